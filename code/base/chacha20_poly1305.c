@@ -0,0 +1,552 @@
+/*
+You can use this C/C++ code however you wish (for example, but not limited to:
+     as is, or by modifying it, or by adding new code, or by removing parts of the code;
+     in public or private projects, in new free or commercial products)
+     only if you get a priori written consent from Petru Soroaga (petrusoroaga@yahoo.com) for your specific use
+     and only if this copyright terms are preserved in the code.
+     This code is public for learning and academic purposes.
+Also, check the licences folder for additional licences terms.
+Code written by: Petru Soroaga, 2021-2023
+*/
+
+#include <string.h>
+#include <stdint.h>
+#include "base.h"
+#include "chacha20_poly1305.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CHACHA20_HAS_SSE2 1
+#include <cpuid.h>
+#include <emmintrin.h>
+#define CHACHA20_SSE2_TARGET __attribute__((target("sse2")))
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define CHACHA20_HAS_NEON 1
+#include <arm_neon.h>
+#endif
+
+typedef void (*t_chacha20_blocks_function)(const u32* pState, u8* pData, int iLength);
+
+static t_chacha20_blocks_function s_pfChaCha20Blocks = NULL;
+static int s_iChaCha20Implementation = -1;
+
+static const char* s_szChaCha20ImplementationNames[CHACHA20_IMPL_COUNT] = { "portable", "sse2", "neon" };
+
+#define CHACHA20_ROTL32(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+
+#define CHACHA20_QUARTERROUND(a, b, c, d) \
+   a += b; d ^= a; d = CHACHA20_ROTL32(d, 16); \
+   c += d; b ^= c; b = CHACHA20_ROTL32(b, 12); \
+   a += b; d ^= a; d = CHACHA20_ROTL32(d, 8); \
+   c += d; b ^= c; b = CHACHA20_ROTL32(b, 7);
+
+static inline u32 _load_le32(const u8* p)
+{
+   return ((u32)p[0]) | (((u32)p[1]) << 8) | (((u32)p[2]) << 16) | (((u32)p[3]) << 24);
+}
+
+static inline void _store_le32(u8* p, u32 v)
+{
+   p[0] = v & 0xFF;
+   p[1] = (v >> 8) & 0xFF;
+   p[2] = (v >> 16) & 0xFF;
+   p[3] = (v >> 24) & 0xFF;
+}
+
+static void _chacha20_init_state(u32* pState, const u8* pKey, const u8* pNonce, u32 uCounter)
+{
+   pState[0] = 0x61707865;
+   pState[1] = 0x3320646e;
+   pState[2] = 0x79622d32;
+   pState[3] = 0x6b206574;
+   for( int i=0; i<8; i++ )
+      pState[4+i] = _load_le32(pKey + 4*i);
+   pState[12] = uCounter;
+   pState[13] = _load_le32(pNonce);
+   pState[14] = _load_le32(pNonce + 4);
+   pState[15] = _load_le32(pNonce + 8);
+}
+
+static void _chacha20_rounds(u32* x)
+{
+   for( int i=0; i<10; i++ )
+   {
+      CHACHA20_QUARTERROUND(x[0], x[4], x[8], x[12]);
+      CHACHA20_QUARTERROUND(x[1], x[5], x[9], x[13]);
+      CHACHA20_QUARTERROUND(x[2], x[6], x[10], x[14]);
+      CHACHA20_QUARTERROUND(x[3], x[7], x[11], x[15]);
+      CHACHA20_QUARTERROUND(x[0], x[5], x[10], x[15]);
+      CHACHA20_QUARTERROUND(x[1], x[6], x[11], x[12]);
+      CHACHA20_QUARTERROUND(x[2], x[7], x[8], x[13]);
+      CHACHA20_QUARTERROUND(x[3], x[4], x[9], x[14]);
+   }
+}
+
+// XORs one key stream block (or the start of it) into pData
+static void _chacha20_block_xor(const u32* pState, u32 uCounter, u8* pData, int iLength)
+{
+   u32 x[16];
+   memcpy(x, pState, sizeof(x));
+   x[12] = uCounter;
+   _chacha20_rounds(x);
+   u8 uStream[64];
+   for( int i=0; i<16; i++ )
+      _store_le32(uStream + 4*i, x[i] + ((12 == i)?uCounter:pState[i]));
+   if ( iLength > 64 )
+      iLength = 64;
+   for( int i=0; i<iLength; i++ )
+      pData[i] ^= uStream[i];
+}
+
+static void _chacha20_blocks_portable(const u32* pState, u8* pData, int iLength)
+{
+   u32 uCounter = pState[12];
+   while ( iLength > 0 )
+   {
+      _chacha20_block_xor(pState, uCounter, pData, iLength);
+      uCounter++;
+      pData += 64;
+      iLength -= 64;
+   }
+}
+
+#ifdef CHACHA20_HAS_SSE2
+
+#define SSE2_ROTL(v, n) _mm_or_si128(_mm_slli_epi32(v, n), _mm_srli_epi32(v, 32-(n)))
+#define SSE2_QUARTERROUND(a, b, c, d) \
+   a = _mm_add_epi32(a, b); d = _mm_xor_si128(d, a); d = SSE2_ROTL(d, 16); \
+   c = _mm_add_epi32(c, d); b = _mm_xor_si128(b, c); b = SSE2_ROTL(b, 12); \
+   a = _mm_add_epi32(a, b); d = _mm_xor_si128(d, a); d = SSE2_ROTL(d, 8); \
+   c = _mm_add_epi32(c, d); b = _mm_xor_si128(b, c); b = SSE2_ROTL(b, 7);
+
+static int _chacha20_sse2_supported()
+{
+#ifdef __x86_64__
+   return 1;
+#else
+   unsigned int eax, ebx, ecx, edx;
+   if ( ! __get_cpuid(1, &eax, &ebx, &ecx, &edx) )
+      return 0;
+   return (edx & bit_SSE2)?1:0;
+#endif
+}
+
+// 4 blocks at a time: vector i holds word i of the 4 blocks
+CHACHA20_SSE2_TARGET
+static void _chacha20_blocks_sse2(const u32* pState, u8* pData, int iLength)
+{
+   u32 uCounter = pState[12];
+   while ( iLength >= 256 )
+   {
+      __m128i s[16], x[16];
+      for( int i=0; i<16; i++ )
+         s[i] = _mm_set1_epi32((int)pState[i]);
+      s[12] = _mm_add_epi32(_mm_set1_epi32((int)uCounter), _mm_setr_epi32(0, 1, 2, 3));
+      for( int i=0; i<16; i++ )
+         x[i] = s[i];
+      for( int i=0; i<10; i++ )
+      {
+         SSE2_QUARTERROUND(x[0], x[4], x[8], x[12]);
+         SSE2_QUARTERROUND(x[1], x[5], x[9], x[13]);
+         SSE2_QUARTERROUND(x[2], x[6], x[10], x[14]);
+         SSE2_QUARTERROUND(x[3], x[7], x[11], x[15]);
+         SSE2_QUARTERROUND(x[0], x[5], x[10], x[15]);
+         SSE2_QUARTERROUND(x[1], x[6], x[11], x[12]);
+         SSE2_QUARTERROUND(x[2], x[7], x[8], x[13]);
+         SSE2_QUARTERROUND(x[3], x[4], x[9], x[14]);
+      }
+      for( int i=0; i<16; i++ )
+         x[i] = _mm_add_epi32(x[i], s[i]);
+
+      // Transpose each group of 4 words to get 16 bytes of each block
+      for( int g=0; g<4; g++ )
+      {
+         __m128i t0 = _mm_unpacklo_epi32(x[4*g], x[4*g+1]);
+         __m128i t1 = _mm_unpacklo_epi32(x[4*g+2], x[4*g+3]);
+         __m128i t2 = _mm_unpackhi_epi32(x[4*g], x[4*g+1]);
+         __m128i t3 = _mm_unpackhi_epi32(x[4*g+2], x[4*g+3]);
+         __m128i b[4];
+         b[0] = _mm_unpacklo_epi64(t0, t1);
+         b[1] = _mm_unpackhi_epi64(t0, t1);
+         b[2] = _mm_unpacklo_epi64(t2, t3);
+         b[3] = _mm_unpackhi_epi64(t2, t3);
+         for( int k=0; k<4; k++ )
+         {
+            __m128i* p = (__m128i*)(pData + 64*k + 16*g);
+            _mm_storeu_si128(p, _mm_xor_si128(_mm_loadu_si128(p), b[k]));
+         }
+      }
+      uCounter += 4;
+      pData += 256;
+      iLength -= 256;
+   }
+   while ( iLength > 0 )
+   {
+      _chacha20_block_xor(pState, uCounter, pData, iLength);
+      uCounter++;
+      pData += 64;
+      iLength -= 64;
+   }
+}
+
+#endif
+
+#ifdef CHACHA20_HAS_NEON
+
+#define NEON_ROTL(v, n) vsriq_n_u32(vshlq_n_u32(v, n), v, 32-(n))
+#define NEON_QUARTERROUND(a, b, c, d) \
+   a = vaddq_u32(a, b); d = veorq_u32(d, a); d = NEON_ROTL(d, 16); \
+   c = vaddq_u32(c, d); b = veorq_u32(b, c); b = NEON_ROTL(b, 12); \
+   a = vaddq_u32(a, b); d = veorq_u32(d, a); d = NEON_ROTL(d, 8); \
+   c = vaddq_u32(c, d); b = veorq_u32(b, c); b = NEON_ROTL(b, 7);
+
+// Same layout as the SSE2 version (little endian)
+static void _chacha20_blocks_neon(const u32* pState, u8* pData, int iLength)
+{
+   static const u32 s_uLanes[4] = { 0, 1, 2, 3 };
+   u32 uCounter = pState[12];
+   while ( iLength >= 256 )
+   {
+      uint32x4_t s[16], x[16];
+      for( int i=0; i<16; i++ )
+         s[i] = vdupq_n_u32(pState[i]);
+      s[12] = vaddq_u32(vdupq_n_u32(uCounter), vld1q_u32(s_uLanes));
+      for( int i=0; i<16; i++ )
+         x[i] = s[i];
+      for( int i=0; i<10; i++ )
+      {
+         NEON_QUARTERROUND(x[0], x[4], x[8], x[12]);
+         NEON_QUARTERROUND(x[1], x[5], x[9], x[13]);
+         NEON_QUARTERROUND(x[2], x[6], x[10], x[14]);
+         NEON_QUARTERROUND(x[3], x[7], x[11], x[15]);
+         NEON_QUARTERROUND(x[0], x[5], x[10], x[15]);
+         NEON_QUARTERROUND(x[1], x[6], x[11], x[12]);
+         NEON_QUARTERROUND(x[2], x[7], x[8], x[13]);
+         NEON_QUARTERROUND(x[3], x[4], x[9], x[14]);
+      }
+      for( int i=0; i<16; i++ )
+         x[i] = vaddq_u32(x[i], s[i]);
+
+      for( int g=0; g<4; g++ )
+      {
+         uint32x4x2_t t01 = vtrnq_u32(x[4*g], x[4*g+1]);
+         uint32x4x2_t t23 = vtrnq_u32(x[4*g+2], x[4*g+3]);
+         uint32x4_t b[4];
+         b[0] = vcombine_u32(vget_low_u32(t01.val[0]), vget_low_u32(t23.val[0]));
+         b[1] = vcombine_u32(vget_low_u32(t01.val[1]), vget_low_u32(t23.val[1]));
+         b[2] = vcombine_u32(vget_high_u32(t01.val[0]), vget_high_u32(t23.val[0]));
+         b[3] = vcombine_u32(vget_high_u32(t01.val[1]), vget_high_u32(t23.val[1]));
+         for( int k=0; k<4; k++ )
+         {
+            u8* p = pData + 64*k + 16*g;
+            vst1q_u8(p, veorq_u8(vld1q_u8(p), vreinterpretq_u8_u32(b[k])));
+         }
+      }
+      uCounter += 4;
+      pData += 256;
+      iLength -= 256;
+   }
+   while ( iLength > 0 )
+   {
+      _chacha20_block_xor(pState, uCounter, pData, iLength);
+      uCounter++;
+      pData += 64;
+      iLength -= 64;
+   }
+}
+
+#endif
+
+static inline t_chacha20_blocks_function _chacha20_get_blocks_function()
+{
+   t_chacha20_blocks_function pf = s_pfChaCha20Blocks;
+   if ( NULL == pf )
+   {
+      int iBest = CHACHA20_IMPL_PORTABLE;
+      if ( chacha20_is_implementation_supported(CHACHA20_IMPL_SSE2) )
+         iBest = CHACHA20_IMPL_SSE2;
+      if ( chacha20_is_implementation_supported(CHACHA20_IMPL_NEON) )
+         iBest = CHACHA20_IMPL_NEON;
+      chacha20_set_implementation(iBest);
+      pf = s_pfChaCha20Blocks;
+   }
+   return pf;
+}
+
+void chacha20_xor(const u8* pKey, const u8* pNonce, u32 uCounter, u8* pData, int iLength)
+{
+   if ( (NULL == pKey) || (NULL == pNonce) || (NULL == pData) || (iLength <= 0) )
+      return;
+   u32 uState[16];
+   _chacha20_init_state(uState, pKey, pNonce, uCounter);
+   _chacha20_get_blocks_function()(uState, pData, iLength);
+}
+
+void hchacha20(u8* pOutput, const u8* pKey, const u8* pInput)
+{
+   u32 x[16];
+   _chacha20_init_state(x, pKey, pInput+4, _load_le32(pInput));
+   _chacha20_rounds(x);
+   for( int i=0; i<4; i++ )
+   {
+      _store_le32(pOutput + 4*i, x[i]);
+      _store_le32(pOutput + 16 + 4*i, x[12+i]);
+   }
+}
+
+//---------------------------------------------------
+// Poly1305, 26 bit limbs (32 bit multiplies, fast on ARMv6/v7 too)
+
+typedef struct
+{
+   u32 r[5];
+   u32 h[5];
+   u32 pad[4];
+   u8 buffer[16];
+   int iBuffered;
+} t_poly1305_state;
+
+static void _poly1305_init(t_poly1305_state* pState, const u8* pKey)
+{
+   pState->r[0] = (_load_le32(pKey + 0)) & 0x3ffffff;
+   pState->r[1] = (_load_le32(pKey + 3) >> 2) & 0x3ffff03;
+   pState->r[2] = (_load_le32(pKey + 6) >> 4) & 0x3ffc0ff;
+   pState->r[3] = (_load_le32(pKey + 9) >> 6) & 0x3f03fff;
+   pState->r[4] = (_load_le32(pKey + 12) >> 8) & 0x00fffff;
+   for( int i=0; i<5; i++ )
+      pState->h[i] = 0;
+   for( int i=0; i<4; i++ )
+      pState->pad[i] = _load_le32(pKey + 16 + 4*i);
+   pState->iBuffered = 0;
+}
+
+static void _poly1305_blocks(t_poly1305_state* pState, const u8* pData, int iLength, u32 uHiBit)
+{
+   const u32 r0 = pState->r[0], r1 = pState->r[1], r2 = pState->r[2], r3 = pState->r[3], r4 = pState->r[4];
+   const u32 s1 = r1*5, s2 = r2*5, s3 = r3*5, s4 = r4*5;
+   u32 h0 = pState->h[0], h1 = pState->h[1], h2 = pState->h[2], h3 = pState->h[3], h4 = pState->h[4];
+
+   while ( iLength >= 16 )
+   {
+      h0 += (_load_le32(pData + 0)) & 0x3ffffff;
+      h1 += (_load_le32(pData + 3) >> 2) & 0x3ffffff;
+      h2 += (_load_le32(pData + 6) >> 4) & 0x3ffffff;
+      h3 += (_load_le32(pData + 9) >> 6) & 0x3ffffff;
+      h4 += (_load_le32(pData + 12) >> 8) | uHiBit;
+
+      uint64_t d0 = (uint64_t)h0*r0 + (uint64_t)h1*s4 + (uint64_t)h2*s3 + (uint64_t)h3*s2 + (uint64_t)h4*s1;
+      uint64_t d1 = (uint64_t)h0*r1 + (uint64_t)h1*r0 + (uint64_t)h2*s4 + (uint64_t)h3*s3 + (uint64_t)h4*s2;
+      uint64_t d2 = (uint64_t)h0*r2 + (uint64_t)h1*r1 + (uint64_t)h2*r0 + (uint64_t)h3*s4 + (uint64_t)h4*s3;
+      uint64_t d3 = (uint64_t)h0*r3 + (uint64_t)h1*r2 + (uint64_t)h2*r1 + (uint64_t)h3*r0 + (uint64_t)h4*s4;
+      uint64_t d4 = (uint64_t)h0*r4 + (uint64_t)h1*r3 + (uint64_t)h2*r2 + (uint64_t)h3*r1 + (uint64_t)h4*r0;
+
+      u32 c = (u32)(d0 >> 26); h0 = (u32)d0 & 0x3ffffff;
+      d1 += c; c = (u32)(d1 >> 26); h1 = (u32)d1 & 0x3ffffff;
+      d2 += c; c = (u32)(d2 >> 26); h2 = (u32)d2 & 0x3ffffff;
+      d3 += c; c = (u32)(d3 >> 26); h3 = (u32)d3 & 0x3ffffff;
+      d4 += c; c = (u32)(d4 >> 26); h4 = (u32)d4 & 0x3ffffff;
+      h0 += c * 5; c = h0 >> 26; h0 &= 0x3ffffff;
+      h1 += c;
+
+      pData += 16;
+      iLength -= 16;
+   }
+   pState->h[0] = h0; pState->h[1] = h1; pState->h[2] = h2; pState->h[3] = h3; pState->h[4] = h4;
+}
+
+static void _poly1305_update(t_poly1305_state* pState, const u8* pData, int iLength)
+{
+   if ( pState->iBuffered > 0 )
+   {
+      int iCopy = 16 - pState->iBuffered;
+      if ( iCopy > iLength )
+         iCopy = iLength;
+      memcpy(pState->buffer + pState->iBuffered, pData, iCopy);
+      pState->iBuffered += iCopy;
+      pData += iCopy;
+      iLength -= iCopy;
+      if ( pState->iBuffered < 16 )
+         return;
+      _poly1305_blocks(pState, pState->buffer, 16, 1 << 24);
+      pState->iBuffered = 0;
+   }
+   int iBlocks = iLength & ~0x0F;
+   if ( iBlocks > 0 )
+      _poly1305_blocks(pState, pData, iBlocks, 1 << 24);
+   if ( iLength > iBlocks )
+   {
+      memcpy(pState->buffer, pData + iBlocks, iLength - iBlocks);
+      pState->iBuffered = iLength - iBlocks;
+   }
+}
+
+// Zero padding to 16 bytes, as the AEAD construction needs for the AAD and the cipher text
+static void _poly1305_pad16(t_poly1305_state* pState)
+{
+   if ( 0 == pState->iBuffered )
+      return;
+   memset(pState->buffer + pState->iBuffered, 0, 16 - pState->iBuffered);
+   _poly1305_blocks(pState, pState->buffer, 16, 1 << 24);
+   pState->iBuffered = 0;
+}
+
+static void _poly1305_finish(t_poly1305_state* pState, u8* pTag)
+{
+   if ( pState->iBuffered > 0 )
+   {
+      pState->buffer[pState->iBuffered] = 1;
+      memset(pState->buffer + pState->iBuffered + 1, 0, 16 - pState->iBuffered - 1);
+      _poly1305_blocks(pState, pState->buffer, 16, 0);
+   }
+
+   u32 h0 = pState->h[0], h1 = pState->h[1], h2 = pState->h[2], h3 = pState->h[3], h4 = pState->h[4];
+   u32 c;
+   c = h1 >> 26; h1 &= 0x3ffffff;
+   h2 += c; c = h2 >> 26; h2 &= 0x3ffffff;
+   h3 += c; c = h3 >> 26; h3 &= 0x3ffffff;
+   h4 += c; c = h4 >> 26; h4 &= 0x3ffffff;
+   h0 += c * 5; c = h0 >> 26; h0 &= 0x3ffffff;
+   h1 += c;
+
+   // h - p, selected if h >= p
+   u32 g0 = h0 + 5; c = g0 >> 26; g0 &= 0x3ffffff;
+   u32 g1 = h1 + c; c = g1 >> 26; g1 &= 0x3ffffff;
+   u32 g2 = h2 + c; c = g2 >> 26; g2 &= 0x3ffffff;
+   u32 g3 = h3 + c; c = g3 >> 26; g3 &= 0x3ffffff;
+   u32 g4 = h4 + c - (1 << 26);
+
+   u32 uMask = (g4 >> 31) - 1;
+   g0 &= uMask; g1 &= uMask; g2 &= uMask; g3 &= uMask; g4 &= uMask;
+   uMask = ~uMask;
+   h0 = (h0 & uMask) | g0;
+   h1 = (h1 & uMask) | g1;
+   h2 = (h2 & uMask) | g2;
+   h3 = (h3 & uMask) | g3;
+   h4 = (h4 & uMask) | g4;
+
+   h0 = (h0 | (h1 << 26));
+   h1 = ((h1 >> 6) | (h2 << 20));
+   h2 = ((h2 >> 12) | (h3 << 14));
+   h3 = ((h3 >> 18) | (h4 << 8));
+
+   uint64_t f;
+   f = (uint64_t)h0 + pState->pad[0]; h0 = (u32)f;
+   f = (uint64_t)h1 + pState->pad[1] + (f >> 32); h1 = (u32)f;
+   f = (uint64_t)h2 + pState->pad[2] + (f >> 32); h2 = (u32)f;
+   f = (uint64_t)h3 + pState->pad[3] + (f >> 32); h3 = (u32)f;
+
+   _store_le32(pTag + 0, h0);
+   _store_le32(pTag + 4, h1);
+   _store_le32(pTag + 8, h2);
+   _store_le32(pTag + 12, h3);
+}
+
+void poly1305_mac(u8* pTag, const u8* pKey, const u8* pData, int iLength)
+{
+   t_poly1305_state state;
+   _poly1305_init(&state, pKey);
+   if ( (NULL != pData) && (iLength > 0) )
+      _poly1305_update(&state, pData, iLength);
+   _poly1305_finish(&state, pTag);
+}
+
+//---------------------------------------------------
+// AEAD
+
+static void _chacha20_poly1305_compute_tag(const u8* pKey, const u8* pNonce, const u8* pAAD, int iAADLength, const u8* pCipherText, int iLength, u8* pTag)
+{
+   // The Poly1305 key is the first 32 bytes of key stream block 0
+   u8 uPolyKey[64];
+   memset(uPolyKey, 0, sizeof(uPolyKey));
+   u32 uState[16];
+   _chacha20_init_state(uState, pKey, pNonce, 0);
+   _chacha20_block_xor(uState, 0, uPolyKey, 64);
+
+   t_poly1305_state state;
+   _poly1305_init(&state, uPolyKey);
+   if ( (NULL != pAAD) && (iAADLength > 0) )
+      _poly1305_update(&state, pAAD, iAADLength);
+   _poly1305_pad16(&state);
+   if ( iLength > 0 )
+      _poly1305_update(&state, pCipherText, iLength);
+   _poly1305_pad16(&state);
+
+   u8 uLengths[16];
+   memset(uLengths, 0, sizeof(uLengths));
+   _store_le32(uLengths, (u32)((iAADLength > 0)?iAADLength:0));
+   _store_le32(uLengths + 8, (u32)((iLength > 0)?iLength:0));
+   _poly1305_update(&state, uLengths, 16);
+   _poly1305_finish(&state, pTag);
+   memset(uPolyKey, 0, sizeof(uPolyKey));
+}
+
+void chacha20_poly1305_encrypt(const u8* pKey, const u8* pNonce, const u8* pAAD, int iAADLength, u8* pData, int iLength, u8* pTag)
+{
+   if ( iLength > 0 )
+      chacha20_xor(pKey, pNonce, 1, pData, iLength);
+   _chacha20_poly1305_compute_tag(pKey, pNonce, pAAD, iAADLength, pData, iLength, pTag);
+}
+
+int chacha20_poly1305_decrypt(const u8* pKey, const u8* pNonce, const u8* pAAD, int iAADLength, u8* pData, int iLength, const u8* pTag)
+{
+   u8 uTag[CHACHA20_POLY1305_TAG_LENGTH];
+   _chacha20_poly1305_compute_tag(pKey, pNonce, pAAD, iAADLength, pData, iLength, uTag);
+
+   // Constant time compare
+   u8 uDiff = 0;
+   for( int i=0; i<CHACHA20_POLY1305_TAG_LENGTH; i++ )
+      uDiff |= uTag[i] ^ pTag[i];
+   if ( 0 != uDiff )
+      return 0;
+   if ( iLength > 0 )
+      chacha20_xor(pKey, pNonce, 1, pData, iLength);
+   return 1;
+}
+
+int chacha20_get_implementation()
+{
+   _chacha20_get_blocks_function();
+   return s_iChaCha20Implementation;
+}
+
+const char* chacha20_get_implementation_name(int iImplementation)
+{
+   if ( (iImplementation < 0) || (iImplementation >= CHACHA20_IMPL_COUNT) )
+      return "none";
+   return s_szChaCha20ImplementationNames[iImplementation];
+}
+
+int chacha20_is_implementation_supported(int iImplementation)
+{
+   if ( CHACHA20_IMPL_PORTABLE == iImplementation )
+      return 1;
+#ifdef CHACHA20_HAS_SSE2
+   if ( CHACHA20_IMPL_SSE2 == iImplementation )
+      return _chacha20_sse2_supported();
+#endif
+#ifdef CHACHA20_HAS_NEON
+   if ( CHACHA20_IMPL_NEON == iImplementation )
+      return 1;
+#endif
+   return 0;
+}
+
+int chacha20_set_implementation(int iImplementation)
+{
+   if ( ! chacha20_is_implementation_supported(iImplementation) )
+      return 0;
+   t_chacha20_blocks_function pf = _chacha20_blocks_portable;
+#ifdef CHACHA20_HAS_SSE2
+   if ( CHACHA20_IMPL_SSE2 == iImplementation )
+      pf = _chacha20_blocks_sse2;
+#endif
+#ifdef CHACHA20_HAS_NEON
+   if ( CHACHA20_IMPL_NEON == iImplementation )
+      pf = _chacha20_blocks_neon;
+#endif
+   s_iChaCha20Implementation = iImplementation;
+   __sync_synchronize();
+   s_pfChaCha20Blocks = pf;
+   return 1;
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include "base.h"
+
+// ChaCha20-Poly1305 authenticated encryption (RFC 8439), used to encrypt radio packets (see encr_aead.h).
+// ChaCha20 runs 4 blocks at a time with SSE2 on x86 and NEON on ARM builds that have it, and one block at
+// a time otherwise; all the implementations give the same output.
+
+#define CHACHA20_POLY1305_KEY_LENGTH 32
+#define CHACHA20_POLY1305_NONCE_LENGTH 12
+#define CHACHA20_POLY1305_TAG_LENGTH 16
+
+#define CHACHA20_IMPL_PORTABLE 0
+#define CHACHA20_IMPL_SSE2 1
+#define CHACHA20_IMPL_NEON 2
+#define CHACHA20_IMPL_COUNT 3
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// XORs the ChaCha20 key stream (starting at block uCounter) into pData, in place
+void chacha20_xor(const u8* pKey, const u8* pNonce, u32 uCounter, u8* pData, int iLength);
+
+// HChaCha20: derives a 32 bytes sub key from a key and 16 bytes of input
+void hchacha20(u8* pOutput, const u8* pKey, const u8* pInput);
+
+void poly1305_mac(u8* pTag, const u8* pKey, const u8* pData, int iLength);
+
+// Encrypts pData in place and writes the tag; the AAD is authenticated, not encrypted
+void chacha20_poly1305_encrypt(const u8* pKey, const u8* pNonce, const u8* pAAD, int iAADLength, u8* pData, int iLength, u8* pTag);
+// Checks the tag, then decrypts pData in place. Returns 0 (and leaves pData unchanged) if the tag is wrong
+int chacha20_poly1305_decrypt(const u8* pKey, const u8* pNonce, const u8* pAAD, int iAADLength, u8* pData, int iLength, const u8* pTag);
+
+int chacha20_get_implementation();
+const char* chacha20_get_implementation_name(int iImplementation);
+int chacha20_is_implementation_supported(int iImplementation);
+// For tests and benchmarks; returns 0 if not supported on this build/CPU
+int chacha20_set_implementation(int iImplementation);
+
+#ifdef __cplusplus
+}  /* end extern "C" */
+#endif
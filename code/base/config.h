@@ -13,6 +13,7 @@
 //#define FEATURE_CHECK_LICENCES 1
 //#define FEATURE_VEHICLE_COMPUTES_ADAPTIVE_VIDEO 1
 //#define FEATURE_MSP_OSD 1
+//#define FEATURE_LATENCY_TRACE 1
 
 #define SYSTEM_NAME "Ruby"
 #define SYSTEM_SW_VERSION_MAJOR 7
@@ -10,6 +10,7 @@
 #define LOG_FILE_VIDEO "logs/log_video.txt"
 #define LOG_FILE_CAPTURE_VEYE "logs/log_capture_veye.txt"
 #define LOG_FILE_VEHICLE "logs/log_vehicle_%s.txt"
+#define FILE_ADAPTIVE_VIDEO_TRACE "logs/adaptive_video_trace.bin"
 
 
 #define FOLDER_RUBY "/home/pi/ruby"
@@ -86,9 +87,10 @@
 #define TEMP_USB_TETHERING_DEVICE "tmp/usb_tethering"
 
 #define TEMP_VIDEO_MEM_FOLDER "tmp/memdisk"
-#define TEMP_VIDEO_MEM_FILE "tmp/memdisk/tmpVideo.h264"
-#define TEMP_VIDEO_FILE "tmp/tmpVideo.h264"
+#define TEMP_VIDEO_MEM_FILE "tmp/memdisk/tmpVideo.mp4"
+#define TEMP_VIDEO_FILE "tmp/tmpVideo.mp4"
 #define TEMP_VIDEO_FILE_INFO "tmp/tmpVideo.info"
+#define TEMP_VIDEO_FILE_PLAYBACK "tmp/tmpVideoPlayback.h264"
 #define TEMP_VIDEO_FILE_PROCESS_ERROR "tmp/tmpErrorVideo.stat"
 
 #define FILE_TMP_UPDATE_IN_PROGRESS "tmp/updateinprogress"
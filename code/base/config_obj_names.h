@@ -5,6 +5,7 @@
 
 #define FIFO_RUBY_STATION_VIDEO_STREAM "tmp/ruby/fifovidstream"
 #define FIFO_RUBY_STATION_VIDEO_STREAM_ETH "tmp/ruby/fifovidstream_eth"
+#define FIFO_RUBY_RC_IN_NOTIFY "tmp/ruby/fiforcinnotify"
 
 #define SEMAPHORE_RESTART_VIDEO_PLAYER "RUBY_SEM_RESTART_VIDEO_PLAYER"
 #define SEMAPHORE_START_VIDEO_RECORD "RUBY_SEM_START_VIDEO_REC"
@@ -0,0 +1,45 @@
+#pragma once
+#include "base.h"
+
+// CRC32 (IEEE 802.3, reflected, the same as base_compute_crc32) used to validate radio and IPC packets.
+// The implementation is picked at first use from what the CPU supports:
+//   ARMv8 CRC32 instructions (checked with the kernel hwcaps),
+//   x86 PCLMULQDQ folding (the SSE4.2 crc32 instruction is CRC32C, a different polynomial, so it can't be used),
+//   portable slice-by-8 tables.
+// All of them give bit exact results with the original byte at a time table code (CRC32_IMPL_BYTEWISE).
+
+#define CRC32_IMPL_BYTEWISE 0
+#define CRC32_IMPL_SLICE8 1
+#define CRC32_IMPL_ARMV8 2
+#define CRC32_IMPL_PCLMUL 3
+#define CRC32_IMPL_COUNT 4
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+u32 crc32_compute(const u8* pBuffer, int iLength);
+
+// Incremental CRC, for packets built or received as chained sub-packets:
+// crc32_end(crc32_update(crc32_update(crc32_begin(), p1, l1), p2, l2)) == crc32_compute() of p1 followed by p2
+u32 crc32_begin();
+u32 crc32_update(u32 uState, const u8* pBuffer, int iLength);
+u32 crc32_end(u32 uState);
+
+// CRC of a packet that stores its own CRC (a u32) at iCRCOffset: the CRC field itself is skipped.
+// Radio packet headers and IPC messages have it at offset 0.
+u32 crc32_compute_skip_field(const u8* pBuffer, int iLength, int iCRCOffset);
+// Computes and stores the CRC at iCRCOffset
+void crc32_store_at(u8* pBuffer, int iLength, int iCRCOffset);
+// Returns 1 if the CRC stored at iCRCOffset matches the packet
+int crc32_check_at(const u8* pBuffer, int iLength, int iCRCOffset);
+
+int crc32_get_implementation();
+const char* crc32_get_implementation_name(int iImplementation);
+int crc32_is_implementation_supported(int iImplementation);
+// For tests and benchmarks; returns 0 if the CPU does not support it
+int crc32_set_implementation(int iImplementation);
+
+#ifdef __cplusplus
+}  /* end extern "C" */
+#endif
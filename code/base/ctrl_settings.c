@@ -76,6 +76,11 @@ void reset_ControllerSettings()
    s_CtrlSettings.iDevSwitchVideoProfileUsingQAButton = -1;
    s_CtrlSettings.iShowControllerAdaptiveInfoStats = 0;
    s_CtrlSettings.iShowVideoStreamInfoCompact = 0;
+   s_CtrlSettings.iAdaptiveVideoController = 0;
+   s_CtrlSettings.iAdaptiveVideoRecordTrace = 0;
+   s_CtrlSettings.iTelemetryHubUDPPort = 0;
+   s_CtrlSettings.iTelemetryHubTCPPort = 0;
+   s_CtrlSettings.iTelemetryHubClientsMaxRateHz = 0;
    log_line("Reseted controller settings.");
 }
 
@@ -120,6 +125,8 @@ int save_ControllerSettings()
    fprintf(fd, "%d %d\n", s_CtrlSettings.iDevSwitchVideoProfileUsingQAButton, s_CtrlSettings.iShowControllerAdaptiveInfoStats);
    fprintf(fd, "%d\n", s_CtrlSettings.iShowVideoStreamInfoCompact);
    fprintf(fd, "%d\n", s_CtrlSettings.iTXPowerSiK);
+   fprintf(fd, "%d %d\n", s_CtrlSettings.iAdaptiveVideoController, s_CtrlSettings.iAdaptiveVideoRecordTrace);
+   fprintf(fd, "%d %d %d\n", s_CtrlSettings.iTelemetryHubUDPPort, s_CtrlSettings.iTelemetryHubTCPPort, s_CtrlSettings.iTelemetryHubClientsMaxRateHz);
    fclose(fd);
 
    log_line("Saved controller settings to file: %s", FILE_CONTROLLER_SETTINGS);
@@ -282,6 +289,14 @@ int load_ControllerSettings()
    if ( (!failed) && ( 1 != fscanf(fd, "%d", &s_CtrlSettings.iTXPowerSiK)) )
       s_CtrlSettings.iTXPowerSiK = DEFAULT_RADIO_SIK_TX_POWER;
 
+   if ( (!failed) && ( 1 != fscanf(fd, "%d", &s_CtrlSettings.iAdaptiveVideoController)) )
+      s_CtrlSettings.iAdaptiveVideoController = 0;
+   if ( (!failed) && ( 1 != fscanf(fd, "%d", &s_CtrlSettings.iAdaptiveVideoRecordTrace)) )
+      s_CtrlSettings.iAdaptiveVideoRecordTrace = 0;
+
+   if ( (!failed) && ( 3 != fscanf(fd, "%d %d %d", &s_CtrlSettings.iTelemetryHubUDPPort, &s_CtrlSettings.iTelemetryHubTCPPort, &s_CtrlSettings.iTelemetryHubClientsMaxRateHz)) )
+      { s_CtrlSettings.iTelemetryHubUDPPort = 0; s_CtrlSettings.iTelemetryHubTCPPort = 0; s_CtrlSettings.iTelemetryHubClientsMaxRateHz = 0; }
+
    fclose(fd);
 
    // Validate settings
@@ -306,6 +321,18 @@ int load_ControllerSettings()
    if ( s_CtrlSettings.iTXPowerSiK > 20 )
       s_CtrlSettings.iTXPowerSiK = DEFAULT_RADIO_SIK_TX_POWER;
      
+   if ( s_CtrlSettings.iAdaptiveVideoController < 0 || s_CtrlSettings.iAdaptiveVideoController > 1 )
+      s_CtrlSettings.iAdaptiveVideoController = 0;
+   if ( s_CtrlSettings.iAdaptiveVideoRecordTrace < 0 || s_CtrlSettings.iAdaptiveVideoRecordTrace > 1 )
+      s_CtrlSettings.iAdaptiveVideoRecordTrace = 0;
+
+   if ( s_CtrlSettings.iTelemetryHubUDPPort < 0 || s_CtrlSettings.iTelemetryHubUDPPort > 65535 )
+      s_CtrlSettings.iTelemetryHubUDPPort = 0;
+   if ( s_CtrlSettings.iTelemetryHubTCPPort < 0 || s_CtrlSettings.iTelemetryHubTCPPort > 65535 )
+      s_CtrlSettings.iTelemetryHubTCPPort = 0;
+   if ( s_CtrlSettings.iTelemetryHubClientsMaxRateHz < 0 || s_CtrlSettings.iTelemetryHubClientsMaxRateHz > 100 )
+      s_CtrlSettings.iTelemetryHubClientsMaxRateHz = 0;
+
    if ( s_CtrlSettings.iRenderFPS < 10 || s_CtrlSettings.iRenderFPS > 30 )
       s_CtrlSettings.iRenderFPS = 10;
 
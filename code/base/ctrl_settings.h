@@ -62,6 +62,11 @@ typedef struct
    int iDevSwitchVideoProfileUsingQAButton;
    int iShowControllerAdaptiveInfoStats;
    int iShowVideoStreamInfoCompact;
+   int iAdaptiveVideoController; // 0 - baseline (thresholds), 1 - estimator (see common/adaptive_video_controllers.h)
+   int iAdaptiveVideoRecordTrace; // 0 - disabled, 1 - record the adaptive video intervals to FILE_ADAPTIVE_VIDEO_TRACE
+   int iTelemetryHubUDPPort; // 0 - disabled; GCSes that send to this port get the telemetry (see common/telemetry_hub.h)
+   int iTelemetryHubTCPPort; // 0 - disabled
+   int iTelemetryHubClientsMaxRateHz; // 0 - no limit; max rate of each stream message sent to the UDP/TCP clients
 
 } ControllerSettings;
 
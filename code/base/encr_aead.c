@@ -0,0 +1,217 @@
+/*
+You can use this C/C++ code however you wish (for example, but not limited to:
+     as is, or by modifying it, or by adding new code, or by removing parts of the code;
+     in public or private projects, in new free or commercial products)
+     only if you get a priori written consent from Petru Soroaga (petrusoroaga@yahoo.com) for your specific use
+     and only if this copyright terms are preserved in the code.
+     This code is public for learning and academic purposes.
+Also, check the licences folder for additional licences terms.
+Code written by: Petru Soroaga, 2021-2023
+*/
+
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "base.h"
+#include "crc32.h"
+#include "encr_aead.h"
+#include "../radio/radiopackets2.h"
+
+static u8 s_uAEADPassPhrase[MAX_PASS_LENGTH];
+static int s_iAEADPassPhraseLength = -1;
+static int s_bAEADFixedPassPhrase = 0;
+static u8 s_uAEADKey[CHACHA20_POLY1305_KEY_LENGTH];
+
+static u32 s_uAEADEpoch = 0;
+static int s_bAEADEpochSet = 0;
+static u32 s_uAEADLastStreamIndex[MAX_RADIO_STREAMS];
+
+// Key = HChaCha20 cascade over the padded pass phrase, 16 bytes at a time, starting from a fixed key
+static void _encr_aead_derive_key(const u8* pPass, int iPassLength)
+{
+   u8 uInput[MAX_PASS_LENGTH + 32];
+   memset(uInput, 0, sizeof(uInput));
+   memcpy(uInput, pPass, iPassLength);
+   uInput[iPassLength] = 0x80;
+   int iInputLength = ((iPassLength + 2 + 15)/16)*16;
+   uInput[iInputLength-1] = (u8)iPassLength;
+
+   memset(s_uAEADKey, 0, sizeof(s_uAEADKey));
+   strcpy((char*)s_uAEADKey, "RubyFPV radio link AEAD key v1");
+   for( int i=0; i<iInputLength; i += 16 )
+   {
+      u8 uNext[CHACHA20_POLY1305_KEY_LENGTH];
+      hchacha20(uNext, s_uAEADKey, uInput + i);
+      memcpy(s_uAEADKey, uNext, sizeof(s_uAEADKey));
+   }
+   memset(uInput, 0, sizeof(uInput));
+}
+
+static const u8* _encr_aead_get_key()
+{
+   if ( s_bAEADFixedPassPhrase )
+      return s_uAEADKey;
+   if ( ! hpp() )
+      return NULL;
+   int iLength = 0;
+   u8* pPass = gpp(&iLength);
+   if ( (NULL == pPass) || (iLength <= 0) )
+      return NULL;
+   if ( iLength > MAX_PASS_LENGTH )
+      iLength = MAX_PASS_LENGTH;
+
+   if ( (iLength != s_iAEADPassPhraseLength) || (0 != memcmp(pPass, s_uAEADPassPhrase, iLength)) )
+   {
+      memcpy(s_uAEADPassPhrase, pPass, iLength);
+      s_iAEADPassPhraseLength = iLength;
+      _encr_aead_derive_key(pPass, iLength);
+      log_line("[Encr] Derived the radio packets encryption key from the current pass phrase.");
+   }
+   return s_uAEADKey;
+}
+
+static void _encr_aead_init_epoch()
+{
+   u32 uEpoch = 0;
+   FILE* fd = fopen("/dev/urandom", "rb");
+   if ( NULL != fd )
+   {
+      if ( 1 != fread(&uEpoch, sizeof(u32), 1, fd) )
+         uEpoch = 0;
+      fclose(fd);
+   }
+   if ( 0 == uEpoch )
+      uEpoch = ((u32)time(NULL)) ^ (((u32)getpid()) << 16) ^ get_current_timestamp_micros();
+   s_uAEADEpoch = uEpoch;
+   for( int i=0; i<MAX_RADIO_STREAMS; i++ )
+      s_uAEADLastStreamIndex[i] = 0;
+   s_bAEADEpochSet = 1;
+}
+
+static void _encr_aead_build_nonce(u8* pNonce, const t_packet_header* pPH, u32 uEpoch)
+{
+   memcpy(pNonce, &pPH->vehicle_id_src, sizeof(u32));
+   memcpy(pNonce + 4, &pPH->stream_packet_idx, sizeof(u32));
+   memcpy(pNonce + 8, &uEpoch, sizeof(u32));
+}
+
+static void _encr_aead_update_crc(u8* pPacket)
+{
+   t_packet_header* pPH = (t_packet_header*)pPacket;
+   if ( pPH->packet_flags & PACKET_FLAGS_BIT_HEADERS_ONLY_CRC )
+      pPH->crc = crc32_compute(pPacket + sizeof(u32), pPH->total_headers_length - sizeof(u32));
+   else
+      pPH->crc = crc32_compute(pPacket + sizeof(u32), pPH->total_length - sizeof(u32));
+}
+
+int encr_aead_has_key()
+{
+   return (NULL != _encr_aead_get_key())?1:0;
+}
+
+void encr_aead_reset_key()
+{
+   s_bAEADFixedPassPhrase = 0;
+   s_iAEADPassPhraseLength = -1;
+   memset(s_uAEADPassPhrase, 0, sizeof(s_uAEADPassPhrase));
+   memset(s_uAEADKey, 0, sizeof(s_uAEADKey));
+}
+
+void encr_aead_set_pass_phrase(const u8* pPass, int iLength)
+{
+   if ( (NULL == pPass) || (iLength <= 0) )
+      return;
+   if ( iLength > MAX_PASS_LENGTH )
+      iLength = MAX_PASS_LENGTH;
+   memcpy(s_uAEADPassPhrase, pPass, iLength);
+   s_iAEADPassPhraseLength = iLength;
+   _encr_aead_derive_key(pPass, iLength);
+   s_bAEADFixedPassPhrase = 1;
+}
+
+int encr_aead_seal_packets(const u8* pInput, int iInputLength, u8* pOutput, int iMaxOutputLength)
+{
+   if ( (NULL == pInput) || (NULL == pOutput) || (iInputLength <= 0) )
+      return -1;
+   const u8* pKey = _encr_aead_get_key();
+   if ( NULL == pKey )
+      return -1;
+   if ( ! s_bAEADEpochSet )
+      _encr_aead_init_epoch();
+
+   int iOutputLength = 0;
+   while ( iInputLength > 0 )
+   {
+      const t_packet_header* pPHIn = (const t_packet_header*)pInput;
+      int iLength = pPHIn->total_length;
+      if ( (iInputLength < (int)sizeof(t_packet_header)) || (iLength < (int)sizeof(t_packet_header)) || (iLength > iInputLength) )
+         return -1;
+      if ( iOutputLength + iLength + ENCR_AEAD_OVERHEAD > iMaxOutputLength )
+         return -1;
+
+      u8* pOut = pOutput + iOutputLength;
+      memcpy(pOut, pInput, iLength);
+      t_packet_header* pPH = (t_packet_header*)pOut;
+      pPH->total_length = (u16)(iLength + ENCR_AEAD_OVERHEAD);
+      pPH->extra_flags |= PACKET_EXTRA_FLAGS_VALID | PACKET_EXTRA_FLAGS_BIT_AEAD;
+
+      u32 uStreamId = (pPH->stream_packet_idx) >> PACKET_FLAGS_MASK_SHIFT_STREAM_INDEX;
+      u32 uIndex = pPH->stream_packet_idx & PACKET_FLAGS_MASK_STREAM_PACKET_IDX;
+      if ( uStreamId < MAX_RADIO_STREAMS )
+      {
+         if ( uIndex < s_uAEADLastStreamIndex[uStreamId] )
+            s_uAEADEpoch++;
+         s_uAEADLastStreamIndex[uStreamId] = uIndex;
+      }
+
+      u8 uNonce[CHACHA20_POLY1305_NONCE_LENGTH];
+      _encr_aead_build_nonce(uNonce, pPH, s_uAEADEpoch);
+      memcpy(pOut + iLength, &s_uAEADEpoch, sizeof(u32));
+      chacha20_poly1305_encrypt(pKey, uNonce, pOut + sizeof(u32), sizeof(t_packet_header) - sizeof(u32),
+         pOut + sizeof(t_packet_header), iLength - sizeof(t_packet_header), pOut + iLength + ENCR_AEAD_EPOCH_LENGTH);
+      _encr_aead_update_crc(pOut);
+
+      iOutputLength += iLength + ENCR_AEAD_OVERHEAD;
+      pInput += iLength;
+      iInputLength -= iLength;
+   }
+   return iOutputLength;
+}
+
+int encr_aead_is_sealed_packet(const u8* pPacket)
+{
+   if ( NULL == pPacket )
+      return 0;
+   const t_packet_header* pPH = (const t_packet_header*)pPacket;
+   if ( (pPH->extra_flags & PACKET_EXTRA_FLAGS_VALID) && (pPH->extra_flags & PACKET_EXTRA_FLAGS_BIT_AEAD) )
+      return 1;
+   return 0;
+}
+
+int encr_aead_open_packet(u8* pPacket, int iLength)
+{
+   if ( ! encr_aead_is_sealed_packet(pPacket) )
+      return 0;
+   t_packet_header* pPH = (t_packet_header*)pPacket;
+   int iTotalLength = pPH->total_length;
+   if ( (iTotalLength > iLength) || (iTotalLength < (int)sizeof(t_packet_header) + ENCR_AEAD_OVERHEAD) )
+      return 0;
+   const u8* pKey = _encr_aead_get_key();
+   if ( NULL == pKey )
+      return 0;
+
+   int iPlainLength = iTotalLength - ENCR_AEAD_OVERHEAD;
+   u32 uEpoch;
+   memcpy(&uEpoch, pPacket + iPlainLength, sizeof(u32));
+   u8 uNonce[CHACHA20_POLY1305_NONCE_LENGTH];
+   _encr_aead_build_nonce(uNonce, pPH, uEpoch);
+
+   if ( ! chacha20_poly1305_decrypt(pKey, uNonce, pPacket + sizeof(u32), sizeof(t_packet_header) - sizeof(u32),
+         pPacket + sizeof(t_packet_header), iPlainLength - sizeof(t_packet_header), pPacket + iPlainLength + ENCR_AEAD_EPOCH_LENGTH) )
+      return 0;
+
+   pPH->total_length = (u16)iPlainLength;
+   pPH->extra_flags &= ~PACKET_EXTRA_FLAGS_BIT_AEAD;
+   _encr_aead_update_crc(pPacket);
+   return iPlainLength;
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include "base.h"
+#include "encr.h"
+#include "chacha20_poly1305.h"
+
+// Authenticated encryption of radio packets (ChaCha20-Poly1305), next to the epp/dpp buffer encryption.
+// The key is derived once from the current pass phrase (lpp/gpp) and cached until the pass phrase changes.
+//
+// A sealed packet keeps its t_packet_header in clear (authenticated, marked with PACKET_EXTRA_FLAGS_BIT_AEAD)
+// and has everything after it encrypted, followed by a trailer: u32 nonce epoch + 16 bytes tag.
+// The nonce is vehicle_id_src + stream_packet_idx + epoch; the epoch is random for each sender process
+// and changes when a stream packet index wraps, so a nonce is never used twice with the same key.
+
+#define ENCR_AEAD_EPOCH_LENGTH 4
+#define ENCR_AEAD_OVERHEAD (ENCR_AEAD_EPOCH_LENGTH + CHACHA20_POLY1305_TAG_LENGTH)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Returns 1 if there is a pass phrase to encrypt with (hpp)
+int encr_aead_has_key();
+// Forces the key to be derived again from the current pass phrase on next use
+void encr_aead_reset_key();
+// Uses this pass phrase instead of the current one until encr_aead_reset_key (for tests and tools)
+void encr_aead_set_pass_phrase(const u8* pPass, int iLength);
+
+// Seals all the chained radio packets in pInput into pOutput (each one grows by ENCR_AEAD_OVERHEAD bytes).
+// Returns the output length, or -1 if there is no key or the output buffer is too small.
+int encr_aead_seal_packets(const u8* pInput, int iInputLength, u8* pOutput, int iMaxOutputLength);
+
+int encr_aead_is_sealed_packet(const u8* pPacket);
+// Checks and decrypts one sealed radio packet in place; its total_length shrinks by ENCR_AEAD_OVERHEAD.
+// Returns the new packet length, or 0 if the packet is not authentic (it is left unchanged).
+int encr_aead_open_packet(u8* pPacket, int iLength);
+
+#ifdef __cplusplus
+}  /* end extern "C" */
+#endif
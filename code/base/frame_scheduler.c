@@ -0,0 +1,418 @@
+/*
+You can use this C/C++ code however you wish (for example, but not limited to:
+     as is, or by modifying it, or by adding new code, or by removing parts of the code;
+     in public or private projects, in new free or commercial products)
+     only if you get a priori written consent from Petru Soroaga (petrusoroaga@yahoo.com) for your specific use
+     and only if this copyright terms are preserved in the code.
+     This code is public for learning and academic purposes.
+Also, check the licences folder for additional licences terms.
+Code written by: Petru Soroaga, 2021-2023
+*/
+
+#include <pthread.h>
+
+#include "base.h"
+#include "frame_scheduler.h"
+
+typedef struct
+{
+   char szName[FRAME_SCHEDULER_MAX_NAME];
+   int iPriority;
+   u32 uPeriodMicros;
+   u32 uFlags;
+   frame_scheduler_task_callback pfCallback;
+   void* pContext;
+
+   u32 uNextDueMicros;
+   int bDeferred; // held back in the current pass
+   u32 uDeferredCount; // consecutive
+
+   t_frame_scheduler_task_stats stats;
+} t_frame_scheduled_task;
+
+static t_frame_scheduled_task s_FrameSchedulerTasks[FRAME_SCHEDULER_MAX_TASKS];
+static int s_iFrameSchedulerCountTasks = 0;
+
+static u32 (*s_pfFrameSchedulerGetTime)(void* pContext) = NULL;
+static void* s_pFrameSchedulerTimeContext = NULL;
+
+// Worker thread, runs one task at a time. The stats of the worker tasks are updated under the mutex.
+static pthread_mutex_t s_FrameSchedulerWorkerMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t s_FrameSchedulerWorkerCond = PTHREAD_COND_INITIALIZER;
+static pthread_t s_FrameSchedulerWorkerThread;
+static int s_iFrameSchedulerWorkerStarted = 0;
+static int s_iFrameSchedulerWorkerQuit = 0;
+static int s_iFrameSchedulerWorkerTask = -1;
+static u32 s_uFrameSchedulerWorkerBudget = 0;
+
+static u32 _frame_scheduler_now_micros()
+{
+   if ( NULL != s_pfFrameSchedulerGetTime )
+      return s_pfFrameSchedulerGetTime(s_pFrameSchedulerTimeContext);
+   return get_current_timestamp_micros();
+}
+
+static int _frame_scheduler_is_due(t_frame_scheduled_task* pTask, u32 uTimeNow)
+{
+   return ((int)(pTask->uNextDueMicros - uTimeNow)) <= 0;
+}
+
+static void _frame_scheduler_update_duration(t_frame_scheduled_task* pTask, u32 uDuration)
+{
+   pTask->stats.uLastDurationMicros = uDuration;
+   if ( uDuration > pTask->stats.uMaxDurationMicros )
+      pTask->stats.uMaxDurationMicros = uDuration;
+   if ( 0 == pTask->stats.uRuns )
+      pTask->stats.uAvgDurationMicros = uDuration;
+   else
+      pTask->stats.uAvgDurationMicros = (pTask->stats.uAvgDurationMicros*4 + uDuration)/5;
+}
+
+// Updates the lateness stats and moves the task to its next period
+static void _frame_scheduler_start_task(t_frame_scheduled_task* pTask, u32 uTimeNow)
+{
+   int iLateness = (int)(uTimeNow - pTask->uNextDueMicros);
+   if ( iLateness < 0 )
+      iLateness = 0;
+   if ( (u32)iLateness > pTask->stats.uMaxLatenessMicros )
+      pTask->stats.uMaxLatenessMicros = (u32)iLateness;
+   if ( pTask->uPeriodMicros > 0 )
+   if ( (u32)iLateness*100 > pTask->uPeriodMicros*FRAME_SCHEDULER_MISS_PERCENT )
+      pTask->stats.uDeadlineMisses++;
+
+   pTask->uDeferredCount = 0;
+   pTask->uNextDueMicros += pTask->uPeriodMicros;
+   // A full period behind: restart from now instead of running it back to back to catch up
+   if ( _frame_scheduler_is_due(pTask, uTimeNow) )
+      pTask->uNextDueMicros = uTimeNow + pTask->uPeriodMicros;
+}
+
+static void _frame_scheduler_run_task(t_frame_scheduled_task* pTask, u32 uBudget)
+{
+   u32 uTimeStart = _frame_scheduler_now_micros();
+   pTask->pfCallback(pTask->pContext, uBudget);
+   _frame_scheduler_update_duration(pTask, _frame_scheduler_now_micros() - uTimeStart);
+   pTask->stats.uRuns++;
+}
+
+static void* _frame_scheduler_worker_thread(void *argument)
+{
+   log_line("[FrameScheduler] Started worker thread.");
+   pthread_mutex_lock(&s_FrameSchedulerWorkerMutex);
+   while ( ! s_iFrameSchedulerWorkerQuit )
+   {
+      if ( s_iFrameSchedulerWorkerTask < 0 )
+      {
+         pthread_cond_wait(&s_FrameSchedulerWorkerCond, &s_FrameSchedulerWorkerMutex);
+         continue;
+      }
+      t_frame_scheduled_task* pTask = &(s_FrameSchedulerTasks[s_iFrameSchedulerWorkerTask]);
+      frame_scheduler_task_callback pfCallback = pTask->pfCallback;
+      void* pContext = pTask->pContext;
+      u32 uBudget = s_uFrameSchedulerWorkerBudget;
+      pthread_mutex_unlock(&s_FrameSchedulerWorkerMutex);
+
+      u32 uTimeStart = _frame_scheduler_now_micros();
+      pfCallback(pContext, uBudget);
+      u32 uDuration = _frame_scheduler_now_micros() - uTimeStart;
+
+      pthread_mutex_lock(&s_FrameSchedulerWorkerMutex);
+      _frame_scheduler_update_duration(pTask, uDuration);
+      pTask->stats.uRuns++;
+      s_iFrameSchedulerWorkerTask = -1;
+      pthread_cond_broadcast(&s_FrameSchedulerWorkerCond);
+   }
+   pthread_mutex_unlock(&s_FrameSchedulerWorkerMutex);
+   log_line("[FrameScheduler] Stopped worker thread.");
+   return NULL;
+}
+
+static int _frame_scheduler_start_worker()
+{
+   if ( s_iFrameSchedulerWorkerStarted )
+      return 1;
+   s_iFrameSchedulerWorkerQuit = 0;
+   s_iFrameSchedulerWorkerTask = -1;
+   if ( 0 != pthread_create(&s_FrameSchedulerWorkerThread, NULL, &_frame_scheduler_worker_thread, NULL) )
+   {
+      log_softerror_and_alarm("[FrameScheduler] Failed to create the worker thread.");
+      return 0;
+   }
+   s_iFrameSchedulerWorkerStarted = 1;
+   return 1;
+}
+
+static void _frame_scheduler_stop_worker()
+{
+   if ( ! s_iFrameSchedulerWorkerStarted )
+      return;
+   pthread_mutex_lock(&s_FrameSchedulerWorkerMutex);
+   s_iFrameSchedulerWorkerQuit = 1;
+   pthread_cond_broadcast(&s_FrameSchedulerWorkerCond);
+   pthread_mutex_unlock(&s_FrameSchedulerWorkerMutex);
+   pthread_join(s_FrameSchedulerWorkerThread, NULL);
+   s_iFrameSchedulerWorkerStarted = 0;
+   s_iFrameSchedulerWorkerTask = -1;
+}
+
+// Returns 0 if the worker is still busy with a previous task
+static int _frame_scheduler_dispatch_to_worker(int iTask, u32 uBudget)
+{
+   int bDispatched = 0;
+   pthread_mutex_lock(&s_FrameSchedulerWorkerMutex);
+   if ( s_iFrameSchedulerWorkerTask < 0 )
+   {
+      s_iFrameSchedulerWorkerTask = iTask;
+      s_uFrameSchedulerWorkerBudget = uBudget;
+      pthread_cond_broadcast(&s_FrameSchedulerWorkerCond);
+      bDispatched = 1;
+   }
+   pthread_mutex_unlock(&s_FrameSchedulerWorkerMutex);
+   return bDispatched;
+}
+
+// Returns the micros until the earliest critical deadline, or 0xFFFFFFFF if there is no critical task
+static u32 _frame_scheduler_get_critical_budget(u32 uTimeNow)
+{
+   u32 uBudget = 0xFFFFFFFF;
+   for( int i=0; i<s_iFrameSchedulerCountTasks; i++ )
+   {
+      t_frame_scheduled_task* pTask = &(s_FrameSchedulerTasks[i]);
+      if ( (pTask->iPriority != FRAME_SCHEDULER_PRIORITY_CRITICAL) || (pTask->uFlags & (FRAME_SCHEDULER_FLAG_IDLE | FRAME_SCHEDULER_FLAG_WORKER)) )
+         continue;
+      int iLeft = (int)(pTask->uNextDueMicros - uTimeNow);
+      if ( iLeft <= 0 )
+         return 0;
+      if ( (u32)iLeft < uBudget )
+         uBudget = (u32)iLeft;
+   }
+   return uBudget;
+}
+
+// Micros until the next due task, not counting the ones held back in this pass
+static u32 _frame_scheduler_get_micros_to_next_due(u32 uTimeNow)
+{
+   u32 uMicros = FRAME_SCHEDULER_MAX_IDLE_MICROS;
+   for( int i=0; i<s_iFrameSchedulerCountTasks; i++ )
+   {
+      t_frame_scheduled_task* pTask = &(s_FrameSchedulerTasks[i]);
+      if ( (pTask->uFlags & FRAME_SCHEDULER_FLAG_IDLE) || pTask->bDeferred )
+         continue;
+      int iLeft = (int)(pTask->uNextDueMicros - uTimeNow);
+      if ( iLeft <= 0 )
+         return 0;
+      if ( (u32)iLeft < uMicros )
+         uMicros = (u32)iLeft;
+   }
+   return uMicros;
+}
+
+void frame_scheduler_init(u32 (*pfGetTimeMicros)(void* pContext), void* pContext)
+{
+   frame_scheduler_release();
+   s_pfFrameSchedulerGetTime = pfGetTimeMicros;
+   s_pFrameSchedulerTimeContext = pContext;
+   log_line("[FrameScheduler] Init (%s clock).", (NULL != pfGetTimeMicros)?"custom":"system");
+}
+
+void frame_scheduler_release()
+{
+   _frame_scheduler_stop_worker();
+   s_iFrameSchedulerCountTasks = 0;
+}
+
+int frame_scheduler_add_task(const char* szName, int iPriority, u32 uPeriodMicros, u32 uCostMicros, u32 uFlags, frame_scheduler_task_callback pfCallback, void* pContext)
+{
+   if ( (NULL == pfCallback) || (s_iFrameSchedulerCountTasks >= FRAME_SCHEDULER_MAX_TASKS) )
+   {
+      log_softerror_and_alarm("[FrameScheduler] Can't add task %s (%d tasks already).", (NULL != szName)?szName:"N/A", s_iFrameSchedulerCountTasks);
+      return -1;
+   }
+   if ( (uFlags & FRAME_SCHEDULER_FLAG_WORKER) && (! _frame_scheduler_start_worker()) )
+      return -1;
+
+   t_frame_scheduled_task* pTask = &(s_FrameSchedulerTasks[s_iFrameSchedulerCountTasks]);
+   memset(pTask, 0, sizeof(t_frame_scheduled_task));
+   if ( NULL != szName )
+      strncpy(pTask->szName, szName, FRAME_SCHEDULER_MAX_NAME-1);
+   pTask->iPriority = iPriority;
+   if ( pTask->iPriority < FRAME_SCHEDULER_PRIORITY_CRITICAL )
+      pTask->iPriority = FRAME_SCHEDULER_PRIORITY_CRITICAL;
+   if ( pTask->iPriority > FRAME_SCHEDULER_PRIORITY_LOW )
+      pTask->iPriority = FRAME_SCHEDULER_PRIORITY_LOW;
+   pTask->uPeriodMicros = uPeriodMicros;
+   pTask->uFlags = uFlags;
+   pTask->pfCallback = pfCallback;
+   pTask->pContext = pContext;
+   pTask->uNextDueMicros = _frame_scheduler_now_micros();
+   pTask->stats.uAvgDurationMicros = uCostMicros;
+
+   s_iFrameSchedulerCountTasks++;
+   log_line("[FrameScheduler] Added task %d: %s, priority %d, period %u us, cost %u us, flags 0x%02X.",
+      s_iFrameSchedulerCountTasks-1, pTask->szName, pTask->iPriority, uPeriodMicros, uCostMicros, uFlags);
+   return s_iFrameSchedulerCountTasks-1;
+}
+
+void frame_scheduler_set_task_period(int iTask, u32 uPeriodMicros)
+{
+   if ( (iTask < 0) || (iTask >= s_iFrameSchedulerCountTasks) )
+      return;
+   t_frame_scheduled_task* pTask = &(s_FrameSchedulerTasks[iTask]);
+   if ( pTask->uPeriodMicros == uPeriodMicros )
+      return;
+   log_line("[FrameScheduler] Task %s period changed from %u us to %u us.", pTask->szName, pTask->uPeriodMicros, uPeriodMicros);
+   pTask->uPeriodMicros = uPeriodMicros;
+   u32 uTimeNow = _frame_scheduler_now_micros();
+   if ( (int)(pTask->uNextDueMicros - uTimeNow) > (int)uPeriodMicros )
+      pTask->uNextDueMicros = uTimeNow + uPeriodMicros;
+}
+
+u32 frame_scheduler_get_task_period(int iTask)
+{
+   if ( (iTask < 0) || (iTask >= s_iFrameSchedulerCountTasks) )
+      return 0;
+   return s_FrameSchedulerTasks[iTask].uPeriodMicros;
+}
+
+int frame_scheduler_get_tasks_count()
+{
+   return s_iFrameSchedulerCountTasks;
+}
+
+const char* frame_scheduler_get_task_name(int iTask)
+{
+   if ( (iTask < 0) || (iTask >= s_iFrameSchedulerCountTasks) )
+      return "N/A";
+   return s_FrameSchedulerTasks[iTask].szName;
+}
+
+int frame_scheduler_get_task_stats(int iTask, t_frame_scheduler_task_stats* pStats)
+{
+   if ( (iTask < 0) || (iTask >= s_iFrameSchedulerCountTasks) || (NULL == pStats) )
+      return 0;
+   pthread_mutex_lock(&s_FrameSchedulerWorkerMutex);
+   memcpy(pStats, &(s_FrameSchedulerTasks[iTask].stats), sizeof(t_frame_scheduler_task_stats));
+   pthread_mutex_unlock(&s_FrameSchedulerWorkerMutex);
+   return 1;
+}
+
+void frame_scheduler_reset_stats()
+{
+   pthread_mutex_lock(&s_FrameSchedulerWorkerMutex);
+   for( int i=0; i<s_iFrameSchedulerCountTasks; i++ )
+   {
+      // Keep the cost estimate
+      u32 uAvg = s_FrameSchedulerTasks[i].stats.uAvgDurationMicros;
+      memset(&(s_FrameSchedulerTasks[i].stats), 0, sizeof(t_frame_scheduler_task_stats));
+      s_FrameSchedulerTasks[i].stats.uAvgDurationMicros = uAvg;
+   }
+   pthread_mutex_unlock(&s_FrameSchedulerWorkerMutex);
+}
+
+u32 frame_scheduler_run()
+{
+   int iDueTasks[FRAME_SCHEDULER_MAX_TASKS];
+   int iCountDue = 0;
+   u32 uTimeNow = _frame_scheduler_now_micros();
+
+   for( int i=0; i<s_iFrameSchedulerCountTasks; i++ )
+   {
+      t_frame_scheduled_task* pTask = &(s_FrameSchedulerTasks[i]);
+      pTask->bDeferred = 0;
+      if ( pTask->uFlags & FRAME_SCHEDULER_FLAG_IDLE )
+         continue;
+      if ( ! _frame_scheduler_is_due(pTask, uTimeNow) )
+         continue;
+
+      // Insert sorted by priority, then by deadline
+      int iPos = iCountDue;
+      while ( iPos > 0 )
+      {
+         t_frame_scheduled_task* pPrev = &(s_FrameSchedulerTasks[iDueTasks[iPos-1]]);
+         if ( pPrev->iPriority < pTask->iPriority )
+            break;
+         if ( (pPrev->iPriority == pTask->iPriority) && ((int)(pPrev->uNextDueMicros - pTask->uNextDueMicros) <= 0) )
+            break;
+         iDueTasks[iPos] = iDueTasks[iPos-1];
+         iPos--;
+      }
+      iDueTasks[iPos] = i;
+      iCountDue++;
+   }
+
+   for( int k=0; k<iCountDue; k++ )
+   {
+      t_frame_scheduled_task* pTask = &(s_FrameSchedulerTasks[iDueTasks[k]]);
+      uTimeNow = _frame_scheduler_now_micros();
+      u32 uBudget = _frame_scheduler_get_critical_budget(uTimeNow);
+
+      if ( pTask->uFlags & FRAME_SCHEDULER_FLAG_WORKER )
+      {
+         if ( pTask->uPeriodMicros < uBudget )
+            uBudget = pTask->uPeriodMicros;
+         if ( ! _frame_scheduler_dispatch_to_worker(iDueTasks[k], uBudget) )
+         {
+            pthread_mutex_lock(&s_FrameSchedulerWorkerMutex);
+            pTask->stats.uSkippedBusy++;
+            pthread_mutex_unlock(&s_FrameSchedulerWorkerMutex);
+         }
+         pthread_mutex_lock(&s_FrameSchedulerWorkerMutex);
+         _frame_scheduler_start_task(pTask, uTimeNow);
+         pthread_mutex_unlock(&s_FrameSchedulerWorkerMutex);
+         continue;
+      }
+
+      if ( pTask->iPriority != FRAME_SCHEDULER_PRIORITY_CRITICAL )
+      if ( pTask->stats.uAvgDurationMicros > uBudget )
+      {
+         if ( (pTask->iPriority == FRAME_SCHEDULER_PRIORITY_HIGH) && (pTask->uDeferredCount >= FRAME_SCHEDULER_MAX_DEFERRED) )
+            pTask->stats.uForced++;
+         else
+         {
+            pTask->bDeferred = 1;
+            pTask->uDeferredCount++;
+            pTask->stats.uDeferred++;
+            continue;
+         }
+      }
+      _frame_scheduler_start_task(pTask, uTimeNow);
+      // Critical tasks get the time until the next critical deadline, their own included
+      if ( pTask->iPriority == FRAME_SCHEDULER_PRIORITY_CRITICAL )
+         uBudget = _frame_scheduler_get_critical_budget(uTimeNow);
+      _frame_scheduler_run_task(pTask, uBudget);
+   }
+
+   for( int i=0; i<s_iFrameSchedulerCountTasks; i++ )
+   {
+      t_frame_scheduled_task* pTask = &(s_FrameSchedulerTasks[i]);
+      if ( ! (pTask->uFlags & FRAME_SCHEDULER_FLAG_IDLE) )
+         continue;
+      _frame_scheduler_run_task(pTask, _frame_scheduler_get_micros_to_next_due(_frame_scheduler_now_micros()));
+   }
+   return _frame_scheduler_get_micros_to_next_due(_frame_scheduler_now_micros());
+}
+
+void frame_scheduler_wait_worker()
+{
+   if ( ! s_iFrameSchedulerWorkerStarted )
+      return;
+   pthread_mutex_lock(&s_FrameSchedulerWorkerMutex);
+   while ( s_iFrameSchedulerWorkerTask >= 0 )
+      pthread_cond_wait(&s_FrameSchedulerWorkerCond, &s_FrameSchedulerWorkerMutex);
+   pthread_mutex_unlock(&s_FrameSchedulerWorkerMutex);
+}
+
+void frame_scheduler_log_stats()
+{
+   for( int i=0; i<s_iFrameSchedulerCountTasks; i++ )
+   {
+      t_frame_scheduler_task_stats stats;
+      frame_scheduler_get_task_stats(i, &stats);
+      t_frame_scheduled_task* pTask = &(s_FrameSchedulerTasks[i]);
+      log_line("[FrameScheduler] Task %s (priority %d, period %u us%s): %u runs, %u deferred, %u forced, %u skipped busy, %u missed deadlines, max late: %u us, avg duration: %u us, max duration: %u us",
+         pTask->szName, pTask->iPriority, pTask->uPeriodMicros,
+         (pTask->uFlags & FRAME_SCHEDULER_FLAG_WORKER)?", worker":((pTask->uFlags & FRAME_SCHEDULER_FLAG_IDLE)?", idle":""),
+         stats.uRuns, stats.uDeferred, stats.uForced, stats.uSkippedBusy, stats.uDeadlineMisses,
+         stats.uMaxLatenessMicros, stats.uAvgDurationMicros, stats.uMaxDurationMicros);
+   }
+}
@@ -0,0 +1,67 @@
+#pragma once
+#include "base.h"
+
+// Frame budget scheduler for a main loop: each task runs at its own period, by priority, then earliest deadline.
+// Critical tasks always run when due. The other tasks run only if their estimated cost (average of their
+// measured durations) fits before the next critical deadline, else they are deferred to a later pass.
+// High priority tasks are forced after FRAME_SCHEDULER_MAX_DEFERRED consecutive deferrals, low priority ones
+// wait for a pass with enough room. Idle tasks run at the end of each pass, with the time left until the
+// next due task as their budget (i.e. waiting on a pipe). Worker tasks run on a separate thread, one at a time.
+
+#define FRAME_SCHEDULER_MAX_TASKS 16
+#define FRAME_SCHEDULER_MAX_NAME 24
+#define FRAME_SCHEDULER_MAX_DEFERRED 4 // a held back high priority task is forced after this many passes
+#define FRAME_SCHEDULER_MAX_IDLE_MICROS 10000 // longest budget given to the idle tasks
+#define FRAME_SCHEDULER_MISS_PERCENT 25 // a task started later than this percent of its period missed its deadline
+
+#define FRAME_SCHEDULER_PRIORITY_CRITICAL 0
+#define FRAME_SCHEDULER_PRIORITY_HIGH 1
+#define FRAME_SCHEDULER_PRIORITY_LOW 2
+
+#define FRAME_SCHEDULER_FLAG_IDLE ((u32)0x01) // runs once at the end of each pass, the period is ignored
+#define FRAME_SCHEDULER_FLAG_WORKER ((u32)0x02) // runs on the worker thread
+
+typedef struct
+{
+   u32 uRuns;
+   u32 uDeferred; // runs held back for a critical deadline
+   u32 uForced; // runs forced after too many deferrals
+   u32 uSkippedBusy; // worker runs skipped, the worker was still busy
+   u32 uDeadlineMisses;
+   u32 uMaxLatenessMicros;
+   u32 uAvgDurationMicros; // also the cost estimate used to fit the task in a pass
+   u32 uMaxDurationMicros;
+   u32 uLastDurationMicros;
+} t_frame_scheduler_task_stats;
+
+// Runs the task. uBudgetMicros is the time left until the next due task (idle tasks) or the next critical deadline
+typedef void (*frame_scheduler_task_callback)(void* pContext, u32 uBudgetMicros);
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// pfGetTimeMicros can be NULL for the system clock (a simulated clock for testing)
+void frame_scheduler_init(u32 (*pfGetTimeMicros)(void* pContext), void* pContext);
+// Removes the tasks and stops the worker thread
+void frame_scheduler_release();
+
+// uCostMicros is the initial cost estimate. Returns the task index, -1 on error
+int frame_scheduler_add_task(const char* szName, int iPriority, u32 uPeriodMicros, u32 uCostMicros, u32 uFlags, frame_scheduler_task_callback pfCallback, void* pContext);
+void frame_scheduler_set_task_period(int iTask, u32 uPeriodMicros);
+u32 frame_scheduler_get_task_period(int iTask);
+int frame_scheduler_get_tasks_count();
+const char* frame_scheduler_get_task_name(int iTask);
+// Worker tasks stats are copied under lock
+int frame_scheduler_get_task_stats(int iTask, t_frame_scheduler_task_stats* pStats);
+void frame_scheduler_reset_stats();
+
+// One pass: runs the due tasks, then the idle ones. Returns the micros until the next due task
+u32 frame_scheduler_run();
+// Waits for the worker thread to finish its current task
+void frame_scheduler_wait_worker();
+void frame_scheduler_log_stats();
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,455 @@
+/*
+You can use this C/C++ code however you wish (for example, but not limited to:
+     as is, or by modifying it, or by adding new code, or by removing parts of the code;
+     in public or private projects, in new free or commercial products)
+     only if you get a priori written consent from Petru Soroaga (petrusoroaga@yahoo.com) for your specific use
+     and only if this copyright terms are preserved in the code.
+     This code is public for learning and academic purposes.
+Also, check the licences folder for additional licences terms.
+Code written by: Petru Soroaga, 2021-2023
+*/
+
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <errno.h>
+
+#include "base.h"
+#include "gpio_input.h"
+
+#define GPIO_INPUT_SOURCE_SYSFS_EDGE 0
+#define GPIO_INPUT_SOURCE_SYSFS_SAMPLED 1
+#define GPIO_INPUT_SOURCE_STREAM 2
+
+typedef struct
+{
+   int iPin;
+   int fd;
+   int iSource;
+   int bActiveLow;
+
+   // Debouncing: a level change is taken right away, then the pin is locked for the debounce
+   // time; the level it has when the lock expires is taken then (if it changed).
+   int iRawLevel;
+   int iLevel;
+   u32 uLockedUntilTime;
+   int bPressed;
+   u32 uNextLongPressTime;
+   u16 uRepeatCount;
+   u32 uNextSampleTime;
+} t_gpio_input_pin;
+
+static char s_szGPIOInputSysfsPath[128] = "/sys/class/gpio";
+static u32 s_uGPIOInputDebounceMs = GPIO_INPUT_DEFAULT_DEBOUNCE_MS;
+static u32 s_uGPIOInputLongPressMs = GPIO_INPUT_DEFAULT_LONG_PRESS_MS;
+static u32 s_uGPIOInputRepeatMs = GPIO_INPUT_DEFAULT_REPEAT_MS;
+
+static t_gpio_input_pin s_GPIOInputPins[GPIO_INPUT_MAX_PINS];
+static int s_iGPIOInputCountPins = 0;
+
+static pthread_t s_GPIOInputThread;
+static volatile int s_iGPIOInputRunning = 0;
+static volatile int s_iGPIOInputQuit = 0;
+static int s_fdGPIOInputWakePipe[2] = { -1, -1 };
+
+// Single producer (the input thread), single consumer (the keyboard code)
+static t_gpio_input_event s_GPIOInputEvents[GPIO_INPUT_EVENTS_QUEUE_SIZE];
+static volatile u32 s_uGPIOInputEventsHead = 0;
+static volatile u32 s_uGPIOInputEventsTail = 0;
+static volatile u32 s_uGPIOInputDroppedEvents = 0;
+
+void gpio_input_set_sysfs_path(const char* szPath)
+{
+   if ( NULL == szPath )
+      return;
+   strncpy(s_szGPIOInputSysfsPath, szPath, sizeof(s_szGPIOInputSysfsPath)-1);
+   s_szGPIOInputSysfsPath[sizeof(s_szGPIOInputSysfsPath)-1] = 0;
+}
+
+void gpio_input_set_timings(u32 uDebounceMs, u32 uLongPressMs, u32 uRepeatMs)
+{
+   s_uGPIOInputDebounceMs = uDebounceMs;
+   s_uGPIOInputLongPressMs = uLongPressMs;
+   s_uGPIOInputRepeatMs = uRepeatMs;
+   if ( s_uGPIOInputRepeatMs < 1 )
+      s_uGPIOInputRepeatMs = 1;
+}
+
+static int _gpio_input_read_level(t_gpio_input_pin* pPin)
+{
+   char szBuff[8];
+   if ( pPin->fd < 0 )
+      return -1;
+
+   if ( pPin->iSource == GPIO_INPUT_SOURCE_STREAM )
+   {
+      // Last level written to the stream
+      int iLevel = -1;
+      int iRead = read(pPin->fd, szBuff, sizeof(szBuff));
+      if ( iRead == 0 )
+         return -2;
+      for( int i=0; i<iRead; i++ )
+      {
+         if ( szBuff[i] == '0' )
+            iLevel = 0;
+         else if ( szBuff[i] == '1' )
+            iLevel = 1;
+      }
+      return iLevel;
+   }
+
+   int iRead = pread(pPin->fd, szBuff, sizeof(szBuff)-1, 0);
+   if ( iRead <= 0 )
+      return -1;
+   szBuff[iRead] = 0;
+   return (atoi(szBuff) != 0)?1:0;
+}
+
+static int _gpio_input_is_pressed_level(t_gpio_input_pin* pPin, int iLevel)
+{
+   if ( pPin->bActiveLow )
+      return (0 == iLevel)?1:0;
+   return (0 != iLevel)?1:0;
+}
+
+static void _gpio_input_add_event(t_gpio_input_pin* pPin, u8 uType, u32 uTime)
+{
+   u32 uHead = s_uGPIOInputEventsHead;
+   if ( uHead - s_uGPIOInputEventsTail >= GPIO_INPUT_EVENTS_QUEUE_SIZE )
+   {
+      s_uGPIOInputDroppedEvents++;
+      return;
+   }
+   t_gpio_input_event* pEvent = &(s_GPIOInputEvents[uHead % GPIO_INPUT_EVENTS_QUEUE_SIZE]);
+   pEvent->iPin = pPin->iPin;
+   pEvent->uType = uType;
+   pEvent->uLevel = pPin->iLevel;
+   pEvent->uRepeatCount = pPin->uRepeatCount;
+   pEvent->uTimeMs = uTime;
+   __sync_synchronize();
+   s_uGPIOInputEventsHead = uHead + 1;
+}
+
+static void _gpio_input_set_level(t_gpio_input_pin* pPin, int iLevel, u32 uTime)
+{
+   pPin->iLevel = iLevel;
+   pPin->uLockedUntilTime = uTime + s_uGPIOInputDebounceMs;
+
+   int bPressed = _gpio_input_is_pressed_level(pPin, iLevel);
+   if ( bPressed == pPin->bPressed )
+      return;
+   pPin->bPressed = bPressed;
+   pPin->uRepeatCount = 0;
+   if ( bPressed )
+   {
+      pPin->uNextLongPressTime = uTime + s_uGPIOInputLongPressMs;
+      _gpio_input_add_event(pPin, GPIO_INPUT_EVENT_PRESS, uTime);
+   }
+   else
+      _gpio_input_add_event(pPin, GPIO_INPUT_EVENT_RELEASE, uTime);
+}
+
+static void _gpio_input_on_sample(t_gpio_input_pin* pPin, int iLevel, u32 uTime)
+{
+   if ( iLevel < 0 )
+      return;
+   pPin->iRawLevel = iLevel;
+   if ( (iLevel != pPin->iLevel) && (uTime >= pPin->uLockedUntilTime) )
+      _gpio_input_set_level(pPin, iLevel, uTime);
+}
+
+// Returns the time until the next thing to do for this pin, in ms, or -1 if nothing to do
+
+static int _gpio_input_update_pin(t_gpio_input_pin* pPin, u32 uTime)
+{
+   int iWait = -1;
+
+   if ( pPin->iRawLevel != pPin->iLevel )
+   {
+      if ( uTime >= pPin->uLockedUntilTime )
+         _gpio_input_set_level(pPin, pPin->iRawLevel, uTime);
+      else
+         iWait = pPin->uLockedUntilTime - uTime;
+   }
+
+   if ( pPin->bPressed )
+   {
+      if ( uTime >= pPin->uNextLongPressTime )
+      {
+         _gpio_input_add_event(pPin, GPIO_INPUT_EVENT_LONG_PRESS, uTime);
+         pPin->uRepeatCount++;
+         pPin->uNextLongPressTime += s_uGPIOInputRepeatMs;
+         if ( pPin->uNextLongPressTime <= uTime )
+            pPin->uNextLongPressTime = uTime + s_uGPIOInputRepeatMs;
+      }
+      int iWaitLong = pPin->uNextLongPressTime - uTime;
+      if ( (iWait < 0) || (iWaitLong < iWait) )
+         iWait = iWaitLong;
+   }
+
+   if ( (pPin->iSource == GPIO_INPUT_SOURCE_SYSFS_SAMPLED) && (pPin->fd >= 0) )
+   {
+      int iWaitSample = 0;
+      if ( pPin->uNextSampleTime > uTime )
+         iWaitSample = pPin->uNextSampleTime - uTime;
+      if ( (iWait < 0) || (iWaitSample < iWait) )
+         iWait = iWaitSample;
+   }
+   return iWait;
+}
+
+static void* _gpio_input_thread(void* pParam)
+{
+   struct pollfd fds[GPIO_INPUT_MAX_PINS+1];
+   int iFdPin[GPIO_INPUT_MAX_PINS+1];
+   int iCountFds = 0;
+   char szBuff[16];
+
+   log_line("[GPIOInput] Thread started.");
+
+   fds[0].fd = s_fdGPIOInputWakePipe[0];
+   fds[0].events = POLLIN;
+   iFdPin[0] = -1;
+   iCountFds = 1;
+   for( int i=0; i<s_iGPIOInputCountPins; i++ )
+   {
+      if ( s_GPIOInputPins[i].iSource == GPIO_INPUT_SOURCE_SYSFS_SAMPLED )
+         continue;
+      fds[iCountFds].fd = s_GPIOInputPins[i].fd;
+      fds[iCountFds].events = (s_GPIOInputPins[i].iSource == GPIO_INPUT_SOURCE_STREAM)?POLLIN:(POLLPRI | POLLERR);
+      iFdPin[iCountFds] = i;
+      iCountFds++;
+   }
+
+   int iTimeout = 0;
+   while ( ! s_iGPIOInputQuit )
+   {
+      for( int i=0; i<iCountFds; i++ )
+         fds[i].revents = 0;
+      int iResult = poll(fds, iCountFds, iTimeout);
+      if ( (iResult < 0) && (errno != EINTR) )
+      {
+         log_softerror_and_alarm("[GPIOInput] Failed to poll for GPIO edges, error: %d", errno);
+         usleep(GPIO_INPUT_SAMPLE_INTERVAL_MS*1000);
+      }
+      if ( s_iGPIOInputQuit )
+         break;
+
+      u32 uTimeNow = get_current_timestamp_ms();
+
+      if ( (iResult > 0) && (fds[0].revents & POLLIN) )
+      {
+         if ( read(fds[0].fd, szBuff, sizeof(szBuff)) < 0 )
+            log_softerror_and_alarm("[GPIOInput] Failed to read wake pipe.");
+      }
+
+      for( int i=1; (iResult > 0) && (i<iCountFds); i++ )
+      {
+         if ( 0 == fds[i].revents )
+            continue;
+         t_gpio_input_pin* pPin = &(s_GPIOInputPins[iFdPin[i]]);
+         int iLevel = _gpio_input_read_level(pPin);
+         if ( (pPin->iSource == GPIO_INPUT_SOURCE_STREAM) && ((iLevel == -2) || ((iLevel < 0) && (fds[i].revents & (POLLHUP | POLLNVAL)))) )
+         {
+            log_line("[GPIOInput] Edge source for pin %d closed.", pPin->iPin);
+            fds[i].fd = -1;
+            continue;
+         }
+         _gpio_input_on_sample(pPin, iLevel, uTimeNow);
+      }
+
+      iTimeout = -1;
+      for( int i=0; i<s_iGPIOInputCountPins; i++ )
+      {
+         t_gpio_input_pin* pPin = &(s_GPIOInputPins[i]);
+         // Sampled pins are sampled again when the debounce lock expires, not to use an older level
+         if ( (pPin->iSource == GPIO_INPUT_SOURCE_SYSFS_SAMPLED) &&
+              ((uTimeNow >= pPin->uNextSampleTime) || ((pPin->iRawLevel != pPin->iLevel) && (uTimeNow >= pPin->uLockedUntilTime))) )
+         {
+            _gpio_input_on_sample(pPin, _gpio_input_read_level(pPin), uTimeNow);
+            pPin->uNextSampleTime = uTimeNow + GPIO_INPUT_SAMPLE_INTERVAL_MS;
+         }
+         int iWait = _gpio_input_update_pin(pPin, uTimeNow);
+         if ( (iWait >= 0) && ((iTimeout < 0) || (iWait < iTimeout)) )
+            iTimeout = iWait;
+      }
+   }
+   log_line("[GPIOInput] Thread stopped.");
+   return NULL;
+}
+
+static int _gpio_input_add(int iPin, int fd, int iSource, int bActiveLow)
+{
+   if ( s_iGPIOInputRunning )
+   {
+      log_softerror_and_alarm("[GPIOInput] Can't add pin %d, already running.", iPin);
+      return 0;
+   }
+   if ( s_iGPIOInputCountPins >= GPIO_INPUT_MAX_PINS )
+   {
+      log_softerror_and_alarm("[GPIOInput] Can't add pin %d, too many pins.", iPin);
+      return 0;
+   }
+   t_gpio_input_pin* pPin = &(s_GPIOInputPins[s_iGPIOInputCountPins]);
+   memset(pPin, 0, sizeof(t_gpio_input_pin));
+   pPin->iPin = iPin;
+   pPin->fd = fd;
+   pPin->iSource = iSource;
+   pPin->bActiveLow = bActiveLow;
+   pPin->iRawLevel = bActiveLow?1:0;
+   pPin->iLevel = pPin->iRawLevel;
+   s_iGPIOInputCountPins++;
+   return 1;
+}
+
+int gpio_input_add_pin(int iPin, int bActiveLow)
+{
+   char szFile[256];
+
+   snprintf(szFile, sizeof(szFile), "%s/gpio%d/value", s_szGPIOInputSysfsPath, iPin);
+   int fd = open(szFile, O_RDONLY | O_NONBLOCK);
+   if ( fd < 0 )
+   {
+      log_softerror_and_alarm("[GPIOInput] Failed to open %s, error: %d", szFile, errno);
+      return 0;
+   }
+
+   // Edges on both levels changes; pins that can't generate interrupts are sampled
+   int iSource = GPIO_INPUT_SOURCE_SYSFS_SAMPLED;
+   snprintf(szFile, sizeof(szFile), "%s/gpio%d/edge", s_szGPIOInputSysfsPath, iPin);
+   int fdEdge = open(szFile, O_WRONLY);
+   if ( fdEdge >= 0 )
+   {
+      if ( 4 == write(fdEdge, "both", 4) )
+         iSource = GPIO_INPUT_SOURCE_SYSFS_EDGE;
+      close(fdEdge);
+   }
+
+   if ( ! _gpio_input_add(iPin, fd, iSource, bActiveLow) )
+   {
+      close(fd);
+      return 0;
+   }
+   log_line("[GPIOInput] Added pin %d (%s).", iPin, (iSource == GPIO_INPUT_SOURCE_SYSFS_EDGE)?"edges":"sampled");
+   return 1;
+}
+
+int gpio_input_add_pin_stream(int iPin, int fd, int bActiveLow)
+{
+   if ( fd < 0 )
+      return 0;
+   int iFlags = fcntl(fd, F_GETFL, 0);
+   if ( iFlags >= 0 )
+      fcntl(fd, F_SETFL, iFlags | O_NONBLOCK);
+   if ( ! _gpio_input_add(iPin, fd, GPIO_INPUT_SOURCE_STREAM, bActiveLow) )
+      return 0;
+   log_line("[GPIOInput] Added pin %d (stream).", iPin);
+   return 1;
+}
+
+int gpio_input_start()
+{
+   if ( s_iGPIOInputRunning )
+      return 1;
+   if ( 0 == s_iGPIOInputCountPins )
+      return 0;
+
+   if ( 0 != pipe(s_fdGPIOInputWakePipe) )
+   {
+      log_softerror_and_alarm("[GPIOInput] Failed to create wake pipe.");
+      return 0;
+   }
+
+   // Current levels are the start levels, no events for them
+   u32 uTimeNow = get_current_timestamp_ms();
+   for( int i=0; i<s_iGPIOInputCountPins; i++ )
+   {
+      t_gpio_input_pin* pPin = &(s_GPIOInputPins[i]);
+      if ( pPin->iSource == GPIO_INPUT_SOURCE_STREAM )
+         continue;
+      int iLevel = _gpio_input_read_level(pPin);
+      if ( iLevel >= 0 )
+      {
+         pPin->iRawLevel = iLevel;
+         pPin->iLevel = iLevel;
+         pPin->bPressed = _gpio_input_is_pressed_level(pPin, iLevel);
+         pPin->uNextLongPressTime = uTimeNow + s_uGPIOInputLongPressMs;
+      }
+      pPin->uNextSampleTime = uTimeNow + GPIO_INPUT_SAMPLE_INTERVAL_MS;
+   }
+
+   s_uGPIOInputEventsHead = 0;
+   s_uGPIOInputEventsTail = 0;
+   s_uGPIOInputDroppedEvents = 0;
+   s_iGPIOInputQuit = 0;
+   if ( 0 != pthread_create(&s_GPIOInputThread, NULL, &_gpio_input_thread, NULL) )
+   {
+      log_softerror_and_alarm("[GPIOInput] Failed to create the input thread.");
+      close(s_fdGPIOInputWakePipe[0]);
+      close(s_fdGPIOInputWakePipe[1]);
+      s_fdGPIOInputWakePipe[0] = -1;
+      s_fdGPIOInputWakePipe[1] = -1;
+      return 0;
+   }
+   s_iGPIOInputRunning = 1;
+   log_line("[GPIOInput] Started, %d pins, debounce %u ms, long press %u ms, repeat %u ms.", s_iGPIOInputCountPins, s_uGPIOInputDebounceMs, s_uGPIOInputLongPressMs, s_uGPIOInputRepeatMs);
+   return 1;
+}
+
+void gpio_input_stop()
+{
+   if ( s_iGPIOInputRunning )
+   {
+      s_iGPIOInputQuit = 1;
+      if ( 1 != write(s_fdGPIOInputWakePipe[1], "q", 1) )
+         log_softerror_and_alarm("[GPIOInput] Failed to wake up the input thread.");
+      pthread_join(s_GPIOInputThread, NULL);
+      s_iGPIOInputRunning = 0;
+      close(s_fdGPIOInputWakePipe[0]);
+      close(s_fdGPIOInputWakePipe[1]);
+      s_fdGPIOInputWakePipe[0] = -1;
+      s_fdGPIOInputWakePipe[1] = -1;
+   }
+
+   // Stream sources are owned by the caller
+   for( int i=0; i<s_iGPIOInputCountPins; i++ )
+   {
+      if ( (s_GPIOInputPins[i].iSource != GPIO_INPUT_SOURCE_STREAM) && (s_GPIOInputPins[i].fd >= 0) )
+         close(s_GPIOInputPins[i].fd);
+      s_GPIOInputPins[i].fd = -1;
+   }
+   s_iGPIOInputCountPins = 0;
+}
+
+int gpio_input_is_running()
+{
+   return s_iGPIOInputRunning;
+}
+
+int gpio_input_get_event(t_gpio_input_event* pEvent)
+{
+   u32 uTail = s_uGPIOInputEventsTail;
+   if ( uTail == s_uGPIOInputEventsHead )
+      return 0;
+   __sync_synchronize();
+   if ( NULL != pEvent )
+      memcpy(pEvent, &(s_GPIOInputEvents[uTail % GPIO_INPUT_EVENTS_QUEUE_SIZE]), sizeof(t_gpio_input_event));
+   __sync_synchronize();
+   s_uGPIOInputEventsTail = uTail + 1;
+   return 1;
+}
+
+int gpio_input_get_level(int iPin)
+{
+   for( int i=0; i<s_iGPIOInputCountPins; i++ )
+   {
+      if ( s_GPIOInputPins[i].iPin == iPin )
+         return s_GPIOInputPins[i].iLevel;
+   }
+   return -1;
+}
+
+u32 gpio_input_get_dropped_events_count()
+{
+   return s_uGPIOInputDroppedEvents;
+}
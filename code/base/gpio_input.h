@@ -0,0 +1,56 @@
+#pragma once
+#include "base.h"
+
+// GPIO input (buttons): a thread keeps the pins value files opened and waits for edges (poll() on
+// the sysfs gpio value files, with edge set to both), debounces each pin and queues timestamped
+// press/release/long press events for the keyboard code.
+// Pins that can't generate edges are sampled (still on the opened file) at GPIO_INPUT_SAMPLE_INTERVAL_MS.
+
+#define GPIO_INPUT_MAX_PINS 16
+#define GPIO_INPUT_EVENTS_QUEUE_SIZE 64
+#define GPIO_INPUT_SAMPLE_INTERVAL_MS 10
+
+#define GPIO_INPUT_DEFAULT_DEBOUNCE_MS 20
+#define GPIO_INPUT_DEFAULT_LONG_PRESS_MS 700
+#define GPIO_INPUT_DEFAULT_REPEAT_MS 150
+
+#define GPIO_INPUT_EVENT_PRESS 1
+#define GPIO_INPUT_EVENT_RELEASE 2
+#define GPIO_INPUT_EVENT_LONG_PRESS 3 // first one after the long press time, then repeated at the repeat interval
+
+typedef struct
+{
+   int iPin;
+   u8 uType;
+   u8 uLevel; // debounced pin level
+   u16 uRepeatCount; // for long press events, 0 for the first one
+   u32 uTimeMs; // when the edge took place (not when it was debounced)
+} t_gpio_input_event;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Defaults to /sys/class/gpio. Must be set before adding pins
+void gpio_input_set_sysfs_path(const char* szPath);
+void gpio_input_set_timings(u32 uDebounceMs, u32 uLongPressMs, u32 uRepeatMs);
+
+// Pins are pressed on high level, unless bActiveLow. Pins must be exported and set as input.
+// Returns 1 on success
+int gpio_input_add_pin(int iPin, int bActiveLow);
+// Edge source from a stream (pipe, socket): each '0'/'1' char read is the new pin level
+int gpio_input_add_pin_stream(int iPin, int fd, int bActiveLow);
+
+int gpio_input_start();
+void gpio_input_stop();
+int gpio_input_is_running();
+
+// Returns 1 if an event was dequeued
+int gpio_input_get_event(t_gpio_input_event* pEvent);
+// Debounced level, -1 if the pin was not added
+int gpio_input_get_level(int iPin);
+u32 gpio_input_get_dropped_events_count();
+
+#ifdef __cplusplus
+}
+#endif
@@ -24,6 +24,7 @@ Code written by: Petru Soroaga, 2021-2023
 #include "base.h"
 #include "hardware.h"
 #include "gpio.h"
+#include "gpio_input.h"
 #include "config.h"
 #include "hw_procs.h"
 #include "hardware_i2c.h"
@@ -306,6 +307,21 @@ int init_hardware()
    sInitialReadQAMinus = GPIORead(GPIO_PIN_QACTIONMINUS);
    log_line("Initial read of Quick Actions buttons: %d %d-%d %d, [%d, %d]", sInitialReadQA1, sInitialReadQA2, sInitialReadQA22, sInitialReadQA3, sInitialReadQAPlus, sInitialReadQAMinus);
 
+   // Buttons events come from the GPIO input thread; keyboard_loop polls the pins only if it can't start
+   gpio_input_set_timings(GPIO_INPUT_DEFAULT_DEBOUNCE_MS, s_long_key_press_delta, s_long_press_repeat_time);
+   gpio_input_add_pin(GPIO_PIN_MENU, 0);
+   gpio_input_add_pin(GPIO_PIN_BACK, 0);
+   gpio_input_add_pin(GPIO_PIN_PLUS, 0);
+   gpio_input_add_pin(GPIO_PIN_MINUS, 0);
+   gpio_input_add_pin(GPIO_PIN_QACTION1, 0);
+   gpio_input_add_pin(GPIO_PIN_QACTION2, 0);
+   gpio_input_add_pin(GPIO_PIN_QACTION2_2, 0);
+   gpio_input_add_pin(GPIO_PIN_QACTION3, 0);
+   gpio_input_add_pin(GPIO_PIN_QACTIONPLUS, 0);
+   gpio_input_add_pin(GPIO_PIN_QACTIONMINUS, 0);
+   if ( ! gpio_input_start() )
+      log_softerror_and_alarm("HW: Failed to start GPIO input events, buttons will be polled.");
+
    s_iHardwareJoystickCount = 0;
    s_hwWasSetup = 1;
    s_bHarwareHasDetectedSystemType = 0;
@@ -345,6 +361,7 @@ int init_hardware_only_status_led()
 
 void hardware_release()
 {
+   gpio_input_stop();
    GPIOUnexport(GPIO_PIN_MENU);
    GPIOUnexport(GPIO_PIN_BACK);
    GPIOUnexport(GPIO_PIN_MINUS);
@@ -667,6 +684,53 @@ int hardware_is_joystick_opened(int joystickIndex)
 // Returns the count of new events
 // Return -1 on error
 
+void hardware_joystick_store_previous_values(hw_joystick_info_t* pJoystick)
+{
+   if ( NULL == pJoystick )
+      return;
+   memcpy( &pJoystick->buttonsValuesPrev, &pJoystick->buttonsValues, MAX_JOYSTICK_BUTTONS*sizeof(int));
+   memcpy( &pJoystick->axesValuesPrev, &pJoystick->axesValues, MAX_JOYSTICK_AXES*sizeof(int));
+}
+
+int hardware_joystick_read_events(hw_joystick_info_t* pJoystick)
+{
+   if ( NULL == pJoystick || -1 == pJoystick->fd )
+      return -1;
+
+   int countEvents = 0;
+   while ( 1 )
+   {
+      struct js_event joystickEvent[8];
+      int iRead = read(pJoystick->fd, &joystickEvent[0], sizeof(joystickEvent));
+      if ( iRead == 0 )
+         break;
+      if ( iRead < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) )
+         break;
+      if ( iRead < 0 )
+         return -1;
+
+      int count = iRead / sizeof(joystickEvent[0]);
+      for( int i=0; i<count; i++ )
+      {
+         if ( (joystickEvent[i].type & ~JS_EVENT_INIT) == JS_EVENT_BUTTON )
+         if ( joystickEvent[i].number >= 0 && joystickEvent[i].number < MAX_JOYSTICK_BUTTONS )
+         {
+            pJoystick->buttonsValues[joystickEvent[i].number] = joystickEvent[i].value;
+            countEvents++;
+         }
+         if ( (joystickEvent[i].type & ~JS_EVENT_INIT) == JS_EVENT_AXIS )
+         if ( joystickEvent[i].number >= 0 && joystickEvent[i].number < MAX_JOYSTICK_AXES )
+         {
+            pJoystick->axesValues[joystickEvent[i].number] = joystickEvent[i].value;
+            countEvents++;
+         }
+      }
+      if ( iRead < (int)sizeof(joystickEvent) )
+         break;
+   }
+   return countEvents;
+}
+
 int hardware_read_joystick(int joystickIndex, int miliSec)
 {
    if (joystickIndex < 0 || joystickIndex >= s_iHardwareJoystickCount )
@@ -676,8 +740,7 @@ int hardware_read_joystick(int joystickIndex, int miliSec)
    if ( -1 == s_HardwareJoystickInfo[joystickIndex].fd )
       return -1;
 
-   memcpy( &s_HardwareJoystickInfo[joystickIndex].buttonsValuesPrev, &s_HardwareJoystickInfo[joystickIndex].buttonsValues, MAX_JOYSTICK_BUTTONS*sizeof(int));
-   memcpy( &s_HardwareJoystickInfo[joystickIndex].axesValuesPrev, &s_HardwareJoystickInfo[joystickIndex].axesValues, MAX_JOYSTICK_AXES*sizeof(int));
+   hardware_joystick_store_previous_values(&s_HardwareJoystickInfo[joystickIndex]);
 
    int countEvents = 0;
    u32 timeStart = get_current_timestamp_micros();
@@ -688,34 +751,14 @@ int hardware_read_joystick(int joystickIndex, int miliSec)
    while ( get_current_timestamp_micros() < timeEnd )
    { 
       hardware_sleep_micros(200);
-      struct js_event joystickEvent[8];
-      int iRead = read(s_HardwareJoystickInfo[joystickIndex].fd, &joystickEvent[0], sizeof(joystickEvent));
-      if ( iRead == 0 )
-         continue;
-      if ( iRead < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) )
-         continue;
-      if ( iRead < 0 )
+      int iEvents = hardware_joystick_read_events(&s_HardwareJoystickInfo[joystickIndex]);
+      if ( iEvents < 0 )
       {
          log_softerror_and_alarm("Error on reading joystick data, joystick index: %d, error: %d", joystickIndex, errno);
          hardware_close_joystick(joystickIndex);
          return -1;
       }
-      int count = iRead / sizeof(joystickEvent[0]);
-      for( int i=0; i<count; i++ )
-      {
-         if ( (joystickEvent[i].type & ~JS_EVENT_INIT) == JS_EVENT_BUTTON )
-         if ( joystickEvent[i].number >= 0 && joystickEvent[i].number < MAX_JOYSTICK_BUTTONS )
-         {
-            s_HardwareJoystickInfo[joystickIndex].buttonsValues[joystickEvent[i].number] = joystickEvent[i].value;
-            countEvents++;
-         }
-         if ( (joystickEvent[i].type & ~JS_EVENT_INIT) == JS_EVENT_AXIS )
-         if ( joystickEvent[i].number >= 0 && joystickEvent[i].number < MAX_JOYSTICK_AXES )
-         {
-            s_HardwareJoystickInfo[joystickIndex].axesValues[joystickEvent[i].number] = joystickEvent[i].value;
-            countEvents++;
-         }
-      }
+      countEvents += iEvents;
    }
    return countEvents;
 }
@@ -746,11 +789,101 @@ u16 hardware_get_flags()
    return retValue;
 }
 
+static int _keyboard_get_key_state(int iPin, int** ppiLastRead, int** ppiPressed, u32** ppuDownStartTime)
+{
+   switch ( iPin )
+   {
+      case GPIO_PIN_MENU: *ppiLastRead = &sLastReadMenu; *ppiPressed = &sKeyMenuPressed; *ppuDownStartTime = &keyMenuDownStartTime; return 1;
+      case GPIO_PIN_BACK: *ppiLastRead = &sLastReadBack; *ppiPressed = &sKeyBackPressed; *ppuDownStartTime = &keyBackDownStartTime; return 1;
+      case GPIO_PIN_PLUS: *ppiLastRead = &sLastReadPlus; *ppiPressed = &sKeyPlusPressed; *ppuDownStartTime = &keyPlusDownStartTime; return 1;
+      case GPIO_PIN_MINUS: *ppiLastRead = &sLastReadMinus; *ppiPressed = &sKeyMinusPressed; *ppuDownStartTime = &keyMinusDownStartTime; return 1;
+      case GPIO_PIN_QACTION1: *ppiLastRead = &sLastReadQA1; *ppiPressed = &sKeyQA1Pressed; *ppuDownStartTime = &keyQA1DownStartTime; return 1;
+      case GPIO_PIN_QACTION2: *ppiLastRead = &sLastReadQA2; *ppiPressed = &sKeyQA2Pressed; *ppuDownStartTime = &keyQA2DownStartTime; return 1;
+      case GPIO_PIN_QACTION2_2: *ppiLastRead = &sLastReadQA22; *ppiPressed = &sKeyQA22Pressed; *ppuDownStartTime = &keyQA22DownStartTime; return 1;
+      case GPIO_PIN_QACTION3: *ppiLastRead = &sLastReadQA3; *ppiPressed = &sKeyQA3Pressed; *ppuDownStartTime = &keyQA3DownStartTime; return 1;
+      case GPIO_PIN_QACTIONPLUS: *ppiLastRead = &sLastReadQAPlus; *ppiPressed = &sKeyQAPlusPressed; *ppuDownStartTime = &keyQAPlusDownStartTime; return 1;
+      case GPIO_PIN_QACTIONMINUS: *ppiLastRead = &sLastReadQAMinus; *ppiPressed = &sKeyQAMinusPressed; *ppuDownStartTime = &keyQAMinusDownStartTime; return 1;
+   }
+   return 0;
+}
+
+// Same keys states as the polling loop, from the GPIO input events: a press is seen
+// even if the button was released before this loop runs.
+
+static void _keyboard_loop_gpio_events()
+{
+   sKeyMenuPressed = 0;
+   sKeyBackPressed = 0;
+   sKeyPlusPressed = 0;
+   sKeyMinusPressed = 0;
+   sKeyQA1Pressed = 0;
+   sKeyQA2Pressed = 0;
+   sKeyQA22Pressed = 0;
+   sKeyQA3Pressed = 0;
+   sKeyQAPlusPressed = 0;
+   sKeyQAMinusPressed = 0;
+
+   int bReleased = 0;
+   t_gpio_input_event event;
+   while ( gpio_input_get_event(&event) )
+   {
+      int* piLastRead = NULL;
+      int* piPressed = NULL;
+      u32* puDownStartTime = NULL;
+      if ( ! _keyboard_get_key_state(event.iPin, &piLastRead, &piPressed, &puDownStartTime) )
+         continue;
+
+      if ( event.uType == GPIO_INPUT_EVENT_PRESS )
+      {
+         *piLastRead = 1;
+         *piPressed = 1;
+         *puDownStartTime = event.uTimeMs;
+      }
+      else if ( event.uType == GPIO_INPUT_EVENT_LONG_PRESS )
+      {
+         // Not after a long press status reset, until released
+         if ( 0 != *puDownStartTime )
+         {
+            *piPressed = 1;
+            *puDownStartTime += s_long_press_repeat_time;
+         }
+      }
+      else if ( event.uType == GPIO_INPUT_EVENT_RELEASE )
+      {
+         *piLastRead = 0;
+         *puDownStartTime = 0;
+         bReleased = 1;
+      }
+   }
+
+   if ( s_bBlockCurrentPressedKeys )
+   {
+      sKeyMenuPressed = 0;
+      sKeyBackPressed = 0;
+      sKeyPlusPressed = 0;
+      sKeyMinusPressed = 0;
+      sKeyQA1Pressed = 0;
+      sKeyQA2Pressed = 0;
+      sKeyQA22Pressed = 0;
+      sKeyQA3Pressed = 0;
+      sKeyQAPlusPressed = 0;
+      sKeyQAMinusPressed = 0;
+      if ( bReleased )
+         s_bBlockCurrentPressedKeys = 0;
+   }
+}
+
 void keyboard_loop()
 {
    if ( ! s_hwWasSetup )
       return;
 
+   if ( gpio_input_is_running() )
+   {
+      _keyboard_loop_gpio_events();
+      return;
+   }
+
    // Check inputs
    int rMenu = GPIORead(GPIO_PIN_MENU);
    int rBack = GPIORead(GPIO_PIN_BACK);
@@ -98,6 +98,11 @@ hw_joystick_info_t* hardware_get_joystick_info(int index);
 int hardware_open_joystick(int joystickIndex);
 void hardware_close_joystick(int joystickIndex);
 int hardware_read_joystick(int joystickIndex, int miliSec);
+// Reads all the pending events of an opened (non blocking) joystick, without waiting.
+// Returns the count of events read, -1 on a read error.
+int hardware_joystick_read_events(hw_joystick_info_t* pJoystick);
+// Button presses are detected against the previous values
+void hardware_joystick_store_previous_values(hw_joystick_info_t* pJoystick);
 int hardware_is_joystick_opened(int joystickIndex);
 
 u16 hardware_get_flags();
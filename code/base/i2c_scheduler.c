@@ -0,0 +1,504 @@
+/*
+You can use this C/C++ code however you wish (for example, but not limited to:
+     as is, or by modifying it, or by adding new code, or by removing parts of the code;
+     in public or private projects, in new free or commercial products)
+     only if you get a priori written consent from Petru Soroaga (petrusoroaga@yahoo.com) for your specific use
+     and only if this copyright terms are preserved in the code.
+     This code is public for learning and academic purposes.
+Also, check the licences folder for additional licences terms.
+Code written by: Petru Soroaga, 2021-2023
+*/
+
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <linux/i2c-dev.h>
+
+#include "base.h"
+#include "i2c_scheduler.h"
+
+typedef struct
+{
+   int iBus;
+   u8 uAddress;
+   int iPriority;
+   u32 uPeriodMicros;
+   i2c_scheduler_build_callback pfBuild;
+   i2c_scheduler_result_callback pfResult;
+   i2c_scheduler_error_callback pfError;
+   void* pContext;
+   int iMsgsPerTransfer; // 0: all the messages in one transaction, can be batched with other devices
+
+   u32 uNextDeadlineMicros;
+   int bReadAgain;
+   int bDeferred; // held back in the current run
+   u32 uDeferredCount; // consecutive
+
+   // Part of the current batch
+   int bInBatch;
+   int iFirstMsg;
+   int iCountMsgs;
+   u32 uBytes;
+
+   u8 uBuffer[I2C_SCHEDULER_DEVICE_BUFFER_SIZE];
+   t_i2c_scheduler_device_stats stats;
+} t_i2c_scheduled_device;
+
+typedef struct
+{
+   int iBus;
+   int fd;
+} t_i2c_scheduler_bus;
+
+static t_i2c_bus_ops s_I2CSchedulerBusOps;
+static int s_bI2CSchedulerUseBusOps = 0;
+
+static t_i2c_scheduled_device s_I2CSchedulerDevices[I2C_SCHEDULER_MAX_DEVICES];
+static int s_iI2CSchedulerCountDevices = 0;
+
+static t_i2c_scheduler_bus s_I2CSchedulerBusses[I2C_SCHEDULER_MAX_BUSSES];
+static int s_iI2CSchedulerCountBusses = 0;
+
+static struct i2c_msg s_I2CSchedulerMsgs[I2C_SCHEDULER_MAX_BATCH_MSGS];
+
+static u32 _i2c_scheduler_now_micros()
+{
+   if ( s_bI2CSchedulerUseBusOps && (NULL != s_I2CSchedulerBusOps.pfGetTimeMicros) )
+      return s_I2CSchedulerBusOps.pfGetTimeMicros(s_I2CSchedulerBusOps.pContext);
+   return get_current_timestamp_micros();
+}
+
+static u32 _i2c_scheduler_micros_to_ms(u32 uTimeMicros)
+{
+   if ( s_bI2CSchedulerUseBusOps && (NULL != s_I2CSchedulerBusOps.pfGetTimeMicros) )
+      return uTimeMicros/1000;
+   return get_current_timestamp_ms();
+}
+
+static int _i2c_scheduler_get_bus_fd(int iBus)
+{
+   for( int i=0; i<s_iI2CSchedulerCountBusses; i++ )
+   {
+      if ( s_I2CSchedulerBusses[i].iBus == iBus )
+         return s_I2CSchedulerBusses[i].fd;
+   }
+   if ( s_iI2CSchedulerCountBusses >= I2C_SCHEDULER_MAX_BUSSES )
+      return -1;
+
+   char szDevice[32];
+   snprintf(szDevice, sizeof(szDevice), "/dev/i2c-%d", iBus);
+   int fd = open(szDevice, O_RDWR);
+   if ( fd < 0 )
+   {
+      log_softerror_and_alarm("[I2CScheduler] Failed to open I2C bus %s", szDevice);
+      return -1;
+   }
+   log_line("[I2CScheduler] Opened I2C bus %s", szDevice);
+   s_I2CSchedulerBusses[s_iI2CSchedulerCountBusses].iBus = iBus;
+   s_I2CSchedulerBusses[s_iI2CSchedulerCountBusses].fd = fd;
+   s_iI2CSchedulerCountBusses++;
+   return fd;
+}
+
+static int _i2c_scheduler_transfer(int iBus, struct i2c_msg* pMsgs, int iCount)
+{
+   if ( s_bI2CSchedulerUseBusOps )
+      return s_I2CSchedulerBusOps.pfTransfer(s_I2CSchedulerBusOps.pContext, iBus, pMsgs, iCount);
+
+   int fd = _i2c_scheduler_get_bus_fd(iBus);
+   if ( fd < 0 )
+      return -1;
+
+   struct i2c_rdwr_ioctl_data data;
+   data.msgs = pMsgs;
+   data.nmsgs = iCount;
+   return ioctl(fd, I2C_RDWR, &data);
+}
+
+static int _i2c_scheduler_transfer_device(t_i2c_scheduled_device* pDevice, struct i2c_msg* pMsgs, int iCount)
+{
+   if ( pDevice->iMsgsPerTransfer <= 0 )
+      return _i2c_scheduler_transfer(pDevice->iBus, pMsgs, iCount);
+
+   for( int i=0; i<iCount; i += pDevice->iMsgsPerTransfer )
+   {
+      int iChunk = iCount - i;
+      if ( iChunk > pDevice->iMsgsPerTransfer )
+         iChunk = pDevice->iMsgsPerTransfer;
+      if ( _i2c_scheduler_transfer(pDevice->iBus, &(pMsgs[i]), iChunk) != iChunk )
+         return -1;
+   }
+   return iCount;
+}
+
+void i2c_scheduler_init(t_i2c_bus_ops* pBusOps)
+{
+   i2c_scheduler_release();
+   s_bI2CSchedulerUseBusOps = 0;
+   if ( NULL != pBusOps )
+   {
+      memcpy(&s_I2CSchedulerBusOps, pBusOps, sizeof(t_i2c_bus_ops));
+      s_bI2CSchedulerUseBusOps = 1;
+   }
+}
+
+void i2c_scheduler_release()
+{
+   i2c_scheduler_remove_all_devices();
+   for( int i=0; i<s_iI2CSchedulerCountBusses; i++ )
+      close(s_I2CSchedulerBusses[i].fd);
+   s_iI2CSchedulerCountBusses = 0;
+}
+
+int i2c_scheduler_add_device(int iBus, u8 uAddress, int iPriority, u32 uPeriodMs,
+     i2c_scheduler_build_callback pfBuild, i2c_scheduler_result_callback pfResult, i2c_scheduler_error_callback pfError, void* pContext)
+{
+   if ( (NULL == pfBuild) || (NULL == pfResult) || (0 == uPeriodMs) )
+      return -1;
+   if ( s_iI2CSchedulerCountDevices >= I2C_SCHEDULER_MAX_DEVICES )
+   {
+      log_softerror_and_alarm("[I2CScheduler] Can't add device 0x%02X, too many devices.", uAddress);
+      return -1;
+   }
+
+   int iDevice = s_iI2CSchedulerCountDevices;
+   t_i2c_scheduled_device* pDevice = &(s_I2CSchedulerDevices[iDevice]);
+   memset(pDevice, 0, sizeof(t_i2c_scheduled_device));
+   pDevice->iBus = iBus;
+   pDevice->uAddress = uAddress;
+   pDevice->iPriority = iPriority;
+   pDevice->uPeriodMicros = uPeriodMs*1000;
+   pDevice->pfBuild = pfBuild;
+   pDevice->pfResult = pfResult;
+   pDevice->pfError = pfError;
+   pDevice->pContext = pContext;
+   pDevice->uNextDeadlineMicros = _i2c_scheduler_now_micros();
+   s_iI2CSchedulerCountDevices++;
+
+   log_line("[I2CScheduler] Added device 0x%02X on bus %d, priority %d, period %u ms.", uAddress, iBus, iPriority, uPeriodMs);
+   return iDevice;
+}
+
+void i2c_scheduler_set_device_period(int iDevice, u32 uPeriodMs)
+{
+   if ( (iDevice < 0) || (iDevice >= s_iI2CSchedulerCountDevices) || (0 == uPeriodMs) )
+      return;
+   t_i2c_scheduled_device* pDevice = &(s_I2CSchedulerDevices[iDevice]);
+   if ( uPeriodMs*1000 < pDevice->uPeriodMicros )
+   if ( (int)(pDevice->uNextDeadlineMicros - _i2c_scheduler_now_micros()) > (int)(uPeriodMs*1000) )
+      pDevice->uNextDeadlineMicros = _i2c_scheduler_now_micros() + uPeriodMs*1000;
+   pDevice->uPeriodMicros = uPeriodMs*1000;
+}
+
+void i2c_scheduler_set_device_msgs_per_transfer(int iDevice, int iMsgsPerTransfer)
+{
+   if ( (iDevice < 0) || (iDevice >= s_iI2CSchedulerCountDevices) || (iMsgsPerTransfer < 0) )
+      return;
+   s_I2CSchedulerDevices[iDevice].iMsgsPerTransfer = iMsgsPerTransfer;
+}
+
+void i2c_scheduler_remove_all_devices()
+{
+   s_iI2CSchedulerCountDevices = 0;
+}
+
+int i2c_scheduler_get_devices_count()
+{
+   return s_iI2CSchedulerCountDevices;
+}
+
+t_i2c_scheduler_device_stats* i2c_scheduler_get_device_stats(int iDevice)
+{
+   if ( (iDevice < 0) || (iDevice >= s_iI2CSchedulerCountDevices) )
+      return NULL;
+   return &(s_I2CSchedulerDevices[iDevice].stats);
+}
+
+static int _i2c_scheduler_is_due(t_i2c_scheduled_device* pDevice, u32 uTimeNow)
+{
+   if ( pDevice->bReadAgain )
+      return 1;
+   return ((int)(pDevice->uNextDeadlineMicros - uTimeNow) <= 0)?1:0;
+}
+
+// Higher priority first, then earlier deadline
+static int _i2c_scheduler_is_before(t_i2c_scheduled_device* pDevice1, t_i2c_scheduled_device* pDevice2)
+{
+   if ( pDevice1->iPriority != pDevice2->iPriority )
+      return (pDevice1->iPriority < pDevice2->iPriority)?1:0;
+   return ((int)(pDevice1->uNextDeadlineMicros - pDevice2->uNextDeadlineMicros) < 0)?1:0;
+}
+
+static void _i2c_scheduler_on_read_failed(int iDevice, u32 uTimeNow, int bBusError)
+{
+   t_i2c_scheduled_device* pDevice = &(s_I2CSchedulerDevices[iDevice]);
+   pDevice->stats.uErrors++;
+   pDevice->stats.uConsecutiveErrors++;
+   pDevice->bReadAgain = 0;
+
+   u32 uBackoffMs = pDevice->uPeriodMicros/1000;
+   for( u32 i=0; i<pDevice->stats.uConsecutiveErrors && uBackoffMs < I2C_SCHEDULER_MAX_BACKOFF_MS; i++ )
+      uBackoffMs *= 2;
+   if ( uBackoffMs > I2C_SCHEDULER_MAX_BACKOFF_MS )
+      uBackoffMs = I2C_SCHEDULER_MAX_BACKOFF_MS;
+   if ( uBackoffMs < pDevice->uPeriodMicros/1000 )
+      uBackoffMs = pDevice->uPeriodMicros/1000;
+   pDevice->stats.uBackoffMs = uBackoffMs;
+   pDevice->uNextDeadlineMicros = uTimeNow + uBackoffMs*1000;
+
+   if ( bBusError && (NULL != pDevice->pfError) )
+      pDevice->pfError(iDevice, pDevice->pContext, pDevice->stats.uConsecutiveErrors);
+}
+
+static void _i2c_scheduler_on_read_done(int iDevice, u32 uTimeNow)
+{
+   t_i2c_scheduled_device* pDevice = &(s_I2CSchedulerDevices[iDevice]);
+   pDevice->stats.uReads++;
+   pDevice->stats.uLastReadTimeMs = _i2c_scheduler_micros_to_ms(uTimeNow);
+
+   int iResult = pDevice->pfResult(iDevice, pDevice->pContext, pDevice->uBuffer, pDevice->stats.uLastReadTimeMs);
+   if ( I2C_SCHEDULER_RESULT_ERROR == iResult )
+   {
+      _i2c_scheduler_on_read_failed(iDevice, uTimeNow, 0);
+      return;
+   }
+   pDevice->stats.uConsecutiveErrors = 0;
+   pDevice->stats.uBackoffMs = 0;
+
+   if ( I2C_SCHEDULER_RESULT_MORE == iResult )
+   {
+      // Keeps the periodic deadline, this is part of the same read
+      pDevice->bReadAgain = 1;
+      return;
+   }
+   pDevice->bReadAgain = 0;
+   pDevice->uNextDeadlineMicros += pDevice->uPeriodMicros;
+   if ( (int)(pDevice->uNextDeadlineMicros - uTimeNow) <= 0 )
+      pDevice->uNextDeadlineMicros = uTimeNow + pDevice->uPeriodMicros;
+}
+
+// Earliest deadline of the higher priority devices that are not in the current batch
+static int _i2c_scheduler_get_guard_deadline(int iPriority, u32* puDeadline)
+{
+   int bHasGuard = 0;
+   for( int i=0; i<s_iI2CSchedulerCountDevices; i++ )
+   {
+      t_i2c_scheduled_device* pDevice = &(s_I2CSchedulerDevices[i]);
+      if ( pDevice->bInBatch || (pDevice->iPriority >= iPriority) )
+         continue;
+      if ( (! bHasGuard) || ((int)(pDevice->uNextDeadlineMicros - *puDeadline) < 0) )
+         *puDeadline = pDevice->uNextDeadlineMicros;
+      bHasGuard = 1;
+   }
+   return bHasGuard;
+}
+
+// Reads the due devices on a bus in one transaction
+static void _i2c_scheduler_run_bus(int iBus, u32 uTimeNow)
+{
+   int iCandidates[I2C_SCHEDULER_MAX_DEVICES];
+   int iCountCandidates = 0;
+
+   for( int i=0; i<s_iI2CSchedulerCountDevices; i++ )
+   {
+      t_i2c_scheduled_device* pDevice = &(s_I2CSchedulerDevices[i]);
+      pDevice->bInBatch = 0;
+      if ( (pDevice->iBus != iBus) || (! _i2c_scheduler_is_due(pDevice, uTimeNow)) )
+         continue;
+      int iPos = iCountCandidates;
+      while ( (iPos > 0) && _i2c_scheduler_is_before(pDevice, &(s_I2CSchedulerDevices[iCandidates[iPos-1]])) )
+      {
+         iCandidates[iPos] = iCandidates[iPos-1];
+         iPos--;
+      }
+      iCandidates[iPos] = i;
+      iCountCandidates++;
+   }
+
+   int iBatch[I2C_SCHEDULER_MAX_DEVICES];
+   int iCountBatch = 0;
+   int iCountMsgs = 0;
+   u32 uEstimatedMicros = 0;
+   struct i2c_msg msgs[I2C_SCHEDULER_MAX_DEVICE_MSGS];
+
+   for( int k=0; k<iCountCandidates; k++ )
+   {
+      int iDevice = iCandidates[k];
+      t_i2c_scheduled_device* pDevice = &(s_I2CSchedulerDevices[iDevice]);
+
+      if ( iCountMsgs + 1 > I2C_SCHEDULER_MAX_BATCH_MSGS )
+         break;
+      // Not batched: read alone, in the next pass if other devices are in this one
+      if ( (pDevice->iMsgsPerTransfer > 0) && (iCountBatch > 0) )
+         continue;
+
+      // Would delay a higher priority device past its deadline?
+      u32 uGuard = 0;
+      if ( pDevice->uDeferredCount < I2C_SCHEDULER_MAX_DEFERRED )
+      if ( _i2c_scheduler_get_guard_deadline(pDevice->iPriority, &uGuard) )
+      if ( (int)(uTimeNow + uEstimatedMicros + pDevice->stats.uAvgDurationMicros - uGuard) > 0 )
+      {
+         pDevice->bDeferred = 1;
+         pDevice->uDeferredCount++;
+         pDevice->stats.uDeferred++;
+         continue;
+      }
+
+      memset(msgs, 0, sizeof(msgs));
+      int iCount = pDevice->pfBuild(iDevice, pDevice->pContext, msgs, I2C_SCHEDULER_MAX_DEVICE_MSGS, pDevice->uBuffer);
+      if ( iCount > I2C_SCHEDULER_MAX_DEVICE_MSGS )
+      {
+         log_softerror_and_alarm("[I2CScheduler] Device 0x%02X read has %d messages, max is %d. Read dropped.", pDevice->uAddress, iCount, I2C_SCHEDULER_MAX_DEVICE_MSGS);
+         _i2c_scheduler_on_read_failed(iDevice, uTimeNow, 0);
+         continue;
+      }
+      if ( iCount <= 0 )
+      {
+         // Nothing to read this time
+         pDevice->bReadAgain = 0;
+         pDevice->uNextDeadlineMicros = uTimeNow + pDevice->uPeriodMicros;
+         continue;
+      }
+      // Doesn't fit, stays due for the next transaction
+      if ( iCountMsgs + iCount > I2C_SCHEDULER_MAX_BATCH_MSGS )
+         continue;
+
+      if ( ! pDevice->bReadAgain )
+      {
+         u32 uLateness = uTimeNow - pDevice->uNextDeadlineMicros;
+         if ( uLateness > pDevice->stats.uMaxLatenessMicros )
+            pDevice->stats.uMaxLatenessMicros = uLateness;
+         if ( uLateness > pDevice->uPeriodMicros )
+            pDevice->stats.uDeadlineMisses++;
+      }
+
+      pDevice->bInBatch = 1;
+      pDevice->uDeferredCount = 0;
+      pDevice->iFirstMsg = iCountMsgs;
+      pDevice->iCountMsgs = iCount;
+      pDevice->uBytes = 0;
+      for( int i=0; i<iCount; i++ )
+      {
+         msgs[i].addr = pDevice->uAddress;
+         pDevice->uBytes += msgs[i].len + 1;
+      }
+      memcpy(&(s_I2CSchedulerMsgs[iCountMsgs]), msgs, iCount*sizeof(struct i2c_msg));
+      iCountMsgs += iCount;
+      uEstimatedMicros += pDevice->stats.uAvgDurationMicros;
+      iBatch[iCountBatch] = iDevice;
+      iCountBatch++;
+      if ( pDevice->iMsgsPerTransfer > 0 )
+         break;
+   }
+
+   if ( 0 == iCountBatch )
+      return;
+
+   u32 uTimeStart = _i2c_scheduler_now_micros();
+   int iResult = -1;
+   if ( 1 == iCountBatch )
+      iResult = _i2c_scheduler_transfer_device(&(s_I2CSchedulerDevices[iBatch[0]]), s_I2CSchedulerMsgs, iCountMsgs);
+   else
+      iResult = _i2c_scheduler_transfer(iBus, s_I2CSchedulerMsgs, iCountMsgs);
+   u32 uTimeEnd = _i2c_scheduler_now_micros();
+
+   if ( iResult == iCountMsgs )
+   {
+      // The transaction time is split by the devices estimated durations (by their bytes until all are known)
+      u32 uWeights[I2C_SCHEDULER_MAX_DEVICES];
+      u32 uTotalWeight = 0;
+      int bUseBytes = 0;
+      for( int k=0; k<iCountBatch; k++ )
+      {
+         if ( 0 == s_I2CSchedulerDevices[iBatch[k]].stats.uAvgDurationMicros )
+            bUseBytes = 1;
+      }
+      for( int k=0; k<iCountBatch; k++ )
+      {
+         t_i2c_scheduled_device* pDevice = &(s_I2CSchedulerDevices[iBatch[k]]);
+         uWeights[k] = bUseBytes?pDevice->uBytes:pDevice->stats.uAvgDurationMicros;
+         uTotalWeight += uWeights[k];
+      }
+
+      for( int k=0; k<iCountBatch; k++ )
+      {
+         t_i2c_scheduled_device* pDevice = &(s_I2CSchedulerDevices[iBatch[k]]);
+         u32 uDuration = (u32)(((unsigned long long)(uTimeEnd - uTimeStart)) * uWeights[k] / uTotalWeight);
+         if ( 0 == pDevice->stats.uAvgDurationMicros )
+            pDevice->stats.uAvgDurationMicros = uDuration;
+         else
+            pDevice->stats.uAvgDurationMicros = (pDevice->stats.uAvgDurationMicros*3 + uDuration)/4;
+         _i2c_scheduler_on_read_done(iBatch[k], uTimeEnd);
+      }
+      return;
+   }
+
+   if ( 1 == iCountBatch )
+   {
+      _i2c_scheduler_on_read_failed(iBatch[0], uTimeEnd, 1);
+      return;
+   }
+
+   // Find out which devices failed the transaction
+   for( int k=0; k<iCountBatch; k++ )
+   {
+      t_i2c_scheduled_device* pDevice = &(s_I2CSchedulerDevices[iBatch[k]]);
+      iResult = _i2c_scheduler_transfer_device(pDevice, &(s_I2CSchedulerMsgs[pDevice->iFirstMsg]), pDevice->iCountMsgs);
+      uTimeEnd = _i2c_scheduler_now_micros();
+      if ( iResult == pDevice->iCountMsgs )
+         _i2c_scheduler_on_read_done(iBatch[k], uTimeEnd);
+      else
+         _i2c_scheduler_on_read_failed(iBatch[k], uTimeEnd, 1);
+   }
+}
+
+u32 i2c_scheduler_run()
+{
+   for( int i=0; i<s_iI2CSchedulerCountDevices; i++ )
+      s_I2CSchedulerDevices[i].bDeferred = 0;
+
+   // Busses are served in the order of their highest priority due device
+   for( int iPass=0; iPass<2*I2C_SCHEDULER_MAX_DEVICES; iPass++ )
+   {
+      u32 uTimeNow = _i2c_scheduler_now_micros();
+      t_i2c_scheduled_device* pFirst = NULL;
+      for( int i=0; i<s_iI2CSchedulerCountDevices; i++ )
+      {
+         t_i2c_scheduled_device* pDevice = &(s_I2CSchedulerDevices[i]);
+         if ( pDevice->bDeferred || (! _i2c_scheduler_is_due(pDevice, uTimeNow)) )
+            continue;
+         if ( (NULL == pFirst) || _i2c_scheduler_is_before(pDevice, pFirst) )
+            pFirst = pDevice;
+      }
+      if ( NULL == pFirst )
+         break;
+      _i2c_scheduler_run_bus(pFirst->iBus, uTimeNow);
+   }
+
+   u32 uTimeNow = _i2c_scheduler_now_micros();
+   u32 uWait = I2C_SCHEDULER_MAX_IDLE_MICROS;
+   for( int i=0; i<s_iI2CSchedulerCountDevices; i++ )
+   {
+      t_i2c_scheduled_device* pDevice = &(s_I2CSchedulerDevices[i]);
+      // Held back devices wait for the higher priority device deadline
+      if ( pDevice->bDeferred )
+         continue;
+      if ( _i2c_scheduler_is_due(pDevice, uTimeNow) )
+         return 0;
+      u32 uDelta = pDevice->uNextDeadlineMicros - uTimeNow;
+      if ( uDelta < uWait )
+         uWait = uDelta;
+   }
+   return uWait;
+}
+
+void i2c_scheduler_log_stats()
+{
+   for( int i=0; i<s_iI2CSchedulerCountDevices; i++ )
+   {
+      t_i2c_scheduled_device* pDevice = &(s_I2CSchedulerDevices[i]);
+      log_line("[I2CScheduler] Device 0x%02X (bus %d, priority %d): %u reads, %u errors, %u deferred, %u missed deadlines, max late: %u us, avg duration: %u us, backoff: %u ms",
+         pDevice->uAddress, pDevice->iBus, pDevice->iPriority, pDevice->stats.uReads, pDevice->stats.uErrors,
+         pDevice->stats.uDeferred, pDevice->stats.uDeadlineMisses, pDevice->stats.uMaxLatenessMicros,
+         pDevice->stats.uAvgDurationMicros, pDevice->stats.uBackoffMs);
+   }
+}
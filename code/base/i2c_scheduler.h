@@ -0,0 +1,88 @@
+#pragma once
+#include "base.h"
+#include <linux/i2c.h>
+
+// I2C devices poll scheduler: each device is read at its own period, by priority (RC input first,
+// then buttons/encoders, then power sensors). The due reads of the devices on the same bus are sent
+// as a single combined transaction (I2C_RDWR ioctl, with repeated starts between the messages).
+// A lower priority read is held back if it would make a higher priority device miss its deadline.
+// Failing devices are backed off (their period doubled on each consecutive error, up to I2C_SCHEDULER_MAX_BACKOFF_MS).
+// When a batched transaction fails, its devices are retried one by one to find the failing ones.
+// Devices that need a STOP between their messages are not batched, their messages are sent as separate transactions.
+
+#define I2C_SCHEDULER_MAX_DEVICES 16
+#define I2C_SCHEDULER_MAX_BUSSES 8
+#define I2C_SCHEDULER_MAX_BATCH_MSGS 42 // I2C_RDWR_IOCTL_MAX_MSGS
+#define I2C_SCHEDULER_MAX_DEVICE_MSGS 36
+#define I2C_SCHEDULER_DEVICE_BUFFER_SIZE 128
+#define I2C_SCHEDULER_MAX_BACKOFF_MS 2000
+#define I2C_SCHEDULER_MAX_DEFERRED 4 // a held back read is forced after this many passes
+#define I2C_SCHEDULER_MAX_IDLE_MICROS 500000 // longest wait returned when there is nothing to read
+
+#define I2C_SCHEDULER_PRIORITY_RC_IN 0
+#define I2C_SCHEDULER_PRIORITY_BUTTONS 1
+#define I2C_SCHEDULER_PRIORITY_POWER 2
+
+#define I2C_SCHEDULER_RESULT_ERROR 0 // invalid response (CRC...), counts as a failed read
+#define I2C_SCHEDULER_RESULT_OK 1
+#define I2C_SCHEDULER_RESULT_MORE 2 // read the device again right away (multi step reads)
+
+typedef struct
+{
+   u32 uReads;
+   u32 uErrors;
+   u32 uConsecutiveErrors;
+   u32 uBackoffMs; // current backoff, 0 if not failing
+   u32 uDeferred; // reads held back for a higher priority device
+   u32 uDeadlineMisses; // reads done more than a period late
+   u32 uMaxLatenessMicros;
+   u32 uAvgDurationMicros; // estimated duration of the device part of a transaction
+   u32 uLastReadTimeMs;
+} t_i2c_scheduler_device_stats;
+
+// Bus operations, for testing on a simulated bus.
+// pfTransfer runs the messages as one combined transaction; returns the messages count or -1 on error.
+// pfGetTimeMicros can be NULL for the system clock.
+typedef struct
+{
+   void* pContext;
+   int (*pfTransfer)(void* pContext, int iBus, struct i2c_msg* pMsgs, int iCount);
+   u32 (*pfGetTimeMicros)(void* pContext);
+} t_i2c_bus_ops;
+
+// Fills in the device read messages (up to iMaxMsgs), with the data buffers in pBuffer
+// (I2C_SCHEDULER_DEVICE_BUFFER_SIZE bytes). Returns the messages count, 0 to skip this read.
+// Longer reads are split in steps (I2C_SCHEDULER_RESULT_MORE).
+typedef int (*i2c_scheduler_build_callback)(int iDevice, void* pContext, struct i2c_msg* pMsgs, int iMaxMsgs, u8* pBuffer);
+// Called after a successful transfer, with the buffer holding the read data and the transfer end time.
+// Returns one of I2C_SCHEDULER_RESULT_*
+typedef int (*i2c_scheduler_result_callback)(int iDevice, void* pContext, u8* pBuffer, u32 uTimeMs);
+// Called when the device read failed on the bus (after the retry)
+typedef void (*i2c_scheduler_error_callback)(int iDevice, void* pContext, u32 uConsecutiveErrors);
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// pBusOps NULL to use the /dev/i2c-N busses
+void i2c_scheduler_init(t_i2c_bus_ops* pBusOps);
+// Removes the devices and closes the busses
+void i2c_scheduler_release();
+
+// Returns the device index, -1 on error
+int i2c_scheduler_add_device(int iBus, u8 uAddress, int iPriority, u32 uPeriodMs,
+     i2c_scheduler_build_callback pfBuild, i2c_scheduler_result_callback pfResult, i2c_scheduler_error_callback pfError, void* pContext);
+void i2c_scheduler_set_device_period(int iDevice, u32 uPeriodMs);
+// Sends the device messages as separate transactions of iMsgsPerTransfer messages each, 0 (default) for one transaction
+void i2c_scheduler_set_device_msgs_per_transfer(int iDevice, int iMsgsPerTransfer);
+void i2c_scheduler_remove_all_devices();
+int i2c_scheduler_get_devices_count();
+
+// Reads the due devices. Returns the micros until the next deadline
+u32 i2c_scheduler_run();
+t_i2c_scheduler_device_stats* i2c_scheduler_get_device_stats(int iDevice);
+void i2c_scheduler_log_stats();
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,201 @@
+/*
+You can use this C/C++ code however you wish (for example, but not limited to:
+     as is, or by modifying it, or by adding new code, or by removing parts of the code;
+     in public or private projects, in new free or commercial products)
+     only if you get a priori written consent from Petru Soroaga (petrusoroaga@yahoo.com) for your specific use
+     and only if this copyright terms are preserved in the code.
+     This code is public for learning and academic purposes.
+Also, check the licences folder for additional licences terms.
+Code written by: Petru Soroaga, 2021-2023
+*/
+
+#include "latency_trace.h"
+#include "hardware.h"
+
+static const char* s_szLatencyTraceStageNames[LATENCY_TRACE_STAGES_COUNT] =
+{
+   "try_read_video_input",
+   "_onNewCompletePacketReadFromInput",
+   "fec_encode",
+   "send_packet_to_radio_interfaces",
+   "process_received_radio_packets",
+   "_reconstruct_block",
+   "_push_first_block_out",
+   "processor_rx_video_forward_video_data"
+};
+
+static shared_mem_latency_trace s_LatencyTraceLocal;
+static shared_mem_latency_trace* s_pLatencyTraceSharedMem = NULL;
+static u32 s_uLatencyTraceLastPublishTime = 0;
+
+static u32 _latency_trace_measure_sample_cost()
+{
+   // Time a batch of trace points on a scratch histogram, same work as a real trace point
+   t_latency_trace_histogram histogram;
+   memset(&histogram, 0, sizeof(t_latency_trace_histogram));
+   int iCount = 2000;
+   u32 uStart = latency_trace_now_nanos();
+   for( int i=0; i<iCount; i++ )
+   {
+      u32 uBegin = latency_trace_now_nanos();
+      u32 uValue = latency_trace_now_nanos() - uBegin;
+      histogram.uCount++;
+      histogram.dTotalNanos += uValue;
+      if ( uValue > histogram.uMaxNanos )
+         histogram.uMaxNanos = uValue;
+      histogram.uBuckets[latency_trace_bucket_for_value(uValue)]++;
+   }
+   u32 uTotal = latency_trace_now_nanos() - uStart;
+   return uTotal/iCount;
+}
+
+int latency_trace_init(const char* szSharedMemName)
+{
+   latency_trace_reset();
+   s_LatencyTraceLocal.uSampleCostNanos = _latency_trace_measure_sample_cost();
+
+   s_pLatencyTraceSharedMem = NULL;
+   if ( NULL != szSharedMemName )
+   {
+      s_pLatencyTraceSharedMem = (shared_mem_latency_trace*)open_shared_mem_for_write(szSharedMemName, sizeof(shared_mem_latency_trace));
+      if ( NULL == s_pLatencyTraceSharedMem )
+      {
+         log_softerror_and_alarm("[LatencyTrace] Failed to open shared memory %s for write.", szSharedMemName);
+         return 0;
+      }
+   }
+   log_line("[LatencyTrace] Started latency tracing (%s), cost per trace point: %u ns.", (NULL != szSharedMemName)?szSharedMemName:"local only", s_LatencyTraceLocal.uSampleCostNanos);
+   return 1;
+}
+
+void latency_trace_uninit()
+{
+   if ( NULL != s_pLatencyTraceSharedMem )
+      munmap(s_pLatencyTraceSharedMem, sizeof(shared_mem_latency_trace));
+   s_pLatencyTraceSharedMem = NULL;
+}
+
+void latency_trace_reset()
+{
+   u32 uCost = s_LatencyTraceLocal.uSampleCostNanos;
+   u32 uCounter = s_LatencyTraceLocal.uUpdateCounter;
+   memset(&s_LatencyTraceLocal, 0, sizeof(shared_mem_latency_trace));
+   s_LatencyTraceLocal.uSampleCostNanos = uCost;
+   s_LatencyTraceLocal.uUpdateCounter = uCounter;
+   s_LatencyTraceLocal.uTimeStart = get_current_timestamp_ms();
+}
+
+int latency_trace_bucket_for_value(u32 uNanos)
+{
+   if ( uNanos < LATENCY_TRACE_LINEAR_BUCKETS )
+      return (int)uNanos;
+   int iTopBit = 31 - __builtin_clz(uNanos); // >= 4
+   int iSubBucket = (uNanos >> (iTopBit-2)) & 0x03;
+   return LATENCY_TRACE_LINEAR_BUCKETS + (iTopBit-4)*4 + iSubBucket;
+}
+
+u32 latency_trace_bucket_upper_value(int iBucket)
+{
+   if ( iBucket < LATENCY_TRACE_LINEAR_BUCKETS )
+      return (u32)iBucket;
+   int iTopBit = 4 + (iBucket - LATENCY_TRACE_LINEAR_BUCKETS)/4;
+   int iSubBucket = (iBucket - LATENCY_TRACE_LINEAR_BUCKETS)%4;
+   unsigned long long uValue = (1ULL << iTopBit) + (((unsigned long long)(iSubBucket+1)) << (iTopBit-2)) - 1;
+   if ( uValue > MAX_U32 )
+      return MAX_U32;
+   return (u32)uValue;
+}
+
+void latency_trace_add_sample(int iStage, u32 uNanos)
+{
+   if ( iStage < 0 || iStage >= LATENCY_TRACE_STAGES_COUNT )
+      return;
+   t_latency_trace_histogram* pHistogram = &(s_LatencyTraceLocal.stages[iStage]);
+   pHistogram->uCount++;
+   pHistogram->dTotalNanos += uNanos;
+   if ( uNanos > pHistogram->uMaxNanos )
+      pHistogram->uMaxNanos = uNanos;
+   pHistogram->uBuckets[latency_trace_bucket_for_value(uNanos)]++;
+   s_LatencyTraceLocal.uTotalSamples++;
+}
+
+void latency_trace_periodic(u32 uTimeNowMs)
+{
+   if ( uTimeNowMs < s_uLatencyTraceLastPublishTime + LATENCY_TRACE_PUBLISH_INTERVAL_MS )
+      return;
+   latency_trace_publish(uTimeNowMs);
+}
+
+void latency_trace_publish(u32 uTimeNowMs)
+{
+   s_uLatencyTraceLastPublishTime = uTimeNowMs;
+   s_LatencyTraceLocal.uTimeLastUpdate = uTimeNowMs;
+   if ( NULL == s_pLatencyTraceSharedMem )
+      return;
+
+   // Same scheme as the model store: counter is odd while the data is being updated
+   u32 uCounter = s_pLatencyTraceSharedMem->uUpdateCounter;
+   __sync_lock_test_and_set(&(s_pLatencyTraceSharedMem->uUpdateCounter), uCounter | 0x01);
+   __sync_synchronize();
+   memcpy(((u8*)s_pLatencyTraceSharedMem) + sizeof(u32), ((u8*)&s_LatencyTraceLocal) + sizeof(u32), sizeof(shared_mem_latency_trace) - sizeof(u32));
+   __sync_synchronize();
+   __sync_lock_test_and_set(&(s_pLatencyTraceSharedMem->uUpdateCounter), (uCounter | 0x01) + 1);
+}
+
+shared_mem_latency_trace* latency_trace_get_local_data()
+{
+   return &s_LatencyTraceLocal;
+}
+
+const char* latency_trace_get_stage_name(int iStage)
+{
+   if ( iStage < 0 || iStage >= LATENCY_TRACE_STAGES_COUNT )
+      return "N/A";
+   return s_szLatencyTraceStageNames[iStage];
+}
+
+u32 latency_trace_get_percentile(const t_latency_trace_histogram* pHistogram, float fPercentile)
+{
+   if ( NULL == pHistogram || 0 == pHistogram->uCount )
+      return 0;
+   double dTarget = (double)pHistogram->uCount * fPercentile / 100.0;
+   double dSum = 0.0;
+   for( int i=0; i<LATENCY_TRACE_BUCKETS; i++ )
+   {
+      dSum += pHistogram->uBuckets[i];
+      if ( dSum >= dTarget && pHistogram->uBuckets[i] > 0 )
+      {
+         u32 uValue = latency_trace_bucket_upper_value(i);
+         if ( uValue > pHistogram->uMaxNanos )
+            uValue = pHistogram->uMaxNanos;
+         return uValue;
+      }
+   }
+   return pHistogram->uMaxNanos;
+}
+
+shared_mem_latency_trace* latency_trace_open_for_read(const char* szSharedMemName)
+{
+   return (shared_mem_latency_trace*)open_shared_mem_for_read(szSharedMemName, sizeof(shared_mem_latency_trace));
+}
+
+int latency_trace_read_snapshot(shared_mem_latency_trace* pSharedMem, shared_mem_latency_trace* pOutSnapshot)
+{
+   if ( NULL == pSharedMem || NULL == pOutSnapshot )
+      return 0;
+   for( int i=0; i<10; i++ )
+   {
+      u32 uCounter = pSharedMem->uUpdateCounter;
+      if ( uCounter & 0x01 )
+      {
+         hardware_sleep_ms(1);
+         continue;
+      }
+      __sync_synchronize();
+      memcpy(pOutSnapshot, pSharedMem, sizeof(shared_mem_latency_trace));
+      __sync_synchronize();
+      if ( pSharedMem->uUpdateCounter == uCounter )
+         return 1;
+   }
+   return 0;
+}
@@ -0,0 +1,90 @@
+#pragma once
+#include "base.h"
+#include "config.h"
+#include "shared_mem.h"
+
+// Per stage latency tracing for the video pipeline.
+// Trace points add samples to fixed bucket histograms kept in process memory;
+// the histograms are published periodically to a shared memory segment, read by ruby_latency_stats.
+// The trace points compile to nothing unless FEATURE_LATENCY_TRACE is defined (config.h).
+
+#define LATENCY_TRACE_STAGE_VEHICLE_READ_VIDEO_INPUT 0
+#define LATENCY_TRACE_STAGE_VEHICLE_NEW_VIDEO_PACKET 1
+#define LATENCY_TRACE_STAGE_VEHICLE_FEC_ENCODE 2
+#define LATENCY_TRACE_STAGE_VEHICLE_SEND_TO_RADIO 3
+#define LATENCY_TRACE_STAGE_STATION_RECEIVE_RADIO 4
+#define LATENCY_TRACE_STAGE_STATION_RECONSTRUCT_BLOCK 5
+#define LATENCY_TRACE_STAGE_STATION_PUSH_BLOCK_OUT 6
+#define LATENCY_TRACE_STAGE_STATION_FORWARD_VIDEO 7
+#define LATENCY_TRACE_STAGES_COUNT 8
+
+// Buckets, in nanoseconds: 0..15 one bucket each, then 4 buckets for each power of 2 up to 2^32
+#define LATENCY_TRACE_LINEAR_BUCKETS 16
+#define LATENCY_TRACE_BUCKETS (LATENCY_TRACE_LINEAR_BUCKETS + 28*4)
+
+#define LATENCY_TRACE_PUBLISH_INTERVAL_MS 500
+
+typedef struct
+{
+   u32 uCount;
+   u32 uMaxNanos;
+   double dTotalNanos;
+   u32 uBuckets[LATENCY_TRACE_BUCKETS];
+} __attribute__((packed)) t_latency_trace_histogram;
+
+typedef struct
+{
+   u32 uUpdateCounter; // odd while the writer is updating the data
+   u32 uTimeStart; // ms, when the tracing (re)started
+   u32 uTimeLastUpdate; // ms
+   u32 uSampleCostNanos; // measured cost of one trace point (two timestamps + histogram update)
+   u32 uTotalSamples;
+   t_latency_trace_histogram stages[LATENCY_TRACE_STAGES_COUNT];
+} __attribute__((packed)) shared_mem_latency_trace;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+static inline u32 latency_trace_now_nanos()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (u32)(ts.tv_sec*1000000000LL + ts.tv_nsec);
+}
+
+int latency_trace_init(const char* szSharedMemName);
+void latency_trace_uninit();
+void latency_trace_reset();
+void latency_trace_add_sample(int iStage, u32 uNanos);
+void latency_trace_periodic(u32 uTimeNowMs);
+void latency_trace_publish(u32 uTimeNowMs);
+shared_mem_latency_trace* latency_trace_get_local_data();
+
+const char* latency_trace_get_stage_name(int iStage);
+int latency_trace_bucket_for_value(u32 uNanos);
+u32 latency_trace_bucket_upper_value(int iBucket);
+// Returns the upper bound of the bucket holding the given percentile (0..100)
+u32 latency_trace_get_percentile(const t_latency_trace_histogram* pHistogram, float fPercentile);
+
+shared_mem_latency_trace* latency_trace_open_for_read(const char* szSharedMemName);
+// Copies a consistent snapshot of the shared data; returns 0 if the writer kept updating it
+int latency_trace_read_snapshot(shared_mem_latency_trace* pSharedMem, shared_mem_latency_trace* pOutSnapshot);
+
+#ifdef __cplusplus
+}
+#endif
+
+#ifdef FEATURE_LATENCY_TRACE
+#define LATENCY_TRACE_INIT(name) latency_trace_init(name)
+#define LATENCY_TRACE_UNINIT() latency_trace_uninit()
+#define LATENCY_TRACE_PERIODIC(timeNow) latency_trace_periodic(timeNow)
+#define LATENCY_TRACE_BEGIN(var) u32 var = latency_trace_now_nanos()
+#define LATENCY_TRACE_END(stage, var) latency_trace_add_sample(stage, latency_trace_now_nanos() - (var))
+#else
+#define LATENCY_TRACE_INIT(name)
+#define LATENCY_TRACE_UNINIT()
+#define LATENCY_TRACE_PERIODIC(timeNow)
+#define LATENCY_TRACE_BEGIN(var)
+#define LATENCY_TRACE_END(stage, var)
+#endif
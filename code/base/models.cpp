@@ -12,6 +12,7 @@ Code written by: Petru Soroaga, 2021-2023
 #include "base.h"
 #include "models.h"
 #include <stdlib.h>
+#include <sys/stat.h>
 #include "config.h"
 #include "hardware.h"
 #include "hw_procs.h"
@@ -30,6 +31,8 @@ int sModelsSpectatorCount = 0;
 Model* spModels[MAX_MODELS];
 int sModelsCount = 0;
 
+static u8* _model_read_binary_file(const char* szFile, int* piLength);
+
 static const char* s_szModelFlightModeNONE = "NONE";
 static const char* s_szModelFlightModeMAN  = "MAN";
 static const char* s_szModelFlightModeSTAB = "STAB";
@@ -413,6 +416,7 @@ Model::Model(void)
    vehicle_name[0] = 0;
    vehicle_long_name[0] = 0;
    iLoadedFileVersion = 0;
+   uLoadedStoreGeneration = 0;
    radioInterfacesParams.interfaces_count = 0;
 
    constructLongName();
@@ -447,13 +451,22 @@ int Model::getLoadedFileVersion()
 
 bool Model::reloadIfChanged(bool bLoadStats)
 {
+   // Fast path: a single generation compare against the shared model store
+   u32 uGeneration = 0;
+   if ( model_shared_store_get_generation(&uGeneration) )
+   {
+      if ( uGeneration == uLoadedStoreGeneration )
+         return true;
+      if ( loadFromSharedStore(bLoadStats) )
+         return true;
+   }
+
    FILE* fd = fopen(FILE_CURRENT_VEHICLE_MODEL, "r");
    if ( NULL == fd )
       return false;
 
    int iV, iS = 0;
-   if ( 1 == fscanf(fd, "%*s %d", &iV) )
-   if ( 1 == fscanf(fd, "%*s %d", &iS) )
+   if ( 2 == fscanf(fd, "%*s %d %*s %*s %d", &iV, &iS) )
    if ( iS != iSaveCount )
    {
       fclose(fd);
@@ -464,6 +477,67 @@ bool Model::reloadIfChanged(bool bLoadStats)
 }
 
 bool Model::loadFromFile(const char* filename, bool bLoadStats)
+{
+   u32 timeStart = get_current_timestamp_ms();
+
+   u32 uStoreGeneration = 0;
+   if ( 0 == strcmp(filename, FILE_CURRENT_VEHICLE_MODEL) )
+      model_shared_store_get_generation(&uStoreGeneration);
+
+   // Try the binary model first. It is used only if it matches the text model save count,
+   // otherwise the text model was written by a different software version and must be migrated.
+   // A text model that can't be parsed doesn't match any binary model (the text loader falls back to the backup).
+   // Callers that write a new text model with an unrelated save count (received models) remove the binary file first.
+
+   char szFileBinary[1024];
+   model_get_binary_file_name(filename, szFileBinary);
+   int iBinaryLength = 0;
+   u8* pBinary = _model_read_binary_file(szFileBinary, &iBinaryLength);
+   if ( NULL != pBinary )
+   {
+      int iTextVersion = 0;
+      int iTextSaveCount = -1;
+      bool bHasTextFile = false;
+      bool bTextReadOk = true;
+      FILE* fd = fopen(filename, "r");
+      if ( NULL != fd )
+      {
+         bHasTextFile = true;
+         if ( 2 != fscanf(fd, "%*s %d %*s %*s %d", &iTextVersion, &iTextSaveCount) )
+            bTextReadOk = false;
+         fclose(fd);
+      }
+      t_model_binary_header* pHeader = (t_model_binary_header*)pBinary;
+      bool bBinaryOk = false;
+      if ( ! bTextReadOk )
+         log_softerror_and_alarm("[ModelStore] Can't read the text model save count (%s). Ignoring binary model.", filename);
+      else if ( (! bHasTextFile) || (iTextSaveCount == (int)pHeader->uSaveCount) )
+         bBinaryOk = loadFromBinaryBuffer(pBinary, iBinaryLength, bLoadStats);
+      else
+         log_line("[ModelStore] Binary model save count (%u) differs from text model save count (%d). Migrating from text model.", pHeader->uSaveCount, iTextSaveCount);
+      free(pBinary);
+
+      if ( bBinaryOk )
+      {
+         validate_settings();
+         uLoadedStoreGeneration = uStoreGeneration;
+         timeStart = get_current_timestamp_ms() - timeStart;
+         log_line("Loaded vehicle successfully (%u ms) from binary file: %s; save count: %d, vehicle name: [%s], vehicle id: %u, software: %d.%d (b%d), is in control mode: %s, %d radio links",
+            timeStart, szFileBinary, iSaveCount, vehicle_name, vehicle_id, (sw_version >> 8) & 0xFF, sw_version & 0xFF, sw_version>>16, is_spectator?"no (is spectator)":"yes", radioLinksParams.links_count);
+         return true;
+      }
+   }
+
+   if ( ! loadFromTextFile(filename, bLoadStats) )
+      return false;
+
+   uLoadedStoreGeneration = uStoreGeneration;
+   if ( saveToBinaryFile(szFileBinary) )
+      log_line("[ModelStore] Migrated text model to binary model file: %s", szFileBinary);
+   return true;
+}
+
+bool Model::loadFromTextFile(const char* filename, bool bLoadStats)
 {
    char szFileNormal[1024];
    char szFileBackup[1024];
@@ -1219,6 +1293,11 @@ bool Model::saveToFile(const char* filename, bool isOnController)
       fclose(fd);
    }
 
+   model_get_binary_file_name(filename, szBuff);
+   saveToBinaryFile(szBuff);
+   if ( 0 == strcmp(filename, FILE_CURRENT_VEHICLE_MODEL) )
+      publishToSharedStore();
+
    timeStart = get_current_timestamp_ms() - timeStart;
    char szLog[512];
    char szFreq1[64];
@@ -1597,6 +1676,516 @@ bool Model::saveVersion8(const char* szFile, FILE* fd, bool isOnController)
    return true;
 }
 
+//-----------------------------------------------------
+// Binary model store
+
+typedef struct
+{
+   u8  bDeveloperMode;
+   u32 uDeveloperFlags;
+   u32 uModelFlags;
+   int board_type;
+   char vehicle_name[MAX_VEHICLE_NAME_LENGTH];
+   u32 vehicle_id;
+   u32 controller_id;
+   u32 sw_version;
+   u8  is_spectator;
+   u8  vehicle_type;
+   int clock_sync_type;
+   u32 alarms;
+   u8  enableDHCP;
+   u32 camera_rc_channels;
+   u32 enc_flags;
+   int iGPSCount;
+   int niceRC;
+   int niceRouter;
+   int ioNiceRouter;
+   int niceTelemetry;
+   int niceVideo;
+   int niceOthers;
+   int ioNiceVideo;
+   int iOverVoltage;
+   int iFreqARM;
+   int iFreqGPU;
+   int iCameraCount;
+   int iCurrentCamera;
+   int iSaveCount;
+} __attribute__((packed)) t_model_binary_scalars;
+
+static shared_mem_model_store* s_pModelSharedStoreRead = NULL;
+static u32 s_uTimeLastTryOpenModelSharedStore = 0;
+
+void model_get_binary_file_name(const char* szTextFileName, char* szOutBinaryFileName)
+{
+   strcpy(szOutBinaryFileName, szTextFileName);
+   int iLen = strlen(szOutBinaryFileName);
+   if ( iLen > 4 && szOutBinaryFileName[iLen-4] == '.' )
+      strcpy(&szOutBinaryFileName[iLen-3], "mdb");
+   else
+      strcat(szOutBinaryFileName, ".mdb");
+}
+
+static shared_mem_model_store* _model_shared_store_open_read()
+{
+   if ( NULL != s_pModelSharedStoreRead )
+      return s_pModelSharedStoreRead;
+
+   // Do not hammer shm_open if no process published the model yet
+   u32 uTimeNow = get_current_timestamp_ms();
+   if ( (0 != s_uTimeLastTryOpenModelSharedStore) && (uTimeNow < s_uTimeLastTryOpenModelSharedStore + 2000) )
+      return NULL;
+   s_uTimeLastTryOpenModelSharedStore = uTimeNow;
+
+   int fd = shm_open(SHARED_MEM_MODEL_STORE, O_RDONLY, S_IRUSR | S_IWUSR);
+   if ( fd < 0 )
+      return NULL;
+   void* pRetVal = mmap(NULL, sizeof(shared_mem_model_store), PROT_READ, MAP_SHARED, fd, 0);
+   close(fd);
+   if ( pRetVal == MAP_FAILED )
+      return NULL;
+   s_pModelSharedStoreRead = (shared_mem_model_store*)pRetVal;
+   log_line("[ModelStore] Opened shared model store for read.");
+   return s_pModelSharedStoreRead;
+}
+
+int model_shared_store_get_generation(u32* pGeneration)
+{
+   shared_mem_model_store* pStore = _model_shared_store_open_read();
+   if ( NULL == pStore || NULL == pGeneration )
+      return 0;
+   u32 uGeneration = pStore->uGeneration;
+   if ( (uGeneration == 0) || (uGeneration & 0x01) )
+      return 0;
+   *pGeneration = uGeneration;
+   return 1;
+}
+
+static u8* _model_read_binary_file(const char* szFile, int* piLength)
+{
+   FILE* fd = fopen(szFile, "rb");
+   if ( NULL == fd )
+      return NULL;
+
+   u8* pBuffer = (u8*)malloc(MODEL_BINARY_MAX_SIZE);
+   if ( NULL == pBuffer )
+   {
+      fclose(fd);
+      return NULL;
+   }
+   int iLength = fread(pBuffer, 1, MODEL_BINARY_MAX_SIZE, fd);
+   fclose(fd);
+   if ( iLength < (int)sizeof(t_model_binary_header) )
+   {
+      free(pBuffer);
+      return NULL;
+   }
+   *piLength = iLength;
+   return pBuffer;
+}
+
+static void _model_binary_add_section(u8* pBuffer, int* piPos, int iMaxLength, int* piCount, u16 uSectionId, const void* pData, int iElementSize, int iElementsCount, bool* pbOk)
+{
+   if ( ! (*pbOk) )
+      return;
+   int iLength = iElementSize * iElementsCount;
+   if ( (*piPos) + (int)sizeof(t_model_binary_section_header) + iLength > iMaxLength )
+   {
+      log_softerror_and_alarm("[ModelStore] Buffer too small to add section %d (%d bytes).", uSectionId, iLength);
+      *pbOk = false;
+      return;
+   }
+   t_model_binary_section_header header;
+   header.uSectionId = uSectionId;
+   header.uFlags = 0;
+   header.uElementSize = (u32)iElementSize;
+   header.uElementsCount = (u32)iElementsCount;
+   header.uCRC = base_compute_crc32((u8*)pData, iLength);
+   memcpy(pBuffer + (*piPos), (u8*)&header, sizeof(t_model_binary_section_header));
+   (*piPos) += sizeof(t_model_binary_section_header);
+   memcpy(pBuffer + (*piPos), (const u8*)pData, iLength);
+   (*piPos) += iLength;
+   (*piCount)++;
+}
+
+// Returns the binary length or 0 on failure
+
+int Model::saveToBinaryBuffer(u8* pBuffer, int iMaxLength)
+{
+   if ( NULL == pBuffer || iMaxLength < (int)sizeof(t_model_binary_header) )
+      return 0;
+
+   t_model_binary_scalars scalars;
+   memset((u8*)&scalars, 0, sizeof(t_model_binary_scalars));
+   scalars.bDeveloperMode = bDeveloperMode?1:0;
+   scalars.uDeveloperFlags = uDeveloperFlags;
+   scalars.uModelFlags = uModelFlags;
+   scalars.board_type = board_type;
+   memcpy(scalars.vehicle_name, vehicle_name, MAX_VEHICLE_NAME_LENGTH);
+   scalars.vehicle_id = vehicle_id;
+   scalars.controller_id = controller_id;
+   scalars.sw_version = sw_version;
+   scalars.is_spectator = is_spectator?1:0;
+   scalars.vehicle_type = vehicle_type;
+   scalars.clock_sync_type = clock_sync_type;
+   scalars.alarms = alarms;
+   scalars.enableDHCP = enableDHCP?1:0;
+   scalars.camera_rc_channels = camera_rc_channels;
+   scalars.enc_flags = enc_flags;
+   scalars.iGPSCount = iGPSCount;
+   scalars.niceRC = niceRC;
+   scalars.niceRouter = niceRouter;
+   scalars.ioNiceRouter = ioNiceRouter;
+   scalars.niceTelemetry = niceTelemetry;
+   scalars.niceVideo = niceVideo;
+   scalars.niceOthers = niceOthers;
+   scalars.ioNiceVideo = ioNiceVideo;
+   scalars.iOverVoltage = iOverVoltage;
+   scalars.iFreqARM = iFreqARM;
+   scalars.iFreqGPU = iFreqGPU;
+   scalars.iCameraCount = iCameraCount;
+   scalars.iCurrentCamera = iCurrentCamera;
+   scalars.iSaveCount = iSaveCount;
+
+   bool bOk = true;
+   int iPos = sizeof(t_model_binary_header);
+   int iCount = 0;
+   _model_binary_add_section(pBuffer, &iPos, iMaxLength, &iCount, MODEL_BINARY_SECTION_SCALARS, &scalars, sizeof(scalars), 1, &bOk);
+   _model_binary_add_section(pBuffer, &iPos, iMaxLength, &iCount, MODEL_BINARY_SECTION_HARDWARE, &hardware_info, sizeof(hardware_info), 1, &bOk);
+   _model_binary_add_section(pBuffer, &iPos, iMaxLength, &iCount, MODEL_BINARY_SECTION_RADIO_INTERFACES, &radioInterfacesParams, sizeof(radioInterfacesParams), 1, &bOk);
+   _model_binary_add_section(pBuffer, &iPos, iMaxLength, &iCount, MODEL_BINARY_SECTION_RADIO_LINKS, &radioLinksParams, sizeof(radioLinksParams), 1, &bOk);
+   _model_binary_add_section(pBuffer, &iPos, iMaxLength, &iCount, MODEL_BINARY_SECTION_CAMERAS, camera_params, sizeof(type_camera_parameters), MODEL_MAX_CAMERAS, &bOk);
+   _model_binary_add_section(pBuffer, &iPos, iMaxLength, &iCount, MODEL_BINARY_SECTION_VIDEO, &video_params, sizeof(video_params), 1, &bOk);
+   _model_binary_add_section(pBuffer, &iPos, iMaxLength, &iCount, MODEL_BINARY_SECTION_VIDEO_PROFILES, video_link_profiles, sizeof(type_video_link_profile), MAX_VIDEO_LINK_PROFILES, &bOk);
+   _model_binary_add_section(pBuffer, &iPos, iMaxLength, &iCount, MODEL_BINARY_SECTION_OSD, &osd_params, sizeof(osd_params), 1, &bOk);
+   _model_binary_add_section(pBuffer, &iPos, iMaxLength, &iCount, MODEL_BINARY_SECTION_RC, &rc_params, sizeof(rc_params), 1, &bOk);
+   _model_binary_add_section(pBuffer, &iPos, iMaxLength, &iCount, MODEL_BINARY_SECTION_TELEMETRY, &telemetry_params, sizeof(telemetry_params), 1, &bOk);
+   _model_binary_add_section(pBuffer, &iPos, iMaxLength, &iCount, MODEL_BINARY_SECTION_AUDIO, &audio_params, sizeof(audio_params), 1, &bOk);
+   _model_binary_add_section(pBuffer, &iPos, iMaxLength, &iCount, MODEL_BINARY_SECTION_FUNCTIONS, &functions_params, sizeof(functions_params), 1, &bOk);
+   _model_binary_add_section(pBuffer, &iPos, iMaxLength, &iCount, MODEL_BINARY_SECTION_RELAY, &relay_params, sizeof(relay_params), 1, &bOk);
+   _model_binary_add_section(pBuffer, &iPos, iMaxLength, &iCount, MODEL_BINARY_SECTION_ALARMS, &alarms_params, sizeof(alarms_params), 1, &bOk);
+   _model_binary_add_section(pBuffer, &iPos, iMaxLength, &iCount, MODEL_BINARY_SECTION_STATS, &m_Stats, sizeof(m_Stats), 1, &bOk);
+
+   if ( ! bOk )
+      return 0;
+
+   t_model_binary_header header;
+   header.uStamp = MODEL_BINARY_FILE_STAMP;
+   header.uSchemaVersion = MODEL_BINARY_SCHEMA_VERSION;
+   header.uSaveCount = (u32)iSaveCount;
+   header.uVehicleId = vehicle_id;
+   header.uSectionsCount = (u32)iCount;
+   header.uTotalLength = (u32)iPos;
+   header.uHeaderCRC = base_compute_crc32((u8*)&header, sizeof(t_model_binary_header) - sizeof(u32));
+   memcpy(pBuffer, (u8*)&header, sizeof(t_model_binary_header));
+   return iPos;
+}
+
+// Sections are copied element by element over the current values, using the smallest of the stored and
+// current element sizes and counts: fields appended to a struct (or elements appended to an array) by a newer
+// schema keep their current values when loading an older file, and the extra trailing fields or elements
+// written by a newer build are ignored. Unknown sections are skipped.
+
+bool Model::loadFromBinaryBuffer(const u8* pBuffer, int iLength, bool bLoadStats)
+{
+   if ( NULL == pBuffer || iLength < (int)sizeof(t_model_binary_header) )
+      return false;
+
+   t_model_binary_header header;
+   memcpy((u8*)&header, pBuffer, sizeof(t_model_binary_header));
+   if ( header.uStamp != MODEL_BINARY_FILE_STAMP )
+   {
+      log_softerror_and_alarm("[ModelStore] Invalid binary model stamp.");
+      return false;
+   }
+   if ( header.uHeaderCRC != base_compute_crc32((u8*)&header, sizeof(t_model_binary_header) - sizeof(u32)) )
+   {
+      log_softerror_and_alarm("[ModelStore] Invalid binary model header checksum.");
+      return false;
+   }
+   if ( header.uSchemaVersion != MODEL_BINARY_SCHEMA_VERSION )
+   {
+      log_line("[ModelStore] Binary model schema version %u differs from current one (%d). Must migrate from text model.", header.uSchemaVersion, MODEL_BINARY_SCHEMA_VERSION);
+      return false;
+   }
+   if ( (int)header.uTotalLength > iLength )
+   {
+      log_softerror_and_alarm("[ModelStore] Truncated binary model (%d bytes, expected %u).", iLength, header.uTotalLength);
+      return false;
+   }
+
+   // Validate all sections before touching the model
+
+   int iPos = sizeof(t_model_binary_header);
+   bool bHasScalars = false;
+   for( u32 u=0; u<header.uSectionsCount; u++ )
+   {
+      t_model_binary_section_header section;
+      if ( iPos + (int)sizeof(t_model_binary_section_header) > (int)header.uTotalLength )
+         { log_softerror_and_alarm("[ModelStore] Truncated section header %u.", u); return false; }
+      memcpy((u8*)&section, pBuffer + iPos, sizeof(t_model_binary_section_header));
+      iPos += sizeof(t_model_binary_section_header);
+      // Checked as a division, so a corrupted element size and count can't overflow the section length
+      if ( (section.uElementSize > 0) && (section.uElementsCount > (header.uTotalLength - iPos) / section.uElementSize) )
+         { log_softerror_and_alarm("[ModelStore] Truncated section %d data.", section.uSectionId); return false; }
+      int iSectionLength = (int)(section.uElementSize * section.uElementsCount);
+      if ( section.uCRC != base_compute_crc32((u8*)(pBuffer + iPos), iSectionLength) )
+         { log_softerror_and_alarm("[ModelStore] Invalid checksum on section %d.", section.uSectionId); return false; }
+      if ( section.uSectionId == MODEL_BINARY_SECTION_SCALARS )
+         bHasScalars = true;
+      iPos += iSectionLength;
+   }
+   if ( ! bHasScalars )
+      { log_softerror_and_alarm("[ModelStore] Binary model has no scalars section."); return false; }
+
+   type_vehicle_stats_info stats;
+   memcpy((u8*)&stats, (u8*)&m_Stats, sizeof(type_vehicle_stats_info));
+
+   iPos = sizeof(t_model_binary_header);
+   for( u32 u=0; u<header.uSectionsCount; u++ )
+   {
+      t_model_binary_section_header section;
+      memcpy((u8*)&section, pBuffer + iPos, sizeof(t_model_binary_section_header));
+      iPos += sizeof(t_model_binary_section_header);
+      const u8* pData = pBuffer + iPos;
+      int iSize = (int)section.uElementSize;
+      int iCount = (int)section.uElementsCount;
+      iPos += iSize * iCount;
+
+      u8* pDest = NULL;
+      int iDestSize = 0;
+      int iDestCount = 1;
+      t_model_binary_scalars scalars;
+      switch ( section.uSectionId )
+      {
+         case MODEL_BINARY_SECTION_SCALARS: pDest = (u8*)&scalars; iDestSize = sizeof(scalars); memset((u8*)&scalars, 0, sizeof(scalars)); break;
+         case MODEL_BINARY_SECTION_HARDWARE: pDest = (u8*)&hardware_info; iDestSize = sizeof(hardware_info); break;
+         case MODEL_BINARY_SECTION_RADIO_INTERFACES: pDest = (u8*)&radioInterfacesParams; iDestSize = sizeof(radioInterfacesParams); break;
+         case MODEL_BINARY_SECTION_RADIO_LINKS: pDest = (u8*)&radioLinksParams; iDestSize = sizeof(radioLinksParams); break;
+         case MODEL_BINARY_SECTION_CAMERAS: pDest = (u8*)camera_params; iDestSize = sizeof(type_camera_parameters); iDestCount = MODEL_MAX_CAMERAS; break;
+         case MODEL_BINARY_SECTION_VIDEO: pDest = (u8*)&video_params; iDestSize = sizeof(video_params); break;
+         case MODEL_BINARY_SECTION_VIDEO_PROFILES: pDest = (u8*)video_link_profiles; iDestSize = sizeof(type_video_link_profile); iDestCount = MAX_VIDEO_LINK_PROFILES; break;
+         case MODEL_BINARY_SECTION_OSD: pDest = (u8*)&osd_params; iDestSize = sizeof(osd_params); break;
+         case MODEL_BINARY_SECTION_RC: pDest = (u8*)&rc_params; iDestSize = sizeof(rc_params); break;
+         case MODEL_BINARY_SECTION_TELEMETRY: pDest = (u8*)&telemetry_params; iDestSize = sizeof(telemetry_params); break;
+         case MODEL_BINARY_SECTION_AUDIO: pDest = (u8*)&audio_params; iDestSize = sizeof(audio_params); break;
+         case MODEL_BINARY_SECTION_FUNCTIONS: pDest = (u8*)&functions_params; iDestSize = sizeof(functions_params); break;
+         case MODEL_BINARY_SECTION_RELAY: pDest = (u8*)&relay_params; iDestSize = sizeof(relay_params); break;
+         case MODEL_BINARY_SECTION_ALARMS: pDest = (u8*)&alarms_params; iDestSize = sizeof(alarms_params); break;
+         case MODEL_BINARY_SECTION_STATS: pDest = (u8*)&m_Stats; iDestSize = sizeof(m_Stats); break;
+         default:
+            log_line("[ModelStore] Skipping unknown section %d (%d elements of %d bytes).", section.uSectionId, iCount, iSize);
+            break;
+      }
+      if ( NULL == pDest )
+         continue;
+      if ( (iSize != iDestSize) || (iCount != iDestCount) )
+         log_line("[ModelStore] Migrating section %d: stored %d elements of %d bytes, current %d elements of %d bytes.", section.uSectionId, iCount, iSize, iDestCount, iDestSize);
+      int iCopySize = (iSize < iDestSize)?iSize:iDestSize;
+      int iCopyCount = (iCount < iDestCount)?iCount:iDestCount;
+      for( int i=0; i<iCopyCount; i++ )
+         memcpy(pDest + i*iDestSize, pData + i*iSize, iCopySize);
+
+      if ( section.uSectionId != MODEL_BINARY_SECTION_SCALARS )
+         continue;
+
+      bDeveloperMode = scalars.bDeveloperMode?true:false;
+      uDeveloperFlags = scalars.uDeveloperFlags;
+      uModelFlags = scalars.uModelFlags;
+      board_type = scalars.board_type;
+      memcpy(vehicle_name, scalars.vehicle_name, MAX_VEHICLE_NAME_LENGTH);
+      vehicle_name[MAX_VEHICLE_NAME_LENGTH-1] = 0;
+      vehicle_id = scalars.vehicle_id;
+      controller_id = scalars.controller_id;
+      sw_version = scalars.sw_version;
+      is_spectator = scalars.is_spectator?true:false;
+      vehicle_type = scalars.vehicle_type;
+      clock_sync_type = scalars.clock_sync_type;
+      alarms = scalars.alarms;
+      enableDHCP = scalars.enableDHCP?true:false;
+      camera_rc_channels = scalars.camera_rc_channels;
+      enc_flags = scalars.enc_flags;
+      iGPSCount = scalars.iGPSCount;
+      niceRC = scalars.niceRC;
+      niceRouter = scalars.niceRouter;
+      ioNiceRouter = scalars.ioNiceRouter;
+      niceTelemetry = scalars.niceTelemetry;
+      niceVideo = scalars.niceVideo;
+      niceOthers = scalars.niceOthers;
+      ioNiceVideo = scalars.ioNiceVideo;
+      iOverVoltage = scalars.iOverVoltage;
+      iFreqARM = scalars.iFreqARM;
+      iFreqGPU = scalars.iFreqGPU;
+      iCameraCount = scalars.iCameraCount;
+      iCurrentCamera = scalars.iCurrentCamera;
+      iSaveCount = scalars.iSaveCount;
+   }
+
+   if ( hardware_is_vehicle() )
+      sw_version = (SYSTEM_SW_VERSION_MAJOR * 256 + SYSTEM_SW_VERSION_MINOR) | (SYSTEM_SW_BUILD_NUMBER<<16);
+   str_sanitize_modelname(vehicle_name);
+
+   if ( ! bLoadStats )
+      memcpy((u8*)&m_Stats, (u8*)&stats, sizeof(type_vehicle_stats_info));
+
+   iLoadedFileVersion = 8;
+   constructLongName();
+   return true;
+}
+
+bool Model::saveToBinaryFile(const char* filename)
+{
+   u8* pBuffer = (u8*)malloc(MODEL_BINARY_MAX_SIZE);
+   if ( NULL == pBuffer )
+      return false;
+   int iLength = saveToBinaryBuffer(pBuffer, MODEL_BINARY_MAX_SIZE);
+   if ( iLength <= 0 )
+   {
+      free(pBuffer);
+      return false;
+   }
+
+   // Write to a temp file and rename it, so readers never see a partial binary model
+   char szTmpFile[1024];
+   snprintf(szTmpFile, sizeof(szTmpFile), "%s.tmp", filename);
+   FILE* fd = fopen(szTmpFile, "wb");
+   if ( NULL == fd )
+   {
+      log_softerror_and_alarm("[ModelStore] Failed to save binary model to file: %s", szTmpFile);
+      free(pBuffer);
+      return false;
+   }
+   bool bOk = (1 == fwrite(pBuffer, iLength, 1, fd));
+   fflush(fd);
+   fclose(fd);
+   free(pBuffer);
+
+   if ( (!bOk) || (0 != rename(szTmpFile, filename)) )
+   {
+      log_softerror_and_alarm("[ModelStore] Failed to write binary model file: %s", filename);
+      unlink(szTmpFile);
+      return false;
+   }
+   return true;
+}
+
+bool Model::loadFromBinaryFile(const char* filename, bool bLoadStats)
+{
+   int iLength = 0;
+   u8* pBuffer = _model_read_binary_file(filename, &iLength);
+   if ( NULL == pBuffer )
+      return false;
+
+   bool bRes = loadFromBinaryBuffer(pBuffer, iLength, bLoadStats);
+   free(pBuffer);
+   return bRes;
+}
+
+void Model::publishToSharedStore()
+{
+   int fd = shm_open(SHARED_MEM_MODEL_STORE, O_CREAT | O_RDWR, S_IRUSR | S_IWUSR);
+   if ( fd < 0 )
+   {
+      log_softerror_and_alarm("[ModelStore] Failed to open shared model store for write: %s", strerror(errno));
+      return;
+   }
+   // Do not truncate/clear it if it exists already: other processes might be reading it
+   struct stat statsBuff;
+   if ( (0 != fstat(fd, &statsBuff)) || (statsBuff.st_size < (off_t)sizeof(shared_mem_model_store)) )
+   if ( 0 != ftruncate(fd, sizeof(shared_mem_model_store)) )
+   {
+      log_softerror_and_alarm("[ModelStore] Failed to size shared model store.");
+      close(fd);
+      return;
+   }
+   void* pMem = mmap(NULL, sizeof(shared_mem_model_store), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+   close(fd);
+   if ( pMem == MAP_FAILED )
+   {
+      log_softerror_and_alarm("[ModelStore] Failed to map shared model store for write.");
+      return;
+   }
+   shared_mem_model_store* pStore = (shared_mem_model_store*)pMem;
+
+   // Take the writer side: generation goes odd while the data is updated
+   u32 uGeneration = 0;
+   for( int i=0; i<100; i++ )
+   {
+      uGeneration = pStore->uGeneration;
+      if ( uGeneration & 0x01 )
+      {
+         hardware_sleep_ms(1);
+         continue;
+      }
+      if ( __sync_bool_compare_and_swap(&(pStore->uGeneration), uGeneration, uGeneration+1) )
+         break;
+   }
+   if ( ! (pStore->uGeneration & 0x01) )
+   {
+      log_softerror_and_alarm("[ModelStore] Shared model store is busy. Skip publishing.");
+      munmap(pMem, sizeof(shared_mem_model_store));
+      return;
+   }
+   __sync_synchronize();
+   int iLength = saveToBinaryBuffer(pStore->uData, MODEL_BINARY_MAX_SIZE);
+   pStore->uLength = (u32)iLength;
+   __sync_synchronize();
+   pStore->uGeneration = pStore->uGeneration + 1;
+   uLoadedStoreGeneration = pStore->uGeneration;
+   munmap(pMem, sizeof(shared_mem_model_store));
+}
+
+bool Model::loadFromSharedStore(bool bLoadStats)
+{
+   shared_mem_model_store* pStore = _model_shared_store_open_read();
+   if ( NULL == pStore )
+      return false;
+
+   u8* pBuffer = (u8*)malloc(MODEL_BINARY_MAX_SIZE);
+   if ( NULL == pBuffer )
+      return false;
+
+   // Copy out a consistent snapshot (generation unchanged and even around the copy)
+   bool bGotCopy = false;
+   u32 uGeneration = 0;
+   int iLength = 0;
+   for( int i=0; i<5; i++ )
+   {
+      uGeneration = pStore->uGeneration;
+      if ( uGeneration & 0x01 )
+      {
+         hardware_sleep_ms(1);
+         continue;
+      }
+      __sync_synchronize();
+      iLength = pStore->uLength;
+      if ( iLength <= 0 || iLength > MODEL_BINARY_MAX_SIZE )
+         break;
+      memcpy(pBuffer, pStore->uData, iLength);
+      __sync_synchronize();
+      if ( pStore->uGeneration == uGeneration )
+      {
+         bGotCopy = true;
+         break;
+      }
+   }
+
+   bool bRes = false;
+   if ( bGotCopy )
+      bRes = loadFromBinaryBuffer(pBuffer, iLength, bLoadStats);
+   free(pBuffer);
+   if ( bRes )
+   {
+      uLoadedStoreGeneration = uGeneration;
+      validate_settings();
+   }
+   return bRes;
+}
+
+u32 Model::getLoadedStoreGeneration()
+{
+   return uLoadedStoreGeneration;
+}
+
 void Model::resetVideoParamsToDefaults()
 {
    memset(&video_params, 0, sizeof(video_params));
@@ -25,6 +25,30 @@
 
 #define MODEL_MAX_OSD_PROFILES 5
 
+// Binary model store: header + sections (id, element size, elements count, crc32, data).
+// Each section is an array of elements (one element for plain structs). Element sizes and counts are stored,
+// so structs that grow at the end and arrays that change their length load from older/newer files.
+// Bump the schema version only when a section layout changes in the middle.
+#define MODEL_BINARY_FILE_STAMP 0x4C444D52 // "RMDL"
+#define MODEL_BINARY_SCHEMA_VERSION 2
+#define MODEL_BINARY_MAX_SIZE 65536
+
+#define MODEL_BINARY_SECTION_SCALARS 1
+#define MODEL_BINARY_SECTION_HARDWARE 2
+#define MODEL_BINARY_SECTION_RADIO_INTERFACES 3
+#define MODEL_BINARY_SECTION_RADIO_LINKS 4
+#define MODEL_BINARY_SECTION_CAMERAS 5
+#define MODEL_BINARY_SECTION_VIDEO 6
+#define MODEL_BINARY_SECTION_VIDEO_PROFILES 7
+#define MODEL_BINARY_SECTION_OSD 8
+#define MODEL_BINARY_SECTION_RC 9
+#define MODEL_BINARY_SECTION_TELEMETRY 10
+#define MODEL_BINARY_SECTION_AUDIO 11
+#define MODEL_BINARY_SECTION_FUNCTIONS 12
+#define MODEL_BINARY_SECTION_RELAY 13
+#define MODEL_BINARY_SECTION_ALARMS 14
+#define MODEL_BINARY_SECTION_STATS 15
+
 #define CAMERA_FLAG_FORCE_MODE_1 1
 #define CAMERA_FLAG_AWB_MODE_OLD ((u32)(((u32)0x01)<<1))
 
@@ -161,6 +185,9 @@ typedef struct
 #define RELAY_FLAGS_VIDEO (((u32)1)<<1)
 #define RELAY_FLAGS_COMMANDS (((u32)1)<<2)
 #define RELAY_FLAGS_SHOW_OSD (((u32)1)<<3)
+#define RELAY_FLAGS_VIDEO_BLOCKS (((u32)1)<<4) // rebuild the relayed video blocks on the relay (FEC recovery, new FEC, retransmissions answered by the relay)
+#define RELAY_FLAGS_MASK_VIDEO_BLOCKS_FECS 0xFF00 // FEC packets per video block from the relay to the controller; 0xFF: same as the relayed vehicle
+#define RELAY_FLAGS_SHIFT_VIDEO_BLOCKS_FECS 8
 
 #define RELAY_MODE_NONE       0
 #define RELAY_MODE_REMOTE     (((u32)1))
@@ -394,6 +421,35 @@ typedef struct
 
 } type_alarms_parameters;
 
+typedef struct
+{
+   u32 uStamp;
+   u32 uSchemaVersion;
+   u32 uSaveCount;
+   u32 uVehicleId;
+   u32 uSectionsCount;
+   u32 uTotalLength; // header included
+   u32 uHeaderCRC;   // crc of all the fields above
+} __attribute__((packed)) t_model_binary_header;
+
+typedef struct
+{
+   u16 uSectionId;
+   u16 uFlags;
+   u32 uElementSize;
+   u32 uElementsCount;
+   u32 uCRC; // crc of the section data (uElementSize * uElementsCount bytes)
+} __attribute__((packed)) t_model_binary_section_header;
+
+// Shared read-only copy of the current vehicle model, published on each save.
+// uGeneration is odd while a writer is updating the data.
+typedef struct
+{
+   u32 uGeneration;
+   u32 uLength;
+   u8  uData[MODEL_BINARY_MAX_SIZE];
+} __attribute__((packed)) shared_mem_model_store;
+
 class Model
 {
    public:
@@ -482,6 +538,13 @@ class Model
       bool reloadIfChanged(bool bLoadStats);
       bool loadFromFile(const char* filename, bool bLoadStats = false);
       bool saveToFile(const char* filename, bool isOnController);
+      bool loadFromTextFile(const char* filename, bool bLoadStats = false);
+      bool loadFromBinaryFile(const char* filename, bool bLoadStats = false);
+      bool saveToBinaryFile(const char* filename);
+      bool loadFromBinaryBuffer(const u8* pBuffer, int iLength, bool bLoadStats);
+      int  saveToBinaryBuffer(u8* pBuffer, int iMaxLength);
+      bool loadFromSharedStore(bool bLoadStats);
+      u32  getLoadedStoreGeneration();
       int getLoadedFileVersion();
       void populateHWInfo();
       bool populateVehicleSerialPorts();
@@ -549,12 +612,17 @@ class Model
       char vehicle_long_name[256];
       int iLoadedFileVersion;
       int iSaveCount;
+      u32 uLoadedStoreGeneration;
 
       void generateUID();
       bool loadVersion8(const char* szFile, FILE* fd);
       bool saveVersion8(const char* szFile, FILE* fd, bool isOnController);
+      void publishToSharedStore();
 };
 
+void model_get_binary_file_name(const char* szTextFileName, char* szOutBinaryFileName);
+int model_shared_store_get_generation(u32* pGeneration);
+
 const char* model_getShortFlightMode(u8 mode);
 const char* model_getLongFlightMode(u8 mode);
 const char* model_getCameraProfileName(int profileIndex);
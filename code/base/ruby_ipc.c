@@ -12,6 +12,7 @@ Code written by: Petru Soroaga, 2021-2023
 #include "base.h"
 #include "config.h"
 #include "ruby_ipc.h"
+#include "crc32.h"
 #include "hardware.h"
 #include "hw_procs.h"
 #include "../common/string_utils.h"
@@ -154,6 +155,9 @@ int ruby_init_ipc_channels()
    sprintf(szBuff, "mkfifo %s", FIFO_RUBY_STATION_VIDEO_STREAM_ETH );
    hw_execute_bash_command(szBuff, NULL);
 
+   sprintf(szBuff, "mkfifo %s", FIFO_RUBY_RC_IN_NOTIFY );
+   hw_execute_bash_command(szBuff, NULL);
+
    #ifdef RUBY_USE_FIFO_PIPES
 
    sprintf(szBuff, "mkfifo %s", FIFO_RUBY_ROUTER_TO_CENTRAL );
@@ -435,7 +439,7 @@ int ruby_ipc_channel_send_message(int iChannelFd, u8* pMessage, int iLength)
    msg.data[4] = ((u32)iLength) & 0xFF; 
    msg.data[5] = (((u32)iLength)>>8) & 0xFF;
    memcpy((u8*)&(msg.data[6]), pMessage, iLength); 
-   u32 uCRC = base_compute_crc32((u8*)&(msg.data[4]), iLength+2);
+   u32 uCRC = crc32_compute((u8*)&(msg.data[4]), iLength+2);
    memcpy((u8*)&(msg.data[0]), (u8*)&uCRC, sizeof(u32));
    if ( 0 == msgsnd(iChannelFd, &msg, sizeof(msg), IPC_NOWAIT) )
    {
@@ -609,7 +613,7 @@ u8* ruby_ipc_try_read_message(int iChannelFd, int timeoutMicrosec, u8* pTempBuff
          log_softerror_and_alarm("[IPC] Received invalid message on channel %s, length: %d", _ruby_ipc_get_channel_name(s_iRubyIPCChannelsType[iFound]), iMsgLen );
       else
       {
-         u32 uCRC = base_compute_crc32((u8*)&(ipcMessage.data[4]), iMsgLen+2);
+         u32 uCRC = crc32_compute((u8*)&(ipcMessage.data[4]), iMsgLen+2);
          u32 uTmp = 0;
          memcpy((u8*)&uTmp, (u8*)&(ipcMessage.data[0]), sizeof(u32));
          if ( uCRC != uTmp )
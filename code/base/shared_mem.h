@@ -23,6 +23,9 @@
 #define SHARED_MEM_ROUTER_PACKETS_STATS_HISTORY "/SYSTEM_SHARED_MEM_STATION_ROUTER_PACKETS_STATS_HISTORY"
 #define SHARED_MEM_RC_DOWNLOAD_INFO "R_SHARED_MEM_VEHICLE_RC_DOWNLOAD_INFO"
 #define SHARED_MEM_RC_UPSTREAM_FRAME "R_SHARED_MEM_RC_UPSTREAM_FRAME"
+#define SHARED_MEM_MODEL_STORE "/SYSTEM_SHARED_MEM_RUBY_MODEL_STORE"
+#define SHARED_MEM_LATENCY_TRACE_VEHICLE "/SYSTEM_SHARED_MEM_RUBY_LATENCY_TRACE_VEHICLE"
+#define SHARED_MEM_LATENCY_TRACE_STATION "/SYSTEM_SHARED_MEM_RUBY_LATENCY_TRACE_STATION"
 
 #define SHARED_MEM_WATCHDOG_CENTRAL "/SYSTEM_SHARED_MEM_WATCHDOG_CENTRAL"
 #define SHARED_MEM_WATCHDOG_ROUTER_RX "/SYSTEM_SHARED_MEM_WATCHDOG_ROUTER_RX"
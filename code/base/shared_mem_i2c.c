@@ -12,6 +12,10 @@ Code written by: Petru Soroaga, 2021-2023
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include "config.h"
 #include "shared_mem.h"
 #include "shared_mem_i2c.h"
 
@@ -58,6 +62,40 @@ void shared_mem_i2c_controller_rc_in_close(t_shared_mem_i2c_controller_rc_in* pA
    //shm_unlink(SHARED_MEM_NAME_I2C_CONTROLLER_RC_IN);
 }
 
+int shared_mem_i2c_controller_rc_in_open_notify_for_read()
+{
+   // Opened read-write, so the pipe does not report hang ups while the writer is not running
+   int fd = open(FIFO_RUBY_RC_IN_NOTIFY, O_RDWR | O_NONBLOCK);
+   if ( fd < 0 )
+      log_softerror_and_alarm("Failed to open RC in notify pipe for read: %s", FIFO_RUBY_RC_IN_NOTIFY);
+   return fd;
+}
+
+int shared_mem_i2c_controller_rc_in_open_notify_for_write()
+{
+   return open(FIFO_RUBY_RC_IN_NOTIFY, O_WRONLY | O_NONBLOCK);
+}
+
+int shared_mem_i2c_controller_rc_in_notify(int fd)
+{
+   if ( fd < 0 )
+      return -1;
+   // A full pipe (EAGAIN) already has a pending wake up
+   u8 uByte = 1;
+   if ( write(fd, &uByte, 1) < 0 )
+   if ( errno == EPIPE )
+      return -1;
+   return 0;
+}
+
+void shared_mem_i2c_controller_rc_in_clear_notify(int fd)
+{
+   if ( fd < 0 )
+      return;
+   u8 uBuffer[64];
+   while ( read(fd, uBuffer, sizeof(uBuffer)) == (int)sizeof(uBuffer) ) {}
+}
+
 t_shared_mem_i2c_rotary_encoder_buttons_events* shared_mem_i2c_rotary_encoder_buttons_events_open_for_read()
 {
    void *retVal =  open_shared_mem(SHARED_MEM_NAME_I2C_ROTARY_ENCODER_BUTTONS_EVENTS, sizeof(t_shared_mem_i2c_rotary_encoder_buttons_events), 1);
@@ -51,6 +51,14 @@ void shared_mem_i2c_current_close(t_shared_mem_i2c_current* pAddress);
 t_shared_mem_i2c_controller_rc_in* shared_mem_i2c_controller_rc_in_open_for_read();
 t_shared_mem_i2c_controller_rc_in* shared_mem_i2c_controller_rc_in_open_for_write();
 void shared_mem_i2c_controller_rc_in_close(t_shared_mem_i2c_controller_rc_in* pAddress);
+// The RC in writer signals new frames on the FIFO_RUBY_RC_IN_NOTIFY pipe, so readers can wait on it (poll/epoll)
+// instead of polling the shared memory. Both ends are non blocking; the writer end opens only while a reader has it open.
+int shared_mem_i2c_controller_rc_in_open_notify_for_read();
+int shared_mem_i2c_controller_rc_in_open_notify_for_write();
+// Returns -1 if the reader closed the pipe
+int shared_mem_i2c_controller_rc_in_notify(int fd);
+// Empties the pipe after a wake up
+void shared_mem_i2c_controller_rc_in_clear_notify(int fd);
 
 t_shared_mem_i2c_rotary_encoder_buttons_events* shared_mem_i2c_rotary_encoder_buttons_events_open_for_read();
 t_shared_mem_i2c_rotary_encoder_buttons_events* shared_mem_i2c_rotary_encoder_buttons_events_open_for_write();
@@ -0,0 +1,375 @@
+/*
+You can use this C/C++ code however you wish (for example, but not limited to:
+     as is, or by modifying it, or by adding new code, or by removing parts of the code;
+     in public or private projects, in new free or commercial products)
+     only if you get a priori written consent from Petru Soroaga (petrusoroaga@yahoo.com) for your specific use
+     and only if this copyright terms are preserved in the code.
+     This code is public for learning and academic purposes.
+Also, check the licences folder for additional licences terms.
+Code written by: Petru Soroaga, 2021-2023
+*/
+
+#include "system_metrics.h"
+#include "config_file_names.h"
+#include "hardware.h"
+
+#include <pthread.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/statvfs.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+static char s_szSystemMetricsProcRoot[256];
+static char s_szSystemMetricsSysRoot[256];
+static char s_szSystemMetricsDiskFolders[SYSTEM_METRICS_DISKS_COUNT][256] = { FOLDER_RUBY, FOLDER_RUBY_TEMP, TEMP_VIDEO_MEM_FOLDER };
+
+// CPU time counters from the previous sample, for the load
+static unsigned long long s_uSystemMetricsLastCPUBusy = 0;
+static unsigned long long s_uSystemMetricsLastCPUTotal = 0;
+static u32 s_uSystemMetricsSamplesCount = 0;
+static pthread_mutex_t s_SystemMetricsSampleMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static shared_mem_system_metrics* s_pSystemMetricsSharedMem = NULL;
+static int s_iSystemMetricsIntervalMs = SYSTEM_METRICS_SAMPLE_INTERVAL_MS;
+static int s_iSystemMetricsSamplerStarted = 0;
+static int s_iSystemMetricsSamplerQuit = 0;
+static pthread_t s_SystemMetricsThread;
+static pthread_mutex_t s_SystemMetricsThreadMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t s_SystemMetricsThreadCond;
+
+static shared_mem_system_metrics* s_pSystemMetricsSharedMemRead = NULL;
+
+void system_metrics_set_root_folders(const char* szProcRoot, const char* szSysRoot)
+{
+   s_szSystemMetricsProcRoot[0] = 0;
+   s_szSystemMetricsSysRoot[0] = 0;
+   if ( NULL != szProcRoot )
+      strncpy(s_szSystemMetricsProcRoot, szProcRoot, sizeof(s_szSystemMetricsProcRoot)-1);
+   if ( NULL != szSysRoot )
+      strncpy(s_szSystemMetricsSysRoot, szSysRoot, sizeof(s_szSystemMetricsSysRoot)-1);
+}
+
+void system_metrics_set_disk_folder(int iDisk, const char* szFolder)
+{
+   if ( iDisk < 0 || iDisk >= SYSTEM_METRICS_DISKS_COUNT || NULL == szFolder )
+      return;
+   pthread_mutex_lock(&s_SystemMetricsSampleMutex);
+   strncpy(s_szSystemMetricsDiskFolders[iDisk], szFolder, sizeof(s_szSystemMetricsDiskFolders[iDisk])-1);
+   s_szSystemMetricsDiskFolders[iDisk][sizeof(s_szSystemMetricsDiskFolders[iDisk])-1] = 0;
+   pthread_mutex_unlock(&s_SystemMetricsSampleMutex);
+}
+
+static FILE* _system_metrics_open(const char* szRoot, const char* szFile)
+{
+   char szPath[512];
+   snprintf(szPath, sizeof(szPath), "%s%s", szRoot, szFile);
+   return fopen(szPath, "r");
+}
+
+// Reads the first value of a one line sysfs file; returns 1 on success
+static int _system_metrics_read_sys_value(const char* szFile, const char* szFormat, void* pValue)
+{
+   FILE* fd = _system_metrics_open(s_szSystemMetricsSysRoot, szFile);
+   if ( NULL == fd )
+      return 0;
+   int iResult = fscanf(fd, szFormat, pValue);
+   fclose(fd);
+   return (1 == iResult)?1:0;
+}
+
+static int _system_metrics_read_cpu_load(shared_mem_system_metrics* pMetrics)
+{
+   FILE* fd = _system_metrics_open(s_szSystemMetricsProcRoot, "/proc/stat");
+   if ( NULL == fd )
+      return 0;
+   // cpu user nice system idle iowait irq softirq steal; kernels before 2.6.11 have only the first ones
+   unsigned long long uValues[8] = {0,0,0,0,0,0,0,0};
+   int iCount = fscanf(fd, "cpu %llu %llu %llu %llu %llu %llu %llu %llu",
+      &uValues[0], &uValues[1], &uValues[2], &uValues[3], &uValues[4], &uValues[5], &uValues[6], &uValues[7]);
+   fclose(fd);
+   if ( iCount < 4 )
+      return 0;
+
+   unsigned long long uTotal = 0;
+   for( int i=0; i<8; i++ )
+      uTotal += uValues[i];
+   unsigned long long uBusy = uTotal - uValues[3] - uValues[4];
+
+   int iValid = 0;
+   if ( (s_uSystemMetricsLastCPUTotal != 0) && (uTotal > s_uSystemMetricsLastCPUTotal) && (uBusy >= s_uSystemMetricsLastCPUBusy) )
+   {
+      pMetrics->uCPULoadPercent = (u32)(((uBusy - s_uSystemMetricsLastCPUBusy) * 100) / (uTotal - s_uSystemMetricsLastCPUTotal));
+      if ( pMetrics->uCPULoadPercent > 100 )
+         pMetrics->uCPULoadPercent = 100;
+      iValid = 1;
+   }
+   s_uSystemMetricsLastCPUBusy = uBusy;
+   s_uSystemMetricsLastCPUTotal = uTotal;
+   return iValid;
+}
+
+static int _system_metrics_read_memory(shared_mem_system_metrics* pMetrics)
+{
+   FILE* fd = _system_metrics_open(s_szSystemMetricsProcRoot, "/proc/meminfo");
+   if ( NULL == fd )
+      return 0;
+
+   char szLine[256];
+   int iFound = 0;
+   unsigned long ulValue = 0;
+   // MemAvailable is missing on old kernels; free is used then
+   pMetrics->uMemAvailableKb = 0;
+   while ( (iFound != 0x07) && (NULL != fgets(szLine, sizeof(szLine), fd)) )
+   {
+      if ( 1 == sscanf(szLine, "MemTotal: %lu", &ulValue) )
+      {
+         pMetrics->uMemTotalKb = (u32)ulValue;
+         iFound |= 0x01;
+      }
+      else if ( 1 == sscanf(szLine, "MemFree: %lu", &ulValue) )
+      {
+         pMetrics->uMemFreeKb = (u32)ulValue;
+         iFound |= 0x02;
+      }
+      else if ( 1 == sscanf(szLine, "MemAvailable: %lu", &ulValue) )
+      {
+         pMetrics->uMemAvailableKb = (u32)ulValue;
+         iFound |= 0x04;
+      }
+   }
+   fclose(fd);
+   if ( ! (iFound & 0x04) )
+      pMetrics->uMemAvailableKb = pMetrics->uMemFreeKb;
+   return ((iFound & 0x03) == 0x03)?1:0;
+}
+
+static int _system_metrics_read_disk(const char* szFolder, t_system_metrics_disk* pDisk)
+{
+   struct statvfs info;
+   if ( 0 != statvfs(szFolder, &info) )
+      return 0;
+   unsigned long long uBlockSize = info.f_frsize;
+   if ( 0 == uBlockSize )
+      uBlockSize = info.f_bsize;
+   pDisk->uTotalKb = (u32)(((unsigned long long)info.f_blocks * uBlockSize) / 1024);
+   pDisk->uUsedKb = (u32)(((unsigned long long)(info.f_blocks - info.f_bfree) * uBlockSize) / 1024);
+   pDisk->uFreeKb = (u32)(((unsigned long long)info.f_bavail * uBlockSize) / 1024);
+   return 1;
+}
+
+void system_metrics_sample_now(shared_mem_system_metrics* pMetrics)
+{
+   if ( NULL == pMetrics )
+      return;
+   u32 uTimeStart = get_current_timestamp_micros();
+   pthread_mutex_lock(&s_SystemMetricsSampleMutex);
+
+   pMetrics->uValidFlags = 0;
+   if ( _system_metrics_read_cpu_load(pMetrics) )
+      pMetrics->uValidFlags |= SYSTEM_METRICS_VALID_CPU_LOAD;
+
+   u32 uValue = 0;
+   if ( _system_metrics_read_sys_value("/sys/devices/system/cpu/cpu0/cpufreq/scaling_cur_freq", "%u", &uValue) )
+   {
+      pMetrics->uCPUSpeedMHz = uValue/1000;
+      pMetrics->uValidFlags |= SYSTEM_METRICS_VALID_CPU_SPEED;
+   }
+
+   int iValue = 0;
+   if ( _system_metrics_read_sys_value("/sys/class/thermal/thermal_zone0/temp", "%d", &iValue) )
+   {
+      pMetrics->iTemperatureC = iValue/1000;
+      pMetrics->uValidFlags |= SYSTEM_METRICS_VALID_TEMPERATURE;
+   }
+
+   // Same value as vcgencmd get_throttled, from the firmware driver
+   if ( _system_metrics_read_sys_value("/sys/devices/platform/soc/soc:firmware/get_throttled", "%x", &uValue) )
+   {
+      pMetrics->uThrottled = uValue;
+      pMetrics->uValidFlags |= SYSTEM_METRICS_VALID_THROTTLED;
+   }
+
+   if ( _system_metrics_read_memory(pMetrics) )
+      pMetrics->uValidFlags |= SYSTEM_METRICS_VALID_MEMORY;
+
+   for( int i=0; i<SYSTEM_METRICS_DISKS_COUNT; i++ )
+   {
+      if ( _system_metrics_read_disk(s_szSystemMetricsDiskFolders[i], &(pMetrics->disks[i])) )
+         pMetrics->uValidFlags |= (SYSTEM_METRICS_VALID_DISK_ROOT << i);
+      else
+         memset(&(pMetrics->disks[i]), 0, sizeof(t_system_metrics_disk));
+   }
+
+   s_uSystemMetricsSamplesCount++;
+   pMetrics->uSamplesCount = s_uSystemMetricsSamplesCount;
+   pthread_mutex_unlock(&s_SystemMetricsSampleMutex);
+
+   pMetrics->uTimeLastUpdate = get_current_timestamp_ms();
+   pMetrics->uLastSampleMicros = get_current_timestamp_micros() - uTimeStart;
+}
+
+static void _system_metrics_publish(shared_mem_system_metrics* pMetrics)
+{
+   if ( NULL == s_pSystemMetricsSharedMem )
+      return;
+
+   // Same scheme as the model store: counter is odd while the data is being updated
+   u32 uCounter = s_pSystemMetricsSharedMem->uUpdateCounter;
+   __sync_lock_test_and_set(&(s_pSystemMetricsSharedMem->uUpdateCounter), uCounter | 0x01);
+   __sync_synchronize();
+   memcpy(((u8*)s_pSystemMetricsSharedMem) + sizeof(u32), ((u8*)pMetrics) + sizeof(u32), sizeof(shared_mem_system_metrics) - sizeof(u32));
+   __sync_synchronize();
+   __sync_lock_test_and_set(&(s_pSystemMetricsSharedMem->uUpdateCounter), (uCounter | 0x01) + 1);
+}
+
+static void* _system_metrics_thread(void* pParam)
+{
+   // The values change slowly: sample only when the CPU is otherwise idle
+   setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), SYSTEM_METRICS_THREAD_NICE);
+
+   shared_mem_system_metrics metrics;
+   memcpy(&metrics, s_pSystemMetricsSharedMem, sizeof(shared_mem_system_metrics));
+
+   pthread_mutex_lock(&s_SystemMetricsThreadMutex);
+   while ( ! s_iSystemMetricsSamplerQuit )
+   {
+      struct timespec ts;
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      ts.tv_sec += s_iSystemMetricsIntervalMs/1000;
+      ts.tv_nsec += (long)(s_iSystemMetricsIntervalMs%1000) * 1000000L;
+      if ( ts.tv_nsec >= 1000000000L )
+      {
+         ts.tv_sec++;
+         ts.tv_nsec -= 1000000000L;
+      }
+      while ( ! s_iSystemMetricsSamplerQuit )
+      {
+         if ( ETIMEDOUT == pthread_cond_timedwait(&s_SystemMetricsThreadCond, &s_SystemMetricsThreadMutex, &ts) )
+            break;
+      }
+      if ( s_iSystemMetricsSamplerQuit )
+         break;
+      pthread_mutex_unlock(&s_SystemMetricsThreadMutex);
+
+      system_metrics_sample_now(&metrics);
+      _system_metrics_publish(&metrics);
+
+      pthread_mutex_lock(&s_SystemMetricsThreadMutex);
+   }
+   pthread_mutex_unlock(&s_SystemMetricsThreadMutex);
+   return NULL;
+}
+
+int system_metrics_sampler_start(const char* szSharedMemName, int iIntervalMs)
+{
+   if ( s_iSystemMetricsSamplerStarted )
+      return 1;
+   if ( NULL == szSharedMemName )
+      return 0;
+
+   s_pSystemMetricsSharedMem = (shared_mem_system_metrics*)open_shared_mem_for_write(szSharedMemName, sizeof(shared_mem_system_metrics));
+   if ( NULL == s_pSystemMetricsSharedMem )
+   {
+      log_softerror_and_alarm("[SystemMetrics] Failed to open shared memory %s for write.", szSharedMemName);
+      return 0;
+   }
+   s_iSystemMetricsIntervalMs = iIntervalMs;
+   if ( s_iSystemMetricsIntervalMs < 100 )
+      s_iSystemMetricsIntervalMs = 100;
+
+   // A first sample right away, so the readers have values from the start
+   shared_mem_system_metrics metrics;
+   memset(&metrics, 0, sizeof(shared_mem_system_metrics));
+   system_metrics_sample_now(&metrics);
+   _system_metrics_publish(&metrics);
+
+   pthread_condattr_t attr;
+   pthread_condattr_init(&attr);
+   pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+   pthread_cond_init(&s_SystemMetricsThreadCond, &attr);
+   pthread_condattr_destroy(&attr);
+
+   s_iSystemMetricsSamplerQuit = 0;
+   if ( 0 != pthread_create(&s_SystemMetricsThread, NULL, &_system_metrics_thread, NULL) )
+   {
+      log_softerror_and_alarm("[SystemMetrics] Failed to create the sampler thread.");
+      pthread_cond_destroy(&s_SystemMetricsThreadCond);
+      munmap(s_pSystemMetricsSharedMem, sizeof(shared_mem_system_metrics));
+      s_pSystemMetricsSharedMem = NULL;
+      return 0;
+   }
+   s_iSystemMetricsSamplerStarted = 1;
+   log_line("[SystemMetrics] Started the sampler thread (%s, every %d ms, first sample took %u us).", szSharedMemName, s_iSystemMetricsIntervalMs, metrics.uLastSampleMicros);
+   return 1;
+}
+
+void system_metrics_sampler_stop()
+{
+   if ( ! s_iSystemMetricsSamplerStarted )
+      return;
+   pthread_mutex_lock(&s_SystemMetricsThreadMutex);
+   s_iSystemMetricsSamplerQuit = 1;
+   pthread_cond_signal(&s_SystemMetricsThreadCond);
+   pthread_mutex_unlock(&s_SystemMetricsThreadMutex);
+   pthread_join(s_SystemMetricsThread, NULL);
+   pthread_cond_destroy(&s_SystemMetricsThreadCond);
+
+   munmap(s_pSystemMetricsSharedMem, sizeof(shared_mem_system_metrics));
+   s_pSystemMetricsSharedMem = NULL;
+   s_iSystemMetricsSamplerStarted = 0;
+   log_line("[SystemMetrics] Stopped the sampler thread.");
+}
+
+int system_metrics_sampler_is_started()
+{
+   return s_iSystemMetricsSamplerStarted;
+}
+
+shared_mem_system_metrics* system_metrics_open_for_read(const char* szSharedMemName)
+{
+   return (shared_mem_system_metrics*)open_shared_mem_for_read(szSharedMemName, sizeof(shared_mem_system_metrics));
+}
+
+int system_metrics_read_snapshot(shared_mem_system_metrics* pSharedMem, shared_mem_system_metrics* pOutSnapshot)
+{
+   if ( NULL == pSharedMem || NULL == pOutSnapshot )
+      return 0;
+   for( int i=0; i<10; i++ )
+   {
+      u32 uCounter = pSharedMem->uUpdateCounter;
+      if ( uCounter & 0x01 )
+      {
+         hardware_sleep_ms(1);
+         continue;
+      }
+      __sync_synchronize();
+      memcpy(pOutSnapshot, pSharedMem, sizeof(shared_mem_system_metrics));
+      __sync_synchronize();
+      if ( pSharedMem->uUpdateCounter == uCounter )
+         return 1;
+   }
+   return 0;
+}
+
+int system_metrics_get(shared_mem_system_metrics* pOutSnapshot)
+{
+   if ( NULL == pOutSnapshot )
+      return 0;
+   if ( NULL == s_pSystemMetricsSharedMemRead )
+      s_pSystemMetricsSharedMemRead = system_metrics_open_for_read(SHARED_MEM_SYSTEM_METRICS);
+   if ( NULL == s_pSystemMetricsSharedMemRead )
+      return 0;
+   if ( ! system_metrics_read_snapshot(s_pSystemMetricsSharedMemRead, pOutSnapshot) )
+      return 0;
+   // Never written (no sampler started since boot)
+   if ( 0 == pOutSnapshot->uSamplesCount )
+      return 0;
+   return 1;
+}
+
+u16 system_metrics_get_compact_throttled_flags(u32 uThrottled)
+{
+   return (u16)((uThrottled & 0xF) | ((uThrottled>>16) << 4));
+}
@@ -0,0 +1,88 @@
+#pragma once
+#include "base.h"
+#include "config.h"
+#include "shared_mem.h"
+
+// System metrics sampler: disk, CPU, memory, temperature and throttling state, read natively
+// (statvfs, /proc/stat, /proc/meminfo, sysfs thermal/cpufreq/firmware) on a background thread,
+// instead of running df, free or vcgencmd through a shell from the UI and watchdog loops.
+// The sampler publishes a snapshot to a shared memory segment; any process can read it at no cost.
+// The /proc and /sys roots can be moved (system_metrics_set_root_folders) so tests can use a fake tree.
+
+#define SHARED_MEM_SYSTEM_METRICS "/SYSTEM_SHARED_MEM_RUBY_SYSTEM_METRICS"
+
+#define SYSTEM_METRICS_SAMPLE_INTERVAL_MS 1000
+#define SYSTEM_METRICS_THREAD_NICE 10
+
+#define SYSTEM_METRICS_DISK_ROOT 0 // the Ruby folder (FOLDER_RUBY)
+#define SYSTEM_METRICS_DISK_TEMP 1 // the temporary files folder (FOLDER_RUBY_TEMP)
+#define SYSTEM_METRICS_DISK_MEMDISK 2 // the memory disk video is recorded to (TEMP_VIDEO_MEM_FOLDER), when mounted
+#define SYSTEM_METRICS_DISKS_COUNT 3
+
+// Which values were read on the last sample (uValidFlags)
+#define SYSTEM_METRICS_VALID_CPU_LOAD ((u32)(((u32)0x01)<<0))
+#define SYSTEM_METRICS_VALID_CPU_SPEED ((u32)(((u32)0x01)<<1))
+#define SYSTEM_METRICS_VALID_TEMPERATURE ((u32)(((u32)0x01)<<2))
+#define SYSTEM_METRICS_VALID_THROTTLED ((u32)(((u32)0x01)<<3))
+#define SYSTEM_METRICS_VALID_MEMORY ((u32)(((u32)0x01)<<4))
+#define SYSTEM_METRICS_VALID_DISK_ROOT ((u32)(((u32)0x01)<<5))
+#define SYSTEM_METRICS_VALID_DISK_TEMP ((u32)(((u32)0x01)<<6))
+#define SYSTEM_METRICS_VALID_DISK_MEMDISK ((u32)(((u32)0x01)<<7))
+
+typedef struct
+{
+   // Same values as the df columns: used is what is taken, free is what a regular user can still write
+   u32 uTotalKb;
+   u32 uUsedKb;
+   u32 uFreeKb;
+} __attribute__((packed)) t_system_metrics_disk;
+
+typedef struct
+{
+   u32 uUpdateCounter; // odd while the writer is updating the data
+   u32 uTimeLastUpdate; // ms
+   u32 uSamplesCount;
+   u32 uLastSampleMicros; // time it took to read all the values
+   u32 uValidFlags;
+
+   u32 uCPULoadPercent; // since the previous sample
+   u32 uCPUSpeedMHz;
+   int iTemperatureC;
+   u32 uThrottled; // raw firmware get_throttled bits, same as vcgencmd get_throttled
+
+   u32 uMemTotalKb;
+   u32 uMemFreeKb;
+   u32 uMemAvailableKb;
+
+   t_system_metrics_disk disks[SYSTEM_METRICS_DISKS_COUNT];
+} __attribute__((packed)) shared_mem_system_metrics;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Empty or NULL root means the real /proc and /sys
+void system_metrics_set_root_folders(const char* szProcRoot, const char* szSysRoot);
+void system_metrics_set_disk_folder(int iDisk, const char* szFolder);
+
+// Reads all the values now, in the calling thread. CPU load is relative to the previous sample.
+void system_metrics_sample_now(shared_mem_system_metrics* pMetrics);
+
+// Takes a first sample right away, then one each interval on a low priority thread
+int system_metrics_sampler_start(const char* szSharedMemName, int iIntervalMs);
+void system_metrics_sampler_stop();
+int system_metrics_sampler_is_started();
+
+shared_mem_system_metrics* system_metrics_open_for_read(const char* szSharedMemName);
+// Copies a consistent snapshot of the shared data; returns 0 if the writer kept updating it
+int system_metrics_read_snapshot(shared_mem_system_metrics* pSharedMem, shared_mem_system_metrics* pOutSnapshot);
+// Snapshot of the default shared memory (opened on first use); returns 0 if there is no sampler running
+int system_metrics_get(shared_mem_system_metrics* pOutSnapshot);
+
+// Throttled bits in the compact format used by hardware_get_flags and the vehicle telemetry:
+// bits 0..3 current state, bits 4..7 state since boot
+u16 system_metrics_get_compact_throttled_flags(u32 uThrottled);
+
+#ifdef __cplusplus
+}
+#endif
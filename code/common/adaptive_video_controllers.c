@@ -0,0 +1,466 @@
+/*
+You can use this C/C++ code however you wish (for example, but not limited to:
+     as is, or by modifying it, or by adding new code, or by removing parts of the code;
+     in public or private projects, in new free or commercial products)
+     only if you get a priori written consent from Petru Soroaga (petrusoroaga@yahoo.com) for your specific use
+     and only if this copyright terms are preserved in the code.
+     This code is public for learning and academic purposes.
+Also, check the licences folder for additional licences terms.
+Code written by: Petru Soroaga, 2021-2023
+*/
+
+#include "adaptive_video_controllers.h"
+#include <math.h>
+
+void adaptive_video_levels_add_profile(t_adaptive_video_levels* pLevels, int iDataPackets, int iECPackets, int iLevelShifts, u32 uVideoBitrate)
+{
+   if ( iDataPackets <= 0 )
+      iDataPackets = 1;
+   for( int i=0; i<=iLevelShifts; i++ )
+   {
+      if ( pLevels->iCountLevels >= ADAPTIVE_VIDEO_MAX_LEVELS )
+      {
+         log_softerror_and_alarm("Adaptive video levels: too many levels, only %d of %d shift levels of the profile (%d/%d) were added.", i, iLevelShifts+1, iDataPackets, iECPackets);
+         return;
+      }
+      pLevels->uDataPackets[pLevels->iCountLevels] = iDataPackets;
+      pLevels->uECPackets[pLevels->iCountLevels] = iECPackets + i;
+      pLevels->uVideoBitrate[pLevels->iCountLevels] = (u32)(((unsigned long long)uVideoBitrate * (iDataPackets + iECPackets)) / (iDataPackets + iECPackets + i));
+      pLevels->iCountLevels++;
+   }
+}
+
+int adaptive_video_is_level_skipped(const t_adaptive_video_levels* pLevels, int iLevel)
+{
+   if ( iLevel == pLevels->iLevelsHQ )
+      return 1;
+   if ( iLevel == pLevels->iLevelsHQ + pLevels->iLevelsMQ + 1 )
+      return 1;
+   if ( iLevel == pLevels->iLevelsHQ + pLevels->iLevelsMQ + pLevels->iLevelsLQ + 2 )
+      return 1;
+   return 0;
+}
+
+float adaptive_video_get_block_failure_probability(const t_adaptive_video_levels* pLevels, int iLevel, float fLossRate, float fBurstLength)
+{
+   if ( iLevel < 0 || iLevel >= pLevels->iCountLevels )
+      return 1.0;
+   if ( fLossRate <= 0.0 )
+      return 0.0;
+   if ( fLossRate >= 1.0 )
+      return 1.0;
+   if ( fBurstLength < 1.0 )
+      fBurstLength = 1.0;
+
+   // Losses come in bursts of fBurstLength packets: a block fails if it gets more than EC/burst length bursts
+   int n = pLevels->uDataPackets[iLevel] + pLevels->uECPackets[iLevel];
+   int k = (int)((float)pLevels->uECPackets[iLevel] / fBurstLength);
+   double q = (double)fLossRate / (double)fBurstLength;
+   if ( k >= n )
+      return 0.0;
+
+   // P(X > k), X ~ Binomial(n, q)
+   double dTerm = pow(1.0-q, n);
+   double dSum = dTerm;
+   for( int i=1; i<=k; i++ )
+   {
+      dTerm *= ((double)(n-i+1)/(double)i) * (q/(1.0-q));
+      dSum += dTerm;
+   }
+   if ( dSum > 1.0 )
+      dSum = 1.0;
+   return (float)(1.0 - dSum);
+}
+
+//-----------------------------------------------------------
+// Baseline controller: counts the intervals with reconstructed blocks, retransmissions and
+// missing packets over the last intervals and compares them to thresholds set by the adjustment strength.
+
+static void _adaptive_video_baseline_reset()
+{
+}
+
+static void _adaptive_video_baseline_adjust(shared_mem_controller_adaptive_video_info_vehicle* pInfo, const t_adaptive_video_levels* pLevels, int iAdjustmentStrength, u32 uTimeNowMs)
+{
+   if ( uTimeNowMs < pInfo->uTimeLastLevelShiftDown + 50 )
+      return;
+   if ( uTimeNowMs < pInfo->uTimeLastLevelShiftUp + 50 )
+      return;
+
+   int iLevelsHQ = pLevels->iLevelsHQ;
+   int iLevelsMQ = pLevels->iLevelsMQ;
+   int iLevelsLQ = pLevels->iLevelsLQ;
+   int iMaxLevels = pLevels->iCountLevels;
+
+   float fParamsChangeStrength = (float)iAdjustmentStrength / 10.0;
+   
+   // When on HQ video profile, switch faster to MQ video profile;
+   
+   if ( pInfo->iLastRequestedLevelShift < iLevelsHQ )
+   {
+      fParamsChangeStrength += 0.2;
+      if ( fParamsChangeStrength > 1.0 )
+         fParamsChangeStrength = 1.0;
+   }
+
+   // Max intervals is MAX_CONTROLLER_ADAPTIVE_VIDEO_INFO_INTERVALS * 20 ms = 4 seconds
+   // Minus one because the current index is still processing/invalid
+
+   int iIntervalsToCheckDown = (1.0-0.4*fParamsChangeStrength) * MAX_CONTROLLER_ADAPTIVE_VIDEO_INFO_INTERVALS;
+   int iIntervalsToCheckUp = (1.0-0.3*fParamsChangeStrength) * MAX_CONTROLLER_ADAPTIVE_VIDEO_INFO_INTERVALS;
+   if ( iIntervalsToCheckDown >= MAX_CONTROLLER_ADAPTIVE_VIDEO_INFO_INTERVALS-1 )
+      iIntervalsToCheckDown = MAX_CONTROLLER_ADAPTIVE_VIDEO_INFO_INTERVALS-2;
+   if ( iIntervalsToCheckUp >= MAX_CONTROLLER_ADAPTIVE_VIDEO_INFO_INTERVALS-1 )
+      iIntervalsToCheckUp = MAX_CONTROLLER_ADAPTIVE_VIDEO_INFO_INTERVALS-2;
+
+   int iIntervalsSinceLastShiftDown = (uTimeNowMs - pInfo->uTimeLastLevelShiftDown) / pInfo->uUpdateInterval;
+   if ( iIntervalsToCheckDown > iIntervalsSinceLastShiftDown )
+      iIntervalsToCheckDown = iIntervalsSinceLastShiftDown;
+   if ( iIntervalsToCheckDown <= 0 )
+      iIntervalsToCheckDown = 1;
+
+   pInfo->uIntervalsAdaptive1 = ((u16)iIntervalsToCheckDown) | (((u16)iIntervalsToCheckUp)<<16);
+   
+   int iCountReconstructedDown = 0;
+   int iLongestReconstructionDown = 0;
+   int iCountRetransmissionsDown = 0;
+   int iCountReRetransmissionsDown = 0;
+   int iCountMissingSegmentsDown = 0;
+
+   int iCountReconstructedUp = 0;
+   int iLongestReconstructionUp = 0;
+   int iCountRetransmissionsUp = 0;
+   int iCountReRetransmissionsUp = 0;
+   int iCountMissingSegmentsUp = 0;
+
+   int iIndex = pInfo->uCurrentIntervalIndex - 1;
+   if ( iIndex < 0 )
+      iIndex = MAX_CONTROLLER_ADAPTIVE_VIDEO_INFO_INTERVALS-1;
+
+   int iCurrentReconstructionLength = 0;
+
+   for( int i=0; i<iIntervalsToCheckDown; i++ )
+   {
+      iIndex--;
+      if ( iIndex < 0 )
+         iIndex = MAX_CONTROLLER_ADAPTIVE_VIDEO_INFO_INTERVALS-1;
+      iCountReconstructedDown += (pInfo->uIntervalsOuputRecontructedVideoPackets[iIndex]!=0)?1:0;
+      iCountRetransmissionsDown += (pInfo->uIntervalsRequestedRetransmissions[iIndex]!=0)?1:0;
+      iCountReRetransmissionsDown += (pInfo->uIntervalsRetriedRetransmissions[iIndex]!=0)?1:0;
+      iCountMissingSegmentsDown += (pInfo->uIntervalsMissingVideoPackets[iIndex]!=0)?1:0;
+   
+      if ( pInfo->uIntervalsOuputRecontructedVideoPackets[iIndex] != 0 )
+         iCurrentReconstructionLength++;
+      else
+      {
+         if ( iCurrentReconstructionLength > iLongestReconstructionDown )
+            iLongestReconstructionDown = iCurrentReconstructionLength;
+         iCurrentReconstructionLength = 0;
+      }
+   }
+
+   iCountReconstructedUp = iCountReconstructedDown;
+   iCountRetransmissionsUp = iCountRetransmissionsDown;
+   iCountReRetransmissionsUp = iCountReRetransmissionsDown;
+   iCountMissingSegmentsUp = iCountMissingSegmentsDown;
+   iLongestReconstructionUp = iLongestReconstructionDown;
+
+   for( int i=iIntervalsToCheckDown; i<iIntervalsToCheckUp; i++ )
+   {
+      iIndex--;
+      if ( iIndex < 0 )
+         iIndex = MAX_CONTROLLER_ADAPTIVE_VIDEO_INFO_INTERVALS-1;
+      iCountReconstructedUp += (pInfo->uIntervalsOuputRecontructedVideoPackets[iIndex]!=0)?1:0;
+      iCountRetransmissionsUp += (pInfo->uIntervalsRequestedRetransmissions[iIndex]!=0)?1:0;
+      iCountReRetransmissionsUp += (pInfo->uIntervalsRetriedRetransmissions[iIndex]!=0)?1:0;
+      iCountMissingSegmentsUp += (pInfo->uIntervalsMissingVideoPackets[iIndex]!=0)?1:0;
+   
+      if ( pInfo->uIntervalsOuputRecontructedVideoPackets[iIndex] != 0 )
+         iCurrentReconstructionLength++;
+      else
+      {
+         if ( iCurrentReconstructionLength > iLongestReconstructionUp )
+            iLongestReconstructionUp = iCurrentReconstructionLength;
+         iCurrentReconstructionLength = 0;
+      }
+   }
+
+   // Check for shift down
+
+   int iThresholdReconstructedDown = 2 + (1.0-fParamsChangeStrength)*iIntervalsToCheckDown;
+   int iThresholdRetransmissionsDown = 2 + (1.0-fParamsChangeStrength)*iIntervalsToCheckDown;
+   int iThresholdLongestRecontructionDown = 2 + (1.0-fParamsChangeStrength)*iIntervalsToCheckDown/2.0;
+
+   u32 uMinTimeSinceLastShift = iIntervalsToCheckDown * pInfo->uUpdateInterval;
+   if ( iThresholdReconstructedDown * pInfo->uUpdateInterval < uMinTimeSinceLastShift )
+      uMinTimeSinceLastShift = iThresholdReconstructedDown * pInfo->uUpdateInterval;
+   if ( iThresholdRetransmissionsDown * pInfo->uUpdateInterval < uMinTimeSinceLastShift )
+      uMinTimeSinceLastShift = iThresholdRetransmissionsDown * pInfo->uUpdateInterval;
+
+   if ( uMinTimeSinceLastShift < 70 )
+      uMinTimeSinceLastShift = 70;
+   if ( uMinTimeSinceLastShift > 500 )
+      uMinTimeSinceLastShift = 500;
+   if ( uTimeNowMs > pInfo->uTimeLastLevelShiftDown + uMinTimeSinceLastShift )
+   {
+      if ( (iCountReconstructedDown > iThresholdReconstructedDown) ||
+           (iLongestReconstructionDown > iThresholdLongestRecontructionDown) )
+      {
+         pInfo->uTimeLastLevelShiftDown = uTimeNowMs;
+         pInfo->iLastRequestedLevelShift++;
+         
+         // Skip data:fec == 1:1 leves
+         if ( pInfo->iLastRequestedLevelShift == iLevelsHQ )
+            pInfo->iLastRequestedLevelShift++;
+         if ( pInfo->iLastRequestedLevelShift == iLevelsHQ + iLevelsMQ + 1 )
+            pInfo->iLastRequestedLevelShift++;
+         if ( pInfo->iLastRequestedLevelShift == iLevelsHQ + iLevelsMQ + iLevelsLQ + 2 )
+            pInfo->iLastRequestedLevelShift++;
+
+         if ( pInfo->iLastRequestedLevelShift >= iMaxLevels - 1 )
+            pInfo->iLastRequestedLevelShift = iMaxLevels - 1;
+      }
+
+      if ( (iCountRetransmissionsDown > iThresholdRetransmissionsDown) ||
+           (iCountReRetransmissionsDown > 0) )
+      {
+         pInfo->uTimeLastLevelShiftDown = uTimeNowMs;
+         if ( pInfo->iLastRequestedLevelShift <= iLevelsHQ+1 )
+            pInfo->iLastRequestedLevelShift = iLevelsHQ+2;
+         else if ( pInfo->iLastRequestedLevelShift <= iLevelsHQ+1 + iLevelsMQ+1)
+            pInfo->iLastRequestedLevelShift = iLevelsHQ+iLevelsMQ+3;
+         else 
+            pInfo->iLastRequestedLevelShift = iMaxLevels - 1;
+
+         if ( pInfo->iLastRequestedLevelShift >= iMaxLevels - 1 )
+            pInfo->iLastRequestedLevelShift = iMaxLevels - 1;
+      }
+   }
+
+   // Check for shift up ?
+   // Only if we did not shifted down or up recently
+
+   int iThresholdReconstructedUp = 2 + (1.0-fParamsChangeStrength)*14.0;
+   int iThresholdLongestRecontructionUp = 2 + (1.0-fParamsChangeStrength)*6.0;
+   u32 uTimeForShiftUp = 1000 - (500.0*fParamsChangeStrength);
+   if ( uTimeForShiftUp < 100 )
+      uTimeForShiftUp = 100;
+   if ( uTimeForShiftUp > 1000 )
+      uTimeForShiftUp = 1000;
+   pInfo->uIntervalsAdaptive2 = ((u32)iThresholdReconstructedUp) | (((u32)iThresholdLongestRecontructionUp)<<8);
+   pInfo->uIntervalsAdaptive2 |= (((u32)iThresholdReconstructedDown)<<16) | (((u32)iThresholdLongestRecontructionDown)<<24);
+   
+   if ( uTimeNowMs > pInfo->uTimeLastLevelShiftDown + uTimeForShiftUp )
+   if ( uTimeNowMs > pInfo->uTimeLastLevelShiftUp + uTimeForShiftUp )
+   {
+      if ( iCountReconstructedUp < iThresholdReconstructedUp )
+      if ( iLongestReconstructionUp < iThresholdLongestRecontructionUp )
+      if ( iCountRetransmissionsUp < 5 )
+      {
+         pInfo->uTimeLastLevelShiftUp = uTimeNowMs;
+         if ( pInfo->iLastRequestedLevelShift > 0 )
+         {
+            pInfo->iLastRequestedLevelShift--;
+            // Skip data:fec == 1:1 leves
+            if ( pInfo->iLastRequestedLevelShift == iLevelsHQ )
+               pInfo->iLastRequestedLevelShift--;
+            if ( pInfo->iLastRequestedLevelShift == iLevelsHQ + iLevelsMQ + 1 )
+               pInfo->iLastRequestedLevelShift--;
+            if ( pInfo->iLastRequestedLevelShift == iLevelsHQ + iLevelsMQ + iLevelsLQ + 2 )
+               pInfo->iLastRequestedLevelShift--;
+         }
+         if ( pInfo->iLastRequestedLevelShift < 0 )
+            pInfo->iLastRequestedLevelShift = 0;
+      }
+   }   
+}
+
+//-----------------------------------------------------------
+// Estimator controller: estimates the packet loss rate (fast and slow averages) and the loss bursts length
+// from the intervals history, predicts the block failure rate and goodput of each level, and goes to the
+// best level that keeps the block failures under the target. Shifts down (more EC) right away, as many
+// levels as needed; shifts up only after the link was stable for a while, and only to the level that still
+// fits with a margin on the loss rate (hysteresis). If it has to go back down right after going up, that level
+// is off limits for a while, twice as long each time it happens again.
+
+static t_adaptive_video_estimator_state s_AdaptiveVideoEstimatorState;
+static int s_iAdaptiveVideoEstimatorHasData = 0;
+static float s_fAdaptiveVideoEstimatorLossyIntervals = 0.0; // average ratio of intervals with lost packets
+static float s_fAdaptiveVideoEstimatorPacketsPerInterval = 0.0;
+
+static void _adaptive_video_estimator_reset()
+{
+   memset(&s_AdaptiveVideoEstimatorState, 0, sizeof(t_adaptive_video_estimator_state));
+   s_AdaptiveVideoEstimatorState.fBurstLength = 1.0;
+   s_AdaptiveVideoEstimatorState.iTargetLevel = -1;
+   s_iAdaptiveVideoEstimatorHasData = 0;
+   s_fAdaptiveVideoEstimatorLossyIntervals = 0.0;
+   s_fAdaptiveVideoEstimatorPacketsPerInterval = 0.0;
+}
+
+static void _adaptive_video_estimator_update(shared_mem_controller_adaptive_video_info_vehicle* pInfo)
+{
+   int iIndex = (int)pInfo->uCurrentIntervalIndex - 1;
+   if ( iIndex < 0 )
+      iIndex = MAX_CONTROLLER_ADAPTIVE_VIDEO_INFO_INTERVALS-1;
+
+   // Reconstructed packets were lost and recovered with EC; requested ones were lost and not recovered
+   u32 uLost = pInfo->uIntervalsOuputRecontructedVideoPackets[iIndex] + pInfo->uIntervalsRequestedRetransmissions[iIndex];
+   u32 uTotal = pInfo->uIntervalsOuputCleanVideoPackets[iIndex] + uLost;
+   float fLoss = 0.0;
+   if ( uTotal > 0 )
+      fLoss = (float)uLost / (float)uTotal;
+   else if ( (pInfo->uIntervalsMissingVideoPackets[iIndex] > 0) || (pInfo->uIntervalsRetriedRetransmissions[iIndex] > 0) )
+      fLoss = 1.0; // nothing gets through: deep fade or link lost
+   else
+      return; // no video in this interval
+
+   t_adaptive_video_estimator_state* pState = &s_AdaptiveVideoEstimatorState;
+   if ( ! s_iAdaptiveVideoEstimatorHasData )
+   {
+      s_iAdaptiveVideoEstimatorHasData = 1;
+      pState->fLossFast = fLoss;
+      pState->fLossSlow = fLoss;
+      s_fAdaptiveVideoEstimatorPacketsPerInterval = uTotal;
+      s_fAdaptiveVideoEstimatorLossyIntervals = (uLost > 0)?1.0:0.0;
+   }
+   pState->fLossFast += ADAPTIVE_VIDEO_ESTIMATOR_FAST_ALPHA * (fLoss - pState->fLossFast);
+   pState->fLossSlow += ADAPTIVE_VIDEO_ESTIMATOR_SLOW_ALPHA * (fLoss - pState->fLossSlow);
+   s_fAdaptiveVideoEstimatorLossyIntervals += ADAPTIVE_VIDEO_ESTIMATOR_SLOW_ALPHA * ((((uLost > 0) || (fLoss >= 1.0))?1.0:0.0) - s_fAdaptiveVideoEstimatorLossyIntervals);
+   if ( uTotal > 0 )
+      s_fAdaptiveVideoEstimatorPacketsPerInterval += ADAPTIVE_VIDEO_ESTIMATOR_SLOW_ALPHA * ((float)uTotal - s_fAdaptiveVideoEstimatorPacketsPerInterval);
+
+   // Burst length: independent losses would hit more intervals than the ones that had losses
+   pState->fBurstLength = 1.0;
+   if ( (pState->fLossSlow > 0.0001) && (s_fAdaptiveVideoEstimatorLossyIntervals > 0.0001) )
+   {
+      float fExpectedLossyIntervals = 1.0 - powf(1.0 - pState->fLossSlow, s_fAdaptiveVideoEstimatorPacketsPerInterval);
+      pState->fBurstLength = fExpectedLossyIntervals / s_fAdaptiveVideoEstimatorLossyIntervals;
+      if ( pState->fBurstLength < 1.0 )
+         pState->fBurstLength = 1.0;
+      if ( pState->fBurstLength > 16.0 )
+         pState->fBurstLength = 16.0;
+   }
+}
+
+// Best predicted goodput among the levels with the block failure rate under the target;
+// the most robust level if none fits
+static int _adaptive_video_estimator_get_best_level(const t_adaptive_video_levels* pLevels, float fLoss, float fBurstLength, float fTargetFailure)
+{
+   int iBestLevel = -1;
+   float fBestGoodput = -1.0;
+   for( int i=0; i<pLevels->iCountLevels; i++ )
+   {
+      if ( adaptive_video_is_level_skipped(pLevels, i) )
+         continue;
+      float fFailure = adaptive_video_get_block_failure_probability(pLevels, i, fLoss, fBurstLength);
+      if ( fFailure > fTargetFailure )
+         continue;
+      float fGoodput = (float)pLevels->uVideoBitrate[i] * (1.0 - fFailure);
+      if ( fGoodput > fBestGoodput )
+      {
+         fBestGoodput = fGoodput;
+         iBestLevel = i;
+      }
+   }
+   if ( iBestLevel < 0 )
+   {
+      iBestLevel = pLevels->iCountLevels-1;
+      while ( iBestLevel > 0 && adaptive_video_is_level_skipped(pLevels, iBestLevel) )
+         iBestLevel--;
+   }
+   return iBestLevel;
+}
+
+static void _adaptive_video_estimator_adjust(shared_mem_controller_adaptive_video_info_vehicle* pInfo, const t_adaptive_video_levels* pLevels, int iAdjustmentStrength, u32 uTimeNowMs)
+{
+   if ( pLevels->iCountLevels <= 0 )
+      return;
+   _adaptive_video_estimator_update(pInfo);
+   if ( ! s_iAdaptiveVideoEstimatorHasData )
+      return;
+
+   t_adaptive_video_estimator_state* pState = &s_AdaptiveVideoEstimatorState;
+   if ( iAdjustmentStrength < 1 )
+      iAdjustmentStrength = 1;
+   if ( iAdjustmentStrength > 10 )
+      iAdjustmentStrength = 10;
+
+   // Stronger adjustments: accept a bit more failures (stay on the better levels) and go up sooner
+   pState->fTargetBlockFailure = ADAPTIVE_VIDEO_ESTIMATOR_TARGET_BLOCK_FAILURE * (0.5 + (float)iAdjustmentStrength/10.0);
+   u32 uHoldUpMs = 3000 - 200*iAdjustmentStrength;
+
+   // The slow average follows the link; the fast one only counts when it is well above it (a fade starts):
+   // more than its own noise on a steady link (4 sigma), so random losses on a steady link don't trigger switches
+   float fLoss = pState->fLossSlow;
+   float fPackets = s_fAdaptiveVideoEstimatorPacketsPerInterval;
+   if ( fPackets < 1.0 )
+      fPackets = 1.0;
+   float fFastNoise = sqrtf(pState->fLossSlow * (1.0 - pState->fLossSlow) * pState->fBurstLength / fPackets * ADAPTIVE_VIDEO_ESTIMATOR_FAST_ALPHA / (2.0 - ADAPTIVE_VIDEO_ESTIMATOR_FAST_ALPHA));
+   if ( pState->fLossFast > pState->fLossSlow + 4.0*fFastNoise + 0.05 )
+      fLoss = pState->fLossFast;
+
+   int iCurrentLevel = pInfo->iLastRequestedLevelShift;
+   int iTargetDown = _adaptive_video_estimator_get_best_level(pLevels, fLoss, pState->fBurstLength, pState->fTargetBlockFailure);
+   float fLossUp = fLoss;
+   if ( pState->fLossFast > fLossUp )
+      fLossUp = pState->fLossFast;
+   int iTargetUp = _adaptive_video_estimator_get_best_level(pLevels, fLossUp*ADAPTIVE_VIDEO_ESTIMATOR_UP_MARGIN, pState->fBurstLength, pState->fTargetBlockFailure);
+   pState->iTargetLevel = iTargetDown;
+
+   pInfo->uIntervalsAdaptive1 = (u32)(pState->fLossFast*10000.0) | (((u32)(pState->fLossSlow*10000.0))<<16);
+   pInfo->uIntervalsAdaptive2 = (u32)(pState->fBurstLength*100.0) | (((u32)iTargetDown & 0xFF)<<16) | (((u32)iTargetUp & 0xFF)<<24);
+
+   if ( iTargetDown > iCurrentLevel )
+   {
+      // Wait for the vehicle to switch to the previous requested level before going down more,
+      // the stats are still from the previous level
+      if ( (pInfo->iLastAcknowledgedLevelShift != iCurrentLevel) && (uTimeNowMs < pInfo->uTimeLastLevelShiftDown + ADAPTIVE_VIDEO_ESTIMATOR_WAIT_ACK_MS) )
+         return;
+      // Back down soon after going up: the link can't hold the level it went up to; don't go up to it
+      // (or better) again for a while, twice as long each time it happens
+      if ( uTimeNowMs < pInfo->uTimeLastLevelShiftUp + 2*uHoldUpMs )
+      {
+         if ( iCurrentLevel == pState->iCeilingLevel - 1 )
+            pState->uCeilingHoldMs *= 2;
+         else
+            pState->uCeilingHoldMs = 2*uHoldUpMs;
+         if ( pState->uCeilingHoldMs > ADAPTIVE_VIDEO_ESTIMATOR_MAX_HOLD_UP_MS )
+            pState->uCeilingHoldMs = ADAPTIVE_VIDEO_ESTIMATOR_MAX_HOLD_UP_MS;
+         pState->iCeilingLevel = iCurrentLevel + 1;
+         pState->uTimeCeilingEnd = uTimeNowMs + pState->uCeilingHoldMs;
+      }
+      pInfo->iLastRequestedLevelShift = iTargetDown;
+      pInfo->uTimeLastLevelShiftDown = uTimeNowMs;
+      return;
+   }
+
+   if ( (uTimeNowMs < pState->uTimeCeilingEnd) && (iTargetUp < pState->iCeilingLevel) )
+      iTargetUp = pState->iCeilingLevel;
+
+   if ( iTargetUp < iCurrentLevel )
+   if ( uTimeNowMs > pInfo->uTimeLastLevelShiftDown + uHoldUpMs )
+   if ( uTimeNowMs > pInfo->uTimeLastLevelShiftUp + uHoldUpMs )
+   {
+      pInfo->iLastRequestedLevelShift = iTargetUp;
+      pInfo->uTimeLastLevelShiftUp = uTimeNowMs;
+   }
+}
+
+const t_adaptive_video_estimator_state* adaptive_video_estimator_get_state()
+{
+   return &s_AdaptiveVideoEstimatorState;
+}
+
+static const t_adaptive_video_controller s_AdaptiveVideoControllers[ADAPTIVE_VIDEO_CONTROLLERS_COUNT] =
+{
+   { "baseline", _adaptive_video_baseline_reset, _adaptive_video_baseline_adjust },
+   { "estimator", _adaptive_video_estimator_reset, _adaptive_video_estimator_adjust }
+};
+
+const t_adaptive_video_controller* adaptive_video_get_controller(int iController)
+{
+   if ( iController < 0 || iController >= ADAPTIVE_VIDEO_CONTROLLERS_COUNT )
+      iController = ADAPTIVE_VIDEO_CONTROLLER_BASELINE;
+   return &s_AdaptiveVideoControllers[iController];
+}
@@ -0,0 +1,86 @@
+#pragma once
+#include "../base/base.h"
+#include "../base/config.h"
+#include "../base/shared_mem_controller_only.h"
+#include "../radio/radiopackets2.h"
+
+// Controller side adaptive video level controllers.
+// A controller looks at the interval history of a vehicle (20 ms intervals: clean, reconstructed and missing
+// video packets, requested/retried retransmissions) and updates the requested adaptive video level
+// (iLastRequestedLevelShift) and the level shift times in the same structure.
+// They don't use any global state (time, model), so the same code runs in ruby_rt_station and offline,
+// on recorded traces (see adaptive_video_trace.h).
+//
+// Levels are the ones the vehicle understands: user profile shift levels 0..N, then MQ profile levels,
+// then LQ profile levels; each shift level adds one EC packet to the profile's block (see process_radio_in_packets.cpp on vehicle).
+
+#define ADAPTIVE_VIDEO_CONTROLLER_BASELINE 0 // the original thresholds based logic
+#define ADAPTIVE_VIDEO_CONTROLLER_ESTIMATOR 1 // loss/burst estimation with predicted goodput per level
+#define ADAPTIVE_VIDEO_CONTROLLERS_COUNT 2
+
+// Up to block_packets - block_fecs shift levels (plus level 0) for each of the user, MQ and LQ profiles
+#define ADAPTIVE_VIDEO_MAX_LEVELS (3*(MAX_DATA_PACKETS_IN_BLOCK+1))
+
+// Estimator controller tuning
+#define ADAPTIVE_VIDEO_ESTIMATOR_FAST_ALPHA 0.3f // about 60 ms time constant at 20 ms intervals
+#define ADAPTIVE_VIDEO_ESTIMATOR_SLOW_ALPHA 0.02f // about 1 second time constant
+#define ADAPTIVE_VIDEO_ESTIMATOR_TARGET_BLOCK_FAILURE 0.002f // at adjustment strength 5
+#define ADAPTIVE_VIDEO_ESTIMATOR_UP_MARGIN 2.0f // a better level must fit the target at this many times the estimated loss
+#define ADAPTIVE_VIDEO_ESTIMATOR_WAIT_ACK_MS 200 // no new shift down until the vehicle acknowledged the previous one
+#define ADAPTIVE_VIDEO_ESTIMATOR_MAX_HOLD_UP_MS 20000 // max time a level that could not be held is off limits
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct
+{
+   int iCountLevels;
+   int iLevelsHQ; // max level shifts of the user profile (Model::get_video_link_profile_max_level_shifts)
+   int iLevelsMQ;
+   int iLevelsLQ;
+   int iVideoPacketLength; // bytes
+   u8 uDataPackets[ADAPTIVE_VIDEO_MAX_LEVELS];
+   u8 uECPackets[ADAPTIVE_VIDEO_MAX_LEVELS];
+   u32 uVideoBitrate[ADAPTIVE_VIDEO_MAX_LEVELS]; // bps, as the vehicle sets it for each level (approximation)
+} __attribute__((packed)) t_adaptive_video_levels;
+
+typedef struct
+{
+   const char* szName;
+   void (*pfReset)(void);
+   // Called once for each new interval; the last complete interval is uCurrentIntervalIndex-1
+   void (*pfAdjust)(shared_mem_controller_adaptive_video_info_vehicle* pInfo, const t_adaptive_video_levels* pLevels, int iAdjustmentStrength, u32 uTimeNowMs);
+} t_adaptive_video_controller;
+
+const t_adaptive_video_controller* adaptive_video_get_controller(int iController);
+
+// Appends the levels of a video profile: shift level N adds N EC packets to the block and lowers the
+// video bitrate so the radio bitrate stays the same
+void adaptive_video_levels_add_profile(t_adaptive_video_levels* pLevels, int iDataPackets, int iECPackets, int iLevelShifts, u32 uVideoBitrate);
+
+// The data:fec == 1:1 level at the end of each profile is not used
+int adaptive_video_is_level_skipped(const t_adaptive_video_levels* pLevels, int iLevel);
+
+// Probability that a block of the given level can't be reconstructed, for a packet loss rate and the
+// average length (in packets) of the loss bursts
+float adaptive_video_get_block_failure_probability(const t_adaptive_video_levels* pLevels, int iLevel, float fLossRate, float fBurstLength);
+
+// Debug values of the estimator controller (also in uIntervalsAdaptive1/2/3 of the interval info)
+typedef struct
+{
+   float fLossFast;
+   float fLossSlow;
+   float fBurstLength; // in packets
+   int iTargetLevel;
+   float fTargetBlockFailure;
+   int iCeilingLevel; // best level allowed until uTimeCeilingEnd, after going back down from a better one
+   u32 uTimeCeilingEnd;
+   u32 uCeilingHoldMs;
+} t_adaptive_video_estimator_state;
+
+const t_adaptive_video_estimator_state* adaptive_video_estimator_get_state();
+
+#ifdef __cplusplus
+}  /* end extern "C" */
+#endif
@@ -0,0 +1,431 @@
+/*
+You can use this C/C++ code however you wish (for example, but not limited to:
+     as is, or by modifying it, or by adding new code, or by removing parts of the code;
+     in public or private projects, in new free or commercial products)
+     only if you get a priori written consent from Petru Soroaga (petrusoroaga@yahoo.com) for your specific use
+     and only if this copyright terms are preserved in the code.
+     This code is public for learning and academic purposes.
+Also, check the licences folder for additional licences terms.
+Code written by: Petru Soroaga, 2021-2023
+*/
+
+#include "adaptive_video_trace.h"
+
+static FILE* s_fAdaptiveVideoTraceFile = NULL;
+static int s_iAdaptiveVideoTraceRecords = 0;
+static u32 s_uAdaptiveVideoTraceTimeStart = 0;
+
+int adaptive_video_trace_start_recording(const char* szFile, u32 uUpdateInterval, int iAdjustmentStrength, int iController, const t_adaptive_video_levels* pLevels)
+{
+   adaptive_video_trace_stop_recording();
+
+   s_fAdaptiveVideoTraceFile = fopen(szFile, "wb");
+   if ( NULL == s_fAdaptiveVideoTraceFile )
+   {
+      log_softerror_and_alarm("Failed to create adaptive video trace file: %s", szFile);
+      return 0;
+   }
+
+   t_adaptive_video_trace_header header;
+   memset(&header, 0, sizeof(t_adaptive_video_trace_header));
+   header.uMagic = ADAPTIVE_VIDEO_TRACE_MAGIC;
+   header.uVersion = ADAPTIVE_VIDEO_TRACE_VERSION;
+   header.uUpdateInterval = uUpdateInterval;
+   header.iAdjustmentStrength = iAdjustmentStrength;
+   header.iController = iController;
+   memcpy(&header.levels, pLevels, sizeof(t_adaptive_video_levels));
+   if ( 1 != fwrite(&header, sizeof(t_adaptive_video_trace_header), 1, s_fAdaptiveVideoTraceFile) )
+   {
+      log_softerror_and_alarm("Failed to write adaptive video trace file: %s", szFile);
+      fclose(s_fAdaptiveVideoTraceFile);
+      s_fAdaptiveVideoTraceFile = NULL;
+      return 0;
+   }
+   s_iAdaptiveVideoTraceRecords = 0;
+   s_uAdaptiveVideoTraceTimeStart = 0;
+   log_line("Started recording adaptive video trace to %s (%d levels)", szFile, pLevels->iCountLevels);
+   return 1;
+}
+
+void adaptive_video_trace_add_interval(const shared_mem_controller_adaptive_video_info_vehicle* pInfo, u32 uTimeNowMs)
+{
+   if ( NULL == s_fAdaptiveVideoTraceFile )
+      return;
+
+   int iIndex = (int)pInfo->uCurrentIntervalIndex - 1;
+   if ( iIndex < 0 )
+      iIndex = MAX_CONTROLLER_ADAPTIVE_VIDEO_INFO_INTERVALS-1;
+
+   if ( 0 == s_iAdaptiveVideoTraceRecords )
+      s_uAdaptiveVideoTraceTimeStart = uTimeNowMs;
+
+   t_adaptive_video_trace_record record;
+   record.uTime = uTimeNowMs - s_uAdaptiveVideoTraceTimeStart;
+   record.uClean = pInfo->uIntervalsOuputCleanVideoPackets[iIndex];
+   record.uReconstructed = pInfo->uIntervalsOuputRecontructedVideoPackets[iIndex];
+   record.uMissing = pInfo->uIntervalsMissingVideoPackets[iIndex];
+   record.uRequested = pInfo->uIntervalsRequestedRetransmissions[iIndex];
+   record.uRetried = pInfo->uIntervalsRetriedRetransmissions[iIndex];
+   record.uAcknowledgedLevel = (pInfo->iLastAcknowledgedLevelShift < 0)?0xFF:(u8)pInfo->iLastAcknowledgedLevelShift;
+   record.uRequestedLevel = (pInfo->iLastRequestedLevelShift < 0)?0xFF:(u8)pInfo->iLastRequestedLevelShift;
+
+   if ( 1 != fwrite(&record, sizeof(t_adaptive_video_trace_record), 1, s_fAdaptiveVideoTraceFile) )
+   {
+      log_softerror_and_alarm("Failed to write to adaptive video trace file. Stopped recording it.");
+      adaptive_video_trace_stop_recording();
+      return;
+   }
+   s_iAdaptiveVideoTraceRecords++;
+   if ( s_iAdaptiveVideoTraceRecords >= ADAPTIVE_VIDEO_TRACE_MAX_RECORDS )
+   {
+      log_line("Adaptive video trace reached max size. Stopped recording it.");
+      adaptive_video_trace_stop_recording();
+   }
+}
+
+void adaptive_video_trace_stop_recording()
+{
+   if ( NULL == s_fAdaptiveVideoTraceFile )
+      return;
+   fclose(s_fAdaptiveVideoTraceFile);
+   s_fAdaptiveVideoTraceFile = NULL;
+   log_line("Stopped recording adaptive video trace (%d intervals)", s_iAdaptiveVideoTraceRecords);
+}
+
+int adaptive_video_trace_is_recording()
+{
+   return (NULL != s_fAdaptiveVideoTraceFile)?1:0;
+}
+
+int adaptive_video_trace_load(const char* szFile, t_adaptive_video_trace* pTrace)
+{
+   memset(pTrace, 0, sizeof(t_adaptive_video_trace));
+   FILE* fd = fopen(szFile, "rb");
+   if ( NULL == fd )
+   {
+      log_softerror_and_alarm("Failed to open adaptive video trace file: %s", szFile);
+      return 0;
+   }
+   if ( 1 != fread(&pTrace->header, sizeof(t_adaptive_video_trace_header), 1, fd) ||
+        pTrace->header.uMagic != ADAPTIVE_VIDEO_TRACE_MAGIC ||
+        pTrace->header.uVersion != ADAPTIVE_VIDEO_TRACE_VERSION ||
+        pTrace->header.levels.iCountLevels <= 0 || pTrace->header.levels.iCountLevels > ADAPTIVE_VIDEO_MAX_LEVELS )
+   {
+      log_softerror_and_alarm("Invalid adaptive video trace file: %s", szFile);
+      fclose(fd);
+      return 0;
+   }
+
+   fseek(fd, 0, SEEK_END);
+   long lSize = ftell(fd) - (long)sizeof(t_adaptive_video_trace_header);
+   fseek(fd, sizeof(t_adaptive_video_trace_header), SEEK_SET);
+
+   // A trace cut while recording can end with a partial record
+   pTrace->iCountRecords = (int)(lSize / (long)sizeof(t_adaptive_video_trace_record));
+   if ( pTrace->iCountRecords > 0 )
+   {
+      pTrace->pRecords = (t_adaptive_video_trace_record*) malloc(pTrace->iCountRecords * sizeof(t_adaptive_video_trace_record));
+      if ( NULL == pTrace->pRecords || (size_t)pTrace->iCountRecords != fread(pTrace->pRecords, sizeof(t_adaptive_video_trace_record), pTrace->iCountRecords, fd) )
+      {
+         log_softerror_and_alarm("Failed to read adaptive video trace file: %s", szFile);
+         fclose(fd);
+         adaptive_video_trace_free(pTrace);
+         return 0;
+      }
+   }
+   fclose(fd);
+   return 1;
+}
+
+int adaptive_video_trace_save(const char* szFile, const t_adaptive_video_trace* pTrace)
+{
+   FILE* fd = fopen(szFile, "wb");
+   if ( NULL == fd )
+   {
+      log_softerror_and_alarm("Failed to create adaptive video trace file: %s", szFile);
+      return 0;
+   }
+   int iOk = 1;
+   if ( 1 != fwrite(&pTrace->header, sizeof(t_adaptive_video_trace_header), 1, fd) )
+      iOk = 0;
+   if ( iOk && pTrace->iCountRecords > 0 )
+   if ( (size_t)pTrace->iCountRecords != fwrite(pTrace->pRecords, sizeof(t_adaptive_video_trace_record), pTrace->iCountRecords, fd) )
+      iOk = 0;
+   fclose(fd);
+   if ( ! iOk )
+      log_softerror_and_alarm("Failed to write adaptive video trace file: %s", szFile);
+   return iOk;
+}
+
+void adaptive_video_trace_free(t_adaptive_video_trace* pTrace)
+{
+   if ( NULL != pTrace->pRecords )
+      free(pTrace->pRecords);
+   pTrace->pRecords = NULL;
+   pTrace->iCountRecords = 0;
+}
+
+void adaptive_video_trace_get_default_levels(t_adaptive_video_levels* pLevels)
+{
+   memset(pLevels, 0, sizeof(t_adaptive_video_levels));
+   pLevels->iVideoPacketLength = DEFAULT_VIDEO_PACKET_LENGTH_HQ;
+   pLevels->iLevelsHQ = 12-6;
+   pLevels->iLevelsMQ = 8-4;
+   pLevels->iLevelsLQ = 4-2;
+   adaptive_video_levels_add_profile(pLevels, 12, 6, pLevels->iLevelsHQ, 8000000);
+   adaptive_video_levels_add_profile(pLevels, 8, 4, pLevels->iLevelsMQ, 4000000);
+   adaptive_video_levels_add_profile(pLevels, 4, 2, pLevels->iLevelsLQ, 2000000);
+}
+
+// Small deterministic generator, so replays and synthetic traces are the same on each run
+static u32 _adaptive_video_trace_random(u32* pState)
+{
+   u32 x = *pState;
+   x ^= x << 13;
+   x ^= x >> 17;
+   x ^= x << 5;
+   *pState = x;
+   return x;
+}
+
+static float _adaptive_video_trace_random_float(u32* pState)
+{
+   return (float)(_adaptive_video_trace_random(pState) >> 8) / (float)(1<<24);
+}
+
+// Video packets (data + EC) sent in one interval at the given level
+static float _adaptive_video_trace_get_packets_per_interval(const t_adaptive_video_levels* pLevels, int iLevel, u32 uUpdateInterval)
+{
+   int iPacketLength = pLevels->iVideoPacketLength;
+   if ( iPacketLength <= 0 )
+      iPacketLength = DEFAULT_VIDEO_PACKET_LENGTH_HQ;
+   float fDataPackets = (float)pLevels->uVideoBitrate[iLevel] * (float)uUpdateInterval / 1000.0 / 8.0 / (float)iPacketLength;
+   return fDataPackets * (float)(pLevels->uDataPackets[iLevel] + pLevels->uECPackets[iLevel]) / (float)pLevels->uDataPackets[iLevel];
+}
+
+int adaptive_video_trace_generate(t_adaptive_video_trace* pTrace, const t_adaptive_video_levels* pLevels, const t_adaptive_video_channel* pChannel, int iDurationMs, u32 uSeed)
+{
+   memset(pTrace, 0, sizeof(t_adaptive_video_trace));
+   pTrace->header.uMagic = ADAPTIVE_VIDEO_TRACE_MAGIC;
+   pTrace->header.uVersion = ADAPTIVE_VIDEO_TRACE_VERSION;
+   pTrace->header.uUpdateInterval = 20;
+   pTrace->header.iAdjustmentStrength = DEFAULT_VIDEO_PARAMS_ADJUSTMENT_STRENGTH;
+   pTrace->header.iController = -1;
+   memcpy(&pTrace->header.levels, pLevels, sizeof(t_adaptive_video_levels));
+
+   pTrace->iCountRecords = iDurationMs / (int)pTrace->header.uUpdateInterval;
+   if ( pTrace->iCountRecords > ADAPTIVE_VIDEO_TRACE_MAX_RECORDS )
+      pTrace->iCountRecords = ADAPTIVE_VIDEO_TRACE_MAX_RECORDS;
+   if ( pTrace->iCountRecords <= 0 )
+      return 0;
+   pTrace->pRecords = (t_adaptive_video_trace_record*) malloc(pTrace->iCountRecords * sizeof(t_adaptive_video_trace_record));
+   if ( NULL == pTrace->pRecords )
+   {
+      pTrace->iCountRecords = 0;
+      return 0;
+   }
+   memset(pTrace->pRecords, 0, pTrace->iCountRecords * sizeof(t_adaptive_video_trace_record));
+
+   // The link is observed at the top level; replays only use the loss rate of each interval
+   float fPacketsPerInterval = _adaptive_video_trace_get_packets_per_interval(pLevels, 0, pTrace->header.uUpdateInterval);
+   float fPacketsCarry = 0.0;
+   int iBadState = 0;
+   u32 uRandom = (0 == uSeed)?1:uSeed;
+
+   for( int i=0; i<pTrace->iCountRecords; i++ )
+   {
+      t_adaptive_video_trace_record* pRecord = &pTrace->pRecords[i];
+      u32 uTime = (u32)i * pTrace->header.uUpdateInterval;
+      pRecord->uTime = uTime;
+      pRecord->uAcknowledgedLevel = 0;
+      pRecord->uRequestedLevel = 0;
+
+      if ( iBadState )
+      {
+         if ( _adaptive_video_trace_random_float(&uRandom) < pChannel->fBadToGood )
+            iBadState = 0;
+      }
+      else if ( _adaptive_video_trace_random_float(&uRandom) < pChannel->fGoodToBad )
+         iBadState = 1;
+
+      float fLoss = iBadState?pChannel->fLossBad:pChannel->fLossGood;
+      if ( pChannel->iFadePeriodMs > 0 )
+      if ( (int)(uTime % (u32)pChannel->iFadePeriodMs) >= pChannel->iFadePeriodMs - pChannel->iFadeDurationMs )
+      if ( pChannel->fFadeLoss > fLoss )
+         fLoss = pChannel->fFadeLoss;
+      int iOutage = 0;
+      if ( pChannel->iOutagePeriodMs > 0 )
+      if ( (int)(uTime % (u32)pChannel->iOutagePeriodMs) >= pChannel->iOutagePeriodMs - pChannel->iOutageDurationMs )
+         iOutage = 1;
+
+      fPacketsCarry += fPacketsPerInterval;
+      int iPackets = (int)fPacketsCarry;
+      fPacketsCarry -= (float)iPackets;
+
+      if ( iOutage )
+      {
+         pRecord->uMissing = iPackets;
+         continue;
+      }
+      int iLost = 0;
+      for( int k=0; k<iPackets; k++ )
+      {
+         if ( _adaptive_video_trace_random_float(&uRandom) < fLoss )
+            iLost++;
+      }
+      pRecord->uClean = iPackets - iLost;
+      pRecord->uReconstructed = iLost;
+   }
+   return 1;
+}
+
+float adaptive_video_trace_get_interval_loss(const t_adaptive_video_trace_record* pRecord)
+{
+   u32 uLost = (u32)pRecord->uReconstructed + (u32)pRecord->uRequested;
+   u32 uTotal = (u32)pRecord->uClean + uLost;
+   if ( uTotal > 0 )
+      return (float)uLost / (float)uTotal;
+   if ( pRecord->uMissing > 0 || pRecord->uRetried > 0 )
+      return 1.0;
+   return -1.0;
+}
+
+void adaptive_video_trace_replay(const t_adaptive_video_trace* pTrace, int iController, int iAdjustmentStrength, u32 uSeed, t_adaptive_video_replay_score* pScore)
+{
+   memset(pScore, 0, sizeof(t_adaptive_video_replay_score));
+   const t_adaptive_video_levels* pLevels = &pTrace->header.levels;
+   if ( pTrace->iCountRecords <= 0 || pLevels->iCountLevels <= 0 )
+      return;
+   if ( iAdjustmentStrength < 0 )
+      iAdjustmentStrength = pTrace->header.iAdjustmentStrength;
+   u32 uUpdateInterval = pTrace->header.uUpdateInterval;
+   if ( 0 == uUpdateInterval )
+      uUpdateInterval = 20;
+
+   const t_adaptive_video_controller* pController = adaptive_video_get_controller(iController);
+   pController->pfReset();
+
+   shared_mem_controller_adaptive_video_info_vehicle* pInfo = (shared_mem_controller_adaptive_video_info_vehicle*) malloc(sizeof(shared_mem_controller_adaptive_video_info_vehicle));
+   if ( NULL == pInfo )
+      return;
+   memset(pInfo, 0, sizeof(shared_mem_controller_adaptive_video_info_vehicle));
+   pInfo->uUpdateInterval = uUpdateInterval;
+   pInfo->iChangeStrength = iAdjustmentStrength;
+
+   // Start after a while, like the station does once it gets the video stream (controllers look back in time)
+   u32 uTimeNow = 10000;
+   pInfo->uTimeLastLevelShiftDown = uTimeNow;
+   pInfo->uTimeLastLevelShiftUp = uTimeNow;
+
+   int iLevel = 0; // the level the vehicle is on
+   int iPendingLevel = 0;
+   int iPendingIntervals = 0;
+   float fPacketsCarry = 0.0;
+   u32 uRandom = (0 == uSeed)?1:uSeed;
+   double dLevelsSum = 0.0;
+   double dGoodBits = 0.0;
+   u32 uStallLength = 0;
+
+   for( int i=0; i<pTrace->iCountRecords; i++ )
+   {
+      uTimeNow += uUpdateInterval;
+
+      // The vehicle switches to the requested level after a few intervals
+      if ( pInfo->iLastRequestedLevelShift != iPendingLevel )
+      {
+         iPendingLevel = pInfo->iLastRequestedLevelShift;
+         iPendingIntervals = ADAPTIVE_VIDEO_REPLAY_SWITCH_DELAY_INTERVALS;
+      }
+      if ( iPendingLevel != iLevel )
+      {
+         iPendingIntervals--;
+         if ( iPendingIntervals <= 0 )
+            iLevel = iPendingLevel;
+      }
+      if ( iLevel < 0 )
+         iLevel = 0;
+      if ( iLevel >= pLevels->iCountLevels )
+         iLevel = pLevels->iCountLevels-1;
+      pInfo->iLastAcknowledgedLevelShift = iLevel;
+
+      // Send the blocks of this interval over the recorded link
+      int iIndex = pInfo->uCurrentIntervalIndex;
+      float fLoss = adaptive_video_trace_get_interval_loss(&pTrace->pRecords[i]);
+      int iStall = 0;
+      if ( fLoss >= 0.0 )
+      {
+         int iData = pLevels->uDataPackets[iLevel];
+         int iEC = pLevels->uECPackets[iLevel];
+         fPacketsCarry += _adaptive_video_trace_get_packets_per_interval(pLevels, iLevel, uUpdateInterval) / (float)(iData + iEC);
+         int iBlocks = (int)fPacketsCarry;
+         fPacketsCarry -= (float)iBlocks;
+         for( int b=0; b<iBlocks; b++ )
+         {
+            int iLostData = 0;
+            int iLostTotal = 0;
+            for( int k=0; k<iData+iEC; k++ )
+            {
+               if ( fLoss >= 1.0 || _adaptive_video_trace_random_float(&uRandom) < fLoss )
+               {
+                  iLostTotal++;
+                  if ( k < iData )
+                     iLostData++;
+               }
+            }
+            pScore->uBlocks++;
+            if ( iLostTotal <= iEC )
+            {
+               pInfo->uIntervalsOuputCleanVideoPackets[iIndex] += iData - iLostData;
+               pInfo->uIntervalsOuputRecontructedVideoPackets[iIndex] += iLostData;
+               dGoodBits += (double)iData * (double)pLevels->iVideoPacketLength * 8.0;
+               continue;
+            }
+            // Can't be reconstructed: the station asks for the lost data packets, if it got any packet of the block
+            if ( iLostTotal < iData + iEC )
+            {
+               pInfo->uIntervalsOuputCleanVideoPackets[iIndex] += iData - iLostData;
+               pInfo->uIntervalsRequestedRetransmissions[iIndex] += iLostData;
+            }
+            pInfo->uIntervalsMissingVideoPackets[iIndex] += iLostData;
+            pScore->uFailedBlocks++;
+            iStall = 1;
+         }
+      }
+
+      pScore->uIntervals++;
+      dLevelsSum += iLevel;
+      if ( iStall )
+      {
+         pScore->uStallIntervals++;
+         if ( 0 == uStallLength )
+            pScore->uStallEvents++;
+         uStallLength++;
+         if ( uStallLength * uUpdateInterval > pScore->uLongestStallMs )
+            pScore->uLongestStallMs = uStallLength * uUpdateInterval;
+      }
+      else
+         uStallLength = 0;
+
+      // Next interval, same as ruby_rt_station does it, then let the controller decide
+      pInfo->uCurrentIntervalIndex++;
+      if ( pInfo->uCurrentIntervalIndex >= MAX_CONTROLLER_ADAPTIVE_VIDEO_INFO_INTERVALS )
+         pInfo->uCurrentIntervalIndex = 0;
+      iIndex = pInfo->uCurrentIntervalIndex;
+      pInfo->uIntervalsOuputCleanVideoPackets[iIndex] = 0;
+      pInfo->uIntervalsOuputRecontructedVideoPackets[iIndex] = 0;
+      pInfo->uIntervalsMissingVideoPackets[iIndex] = 0;
+      pInfo->uIntervalsRequestedRetransmissions[iIndex] = 0;
+      pInfo->uIntervalsRetriedRetransmissions[iIndex] = 0;
+
+      int iRequestedBefore = pInfo->iLastRequestedLevelShift;
+      pController->pfAdjust(pInfo, pLevels, iAdjustmentStrength, uTimeNow);
+      if ( pInfo->iLastRequestedLevelShift > iRequestedBefore )
+         pScore->uSwitchesDown++;
+      else if ( pInfo->iLastRequestedLevelShift < iRequestedBefore )
+         pScore->uSwitchesUp++;
+   }
+
+   pScore->fAverageLevel = (float)(dLevelsSum / (double)pScore->uIntervals);
+   pScore->fGoodputKbps = (float)(dGoodBits / (double)(pScore->uIntervals * uUpdateInterval));
+   free(pInfo);
+}
@@ -0,0 +1,106 @@
+#pragma once
+#include "../base/base.h"
+#include "../base/config.h"
+#include "../base/shared_mem_controller_only.h"
+#include "adaptive_video_controllers.h"
+
+// Adaptive video link traces: the per interval video stats the controller saw (one record each 20 ms)
+// and the levels it requested, recorded by ruby_rt_station (when enabled in the controller settings)
+// or generated from a synthetic channel model.
+// A trace can be replayed against any adaptive video controller (see adaptive_video_controllers.h):
+// the per interval packet loss of the recorded link is applied to the blocks of the levels the replayed
+// controller picks, and the result is scored (stalls, switches, goodput). Used by ruby_adaptive_video_replay.
+
+#define ADAPTIVE_VIDEO_TRACE_MAGIC 0x54564152 // "RAVT"
+#define ADAPTIVE_VIDEO_TRACE_VERSION 2 // 2: levels sized for 3 profiles of up to 33 levels
+#define ADAPTIVE_VIDEO_TRACE_MAX_RECORDS (50*3600) // one hour at 20 ms intervals
+
+// How many update intervals it takes the vehicle to switch to a requested level, in replays
+#define ADAPTIVE_VIDEO_REPLAY_SWITCH_DELAY_INTERVALS 3
+
+typedef struct
+{
+   u32 uMagic;
+   u32 uVersion;
+   u32 uUpdateInterval; // ms
+   int iAdjustmentStrength;
+   int iController;
+   t_adaptive_video_levels levels;
+} __attribute__((packed)) t_adaptive_video_trace_header;
+
+typedef struct
+{
+   u32 uTime; // ms since the start of the trace
+   u16 uClean;
+   u16 uReconstructed;
+   u16 uMissing;
+   u16 uRequested;
+   u16 uRetried;
+   u8 uAcknowledgedLevel; // 0xFF: none yet
+   u8 uRequestedLevel;
+} __attribute__((packed)) t_adaptive_video_trace_record;
+
+typedef struct
+{
+   t_adaptive_video_trace_header header;
+   int iCountRecords;
+   t_adaptive_video_trace_record* pRecords;
+} t_adaptive_video_trace;
+
+// Channel model for synthetic traces: a two state (good/bad) Markov channel, switching state on interval
+// boundaries, plus periodic fades and outages
+typedef struct
+{
+   float fLossGood;
+   float fLossBad;
+   float fGoodToBad; // probability to switch state on each interval
+   float fBadToGood;
+   int iFadePeriodMs; // 0 for no fades
+   int iFadeDurationMs;
+   float fFadeLoss;
+   int iOutagePeriodMs; // 0 for no outages; all packets are lost during an outage
+   int iOutageDurationMs;
+} t_adaptive_video_channel;
+
+typedef struct
+{
+   u32 uIntervals;
+   u32 uStallIntervals; // intervals with at least one block that could not be reconstructed
+   u32 uStallEvents;
+   u32 uLongestStallMs;
+   u32 uBlocks;
+   u32 uFailedBlocks;
+   u32 uSwitchesUp;
+   u32 uSwitchesDown;
+   float fAverageLevel;
+   float fGoodputKbps; // video bitrate of the blocks that got through
+} t_adaptive_video_replay_score;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int adaptive_video_trace_start_recording(const char* szFile, u32 uUpdateInterval, int iAdjustmentStrength, int iController, const t_adaptive_video_levels* pLevels);
+// Adds the last complete interval (uCurrentIntervalIndex-1); stops by itself after ADAPTIVE_VIDEO_TRACE_MAX_RECORDS
+void adaptive_video_trace_add_interval(const shared_mem_controller_adaptive_video_info_vehicle* pInfo, u32 uTimeNowMs);
+void adaptive_video_trace_stop_recording();
+int adaptive_video_trace_is_recording();
+
+int adaptive_video_trace_load(const char* szFile, t_adaptive_video_trace* pTrace);
+int adaptive_video_trace_save(const char* szFile, const t_adaptive_video_trace* pTrace);
+void adaptive_video_trace_free(t_adaptive_video_trace* pTrace);
+
+// Levels for a typical 12 data + 6 EC user profile at 8 Mbps, with 8 + 4 MQ and 4 + 2 LQ profiles, for synthetic traces
+void adaptive_video_trace_get_default_levels(t_adaptive_video_levels* pLevels);
+
+int adaptive_video_trace_generate(t_adaptive_video_trace* pTrace, const t_adaptive_video_levels* pLevels, const t_adaptive_video_channel* pChannel, int iDurationMs, u32 uSeed);
+
+// Packet loss of the link in a trace interval: 1 when nothing got through, -1 when there was no video
+float adaptive_video_trace_get_interval_loss(const t_adaptive_video_trace_record* pRecord);
+
+// iAdjustmentStrength: -1 to use the one from the trace
+void adaptive_video_trace_replay(const t_adaptive_video_trace* pTrace, int iController, int iAdjustmentStrength, u32 uSeed, t_adaptive_video_replay_score* pScore);
+
+#ifdef __cplusplus
+}  /* end extern "C" */
+#endif
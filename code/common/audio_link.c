@@ -0,0 +1,532 @@
+/*
+You can use this C/C++ code however you wish (for example, but not limited to:
+     as is, or by modifying it, or by adding new code, or by removing parts of the code;
+     in public or private projects, in new free or commercial products)
+     only if you get a priori written consent from Petru Soroaga (petrusoroaga@yahoo.com) for your specific use
+     and only if this copyright terms are preserved in the code.
+     This code is public for learning and academic purposes.
+Also, check the licences folder for additional licences terms.
+Code written by: Petru Soroaga, 2021-2023
+*/
+
+#include "../base/base.h"
+#include "../radio/fec.h"
+#include "audio_link.h"
+
+static void _audio_link_clamp_scheme(int* piDataPackets, int* piFECPackets)
+{
+   if ( *piDataPackets < 1 )
+      *piDataPackets = 1;
+   if ( *piDataPackets > AUDIO_MAX_DATA_PACKETS )
+      *piDataPackets = AUDIO_MAX_DATA_PACKETS;
+   if ( *piFECPackets < 0 )
+      *piFECPackets = 0;
+   if ( *piFECPackets > AUDIO_MAX_FEC_PACKETS )
+      *piFECPackets = AUDIO_MAX_FEC_PACKETS;
+   if ( *piDataPackets + *piFECPackets > MAX_AUDIO_PACKETS )
+      *piFECPackets = MAX_AUDIO_PACKETS - *piDataPackets;
+}
+
+void audio_tx_buffer_init(t_audio_tx_buffer* pBuffer)
+{
+   if ( NULL == pBuffer )
+      return;
+   memset(pBuffer, 0, sizeof(t_audio_tx_buffer));
+}
+
+static void _audio_tx_buffer_segment_full(t_audio_tx_buffer* pBuffer)
+{
+   pBuffer->iWritePos = 0;
+   pBuffer->uWriteCounter++;
+
+   // The slot being filled must stay free: drop the oldest segment
+   if ( pBuffer->uWriteCounter - pBuffer->uReadCounter >= MAX_AUDIO_PACKETS )
+   {
+      pBuffer->uReadCounter++;
+      pBuffer->uSegmentsDropped++;
+   }
+}
+
+int audio_tx_buffer_read(t_audio_tx_buffer* pBuffer, int fd)
+{
+   if ( NULL == pBuffer || fd < 0 )
+      return 0;
+
+   int iTotalRead = 0;
+   for( int i=0; i<MAX_AUDIO_PACKETS; i++ )
+   {
+      int iSpace = AUDIO_SEGMENT_SIZE - pBuffer->iWritePos;
+      u8* pDest = &(pBuffer->uSegments[pBuffer->uWriteCounter % MAX_AUDIO_PACKETS][pBuffer->iWritePos]);
+      int iCount = read(fd, pDest, iSpace);
+      if ( iCount < 0 )
+      {
+         if ( errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR )
+            break;
+         return -1;
+      }
+      if ( 0 == iCount )
+         break;
+
+      iTotalRead += iCount;
+      pBuffer->uBytesIn += iCount;
+      pBuffer->iWritePos += iCount;
+      if ( pBuffer->iWritePos >= AUDIO_SEGMENT_SIZE )
+         _audio_tx_buffer_segment_full(pBuffer);
+
+      // Short read: the pipe is empty
+      if ( iCount < iSpace )
+         break;
+   }
+   return iTotalRead;
+}
+
+void audio_tx_buffer_add_data(t_audio_tx_buffer* pBuffer, const u8* pData, int iLength)
+{
+   if ( NULL == pBuffer || NULL == pData )
+      return;
+
+   pBuffer->uBytesIn += iLength;
+   while ( iLength > 0 )
+   {
+      int iCount = AUDIO_SEGMENT_SIZE - pBuffer->iWritePos;
+      if ( iCount > iLength )
+         iCount = iLength;
+      memcpy(&(pBuffer->uSegments[pBuffer->uWriteCounter % MAX_AUDIO_PACKETS][pBuffer->iWritePos]), pData, iCount);
+      pData += iCount;
+      iLength -= iCount;
+      pBuffer->iWritePos += iCount;
+      if ( pBuffer->iWritePos >= AUDIO_SEGMENT_SIZE )
+         _audio_tx_buffer_segment_full(pBuffer);
+   }
+}
+
+int audio_tx_buffer_get_ready_segments(t_audio_tx_buffer* pBuffer)
+{
+   if ( NULL == pBuffer )
+      return 0;
+   return (int)(pBuffer->uWriteCounter - pBuffer->uReadCounter);
+}
+
+int audio_tx_buffer_send_block(t_audio_tx_buffer* pBuffer, int iDataPackets, int iFECPackets, audio_tx_send_segment pfSend, void* pContext)
+{
+   if ( NULL == pBuffer || NULL == pfSend )
+      return 0;
+
+   _audio_link_clamp_scheme(&iDataPackets, &iFECPackets);
+   if ( audio_tx_buffer_get_ready_segments(pBuffer) < iDataPackets )
+      return 0;
+
+   // FEC is computed straight from the ring slots
+   u8* pDataSegments[AUDIO_MAX_DATA_PACKETS];
+   u8* pFECSegments[AUDIO_MAX_FEC_PACKETS];
+   for( int i=0; i<iDataPackets; i++ )
+      pDataSegments[i] = &(pBuffer->uSegments[(pBuffer->uReadCounter+i) % MAX_AUDIO_PACKETS][0]);
+   for( int i=0; i<iFECPackets; i++ )
+      pFECSegments[i] = &(pBuffer->uFECSegments[i][0]);
+
+   if ( iFECPackets > 0 )
+      fec_encode(AUDIO_SEGMENT_SIZE, pDataSegments, (unsigned int)iDataPackets, pFECSegments, (unsigned int)iFECPackets);
+
+   u32 uBlockIndex = (pBuffer->uNextBlockIndex & 0xFFFFFF) << 8;
+   for( int i=0; i<iDataPackets; i++ )
+      pfSend(uBlockIndex | (u32)i, pDataSegments[i], AUDIO_SEGMENT_SIZE, pContext);
+   for( int i=0; i<iFECPackets; i++ )
+      pfSend(uBlockIndex | (u32)(iDataPackets+i), pFECSegments[i], AUDIO_SEGMENT_SIZE, pContext);
+
+   pBuffer->uReadCounter += iDataPackets;
+   pBuffer->uNextBlockIndex++;
+   return iDataPackets;
+}
+
+
+u32 audio_rx_buffer_get_frame_micros(t_audio_rx_buffer* pBuffer)
+{
+   if ( NULL == pBuffer || 0 == pBuffer->uBytesPerSecond )
+      return 1;
+   return (u32)(((unsigned long long)AUDIO_SEGMENT_SIZE) * 1000000LL / pBuffer->uBytesPerSecond);
+}
+
+static void _audio_rx_buffer_reset_stream(t_audio_rx_buffer* pBuffer)
+{
+   for( int i=0; i<AUDIO_RX_MAX_BLOCKS; i++ )
+      pBuffer->blocks[i].uBlockIndex = MAX_U32;
+   for( int i=0; i<AUDIO_JITTER_MAX_FRAMES; i++ )
+      pBuffer->frames[i].uSequence = MAX_U32;
+   pBuffer->iHasFrames = 0;
+   pBuffer->iPlaying = 0;
+   pBuffer->iHasTransit = 0;
+   pBuffer->uLastDelay = 0;
+   pBuffer->stats.uPeakDelayMicros = 0;
+   pBuffer->iLastFrameLength = 0;
+   pBuffer->iConcealedFrames = 0;
+}
+
+void audio_rx_buffer_init(t_audio_rx_buffer* pBuffer, int iDataPackets, int iFECPackets)
+{
+   if ( NULL == pBuffer )
+      return;
+   memset(pBuffer, 0, sizeof(t_audio_rx_buffer));
+   _audio_link_clamp_scheme(&iDataPackets, &iFECPackets);
+   pBuffer->iDataPackets = iDataPackets;
+   pBuffer->iFECPackets = iFECPackets;
+   pBuffer->uBytesPerSecond = AUDIO_DEFAULT_BYTES_PER_SECOND;
+   _audio_rx_buffer_reset_stream(pBuffer);
+   pBuffer->stats.uTargetDepthMicros = AUDIO_JITTER_MIN_DEPTH_MICROS;
+}
+
+static u32 _audio_rx_buffer_get_target_depth(t_audio_rx_buffer* pBuffer)
+{
+   u32 uDepth = pBuffer->stats.uPeakDelayMicros + audio_rx_buffer_get_frame_micros(pBuffer) + pBuffer->uExtraDepthMicros;
+   if ( uDepth < AUDIO_JITTER_MIN_DEPTH_MICROS )
+      uDepth = AUDIO_JITTER_MIN_DEPTH_MICROS;
+   if ( uDepth > AUDIO_JITTER_MAX_DEPTH_MICROS )
+      uDepth = AUDIO_JITTER_MAX_DEPTH_MICROS;
+   pBuffer->stats.uTargetDepthMicros = uDepth;
+   return uDepth;
+}
+
+// The station does not know the capture format, but the capture stream starts with a WAV header
+static int _audio_rx_buffer_check_wav_header(t_audio_rx_buffer* pBuffer, u8* pData, int iLength)
+{
+   if ( iLength < 44 )
+      return 0;
+   if ( 0 != memcmp(pData, "RIFF", 4) || 0 != memcmp(pData+8, "WAVE", 4) || 0 != memcmp(pData+12, "fmt ", 4) )
+      return 0;
+   u32 uBytesPerSecond = 0;
+   memcpy((u8*)&uBytesPerSecond, pData+28, sizeof(u32));
+   if ( uBytesPerSecond >= 1000 && uBytesPerSecond <= 2000000 && uBytesPerSecond != pBuffer->uBytesPerSecond )
+   {
+      log_line("[AudioRx] Audio stream format: %u bytes/sec", uBytesPerSecond);
+      pBuffer->uBytesPerSecond = uBytesPerSecond;
+      pBuffer->iHasTransit = 0;
+   }
+   return 1;
+}
+
+static void _audio_rx_buffer_update_transit(t_audio_rx_buffer* pBuffer, u32 uSequence, u32 uTimeNowMicros)
+{
+   u32 uFrameMicros = audio_rx_buffer_get_frame_micros(pBuffer);
+   u32 uTransit = uTimeNowMicros - (u32)((unsigned long long)uSequence * (unsigned long long)uFrameMicros);
+
+   if ( (! pBuffer->iHasTransit) || ((int)(uTransit - pBuffer->uMinTransit) < 0) )
+   {
+      pBuffer->uMinTransit = uTransit;
+      pBuffer->iHasTransit = 1;
+   }
+   u32 uDelay = uTransit - pBuffer->uMinTransit;
+
+   // Let the lowest transit creep up, to follow the clock drift between vehicle and station
+   pBuffer->uMinTransit += uFrameMicros/256;
+
+   int iDiff = (int)uDelay - (int)pBuffer->uLastDelay;
+   if ( iDiff < 0 )
+      iDiff = -iDiff;
+   pBuffer->stats.uJitterMicros = pBuffer->stats.uJitterMicros + (iDiff - (int)pBuffer->stats.uJitterMicros)/16;
+   pBuffer->uLastDelay = uDelay;
+
+   if ( uDelay > pBuffer->stats.uPeakDelayMicros )
+      pBuffer->stats.uPeakDelayMicros = uDelay;
+   else
+      pBuffer->stats.uPeakDelayMicros -= pBuffer->stats.uPeakDelayMicros/512;
+}
+
+static void _audio_rx_buffer_push_frame(t_audio_rx_buffer* pBuffer, u32 uSequence, u8* pData, int iLength, u32 uTimeNowMicros)
+{
+   pBuffer->stats.uFramesIn++;
+
+   // Too far from the current position: the vehicle restarted the stream
+   if ( pBuffer->iHasFrames )
+   {
+      u32 uRef = pBuffer->iPlaying?pBuffer->uNextPlaySequence:pBuffer->uMaxSequence;
+      if ( uSequence + AUDIO_JITTER_RESYNC_FRAMES < uRef || uSequence > uRef + AUDIO_JITTER_RESYNC_FRAMES )
+      {
+         log_line("[AudioRx] Audio stream restarted (frame %u, expected around %u)", uSequence, uRef);
+         _audio_rx_buffer_reset_stream(pBuffer);
+         pBuffer->stats.uResyncs++;
+      }
+   }
+
+   if ( pBuffer->iPlaying && uSequence < pBuffer->uNextPlaySequence )
+   {
+      pBuffer->stats.uFramesLate++;
+      return;
+   }
+
+   t_audio_jitter_frame* pFrame = &(pBuffer->frames[uSequence % AUDIO_JITTER_MAX_FRAMES]);
+   if ( pFrame->uSequence == uSequence )
+      return;
+
+   _audio_rx_buffer_check_wav_header(pBuffer, pData, iLength);
+   _audio_rx_buffer_update_transit(pBuffer, uSequence, uTimeNowMicros);
+
+   if ( ! pBuffer->iHasFrames )
+   {
+      pBuffer->iHasFrames = 1;
+      pBuffer->uMaxSequence = uSequence;
+      pBuffer->uNextPlaySequence = uSequence;
+      pBuffer->uNextPlayTimeMicros = uTimeNowMicros + _audio_rx_buffer_get_target_depth(pBuffer);
+   }
+   else if ( (! pBuffer->iPlaying) && uSequence < pBuffer->uNextPlaySequence )
+      pBuffer->uNextPlaySequence = uSequence;
+
+   if ( uSequence > pBuffer->uMaxSequence )
+      pBuffer->uMaxSequence = uSequence;
+
+   // Way ahead of the playout position (longer than the buffer can hold): skip forward
+   if ( uSequence >= pBuffer->uNextPlaySequence + AUDIO_JITTER_MAX_FRAMES )
+   {
+      u32 uNewSequence = uSequence - AUDIO_JITTER_MAX_FRAMES + 1;
+      pBuffer->stats.uFramesSkipped += uNewSequence - pBuffer->uNextPlaySequence;
+      pBuffer->uNextPlaySequence = uNewSequence;
+   }
+
+   pFrame->uSequence = uSequence;
+   pFrame->iLength = iLength;
+   memcpy(pFrame->uData, pData, iLength);
+}
+
+static t_audio_rx_block* _audio_rx_buffer_get_block(t_audio_rx_buffer* pBuffer, u32 uBlockIndex)
+{
+   t_audio_rx_block* pFree = NULL;
+   t_audio_rx_block* pOldest = NULL;
+   for( int i=0; i<AUDIO_RX_MAX_BLOCKS; i++ )
+   {
+      t_audio_rx_block* pBlock = &(pBuffer->blocks[i]);
+      if ( pBlock->uBlockIndex == uBlockIndex )
+         return pBlock;
+      if ( MAX_U32 == pBlock->uBlockIndex )
+      {
+         if ( NULL == pFree )
+            pFree = pBlock;
+      }
+      else if ( NULL == pOldest || pBlock->uBlockIndex < pOldest->uBlockIndex )
+         pOldest = pBlock;
+   }
+
+   if ( NULL == pFree )
+   {
+      // Older than all the blocks in progress: its data segments go straight to the jitter buffer
+      if ( uBlockIndex < pOldest->uBlockIndex )
+         return NULL;
+      pFree = pOldest;
+   }
+   pFree->uBlockIndex = uBlockIndex;
+   memset(pFree->uReceived, 0, sizeof(pFree->uReceived));
+   pFree->iDataReceived = 0;
+   pFree->iFECReceived = 0;
+   pFree->iSegmentLength = 0;
+   pFree->iDone = 0;
+   return pFree;
+}
+
+static void _audio_rx_buffer_reconstruct_block(t_audio_rx_buffer* pBuffer, t_audio_rx_block* pBlock, u32 uTimeNowMicros)
+{
+   u8* pDataSegments[MAX_AUDIO_PACKETS];
+   u8* pFECSegments[MAX_AUDIO_PACKETS];
+   unsigned int uFECIndexes[MAX_AUDIO_PACKETS];
+   unsigned int uMissingIndexes[MAX_AUDIO_PACKETS];
+   int iMissing = 0;
+
+   for( int i=0; i<pBuffer->iDataPackets; i++ )
+   {
+      pDataSegments[i] = &(pBlock->uSegments[i][0]);
+      if ( ! pBlock->uReceived[i] )
+         uMissingIndexes[iMissing++] = (unsigned int)i;
+   }
+
+   int iFEC = 0;
+   for( int i=0; i<pBuffer->iFECPackets && iFEC < iMissing; i++ )
+   {
+      if ( ! pBlock->uReceived[pBuffer->iDataPackets+i] )
+         continue;
+      pFECSegments[iFEC] = &(pBlock->uSegments[pBuffer->iDataPackets+i][0]);
+      uFECIndexes[iFEC] = (unsigned int)i;
+      iFEC++;
+   }
+
+   fec_decode((unsigned int)pBlock->iSegmentLength, pDataSegments, (unsigned int)pBuffer->iDataPackets, pFECSegments, uFECIndexes, uMissingIndexes, (unsigned short)iMissing);
+
+   u32 uFirstSequence = pBlock->uBlockIndex * (u32)pBuffer->iDataPackets;
+   for( int i=0; i<iMissing; i++ )
+   {
+      pBuffer->stats.uFramesRecovered++;
+      _audio_rx_buffer_push_frame(pBuffer, uFirstSequence + uMissingIndexes[i], pDataSegments[uMissingIndexes[i]], pBlock->iSegmentLength, uTimeNowMicros);
+   }
+}
+
+void audio_rx_buffer_add_segment(t_audio_rx_buffer* pBuffer, u32 uSegmentIndex, u8* pData, int iLength, u32 uTimeNowMicros)
+{
+   if ( NULL == pBuffer || NULL == pData || iLength <= 0 )
+      return;
+   if ( iLength > AUDIO_SEGMENT_SIZE )
+      iLength = AUDIO_SEGMENT_SIZE;
+
+   u32 uBlockIndex = uSegmentIndex >> 8;
+   int iIndex = (int)(uSegmentIndex & 0xFF);
+   if ( iIndex >= pBuffer->iDataPackets + pBuffer->iFECPackets )
+      return;
+
+   pBuffer->stats.uSegmentsIn++;
+   t_audio_rx_block* pBlock = _audio_rx_buffer_get_block(pBuffer, uBlockIndex);
+   if ( NULL != pBlock )
+   {
+      if ( pBlock->uReceived[iIndex] )
+      {
+         pBuffer->stats.uSegmentsDuplicate++;
+         return;
+      }
+      pBlock->uReceived[iIndex] = 1;
+      if ( 0 == pBlock->iSegmentLength )
+         pBlock->iSegmentLength = iLength;
+      memcpy(&(pBlock->uSegments[iIndex][0]), pData, iLength);
+      if ( iLength < pBlock->iSegmentLength )
+         memset(&(pBlock->uSegments[iIndex][iLength]), 0, pBlock->iSegmentLength - iLength);
+      if ( iIndex < pBuffer->iDataPackets )
+         pBlock->iDataReceived++;
+      else
+         pBlock->iFECReceived++;
+   }
+
+   // Data segments are played as soon as they are in, not when the block is complete
+   if ( iIndex < pBuffer->iDataPackets )
+      _audio_rx_buffer_push_frame(pBuffer, uBlockIndex * (u32)pBuffer->iDataPackets + (u32)iIndex, pData, iLength, uTimeNowMicros);
+
+   if ( NULL == pBlock || pBlock->iDone )
+      return;
+   if ( pBlock->iDataReceived >= pBuffer->iDataPackets )
+   {
+      pBlock->iDone = 1;
+      return;
+   }
+   if ( pBlock->iDataReceived + pBlock->iFECReceived >= pBuffer->iDataPackets )
+   {
+      _audio_rx_buffer_reconstruct_block(pBuffer, pBlock, uTimeNowMicros);
+      pBlock->iDone = 1;
+   }
+}
+
+// Repeats the last played frame, fading it out, then silence (16 bits little endian samples)
+static int _audio_rx_buffer_conceal(t_audio_rx_buffer* pBuffer, u8* pOutput)
+{
+   int iLength = pBuffer->iLastFrameLength;
+   if ( iLength <= 0 )
+      iLength = AUDIO_SEGMENT_SIZE;
+   pBuffer->iConcealedFrames++;
+
+   if ( pBuffer->iLastFrameLength <= 0 || pBuffer->iConcealedFrames > AUDIO_CONCEAL_MAX_FRAMES )
+   {
+      memset(pOutput, 0, iLength);
+      return iLength;
+   }
+
+   int iShift = pBuffer->iConcealedFrames;
+   for( int i=0; i+1<iLength; i+=2 )
+   {
+      short sample = (short)(pBuffer->uLastFrame[i] | (pBuffer->uLastFrame[i+1] << 8));
+      sample = sample >> iShift;
+      pOutput[i] = (u8)(sample & 0xFF);
+      pOutput[i+1] = (u8)((sample >> 8) & 0xFF);
+   }
+   if ( iLength & 1 )
+      pOutput[iLength-1] = 0;
+   return iLength;
+}
+
+static int _audio_rx_buffer_play_frame(t_audio_rx_buffer* pBuffer, t_audio_jitter_frame* pFrame, u8* pOutput)
+{
+   int iLength = pFrame->iLength;
+   memcpy(pOutput, pFrame->uData, iLength);
+
+   // The WAV header frame is not a good source for concealment
+   if ( (iLength >= 4) && (0 == memcmp(pFrame->uData, "RIFF", 4)) )
+      pBuffer->iLastFrameLength = 0;
+   else
+   {
+      memcpy(pBuffer->uLastFrame, pFrame->uData, iLength);
+      pBuffer->iLastFrameLength = iLength;
+   }
+   pBuffer->iConcealedFrames = 0;
+   pFrame->uSequence = MAX_U32;
+   pBuffer->stats.uFramesPlayed++;
+   return iLength;
+}
+
+int audio_rx_buffer_get_frame(t_audio_rx_buffer* pBuffer, u32 uTimeNowMicros, u8* pOutput)
+{
+   if ( NULL == pBuffer || NULL == pOutput || (! pBuffer->iHasFrames) )
+      return 0;
+   if ( (int)(uTimeNowMicros - pBuffer->uNextPlayTimeMicros) < 0 )
+      return 0;
+
+   u32 uFrameMicros = audio_rx_buffer_get_frame_micros(pBuffer);
+   u32 uTargetDepth = _audio_rx_buffer_get_target_depth(pBuffer);
+
+   pBuffer->iPlaying = 1;
+
+   // The caller was busy for longer than the buffer can hold: restart the playout clock
+   if ( uTimeNowMicros - pBuffer->uNextPlayTimeMicros > AUDIO_JITTER_MAX_DEPTH_MICROS )
+      pBuffer->uNextPlayTimeMicros = uTimeNowMicros;
+
+   if ( pBuffer->uExtraDepthMicros > 0 )
+   if ( uTimeNowMicros - pBuffer->uTimeLastUnderrun > 5000000 )
+   {
+      pBuffer->uExtraDepthMicros = (pBuffer->uExtraDepthMicros > uFrameMicros)?(pBuffer->uExtraDepthMicros - uFrameMicros):0;
+      pBuffer->uTimeLastUnderrun = uTimeNowMicros;
+   }
+
+   // How long after its earliest possible arrival the next frame is played
+   u32 uEarliest = pBuffer->uMinTransit + (u32)((unsigned long long)pBuffer->uNextPlaySequence * (unsigned long long)uFrameMicros);
+   int iSlack = (int)(pBuffer->uNextPlayTimeMicros - uEarliest);
+
+   pBuffer->uNextPlayTimeMicros += uFrameMicros;
+
+   t_audio_jitter_frame* pFrame = &(pBuffer->frames[pBuffer->uNextPlaySequence % AUDIO_JITTER_MAX_FRAMES]);
+   if ( pFrame->uSequence == pBuffer->uNextPlaySequence )
+   {
+      // Buffer deeper than needed and the next frame is in too: drop this one
+      t_audio_jitter_frame* pNextFrame = &(pBuffer->frames[(pBuffer->uNextPlaySequence+1) % AUDIO_JITTER_MAX_FRAMES]);
+      if ( pBuffer->iHasTransit && (iSlack > (int)(uTargetDepth + 2*uFrameMicros)) && pNextFrame->uSequence == pBuffer->uNextPlaySequence+1 )
+      {
+         pFrame->uSequence = MAX_U32;
+         pBuffer->stats.uFramesSkipped++;
+         pBuffer->uNextPlaySequence++;
+         pFrame = pNextFrame;
+      }
+      // Buffer too shallow: play a concealment frame and keep this one for later
+      else if ( pBuffer->iHasTransit && (iSlack < (int)uTargetDepth - (int)(2*uFrameMicros)) && pBuffer->iLastFrameLength > 0 && pBuffer->iConcealedFrames < 1 )
+      {
+         pBuffer->stats.uFramesInserted++;
+         return _audio_rx_buffer_conceal(pBuffer, pOutput);
+      }
+      pBuffer->uNextPlaySequence++;
+      return _audio_rx_buffer_play_frame(pBuffer, pFrame, pOutput);
+   }
+
+   // Lost: later frames are in already
+   if ( pBuffer->uMaxSequence > pBuffer->uNextPlaySequence )
+   {
+      pBuffer->stats.uFramesConcealedLost++;
+      pBuffer->uNextPlaySequence++;
+      return _audio_rx_buffer_conceal(pBuffer, pOutput);
+   }
+
+   // Empty: keep waiting for this frame and raise the buffer depth
+   if ( 0 == pBuffer->iConcealedFrames )
+   {
+      pBuffer->stats.uUnderruns++;
+      pBuffer->uExtraDepthMicros += uFrameMicros;
+      if ( pBuffer->uExtraDepthMicros > AUDIO_JITTER_MAX_DEPTH_MICROS/2 )
+         pBuffer->uExtraDepthMicros = AUDIO_JITTER_MAX_DEPTH_MICROS/2;
+      pBuffer->uTimeLastUnderrun = uTimeNowMicros;
+   }
+   pBuffer->stats.uFramesConcealedEmpty++;
+
+   // The stream stopped: wait for it to start again, and buffer again then
+   if ( (u32)pBuffer->iConcealedFrames * uFrameMicros > AUDIO_JITTER_MAX_DEPTH_MICROS )
+   {
+      pBuffer->iHasFrames = 0;
+      pBuffer->iPlaying = 0;
+      return 0;
+   }
+   return _audio_rx_buffer_conceal(pBuffer, pOutput);
+}
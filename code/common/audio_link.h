@@ -0,0 +1,132 @@
+#pragma once
+#include "../base/base.h"
+#include "../base/config.h"
+#include "../radio/radiopackets2.h"
+
+// Audio link buffers, used by the vehicle audio TX and the station audio RX.
+// Vehicle: the captured audio is read straight into a ring of segments (one radio packet each);
+// full segments are FEC encoded and sent in blocks, in place, with no copies or shifts of the ring.
+// Station: received segments are grouped by block and FEC decoded as soon as enough segments are in,
+// then go into a jitter buffer that plays them out at the audio rate. The jitter buffer depth follows
+// the measured arrival jitter; frames still missing at their playout time are concealed.
+// Segment index on the radio link: block index << 8 | index in block (data segments first, then FEC).
+// Frames are numbered on the station as block index * data segments per block + index in block.
+
+#define AUDIO_SEGMENT_SIZE (MAX_PACKET_PAYLOAD-4) // the segment index comes first in the packet
+#define AUDIO_MAX_DATA_PACKETS 16
+#define AUDIO_MAX_FEC_PACKETS 10
+#define AUDIO_DEFAULT_BYTES_PER_SECOND 88200 // 44100 Hz, mono, 16 bits, as captured on the vehicle
+
+#define AUDIO_RX_MAX_BLOCKS 4
+#define AUDIO_JITTER_MAX_FRAMES 64
+#define AUDIO_JITTER_MIN_DEPTH_MICROS 20000
+#define AUDIO_JITTER_MAX_DEPTH_MICROS 400000
+#define AUDIO_JITTER_RESYNC_FRAMES 500 // frames this far from the playout position restart the stream
+#define AUDIO_CONCEAL_MAX_FRAMES 4 // consecutive concealed frames faded out, then silence
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct
+{
+   u8 uSegments[MAX_AUDIO_PACKETS][AUDIO_SEGMENT_SIZE];
+   u32 uReadCounter; // next full segment to send
+   u32 uWriteCounter; // segment being filled
+   int iWritePos;
+   u32 uNextBlockIndex;
+   u8 uFECSegments[AUDIO_MAX_FEC_PACKETS][AUDIO_SEGMENT_SIZE];
+   u32 uBytesIn;
+   u32 uSegmentsDropped; // ring full, oldest segments dropped
+} t_audio_tx_buffer;
+
+typedef void (*audio_tx_send_segment)(u32 uSegmentIndex, u8* pData, int iLength, void* pContext);
+
+void audio_tx_buffer_init(t_audio_tx_buffer* pBuffer);
+// Reads everything available on a non blocking fd straight into the ring. Returns the bytes read, -1 on error
+int audio_tx_buffer_read(t_audio_tx_buffer* pBuffer, int fd);
+void audio_tx_buffer_add_data(t_audio_tx_buffer* pBuffer, const u8* pData, int iLength);
+int audio_tx_buffer_get_ready_segments(t_audio_tx_buffer* pBuffer);
+// Sends the next block (data segments, then FEC segments) if enough segments are captured.
+// Returns the count of data segments sent.
+int audio_tx_buffer_send_block(t_audio_tx_buffer* pBuffer, int iDataPackets, int iFECPackets, audio_tx_send_segment pfSend, void* pContext);
+
+
+typedef struct
+{
+   u32 uBlockIndex; // MAX_U32 for a free slot
+   u8 uReceived[MAX_AUDIO_PACKETS];
+   int iDataReceived;
+   int iFECReceived;
+   int iSegmentLength;
+   int iDone; // all data segments are known and were pushed to the jitter buffer
+   u8 uSegments[MAX_AUDIO_PACKETS][AUDIO_SEGMENT_SIZE];
+} t_audio_rx_block;
+
+typedef struct
+{
+   u32 uSequence; // MAX_U32 for a free slot
+   int iLength;
+   u8 uData[AUDIO_SEGMENT_SIZE];
+} t_audio_jitter_frame;
+
+typedef struct
+{
+   u32 uSegmentsIn;
+   u32 uSegmentsDuplicate;
+   u32 uFramesIn;
+   u32 uFramesRecovered; // rebuilt by FEC
+   u32 uFramesLate; // arrived after their playout time
+   u32 uFramesPlayed;
+   u32 uFramesConcealedLost; // missing while later frames were in
+   u32 uFramesConcealedEmpty; // the buffer was empty
+   u32 uFramesInserted; // concealed to grow the buffer depth
+   u32 uFramesSkipped; // dropped to shrink the buffer depth
+   u32 uUnderruns; // times the buffer went empty while playing
+   u32 uResyncs;
+   u32 uJitterMicros; // RFC 3550 style, on the frame transit times
+   u32 uPeakDelayMicros;
+   u32 uTargetDepthMicros;
+} t_audio_rx_stats;
+
+typedef struct
+{
+   int iDataPackets;
+   int iFECPackets;
+   u32 uBytesPerSecond;
+
+   t_audio_rx_block blocks[AUDIO_RX_MAX_BLOCKS];
+   t_audio_jitter_frame frames[AUDIO_JITTER_MAX_FRAMES]; // slot: sequence % AUDIO_JITTER_MAX_FRAMES
+
+   int iHasFrames;
+   u32 uMaxSequence;
+   int iPlaying;
+   u32 uNextPlaySequence;
+   u32 uNextPlayTimeMicros;
+
+   // Transit of a frame: its arrival time minus its place in the stream.
+   // The lowest transit seen is the earliest a frame can be played; the delay of a frame is its
+   // transit over the lowest one, and the peak delay (slowly decaying) sets the buffer depth.
+   int iHasTransit;
+   u32 uMinTransit;
+   u32 uLastDelay;
+   u32 uExtraDepthMicros; // added after underruns, removed over time
+   u32 uTimeLastUnderrun;
+
+   u8 uLastFrame[AUDIO_SEGMENT_SIZE];
+   int iLastFrameLength;
+   int iConcealedFrames;
+
+   t_audio_rx_stats stats;
+} t_audio_rx_buffer;
+
+void audio_rx_buffer_init(t_audio_rx_buffer* pBuffer, int iDataPackets, int iFECPackets);
+void audio_rx_buffer_add_segment(t_audio_rx_buffer* pBuffer, u32 uSegmentIndex, u8* pData, int iLength, u32 uTimeNowMicros);
+// Returns the length of the frame (received or concealed) due for playout at uTimeNowMicros, copied to pOutput, 0 if none.
+// Call it until it returns 0.
+int audio_rx_buffer_get_frame(t_audio_rx_buffer* pBuffer, u32 uTimeNowMicros, u8* pOutput);
+u32 audio_rx_buffer_get_frame_micros(t_audio_rx_buffer* pBuffer);
+
+#ifdef __cplusplus
+}  /* end extern "C" */
+#endif
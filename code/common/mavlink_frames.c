@@ -0,0 +1,322 @@
+/*
+You can use this C/C++ code however you wish (for example, but not limited to:
+     as is, or by modifying it, or by adding new code, or by removing parts of the code;
+     in public or private projects, in new free or commercial products) 
+     only if you get a priori written consent from Petru Soroaga (petrusoroaga@yahoo.com) for your specific use
+     and only if this copyright terms are preserved in the code.
+     This code is public for learning and academic purposes.
+Also, check the licences folder for additional licences terms.
+Code written by: Petru Soroaga, 2021-2023
+*/
+
+#include "../base/base.h"
+#include "mavlink_frames.h"
+
+#define MAVLINK_FRAMES_HEADER_V1 6
+#define MAVLINK_FRAMES_HEADER_V2 10
+
+static u16 s_uMAVLinkFramesCRCTable[256];
+static int s_iMAVLinkFramesCRCTableInitialized = 0;
+
+// Table driven X.25 CRC, same result as crc_accumulate() byte by byte
+static void _mavlink_frames_init_crc_table()
+{
+   for( int i=0; i<256; i++ )
+   {
+      u16 uCRC = 0;
+      crc_accumulate((u8)i, &uCRC);
+      s_uMAVLinkFramesCRCTable[i] = uCRC;
+   }
+   s_iMAVLinkFramesCRCTableInitialized = 1;
+}
+
+static inline u16 _mavlink_frames_crc(u16 uCRC, const u8* pData, int iLength)
+{
+   while ( iLength-- > 0 )
+      uCRC = (uCRC >> 8) ^ s_uMAVLinkFramesCRCTable[(uCRC ^ (*pData++)) & 0xFF];
+   return uCRC;
+}
+
+void mavlink_frames_init(t_mavlink_frame_extractor* pExtractor)
+{
+   if ( NULL == pExtractor )
+      return;
+   memset((u8*)pExtractor, 0, sizeof(t_mavlink_frame_extractor));
+   if ( ! s_iMAVLinkFramesCRCTableInitialized )
+      _mavlink_frames_init_crc_table();
+}
+
+void mavlink_frames_reset_stats(t_mavlink_frame_extractor* pExtractor)
+{
+   if ( NULL == pExtractor )
+      return;
+   pExtractor->uTotalBytes = 0;
+   pExtractor->uFramesOk = 0;
+   pExtractor->uFramesDispatched = 0;
+   pExtractor->uFramesFiltered = 0;
+   pExtractor->uFramesBadCRC = 0;
+   pExtractor->uFramesUnknownId = 0;
+   pExtractor->uBytesDiscarded = 0;
+}
+
+int mavlink_frames_set_handler(t_mavlink_frame_extractor* pExtractor, u32 uMsgId, mavlink_frame_handler pHandler)
+{
+   if ( NULL == pExtractor )
+      return 0;
+   if ( uMsgId < MAVLINK_FRAMES_MAX_DIRECT_ID )
+   {
+      pExtractor->pHandlers[uMsgId] = pHandler;
+      return 1;
+   }
+   for( int i=0; i<pExtractor->iExtendedHandlersCount; i++ )
+   {
+      if ( pExtractor->uExtendedMsgIds[i] == uMsgId )
+      {
+         pExtractor->pExtendedHandlers[i] = pHandler;
+         return 1;
+      }
+   }
+   if ( pExtractor->iExtendedHandlersCount >= MAVLINK_FRAMES_MAX_EXTENDED_HANDLERS )
+   {
+      log_softerror_and_alarm("[MAVLinkFrames] No more room for handler for message id %u", uMsgId);
+      return 0;
+   }
+   pExtractor->uExtendedMsgIds[pExtractor->iExtendedHandlersCount] = uMsgId;
+   pExtractor->pExtendedHandlers[pExtractor->iExtendedHandlersCount] = pHandler;
+   pExtractor->iExtendedHandlersCount++;
+   return 1;
+}
+
+void mavlink_frames_set_default_handler(t_mavlink_frame_extractor* pExtractor, mavlink_frame_handler pHandler)
+{
+   if ( NULL != pExtractor )
+      pExtractor->pDefaultHandler = pHandler;
+}
+
+static mavlink_frame_handler _mavlink_frames_get_handler(t_mavlink_frame_extractor* pExtractor, u32 uMsgId)
+{
+   mavlink_frame_handler pHandler = NULL;
+   if ( uMsgId < MAVLINK_FRAMES_MAX_DIRECT_ID )
+      pHandler = pExtractor->pHandlers[uMsgId];
+   else
+   {
+      for( int i=0; i<pExtractor->iExtendedHandlersCount; i++ )
+         if ( pExtractor->uExtendedMsgIds[i] == uMsgId )
+         {
+            pHandler = pExtractor->pExtendedHandlers[i];
+            break;
+         }
+   }
+   if ( NULL == pHandler )
+      pHandler = pExtractor->pDefaultHandler;
+   return pHandler;
+}
+
+static const u8* _mavlink_frames_find_stx(const u8* pData, int iLength)
+{
+   const u8* pV2 = (const u8*)memchr(pData, MAVLINK_STX, iLength);
+   int iLimit = (NULL != pV2)?(int)(pV2 - pData):iLength;
+   const u8* pV1 = (const u8*)memchr(pData, MAVLINK_STX_MAVLINK1, iLimit);
+   if ( NULL != pV1 )
+      return pV1;
+   return pV2;
+}
+
+int mavlink_frames_check_frame(const u8* pData, int iLength, u32* pMsgId)
+{
+   int iHeaderLength = 0;
+   u32 uMsgId = 0;
+   int iPayloadLength = 0;
+   int iFrameLength = 0;
+
+   if ( iLength < 2 )
+      return 0;
+   iPayloadLength = pData[1];
+
+   if ( pData[0] == MAVLINK_STX )
+   {
+      iHeaderLength = MAVLINK_FRAMES_HEADER_V2;
+      if ( iLength < iHeaderLength )
+         return 0;
+      if ( pData[2] & (~MAVLINK_IFLAG_SIGNED) )
+         return -1;
+      uMsgId = ((u32)pData[7]) | (((u32)pData[8])<<8) | (((u32)pData[9])<<16);
+      iFrameLength = iHeaderLength + iPayloadLength + MAVLINK_NUM_CHECKSUM_BYTES;
+      if ( pData[2] & MAVLINK_IFLAG_SIGNED )
+         iFrameLength += MAVLINK_SIGNATURE_BLOCK_LEN;
+   }
+   else if ( pData[0] == MAVLINK_STX_MAVLINK1 )
+   {
+      iHeaderLength = MAVLINK_FRAMES_HEADER_V1;
+      if ( iLength < iHeaderLength )
+         return 0;
+      uMsgId = pData[5];
+      iFrameLength = iHeaderLength + iPayloadLength + MAVLINK_NUM_CHECKSUM_BYTES;
+   }
+   else
+      return -1;
+
+   // Unknown ids have no CRC extra, so they can't be validated: reject them before waiting for the rest of the frame
+   const mavlink_msg_entry_t* pEntry = mavlink_get_msg_entry(uMsgId);
+   if ( NULL == pEntry )
+      return -2;
+
+   if ( iLength < iFrameLength )
+      return 0;
+
+   if ( ! s_iMAVLinkFramesCRCTableInitialized )
+      _mavlink_frames_init_crc_table();
+   u16 uCRC = _mavlink_frames_crc(X25_INIT_CRC, pData+1, iHeaderLength + iPayloadLength - 1);
+   uCRC = _mavlink_frames_crc(uCRC, &(pEntry->crc_extra), 1);
+   const u8* pCRC = pData + iHeaderLength + iPayloadLength;
+   if ( pCRC[0] != (uCRC & 0xFF) || pCRC[1] != (uCRC >> 8) )
+      return -3;
+
+   if ( NULL != pMsgId )
+      *pMsgId = uMsgId;
+   return iFrameLength;
+}
+
+// Returns the number of bytes consumed. The unconsumed tail is an incomplete frame.
+
+static int _mavlink_frames_parse_block(t_mavlink_frame_extractor* pExtractor, const u8* pData, int iLength, void* pContext, int* piFrames)
+{
+   int iPos = 0;
+   while ( iPos < iLength )
+   {
+      const u8* pStx = _mavlink_frames_find_stx(pData + iPos, iLength - iPos);
+      if ( NULL == pStx )
+      {
+         pExtractor->uBytesDiscarded += iLength - iPos;
+         return iLength;
+      }
+      int iStart = (int)(pStx - pData);
+      pExtractor->uBytesDiscarded += iStart - iPos;
+      iPos = iStart;
+
+      u32 uMsgId = 0;
+      int iRes = mavlink_frames_check_frame(pData + iPos, iLength - iPos, &uMsgId);
+      if ( 0 == iRes )
+         return iPos;
+      if ( iRes < 0 )
+      {
+         if ( -2 == iRes )
+            pExtractor->uFramesUnknownId++;
+         else if ( -3 == iRes )
+            pExtractor->uFramesBadCRC++;
+         pExtractor->uBytesDiscarded++;
+         iPos++;
+         continue;
+      }
+
+      pExtractor->uFramesOk++;
+      (*piFrames)++;
+      mavlink_frame_handler pHandler = _mavlink_frames_get_handler(pExtractor, uMsgId);
+      if ( NULL != pHandler )
+      {
+         pExtractor->uFramesDispatched++;
+         pHandler(pData + iPos, iRes, uMsgId, pContext);
+      }
+      else
+         pExtractor->uFramesFiltered++;
+      iPos += iRes;
+   }
+   return iPos;
+}
+
+int mavlink_frames_parse(t_mavlink_frame_extractor* pExtractor, const u8* pData, int iLength, void* pContext)
+{
+   if ( NULL == pExtractor || NULL == pData || iLength <= 0 )
+      return 0;
+
+   pExtractor->uTotalBytes += iLength;
+   int iFrames = 0;
+
+   // Resolve the incomplete frame left over from the previous block. A frame is at most
+   // MAVLINK_MAX_PACKET_LEN bytes, so appending that much input always completes or rejects it.
+   if ( pExtractor->iBufferedBytes > 0 )
+   {
+      int iCopy = iLength;
+      if ( iCopy > MAVLINK_MAX_PACKET_LEN )
+         iCopy = MAVLINK_MAX_PACKET_LEN;
+      memcpy(&pExtractor->uBuffer[pExtractor->iBufferedBytes], pData, iCopy);
+      int iTotal = pExtractor->iBufferedBytes + iCopy;
+      int iConsumed = _mavlink_frames_parse_block(pExtractor, pExtractor->uBuffer, iTotal, pContext, &iFrames);
+      if ( iConsumed >= pExtractor->iBufferedBytes )
+      {
+         // Old tail is done, continue in place on the input from where the buffer parsing stopped
+         int iUsedFromInput = iConsumed - pExtractor->iBufferedBytes;
+         pData += iUsedFromInput;
+         iLength -= iUsedFromInput;
+         pExtractor->iBufferedBytes = 0;
+      }
+      else
+      {
+         // Not enough new data yet (iCopy == iLength here)
+         memmove(pExtractor->uBuffer, &pExtractor->uBuffer[iConsumed], iTotal - iConsumed);
+         pExtractor->iBufferedBytes = iTotal - iConsumed;
+         return iFrames;
+      }
+   }
+
+   if ( iLength <= 0 )
+      return iFrames;
+
+   int iConsumed = _mavlink_frames_parse_block(pExtractor, pData, iLength, pContext, &iFrames);
+   int iTail = iLength - iConsumed;
+   if ( iTail > MAVLINK_MAX_PACKET_LEN )
+   {
+      pExtractor->uBytesDiscarded += iTail - MAVLINK_MAX_PACKET_LEN;
+      iConsumed += iTail - MAVLINK_MAX_PACKET_LEN;
+      iTail = MAVLINK_MAX_PACKET_LEN;
+   }
+   if ( iTail > 0 )
+      memcpy(pExtractor->uBuffer, pData + iConsumed, iTail);
+   pExtractor->iBufferedBytes = iTail;
+   return iFrames;
+}
+
+void mavlink_frames_to_message(const u8* pFrame, int iFrameLength, mavlink_message_t* pMessage)
+{
+   if ( NULL == pFrame || NULL == pMessage || iFrameLength < MAVLINK_FRAMES_HEADER_V1 )
+      return;
+
+   int iHeaderLength = 0;
+   pMessage->magic = pFrame[0];
+   pMessage->len = pFrame[1];
+   if ( pFrame[0] == MAVLINK_STX )
+   {
+      iHeaderLength = MAVLINK_FRAMES_HEADER_V2;
+      pMessage->incompat_flags = pFrame[2];
+      pMessage->compat_flags = pFrame[3];
+      pMessage->seq = pFrame[4];
+      pMessage->sysid = pFrame[5];
+      pMessage->compid = pFrame[6];
+      pMessage->msgid = ((u32)pFrame[7]) | (((u32)pFrame[8])<<8) | (((u32)pFrame[9])<<16);
+   }
+   else
+   {
+      iHeaderLength = MAVLINK_FRAMES_HEADER_V1;
+      pMessage->incompat_flags = 0;
+      pMessage->compat_flags = 0;
+      pMessage->seq = pFrame[2];
+      pMessage->sysid = pFrame[3];
+      pMessage->compid = pFrame[4];
+      pMessage->msgid = pFrame[5];
+   }
+
+   u8* pPayload = (u8*)_MAV_PAYLOAD_NON_CONST(pMessage);
+   memcpy(pPayload, pFrame + iHeaderLength, pMessage->len);
+
+   // Zero fill truncated MAVLink 2 payloads, same as mavlink_parse_char does
+   const mavlink_msg_entry_t* pEntry = mavlink_get_msg_entry(pMessage->msgid);
+   if ( NULL != pEntry && pMessage->len < pEntry->msg_len )
+      memset(pPayload + pMessage->len, 0, pEntry->msg_len - pMessage->len);
+
+   const u8* pCRC = pFrame + iHeaderLength + pMessage->len;
+   pMessage->ck[0] = pCRC[0];
+   pMessage->ck[1] = pCRC[1];
+   pMessage->checksum = ((u16)pCRC[0]) | (((u16)pCRC[1])<<8);
+   if ( pMessage->incompat_flags & MAVLINK_IFLAG_SIGNED )
+      memcpy(pMessage->signature, pCRC + MAVLINK_NUM_CHECKSUM_BYTES, MAVLINK_SIGNATURE_BLOCK_LEN);
+}
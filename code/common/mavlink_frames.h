@@ -0,0 +1,56 @@
+#pragma once
+#include "../base/base.h"
+#include "../../mavlink/common/mavlink.h"
+
+// Block oriented MAVLink (v1 and v2) frame extractor.
+// Scans whole buffers for STX, validates length and CRC in one pass and dispatches
+// complete frames by message id through a handler table. Frames with no handler are
+// counted and skipped without being decoded.
+
+#define MAVLINK_FRAMES_BUFFER_SIZE 1024 // must hold two max size frames
+#define MAVLINK_FRAMES_MAX_DIRECT_ID 256
+#define MAVLINK_FRAMES_MAX_EXTENDED_HANDLERS 16
+
+#ifdef __cplusplus
+extern "C" {
+#endif  
+
+typedef void (*mavlink_frame_handler)(const u8* pFrame, int iFrameLength, u32 uMsgId, void* pContext);
+
+typedef struct
+{
+   u8  uBuffer[MAVLINK_FRAMES_BUFFER_SIZE]; // holds the incomplete frame from the previous block
+   int iBufferedBytes;
+
+   mavlink_frame_handler pHandlers[MAVLINK_FRAMES_MAX_DIRECT_ID]; // jump table for message ids < 256
+   u32 uExtendedMsgIds[MAVLINK_FRAMES_MAX_EXTENDED_HANDLERS];
+   mavlink_frame_handler pExtendedHandlers[MAVLINK_FRAMES_MAX_EXTENDED_HANDLERS];
+   int iExtendedHandlersCount;
+   mavlink_frame_handler pDefaultHandler; // if set, receives all valid frames with no specific handler
+
+   u32 uTotalBytes;
+   u32 uFramesOk;
+   u32 uFramesDispatched;
+   u32 uFramesFiltered;
+   u32 uFramesBadCRC;
+   u32 uFramesUnknownId;
+   u32 uBytesDiscarded;
+} t_mavlink_frame_extractor;
+
+void mavlink_frames_init(t_mavlink_frame_extractor* pExtractor);
+void mavlink_frames_reset_stats(t_mavlink_frame_extractor* pExtractor);
+int  mavlink_frames_set_handler(t_mavlink_frame_extractor* pExtractor, u32 uMsgId, mavlink_frame_handler pHandler);
+void mavlink_frames_set_default_handler(t_mavlink_frame_extractor* pExtractor, mavlink_frame_handler pHandler);
+
+// Returns the number of complete valid frames found in this block (dispatched or filtered)
+int  mavlink_frames_parse(t_mavlink_frame_extractor* pExtractor, const u8* pData, int iLength, void* pContext);
+
+// Returns the length of the valid frame starting at pData, 0 if incomplete, -1 if not a valid frame start
+int  mavlink_frames_check_frame(const u8* pData, int iLength, u32* pMsgId);
+
+// Decodes a frame validated by the extractor into a mavlink message, for use with the mavlink_msg_*_decode functions
+void mavlink_frames_to_message(const u8* pFrame, int iFrameLength, mavlink_message_t* pMessage);
+
+#ifdef __cplusplus
+}  
+#endif
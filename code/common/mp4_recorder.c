@@ -0,0 +1,912 @@
+/*
+You can use this C/C++ code however you wish (for example, but not limited to:
+     as is, or by modifying it, or by adding new code, or by removing parts of the code;
+     in public or private projects, in new free or commercial products)
+     only if you get a priori written consent from Petru Soroaga (petrusoroaga@yahoo.com) for your specific use
+     and only if this copyright terms are preserved in the code.
+     This code is public for learning and academic purposes.
+Also, check the licences folder for additional licences terms.
+Code written by: Petru Soroaga, 2021-2023
+*/
+
+#include "../base/base.h"
+#include "mp4_recorder.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#define MP4_NAL_SLICE 1
+#define MP4_NAL_IDR 5
+#define MP4_NAL_SPS 7
+#define MP4_NAL_PPS 8
+#define MP4_NAL_AUD 9
+
+#define MP4_SAMPLE_FLAGS_SYNC 0x02000000 // depends on no other sample
+#define MP4_SAMPLE_FLAGS_NON_SYNC 0x01010000 // depends on others, not a sync sample
+
+//----------------------------------------------------
+// Box writing
+
+typedef struct
+{
+   u8* pBuffer;
+   int iPos;
+   int iStack[8];
+   int iDepth;
+} t_mp4_box_writer;
+
+static void _box_u8(t_mp4_box_writer* pW, u8 uValue)
+{
+   pW->pBuffer[pW->iPos++] = uValue;
+}
+
+static void _box_u16(t_mp4_box_writer* pW, u16 uValue)
+{
+   pW->pBuffer[pW->iPos++] = (uValue >> 8) & 0xFF;
+   pW->pBuffer[pW->iPos++] = uValue & 0xFF;
+}
+
+static void _box_u32(t_mp4_box_writer* pW, u32 uValue)
+{
+   pW->pBuffer[pW->iPos++] = (uValue >> 24) & 0xFF;
+   pW->pBuffer[pW->iPos++] = (uValue >> 16) & 0xFF;
+   pW->pBuffer[pW->iPos++] = (uValue >> 8) & 0xFF;
+   pW->pBuffer[pW->iPos++] = uValue & 0xFF;
+}
+
+static void _box_u64(t_mp4_box_writer* pW, unsigned long long uValue)
+{
+   _box_u32(pW, (u32)(uValue >> 32));
+   _box_u32(pW, (u32)(uValue & 0xFFFFFFFF));
+}
+
+static void _box_bytes(t_mp4_box_writer* pW, const u8* pData, int iLength)
+{
+   memcpy(pW->pBuffer + pW->iPos, pData, iLength);
+   pW->iPos += iLength;
+}
+
+static void _box_zeros(t_mp4_box_writer* pW, int iCount)
+{
+   memset(pW->pBuffer + pW->iPos, 0, iCount);
+   pW->iPos += iCount;
+}
+
+static void _box_start(t_mp4_box_writer* pW, const char* szType)
+{
+   pW->iStack[pW->iDepth++] = pW->iPos;
+   _box_u32(pW, 0);
+   _box_bytes(pW, (const u8*)szType, 4);
+}
+
+static void _box_start_full(t_mp4_box_writer* pW, const char* szType, u8 uVersion, u32 uFlags)
+{
+   _box_start(pW, szType);
+   _box_u32(pW, (((u32)uVersion) << 24) | (uFlags & 0xFFFFFF));
+}
+
+static void _box_end(t_mp4_box_writer* pW)
+{
+   int iStart = pW->iStack[--pW->iDepth];
+   u32 uSize = (u32)(pW->iPos - iStart);
+   pW->pBuffer[iStart] = (uSize >> 24) & 0xFF;
+   pW->pBuffer[iStart+1] = (uSize >> 16) & 0xFF;
+   pW->pBuffer[iStart+2] = (uSize >> 8) & 0xFF;
+   pW->pBuffer[iStart+3] = uSize & 0xFF;
+}
+
+static u32 _read_u32(const u8* pData)
+{
+   return (((u32)pData[0]) << 24) | (((u32)pData[1]) << 16) | (((u32)pData[2]) << 8) | pData[3];
+}
+
+//----------------------------------------------------
+// SPS parsing (only what is needed for the frame size)
+
+typedef struct
+{
+   u8 uData[MP4_RECORDER_MAX_PARAM_SET_SIZE];
+   int iLength;
+   int iBitPos;
+} t_mp4_bit_reader;
+
+static u32 _bits_read(t_mp4_bit_reader* pR, int iCount)
+{
+   u32 uValue = 0;
+   for( int i=0; i<iCount; i++ )
+   {
+      u32 uBit = 0;
+      if ( pR->iBitPos < pR->iLength*8 )
+         uBit = (pR->uData[pR->iBitPos/8] >> (7 - (pR->iBitPos%8))) & 0x01;
+      pR->iBitPos++;
+      uValue = (uValue << 1) | uBit;
+   }
+   return uValue;
+}
+
+static u32 _bits_read_ue(t_mp4_bit_reader* pR)
+{
+   int iZeros = 0;
+   while ( 0 == _bits_read(pR, 1) && iZeros < 32 && pR->iBitPos < pR->iLength*8 )
+      iZeros++;
+   if ( 0 == iZeros )
+      return 0;
+   return ((1u << iZeros) - 1) + _bits_read(pR, iZeros);
+}
+
+static int _bits_read_se(t_mp4_bit_reader* pR)
+{
+   u32 uValue = _bits_read_ue(pR);
+   if ( uValue & 0x01 )
+      return (int)((uValue+1)/2);
+   return -(int)(uValue/2);
+}
+
+int mp4_parse_h264_sps(const u8* pSPS, int iLength, int* piWidth, int* piHeight)
+{
+   if ( NULL == pSPS || iLength < 4 || iLength > MP4_RECORDER_MAX_PARAM_SET_SIZE )
+      return -1;
+
+   // Remove the emulation prevention bytes, skip the NAL header
+   t_mp4_bit_reader reader;
+   reader.iLength = 0;
+   reader.iBitPos = 0;
+   int iZeros = 0;
+   for( int i=1; i<iLength; i++ )
+   {
+      if ( iZeros >= 2 && pSPS[i] == 0x03 )
+      {
+         iZeros = 0;
+         continue;
+      }
+      iZeros = (pSPS[i] == 0)?(iZeros+1):0;
+      reader.uData[reader.iLength++] = pSPS[i];
+   }
+
+   u32 uProfile = _bits_read(&reader, 8);
+   _bits_read(&reader, 16); // constraint flags, level
+   _bits_read_ue(&reader); // sps id
+
+   u32 uChromaFormat = 1;
+   if ( uProfile == 100 || uProfile == 110 || uProfile == 122 || uProfile == 244 || uProfile == 44 ||
+        uProfile == 83 || uProfile == 86 || uProfile == 118 || uProfile == 128 || uProfile == 138 ||
+        uProfile == 139 || uProfile == 134 || uProfile == 135 )
+   {
+      uChromaFormat = _bits_read_ue(&reader);
+      if ( 3 == uChromaFormat )
+         _bits_read(&reader, 1);
+      _bits_read_ue(&reader); // bit depth luma
+      _bits_read_ue(&reader); // bit depth chroma
+      _bits_read(&reader, 1);
+      if ( _bits_read(&reader, 1) ) // scaling matrix present
+      {
+         for( int i=0; i<((uChromaFormat != 3)?8:12); i++ )
+         {
+            if ( ! _bits_read(&reader, 1) )
+               continue;
+            int iSize = (i < 6)?16:64;
+            int iLastScale = 8, iNextScale = 8;
+            for( int k=0; k<iSize; k++ )
+            {
+               if ( 0 != iNextScale )
+                  iNextScale = (iLastScale + _bits_read_se(&reader) + 256) % 256;
+               iLastScale = (0 == iNextScale)?iLastScale:iNextScale;
+            }
+         }
+      }
+   }
+
+   _bits_read_ue(&reader); // log2 max frame num
+   u32 uPOCType = _bits_read_ue(&reader);
+   if ( 0 == uPOCType )
+      _bits_read_ue(&reader);
+   else if ( 1 == uPOCType )
+   {
+      _bits_read(&reader, 1);
+      _bits_read_se(&reader);
+      _bits_read_se(&reader);
+      u32 uCycle = _bits_read_ue(&reader);
+      for( u32 i=0; i<uCycle && i<256; i++ )
+         _bits_read_se(&reader);
+   }
+   _bits_read_ue(&reader); // max ref frames
+   _bits_read(&reader, 1);
+   u32 uWidthMBs = _bits_read_ue(&reader) + 1;
+   u32 uHeightMapUnits = _bits_read_ue(&reader) + 1;
+   u32 uFrameMBsOnly = _bits_read(&reader, 1);
+   if ( ! uFrameMBsOnly )
+      _bits_read(&reader, 1);
+   _bits_read(&reader, 1); // direct 8x8
+
+   u32 uCropLeft = 0, uCropRight = 0, uCropTop = 0, uCropBottom = 0;
+   if ( _bits_read(&reader, 1) )
+   {
+      uCropLeft = _bits_read_ue(&reader);
+      uCropRight = _bits_read_ue(&reader);
+      uCropTop = _bits_read_ue(&reader);
+      uCropBottom = _bits_read_ue(&reader);
+   }
+   if ( reader.iBitPos > reader.iLength*8 )
+      return -1;
+
+   u32 uCropUnitX = (0 == uChromaFormat || 3 == uChromaFormat)?1:2;
+   u32 uCropUnitY = ((1 == uChromaFormat)?2:1) * (2 - uFrameMBsOnly);
+   int iWidth = (int)(uWidthMBs*16 - uCropUnitX*(uCropLeft + uCropRight));
+   int iHeight = (int)((2 - uFrameMBsOnly)*uHeightMapUnits*16 - uCropUnitY*(uCropTop + uCropBottom));
+   if ( iWidth <= 0 || iHeight <= 0 || iWidth > 8192 || iHeight > 8192 )
+      return -1;
+   if ( NULL != piWidth )
+      *piWidth = iWidth;
+   if ( NULL != piHeight )
+      *piHeight = iHeight;
+   return 0;
+}
+
+//----------------------------------------------------
+// Writing
+
+// Runs on the writer thread. Returns the bytes written, -1 on error (after writing *piWritten bytes)
+static int _mp4_write(int fd, const u8* pData, int iLength, int* piWritten)
+{
+   *piWritten = 0;
+   while ( iLength > 0 )
+   {
+      int iRes = write(fd, pData, iLength);
+      if ( iRes <= 0 )
+         return -1;
+      pData += iRes;
+      iLength -= iRes;
+      *piWritten += iRes;
+   }
+   return *piWritten;
+}
+
+static void* _mp4_writer_thread(void* pParam)
+{
+   t_mp4_recorder* pRecorder = (t_mp4_recorder*)pParam;
+   log_line("[MP4Recorder] Writer thread started.");
+
+   pthread_mutex_lock(&pRecorder->writerMutex);
+   while ( 1 )
+   {
+      while ( 0 == pRecorder->iWriteQueueCount && ! pRecorder->iWriterQuit )
+         pthread_cond_wait(&pRecorder->writerCondRequest, &pRecorder->writerMutex);
+      // Quits only when all the queued writes are done
+      if ( 0 == pRecorder->iWriteQueueCount )
+         break;
+
+      t_mp4_write_request request = pRecorder->writeQueue[pRecorder->iWriteQueueStart];
+      pRecorder->iWriteQueueStart = (pRecorder->iWriteQueueStart+1) % MP4_RECORDER_WRITE_QUEUE_SIZE;
+      pRecorder->iWriteQueueCount--;
+      pthread_mutex_unlock(&pRecorder->writerMutex);
+
+      int iWritten = 0;
+      int iRes = _mp4_write(pRecorder->fd, request.pData, request.iLength, &iWritten);
+      int iError = errno;
+      free(request.pData);
+
+      pthread_mutex_lock(&pRecorder->writerMutex);
+      pRecorder->stats.uBytesWritten += iWritten;
+      if ( iRes < 0 )
+      {
+         if ( 0 == pRecorder->stats.uWriteErrors )
+            log_softerror_and_alarm("[MP4Recorder] Failed to write to the video file, error: %d", iError);
+         pRecorder->stats.uWriteErrors++;
+         pRecorder->stats.uFramesDropped += request.iFrames;
+      }
+      else if ( request.iFrames > 0 )
+      {
+         pRecorder->stats.uFramesWritten += request.iFrames;
+         pRecorder->stats.uFragmentsWritten++;
+      }
+   }
+   pthread_mutex_unlock(&pRecorder->writerMutex);
+   log_line("[MP4Recorder] Writer thread stopped.");
+   return NULL;
+}
+
+// Queues the two parts of a write (a box header and its data) for the writer thread.
+// iFrames: samples in a fragment, 0 for the file header. Returns 0 if queued, -1 if dropped.
+static int _mp4_queue_write(t_mp4_recorder* pRecorder, const u8* pHeader, int iHeaderLength, const u8* pData, int iDataLength, int iFrames)
+{
+   pthread_mutex_lock(&pRecorder->writerMutex);
+   if ( pRecorder->iWriteQueueCount >= MP4_RECORDER_WRITE_QUEUE_SIZE )
+   {
+      pRecorder->stats.uFramesDropped += iFrames;
+      pRecorder->stats.uFragmentsDropped++;
+      if ( 1 == pRecorder->stats.uFragmentsDropped )
+         log_softerror_and_alarm("[MP4Recorder] Write queue is full (storage too slow), dropping fragments.");
+      pthread_mutex_unlock(&pRecorder->writerMutex);
+      return -1;
+   }
+   pthread_mutex_unlock(&pRecorder->writerMutex);
+
+   // Only this thread adds to the queue, so the free slot is still there
+   u8* pBuffer = (u8*) malloc(iHeaderLength + iDataLength);
+   if ( NULL == pBuffer )
+   {
+      pthread_mutex_lock(&pRecorder->writerMutex);
+      pRecorder->stats.uFramesDropped += iFrames;
+      pRecorder->stats.uFragmentsDropped++;
+      pthread_mutex_unlock(&pRecorder->writerMutex);
+      return -1;
+   }
+   memcpy(pBuffer, pHeader, iHeaderLength);
+   if ( iDataLength > 0 )
+      memcpy(pBuffer + iHeaderLength, pData, iDataLength);
+
+   pthread_mutex_lock(&pRecorder->writerMutex);
+   t_mp4_write_request* pRequest = &pRecorder->writeQueue[(pRecorder->iWriteQueueStart + pRecorder->iWriteQueueCount) % MP4_RECORDER_WRITE_QUEUE_SIZE];
+   pRequest->pData = pBuffer;
+   pRequest->iLength = iHeaderLength + iDataLength;
+   pRequest->iFrames = iFrames;
+   pRecorder->iWriteQueueCount++;
+   pthread_cond_signal(&pRecorder->writerCondRequest);
+   pthread_mutex_unlock(&pRecorder->writerMutex);
+   return 0;
+}
+
+static void _mp4_write_header(t_mp4_recorder* pRecorder)
+{
+   u8 uBuffer[1024 + 2*MP4_RECORDER_MAX_PARAM_SET_SIZE];
+   t_mp4_box_writer w;
+   w.pBuffer = uBuffer;
+   w.iPos = 0;
+   w.iDepth = 0;
+
+   if ( 0 != mp4_parse_h264_sps(pRecorder->uSPS, pRecorder->iSPSLength, &pRecorder->iWidth, &pRecorder->iHeight) )
+      log_softerror_and_alarm("[MP4Recorder] Failed to parse the video SPS, using %d x %d", pRecorder->iWidth, pRecorder->iHeight);
+   log_line("[MP4Recorder] Starting video file, %d x %d", pRecorder->iWidth, pRecorder->iHeight);
+
+   _box_start(&w, "ftyp");
+   _box_bytes(&w, (const u8*)"isom", 4);
+   _box_u32(&w, 0x200);
+   _box_bytes(&w, (const u8*)"isomiso6avc1mp41", 16);
+   _box_end(&w);
+
+   _box_start(&w, "moov");
+
+   _box_start_full(&w, "mvhd", 0, 0);
+   _box_u32(&w, 0); // creation time
+   _box_u32(&w, 0);
+   _box_u32(&w, 1000); // timescale
+   _box_u32(&w, 0); // duration: unknown, fragmented
+   _box_u32(&w, 0x00010000); // rate
+   _box_u16(&w, 0x0100); // volume
+   _box_zeros(&w, 10);
+   u32 uMatrix[9] = { 0x00010000, 0, 0, 0, 0x00010000, 0, 0, 0, 0x40000000 };
+   for( int i=0; i<9; i++ )
+      _box_u32(&w, uMatrix[i]);
+   _box_zeros(&w, 24);
+   _box_u32(&w, 2); // next track id
+   _box_end(&w);
+
+   _box_start(&w, "trak");
+   _box_start_full(&w, "tkhd", 0, 0x03); // enabled, in movie
+   _box_u32(&w, 0);
+   _box_u32(&w, 0);
+   _box_u32(&w, 1); // track id
+   _box_u32(&w, 0);
+   _box_u32(&w, 0); // duration
+   _box_zeros(&w, 8);
+   _box_u16(&w, 0); // layer
+   _box_u16(&w, 0); // alternate group
+   _box_u16(&w, 0); // volume
+   _box_u16(&w, 0);
+   for( int i=0; i<9; i++ )
+      _box_u32(&w, uMatrix[i]);
+   _box_u32(&w, ((u32)pRecorder->iWidth) << 16);
+   _box_u32(&w, ((u32)pRecorder->iHeight) << 16);
+   _box_end(&w);
+
+   _box_start(&w, "mdia");
+   _box_start_full(&w, "mdhd", 0, 0);
+   _box_u32(&w, 0);
+   _box_u32(&w, 0);
+   _box_u32(&w, MP4_RECORDER_TIMESCALE);
+   _box_u32(&w, 0);
+   _box_u16(&w, 0x55C4); // "und"
+   _box_u16(&w, 0);
+   _box_end(&w);
+
+   _box_start_full(&w, "hdlr", 0, 0);
+   _box_u32(&w, 0);
+   _box_bytes(&w, (const u8*)"vide", 4);
+   _box_zeros(&w, 12);
+   _box_bytes(&w, (const u8*)"Video\0", 6);
+   _box_end(&w);
+
+   _box_start(&w, "minf");
+   _box_start_full(&w, "vmhd", 0, 0x01);
+   _box_zeros(&w, 8);
+   _box_end(&w);
+   _box_start(&w, "dinf");
+   _box_start_full(&w, "dref", 0, 0);
+   _box_u32(&w, 1);
+   _box_start_full(&w, "url ", 0, 0x01); // data in this file
+   _box_end(&w);
+   _box_end(&w);
+   _box_end(&w);
+
+   _box_start(&w, "stbl");
+   _box_start_full(&w, "stsd", 0, 0);
+   _box_u32(&w, 1);
+   _box_start(&w, "avc1");
+   _box_zeros(&w, 6);
+   _box_u16(&w, 1); // data reference index
+   _box_zeros(&w, 16);
+   _box_u16(&w, (u16)pRecorder->iWidth);
+   _box_u16(&w, (u16)pRecorder->iHeight);
+   _box_u32(&w, 0x00480000); // 72 dpi
+   _box_u32(&w, 0x00480000);
+   _box_u32(&w, 0);
+   _box_u16(&w, 1); // frames per sample
+   _box_zeros(&w, 32); // compressor name
+   _box_u16(&w, 0x0018); // depth
+   _box_u16(&w, 0xFFFF);
+   _box_start(&w, "avcC");
+   _box_u8(&w, 1);
+   _box_u8(&w, pRecorder->uSPS[1]); // profile
+   _box_u8(&w, pRecorder->uSPS[2]); // compatibility
+   _box_u8(&w, pRecorder->uSPS[3]); // level
+   _box_u8(&w, 0xFF); // 4 bytes NAL lengths
+   _box_u8(&w, 0xE1); // one SPS
+   _box_u16(&w, (u16)pRecorder->iSPSLength);
+   _box_bytes(&w, pRecorder->uSPS, pRecorder->iSPSLength);
+   _box_u8(&w, 1); // one PPS
+   _box_u16(&w, (u16)pRecorder->iPPSLength);
+   _box_bytes(&w, pRecorder->uPPS, pRecorder->iPPSLength);
+   _box_end(&w); // avcC
+   _box_end(&w); // avc1
+   _box_end(&w); // stsd
+
+   // Empty sample tables, the samples are in the fragments
+   _box_start_full(&w, "stts", 0, 0);
+   _box_u32(&w, 0);
+   _box_end(&w);
+   _box_start_full(&w, "stsc", 0, 0);
+   _box_u32(&w, 0);
+   _box_end(&w);
+   _box_start_full(&w, "stsz", 0, 0);
+   _box_u32(&w, 0);
+   _box_u32(&w, 0);
+   _box_end(&w);
+   _box_start_full(&w, "stco", 0, 0);
+   _box_u32(&w, 0);
+   _box_end(&w);
+   _box_end(&w); // stbl
+   _box_end(&w); // minf
+   _box_end(&w); // mdia
+   _box_end(&w); // trak
+
+   _box_start(&w, "mvex");
+   _box_start_full(&w, "trex", 0, 0);
+   _box_u32(&w, 1); // track id
+   _box_u32(&w, 1); // sample description index
+   _box_u32(&w, 0);
+   _box_u32(&w, 0);
+   _box_u32(&w, 0);
+   _box_end(&w);
+   _box_end(&w);
+
+   _box_end(&w); // moov
+
+   _mp4_queue_write(pRecorder, uBuffer, w.iPos, NULL, 0, 0);
+   pRecorder->iHeaderWritten = 1;
+}
+
+static u32 _mp4_duration_ms(u32 uTimeFrom, u32 uTimeTo)
+{
+   // Frames arrive in bursts at times: keep the durations in a sane range
+   u32 uDuration = uTimeTo - uTimeFrom;
+   if ( uDuration < 1 || uDuration > 0x7FFFFFFF )
+      uDuration = 1;
+   if ( uDuration > 1000 )
+      uDuration = 1000;
+   return uDuration;
+}
+
+// Writes the samples of the fragment buffer, up to iDataEnd. uTimeNextMs: start time of the sample after them
+static void _mp4_write_fragment(t_mp4_recorder* pRecorder, int iDataEnd, u32 uTimeNextMs)
+{
+   if ( 0 == pRecorder->iSamplesCount )
+      return;
+
+   u8 uBuffer[128 + 12*MP4_RECORDER_FRAGMENT_MAX_SAMPLES];
+   t_mp4_box_writer w;
+   w.pBuffer = uBuffer;
+   w.iPos = 0;
+   w.iDepth = 0;
+
+   _box_start(&w, "moof");
+   _box_start_full(&w, "mfhd", 0, 0);
+   _box_u32(&w, ++pRecorder->uFragmentSequence);
+   _box_end(&w);
+   _box_start(&w, "traf");
+   _box_start_full(&w, "tfhd", 0, 0x020000); // default base is moof
+   _box_u32(&w, 1);
+   _box_end(&w);
+   _box_start_full(&w, "tfdt", 1, 0);
+   _box_u64(&w, pRecorder->uDecodeTime);
+   _box_end(&w);
+   _box_start_full(&w, "trun", 0, 0x000701); // data offset, sample duration, size, flags
+   _box_u32(&w, (u32)pRecorder->iSamplesCount);
+   int iDataOffsetPos = w.iPos;
+   _box_u32(&w, 0);
+   for( int i=0; i<pRecorder->iSamplesCount; i++ )
+   {
+      u32 uTimeNext = (i < pRecorder->iSamplesCount-1)?pRecorder->uSampleTimeMs[i+1]:uTimeNextMs;
+      u32 uDuration = _mp4_duration_ms(pRecorder->uSampleTimeMs[i], uTimeNext);
+      if ( (i == pRecorder->iSamplesCount-1) && (uTimeNextMs == MAX_U32) )
+         uDuration = pRecorder->uLastSampleDuration;
+      pRecorder->uLastSampleDuration = uDuration;
+      uDuration *= MP4_RECORDER_TIMESCALE/1000;
+      pRecorder->uDecodeTime += uDuration;
+
+      _box_u32(&w, uDuration);
+      _box_u32(&w, pRecorder->uSampleSize[i]);
+      _box_u32(&w, pRecorder->uSampleIsKey[i]?MP4_SAMPLE_FLAGS_SYNC:MP4_SAMPLE_FLAGS_NON_SYNC);
+   }
+   _box_end(&w); // trun
+   _box_end(&w); // traf
+   _box_end(&w); // moof
+
+   u32 uDataOffset = (u32)(w.iPos + 8);
+   w.pBuffer[iDataOffsetPos] = (uDataOffset >> 24) & 0xFF;
+   w.pBuffer[iDataOffsetPos+1] = (uDataOffset >> 16) & 0xFF;
+   w.pBuffer[iDataOffsetPos+2] = (uDataOffset >> 8) & 0xFF;
+   w.pBuffer[iDataOffsetPos+3] = uDataOffset & 0xFF;
+   _box_u32(&w, (u32)(iDataEnd + 8));
+   _box_bytes(&w, (const u8*)"mdat", 4);
+
+   // The fragment goes out as a whole: a cut file ends with at most one partial fragment.
+   // The decode times are already moved on, so the fragments after a dropped one keep their timing.
+   _mp4_queue_write(pRecorder, uBuffer, w.iPos, pRecorder->pData, iDataEnd, pRecorder->iSamplesCount);
+   pRecorder->iSamplesCount = 0;
+}
+
+// Writes the completed samples and moves the data after them to the start of the buffer
+static void _mp4_flush_samples(t_mp4_recorder* pRecorder, u32 uTimeNextMs)
+{
+   int iEnd = pRecorder->iFrameStartPos;
+   _mp4_write_fragment(pRecorder, iEnd, uTimeNextMs);
+   if ( iEnd <= 0 )
+      return;
+   memmove(pRecorder->pData, pRecorder->pData + iEnd, pRecorder->iDataPos - iEnd);
+   pRecorder->iDataPos -= iEnd;
+   pRecorder->iFrameStartPos = 0;
+   if ( pRecorder->iNALStartPos >= 0 )
+      pRecorder->iNALStartPos -= iEnd;
+}
+
+static void _mp4_end_nal(t_mp4_recorder* pRecorder)
+{
+   if ( pRecorder->iNALStartPos < 0 )
+      return;
+
+   // Remove the start code of the next NAL and the trailing zeros
+   int iEnd = pRecorder->iDataPos;
+   int iStart = pRecorder->iNALStartPos + 4;
+   if ( iEnd - iStart >= 3 && pRecorder->pData[iEnd-1] == 0x01 && pRecorder->pData[iEnd-2] == 0 && pRecorder->pData[iEnd-3] == 0 )
+      iEnd--;
+   while ( iEnd > iStart && 0 == pRecorder->pData[iEnd-1] )
+      iEnd--;
+
+   int iLength = iEnd - iStart;
+   if ( iLength <= 0 || pRecorder->iNALType == MP4_NAL_AUD )
+   {
+      pRecorder->iDataPos = pRecorder->iNALStartPos;
+      pRecorder->iNALStartPos = -1;
+      return;
+   }
+
+   u8* pNAL = pRecorder->pData + iStart;
+   if ( pRecorder->iNALType == MP4_NAL_SPS && iLength <= MP4_RECORDER_MAX_PARAM_SET_SIZE )
+   {
+      memcpy(pRecorder->uSPS, pNAL, iLength);
+      pRecorder->iSPSLength = iLength;
+   }
+   if ( pRecorder->iNALType == MP4_NAL_PPS && iLength <= MP4_RECORDER_MAX_PARAM_SET_SIZE )
+   {
+      memcpy(pRecorder->uPPS, pNAL, iLength);
+      pRecorder->iPPSLength = iLength;
+   }
+   if ( pRecorder->iNALType == MP4_NAL_IDR )
+      pRecorder->iFrameIsKey = 1;
+
+   u8* pLength = pRecorder->pData + pRecorder->iNALStartPos;
+   pLength[0] = (iLength >> 24) & 0xFF;
+   pLength[1] = (iLength >> 16) & 0xFF;
+   pLength[2] = (iLength >> 8) & 0xFF;
+   pLength[3] = iLength & 0xFF;
+   pRecorder->iDataPos = iEnd;
+   pRecorder->iNALStartPos = -1;
+}
+
+static void _mp4_count_dropped_frame(t_mp4_recorder* pRecorder)
+{
+   pthread_mutex_lock(&pRecorder->writerMutex);
+   pRecorder->stats.uFramesDropped++;
+   pthread_mutex_unlock(&pRecorder->writerMutex);
+}
+
+static void _mp4_end_frame(t_mp4_recorder* pRecorder)
+{
+   int iFrameSize = pRecorder->iDataPos - pRecorder->iFrameStartPos;
+   int bKey = pRecorder->iFrameIsKey;
+   pRecorder->iFrameIsKey = 0;
+
+   if ( pRecorder->iFrameDropped || iFrameSize <= 0 )
+   {
+      _mp4_count_dropped_frame(pRecorder);
+      pRecorder->iDataPos = pRecorder->iFrameStartPos;
+      pRecorder->iFrameDropped = 0;
+      return;
+   }
+
+   if ( ! pRecorder->iHeaderWritten )
+   {
+      if ( (!bKey) || 0 == pRecorder->iSPSLength || 0 == pRecorder->iPPSLength )
+      {
+         _mp4_count_dropped_frame(pRecorder);
+         pRecorder->iDataPos = pRecorder->iFrameStartPos;
+         return;
+      }
+      _mp4_write_header(pRecorder);
+   }
+
+   // A new fragment starts on a key frame (or when the fragment gets too long)
+   if ( pRecorder->iSamplesCount > 0 )
+   {
+      u32 uFragmentMs = pRecorder->uFrameTimeMs - pRecorder->uSampleTimeMs[0];
+      if ( (bKey && uFragmentMs >= MP4_RECORDER_FRAGMENT_MIN_MS) || uFragmentMs >= MP4_RECORDER_FRAGMENT_MAX_MS ||
+           pRecorder->iSamplesCount >= MP4_RECORDER_FRAGMENT_MAX_SAMPLES )
+         _mp4_flush_samples(pRecorder, pRecorder->uFrameTimeMs);
+   }
+
+   pRecorder->uSampleSize[pRecorder->iSamplesCount] = (u32)iFrameSize;
+   pRecorder->uSampleTimeMs[pRecorder->iSamplesCount] = pRecorder->uFrameTimeMs;
+   pRecorder->uSampleIsKey[pRecorder->iSamplesCount] = (u8)bKey;
+   pRecorder->iSamplesCount++;
+   pRecorder->iFrameStartPos = pRecorder->iDataPos;
+}
+
+int mp4_recorder_open(t_mp4_recorder* pRecorder, const char* szFile)
+{
+   if ( NULL == pRecorder )
+      return -1;
+   memset(pRecorder, 0, sizeof(t_mp4_recorder));
+   pRecorder->iNALStartPos = -1;
+   pRecorder->iWidth = 1280;
+   pRecorder->iHeight = 720;
+   pRecorder->uLastSampleDuration = 33;
+
+   pRecorder->pData = (u8*) malloc(MP4_RECORDER_FRAGMENT_MAX_BYTES);
+   if ( NULL == pRecorder->pData )
+   {
+      log_softerror_and_alarm("[MP4Recorder] Failed to allocate the fragment buffer.");
+      pRecorder->fd = -1;
+      return -1;
+   }
+   pRecorder->fd = open(szFile, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+   if ( pRecorder->fd < 0 )
+   {
+      log_softerror_and_alarm("[MP4Recorder] Failed to create video file %s", szFile);
+      free(pRecorder->pData);
+      pRecorder->pData = NULL;
+      return -1;
+   }
+
+   pthread_mutex_init(&pRecorder->writerMutex, NULL);
+   pthread_cond_init(&pRecorder->writerCondRequest, NULL);
+   if ( 0 != pthread_create(&pRecorder->writerThread, NULL, &_mp4_writer_thread, pRecorder) )
+   {
+      log_softerror_and_alarm("[MP4Recorder] Failed to create the writer thread.");
+      pthread_cond_destroy(&pRecorder->writerCondRequest);
+      pthread_mutex_destroy(&pRecorder->writerMutex);
+      close(pRecorder->fd);
+      pRecorder->fd = -1;
+      free(pRecorder->pData);
+      pRecorder->pData = NULL;
+      return -1;
+   }
+   log_line("[MP4Recorder] Created video file %s", szFile);
+   return 0;
+}
+
+void mp4_recorder_close(t_mp4_recorder* pRecorder)
+{
+   if ( NULL == pRecorder || NULL == pRecorder->pData )
+      return;
+
+   _mp4_end_nal(pRecorder);
+   if ( pRecorder->iDataPos > pRecorder->iFrameStartPos )
+   {
+      pRecorder->uFrameTimeMs = pRecorder->uLastTimeMs;
+      _mp4_end_frame(pRecorder);
+   }
+   _mp4_flush_samples(pRecorder, MAX_U32);
+
+   pthread_mutex_lock(&pRecorder->writerMutex);
+   pRecorder->iWriterQuit = 1;
+   pthread_cond_signal(&pRecorder->writerCondRequest);
+   pthread_mutex_unlock(&pRecorder->writerMutex);
+   pthread_join(pRecorder->writerThread, NULL);
+   pthread_cond_destroy(&pRecorder->writerCondRequest);
+   pthread_mutex_destroy(&pRecorder->writerMutex);
+
+   if ( pRecorder->fd >= 0 )
+      close(pRecorder->fd);
+   pRecorder->fd = -1;
+   free(pRecorder->pData);
+   pRecorder->pData = NULL;
+   log_line("[MP4Recorder] Closed video file: %u frames in %u fragments, %llu bytes; %u frames dropped, %u fragments dropped (write queue full), %u write errors",
+      pRecorder->stats.uFramesWritten, pRecorder->stats.uFragmentsWritten, pRecorder->stats.uBytesWritten,
+      pRecorder->stats.uFramesDropped, pRecorder->stats.uFragmentsDropped, pRecorder->stats.uWriteErrors);
+}
+
+void mp4_recorder_get_stats(t_mp4_recorder* pRecorder, t_mp4_recorder_stats* pStats)
+{
+   if ( NULL == pRecorder || NULL == pStats )
+      return;
+   if ( NULL == pRecorder->pData )
+   {
+      memcpy(pStats, &pRecorder->stats, sizeof(t_mp4_recorder_stats));
+      return;
+   }
+   pthread_mutex_lock(&pRecorder->writerMutex);
+   memcpy(pStats, &pRecorder->stats, sizeof(t_mp4_recorder_stats));
+   pthread_mutex_unlock(&pRecorder->writerMutex);
+}
+
+int mp4_recorder_get_pending_writes(t_mp4_recorder* pRecorder)
+{
+   if ( NULL == pRecorder || NULL == pRecorder->pData )
+      return 0;
+   pthread_mutex_lock(&pRecorder->writerMutex);
+   int iPending = pRecorder->iWriteQueueCount;
+   pthread_mutex_unlock(&pRecorder->writerMutex);
+   return iPending;
+}
+
+void mp4_recorder_start_nal(t_mp4_recorder* pRecorder, int iNALType, int bIsLastSliceInFrame, u32 uTimeMs)
+{
+   if ( NULL == pRecorder || NULL == pRecorder->pData )
+      return;
+
+   int bFrameComplete = pRecorder->iNALIsLastSlice;
+   _mp4_end_nal(pRecorder);
+   if ( bFrameComplete )
+      _mp4_end_frame(pRecorder);
+
+   pRecorder->uLastTimeMs = uTimeMs;
+   pRecorder->iNALType = iNALType;
+   pRecorder->iNALIsLastSlice = bIsLastSliceInFrame;
+   if ( bIsLastSliceInFrame )
+      pRecorder->uFrameTimeMs = uTimeMs;
+
+   if ( pRecorder->iDataPos + 4 > MP4_RECORDER_FRAGMENT_MAX_BYTES )
+      _mp4_flush_samples(pRecorder, uTimeMs);
+   if ( pRecorder->iDataPos + 4 > MP4_RECORDER_FRAGMENT_MAX_BYTES )
+   {
+      // A single frame does not fit in the buffer
+      pRecorder->iFrameDropped = 1;
+      pRecorder->iDataPos = pRecorder->iFrameStartPos;
+   }
+   pRecorder->iNALStartPos = pRecorder->iDataPos;
+   pRecorder->iDataPos += 4;
+}
+
+void mp4_recorder_add_nal_data(t_mp4_recorder* pRecorder, const u8* pData, int iLength)
+{
+   if ( NULL == pRecorder || NULL == pRecorder->pData || pRecorder->iNALStartPos < 0 || iLength <= 0 )
+      return;
+   if ( pRecorder->iFrameDropped )
+      return;
+
+   if ( pRecorder->iDataPos + iLength > MP4_RECORDER_FRAGMENT_MAX_BYTES )
+      _mp4_flush_samples(pRecorder, pRecorder->uLastTimeMs);
+   if ( pRecorder->iDataPos + iLength > MP4_RECORDER_FRAGMENT_MAX_BYTES )
+   {
+      pRecorder->iFrameDropped = 1;
+      pRecorder->iDataPos = pRecorder->iFrameStartPos;
+      pRecorder->iNALStartPos = pRecorder->iDataPos;
+      pRecorder->iDataPos += 4;
+      return;
+   }
+   memcpy(pRecorder->pData + pRecorder->iDataPos, pData, iLength);
+   pRecorder->iDataPos += iLength;
+}
+
+//----------------------------------------------------
+// Reading back
+
+static int _mp4_write_nal(FILE* fOut, const u8* pNAL, int iLength)
+{
+   static const u8 uStartCode[4] = { 0, 0, 0, 1 };
+   if ( 4 != fwrite(uStartCode, 1, 4, fOut) )
+      return -1;
+   if ( iLength != (int)fwrite(pNAL, 1, iLength, fOut) )
+      return -1;
+   return 0;
+}
+
+int mp4_file_extract_h264(const char* szFileIn, const char* szFileOut)
+{
+   FILE* fIn = fopen(szFileIn, "rb");
+   if ( NULL == fIn )
+      return -1;
+   FILE* fOut = fopen(szFileOut, "wb");
+   if ( NULL == fOut )
+   {
+      fclose(fIn);
+      return -1;
+   }
+
+   int iFrames = 0;
+   int iError = 0;
+   u8* pBox = NULL;
+   u8 uHeader[8];
+   while ( (!iError) && 8 == fread(uHeader, 1, 8, fIn) )
+   {
+      u32 uSize = _read_u32(uHeader);
+      if ( uSize < 8 )
+         break;
+      int bMoov = (0 == memcmp(uHeader+4, "moov", 4));
+      int bMdat = (0 == memcmp(uHeader+4, "mdat", 4));
+      if ( (!bMoov) && (!bMdat) )
+      {
+         if ( 0 != fseek(fIn, uSize-8, SEEK_CUR) )
+            break;
+         continue;
+      }
+      pBox = (u8*) realloc(pBox, uSize);
+      if ( NULL == pBox )
+         break;
+      // A cut file ends with a partial box: use only what is complete
+      int iLength = (int)fread(pBox, 1, uSize-8, fIn);
+
+      if ( bMoov )
+      {
+         // The parameter sets from the avcC box
+         for( int i=0; i+8<iLength; i++ )
+         {
+            if ( 0 != memcmp(pBox+i, "avcC", 4) )
+               continue;
+            u8* p = pBox + i + 4;
+            int iSPSLength = (p[6] << 8) | p[7];
+            if ( i + 4 + 8 + iSPSLength + 3 > iLength )
+               break;
+            int iPPSLength = (p[8+iSPSLength+1] << 8) | p[8+iSPSLength+2];
+            if ( i + 4 + 8 + iSPSLength + 3 + iPPSLength > iLength )
+               break;
+            if ( 0 != _mp4_write_nal(fOut, p+8, iSPSLength) || 0 != _mp4_write_nal(fOut, p+8+iSPSLength+3, iPPSLength) )
+               iError = 1;
+            break;
+         }
+         continue;
+      }
+
+      int iPos = 0;
+      while ( (!iError) && iPos + 4 <= iLength )
+      {
+         int iNALLength = (int)_read_u32(pBox+iPos);
+         if ( iNALLength <= 0 || iPos + 4 + iNALLength > iLength )
+            break;
+         u8 uType = pBox[iPos+4] & 0x1F;
+         if ( uType == MP4_NAL_SLICE || uType == MP4_NAL_IDR )
+            iFrames++;
+         if ( 0 != _mp4_write_nal(fOut, pBox+iPos+4, iNALLength) )
+            iError = 1;
+         iPos += 4 + iNALLength;
+      }
+   }
+
+   if ( NULL != pBox )
+      free(pBox);
+   fclose(fIn);
+   fclose(fOut);
+   if ( iError )
+      return -1;
+   return iFrames;
+}
@@ -0,0 +1,111 @@
+#pragma once
+#include "../base/base.h"
+#include <pthread.h>
+
+// Streaming fragmented MP4 writer for the received H264 video.
+// The station H264 parser feeds it NAL by NAL: each NAL start (with its type and if it is the last slice
+// of a frame), then the NAL bytes as they come in. NALs are stored length prefixed right in the fragment
+// buffer (no extra copies), frames are timed by their arrival time.
+// The file header (ftyp, moov) is written on the first key frame, then a fragment (moof + mdat) is written
+// about each second, starting on a key frame. A file cut at any point (power loss) plays up to the last
+// complete fragment. Memory used is the fixed size fragment buffer.
+// SPS/PPS are kept in the samples too, so a stream that changes resolution still decodes.
+// The file writes are done by a writer thread, so a slow storage never blocks the caller (the video forwarding):
+// the header and the fragments are queued, and a fragment that finds the queue full is dropped as a whole
+// (the file stays valid, with a gap in the video).
+
+#define MP4_RECORDER_TIMESCALE 90000
+#define MP4_RECORDER_FRAGMENT_MIN_MS 1000 // fragments start on a key frame, at least this long
+#define MP4_RECORDER_FRAGMENT_MAX_MS 3000 // fragments end on any frame when this long
+#define MP4_RECORDER_FRAGMENT_MAX_BYTES (6*1024*1024)
+#define MP4_RECORDER_FRAGMENT_MAX_SAMPLES 360
+#define MP4_RECORDER_MAX_PARAM_SET_SIZE 256
+#define MP4_RECORDER_WRITE_QUEUE_SIZE 4 // fragments waiting for the writer thread
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct
+{
+   u32 uFramesWritten;
+   u32 uFramesDropped; // before the first key frame, too big for the fragment buffer, or in a dropped/failed fragment
+   u32 uFragmentsWritten;
+   u32 uFragmentsDropped; // the write queue was full
+   u32 uWriteErrors;
+   unsigned long long uBytesWritten;
+} t_mp4_recorder_stats;
+
+typedef struct
+{
+   u8* pData;
+   int iLength;
+   int iFrames;
+} t_mp4_write_request;
+
+typedef struct
+{
+   int fd;
+   int iHeaderWritten;
+   int iWidth;
+   int iHeight;
+   u8 uSPS[MP4_RECORDER_MAX_PARAM_SET_SIZE];
+   int iSPSLength;
+   u8 uPPS[MP4_RECORDER_MAX_PARAM_SET_SIZE];
+   int iPPSLength;
+
+   // Samples of the current fragment (length prefixed NALs), then the frame being received
+   u8* pData;
+   int iDataPos;
+   int iFrameStartPos;
+   int iNALStartPos; // -1 if no NAL is open
+   int iNALType;
+   int iNALIsLastSlice;
+   int iFrameIsKey;
+   int iFrameDropped;
+   u32 uFrameTimeMs;
+   u32 uLastTimeMs;
+
+   int iSamplesCount;
+   u32 uSampleSize[MP4_RECORDER_FRAGMENT_MAX_SAMPLES];
+   u32 uSampleTimeMs[MP4_RECORDER_FRAGMENT_MAX_SAMPLES];
+   u8 uSampleIsKey[MP4_RECORDER_FRAGMENT_MAX_SAMPLES];
+   u32 uLastSampleDuration;
+   unsigned long long uDecodeTime;
+   u32 uFragmentSequence;
+
+   // Writer thread and its queue; the stats are updated under the mutex
+   pthread_t writerThread;
+   pthread_mutex_t writerMutex;
+   pthread_cond_t writerCondRequest;
+   t_mp4_write_request writeQueue[MP4_RECORDER_WRITE_QUEUE_SIZE];
+   int iWriteQueueStart;
+   int iWriteQueueCount;
+   int iWriterQuit;
+
+   t_mp4_recorder_stats stats;
+} t_mp4_recorder;
+
+// Returns 0 on success, -1 if the file can't be created
+int mp4_recorder_open(t_mp4_recorder* pRecorder, const char* szFile);
+// Writes the pending frames, waits for the writer thread to write them and closes the file
+void mp4_recorder_close(t_mp4_recorder* pRecorder);
+// Copies the stats (they are updated by the writer thread)
+void mp4_recorder_get_stats(t_mp4_recorder* pRecorder, t_mp4_recorder_stats* pStats);
+// Writes queued and not done yet
+int mp4_recorder_get_pending_writes(t_mp4_recorder* pRecorder);
+// A NAL starts (its first byte, the NAL header, is the next byte added). The previous NAL ends here;
+// if it was the last slice of a frame, the frame is complete.
+void mp4_recorder_start_nal(t_mp4_recorder* pRecorder, int iNALType, int bIsLastSliceInFrame, u32 uTimeMs);
+// Bytes of the current NAL. A trailing start code (of the next NAL) is removed when the next NAL starts.
+void mp4_recorder_add_nal_data(t_mp4_recorder* pRecorder, const u8* pData, int iLength);
+
+// Gets the width/height from a SPS NAL (with its header byte). Returns 0 on success.
+int mp4_parse_h264_sps(const u8* pSPS, int iLength, int* piWidth, int* piHeight);
+// Converts a recorded MP4 file back to a raw H264 (annex B) stream, for players that take raw H264.
+// The output can be a pipe. Returns the count of frames written, -1 on error.
+int mp4_file_extract_h264(const char* szFileIn, const char* szFileOut);
+
+#ifdef __cplusplus
+}  /* end extern "C" */
+#endif
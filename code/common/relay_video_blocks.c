@@ -0,0 +1,398 @@
+/*
+You can use this C/C++ code however you wish (for example, but not limited to:
+     as is, or by modifying it, or by adding new code, or by removing parts of the code;
+     in public or private projects, in new free or commercial products)
+     only if you get a priori written consent from Petru Soroaga (petrusoroaga@yahoo.com) for your specific use
+     and only if this copyright terms are preserved in the code.
+     This code is public for learning and academic purposes.
+Also, check the licences folder for additional licences terms.
+Code written by: Petru Soroaga, 2021-2023
+*/
+
+#include "relay_video_blocks.h"
+#include "../base/encr_aead.h"
+#include "../radio/fec.h"
+
+static void _relay_video_blocks_free_block(t_relay_video_block* pBlock)
+{
+   pBlock->uBlockIndex = MAX_U32;
+   pBlock->iDataPackets = 0;
+   pBlock->iFecPacketsIn = 0;
+   pBlock->iFecPacketsOut = 0;
+   pBlock->iPacketLength = 0;
+   pBlock->iReceivedData = 0;
+   pBlock->iReceivedFec = 0;
+   pBlock->bDataComplete = 0;
+   pBlock->bRecovered = 0;
+   pBlock->bHeadersFromRetransmission = 0;
+   pBlock->iHeadersLength = 0;
+   memset(pBlock->uReceived, 0, sizeof(pBlock->uReceived));
+}
+
+t_relay_video_blocks* relay_video_blocks_create(int iFecPacketsOut, relay_video_blocks_send_packet pfSend, void* pContext)
+{
+   t_relay_video_blocks* pRelay = (t_relay_video_blocks*) malloc(sizeof(t_relay_video_blocks));
+   if ( NULL == pRelay )
+      return NULL;
+   memset(pRelay, 0, sizeof(t_relay_video_blocks));
+   pRelay->pfSend = pfSend;
+   pRelay->pSendContext = pContext;
+   relay_video_blocks_set_fec_packets(pRelay, iFecPacketsOut);
+   for( int i=0; i<RELAY_VIDEO_BLOCKS_MAX_BLOCKS; i++ )
+      _relay_video_blocks_free_block(&(pRelay->blocks[i]));
+   log_line("[RelayVideoBlocks] Created, FEC packets per block to controller: %d%s", pRelay->iFecPacketsOut,
+      (pRelay->iFecPacketsOut == RELAY_VIDEO_BLOCKS_SAME_FECS)?" (same as relayed vehicle)":"");
+   return pRelay;
+}
+
+void relay_video_blocks_destroy(t_relay_video_blocks* pRelay)
+{
+   if ( NULL == pRelay )
+      return;
+   for( int i=0; i<RELAY_VIDEO_BLOCKS_MAX_BLOCKS; i++ )
+   {
+      if ( NULL != pRelay->blocks[i].pPayloads )
+         free(pRelay->blocks[i].pPayloads);
+   }
+   free(pRelay);
+}
+
+void relay_video_blocks_set_fec_packets(t_relay_video_blocks* pRelay, int iFecPacketsOut)
+{
+   if ( NULL == pRelay )
+      return;
+   if ( iFecPacketsOut > MAX_FECS_PACKETS_IN_BLOCK )
+      iFecPacketsOut = MAX_FECS_PACKETS_IN_BLOCK;
+   if ( iFecPacketsOut < 0 )
+      iFecPacketsOut = RELAY_VIDEO_BLOCKS_SAME_FECS;
+   pRelay->iFecPacketsOut = iFecPacketsOut;
+}
+
+void relay_video_blocks_reset(t_relay_video_blocks* pRelay)
+{
+   if ( NULL == pRelay )
+      return;
+   for( int i=0; i<RELAY_VIDEO_BLOCKS_MAX_BLOCKS; i++ )
+      _relay_video_blocks_free_block(&(pRelay->blocks[i]));
+   memset(&(pRelay->stats), 0, sizeof(t_relay_video_blocks_stats));
+}
+
+// Payloads: data packets, then the FEC packets received, then the FEC packets for the next hop
+static u8* _relay_video_blocks_get_payload(t_relay_video_block* pBlock, int iSlot)
+{
+   return pBlock->pPayloads + iSlot * pBlock->iPacketLength;
+}
+
+static u8* _relay_video_blocks_get_out_payload(t_relay_video_block* pBlock, int iPacketIndex)
+{
+   if ( iPacketIndex < pBlock->iDataPackets )
+      return _relay_video_blocks_get_payload(pBlock, iPacketIndex);
+   return _relay_video_blocks_get_payload(pBlock, pBlock->iFecPacketsIn + iPacketIndex);
+}
+
+static int _relay_video_blocks_start_block(t_relay_video_blocks* pRelay, t_relay_video_block* pBlock, t_packet_header_video_full* pPHVF)
+{
+   if ( (MAX_U32 != pBlock->uBlockIndex) && (! pBlock->bDataComplete) )
+      pRelay->stats.uBlocksIncomplete++;
+   _relay_video_blocks_free_block(pBlock);
+
+   int iFecPacketsOut = pRelay->iFecPacketsOut;
+   if ( iFecPacketsOut == RELAY_VIDEO_BLOCKS_SAME_FECS )
+      iFecPacketsOut = pPHVF->block_fecs;
+
+   int iSize = (pPHVF->block_packets + pPHVF->block_fecs + iFecPacketsOut) * pPHVF->video_packet_length;
+   if ( iSize > pBlock->iPayloadsSize )
+   {
+      u8* pPayloads = (u8*) realloc(pBlock->pPayloads, iSize);
+      if ( NULL == pPayloads )
+      {
+         log_softerror_and_alarm("[RelayVideoBlocks] Failed to allocate %d bytes for video block %u.", iSize, pPHVF->video_block_index);
+         return 0;
+      }
+      pBlock->pPayloads = pPayloads;
+      pBlock->iPayloadsSize = iSize;
+   }
+   pBlock->uBlockIndex = pPHVF->video_block_index;
+   pBlock->iDataPackets = pPHVF->block_packets;
+   pBlock->iFecPacketsIn = pPHVF->block_fecs;
+   pBlock->iFecPacketsOut = iFecPacketsOut;
+   pBlock->iPacketLength = pPHVF->video_packet_length;
+   return 1;
+}
+
+// iPacketIndex: data packets, then the next hop FEC packets
+static void _relay_video_blocks_send(t_relay_video_blocks* pRelay, t_relay_video_block* pBlock, int iPacketIndex, int bRetransmitted, u32 uRetransmissionId)
+{
+   u8 uPacket[MAX_PACKET_TOTAL_SIZE];
+   t_packet_header* pPH = (t_packet_header*)uPacket;
+   t_packet_header_video_full* pPHVF = (t_packet_header_video_full*)(uPacket + sizeof(t_packet_header));
+
+   memcpy(uPacket, pBlock->uHeaders, pBlock->iHeadersLength);
+   memcpy(uPacket + pBlock->iHeadersLength, _relay_video_blocks_get_out_payload(pBlock, iPacketIndex), pBlock->iPacketLength);
+
+   pPH->total_headers_length = pBlock->iHeadersLength;
+   pPH->total_length = pBlock->iHeadersLength + pBlock->iPacketLength;
+   pPH->stream_packet_idx = (pPH->stream_packet_idx & (~PACKET_FLAGS_MASK_STREAM_PACKET_IDX)) | (pRelay->uStreamPacketIndex & PACKET_FLAGS_MASK_STREAM_PACKET_IDX);
+   pRelay->uStreamPacketIndex++;
+   pPHVF->block_fecs = pBlock->iFecPacketsOut;
+   pPHVF->video_block_packet_index = iPacketIndex;
+
+   pPH->packet_flags &= ~PACKET_FLAGS_BIT_RETRANSMITED;
+   if ( bRetransmitted )
+   {
+      pPH->packet_flags |= PACKET_FLAGS_BIT_RETRANSMITED;
+      pPHVF->video_width = (uRetransmissionId >> 16) & 0xFFFF;
+      pPHVF->video_height = uRetransmissionId & 0xFFFF;
+   }
+
+   if ( pPH->packet_flags & PACKET_FLAGS_BIT_HEADERS_ONLY_CRC )
+      packet_compute_crc(uPacket, pPH->total_headers_length);
+   else
+      packet_compute_crc(uPacket, pPH->total_length);
+
+   pRelay->stats.uPacketsOut++;
+   if ( NULL != pRelay->pfSend )
+      pRelay->pfSend(uPacket, pPH->total_length, pRelay->pSendContext);
+}
+
+// Once enough packets are in: recovers and sends the missing data packets, then computes and sends the next hop FEC packets
+static void _relay_video_blocks_check_complete(t_relay_video_blocks* pRelay, t_relay_video_block* pBlock)
+{
+   if ( pBlock->bDataComplete )
+      return;
+   if ( pBlock->iReceivedData + pBlock->iReceivedFec < pBlock->iDataPackets )
+      return;
+
+   u8* pDataPackets[MAX_DATA_PACKETS_IN_BLOCK];
+   for( int i=0; i<pBlock->iDataPackets; i++ )
+      pDataPackets[i] = _relay_video_blocks_get_payload(pBlock, i);
+
+   if ( pBlock->iReceivedData < pBlock->iDataPackets )
+   {
+      u8* pFecPackets[MAX_FECS_PACKETS_IN_BLOCK];
+      unsigned int uFecIndexes[MAX_FECS_PACKETS_IN_BLOCK];
+      unsigned int uMissingIndexes[MAX_DATA_PACKETS_IN_BLOCK];
+      unsigned int uMissing = 0;
+      for( int i=0; i<pBlock->iDataPackets; i++ )
+      {
+         if ( ! pBlock->uReceived[i] )
+            uMissingIndexes[uMissing++] = i;
+      }
+      unsigned int uPos = 0;
+      for( int i=0; (i<pBlock->iFecPacketsIn) && (uPos < uMissing); i++ )
+      {
+         if ( ! pBlock->uReceived[pBlock->iDataPackets+i] )
+            continue;
+         pFecPackets[uPos] = _relay_video_blocks_get_payload(pBlock, pBlock->iDataPackets+i);
+         uFecIndexes[uPos] = i;
+         uPos++;
+      }
+      fec_decode(pBlock->iPacketLength, pDataPackets, pBlock->iDataPackets, pFecPackets, uFecIndexes, uMissingIndexes, uMissing);
+
+      for( unsigned int u=0; u<uMissing; u++ )
+      {
+         pBlock->uReceived[uMissingIndexes[u]] = 1;
+         pRelay->stats.uDataPacketsRecovered++;
+         _relay_video_blocks_send(pRelay, pBlock, uMissingIndexes[u], 0, 0);
+      }
+      pBlock->bRecovered = 1;
+      pRelay->stats.uBlocksRecovered++;
+   }
+   else
+      pRelay->stats.uBlocksComplete++;
+
+   pBlock->bDataComplete = 1;
+
+   if ( pBlock->iFecPacketsOut <= 0 )
+      return;
+
+   u8* pFecPacketsOut[MAX_FECS_PACKETS_IN_BLOCK];
+   for( int i=0; i<pBlock->iFecPacketsOut; i++ )
+      pFecPacketsOut[i] = _relay_video_blocks_get_out_payload(pBlock, pBlock->iDataPackets+i);
+   fec_encode(pBlock->iPacketLength, pDataPackets, pBlock->iDataPackets, pFecPacketsOut, pBlock->iFecPacketsOut);
+
+   for( int i=0; i<pBlock->iFecPacketsOut; i++ )
+   {
+      pRelay->stats.uFecPacketsOut++;
+      _relay_video_blocks_send(pRelay, pBlock, pBlock->iDataPackets+i, 0, 0);
+   }
+}
+
+int relay_video_blocks_on_packet(t_relay_video_blocks* pRelay, u8* pPacket, int iLength)
+{
+   if ( (NULL == pRelay) || (NULL == pPacket) || (iLength < (int)sizeof(t_packet_header)) )
+      return 0;
+
+   t_packet_header* pPH = (t_packet_header*)pPacket;
+   if ( ((pPH->packet_flags & PACKET_FLAGS_MASK_MODULE) != PACKET_COMPONENT_VIDEO) || (pPH->packet_type != PACKET_TYPE_VIDEO_DATA_FULL) )
+      return 0;
+   if ( encr_aead_is_sealed_packet(pPacket) )
+   {
+      pRelay->stats.uPacketsSealed++;
+      return 0;
+   }
+
+   t_packet_header_video_full* pPHVF = (t_packet_header_video_full*)(pPacket + sizeof(t_packet_header));
+   int iHeadersLength = pPH->total_headers_length;
+   if ( (iLength < (int)(sizeof(t_packet_header) + sizeof(t_packet_header_video_full))) ||
+        (iHeadersLength < (int)(sizeof(t_packet_header) + sizeof(t_packet_header_video_full))) ||
+        (iHeadersLength > RELAY_VIDEO_BLOCKS_MAX_HEADERS) ||
+        (pPHVF->block_packets == 0) || (pPHVF->block_packets > MAX_DATA_PACKETS_IN_BLOCK) ||
+        (pPHVF->block_fecs > MAX_FECS_PACKETS_IN_BLOCK) ||
+        (pPHVF->video_block_packet_index >= pPHVF->block_packets + pPHVF->block_fecs) ||
+        (pPHVF->video_packet_length == 0) ||
+        (iHeadersLength + pPHVF->video_packet_length > pPH->total_length) || (pPH->total_length > iLength) )
+   {
+      pRelay->stats.uPacketsInvalid++;
+      return 1;
+   }
+
+   pRelay->stats.uPacketsIn++;
+
+   u32 uBlockIndex = pPHVF->video_block_index;
+   int iPacketIndex = pPHVF->video_block_packet_index;
+   t_relay_video_block* pBlock = &(pRelay->blocks[uBlockIndex % RELAY_VIDEO_BLOCKS_MAX_BLOCKS]);
+
+   if ( pBlock->uBlockIndex != uBlockIndex )
+   {
+      if ( (MAX_U32 != pBlock->uBlockIndex) && ((int)(uBlockIndex - pBlock->uBlockIndex) < 0) )
+      {
+         pRelay->stats.uPacketsTooOld++;
+         return 1;
+      }
+      if ( ! _relay_video_blocks_start_block(pRelay, pBlock, pPHVF) )
+         return 1;
+   }
+   else if ( (pBlock->iDataPackets != pPHVF->block_packets) || (pBlock->iFecPacketsIn != pPHVF->block_fecs) || (pBlock->iPacketLength != pPHVF->video_packet_length) )
+   {
+      pRelay->stats.uPacketsInvalid++;
+      return 1;
+   }
+
+   if ( pBlock->uReceived[iPacketIndex] )
+   {
+      pRelay->stats.uPacketsDuplicate++;
+      return 1;
+   }
+
+   // Retransmitted packets carry the retransmission id instead of the video size: keep the headers of a regular packet
+   int bRetransmitted = (pPH->packet_flags & PACKET_FLAGS_BIT_RETRANSMITED)?1:0;
+   if ( (0 == pBlock->iHeadersLength) || (pBlock->bHeadersFromRetransmission && (! bRetransmitted)) )
+   {
+      memcpy(pBlock->uHeaders, pPacket, iHeadersLength);
+      pBlock->iHeadersLength = iHeadersLength;
+      pBlock->bHeadersFromRetransmission = bRetransmitted;
+   }
+
+   pBlock->uReceived[iPacketIndex] = 1;
+   memcpy(_relay_video_blocks_get_payload(pBlock, iPacketIndex), pPacket + iHeadersLength, pBlock->iPacketLength);
+   if ( iPacketIndex < pBlock->iDataPackets )
+   {
+      pBlock->iReceivedData++;
+      u32 uRetransmissionId = (((u32)pPHVF->video_width) << 16) | (u32)pPHVF->video_height;
+      _relay_video_blocks_send(pRelay, pBlock, iPacketIndex, bRetransmitted, uRetransmissionId);
+   }
+   else
+      pBlock->iReceivedFec++;
+
+   _relay_video_blocks_check_complete(pRelay, pBlock);
+   return 1;
+}
+
+int relay_video_blocks_on_retransmission_request(t_relay_video_blocks* pRelay, u8* pPacket, int iLength, u8* pOutRequest)
+{
+   if ( (NULL == pRelay) || (NULL == pPacket) || (iLength < (int)sizeof(t_packet_header)) )
+      return -1;
+
+   t_packet_header* pPH = (t_packet_header*)pPacket;
+   if ( (pPH->packet_flags & PACKET_FLAGS_MASK_MODULE) != PACKET_COMPONENT_VIDEO )
+      return -1;
+   if ( (pPH->packet_type != PACKET_TYPE_VIDEO_REQ_MULTIPLE_PACKETS) && (pPH->packet_type != PACKET_TYPE_VIDEO_REQ_MULTIPLE_PACKETS2) )
+      return -1;
+   if ( encr_aead_is_sealed_packet(pPacket) )
+   {
+      pRelay->stats.uRetrRequestsSealed++;
+      return -1;
+   }
+
+   int iPos = sizeof(t_packet_header);
+   u32 uRetransmissionId = 0;
+   if ( pPH->packet_type == PACKET_TYPE_VIDEO_REQ_MULTIPLE_PACKETS2 )
+   {
+      if ( pPH->total_length < iPos + sizeof(u32) )
+         return -1;
+      memcpy(&uRetransmissionId, pPacket + iPos, sizeof(u32));
+      iPos += sizeof(u32);
+   }
+   if ( (pPH->total_length > iLength) || (pPH->total_length < iPos + 2) )
+      return -1;
+
+   int iCount = pPacket[iPos+1];
+   int iEntriesPos = iPos + 2;
+   int iTrailingPos = iEntriesPos + iCount*6;
+   if ( iTrailingPos > pPH->total_length )
+      return -1;
+
+   pRelay->stats.uRetrRequests++;
+
+   // The request for the relayed vehicle: same headers and id, only the entries the relay can't answer, same link stats after them
+   memcpy(pOutRequest, pPacket, iEntriesPos);
+   int iOutCount = 0;
+   u8* pEntry = pPacket + iEntriesPos;
+   for( int i=0; i<iCount; i++, pEntry += 6 )
+   {
+      u32 uBlockIndex = 0;
+      memcpy(&uBlockIndex, pEntry, sizeof(u32));
+      int iPacketIndex = pEntry[4];
+      pRelay->stats.uRetrPacketsRequested++;
+
+      t_relay_video_block* pBlock = &(pRelay->blocks[uBlockIndex % RELAY_VIDEO_BLOCKS_MAX_BLOCKS]);
+      if ( pBlock->uBlockIndex == uBlockIndex )
+      {
+         if ( ((iPacketIndex < pBlock->iDataPackets) && pBlock->uReceived[iPacketIndex]) ||
+              (pBlock->bDataComplete && (iPacketIndex >= pBlock->iDataPackets) && (iPacketIndex < pBlock->iDataPackets + pBlock->iFecPacketsOut)) )
+         {
+            pRelay->stats.uRetrPacketsFromCache++;
+            _relay_video_blocks_send(pRelay, pBlock, iPacketIndex, 1, uRetransmissionId);
+            continue;
+         }
+         // FEC packets of the relayed vehicle are numbered for its own FEC scheme
+         if ( iPacketIndex >= pBlock->iDataPackets + pBlock->iFecPacketsIn )
+            continue;
+      }
+      memcpy(pOutRequest + iEntriesPos + iOutCount*6, pEntry, 6);
+      iOutCount++;
+      pRelay->stats.uRetrPacketsForwarded++;
+   }
+
+   if ( 0 == iOutCount )
+      return 0;
+
+   int iTrailingLength = pPH->total_length - iTrailingPos;
+   int iOutLength = iEntriesPos + iOutCount*6;
+   if ( iTrailingLength > 0 )
+      memcpy(pOutRequest + iOutLength, pPacket + iTrailingPos, iTrailingLength);
+   iOutLength += iTrailingLength;
+
+   t_packet_header* pPHOut = (t_packet_header*)pOutRequest;
+   pOutRequest[iPos+1] = (u8)iOutCount;
+   pPHOut->total_length = iOutLength;
+   if ( pPHOut->packet_flags & PACKET_FLAGS_BIT_HEADERS_ONLY_CRC )
+      packet_compute_crc(pOutRequest, pPHOut->total_headers_length);
+   else
+      packet_compute_crc(pOutRequest, pPHOut->total_length);
+   return iOutLength;
+}
+
+void relay_video_blocks_log_stats(t_relay_video_blocks* pRelay)
+{
+   if ( NULL == pRelay )
+      return;
+   t_relay_video_blocks_stats* pStats = &(pRelay->stats);
+   log_line("[RelayVideoBlocks] Packets in: %u (%u duplicate, %u too old, %u invalid), %u sealed forwarded, out: %u (%u recovered data, %u FEC)",
+      pStats->uPacketsIn, pStats->uPacketsDuplicate, pStats->uPacketsTooOld, pStats->uPacketsInvalid, pStats->uPacketsSealed,
+      pStats->uPacketsOut, pStats->uDataPacketsRecovered, pStats->uFecPacketsOut);
+   log_line("[RelayVideoBlocks] Blocks complete: %u, recovered: %u, incomplete: %u; retransmissions: %u requests (%u sealed forwarded), %u packets requested, %u from cache, %u requested from relayed vehicle",
+      pStats->uBlocksComplete, pStats->uBlocksRecovered, pStats->uBlocksIncomplete,
+      pStats->uRetrRequests, pStats->uRetrRequestsSealed, pStats->uRetrPacketsRequested, pStats->uRetrPacketsFromCache, pStats->uRetrPacketsForwarded);
+}
@@ -0,0 +1,93 @@
+#pragma once
+#include "../base/base.h"
+#include "../radio/radiopackets2.h"
+
+// Video blocks relaying: instead of forwarding the relayed vehicle video packets as they are received,
+// the relay vehicle rebuilds each video block. Data packets are forwarded to the controller as soon as
+// they are received; once enough packets of a block are in, the missing data packets are recovered
+// with FEC and sent, followed by new FEC packets computed for the relay -> controller hop.
+// The rebuilt blocks are kept, so the controller retransmission requests are answered by the relay;
+// only the packets the relay doesn't have are requested from the relayed vehicle.
+// Sealed (encrypted) packets are forwarded as they are, both ways: their stream index and video headers are
+// authenticated end to end, so the relay can't rebuild or renumber them.
+
+#define RELAY_VIDEO_BLOCKS_MAX_BLOCKS 64 // blocks kept for reassembly and retransmissions
+#define RELAY_VIDEO_BLOCKS_MAX_HEADERS 64
+#define RELAY_VIDEO_BLOCKS_SAME_FECS (-1)
+
+typedef struct
+{
+   u32 uPacketsIn;
+   u32 uPacketsDuplicate;
+   u32 uPacketsTooOld; // for blocks already replaced in the cache
+   u32 uPacketsInvalid;
+   u32 uPacketsSealed; // encrypted video packets, forwarded as they are
+   u32 uPacketsOut;
+   u32 uDataPacketsRecovered; // data packets rebuilt with FEC on the relay
+   u32 uFecPacketsOut;
+   u32 uBlocksComplete; // all data packets received
+   u32 uBlocksRecovered; // some data packets rebuilt with FEC
+   u32 uBlocksIncomplete; // replaced in the cache before they could be completed
+   u32 uRetrRequests;
+   u32 uRetrRequestsSealed; // encrypted requests, forwarded as they are
+   u32 uRetrPacketsRequested;
+   u32 uRetrPacketsFromCache;
+   u32 uRetrPacketsForwarded; // requested from the relayed vehicle
+} t_relay_video_blocks_stats;
+
+typedef struct
+{
+   u32 uBlockIndex; // MAX_U32 for a free slot
+   int iDataPackets;
+   int iFecPacketsIn;
+   int iFecPacketsOut;
+   int iPacketLength;
+   int iReceivedData;
+   int iReceivedFec;
+   int bDataComplete; // all data packets received or recovered, FEC packets for the next hop computed
+   int bRecovered;
+   int bHeadersFromRetransmission;
+   int iHeadersLength;
+   u8 uHeaders[RELAY_VIDEO_BLOCKS_MAX_HEADERS]; // packet and video headers of a received packet of this block
+   u8 uReceived[MAX_TOTAL_PACKETS_IN_BLOCK];
+   u8* pPayloads; // data, received FEC, then next hop FEC payloads
+   int iPayloadsSize;
+} t_relay_video_block;
+
+typedef void (*relay_video_blocks_send_packet)(u8* pPacket, int iLength, void* pContext);
+
+typedef struct
+{
+   int iFecPacketsOut; // FEC packets per block on the relay -> controller hop, or RELAY_VIDEO_BLOCKS_SAME_FECS
+   relay_video_blocks_send_packet pfSend;
+   void* pSendContext;
+   u32 uStreamPacketIndex;
+   t_relay_video_block blocks[RELAY_VIDEO_BLOCKS_MAX_BLOCKS];
+   t_relay_video_blocks_stats stats;
+} t_relay_video_blocks;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+t_relay_video_blocks* relay_video_blocks_create(int iFecPacketsOut, relay_video_blocks_send_packet pfSend, void* pContext);
+void relay_video_blocks_destroy(t_relay_video_blocks* pRelay);
+// Applies to the blocks started after this call
+void relay_video_blocks_set_fec_packets(t_relay_video_blocks* pRelay, int iFecPacketsOut);
+void relay_video_blocks_reset(t_relay_video_blocks* pRelay);
+
+// Takes a video data packet (CRC already checked) received from the relayed vehicle.
+// Returns 1 if the packet was handled, 0 if it's not a video data packet or it's sealed (forward it as is).
+int relay_video_blocks_on_packet(t_relay_video_blocks* pRelay, u8* pPacket, int iLength);
+
+// Takes a video retransmission request from the controller to the relayed vehicle and sends the requested
+// packets that are in the cache. The packets still missing are written to pOutRequest as a request for the
+// relayed vehicle (same request id). Returns its length, 0 if nothing has to be requested from the relayed vehicle,
+// -1 if the packet is not a video retransmission request or it's sealed (forward it as is).
+int relay_video_blocks_on_retransmission_request(t_relay_video_blocks* pRelay, u8* pPacket, int iLength, u8* pOutRequest);
+
+void relay_video_blocks_log_stats(t_relay_video_blocks* pRelay);
+
+#ifdef __cplusplus
+}
+#endif
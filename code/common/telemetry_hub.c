@@ -0,0 +1,740 @@
+/*
+You can use this C/C++ code however you wish (for example, but not limited to:
+     as is, or by modifying it, or by adding new code, or by removing parts of the code;
+     in public or private projects, in new free or commercial products)
+     only if you get a priori written consent from Petru Soroaga (petrusoroaga@yahoo.com) for your specific use
+     and only if this copyright terms are preserved in the code.
+     This code is public for learning and academic purposes.
+Also, check the licences folder for additional licences terms.
+Code written by: Petru Soroaga, 2021-2023
+*/
+
+#include "../base/base.h"
+#include "../../mavlink/common/mavlink.h"
+#include "telemetry_transport.h"
+#include "telemetry_hub.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define TELEMETRY_HUB_NO_MSG_ID MAX_U32
+
+static void _th_set_non_blocking(int iFd)
+{
+   int iFlags = fcntl(iFd, F_GETFL, 0);
+   if ( iFlags >= 0 )
+      fcntl(iFd, F_SETFL, iFlags | O_NONBLOCK);
+}
+
+// Length of the next unit at pData: a MAVLink frame (from its header) or the bytes up to the next frame start.
+// Returns 0 if the frame is incomplete
+static int _th_get_unit(const u8* pData, int iLength, u32* pMsgId, u16* pSource)
+{
+   *pMsgId = TELEMETRY_HUB_NO_MSG_ID;
+   if ( pData[0] == MAVLINK_STX )
+   {
+      if ( iLength < 10 )
+         return 0;
+      int iFrameLength = 10 + pData[1] + MAVLINK_NUM_CHECKSUM_BYTES;
+      if ( pData[2] & MAVLINK_IFLAG_SIGNED )
+         iFrameLength += MAVLINK_SIGNATURE_BLOCK_LEN;
+      if ( iFrameLength > iLength )
+         return 0;
+      *pMsgId = ((u32)pData[7]) | (((u32)pData[8])<<8) | (((u32)pData[9])<<16);
+      *pSource = (((u16)pData[5])<<8) | pData[6];
+      return iFrameLength;
+   }
+   if ( pData[0] == MAVLINK_STX_MAVLINK1 )
+   {
+      if ( iLength < 6 )
+         return 0;
+      int iFrameLength = 6 + pData[1] + MAVLINK_NUM_CHECKSUM_BYTES;
+      if ( iFrameLength > iLength )
+         return 0;
+      *pMsgId = pData[5];
+      *pSource = (((u16)pData[3])<<8) | pData[4];
+      return iFrameLength;
+   }
+   int iPos = 1;
+   while ( (iPos < iLength) && (pData[iPos] != MAVLINK_STX) && (pData[iPos] != MAVLINK_STX_MAVLINK1) )
+      iPos++;
+   return iPos;
+}
+
+static void _th_reset_client(t_telemetry_hub_client* pClient)
+{
+   memset(pClient, 0, sizeof(t_telemetry_hub_client));
+   pClient->iFd = -1;
+   pClient->iMaxDatagram = TELEMETRY_HUB_MAX_DATAGRAM;
+}
+
+void telemetry_hub_init(t_telemetry_hub* pHub, telemetry_hub_uplink_callback pfUplink, void* pUplinkContext)
+{
+   if ( NULL == pHub )
+      return;
+   memset(pHub, 0, sizeof(t_telemetry_hub));
+   for( int i=0; i<TELEMETRY_HUB_MAX_CLIENTS; i++ )
+      _th_reset_client(&(pHub->clients[i]));
+   pHub->iUDPServerFd = -1;
+   pHub->iTCPServerFd = -1;
+   pHub->pfUplink = pfUplink;
+   pHub->pUplinkContext = pUplinkContext;
+}
+
+void telemetry_hub_close(t_telemetry_hub* pHub)
+{
+   if ( NULL == pHub )
+      return;
+   for( int i=0; i<TELEMETRY_HUB_MAX_CLIENTS; i++ )
+      telemetry_hub_remove_client(pHub, i);
+   telemetry_hub_stop_listening(pHub);
+}
+
+void telemetry_hub_set_mavlink(t_telemetry_hub* pHub, int bMAVLink)
+{
+   if ( (NULL == pHub) || (pHub->bMAVLink == bMAVLink) )
+      return;
+   pHub->bMAVLink = bMAVLink;
+   pHub->iDownlinkBytes = 0;
+   for( int i=0; i<TELEMETRY_HUB_MAX_CLIENTS; i++ )
+      pHub->clients[i].iUplinkBytes = 0;
+}
+
+static int _th_open_server(int iType, int iPort, int* piBoundPort)
+{
+   int iFd = socket(AF_INET, iType, 0);
+   if ( iFd < 0 )
+      return -1;
+   int iOne = 1;
+   setsockopt(iFd, SOL_SOCKET, SO_REUSEADDR, &iOne, sizeof(iOne));
+
+   struct sockaddr_in addr;
+   memset(&addr, 0, sizeof(addr));
+   addr.sin_family = AF_INET;
+   addr.sin_addr.s_addr = htonl(INADDR_ANY);
+   addr.sin_port = htons(iPort);
+   if ( bind(iFd, (struct sockaddr*)&addr, sizeof(addr)) < 0 )
+   {
+      close(iFd);
+      return -1;
+   }
+   if ( (iType == SOCK_STREAM) && (listen(iFd, 4) < 0) )
+   {
+      close(iFd);
+      return -1;
+   }
+   socklen_t iAddrLen = sizeof(addr);
+   if ( 0 == getsockname(iFd, (struct sockaddr*)&addr, &iAddrLen) )
+      *piBoundPort = ntohs(addr.sin_port);
+   else
+      *piBoundPort = iPort;
+   _th_set_non_blocking(iFd);
+   return iFd;
+}
+
+int telemetry_hub_listen_udp(t_telemetry_hub* pHub, int iPort)
+{
+   if ( (NULL == pHub) || (-1 != pHub->iUDPServerFd) )
+      return 0;
+   pHub->iUDPServerFd = _th_open_server(SOCK_DGRAM, iPort, &pHub->iUDPServerPort);
+   if ( pHub->iUDPServerFd < 0 )
+   {
+      log_softerror_and_alarm("[TelemetryHub] Failed to listen for UDP clients on port %d, error: %s", iPort, strerror(errno));
+      return 0;
+   }
+   log_line("[TelemetryHub] Listening for UDP clients on port %d.", pHub->iUDPServerPort);
+   return 1;
+}
+
+int telemetry_hub_listen_tcp(t_telemetry_hub* pHub, int iPort)
+{
+   if ( (NULL == pHub) || (-1 != pHub->iTCPServerFd) )
+      return 0;
+   pHub->iTCPServerFd = _th_open_server(SOCK_STREAM, iPort, &pHub->iTCPServerPort);
+   if ( pHub->iTCPServerFd < 0 )
+   {
+      log_softerror_and_alarm("[TelemetryHub] Failed to listen for TCP clients on port %d, error: %s", iPort, strerror(errno));
+      return 0;
+   }
+   log_line("[TelemetryHub] Listening for TCP clients on port %d.", pHub->iTCPServerPort);
+   return 1;
+}
+
+void telemetry_hub_stop_listening(t_telemetry_hub* pHub)
+{
+   if ( NULL == pHub )
+      return;
+   for( int i=0; i<TELEMETRY_HUB_MAX_CLIENTS; i++ )
+   {
+      if ( pHub->clients[i].bUsed )
+      if ( (pHub->clients[i].iType == TELEMETRY_HUB_CLIENT_UDP_REMOTE) || (pHub->clients[i].iType == TELEMETRY_HUB_CLIENT_TCP) )
+         telemetry_hub_remove_client(pHub, i);
+   }
+   if ( -1 != pHub->iUDPServerFd )
+      close(pHub->iUDPServerFd);
+   if ( -1 != pHub->iTCPServerFd )
+      close(pHub->iTCPServerFd);
+   pHub->iUDPServerFd = -1;
+   pHub->iTCPServerFd = -1;
+   pHub->iUDPServerPort = 0;
+   pHub->iTCPServerPort = 0;
+}
+
+static int _th_alloc_client(t_telemetry_hub* pHub, int iType, u32 uFlags, const char* szName)
+{
+   for( int i=0; i<TELEMETRY_HUB_MAX_CLIENTS; i++ )
+   {
+      if ( pHub->clients[i].bUsed )
+         continue;
+      t_telemetry_hub_client* pClient = &(pHub->clients[i]);
+      _th_reset_client(pClient);
+      pClient->bUsed = 1;
+      pClient->iType = iType;
+      pClient->uFlags = uFlags;
+      if ( NULL != szName )
+         strncpy(pClient->szName, szName, sizeof(pClient->szName)-1);
+      if ( (iType == TELEMETRY_HUB_CLIENT_UDP_REMOTE) || (iType == TELEMETRY_HUB_CLIENT_TCP) )
+         pClient->uMaxStreamRateHz = pHub->uRemoteClientsMaxStreamRateHz;
+      return i;
+   }
+   pHub->uClientsRejected++;
+   log_softerror_and_alarm("[TelemetryHub] No free client slot (max %d clients) for client %s.", TELEMETRY_HUB_MAX_CLIENTS, (NULL != szName)?szName:"");
+   return -1;
+}
+
+int telemetry_hub_add_udp_client(t_telemetry_hub* pHub, const char* szIP, int iPort, u32 uFlags, int iMaxDatagram, const char* szName)
+{
+   if ( (NULL == pHub) || (NULL == szIP) || (0 == szIP[0]) )
+      return -1;
+   int iFd = socket(AF_INET, SOCK_DGRAM, 0);
+   if ( iFd < 0 )
+   {
+      log_softerror_and_alarm("[TelemetryHub] Failed to create UDP socket for client %s:%d", szIP, iPort);
+      return -1;
+   }
+   int iClientId = _th_alloc_client(pHub, TELEMETRY_HUB_CLIENT_UDP, uFlags, szName);
+   if ( iClientId < 0 )
+   {
+      close(iFd);
+      return -1;
+   }
+   _th_set_non_blocking(iFd);
+   t_telemetry_hub_client* pClient = &(pHub->clients[iClientId]);
+   pClient->iFd = iFd;
+   pClient->bOwnsFd = 1;
+   pClient->sockAddr.sin_family = AF_INET;
+   pClient->sockAddr.sin_addr.s_addr = inet_addr(szIP);
+   pClient->sockAddr.sin_port = htons(iPort);
+   if ( (iMaxDatagram > 0) && (iMaxDatagram <= TELEMETRY_HUB_CLIENT_BUFFER) )
+      pClient->iMaxDatagram = iMaxDatagram;
+   log_line("[TelemetryHub] Added UDP client %s (%s:%d), id %d.", pClient->szName, szIP, iPort, iClientId);
+   return iClientId;
+}
+
+int telemetry_hub_add_serial(t_telemetry_hub* pHub, int iFd, u32 uFlags, const char* szName)
+{
+   if ( (NULL == pHub) || (iFd < 0) )
+      return -1;
+   int iClientId = _th_alloc_client(pHub, TELEMETRY_HUB_CLIENT_SERIAL, uFlags, szName);
+   if ( iClientId < 0 )
+      return -1;
+   _th_set_non_blocking(iFd);
+   pHub->clients[iClientId].iFd = iFd;
+   pHub->clients[iClientId].bOwnsFd = 0;
+   log_line("[TelemetryHub] Added serial client %s, id %d, downlink: %s, uplink: %s.", pHub->clients[iClientId].szName, iClientId,
+      (uFlags & TELEMETRY_HUB_FLAG_DOWNLINK)?"yes":"no", (uFlags & TELEMETRY_HUB_FLAG_UPLINK)?"yes":"no");
+   return iClientId;
+}
+
+void telemetry_hub_remove_client(t_telemetry_hub* pHub, int iClientId)
+{
+   if ( (NULL == pHub) || (iClientId < 0) || (iClientId >= TELEMETRY_HUB_MAX_CLIENTS) )
+      return;
+   t_telemetry_hub_client* pClient = &(pHub->clients[iClientId]);
+   if ( ! pClient->bUsed )
+      return;
+   log_line("[TelemetryHub] Removed client %s, id %d (sent %u bytes, dropped %u bytes, received %u bytes).",
+      pClient->szName, iClientId, pClient->stats.uBytesSent, pClient->stats.uBytesDropped, pClient->stats.uBytesReceived);
+   if ( pClient->bOwnsFd && (-1 != pClient->iFd) )
+      close(pClient->iFd);
+   _th_reset_client(pClient);
+}
+
+int telemetry_hub_get_clients_count(t_telemetry_hub* pHub)
+{
+   if ( NULL == pHub )
+      return 0;
+   int iCount = 0;
+   for( int i=0; i<TELEMETRY_HUB_MAX_CLIENTS; i++ )
+   {
+      if ( pHub->clients[i].bUsed )
+         iCount++;
+   }
+   return iCount;
+}
+
+void telemetry_hub_set_client_rate_filter(t_telemetry_hub* pHub, int iClientId, u32 uMaxStreamRateHz)
+{
+   if ( (NULL == pHub) || (iClientId < 0) || (iClientId >= TELEMETRY_HUB_MAX_CLIENTS) )
+      return;
+   t_telemetry_hub_client* pClient = &(pHub->clients[iClientId]);
+   pClient->uMaxStreamRateHz = uMaxStreamRateHz;
+   pClient->iFilterCount = 0;
+}
+
+void telemetry_hub_set_remote_clients_rate_filter(t_telemetry_hub* pHub, u32 uMaxStreamRateHz)
+{
+   if ( NULL == pHub )
+      return;
+   pHub->uRemoteClientsMaxStreamRateHz = uMaxStreamRateHz;
+   for( int i=0; i<TELEMETRY_HUB_MAX_CLIENTS; i++ )
+   {
+      if ( pHub->clients[i].bUsed )
+      if ( (pHub->clients[i].iType == TELEMETRY_HUB_CLIENT_UDP_REMOTE) || (pHub->clients[i].iType == TELEMETRY_HUB_CLIENT_TCP) )
+         telemetry_hub_set_client_rate_filter(pHub, i, uMaxStreamRateHz);
+   }
+}
+
+// Returns 0 if the stream frame must be skipped for this client
+static int _th_filter_pass(t_telemetry_hub_client* pClient, u32 uMsgId, u16 uSource, u32 uTimeNow)
+{
+   u32 uKey = (uMsgId & 0xFFFFFF) | (((u32)(uSource >> 8)) << 24);
+   int iIndex = 0;
+   for( iIndex=0; iIndex<pClient->iFilterCount; iIndex++ )
+   {
+      if ( pClient->uFilterMsgIds[iIndex] == uKey )
+         break;
+   }
+   if ( iIndex >= pClient->iFilterCount )
+   {
+      // Table full: the message is not rate limited
+      if ( pClient->iFilterCount >= TELEMETRY_HUB_MAX_FILTERED_IDS )
+         return 1;
+      pClient->uFilterMsgIds[iIndex] = uKey;
+      pClient->uFilterTimeLastSent[iIndex] = uTimeNow;
+      pClient->iFilterCount++;
+      return 1;
+   }
+   if ( uTimeNow - pClient->uFilterTimeLastSent[iIndex] < 1000/pClient->uMaxStreamRateHz )
+      return 0;
+   pClient->uFilterTimeLastSent[iIndex] = uTimeNow;
+   return 1;
+}
+
+// Queues one unit (frame or non frame bytes) to all the downlink clients, whole or not at all
+static void _th_queue_unit(t_telemetry_hub* pHub, const u8* pData, int iLength, u32 uMsgId, u16 uSource, u32 uTimeNow)
+{
+   pHub->uUnitsIn++;
+   int bStream = (uMsgId != TELEMETRY_HUB_NO_MSG_ID) && (telemetry_transport_get_message_class(uMsgId) == TELEMETRY_TRANSPORT_CLASS_STREAM);
+
+   for( int i=0; i<TELEMETRY_HUB_MAX_CLIENTS; i++ )
+   {
+      t_telemetry_hub_client* pClient = &(pHub->clients[i]);
+      if ( (! pClient->bUsed) || (! (pClient->uFlags & TELEMETRY_HUB_FLAG_DOWNLINK)) )
+         continue;
+      if ( bStream && (0 != pClient->uMaxStreamRateHz) )
+      if ( ! _th_filter_pass(pClient, uMsgId, uSource, uTimeNow) )
+      {
+         pClient->stats.uFramesFiltered++;
+         continue;
+      }
+      if ( pClient->iRingCount + iLength > TELEMETRY_HUB_CLIENT_BUFFER )
+      {
+         pClient->stats.uBytesDropped += iLength;
+         pClient->stats.uUnitsDropped++;
+         continue;
+      }
+      int iEnd = (pClient->iRingStart + pClient->iRingCount) % TELEMETRY_HUB_CLIENT_BUFFER;
+      int iFirst = TELEMETRY_HUB_CLIENT_BUFFER - iEnd;
+      if ( iFirst > iLength )
+         iFirst = iLength;
+      memcpy(&(pClient->uRing[iEnd]), pData, iFirst);
+      if ( iFirst < iLength )
+         memcpy(&(pClient->uRing[0]), pData + iFirst, iLength - iFirst);
+      pClient->iRingCount += iLength;
+      pClient->stats.uBytesQueued += iLength;
+   }
+}
+
+void telemetry_hub_send(t_telemetry_hub* pHub, const u8* pData, int iLength, u32 uTimeNow)
+{
+   if ( (NULL == pHub) || (NULL == pData) || (iLength <= 0) )
+      return;
+   pHub->uBytesIn += iLength;
+
+   if ( ! pHub->bMAVLink )
+   {
+      _th_queue_unit(pHub, pData, iLength, TELEMETRY_HUB_NO_MSG_ID, 0, uTimeNow);
+      return;
+   }
+
+   while ( iLength > 0 )
+   {
+      int iCopy = (int)sizeof(pHub->uDownlinkBuffer) - pHub->iDownlinkBytes;
+      if ( iCopy > iLength )
+         iCopy = iLength;
+      memcpy(&(pHub->uDownlinkBuffer[pHub->iDownlinkBytes]), pData, iCopy);
+      pHub->iDownlinkBytes += iCopy;
+      pData += iCopy;
+      iLength -= iCopy;
+
+      int iPos = 0;
+      while ( iPos < pHub->iDownlinkBytes )
+      {
+         u32 uMsgId = 0;
+         u16 uSource = 0;
+         int iUnit = _th_get_unit(&(pHub->uDownlinkBuffer[iPos]), pHub->iDownlinkBytes - iPos, &uMsgId, &uSource);
+         if ( 0 == iUnit )
+            break;
+         _th_queue_unit(pHub, &(pHub->uDownlinkBuffer[iPos]), iUnit, uMsgId, uSource, uTimeNow);
+         iPos += iUnit;
+      }
+      if ( iPos > 0 )
+      {
+         if ( iPos < pHub->iDownlinkBytes )
+            memmove(pHub->uDownlinkBuffer, &(pHub->uDownlinkBuffer[iPos]), pHub->iDownlinkBytes - iPos);
+         pHub->iDownlinkBytes -= iPos;
+      }
+   }
+}
+
+static void _th_consume(t_telemetry_hub_client* pClient, int iLength)
+{
+   pClient->iRingStart = (pClient->iRingStart + iLength) % TELEMETRY_HUB_CLIENT_BUFFER;
+   pClient->iRingCount -= iLength;
+   pClient->stats.uBytesSent += iLength;
+}
+
+// Returns the bytes written. Returns -1 if the client is gone and must be removed
+static int _th_flush_client(t_telemetry_hub_client* pClient)
+{
+   int iWritten = 0;
+   while ( (pClient->iRingCount > 0) && (iWritten < TELEMETRY_HUB_QUANTUM) )
+   {
+      int iContiguous = TELEMETRY_HUB_CLIENT_BUFFER - pClient->iRingStart;
+      if ( iContiguous > pClient->iRingCount )
+         iContiguous = pClient->iRingCount;
+
+      if ( (pClient->iType == TELEMETRY_HUB_CLIENT_UDP) || (pClient->iType == TELEMETRY_HUB_CLIENT_UDP_REMOTE) )
+      {
+         int iLength = pClient->iRingCount;
+         if ( iLength > pClient->iMaxDatagram )
+            iLength = pClient->iMaxDatagram;
+         u8 uDatagram[TELEMETRY_HUB_CLIENT_BUFFER];
+         const u8* pDatagram = &(pClient->uRing[pClient->iRingStart]);
+         if ( iLength > iContiguous )
+         {
+            memcpy(uDatagram, pDatagram, iContiguous);
+            memcpy(uDatagram + iContiguous, &(pClient->uRing[0]), iLength - iContiguous);
+            pDatagram = uDatagram;
+         }
+         int iRes = sendto(pClient->iFd, pDatagram, iLength, MSG_DONTWAIT, (struct sockaddr*)&(pClient->sockAddr), sizeof(pClient->sockAddr));
+         if ( iRes < 0 )
+         {
+            if ( (errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == ENOBUFS) )
+            {
+               pClient->stats.uWritesBlocked++;
+               break;
+            }
+            // Nobody listening on the other side yet (refused), unreachable...: the datagram is lost
+            pClient->stats.uWriteErrors++;
+            pClient->stats.uBytesDropped += iLength;
+            pClient->iRingStart = (pClient->iRingStart + iLength) % TELEMETRY_HUB_CLIENT_BUFFER;
+            pClient->iRingCount -= iLength;
+            continue;
+         }
+         _th_consume(pClient, iLength);
+         iWritten += iLength;
+         continue;
+      }
+
+      int iLength = iContiguous;
+      if ( iLength > TELEMETRY_HUB_QUANTUM - iWritten )
+         iLength = TELEMETRY_HUB_QUANTUM - iWritten;
+      int iRes = 0;
+      if ( pClient->iType == TELEMETRY_HUB_CLIENT_TCP )
+         iRes = send(pClient->iFd, &(pClient->uRing[pClient->iRingStart]), iLength, MSG_DONTWAIT | MSG_NOSIGNAL);
+      else
+         iRes = write(pClient->iFd, &(pClient->uRing[pClient->iRingStart]), iLength);
+      if ( iRes < 0 )
+      {
+         if ( (errno == EAGAIN) || (errno == EWOULDBLOCK) )
+         {
+            pClient->stats.uWritesBlocked++;
+            break;
+         }
+         pClient->stats.uWriteErrors++;
+         if ( pClient->iType == TELEMETRY_HUB_CLIENT_TCP )
+            return -1;
+         pClient->stats.uBytesDropped += pClient->iRingCount;
+         pClient->iRingCount = 0;
+         break;
+      }
+      _th_consume(pClient, iRes);
+      iWritten += iRes;
+      if ( iRes < iLength )
+      {
+         pClient->stats.uWritesBlocked++;
+         break;
+      }
+   }
+   return iWritten;
+}
+
+int telemetry_hub_flush(t_telemetry_hub* pHub, u32 uTimeNow)
+{
+   if ( NULL == pHub )
+      return 0;
+   int iTotal = 0;
+   for( int k=0; k<TELEMETRY_HUB_MAX_CLIENTS; k++ )
+   {
+      int i = (pHub->iNextFlushClient + k) % TELEMETRY_HUB_MAX_CLIENTS;
+      t_telemetry_hub_client* pClient = &(pHub->clients[i]);
+      if ( ! pClient->bUsed )
+         continue;
+      if ( pClient->iType == TELEMETRY_HUB_CLIENT_UDP_REMOTE )
+      if ( uTimeNow - pClient->uTimeLastReceived > TELEMETRY_HUB_UDP_CLIENT_TIMEOUT_MS )
+      {
+         log_line("[TelemetryHub] UDP client %s timed out.", pClient->szName);
+         telemetry_hub_remove_client(pHub, i);
+         continue;
+      }
+      if ( 0 == pClient->iRingCount )
+         continue;
+      int iRes = _th_flush_client(pClient);
+      if ( iRes < 0 )
+      {
+         log_line("[TelemetryHub] Client %s disconnected (write failed).", pClient->szName);
+         telemetry_hub_remove_client(pHub, i);
+         continue;
+      }
+      iTotal += iRes;
+   }
+   pHub->iNextFlushClient = (pHub->iNextFlushClient + 1) % TELEMETRY_HUB_MAX_CLIENTS;
+   return iTotal;
+}
+
+// Routes uplink data read from a client. Returns the bytes routed
+static int _th_on_client_data(t_telemetry_hub* pHub, int iClientId, const u8* pData, int iLength)
+{
+   t_telemetry_hub_client* pClient = &(pHub->clients[iClientId]);
+   pClient->stats.uBytesReceived += iLength;
+   if ( ! (pClient->uFlags & TELEMETRY_HUB_FLAG_UPLINK) )
+   {
+      pClient->stats.uBytesRejected += iLength;
+      return 0;
+   }
+   pHub->uBytesUplink += iLength;
+
+   if ( ! pHub->bMAVLink )
+   {
+      if ( NULL != pHub->pfUplink )
+         pHub->pfUplink(pData, iLength, iClientId, pHub->pUplinkContext);
+      return iLength;
+   }
+
+   int iTotal = iLength;
+   while ( iLength > 0 )
+   {
+      int iCopy = (int)sizeof(pClient->uUplinkBuffer) - pClient->iUplinkBytes;
+      if ( iCopy > iLength )
+         iCopy = iLength;
+      memcpy(&(pClient->uUplinkBuffer[pClient->iUplinkBytes]), pData, iCopy);
+      pClient->iUplinkBytes += iCopy;
+      pData += iCopy;
+      iLength -= iCopy;
+
+      int iPos = 0;
+      while ( iPos < pClient->iUplinkBytes )
+      {
+         u32 uMsgId = 0;
+         u16 uSource = 0;
+         int iUnit = _th_get_unit(&(pClient->uUplinkBuffer[iPos]), pClient->iUplinkBytes - iPos, &uMsgId, &uSource);
+         if ( 0 == iUnit )
+            break;
+         if ( NULL != pHub->pfUplink )
+            pHub->pfUplink(&(pClient->uUplinkBuffer[iPos]), iUnit, iClientId, pHub->pUplinkContext);
+         iPos += iUnit;
+      }
+      if ( iPos > 0 )
+      {
+         if ( iPos < pClient->iUplinkBytes )
+            memmove(pClient->uUplinkBuffer, &(pClient->uUplinkBuffer[iPos]), pClient->iUplinkBytes - iPos);
+         pClient->iUplinkBytes -= iPos;
+      }
+   }
+   return iTotal;
+}
+
+static void _th_accept_tcp_client(t_telemetry_hub* pHub, u32 uTimeNow)
+{
+   struct sockaddr_in addr;
+   socklen_t iAddrLen = sizeof(addr);
+   int iFd = accept(pHub->iTCPServerFd, (struct sockaddr*)&addr, &iAddrLen);
+   if ( iFd < 0 )
+      return;
+   char szName[32];
+   snprintf(szName, sizeof(szName), "tcp %s:%d", inet_ntoa(addr.sin_addr), ntohs(addr.sin_port));
+   int iClientId = _th_alloc_client(pHub, TELEMETRY_HUB_CLIENT_TCP, TELEMETRY_HUB_FLAG_DOWNLINK | TELEMETRY_HUB_FLAG_UPLINK, szName);
+   if ( iClientId < 0 )
+   {
+      close(iFd);
+      return;
+   }
+   int iOne = 1;
+   setsockopt(iFd, IPPROTO_TCP, TCP_NODELAY, &iOne, sizeof(iOne));
+   // A small kernel buffer, so a slow client backs up into its ring (and drops old data there) instead of
+   // piling up seconds of stale telemetry in the socket
+   int iSendBuffer = TELEMETRY_HUB_CLIENT_BUFFER;
+   setsockopt(iFd, SOL_SOCKET, SO_SNDBUF, &iSendBuffer, sizeof(iSendBuffer));
+   _th_set_non_blocking(iFd);
+   pHub->clients[iClientId].iFd = iFd;
+   pHub->clients[iClientId].bOwnsFd = 1;
+   pHub->clients[iClientId].uTimeLastReceived = uTimeNow;
+   log_line("[TelemetryHub] Accepted TCP client %s, id %d.", szName, iClientId);
+}
+
+static int _th_read_udp_server(t_telemetry_hub* pHub, u32 uTimeNow)
+{
+   int iTotal = 0;
+   u8 uBuffer[TELEMETRY_HUB_QUANTUM];
+   while ( iTotal < TELEMETRY_HUB_QUANTUM )
+   {
+      struct sockaddr_in addr;
+      socklen_t iAddrLen = sizeof(addr);
+      int iRes = recvfrom(pHub->iUDPServerFd, uBuffer, sizeof(uBuffer), MSG_DONTWAIT, (struct sockaddr*)&addr, &iAddrLen);
+      if ( iRes <= 0 )
+         break;
+
+      int iClientId = -1;
+      for( int i=0; i<TELEMETRY_HUB_MAX_CLIENTS; i++ )
+      {
+         t_telemetry_hub_client* pClient = &(pHub->clients[i]);
+         if ( pClient->bUsed && (pClient->iType == TELEMETRY_HUB_CLIENT_UDP_REMOTE) )
+         if ( (pClient->sockAddr.sin_addr.s_addr == addr.sin_addr.s_addr) && (pClient->sockAddr.sin_port == addr.sin_port) )
+         {
+            iClientId = i;
+            break;
+         }
+      }
+      if ( -1 == iClientId )
+      {
+         char szName[32];
+         snprintf(szName, sizeof(szName), "udp %s:%d", inet_ntoa(addr.sin_addr), ntohs(addr.sin_port));
+         iClientId = _th_alloc_client(pHub, TELEMETRY_HUB_CLIENT_UDP_REMOTE, TELEMETRY_HUB_FLAG_DOWNLINK | TELEMETRY_HUB_FLAG_UPLINK, szName);
+         if ( iClientId < 0 )
+            continue;
+         pHub->clients[iClientId].iFd = pHub->iUDPServerFd;
+         pHub->clients[iClientId].bOwnsFd = 0;
+         memcpy(&(pHub->clients[iClientId].sockAddr), &addr, sizeof(addr));
+         log_line("[TelemetryHub] New UDP client %s, id %d.", szName, iClientId);
+      }
+      pHub->clients[iClientId].uTimeLastReceived = uTimeNow;
+      iTotal += _th_on_client_data(pHub, iClientId, uBuffer, iRes);
+   }
+   return iTotal;
+}
+
+int telemetry_hub_poll(t_telemetry_hub* pHub, int iTimeoutMicroSec, u32 uTimeNow)
+{
+   if ( NULL == pHub )
+      return 0;
+
+   fd_set readset;
+   FD_ZERO(&readset);
+   int iMaxFd = -1;
+   if ( -1 != pHub->iUDPServerFd )
+   {
+      FD_SET(pHub->iUDPServerFd, &readset);
+      if ( pHub->iUDPServerFd > iMaxFd )
+         iMaxFd = pHub->iUDPServerFd;
+   }
+   if ( -1 != pHub->iTCPServerFd )
+   {
+      FD_SET(pHub->iTCPServerFd, &readset);
+      if ( pHub->iTCPServerFd > iMaxFd )
+         iMaxFd = pHub->iTCPServerFd;
+   }
+   for( int i=0; i<TELEMETRY_HUB_MAX_CLIENTS; i++ )
+   {
+      t_telemetry_hub_client* pClient = &(pHub->clients[i]);
+      if ( (! pClient->bUsed) || (pClient->iFd < 0) || (pClient->iType == TELEMETRY_HUB_CLIENT_UDP_REMOTE) )
+         continue;
+      // TCP clients are always read, to find out when they disconnect
+      if ( (pClient->iType != TELEMETRY_HUB_CLIENT_TCP) && (! (pClient->uFlags & TELEMETRY_HUB_FLAG_UPLINK)) )
+         continue;
+      FD_SET(pClient->iFd, &readset);
+      if ( pClient->iFd > iMaxFd )
+         iMaxFd = pClient->iFd;
+   }
+   if ( iMaxFd < 0 )
+      return 0;
+
+   struct timeval to;
+   to.tv_sec = iTimeoutMicroSec / 1000000;
+   to.tv_usec = iTimeoutMicroSec % 1000000;
+   if ( select(iMaxFd+1, &readset, NULL, NULL, &to) <= 0 )
+      return 0;
+
+   int iTotal = 0;
+   if ( (-1 != pHub->iTCPServerFd) && FD_ISSET(pHub->iTCPServerFd, &readset) )
+      _th_accept_tcp_client(pHub, uTimeNow);
+   if ( (-1 != pHub->iUDPServerFd) && FD_ISSET(pHub->iUDPServerFd, &readset) )
+      iTotal += _th_read_udp_server(pHub, uTimeNow);
+
+   u8 uBuffer[TELEMETRY_HUB_QUANTUM];
+   for( int k=0; k<TELEMETRY_HUB_MAX_CLIENTS; k++ )
+   {
+      int i = (pHub->iNextPollClient + k) % TELEMETRY_HUB_MAX_CLIENTS;
+      t_telemetry_hub_client* pClient = &(pHub->clients[i]);
+      if ( (! pClient->bUsed) || (pClient->iFd < 0) || (pClient->iType == TELEMETRY_HUB_CLIENT_UDP_REMOTE) )
+         continue;
+      if ( ! FD_ISSET(pClient->iFd, &readset) )
+         continue;
+      int iRes = read(pClient->iFd, uBuffer, sizeof(uBuffer));
+      if ( (0 == iRes) && (pClient->iType == TELEMETRY_HUB_CLIENT_TCP) )
+      {
+         log_line("[TelemetryHub] Client %s disconnected.", pClient->szName);
+         telemetry_hub_remove_client(pHub, i);
+         continue;
+      }
+      if ( iRes < 0 )
+      {
+         if ( (errno != EAGAIN) && (errno != EWOULDBLOCK) && (pClient->iType == TELEMETRY_HUB_CLIENT_TCP) )
+         {
+            log_line("[TelemetryHub] Client %s disconnected (read failed).", pClient->szName);
+            telemetry_hub_remove_client(pHub, i);
+         }
+         continue;
+      }
+      if ( iRes > 0 )
+      {
+         pClient->uTimeLastReceived = uTimeNow;
+         iTotal += _th_on_client_data(pHub, i, uBuffer, iRes);
+      }
+   }
+   pHub->iNextPollClient = (pHub->iNextPollClient + 1) % TELEMETRY_HUB_MAX_CLIENTS;
+   return iTotal;
+}
+
+void telemetry_hub_log_stats(t_telemetry_hub* pHub)
+{
+   if ( NULL == pHub )
+      return;
+   log_line("[TelemetryHub] %d clients, downlink: %u bytes in %u units, uplink: %u bytes, clients rejected: %u",
+      telemetry_hub_get_clients_count(pHub), pHub->uBytesIn, pHub->uUnitsIn, pHub->uBytesUplink, pHub->uClientsRejected);
+   for( int i=0; i<TELEMETRY_HUB_MAX_CLIENTS; i++ )
+   {
+      t_telemetry_hub_client* pClient = &(pHub->clients[i]);
+      if ( ! pClient->bUsed )
+         continue;
+      log_line("[TelemetryHub] client %d (%s): queued: %u, sent: %u, dropped: %u bytes (%u units), filtered: %u frames, blocked writes: %u, errors: %u, received: %u bytes (%u rejected)",
+         i, pClient->szName, pClient->stats.uBytesQueued, pClient->stats.uBytesSent, pClient->stats.uBytesDropped, pClient->stats.uUnitsDropped,
+         pClient->stats.uFramesFiltered, pClient->stats.uWritesBlocked, pClient->stats.uWriteErrors, pClient->stats.uBytesReceived, pClient->stats.uBytesRejected);
+   }
+}
@@ -0,0 +1,137 @@
+#pragma once
+#include "../base/base.h"
+#include <netinet/in.h>
+
+// Telemetry hub on the controller: fans out the telemetry received from the vehicle to any number of
+// clients (the serial port, fixed UDP destinations like the USB tethered device, GCSes that connect over
+// UDP or TCP) and routes the data received from any of them up to the vehicle.
+// Each client has its own ring buffer and is written with non blocking writes: a slow or stuck client
+// only loses its own data (counted in its stats), it never blocks the other clients or the caller.
+// With MAVLink telemetry the data is cut on frame boundaries: a frame is queued whole or dropped whole,
+// the uplink frames of different clients never interleave and a client can have a max rate for the
+// stream messages (transactional messages always pass, see telemetry_transport_get_message_class).
+// Bytes that are not MAVLink frames are passed on as they are.
+
+#define TELEMETRY_HUB_MAX_CLIENTS 16
+#define TELEMETRY_HUB_CLIENT_BUFFER 8192 // downlink bytes queued for one client
+#define TELEMETRY_HUB_MAX_FRAME 280
+#define TELEMETRY_HUB_MAX_DATAGRAM 1024 // default max size of the UDP datagrams sent to clients
+#define TELEMETRY_HUB_QUANTUM 2048 // max bytes written to or read from one client in one flush/poll, so all get a turn
+#define TELEMETRY_HUB_UDP_CLIENT_TIMEOUT_MS 10000 // UDP clients learned from the received datagrams are dropped after this much silence
+#define TELEMETRY_HUB_MAX_FILTERED_IDS 32 // stream messages tracked by the rate filter of a client
+
+#define TELEMETRY_HUB_CLIENT_SERIAL 0
+#define TELEMETRY_HUB_CLIENT_UDP 1 // fixed destination
+#define TELEMETRY_HUB_CLIENT_UDP_REMOTE 2 // learned by the UDP server from the datagrams it receives
+#define TELEMETRY_HUB_CLIENT_TCP 3 // accepted by the TCP server
+
+#define TELEMETRY_HUB_FLAG_DOWNLINK 0x01 // gets the telemetry from the vehicle
+#define TELEMETRY_HUB_FLAG_UPLINK 0x02 // the data read from it goes to the vehicle
+
+// Uplink data, from one client. In MAVLink mode it's one whole frame (or a run of non frame bytes)
+typedef void (*telemetry_hub_uplink_callback)(const u8* pData, int iLength, int iClientId, void* pContext);
+
+typedef struct
+{
+   u32 uBytesQueued;
+   u32 uBytesSent;
+   u32 uBytesDropped; // the client buffer was full
+   u32 uUnitsDropped; // frames (or non frame chunks) dropped
+   u32 uFramesFiltered; // by the rate filter
+   u32 uWritesBlocked; // the socket/serial buffer was full, retried on the next flush
+   u32 uWriteErrors;
+   u32 uBytesReceived;
+   u32 uBytesRejected; // received from a client that can't uplink
+} t_telemetry_hub_client_stats;
+
+typedef struct
+{
+   int bUsed;
+   int iType;
+   u32 uFlags;
+   int iFd;
+   int bOwnsFd; // closed when the client is removed
+   struct sockaddr_in sockAddr; // UDP clients
+   int iMaxDatagram;
+   char szName[32];
+   u32 uTimeLastReceived;
+
+   u32 uMaxStreamRateHz; // 0: no filter
+   u32 uFilterMsgIds[TELEMETRY_HUB_MAX_FILTERED_IDS]; // message id, source system id in the high byte
+   u32 uFilterTimeLastSent[TELEMETRY_HUB_MAX_FILTERED_IDS];
+   int iFilterCount;
+
+   u8  uRing[TELEMETRY_HUB_CLIENT_BUFFER];
+   int iRingStart;
+   int iRingCount;
+
+   u8  uUplinkBuffer[2*TELEMETRY_HUB_MAX_FRAME]; // incomplete uplink frame
+   int iUplinkBytes;
+
+   t_telemetry_hub_client_stats stats;
+} t_telemetry_hub_client;
+
+typedef struct
+{
+   t_telemetry_hub_client clients[TELEMETRY_HUB_MAX_CLIENTS];
+   int iUDPServerFd;
+   int iUDPServerPort;
+   int iTCPServerFd;
+   int iTCPServerPort;
+   int bMAVLink;
+   u32 uRemoteClientsMaxStreamRateHz; // rate filter of the clients added by the servers
+
+   u8  uDownlinkBuffer[2*TELEMETRY_HUB_MAX_FRAME]; // incomplete downlink frame
+   int iDownlinkBytes;
+   int iNextFlushClient;
+   int iNextPollClient;
+
+   telemetry_hub_uplink_callback pfUplink;
+   void* pUplinkContext;
+
+   u32 uBytesIn;
+   u32 uUnitsIn;
+   u32 uBytesUplink;
+   u32 uClientsRejected; // no free client slot
+} t_telemetry_hub;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void telemetry_hub_init(t_telemetry_hub* pHub, telemetry_hub_uplink_callback pfUplink, void* pUplinkContext);
+// Removes all clients and stops the servers
+void telemetry_hub_close(t_telemetry_hub* pHub);
+// Cut the data on MAVLink frame boundaries (rate filters work only in this mode)
+void telemetry_hub_set_mavlink(t_telemetry_hub* pHub, int bMAVLink);
+
+// GCSes that send datagrams to this port get the telemetry back on the address they send from.
+// Port 0 binds to any free port (see iUDPServerPort). Return 1 on success
+int telemetry_hub_listen_udp(t_telemetry_hub* pHub, int iPort);
+int telemetry_hub_listen_tcp(t_telemetry_hub* pHub, int iPort);
+// Stops both servers and removes the clients they added
+void telemetry_hub_stop_listening(t_telemetry_hub* pHub);
+
+// Return the client id, -1 on failure
+int telemetry_hub_add_udp_client(t_telemetry_hub* pHub, const char* szIP, int iPort, u32 uFlags, int iMaxDatagram, const char* szName);
+// The serial port stays owned by the caller (remove the client before closing it). It's set to non blocking
+int telemetry_hub_add_serial(t_telemetry_hub* pHub, int iFd, u32 uFlags, const char* szName);
+void telemetry_hub_remove_client(t_telemetry_hub* pHub, int iClientId);
+int telemetry_hub_get_clients_count(t_telemetry_hub* pHub);
+// Max rate for each stream message (by id and source), 0 to send all
+void telemetry_hub_set_client_rate_filter(t_telemetry_hub* pHub, int iClientId, u32 uMaxStreamRateHz);
+// Same, for all the current and future clients added by the UDP/TCP servers
+void telemetry_hub_set_remote_clients_rate_filter(t_telemetry_hub* pHub, u32 uMaxStreamRateHz);
+
+// Queues downlink telemetry to all the downlink clients
+void telemetry_hub_send(t_telemetry_hub* pHub, const u8* pData, int iLength, u32 uTimeNow);
+// Writes the queued data to the clients, without blocking. Returns the bytes written
+int telemetry_hub_flush(t_telemetry_hub* pHub, u32 uTimeNow);
+// Accepts new clients and reads the uplink data (waits at most the timeout). Returns the uplink bytes routed
+int telemetry_hub_poll(t_telemetry_hub* pHub, int iTimeoutMicroSec, u32 uTimeNow);
+
+void telemetry_hub_log_stats(t_telemetry_hub* pHub);
+
+#ifdef __cplusplus
+}
+#endif
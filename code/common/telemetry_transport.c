@@ -0,0 +1,747 @@
+/*
+You can use this C/C++ code however you wish (for example, but not limited to:
+     as is, or by modifying it, or by adding new code, or by removing parts of the code;
+     in public or private projects, in new free or commercial products)
+     only if you get a priori written consent from Petru Soroaga (petrusoroaga@yahoo.com) for your specific use
+     and only if this copyright terms are preserved in the code.
+     This code is public for learning and academic purposes.
+Also, check the licences folder for additional licences terms.
+Code written by: Petru Soroaga, 2021-2023
+*/
+
+#include "../base/base.h"
+#include "mavlink_frames.h"
+#include "telemetry_transport.h"
+
+#define TELEMETRY_TRANSPORT_INITIAL_RTO_MS 200
+#define TELEMETRY_TRANSPORT_BURST_MS 100 // bucket depth, as time at the set rate
+
+// Signed distance between two 16 bit indexes
+static inline int _tt_index_diff(u16 uA, u16 uB)
+{
+   return (int)(short)(u16)(uA - uB);
+}
+
+int telemetry_transport_get_message_class(u32 uMsgId)
+{
+   switch ( uMsgId )
+   {
+      case MAVLINK_MSG_ID_CHANGE_OPERATOR_CONTROL:
+      case MAVLINK_MSG_ID_CHANGE_OPERATOR_CONTROL_ACK:
+      case MAVLINK_MSG_ID_SET_MODE:
+      case MAVLINK_MSG_ID_PARAM_REQUEST_READ:
+      case MAVLINK_MSG_ID_PARAM_REQUEST_LIST:
+      case MAVLINK_MSG_ID_PARAM_VALUE:
+      case MAVLINK_MSG_ID_PARAM_SET:
+      case MAVLINK_MSG_ID_MISSION_REQUEST_PARTIAL_LIST:
+      case MAVLINK_MSG_ID_MISSION_WRITE_PARTIAL_LIST:
+      case MAVLINK_MSG_ID_MISSION_ITEM:
+      case MAVLINK_MSG_ID_MISSION_REQUEST:
+      case MAVLINK_MSG_ID_MISSION_SET_CURRENT:
+      case MAVLINK_MSG_ID_MISSION_REQUEST_LIST:
+      case MAVLINK_MSG_ID_MISSION_COUNT:
+      case MAVLINK_MSG_ID_MISSION_CLEAR_ALL:
+      case MAVLINK_MSG_ID_MISSION_ITEM_REACHED:
+      case MAVLINK_MSG_ID_MISSION_ACK:
+      case MAVLINK_MSG_ID_SET_GPS_GLOBAL_ORIGIN:
+      case MAVLINK_MSG_ID_MISSION_REQUEST_INT:
+      case MAVLINK_MSG_ID_REQUEST_DATA_STREAM:
+      case MAVLINK_MSG_ID_MISSION_ITEM_INT:
+      case MAVLINK_MSG_ID_COMMAND_INT:
+      case MAVLINK_MSG_ID_COMMAND_LONG:
+      case MAVLINK_MSG_ID_COMMAND_ACK:
+      case MAVLINK_MSG_ID_FILE_TRANSFER_PROTOCOL:
+      case MAVLINK_MSG_ID_LOG_REQUEST_LIST:
+      case MAVLINK_MSG_ID_LOG_ENTRY:
+      case MAVLINK_MSG_ID_LOG_REQUEST_DATA:
+      case MAVLINK_MSG_ID_LOG_DATA:
+      case MAVLINK_MSG_ID_LOG_ERASE:
+      case MAVLINK_MSG_ID_LOG_REQUEST_END:
+      case MAVLINK_MSG_ID_GPS_INJECT_DATA:
+      case 160: // ArduPilot FENCE_POINT
+      case 161: // ArduPilot FENCE_FETCH_POINT
+      case 175: // ArduPilot RALLY_POINT
+      case 176: // ArduPilot RALLY_FETCH_POINT
+      case MAVLINK_MSG_ID_GPS_RTCM_DATA: // fragments of one correction message
+      case MAVLINK_MSG_ID_STATUSTEXT:
+      case MAVLINK_MSG_ID_SETUP_SIGNING:
+      case MAVLINK_MSG_ID_LOGGING_DATA_ACKED:
+      case MAVLINK_MSG_ID_LOGGING_ACK:
+      case MAVLINK_MSG_ID_PARAM_EXT_REQUEST_READ:
+      case MAVLINK_MSG_ID_PARAM_EXT_REQUEST_LIST:
+      case MAVLINK_MSG_ID_PARAM_EXT_VALUE:
+      case MAVLINK_MSG_ID_PARAM_EXT_SET:
+      case MAVLINK_MSG_ID_PARAM_EXT_ACK:
+         return TELEMETRY_TRANSPORT_CLASS_TRANSACTIONAL;
+   }
+   return TELEMETRY_TRANSPORT_CLASS_STREAM;
+}
+
+// Frame length from the MAVLink header only (no CRC check). Returns 0 if incomplete, -1 if not a frame start
+static int _tt_get_frame_length(const u8* pData, int iLength, u32* pMsgId, u8* pSysId, u8* pCompId)
+{
+   if ( iLength < 1 )
+      return 0;
+   if ( pData[0] == MAVLINK_STX )
+   {
+      if ( iLength < 10 )
+         return 0;
+      if ( NULL != pMsgId )
+         *pMsgId = ((u32)pData[7]) | (((u32)pData[8])<<8) | (((u32)pData[9])<<16);
+      if ( NULL != pSysId )
+         *pSysId = pData[5];
+      if ( NULL != pCompId )
+         *pCompId = pData[6];
+      int iFrameLength = 10 + pData[1] + MAVLINK_NUM_CHECKSUM_BYTES;
+      if ( pData[2] & MAVLINK_IFLAG_SIGNED )
+         iFrameLength += MAVLINK_SIGNATURE_BLOCK_LEN;
+      return iFrameLength;
+   }
+   if ( pData[0] == MAVLINK_STX_MAVLINK1 )
+   {
+      if ( iLength < 6 )
+         return 0;
+      if ( NULL != pMsgId )
+         *pMsgId = pData[5];
+      if ( NULL != pSysId )
+         *pSysId = pData[3];
+      if ( NULL != pCompId )
+         *pCompId = pData[4];
+      return 6 + pData[1] + MAVLINK_NUM_CHECKSUM_BYTES;
+   }
+   return -1;
+}
+
+static void _tt_update_rto(t_telemetry_transport* pTT, u32 uRTTMs)
+{
+   if ( 0 == pTT->uSRTTMs )
+   {
+      pTT->uSRTTMs = uRTTMs;
+      if ( 0 == pTT->uSRTTMs )
+         pTT->uSRTTMs = 1;
+      pTT->uRTTVarMs = uRTTMs/2;
+   }
+   else
+   {
+      u32 uDelta = (uRTTMs > pTT->uSRTTMs)?(uRTTMs - pTT->uSRTTMs):(pTT->uSRTTMs - uRTTMs);
+      pTT->uRTTVarMs = (3*pTT->uRTTVarMs + uDelta)/4;
+      pTT->uSRTTMs = (7*pTT->uSRTTMs + uRTTMs)/8;
+   }
+   u32 uVar = 4*pTT->uRTTVarMs;
+   if ( uVar < 10 )
+      uVar = 10;
+   pTT->uRTOMs = pTT->uSRTTMs + uVar;
+   if ( pTT->uRTOMs < TELEMETRY_TRANSPORT_MIN_RTO_MS )
+      pTT->uRTOMs = TELEMETRY_TRANSPORT_MIN_RTO_MS;
+   if ( pTT->uRTOMs > TELEMETRY_TRANSPORT_MAX_RTO_MS )
+      pTT->uRTOMs = TELEMETRY_TRANSPORT_MAX_RTO_MS;
+   pTT->stats.uRTTMs = pTT->uSRTTMs;
+}
+
+static void _tt_reset_receiver(t_telemetry_transport* pTT)
+{
+   pTT->bPeerSessionKnown = 0;
+   pTT->uPeerSessionId = 0;
+   pTT->uExpectedIndex = 0;
+   for( int i=0; i<TELEMETRY_TRANSPORT_WINDOW; i++ )
+      pTT->bReceived[i] = 0;
+   pTT->bAckPending = 0;
+}
+
+void telemetry_transport_init(t_telemetry_transport* pTT, telemetry_transport_deliver_callback pfDeliver, void* pDeliverContext, u32 uTimeNow)
+{
+   if ( NULL == pTT )
+      return;
+   memset((u8*)pTT, 0, sizeof(t_telemetry_transport));
+   pTT->pfDeliver = pfDeliver;
+   pTT->pDeliverContext = pDeliverContext;
+   pTT->uSessionId = (u16)((rand() & 0xFFFF) ^ uTimeNow);
+   telemetry_transport_set_rate(pTT, TELEMETRY_TRANSPORT_DEFAULT_RATE, uTimeNow);
+   telemetry_transport_reset(pTT, uTimeNow);
+}
+
+void telemetry_transport_reset(t_telemetry_transport* pTT, u32 uTimeNow)
+{
+   if ( NULL == pTT )
+      return;
+   pTT->uSessionId++;
+   pTT->iSerialBytes = 0;
+   pTT->iQueued = 0;
+   pTT->iQueuedBytes = 0;
+   pTT->uNextReliableIndex = 0;
+   pTT->uFirstUnackedIndex = 0;
+   pTT->uSRTTMs = 0;
+   pTT->uRTTVarMs = 0;
+   pTT->uRTOMs = TELEMETRY_TRANSPORT_INITIAL_RTO_MS;
+   _tt_reset_receiver(pTT);
+   pTT->iTokens = pTT->iBurstBytes;
+   pTT->uTimeLastRefill = uTimeNow;
+}
+
+void telemetry_transport_set_rate(t_telemetry_transport* pTT, u32 uRateBytesPerSec, u32 uTimeNow)
+{
+   if ( NULL == pTT )
+      return;
+   if ( uRateBytesPerSec < 100 )
+      uRateBytesPerSec = 100;
+   pTT->uRateBytesPerSec = uRateBytesPerSec;
+   pTT->iBurstBytes = (int)(uRateBytesPerSec * TELEMETRY_TRANSPORT_BURST_MS / 1000);
+   if ( pTT->iBurstBytes < 2*TELEMETRY_TRANSPORT_MAX_PAYLOAD )
+      pTT->iBurstBytes = 2*TELEMETRY_TRANSPORT_MAX_PAYLOAD;
+   if ( pTT->iTokens > pTT->iBurstBytes )
+      pTT->iTokens = pTT->iBurstBytes;
+   pTT->uTimeLastRefill = uTimeNow;
+}
+
+static void _tt_refill_tokens(t_telemetry_transport* pTT, u32 uTimeNow)
+{
+   u32 uDelta = uTimeNow - pTT->uTimeLastRefill;
+   if ( uDelta > 1000 )
+      uDelta = 1000;
+   int iAdd = (int)(uDelta * pTT->uRateBytesPerSec / 1000);
+   if ( iAdd <= 0 )
+      return;
+   // Advance only by the time the added tokens stand for, so slow rates don't lose the fractions
+   pTT->uTimeLastRefill += (u32)iAdd * 1000 / pTT->uRateBytesPerSec;
+   if ( uTimeNow - pTT->uTimeLastRefill > 1000 )
+      pTT->uTimeLastRefill = uTimeNow;
+   pTT->iTokens += iAdd;
+   if ( pTT->iTokens > pTT->iBurstBytes )
+      pTT->iTokens = pTT->iBurstBytes;
+}
+
+static void _tt_remove_queued(t_telemetry_transport* pTT, int iIndex)
+{
+   pTT->iQueuedBytes -= pTT->queue[iIndex].iLength;
+   for( int i=iIndex; i<pTT->iQueued-1; i++ )
+      memcpy(&(pTT->queue[i]), &(pTT->queue[i+1]), sizeof(t_telemetry_transport_frame));
+   pTT->iQueued--;
+}
+
+int telemetry_transport_add_frame(t_telemetry_transport* pTT, const u8* pFrame, int iFrameLength, u32 uTimeNow)
+{
+   if ( (NULL == pTT) || (NULL == pFrame) || (iFrameLength <= 0) || (iFrameLength > TELEMETRY_TRANSPORT_MAX_FRAME) )
+      return 0;
+
+   u32 uMsgId = 0;
+   u8 uSysId = 0, uCompId = 0;
+   if ( _tt_get_frame_length(pFrame, iFrameLength, &uMsgId, &uSysId, &uCompId) != iFrameLength )
+      return 0;
+
+   int iClass = telemetry_transport_get_message_class(uMsgId);
+   pTT->stats.uFramesIn++;
+   if ( iClass == TELEMETRY_TRANSPORT_CLASS_TRANSACTIONAL )
+      pTT->stats.uFramesInTransactional++;
+
+   // Under congestion (no rate budget left) latest wins: replace the queued frame of the same source and message, in place
+   _tt_refill_tokens(pTT, uTimeNow);
+   if ( (iClass == TELEMETRY_TRANSPORT_CLASS_STREAM) && (pTT->iTokens <= 0) )
+   for( int i=0; i<pTT->iQueued; i++ )
+   {
+      t_telemetry_transport_frame* pQueued = &(pTT->queue[i]);
+      if ( (pQueued->uClass != TELEMETRY_TRANSPORT_CLASS_STREAM) || (pQueued->uMsgId != uMsgId) ||
+           (pQueued->uSysId != uSysId) || (pQueued->uCompId != uCompId) )
+         continue;
+      pTT->iQueuedBytes += iFrameLength - pQueued->iLength;
+      memcpy(pQueued->uFrame, pFrame, iFrameLength);
+      pQueued->iLength = iFrameLength;
+      pQueued->uTimeUpdated = uTimeNow;
+      pTT->stats.uStreamCoalesced++;
+      return 1;
+   }
+
+   if ( pTT->iQueued >= TELEMETRY_TRANSPORT_MAX_QUEUED )
+   {
+      // Make room by dropping the oldest stream frame; transactional frames are never dropped for stream ones
+      int iDrop = -1;
+      for( int i=0; i<pTT->iQueued; i++ )
+      {
+         if ( pTT->queue[i].uClass == TELEMETRY_TRANSPORT_CLASS_STREAM )
+         {
+            iDrop = i;
+            break;
+         }
+      }
+      if ( -1 == iDrop )
+      {
+         if ( iClass == TELEMETRY_TRANSPORT_CLASS_STREAM )
+            pTT->stats.uStreamDropped++;
+         else
+            pTT->stats.uTransactionalDropped++;
+         return 0;
+      }
+      _tt_remove_queued(pTT, iDrop);
+      pTT->stats.uStreamDropped++;
+   }
+
+   t_telemetry_transport_frame* pEntry = &(pTT->queue[pTT->iQueued]);
+   pEntry->uTimeQueued = uTimeNow;
+   pEntry->uTimeUpdated = uTimeNow;
+   pEntry->uReliableIndex = 0;
+   pEntry->uClass = (u8)iClass;
+   pEntry->uSysId = uSysId;
+   pEntry->uCompId = uCompId;
+   pEntry->uMsgId = uMsgId;
+   pEntry->iLength = iFrameLength;
+   memcpy(pEntry->uFrame, pFrame, iFrameLength);
+   pTT->iQueued++;
+   pTT->iQueuedBytes += iFrameLength;
+   return 1;
+}
+
+// Queues the complete frames in the serial buffer and keeps the incomplete one at the start
+static int _tt_parse_serial_buffer(t_telemetry_transport* pTT, u32 uTimeNow)
+{
+   int iFrames = 0;
+   int iPos = 0;
+   while ( iPos < pTT->iSerialBytes )
+   {
+      u8* pData = &(pTT->uSerialBuffer[iPos]);
+      int iLeft = pTT->iSerialBytes - iPos;
+      if ( (pData[0] != MAVLINK_STX) && (pData[0] != MAVLINK_STX_MAVLINK1) )
+      {
+         pTT->stats.uBytesDiscarded++;
+         iPos++;
+         continue;
+      }
+      u32 uMsgId = 0;
+      int iRes = mavlink_frames_check_frame(pData, iLeft, &uMsgId);
+      if ( 0 == iRes )
+         break;
+
+      // Messages not in the common dialect (autopilot specific) can't be CRC checked here: pass them on by their
+      // header length, if the next frame starts right after (so a false STX in line noise does not swallow real frames)
+      if ( -2 == iRes )
+      {
+         iRes = _tt_get_frame_length(pData, iLeft, NULL, NULL, NULL);
+         if ( iRes > iLeft )
+            break;
+         if ( (iRes < iLeft) && (pData[iRes] != MAVLINK_STX) && (pData[iRes] != MAVLINK_STX_MAVLINK1) )
+            iRes = -1;
+      }
+      if ( iRes < 0 )
+      {
+         pTT->stats.uBytesDiscarded++;
+         iPos++;
+         continue;
+      }
+      if ( telemetry_transport_add_frame(pTT, pData, iRes, uTimeNow) )
+         iFrames++;
+      iPos += iRes;
+   }
+
+   if ( iPos > 0 )
+   {
+      if ( iPos < pTT->iSerialBytes )
+         memmove(pTT->uSerialBuffer, &(pTT->uSerialBuffer[iPos]), pTT->iSerialBytes - iPos);
+      pTT->iSerialBytes -= iPos;
+   }
+   return iFrames;
+}
+
+int telemetry_transport_add_serial_data(t_telemetry_transport* pTT, const u8* pData, int iLength, u32 uTimeNow)
+{
+   if ( (NULL == pTT) || (NULL == pData) )
+      return 0;
+
+   int iFrames = 0;
+   while ( iLength > 0 )
+   {
+      int iCopy = (int)sizeof(pTT->uSerialBuffer) - pTT->iSerialBytes;
+      if ( iCopy > iLength )
+         iCopy = iLength;
+      memcpy(&(pTT->uSerialBuffer[pTT->iSerialBytes]), pData, iCopy);
+      pTT->iSerialBytes += iCopy;
+      pData += iCopy;
+      iLength -= iCopy;
+      iFrames += _tt_parse_serial_buffer(pTT, uTimeNow);
+   }
+   return iFrames;
+}
+
+void telemetry_transport_request_ack(t_telemetry_transport* pTT, u32 uTimeNow)
+{
+   if ( NULL == pTT )
+      return;
+   if ( ! pTT->bAckPending )
+      pTT->uTimeAckPending = uTimeNow - TELEMETRY_TRANSPORT_ACK_DELAY_MS;
+   pTT->bAckPending = 1;
+}
+
+static void _tt_advance_first_unacked(t_telemetry_transport* pTT)
+{
+   while ( (pTT->uFirstUnackedIndex != pTT->uNextReliableIndex) &&
+           pTT->inflight[pTT->uFirstUnackedIndex % TELEMETRY_TRANSPORT_WINDOW].bAcked )
+      pTT->uFirstUnackedIndex++;
+}
+
+// Marks the in flight frames to resend (timed out) or gives them up
+static void _tt_check_retransmissions(t_telemetry_transport* pTT, u32 uTimeNow)
+{
+   for( u16 uIndex = pTT->uFirstUnackedIndex; uIndex != pTT->uNextReliableIndex; uIndex++ )
+   {
+      t_telemetry_transport_inflight* pInflight = &(pTT->inflight[uIndex % TELEMETRY_TRANSPORT_WINDOW]);
+      if ( pInflight->bAcked || pInflight->bRetransmit )
+         continue;
+      u32 uTimeout = pTT->uRTOMs << ((pInflight->uRetries < 4)?pInflight->uRetries:4);
+      if ( uTimeout > TELEMETRY_TRANSPORT_MAX_RTO_MS )
+         uTimeout = TELEMETRY_TRANSPORT_MAX_RTO_MS;
+      if ( uTimeNow - pInflight->uTimeLastSent < uTimeout )
+         continue;
+      if ( pInflight->uRetries >= TELEMETRY_TRANSPORT_MAX_RETRIES )
+      {
+         pInflight->bAcked = 1;
+         pTT->stats.uGivenUp++;
+         continue;
+      }
+      pInflight->bRetransmit = 1;
+   }
+   _tt_advance_first_unacked(pTT);
+}
+
+static void _tt_process_ack(t_telemetry_transport* pTT, u16 uAckIndex, u32 uAckBitmap, u32 uTimeNow)
+{
+   int bHighestAckedKnown = 0;
+   u16 uHighestAcked = 0;
+   for( u16 uIndex = pTT->uFirstUnackedIndex; uIndex != pTT->uNextReliableIndex; uIndex++ )
+   {
+      t_telemetry_transport_inflight* pInflight = &(pTT->inflight[uIndex % TELEMETRY_TRANSPORT_WINDOW]);
+      int iDiff = _tt_index_diff(uIndex, uAckIndex);
+      int bAcked = (iDiff < 0);
+      if ( (iDiff > 0) && (iDiff <= 32) && (uAckBitmap & (((u32)1)<<(iDiff-1))) )
+      {
+         bAcked = 1;
+         bHighestAckedKnown = 1;
+         uHighestAcked = uIndex;
+      }
+      if ( (! bAcked) || pInflight->bAcked )
+         continue;
+      // Only frames sent once give RTT samples (an ack for a resent frame is ambiguous)
+      if ( 0 == pInflight->uRetries )
+         _tt_update_rto(pTT, uTimeNow - pInflight->uTimeFirstSent);
+      pInflight->bAcked = 1;
+      pInflight->bRetransmit = 0;
+   }
+
+   // Holes before a frame the peer has: resend them now if their ack should have come back already
+   if ( bHighestAckedKnown )
+   for( u16 uIndex = pTT->uFirstUnackedIndex; uIndex != uHighestAcked; uIndex++ )
+   {
+      t_telemetry_transport_inflight* pInflight = &(pTT->inflight[uIndex % TELEMETRY_TRANSPORT_WINDOW]);
+      if ( pInflight->bAcked || pInflight->bRetransmit )
+         continue;
+      if ( uTimeNow - pInflight->uTimeLastSent >= pTT->uSRTTMs )
+         pInflight->bRetransmit = 1;
+   }
+   _tt_advance_first_unacked(pTT);
+}
+
+static void _tt_drop_stale_stream_frames(t_telemetry_transport* pTT, u32 uTimeNow)
+{
+   for( int i=pTT->iQueued-1; i>=0; i-- )
+   {
+      if ( pTT->queue[i].uClass != TELEMETRY_TRANSPORT_CLASS_STREAM )
+         continue;
+      if ( uTimeNow - pTT->queue[i].uTimeUpdated < TELEMETRY_TRANSPORT_MAX_STREAM_AGE_MS )
+         continue;
+      _tt_remove_queued(pTT, i);
+      pTT->stats.uStreamDropped++;
+   }
+}
+
+static int _tt_is_packet_due(t_telemetry_transport* pTT, int iMaxLength, u32 uTimeNow)
+{
+   for( u16 uIndex = pTT->uFirstUnackedIndex; uIndex != pTT->uNextReliableIndex; uIndex++ )
+   {
+      if ( pTT->inflight[uIndex % TELEMETRY_TRANSPORT_WINDOW].bRetransmit )
+         return 1;
+   }
+
+   int bWindowFree = (_tt_index_diff(pTT->uNextReliableIndex, pTT->uFirstUnackedIndex) < TELEMETRY_TRANSPORT_WINDOW);
+   int iStreamBytes = 0;
+   for( int i=0; i<pTT->iQueued; i++ )
+   {
+      t_telemetry_transport_frame* pQueued = &(pTT->queue[i]);
+      if ( pQueued->uClass == TELEMETRY_TRANSPORT_CLASS_TRANSACTIONAL )
+      {
+         if ( bWindowFree )
+            return 1;
+         continue;
+      }
+      if ( uTimeNow - pQueued->uTimeQueued >= TELEMETRY_TRANSPORT_MAX_DELAY_MS )
+         return 1;
+      iStreamBytes += pQueued->iLength + 1;
+   }
+   if ( iStreamBytes + (int)sizeof(t_packet_header_telemetry_transport) >= iMaxLength )
+      return 1;
+   return 0;
+}
+
+static int _tt_add_frame_to_packet(u8* pPayload, int* piPos, int iMaxLength, t_telemetry_transport_frame* pFrame, int bReliable)
+{
+   int iSize = 1 + pFrame->iLength + (bReliable?2:0);
+   if ( *piPos + iSize > iMaxLength )
+      return 0;
+   u8* pOut = pPayload + *piPos;
+   *pOut++ = bReliable?TELEMETRY_TRANSPORT_FRAME_FLAG_RELIABLE:0;
+   if ( bReliable )
+   {
+      *pOut++ = pFrame->uReliableIndex & 0xFF;
+      *pOut++ = (pFrame->uReliableIndex >> 8) & 0xFF;
+   }
+   memcpy(pOut, pFrame->uFrame, pFrame->iLength);
+   *piPos += iSize;
+   return 1;
+}
+
+int telemetry_transport_get_packet(t_telemetry_transport* pTT, u8* pPayload, int iMaxLength, u32 uTimeNow)
+{
+   if ( (NULL == pTT) || (NULL == pPayload) || (iMaxLength < (int)sizeof(t_packet_header_telemetry_transport)) )
+      return 0;
+   if ( iMaxLength > TELEMETRY_TRANSPORT_MAX_PAYLOAD )
+      iMaxLength = TELEMETRY_TRANSPORT_MAX_PAYLOAD;
+
+   _tt_refill_tokens(pTT, uTimeNow);
+   _tt_drop_stale_stream_frames(pTT, uTimeNow);
+   _tt_check_retransmissions(pTT, uTimeNow);
+
+   // Data waits for the rate budget (stream frames coalesce meanwhile); acks always go
+   int bSendData = (pTT->iTokens > 0) && _tt_is_packet_due(pTT, iMaxLength, uTimeNow);
+   int bSendAck = pTT->bAckPending && (uTimeNow - pTT->uTimeAckPending >= TELEMETRY_TRANSPORT_ACK_DELAY_MS);
+   if ( (! bSendData) && (! bSendAck) )
+      return 0;
+
+   t_packet_header_telemetry_transport* pPHTT = (t_packet_header_telemetry_transport*)pPayload;
+   memset((u8*)pPHTT, 0, sizeof(t_packet_header_telemetry_transport));
+   pPHTT->uSessionId = pTT->uSessionId;
+   pPHTT->uFirstUnackedIndex = pTT->uFirstUnackedIndex;
+   if ( pTT->bPeerSessionKnown )
+   {
+      pPHTT->uFlags |= TELEMETRY_TRANSPORT_FLAG_ACK;
+      pPHTT->uAckSessionId = pTT->uPeerSessionId;
+      pPHTT->uAckIndex = pTT->uExpectedIndex;
+      for( int i=0; i<TELEMETRY_TRANSPORT_WINDOW && i<32; i++ )
+      {
+         if ( pTT->bReceived[(u16)(pTT->uExpectedIndex + 1 + i) % TELEMETRY_TRANSPORT_WINDOW] )
+            pPHTT->uAckBitmap |= ((u32)1)<<i;
+      }
+   }
+
+   int iPos = sizeof(t_packet_header_telemetry_transport);
+   int iFrames = 0;
+
+   if ( bSendData )
+   {
+      // Resends first, then new transactional frames while the window allows, then the stream frames
+      for( u16 uIndex = pTT->uFirstUnackedIndex; uIndex != pTT->uNextReliableIndex; uIndex++ )
+      {
+         t_telemetry_transport_inflight* pInflight = &(pTT->inflight[uIndex % TELEMETRY_TRANSPORT_WINDOW]);
+         if ( pInflight->bAcked || (! pInflight->bRetransmit) )
+            continue;
+         if ( ! _tt_add_frame_to_packet(pPayload, &iPos, iMaxLength, &(pInflight->frame), 1) )
+            continue;
+         pInflight->bRetransmit = 0;
+         pInflight->uRetries++;
+         pInflight->uTimeLastSent = uTimeNow;
+         pTT->stats.uRetransmissions++;
+         iFrames++;
+      }
+
+      int i = 0;
+      while ( i < pTT->iQueued )
+      {
+         t_telemetry_transport_frame* pQueued = &(pTT->queue[i]);
+         if ( pQueued->uClass == TELEMETRY_TRANSPORT_CLASS_TRANSACTIONAL )
+         {
+            if ( _tt_index_diff(pTT->uNextReliableIndex, pTT->uFirstUnackedIndex) >= TELEMETRY_TRANSPORT_WINDOW )
+            {
+               i++;
+               continue;
+            }
+            pQueued->uReliableIndex = pTT->uNextReliableIndex;
+            if ( ! _tt_add_frame_to_packet(pPayload, &iPos, iMaxLength, pQueued, 1) )
+               break; // keep the transactional frames order
+            t_telemetry_transport_inflight* pInflight = &(pTT->inflight[pTT->uNextReliableIndex % TELEMETRY_TRANSPORT_WINDOW]);
+            memcpy(&(pInflight->frame), pQueued, sizeof(t_telemetry_transport_frame));
+            pInflight->uTimeFirstSent = uTimeNow;
+            pInflight->uTimeLastSent = uTimeNow;
+            pInflight->uRetries = 0;
+            pInflight->bAcked = 0;
+            pInflight->bRetransmit = 0;
+            pTT->uNextReliableIndex++;
+            _tt_remove_queued(pTT, i);
+            iFrames++;
+            continue;
+         }
+         i++;
+      }
+
+      i = 0;
+      while ( i < pTT->iQueued )
+      {
+         t_telemetry_transport_frame* pQueued = &(pTT->queue[i]);
+         if ( (pQueued->uClass == TELEMETRY_TRANSPORT_CLASS_STREAM) &&
+              _tt_add_frame_to_packet(pPayload, &iPos, iMaxLength, pQueued, 0) )
+         {
+            _tt_remove_queued(pTT, i);
+            iFrames++;
+            continue;
+         }
+         i++;
+      }
+   }
+
+   if ( (0 == iFrames) && (! bSendAck) )
+      return 0;
+
+   pPHTT->uFramesCount = (u8)iFrames;
+   pTT->bAckPending = 0;
+   pTT->iTokens -= iPos;
+   pTT->stats.uPacketsSent++;
+   pTT->stats.uBytesSent += iPos;
+   if ( 0 == iFrames )
+      pTT->stats.uAckOnlyPackets++;
+   return iPos;
+}
+
+static void _tt_deliver(t_telemetry_transport* pTT, const u8* pFrame, int iLength)
+{
+   pTT->stats.uFramesDelivered++;
+   if ( NULL != pTT->pfDeliver )
+      pTT->pfDeliver(pFrame, iLength, pTT->pDeliverContext);
+}
+
+// Delivers the frames received out of order that are next in sequence now
+static void _tt_deliver_in_order(t_telemetry_transport* pTT)
+{
+   while ( pTT->bReceived[pTT->uExpectedIndex % TELEMETRY_TRANSPORT_WINDOW] )
+   {
+      int iSlot = pTT->uExpectedIndex % TELEMETRY_TRANSPORT_WINDOW;
+      pTT->bReceived[iSlot] = 0;
+      pTT->uExpectedIndex++;
+      _tt_deliver(pTT, pTT->received[iSlot].uFrame, pTT->received[iSlot].iLength);
+   }
+}
+
+int telemetry_transport_on_packet(t_telemetry_transport* pTT, const u8* pPayload, int iLength, u32 uTimeNow)
+{
+   if ( (NULL == pTT) || (NULL == pPayload) )
+      return 0;
+   if ( iLength < (int)sizeof(t_packet_header_telemetry_transport) )
+   {
+      pTT->stats.uPacketsInvalid++;
+      return 0;
+   }
+   pTT->stats.uPacketsReceived++;
+
+   t_packet_header_telemetry_transport PHTT;
+   memcpy((u8*)&PHTT, pPayload, sizeof(t_packet_header_telemetry_transport));
+
+   if ( (! pTT->bPeerSessionKnown) || (pTT->uPeerSessionId != PHTT.uSessionId) )
+   {
+      _tt_reset_receiver(pTT);
+      pTT->bPeerSessionKnown = 1;
+      pTT->uPeerSessionId = PHTT.uSessionId;
+      pTT->uExpectedIndex = PHTT.uFirstUnackedIndex;
+   }
+
+   if ( (PHTT.uFlags & TELEMETRY_TRANSPORT_FLAG_ACK) && (PHTT.uAckSessionId == pTT->uSessionId) )
+      _tt_process_ack(pTT, PHTT.uAckIndex, PHTT.uAckBitmap, uTimeNow);
+
+   // The peer gave up on the frames before its first unacked one: don't wait for them
+   if ( _tt_index_diff(PHTT.uFirstUnackedIndex, pTT->uExpectedIndex) > 0 )
+   {
+      while ( _tt_index_diff(PHTT.uFirstUnackedIndex, pTT->uExpectedIndex) > 0 )
+      {
+         int iSlot = pTT->uExpectedIndex % TELEMETRY_TRANSPORT_WINDOW;
+         if ( pTT->bReceived[iSlot] )
+         {
+            pTT->bReceived[iSlot] = 0;
+            _tt_deliver(pTT, pTT->received[iSlot].uFrame, pTT->received[iSlot].iLength);
+         }
+         else
+            pTT->stats.uSkipped++;
+         pTT->uExpectedIndex++;
+      }
+      _tt_deliver_in_order(pTT);
+   }
+
+   int iPos = sizeof(t_packet_header_telemetry_transport);
+   for( int iFrame=0; iFrame<PHTT.uFramesCount; iFrame++ )
+   {
+      if ( iPos >= iLength )
+         break;
+      u8 uFlags = pPayload[iPos++];
+      u16 uIndex = 0;
+      if ( uFlags & TELEMETRY_TRANSPORT_FRAME_FLAG_RELIABLE )
+      {
+         if ( iPos + 2 > iLength )
+            break;
+         uIndex = ((u16)pPayload[iPos]) | (((u16)pPayload[iPos+1])<<8);
+         iPos += 2;
+      }
+      const u8* pFrame = pPayload + iPos;
+      int iFrameLength = _tt_get_frame_length(pFrame, iLength - iPos, NULL, NULL, NULL);
+      if ( (iFrameLength <= 0) || (iFrameLength > TELEMETRY_TRANSPORT_MAX_FRAME) || (iPos + iFrameLength > iLength) )
+      {
+         pTT->stats.uPacketsInvalid++;
+         return 0;
+      }
+      iPos += iFrameLength;
+
+      if ( ! (uFlags & TELEMETRY_TRANSPORT_FRAME_FLAG_RELIABLE) )
+      {
+         _tt_deliver(pTT, pFrame, iFrameLength);
+         continue;
+      }
+
+      if ( ! pTT->bAckPending )
+         pTT->uTimeAckPending = uTimeNow;
+      pTT->bAckPending = 1;
+
+      int iDiff = _tt_index_diff(uIndex, pTT->uExpectedIndex);
+      if ( (iDiff < 0) || (iDiff >= TELEMETRY_TRANSPORT_WINDOW) )
+      {
+         if ( iDiff < 0 )
+            pTT->stats.uDuplicates++;
+         continue;
+      }
+      if ( 0 == iDiff )
+      {
+         pTT->uExpectedIndex++;
+         _tt_deliver(pTT, pFrame, iFrameLength);
+         _tt_deliver_in_order(pTT);
+         continue;
+      }
+      int iSlot = uIndex % TELEMETRY_TRANSPORT_WINDOW;
+      if ( pTT->bReceived[iSlot] )
+      {
+         pTT->stats.uDuplicates++;
+         continue;
+      }
+      pTT->bReceived[iSlot] = 1;
+      memcpy(pTT->received[iSlot].uFrame, pFrame, iFrameLength);
+      pTT->received[iSlot].iLength = iFrameLength;
+   }
+   return 1;
+}
+
+int telemetry_transport_has_pending(t_telemetry_transport* pTT)
+{
+   if ( NULL == pTT )
+      return 0;
+   return (pTT->iQueued > 0) || (pTT->uFirstUnackedIndex != pTT->uNextReliableIndex);
+}
+
+void telemetry_transport_log_stats(t_telemetry_transport* pTT, const char* szName)
+{
+   if ( NULL == pTT )
+      return;
+   t_telemetry_transport_stats* pStats = &(pTT->stats);
+   log_line("[TelemetryTransport] %s: frames in: %u (%u transactional), coalesced: %u, stream dropped: %u, transactional dropped: %u, discarded bytes: %u",
+      (NULL != szName)?szName:"", pStats->uFramesIn, pStats->uFramesInTransactional, pStats->uStreamCoalesced, pStats->uStreamDropped, pStats->uTransactionalDropped, pStats->uBytesDiscarded);
+   log_line("[TelemetryTransport] %s: packets sent: %u (%u ack only), bytes: %u, resent frames: %u, given up: %u, RTT: %u ms, RTO: %u ms",
+      (NULL != szName)?szName:"", pStats->uPacketsSent, pStats->uAckOnlyPackets, pStats->uBytesSent, pStats->uRetransmissions, pStats->uGivenUp, pStats->uRTTMs, pTT->uRTOMs);
+   log_line("[TelemetryTransport] %s: packets received: %u (%u invalid), frames delivered: %u, duplicates: %u, skipped: %u",
+      (NULL != szName)?szName:"", pStats->uPacketsReceived, pStats->uPacketsInvalid, pStats->uFramesDelivered, pStats->uDuplicates, pStats->uSkipped);
+}
@@ -0,0 +1,152 @@
+#pragma once
+#include "../base/base.h"
+#include "../radio/radiopackets2.h"
+
+// MAVLink aware telemetry transport between the vehicle and the controller (one endpoint on each side).
+// The serial telemetry is cut on MAVLink frame boundaries, so a lost radio packet never corrupts a frame.
+// Frames are either:
+//  - stream (attitude, position, heartbeat...): sent once, latest wins: a newer frame with the same
+//    system, component and message id replaces the queued one. Stale stream frames are dropped.
+//  - transactional (mission, params, commands, ftp, logs, status texts): sent reliably, in order.
+//    The receiver acks them (cumulative index + bitmap of the next ones), only the missing ones are resent.
+// Packets are sent as the byte rate budget allows; under congestion the queued stream frames coalesce.
+// No global state: the time is passed in and the packets payloads are built into caller buffers, so it
+// runs the same in tests.
+
+#define TELEMETRY_TRANSPORT_MAX_PAYLOAD 300 // including the t_packet_header_telemetry_transport
+#define TELEMETRY_TRANSPORT_MAX_FRAME 280 // MAVLink 2 signed frame
+#define TELEMETRY_TRANSPORT_MAX_QUEUED 128 // frames waiting to be sent
+#define TELEMETRY_TRANSPORT_WINDOW 32 // reliable frames in flight (and out of order frames kept by the receiver)
+
+#define TELEMETRY_TRANSPORT_DEFAULT_RATE 8000 // bytes/sec
+#define TELEMETRY_TRANSPORT_MAX_DELAY_MS 40 // stream frames wait at most this much for more frames to fill a packet
+#define TELEMETRY_TRANSPORT_MAX_STREAM_AGE_MS 500 // queued stream frames older than this are dropped
+#define TELEMETRY_TRANSPORT_ACK_DELAY_MS 20 // an ack waits at most this much to ride on a data packet
+#define TELEMETRY_TRANSPORT_MIN_RTO_MS 80
+#define TELEMETRY_TRANSPORT_MAX_RTO_MS 2000
+#define TELEMETRY_TRANSPORT_MAX_RETRIES 10 // then the frame is given up
+#define TELEMETRY_TRANSPORT_KEEPALIVE_MS 1000 // an idle controller still sends an ack this often, so the vehicle knows the transport is in use
+#define TELEMETRY_TRANSPORT_LINK_TIMEOUT_MS 5000 // no transport packet from the controller for this long: the vehicle goes back to the raw telemetry segments
+
+#define TELEMETRY_TRANSPORT_CLASS_STREAM 0
+#define TELEMETRY_TRANSPORT_CLASS_TRANSACTIONAL 1
+
+#define TELEMETRY_TRANSPORT_FLAG_ACK 0x01 // the ack fields are valid
+
+#define TELEMETRY_TRANSPORT_FRAME_FLAG_RELIABLE 0x01 // frame has a u16 reliable index after the flags byte
+
+// Delivered frames, in order for the transactional ones
+typedef void (*telemetry_transport_deliver_callback)(const u8* pFrame, int iFrameLength, void* pContext);
+
+typedef struct
+{
+   u32 uTimeQueued;
+   u32 uTimeUpdated; // last replaced by a newer stream frame
+   u16 uReliableIndex;
+   u8  uClass;
+   u8  uSysId;
+   u8  uCompId;
+   u32 uMsgId;
+   int iLength;
+   u8  uFrame[TELEMETRY_TRANSPORT_MAX_FRAME];
+} t_telemetry_transport_frame;
+
+typedef struct
+{
+   t_telemetry_transport_frame frame;
+   u32 uTimeFirstSent;
+   u32 uTimeLastSent;
+   u32 uRetries;
+   int bAcked;
+   int bRetransmit; // resend on the next packet
+} t_telemetry_transport_inflight;
+
+typedef struct
+{
+   u32 uFramesIn;
+   u32 uFramesInTransactional;
+   u32 uBytesDiscarded; // serial bytes that are not MAVLink frames
+   u32 uStreamCoalesced; // replaced by a newer frame while queued
+   u32 uStreamDropped; // stale or queue full
+   u32 uTransactionalDropped; // queue full
+   u32 uRetransmissions;
+   u32 uGivenUp; // transactional frames not acked after the max retries
+   u32 uPacketsSent;
+   u32 uAckOnlyPackets;
+   u32 uBytesSent; // packets payloads, headers included
+
+   u32 uPacketsReceived;
+   u32 uPacketsInvalid;
+   u32 uFramesDelivered;
+   u32 uDuplicates;
+   u32 uSkipped; // transactional frames the peer gave up on
+   u32 uRTTMs; // smoothed
+} t_telemetry_transport_stats;
+
+typedef struct
+{
+   u16 uSessionId;
+   u32 uRateBytesPerSec;
+   int iBurstBytes;
+   int iTokens;
+   u32 uTimeLastRefill;
+
+   // Serial input reassembly
+   u8  uSerialBuffer[2*TELEMETRY_TRANSPORT_MAX_FRAME];
+   int iSerialBytes;
+
+   // Sender
+   t_telemetry_transport_frame queue[TELEMETRY_TRANSPORT_MAX_QUEUED];
+   int iQueued;
+   int iQueuedBytes;
+   t_telemetry_transport_inflight inflight[TELEMETRY_TRANSPORT_WINDOW]; // by reliable index % window
+   u16 uNextReliableIndex;
+   u16 uFirstUnackedIndex;
+   u32 uSRTTMs; // 0: no sample yet
+   u32 uRTTVarMs;
+   u32 uRTOMs;
+
+   // Receiver
+   int bPeerSessionKnown;
+   u16 uPeerSessionId;
+   u16 uExpectedIndex; // next transactional frame to deliver
+   int bReceived[TELEMETRY_TRANSPORT_WINDOW]; // out of order frames, by index % window
+   t_telemetry_transport_frame received[TELEMETRY_TRANSPORT_WINDOW];
+   int bAckPending;
+   u32 uTimeAckPending;
+
+   telemetry_transport_deliver_callback pfDeliver;
+   void* pDeliverContext;
+   t_telemetry_transport_stats stats;
+} t_telemetry_transport;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void telemetry_transport_init(t_telemetry_transport* pTT, telemetry_transport_deliver_callback pfDeliver, void* pDeliverContext, u32 uTimeNow);
+// Drops all the queued and in flight frames and starts a new session
+void telemetry_transport_reset(t_telemetry_transport* pTT, u32 uTimeNow);
+void telemetry_transport_set_rate(t_telemetry_transport* pTT, u32 uRateBytesPerSec, u32 uTimeNow);
+
+int telemetry_transport_get_message_class(u32 uMsgId);
+
+// Cuts the serial data into frames and queues them. Returns the count of complete frames queued
+int telemetry_transport_add_serial_data(t_telemetry_transport* pTT, const u8* pData, int iLength, u32 uTimeNow);
+// Queues one complete MAVLink frame. Returns 1 if queued
+int telemetry_transport_add_frame(t_telemetry_transport* pTT, const u8* pFrame, int iFrameLength, u32 uTimeNow);
+// The next ack goes out even if there is nothing to ack (the peer learns this endpoint is here)
+void telemetry_transport_request_ack(t_telemetry_transport* pTT, u32 uTimeNow);
+
+// Builds the next packet payload (t_packet_header_telemetry_transport and frames) if one is due.
+// Returns the payload length, 0 if there is nothing to send now.
+int telemetry_transport_get_packet(t_telemetry_transport* pTT, u8* pPayload, int iMaxLength, u32 uTimeNow);
+// Processes a payload received from the peer. Returns 0 if the payload is invalid
+int telemetry_transport_on_packet(t_telemetry_transport* pTT, const u8* pPayload, int iLength, u32 uTimeNow);
+
+int telemetry_transport_has_pending(t_telemetry_transport* pTT); // frames queued or in flight
+void telemetry_transport_log_stats(t_telemetry_transport* pTT, const char* szName);
+
+#ifdef __cplusplus
+}
+#endif
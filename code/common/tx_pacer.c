@@ -0,0 +1,359 @@
+/*
+You can use this C/C++ code however you wish (for example, but not limited to:
+     as is, or by modifying it, or by adding new code, or by removing parts of the code;
+     in public or private projects, in new free or commercial products)
+     only if you get a priori written consent from Petru Soroaga (petrusoroaga@yahoo.com) for your specific use
+     and only if this copyright terms are preserved in the code.
+     This code is public for learning and academic purposes.
+Also, check the licences folder for additional licences terms.
+Code written by: Petru Soroaga, 2021-2023
+*/
+
+#include "tx_pacer.h"
+
+// The set rate, or faster if the queued packets would not go out in the max delay at the set rate
+// (i.e. an I-frame is spread over the max delay instead of being flushed when it's late)
+static u32 _tx_pacer_get_current_rate(t_tx_pacer* pPacer)
+{
+   u32 uRate = pPacer->uRateBPS;
+   if ( (0 == uRate) || (pPacer->iMaxDelayMicros <= 0) )
+      return uRate;
+   unsigned long long uBacklogRate = ((unsigned long long)pPacer->iQueuedBytes * 8000000) / pPacer->iMaxDelayMicros;
+   if ( uBacklogRate > MAX_U32 )
+      uBacklogRate = MAX_U32;
+   if ( uBacklogRate > uRate )
+      uRate = (u32)uBacklogRate;
+   if ( uRate > pPacer->stats.uRateMaxBPS )
+      pPacer->stats.uRateMaxBPS = uRate;
+   return uRate;
+}
+
+static void _tx_pacer_refill(t_tx_pacer* pPacer, u32 uTimeNowMicros)
+{
+   u32 uDelta = uTimeNowMicros - pPacer->uTimeLastRefillMicros;
+   if ( (0 == pPacer->uRateBPS) || (pPacer->iTokens >= pPacer->iBurstBytes) || (uDelta > 1000000) )
+   {
+      if ( (0 != pPacer->uRateBPS) && (uDelta > 1000000) )
+         pPacer->iTokens = pPacer->iBurstBytes;
+      pPacer->uTimeLastRefillMicros = uTimeNowMicros;
+      return;
+   }
+
+   u32 uRate = _tx_pacer_get_current_rate(pPacer);
+   unsigned long long uBytes = ((unsigned long long)uDelta * uRate) / 8000000;
+   if ( 0 == uBytes )
+      return; // keep the remainder for the next refill
+   if ( (long long)pPacer->iTokens + (long long)uBytes >= pPacer->iBurstBytes )
+   {
+      pPacer->iTokens = pPacer->iBurstBytes;
+      pPacer->uTimeLastRefillMicros = uTimeNowMicros;
+      return;
+   }
+   pPacer->iTokens += (int)uBytes;
+   pPacer->uTimeLastRefillMicros += (u32)((uBytes * 8000000) / uRate);
+}
+
+static void _tx_pacer_send_entry(t_tx_pacer* pPacer, t_tx_pacer_entry* pEntry, u32 uTimeNowMicros, int bPaced)
+{
+   u32 uDelay = uTimeNowMicros - pEntry->uTimeAddedMicros;
+   pPacer->stats.uPacketsSent++;
+   if ( ! bPaced )
+      pPacer->stats.uPacketsSentUnpaced++;
+   pPacer->stats.uDelayTotalMicros += uDelay;
+   if ( uDelay > pPacer->stats.uDelayMaxMicros )
+      pPacer->stats.uDelayMaxMicros = uDelay;
+
+   pPacer->iQueuedBytes -= pEntry->pBuffer->packet_length;
+   pPacer->iTokens -= pEntry->pBuffer->packet_length;
+   if ( pPacer->iTokens < -pPacer->iBurstBytes )
+      pPacer->iTokens = -pPacer->iBurstBytes;
+
+   if ( NULL != pPacer->pfSend )
+      pPacer->pfSend(pEntry->pBuffer->packet_buffer, pEntry->pBuffer->packet_length, pPacer->pSendContext);
+   packets_pool_release(pEntry->pBuffer);
+   pEntry->pBuffer = NULL;
+}
+
+// Returns the next entry to send (priority ones first), without removing it
+static t_tx_pacer_entry* _tx_pacer_peek(t_tx_pacer* pPacer, int* pbPriority)
+{
+   if ( pPacer->iPriorityCount > 0 )
+   {
+      *pbPriority = 1;
+      return &(pPacer->priorityEntries[pPacer->iPriorityStart]);
+   }
+   if ( pPacer->iCount > 0 )
+   {
+      *pbPriority = 0;
+      return &(pPacer->entries[pPacer->iStart]);
+   }
+   return NULL;
+}
+
+static void _tx_pacer_remove_first(t_tx_pacer* pPacer, int bPriority)
+{
+   if ( bPriority )
+   {
+      pPacer->iPriorityStart = (pPacer->iPriorityStart + 1) % TX_PACER_MAX_PRIORITY_PACKETS;
+      pPacer->iPriorityCount--;
+   }
+   else
+   {
+      pPacer->iStart = (pPacer->iStart + 1) % TX_PACER_MAX_PACKETS;
+      pPacer->iCount--;
+   }
+}
+
+void tx_pacer_init(t_tx_pacer* pPacer, tx_pacer_send_callback pfSend, void* pSendContext)
+{
+   if ( NULL == pPacer )
+      return;
+   memset(pPacer, 0, sizeof(t_tx_pacer));
+   pPacer->pfSend = pfSend;
+   pPacer->pSendContext = pSendContext;
+   pPacer->iMaxDelayMicros = TX_PACER_DEFAULT_MAX_DELAY_MICROS;
+   pPacer->iBurstBytes = 2*MAX_PACKET_TOTAL_SIZE;
+}
+
+void tx_pacer_flush(t_tx_pacer* pPacer, u32 uTimeNowMicros)
+{
+   if ( NULL == pPacer )
+      return;
+   int bPriority = 0;
+   t_tx_pacer_entry* pEntry = NULL;
+   while ( NULL != (pEntry = _tx_pacer_peek(pPacer, &bPriority)) )
+   {
+      _tx_pacer_send_entry(pPacer, pEntry, uTimeNowMicros, 0);
+      _tx_pacer_remove_first(pPacer, bPriority);
+   }
+}
+
+void tx_pacer_drop_queued(t_tx_pacer* pPacer)
+{
+   if ( NULL == pPacer )
+      return;
+   int bPriority = 0;
+   t_tx_pacer_entry* pEntry = NULL;
+   while ( NULL != (pEntry = _tx_pacer_peek(pPacer, &bPriority)) )
+   {
+      pPacer->stats.uPacketsDropped++;
+      pPacer->iQueuedBytes -= pEntry->pBuffer->packet_length;
+      packets_pool_release(pEntry->pBuffer);
+      pEntry->pBuffer = NULL;
+      _tx_pacer_remove_first(pPacer, bPriority);
+   }
+}
+
+void tx_pacer_set_rate(t_tx_pacer* pPacer, u32 uRateBPS, u32 uTimeNowMicros)
+{
+   if ( NULL == pPacer )
+      return;
+   _tx_pacer_refill(pPacer, uTimeNowMicros);
+   if ( (0 == pPacer->uRateBPS) && (0 != uRateBPS) )
+   {
+      pPacer->uTimeLastRefillMicros = uTimeNowMicros;
+      pPacer->iTokens = 0;
+   }
+   pPacer->uRateBPS = uRateBPS;
+
+   int iBurst = (int)(((unsigned long long)uRateBPS * TX_PACER_BURST_MICROS) / 8000000);
+   if ( iBurst < 2*MAX_PACKET_TOTAL_SIZE )
+      iBurst = 2*MAX_PACKET_TOTAL_SIZE;
+   if ( iBurst > 16*MAX_PACKET_TOTAL_SIZE )
+      iBurst = 16*MAX_PACKET_TOTAL_SIZE;
+   pPacer->iBurstBytes = iBurst;
+   if ( pPacer->iTokens > pPacer->iBurstBytes )
+      pPacer->iTokens = pPacer->iBurstBytes;
+}
+
+u32 tx_pacer_compute_rate(u32 uVideoBitrateBPS, u32 uRadioDataRateBPS)
+{
+   if ( 0 == uVideoBitrateBPS )
+      return 0;
+   unsigned long long uRate = ((unsigned long long)uVideoBitrateBPS * TX_PACER_RATE_HEADROOM_PERCENT) / 100;
+   if ( uRate < 1000000 )
+      uRate = 1000000;
+   if ( 0 != uRadioDataRateBPS )
+   {
+      unsigned long long uMaxRate = ((unsigned long long)uRadioDataRateBPS * TX_PACER_RADIO_USAGE_PERCENT) / 100;
+      if ( uRate > uMaxRate )
+         uRate = uMaxRate;
+   }
+   // Never below the video bitrate, or the queue only grows
+   unsigned long long uMinRate = ((unsigned long long)uVideoBitrateBPS * 110) / 100;
+   if ( uRate < uMinRate )
+      uRate = uMinRate;
+   if ( uRate > MAX_U32 )
+      uRate = MAX_U32;
+   return (u32)uRate;
+}
+
+void tx_pacer_set_max_delay(t_tx_pacer* pPacer, int iMaxDelayMicros)
+{
+   if ( NULL == pPacer )
+      return;
+   if ( iMaxDelayMicros < 0 )
+      iMaxDelayMicros = 0;
+   pPacer->iMaxDelayMicros = iMaxDelayMicros;
+}
+
+int tx_pacer_add_packet(t_tx_pacer* pPacer, u8* pPacketData, int iPacketLength, int bPriority, u32 uTimeNowMicros)
+{
+   if ( (NULL == pPacer) || (NULL == pPacketData) || (iPacketLength <= 0) || (iPacketLength > MAX_PACKET_TOTAL_SIZE) )
+      return 0;
+
+   pPacer->stats.uPacketsIn++;
+   if ( bPriority )
+      pPacer->stats.uPacketsPriority++;
+
+   // Not paced: send it now, same as before
+   if ( 0 == pPacer->uRateBPS )
+   {
+      pPacer->stats.uPacketsSent++;
+      if ( NULL != pPacer->pfSend )
+         pPacer->pfSend(pPacketData, iPacketLength, pPacer->pSendContext);
+      return 1;
+   }
+
+   // Make room: the oldest queued packet goes out now
+   if ( bPriority && (pPacer->iPriorityCount >= TX_PACER_MAX_PRIORITY_PACKETS) )
+   {
+      _tx_pacer_send_entry(pPacer, &(pPacer->priorityEntries[pPacer->iPriorityStart]), uTimeNowMicros, 0);
+      _tx_pacer_remove_first(pPacer, 1);
+   }
+   if ( (! bPriority) && (pPacer->iCount >= TX_PACER_MAX_PACKETS) )
+   {
+      _tx_pacer_send_entry(pPacer, &(pPacer->entries[pPacer->iStart]), uTimeNowMicros, 0);
+      _tx_pacer_remove_first(pPacer, 0);
+   }
+
+   t_packet_buffer* pBuffer = packets_pool_alloc();
+   if ( NULL == pBuffer )
+   {
+      // Keep the order: what is queued goes first
+      tx_pacer_flush(pPacer, uTimeNowMicros);
+      pPacer->stats.uPacketsSent++;
+      pPacer->stats.uPacketsSentUnpaced++;
+      pPacer->iTokens -= iPacketLength;
+      if ( pPacer->iTokens < -pPacer->iBurstBytes )
+         pPacer->iTokens = -pPacer->iBurstBytes;
+      if ( NULL != pPacer->pfSend )
+         pPacer->pfSend(pPacketData, iPacketLength, pPacer->pSendContext);
+      return 1;
+   }
+   memcpy(pBuffer->packet_buffer, pPacketData, iPacketLength);
+   pBuffer->packet_length = (u16)iPacketLength;
+
+   t_tx_pacer_entry* pEntry = NULL;
+   if ( bPriority )
+   {
+      pEntry = &(pPacer->priorityEntries[(pPacer->iPriorityStart + pPacer->iPriorityCount) % TX_PACER_MAX_PRIORITY_PACKETS]);
+      pPacer->iPriorityCount++;
+   }
+   else
+   {
+      pEntry = &(pPacer->entries[(pPacer->iStart + pPacer->iCount) % TX_PACER_MAX_PACKETS]);
+      pPacer->iCount++;
+   }
+   pEntry->pBuffer = pBuffer;
+   pEntry->uTimeAddedMicros = uTimeNowMicros;
+   pPacer->iQueuedBytes += iPacketLength;
+
+   tx_pacer_send_ready(pPacer, uTimeNowMicros);
+   return 1;
+}
+
+void tx_pacer_on_bypass_packet_sent(t_tx_pacer* pPacer, int iPacketLength, u32 uTimeNowMicros)
+{
+   if ( (NULL == pPacer) || (iPacketLength <= 0) )
+      return;
+   pPacer->stats.uBytesBypass += iPacketLength;
+   if ( 0 == pPacer->uRateBPS )
+      return;
+   _tx_pacer_refill(pPacer, uTimeNowMicros);
+   pPacer->iTokens -= iPacketLength;
+   if ( pPacer->iTokens < -pPacer->iBurstBytes )
+      pPacer->iTokens = -pPacer->iBurstBytes;
+}
+
+int tx_pacer_send_ready(t_tx_pacer* pPacer, u32 uTimeNowMicros)
+{
+   if ( NULL == pPacer )
+      return 0;
+   _tx_pacer_refill(pPacer, uTimeNowMicros);
+
+   int iCountSent = 0;
+   int bPriority = 0;
+   t_tx_pacer_entry* pEntry = NULL;
+   while ( NULL != (pEntry = _tx_pacer_peek(pPacer, &bPriority)) )
+   {
+      int bPaced = 1;
+      if ( pPacer->iTokens < pEntry->pBuffer->packet_length )
+      {
+         // Waited too long? The oldest packet is the first normal one or the first priority one
+         int bLate = 0;
+         if ( (pPacer->iPriorityCount > 0) && ((int)(uTimeNowMicros - pPacer->priorityEntries[pPacer->iPriorityStart].uTimeAddedMicros) >= pPacer->iMaxDelayMicros) )
+            bLate = 1;
+         if ( (pPacer->iCount > 0) && ((int)(uTimeNowMicros - pPacer->entries[pPacer->iStart].uTimeAddedMicros) >= pPacer->iMaxDelayMicros) )
+            bLate = 1;
+         if ( (0 != pPacer->uRateBPS) && (! bLate) )
+            break;
+         bPaced = 0;
+      }
+      _tx_pacer_send_entry(pPacer, pEntry, uTimeNowMicros, bPaced);
+      _tx_pacer_remove_first(pPacer, bPriority);
+      iCountSent++;
+   }
+   if ( (u32)iCountSent > pPacer->stats.uMaxBurstPackets )
+      pPacer->stats.uMaxBurstPackets = iCountSent;
+   return iCountSent;
+}
+
+u32 tx_pacer_get_time_to_next_send(t_tx_pacer* pPacer, u32 uTimeNowMicros)
+{
+   if ( NULL == pPacer )
+      return 0;
+   int bPriority = 0;
+   t_tx_pacer_entry* pEntry = _tx_pacer_peek(pPacer, &bPriority);
+   if ( (NULL == pEntry) || (0 == pPacer->uRateBPS) )
+      return 0;
+   _tx_pacer_refill(pPacer, uTimeNowMicros);
+   int iMissing = pEntry->pBuffer->packet_length - pPacer->iTokens;
+   if ( iMissing <= 0 )
+      return 0;
+   u32 uTime = (u32)(((unsigned long long)iMissing * 8000000) / _tx_pacer_get_current_rate(pPacer)) + 1;
+   int iWaited = (int)(uTimeNowMicros - pEntry->uTimeAddedMicros);
+   if ( iWaited >= pPacer->iMaxDelayMicros )
+      return 0;
+   if ( uTime > (u32)(pPacer->iMaxDelayMicros - iWaited) )
+      uTime = (u32)(pPacer->iMaxDelayMicros - iWaited);
+   return uTime;
+}
+
+int tx_pacer_get_queued_count(t_tx_pacer* pPacer)
+{
+   if ( NULL == pPacer )
+      return 0;
+   return pPacer->iCount + pPacer->iPriorityCount;
+}
+
+void tx_pacer_reset_stats(t_tx_pacer* pPacer)
+{
+   if ( NULL == pPacer )
+      return;
+   memset(&(pPacer->stats), 0, sizeof(t_tx_pacer_stats));
+}
+
+void tx_pacer_log_stats(t_tx_pacer* pPacer, const char* szName)
+{
+   if ( NULL == pPacer )
+      return;
+   u32 uDelayAvg = 0;
+   if ( 0 != pPacer->stats.uPacketsSent )
+      uDelayAvg = (u32)(pPacer->stats.uDelayTotalMicros / pPacer->stats.uPacketsSent);
+   log_line("[TxPacer] %s: rate %u kbps (max %u kbps), burst %d bytes; packets in %u, sent %u (%u unpaced, %u priority), dropped %u, max burst %u packets, queued %d, delay avg/max: %u/%u us, bypass %u bytes",
+      (NULL != szName)?szName:"", pPacer->uRateBPS/1000, pPacer->stats.uRateMaxBPS/1000, pPacer->iBurstBytes,
+      pPacer->stats.uPacketsIn, pPacer->stats.uPacketsSent, pPacer->stats.uPacketsSentUnpaced, pPacer->stats.uPacketsPriority, pPacer->stats.uPacketsDropped,
+      pPacer->stats.uMaxBurstPackets, tx_pacer_get_queued_count(pPacer), uDelayAvg, pPacer->stats.uDelayMaxMicros, pPacer->stats.uBytesBypass);
+   tx_pacer_reset_stats(pPacer);
+}
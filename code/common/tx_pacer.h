@@ -0,0 +1,95 @@
+#pragma once
+#include "../base/base.h"
+#include "../radio/radiopacketsqueue.h"
+
+// Token bucket pacer for radio packets (video on the vehicle).
+// Packets are copied to packets pool buffers and sent by tx_pacer_send_ready as the bucket allows, instead of
+// back to back at the end of each video block. Priority packets (retransmissions) go before the queued ones.
+// Traffic sent around the pacer (commands, telemetry) takes its tokens, so it preempts the queued video.
+// Packets should not wait more than the max delay: when more is queued than the rate can send in that time,
+// the pacer goes faster; a packet still late (or a full queue/pool) is sent right away.
+// No global state: the time is passed in, packets go out through a callback, so it runs the same in tests.
+
+#define TX_PACER_MAX_PACKETS 128
+#define TX_PACER_MAX_PRIORITY_PACKETS 32
+
+#define TX_PACER_DEFAULT_MAX_DELAY_MICROS 40000
+#define TX_PACER_BURST_MICROS 2000 // bucket depth, as time at the pacing rate
+#define TX_PACER_RATE_HEADROOM_PERCENT 200 // pacing rate vs the video bitrate
+#define TX_PACER_RADIO_USAGE_PERCENT 50 // max pacing rate vs the radio datarate (about what the radio really carries)
+
+typedef int (*tx_pacer_send_callback)(u8* pPacketData, int iPacketLength, void* pContext);
+
+typedef struct
+{
+   t_packet_buffer* pBuffer;
+   u32 uTimeAddedMicros;
+} t_tx_pacer_entry;
+
+typedef struct
+{
+   u32 uPacketsIn;
+   u32 uPacketsSent;
+   u32 uPacketsSentUnpaced; // queue/pool full or waited too long
+   u32 uPacketsDropped; // still queued when tx was paused
+   u32 uPacketsPriority;
+   u32 uBytesBypass; // sent around the pacer
+   u32 uMaxBurstPackets; // max packets sent in one tx_pacer_send_ready call
+   u32 uRateMaxBPS; // max rate used, faster than the set rate to keep the max delay
+   u32 uDelayMaxMicros;
+   unsigned long long uDelayTotalMicros;
+} t_tx_pacer_stats;
+
+typedef struct
+{
+   u32 uRateBPS; // 0: not paced
+   int iBurstBytes;
+   int iMaxDelayMicros;
+   int iTokens; // bytes; negative after traffic around the pacer
+   u32 uTimeLastRefillMicros;
+
+   t_tx_pacer_entry entries[TX_PACER_MAX_PACKETS];
+   int iStart;
+   int iCount;
+   int iQueuedBytes;
+   t_tx_pacer_entry priorityEntries[TX_PACER_MAX_PRIORITY_PACKETS];
+   int iPriorityStart;
+   int iPriorityCount;
+
+   tx_pacer_send_callback pfSend;
+   void* pSendContext;
+   t_tx_pacer_stats stats; // since the last tx_pacer_reset_stats
+} t_tx_pacer;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void tx_pacer_init(t_tx_pacer* pPacer, tx_pacer_send_callback pfSend, void* pSendContext);
+// Sends all the queued packets now
+void tx_pacer_flush(t_tx_pacer* pPacer, u32 uTimeNowMicros);
+// Discards all the queued packets (tx paused: they must not go out later in a burst)
+void tx_pacer_drop_queued(t_tx_pacer* pPacer);
+
+// Sets the pacing rate directly (0 disables pacing)
+void tx_pacer_set_rate(t_tx_pacer* pPacer, u32 uRateBPS, u32 uTimeNowMicros);
+// Pacing rate from the current video bitrate (with headroom) capped by the radio datarate
+u32 tx_pacer_compute_rate(u32 uVideoBitrateBPS, u32 uRadioDataRateBPS);
+void tx_pacer_set_max_delay(t_tx_pacer* pPacer, int iMaxDelayMicros);
+
+// Queues a copy of the packet and sends what the bucket allows. Returns 1 if queued or sent
+int tx_pacer_add_packet(t_tx_pacer* pPacer, u8* pPacketData, int iPacketLength, int bPriority, u32 uTimeNowMicros);
+// Takes the tokens of a packet sent around the pacer
+void tx_pacer_on_bypass_packet_sent(t_tx_pacer* pPacer, int iPacketLength, u32 uTimeNowMicros);
+// Sends the queued packets the bucket allows (and the ones that waited too long). Returns the count sent
+int tx_pacer_send_ready(t_tx_pacer* pPacer, u32 uTimeNowMicros);
+// Microseconds until the next queued packet can go, 0 if now or nothing queued
+u32 tx_pacer_get_time_to_next_send(t_tx_pacer* pPacer, u32 uTimeNowMicros);
+int tx_pacer_get_queued_count(t_tx_pacer* pPacer);
+
+void tx_pacer_reset_stats(t_tx_pacer* pPacer);
+void tx_pacer_log_stats(t_tx_pacer* pPacer, const char* szName);
+
+#ifdef __cplusplus
+}
+#endif
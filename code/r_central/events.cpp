@@ -330,6 +330,11 @@ bool onEventReceivedModelSettings(u8* pBuffer, int length, bool bUnsolicited)
       return false;
    }
 
+   // The binary model of a previous received model must not be used instead of this one
+   char szFileBinary[256];
+   model_get_binary_file_name("tmp/last_recv_model.mdl", szFileBinary);
+   unlink(szFileBinary);
+
    Model modelTemp;
    if ( ! modelTemp.loadFromFile("tmp/last_recv_model.mdl", true) )
    {
@@ -1026,6 +1026,9 @@ bool handle_last_command_result()
             memcpy(&radio_links, &g_pCurrentModel->radioLinksParams, sizeof(type_radio_links_parameters) );
             memcpy(&radio_interfaces, &g_pCurrentModel->radioInterfacesParams, sizeof(type_radio_interfaces_parameters) );
  
+            char szFileBinary[256];
+            model_get_binary_file_name("tmp/tempVehicleSettings.txt", szFileBinary);
+            unlink(szFileBinary);
             g_pCurrentModel->loadFromFile("tmp/tempVehicleSettings.txt"); 
 
             memcpy(&g_pCurrentModel->radioLinksParams, &radio_links, sizeof(type_radio_links_parameters) );
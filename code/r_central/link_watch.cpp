@@ -15,6 +15,7 @@ Code written by: Petru Soroaga, 2021-2023
 #include "../radio/radiopackets2.h"
 #include "../base/ctrl_settings.h"
 #include "../base/ctrl_interfaces.h"
+#include "../base/system_metrics.h"
 #include "../common/string_utils.h"
 
 #include "shared_vars.h"
@@ -719,14 +720,9 @@ void link_watch_loop_processes()
          if ( g_TimeNow > s_TimeLastVideoMemoryFreeCheck + 4000 )
          {
             s_TimeLastVideoMemoryFreeCheck = g_TimeNow;
-            char szComm[1024];
-            char szBuff[2048];
-            char szTemp[64];
-            sprintf(szComm, "df %s | sed -n 2p", TEMP_VIDEO_MEM_FOLDER);
-            hw_execute_bash_command_raw(szComm, szBuff);
-            long lu, lf, lt;
-            sscanf(szBuff, "%s %ld %ld %ld", szTemp, &lt, &lu, &lf);
-            if ( lf/1000 < 20 )
+            shared_mem_system_metrics metrics;
+            if ( system_metrics_get(&metrics) && (metrics.uValidFlags & SYSTEM_METRICS_VALID_DISK_MEMDISK) )
+            if ( metrics.disks[SYSTEM_METRICS_DISK_MEMDISK].uFreeKb/1000 < 20 )
                ruby_stop_recording();
          }
       }
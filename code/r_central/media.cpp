@@ -17,6 +17,7 @@ Code written by: Petru Soroaga, 2021-2023
 #include "media.h"
 #include "../base/launchers.h"
 #include "../renderer/render_engine.h"
+#include "../renderer/render_screenshot.h"
 #include "popup.h"
 #include "ruby_central.h"
 #include "shared_vars.h"
@@ -80,6 +81,11 @@ void _media_remove_invalid_files()
          sprintf(szComm, "rm -rf %s%s", FOLDER_MEDIA, szFile);
          hw_execute_bash_command(szComm, NULL);
 
+         szFile[pos] = 0;
+         strcat(szFile, "mp4");
+         sprintf(szComm, "rm -rf %s%s", FOLDER_MEDIA, szFile);
+         hw_execute_bash_command(szComm, NULL);
+
          szFile[pos] = 0;
          strcat(szFile, "info");
          sprintf(szComm, "rm -rf %s%s", FOLDER_MEDIA, szFile);
@@ -199,13 +205,18 @@ char* media_get_video_filename()
    return s_szMediaCurrentVideoFileInfo;
 }
 
+void media_uninit()
+{
+   render_screenshot_writer_stop();
+}
+
 bool media_take_screenshot(bool bIncludeOSD)
 {
+   // Without OSD: an empty frame leaves only the video layer on the display
    if ( ! bIncludeOSD )
    {
       g_pRenderEngine->startFrame();
       g_pRenderEngine->endFrame();
-      hardware_sleep_ms(20);
    }
 
    char szFile[1024];
@@ -214,9 +225,26 @@ bool media_take_screenshot(bool bIncludeOSD)
    strcpy(szFile, FOLDER_MEDIA);
    strcat(szFile, s_szMediaCurrentScreenshotFileName);
 
-   ruby_signal_alive();
-   hw_launch_process2("./raspi2png", "-p", szFile);
-   ruby_signal_alive();
+   // The screen is copied here; the PNG is encoded and saved on the screenshots writer thread
+   int iWidth = 0, iHeight = 0;
+   u8* pFrame = g_pRenderEngine->captureFrame(&iWidth, &iHeight);
+   if ( NULL != pFrame )
+   {
+      if ( ! render_screenshot_writer_add(pFrame, iWidth, iHeight, szFile) )
+      {
+         Popup* p = new Popup("Screenshot skipped, still saving the previous ones", 0.1,0.72, 2);
+         popups_add_topmost(p);
+         return false;
+      }
+   }
+   else
+   {
+      if ( ! bIncludeOSD )
+         hardware_sleep_ms(20);
+      ruby_signal_alive();
+      hw_launch_process2("./raspi2png", "-p", szFile);
+      ruby_signal_alive();
+   }
 
    log_line("Media Storage: Took a screenshot to file: %s", szFile);
    s_iScreenshotsCountOnDisk++;
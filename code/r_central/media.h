@@ -1,6 +1,7 @@
 #pragma once
 
 bool media_init_and_scan();
+void media_uninit();
 void media_scan_files();
 int media_get_screenshots_count();
 int media_get_videos_count();
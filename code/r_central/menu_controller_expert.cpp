@@ -21,6 +21,7 @@ Code written by: Petru Soroaga, 2021-2023
 
 #include "../base/config.h"
 #include "../base/ctrl_settings.h"
+#include "../base/system_metrics.h"
 #include "../base/launchers.h"
 #include "../base/hardware.h"
 #include "../common/string_utils.h"
@@ -261,8 +262,10 @@ void MenuControllerExpert::addTopInfo()
    hw_execute_bash_command_raw("nproc --all", szOutput);
    szOutput[strlen(szOutput)-1] = 0;
 
-   int speed = hardware_get_cpu_speed();
-   sprintf(szOutput2, "%d Mhz", speed);
+   shared_mem_system_metrics metrics;
+   memset(&metrics, 0, sizeof(shared_mem_system_metrics));
+   system_metrics_get(&metrics);
+   sprintf(szOutput2, "%u Mhz", metrics.uCPUSpeedMHz);
 
    sprintf(szBuffer, "%s, %s CPU Cores, %s Hz", szBoard, szOutput, szOutput2);
    addTopLine(szBuffer);
@@ -11,6 +11,7 @@ Code written by: Petru Soroaga, 2021-2023
 
 #include "../base/base.h"
 #include "../base/hw_procs.h"
+#include "../base/system_metrics.h"
 #include "menu.h"
 #include "menu_root.h"
 #include "menu_search.h"
@@ -327,18 +328,13 @@ void MenuRoot::createHWInfo(Menu* pm)
    else
       strcat(szBuff, "no built in WiFi. ");
 
-   int temp = 0;
-   fp = fopen("/sys/class/thermal/thermal_zone0/temp", "r");
-   fscanf(fp, "%d", &temp);
-   fclose(fp);
-
-   int speed = hardware_get_cpu_speed();
-   sprintf(szTemp, "CPU: %d Mhz, Temp: %d C", speed, temp/1000); 
+   shared_mem_system_metrics metrics;
+   memset(&metrics, 0, sizeof(shared_mem_system_metrics));
+   system_metrics_get(&metrics);
+   sprintf(szTemp, "CPU: %u Mhz, Temp: %d C", metrics.uCPUSpeedMHz, metrics.iTemperatureC); 
    strcat(szBuff, szTemp);
    pm->addTopLine(szBuff);
 
-   u16 flags = hardware_get_flags();
-   
    pm->addTopLine(" ");
    pm->addTopLine(" ");
 }
@@ -391,21 +387,21 @@ void MenuRoot::show_MenuInfo()
 
    createHWInfo(pm);
 
-   if ( 1 == hw_execute_bash_command_raw("df -m /home/pi/ruby | grep root", szBuff) )
-   {
-      char szTemp[1024];
-      long lb, lu, lf;
-      sscanf(szBuff, "%s %ld %ld %ld", szTemp, &lb, &lu, &lf);
-      sprintf(szBuff, "System storage: %ld Mb free out of %ld Mb total.", lf, lu+lf);
-      pm->addTopLine(szBuff);
-   }
-   if ( 1 == hw_execute_bash_command_raw("free -m  | grep Mem", szBuff) )
+   shared_mem_system_metrics metrics;
+   if ( system_metrics_get(&metrics) )
    {
-      char szTemp[1024];
-      long lt, lu, lf;
-      sscanf(szBuff, "%s %ld %ld %ld", szTemp, &lt, &lu, &lf);
-      sprintf(szBuff, "System memory: %ld Mb free out of %ld Mb total.", lf, lt);
-      pm->addTopLine(szBuff);
+      if ( metrics.uValidFlags & SYSTEM_METRICS_VALID_DISK_ROOT )
+      {
+         u32 uFree = metrics.disks[SYSTEM_METRICS_DISK_ROOT].uFreeKb/1024;
+         u32 uUsed = metrics.disks[SYSTEM_METRICS_DISK_ROOT].uUsedKb/1024;
+         sprintf(szBuff, "System storage: %u Mb free out of %u Mb total.", uFree, uUsed + uFree);
+         pm->addTopLine(szBuff);
+      }
+      if ( metrics.uValidFlags & SYSTEM_METRICS_VALID_MEMORY )
+      {
+         sprintf(szBuff, "System memory: %u Mb free out of %u Mb total.", metrics.uMemFreeKb/1024, metrics.uMemTotalKb/1024);
+         pm->addTopLine(szBuff);
+      }
    }
 
    createAboutInfo(pm);
@@ -21,6 +21,7 @@ Code written by: Petru Soroaga, 2021-2023
 
 #include "../base/config.h"
 #include "../base/ctrl_settings.h"
+#include "../base/system_metrics.h"
 
 #include "../base/launchers.h"
 #include "shared_vars.h"
@@ -76,19 +77,16 @@ void MenuStorage::valuesToUI()
 
 void MenuStorage::onShow()
 {
-   char szBuff[1024];
    removeAllTopLines();
    removeAllItems();
 
    media_scan_files();
 
-   if ( 1 == hw_execute_bash_command_raw("df -m /home/pi/ruby | grep root", szBuff) )
+   shared_mem_system_metrics metrics;
+   if ( system_metrics_get(&metrics) && (metrics.uValidFlags & SYSTEM_METRICS_VALID_DISK_ROOT) )
    {
-      char szTemp[1024];
-      long lb, lu, lf;
-      sscanf(szBuff, "%s %ld %ld %ld", szTemp, &lb, &lu, &lf);
-      m_MemUsed = lu;
-      m_MemFree = lf;
+      m_MemUsed = metrics.disks[SYSTEM_METRICS_DISK_ROOT].uUsedKb/1024;
+      m_MemFree = metrics.disks[SYSTEM_METRICS_DISK_ROOT].uFreeKb/1024;
    }
 
    ruby_signal_alive();
@@ -510,7 +508,18 @@ void MenuStorage::onSelectItem()
       pairing_stop();
       m_bWasPairingStarted = true;
    }
-   sprintf(szBuff, "./%s %s%s 30 &", VIDEO_PLAYER_OFFLINE, FOLDER_MEDIA, szFile);
+   // The offline player takes raw H264: MP4 recordings are extracted to it on the fly, through a pipe
+   int iLen = strlen(szFile);
+   if ( iLen > 4 && 0 == strcmp(szFile + iLen - 4, ".mp4") )
+   {
+      sprintf(szBuff, "rm -rf %s; mkfifo %s", TEMP_VIDEO_FILE_PLAYBACK, TEMP_VIDEO_FILE_PLAYBACK);
+      hw_execute_bash_command(szBuff, NULL);
+      sprintf(szBuff, "./ruby_video_proc -extract %s%s %s &", FOLDER_MEDIA, szFile, TEMP_VIDEO_FILE_PLAYBACK);
+      hw_execute_bash_command(szBuff, NULL);
+      sprintf(szBuff, "./%s %s 30 &", VIDEO_PLAYER_OFFLINE, TEMP_VIDEO_FILE_PLAYBACK);
+   }
+   else
+      sprintf(szBuff, "./%s %s%s 30 &", VIDEO_PLAYER_OFFLINE, FOLDER_MEDIA, szFile);
    hw_execute_bash_command(szBuff,NULL);
    g_bVideoPlaying = true;
    g_uVideoPlayingStartTime = get_current_timestamp_ms();
@@ -722,10 +731,10 @@ void MenuStorage::moveVideos(bool bDelete)
       }
       fclose(fd);
       strcpy(szOutFile, szSrcFile);
-      szOutFile[strlen(szOutFile)-4] = 'm';
-      szOutFile[strlen(szOutFile)-3] = 'p';
-      szOutFile[strlen(szOutFile)-2] = '4';
-      szOutFile[strlen(szOutFile)-1] = 0;
+      char* pExtension = strrchr(szOutFile, '.');
+      if ( NULL != pExtension )
+         *pExtension = 0;
+      strcat(szOutFile, ".mp4");
       sprintf(szCommand, "rm -rf %s/%s/Ruby/%s", FOLDER_RUBY, FOLDER_USB_MOUNT, szOutFile);
       hw_execute_bash_command(szCommand, NULL);
 
@@ -759,6 +768,9 @@ void MenuStorage::moveVideos(bool bDelete)
          szCommand[strlen(szCommand)-2] = '6';
          szCommand[strlen(szCommand)-1] = '4';
          hw_execute_bash_command(szCommand, NULL);
+         szCommand[strlen(szCommand)-4] = 0;
+         strcat(szCommand, "mp4");
+         hw_execute_bash_command(szCommand, NULL);
       }
    }
 
@@ -122,6 +122,19 @@ MenuSystemVideoProfiles::MenuSystemVideoProfiles(void)
    m_pItemsSlider[2]->setStep(1);
    m_IndexVideoAdjustStrength = addMenuItem(m_pItemsSlider[2]);
 
+   m_pItemsSelect[1] = new MenuItemSelect("Video Link Adjustment Method", "How the controller decides the video link adjustments: Thresholds is the original method (counts recovered and lost packets over fixed intervals); Estimator estimates the link loss and predicts the best video level, with less level switches on marginal links and faster reactions to fades.");
+   m_pItemsSelect[1]->addSelection("Thresholds");
+   m_pItemsSelect[1]->addSelection("Estimator");
+   m_pItemsSelect[1]->setIsEditable();
+   m_IndexAdaptiveVideoController = addMenuItem(m_pItemsSelect[1]);
+
+   sprintf(szBuff, "Records the video link adjustments history to %s on the controller (up to one hour), to be replayed with ruby_adaptive_video_replay.", FILE_ADAPTIVE_VIDEO_TRACE);
+   m_pItemsSelect[4] = new MenuItemSelect("Record Video Link Adjustments", szBuff);
+   m_pItemsSelect[4]->addSelection("No");
+   m_pItemsSelect[4]->addSelection("Yes");
+   m_pItemsSelect[4]->setIsEditable();
+   m_IndexAdaptiveVideoRecordTrace = addMenuItem(m_pItemsSelect[4]);
+
    for( int k=VIDEO_PROFILE_MQ; k<=VIDEO_PROFILE_LQ; k++ )
    {
       if ( k == VIDEO_PROFILE_MQ )
@@ -308,6 +321,8 @@ void MenuSystemVideoProfiles::valuesToUI()
    }
 
    m_pItemsSelect[3]->setSelectedIndex(pCS->iDevSwitchVideoProfileUsingQAButton+1);
+   m_pItemsSelect[1]->setSelectedIndex(pCS->iAdaptiveVideoController);
+   m_pItemsSelect[4]->setSelectedIndex(pCS->iAdaptiveVideoRecordTrace);
 
    m_pMenuItems[m_IndexSwitchToHQVideo]->setEnabled(true);
    m_pMenuItems[m_IndexSwitchToMQVideo]->setEnabled(true);
@@ -657,6 +672,24 @@ void MenuSystemVideoProfiles::onSelectItem()
          valuesToUI();
    }
 
+   if ( m_IndexAdaptiveVideoController == m_SelectedIndex )
+   {
+      pCS->iAdaptiveVideoController = m_pItemsSelect[1]->getSelectedIndex();
+      save_ControllerSettings();
+      send_control_message_to_router(PACKET_TYPE_LOCAL_CONTROL_CONTROLLER_CHANGED, PACKET_COMPONENT_LOCAL_CONTROL);
+      valuesToUI();
+      return;
+   }
+
+   if ( m_IndexAdaptiveVideoRecordTrace == m_SelectedIndex )
+   {
+      pCS->iAdaptiveVideoRecordTrace = m_pItemsSelect[4]->getSelectedIndex();
+      save_ControllerSettings();
+      send_control_message_to_router(PACKET_TYPE_LOCAL_CONTROL_CONTROLLER_CHANGED, PACKET_COMPONENT_LOCAL_CONTROL);
+      valuesToUI();
+      return;
+   }
+
    if ( m_IndexSwitchUsingQAButton == m_SelectedIndex )
    {
       pCS->iDevSwitchVideoProfileUsingQAButton = m_pItemsSelect[3]->getSelectedIndex()-1;
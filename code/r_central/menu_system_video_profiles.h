@@ -26,6 +26,8 @@ class MenuSystemVideoProfiles: public Menu
       int m_IndexDisableRetransmissionsTimeout;
       int m_IndexDefaultAutoKeyframe;
       int m_IndexVideoAdjustStrength;
+      int m_IndexAdaptiveVideoController;
+      int m_IndexAdaptiveVideoRecordTrace;
       int m_IndexLowestAllowedVideoBitrate;
 
       int m_IndexVideoProfile_VideoRadioRate[8];
@@ -40,6 +40,8 @@ Code written by: Petru Soroaga, 2021-2023
 #include "handle_commands.h"
 #include "osd_common.h"
 
+static int s_iRelayVideoBlocksFecPackets[] = { 1, 2, 3, 4, 6, 8 };
+
 MenuVehicleRelay::MenuVehicleRelay(void)
 :Menu(MENU_ID_VEHICLE_RELAY, "Relay Settings", NULL)
 {
@@ -69,6 +71,7 @@ void MenuVehicleRelay::onShow()
    m_IndexItemEnabled = -1;
    m_IndexQAButton = -1;
    m_IndexVehicle = -1;
+   m_IndexVideoBlocks = -1;
    m_bIsConfigurable = false;
 
    int countLinksOkOnVehicle = 0;
@@ -168,6 +171,17 @@ void MenuVehicleRelay::onShow()
    m_pItemsSelect[4]->setUseMultiViewLayout();
    m_IndexOSD = addMenuItem(m_pItemsSelect[4]);
 
+   m_pItemsSelect[5] = new MenuItemSelect("Relayed Video", "Forward the relayed video packets as they are received, or rebuild the video blocks on this vehicle: lost packets are recovered here and new EC packets are added for the link to the controller. Retransmissions are then answered by this vehicle.");
+   m_pItemsSelect[5]->addSelection("Forward packets");
+   m_pItemsSelect[5]->addSelection("Rebuild blocks, same EC");
+   for( int i=0; i<(int)(sizeof(s_iRelayVideoBlocksFecPackets)/sizeof(s_iRelayVideoBlocksFecPackets[0])); i++ )
+   {
+      sprintf(szBuff, "Rebuild blocks, %d EC", s_iRelayVideoBlocksFecPackets[i]);
+      m_pItemsSelect[5]->addSelection(szBuff);
+   }
+   m_pItemsSelect[5]->setIsEditable();
+   m_IndexVideoBlocks = addMenuItem(m_pItemsSelect[5]);
+
    Menu::onShow();
 
    if ( g_pCurrentModel->rc_params.rc_enabled )
@@ -193,6 +207,7 @@ void MenuVehicleRelay::valuesToUI()
       m_pItemsSelect[2]->setEnabled(false);
       m_pItemsSelect[3]->setEnabled(false);
       m_pItemsSelect[4]->setEnabled(false);
+      m_pItemsSelect[5]->setEnabled(false);
       return;
    }
 
@@ -201,6 +216,7 @@ void MenuVehicleRelay::valuesToUI()
    m_pItemsSelect[2]->setEnabled(true);
    m_pItemsSelect[3]->setEnabled(true);
    m_pItemsSelect[4]->setEnabled(true);
+   m_pItemsSelect[5]->setEnabled(true);
 
    m_pItemsSelect[1]->setSelection(0);
    if ( pCS->iQAButtonRelaySwitching >= 0 )
@@ -241,6 +257,19 @@ void MenuVehicleRelay::valuesToUI()
    m_pItemsSelect[4]->setSelectedIndex(0);
    if ( g_pCurrentModel->relay_params.uRelayFlags & RELAY_FLAGS_SHOW_OSD )
       m_pItemsSelect[4]->setSelectedIndex(1);
+
+   m_pItemsSelect[5]->setSelectedIndex(0);
+   m_pItemsSelect[5]->setEnabled((g_pCurrentModel->relay_params.uRelayFlags & RELAY_FLAGS_VIDEO)?true:false);
+   if ( g_pCurrentModel->relay_params.uRelayFlags & RELAY_FLAGS_VIDEO_BLOCKS )
+   {
+      int iFecPackets = (g_pCurrentModel->relay_params.uRelayFlags & RELAY_FLAGS_MASK_VIDEO_BLOCKS_FECS) >> RELAY_FLAGS_SHIFT_VIDEO_BLOCKS_FECS;
+      m_pItemsSelect[5]->setSelectedIndex(1);
+      for( int i=0; i<(int)(sizeof(s_iRelayVideoBlocksFecPackets)/sizeof(s_iRelayVideoBlocksFecPackets[0])); i++ )
+      {
+         if ( s_iRelayVideoBlocksFecPackets[i] == iFecPackets )
+            m_pItemsSelect[5]->setSelectedIndex(i+2);
+      }
+   }
 }
 
 
@@ -831,6 +860,23 @@ void MenuVehicleRelay::onSelectItem()
       if ( 1 == m_pItemsSelect[4]->getSelectedIndex() )
          params.uRelayFlags |= RELAY_FLAGS_SHOW_OSD;
       
+      if ( ! handle_commands_send_to_vehicle(COMMAND_ID_SET_RELAY_PARAMETERS, 0, (u8*)&params, sizeof(type_relay_parameters)) )
+         valuesToUI();
+      return;
+   }
+
+   if ( m_IndexVideoBlocks == m_SelectedIndex )
+   {
+      type_relay_parameters params;
+      memcpy((u8*)&params, &(g_pCurrentModel->relay_params), sizeof(type_relay_parameters));
+
+      params.uRelayFlags &= ~(RELAY_FLAGS_VIDEO_BLOCKS | RELAY_FLAGS_MASK_VIDEO_BLOCKS_FECS);
+      int iIndex = m_pItemsSelect[5]->getSelectedIndex();
+      if ( 1 == iIndex )
+         params.uRelayFlags |= RELAY_FLAGS_VIDEO_BLOCKS | (((u32)0xFF) << RELAY_FLAGS_SHIFT_VIDEO_BLOCKS_FECS);
+      else if ( iIndex > 1 )
+         params.uRelayFlags |= RELAY_FLAGS_VIDEO_BLOCKS | (((u32)s_iRelayVideoBlocksFecPackets[iIndex-2]) << RELAY_FLAGS_SHIFT_VIDEO_BLOCKS_FECS);
+
       if ( ! handle_commands_send_to_vehicle(COMMAND_ID_SET_RELAY_PARAMETERS, 0, (u8*)&params, sizeof(type_relay_parameters)) )
          valuesToUI();
    }
@@ -24,6 +24,7 @@ class MenuVehicleRelay: public Menu
       int m_IndexQAButton;
       int m_IndexRelayType;
       int m_IndexOSD;
+      int m_IndexVideoBlocks;
 
       bool m_bIsConfigurable;
       float m_fHeightHeader;
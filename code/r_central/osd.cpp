@@ -19,6 +19,7 @@ Code written by: Petru Soroaga, 2021-2023
 #include "osd_plugins.h"
 #include "osd_links.h"
 #include "../common/string_utils.h"
+#include "../base/system_metrics.h"
 #include "../../mavlink/common/mavlink.h"
 #include <math.h>
 
@@ -1749,22 +1750,17 @@ void osd_show_recording(bool bShowWhenStopped, float xPos, float yPos)
    }
    else
    {
-      if  ( 0 == s_lMemDiskOSDTotal )
-      {
-         s_lMemDiskLastTime = g_TimeNow-3000;
-         s_lMemDiskOSDTotal = 1;
-      }
-      if ( g_TimeNow > s_lMemDiskLastTime + 4000 )
+      if ( (0 == s_lMemDiskOSDTotal) || (g_TimeNow > s_lMemDiskLastTime + 1000) )
       {
          s_lMemDiskLastTime = g_TimeNow;
-         char szComm[1024];
-         char szBuff[2048];
-         char szTemp[64];
-         sprintf(szComm, "df %s | sed -n 2p", TEMP_VIDEO_MEM_FOLDER);
-         hw_execute_bash_command_raw(szComm, szBuff);
-         //log_line("Output: [%s]", szBuff);
-         long lu;
-         sscanf(szBuff, "%s %ld %ld %ld", szTemp, &s_lMemDiskOSDTotal, &lu, &s_lMemDiskOSDFree);
+         shared_mem_system_metrics metrics;
+         if ( system_metrics_get(&metrics) && (metrics.uValidFlags & SYSTEM_METRICS_VALID_DISK_MEMDISK) )
+         {
+            s_lMemDiskOSDTotal = (long)metrics.disks[SYSTEM_METRICS_DISK_MEMDISK].uTotalKb;
+            s_lMemDiskOSDFree = (long)metrics.disks[SYSTEM_METRICS_DISK_MEMDISK].uFreeKb;
+         }
+         else if ( 0 == s_lMemDiskOSDTotal )
+            s_lMemDiskOSDTotal = 1;
       }
       sprintf(szTime, "%d/%d", s_lMemDiskOSDTotal/1000-s_lMemDiskOSDFree/1000, s_lMemDiskOSDTotal/1000);
    }
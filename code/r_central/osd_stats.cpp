@@ -22,6 +22,7 @@ Code written by: Petru Soroaga, 2021-2023
 #include "shared_vars.h"
 #include "colors.h"
 #include "../renderer/render_engine.h"
+#include "../renderer/render_engine_display_list.h"
 #include "osd_common.h"
 #include "osd.h"
 #include "osd_stats_dev.h"
@@ -79,6 +80,38 @@ static float s_fOSDStatsMarginV = 0.0;
 static float s_fOSDStatsMarginVTop = 0.0;
 
 static float s_fOSDStatsWindowsMinimBoxHeight = 0.0;
+
+// Each panel is measured and recorded (as a display list) once per stats refresh interval,
+// and replayed on each frame. Panels are re-arranged only when their sizes or the margins change.
+
+#define OSD_STATS_MAX_PANEL_ID 16
+#define OSD_STATS_MAX_PANELS 50
+
+typedef struct
+{
+   int iCount;
+   int iIds[OSD_STATS_MAX_PANELS];
+   float fWidths[OSD_STATS_MAX_PANELS];
+   float fHeights[OSD_STATS_MAX_PANELS];
+   float fMarginH;
+   float fMarginV;
+   float fMarginVTop;
+   float fSpacingH;
+   float fSpacingV;
+   float fForcePanelWidth;
+   u32 uOSDPreferences;
+} t_osd_stats_layout_key;
+
+static t_osd_stats_layout_key s_OSDStatsLayoutMeasured;
+static t_osd_stats_layout_key s_OSDStatsLayoutArranged;
+static RenderEngineDisplayList* s_pOSDStatsPanelsDisplayLists[OSD_STATS_MAX_PANEL_ID];
+static float s_fOSDStatsPanelsRecordedX[OSD_STATS_MAX_PANEL_ID];
+static float s_fOSDStatsPanelsRecordedY[OSD_STATS_MAX_PANEL_ID];
+static bool s_bOSDStatsPanelsInvalidated = true;
+static bool s_bOSDStatsPanelsUncached = false; // measure, arrange and draw the panels each frame
+static u32 s_uOSDStatsPanelsLastRefreshTime = 0;
+static u32 s_uOSDStatsPanelsCountRecordings = 0;
+static u32 s_uOSDStatsPanelsCountArrangements = 0;
 static float s_fOSDVideoDecodeWidthZoom = 1.0;
 
 
@@ -100,6 +133,7 @@ void osd_stats_init()
    s_uOSDMaxFrameDeviationTx = 0;
    s_uOSDMaxFrameDeviationRx = 0;
    s_uOSDMaxFrameDeviationPlayer = 0;
+   s_bOSDStatsPanelsInvalidated = true;
 }
 
 void osd_render_stats_full_rx_port()
@@ -4560,301 +4594,6 @@ float osd_render_stats_dev(float xPos, float yPos, float scale)
    return height;
 }
 
-void _osd_render_stats_panels_horizontal()
-{
-   if ( NULL == g_pCurrentModel )
-      return;
-   
-   ControllerSettings* pCS = get_ControllerSettings();
-   Preferences* p = get_Preferences();
-   float fStatsSize = 1.0;
-
-   float yMax = 1.0-osd_getMarginY()-osd_getBarHeight()-0.01 - osd_getSecondBarHeight();
-
-   if ( g_pCurrentModel->osd_params.layout == osdLayoutLean )
-      yMax -= 0.05; 
-
-   float xWidth = 0.44*fStatsSize;
-   float xSpacing = 0.01*fStatsSize;
-
-   float yStats = yMax;
-   float xStats = 0.99-osd_getMarginX();
-
-   if ( g_pCurrentModel->osd_params.osd_flags2[g_iCurrentOSDVehicleLayout] & OSD_FLAG_EXT_LAYOUT_LEFT_RIGHT )
-   {
-      float fWidth = osd_getVerticalBarWidth();
-      xStats -= fWidth;
-      yMax = 1.0-osd_getMarginY()-0.01;
-      yStats = yMax;
-   }
-
-   if ( pCS->iDeveloperMode || s_bDebugStatsShowAll )
-   if ( p->iDebugShowDevVideoStats || p->iDebugShowDevRadioStats )
-   {
-      osd_render_stats_dev(xStats, yStats-osd_render_stats_dev_get_height(), fStatsSize);
-      xStats -= osd_render_stats_dev_get_width() + xSpacing;
-   }
-
-   if ( pCS->iDeveloperMode || s_bDebugStatsShowAll )
-   if ( p->iDebugShowVehicleVideoGraphs )
-   {
-      osd_render_stats_video_graphs(xStats, yStats-osd_render_stats_video_graphs_get_height());
-      xStats -= osd_render_stats_video_graphs_get_width() + xSpacing;
-   }
-
-   if ( pCS->iDeveloperMode || s_bDebugStatsShowAll )
-   if ( p->iDebugShowVehicleVideoStats )
-   {
-      osd_render_stats_video_stats(xStats, yStats-osd_render_stats_video_stats_get_height());
-      xStats -= osd_render_stats_video_stats_get_width() + xSpacing;
-   }
-
-   if ( pCS->iDeveloperMode || s_bDebugStatsShowAll )
-   if ( NULL != g_pCurrentModel && (g_pCurrentModel->uDeveloperFlags & DEVELOPER_FLAGS_BIT_SEND_BACK_VEHICLE_TX_GAP) )
-   {
-      osd_render_stats_graphs_vehicle_tx_gap(xStats, yStats-osd_render_stats_graphs_vehicle_tx_gap_get_height());
-      xStats -= osd_render_stats_graphs_vehicle_tx_gap_get_width() + xSpacing;
-   }
-
-   if ( pCS->iDeveloperMode || s_bDebugStatsShowAll )
-   if ( NULL != g_pCurrentModel && (g_pCurrentModel->osd_params.osd_flags3[g_iCurrentOSDVehicleLayout] & OSD_FLAG3_SHOW_VIDEO_BITRATE_HISTORY) )
-   {
-      osd_render_stats_video_bitrate_history(xStats - osd_render_stats_video_bitrate_history_get_width(), yStats-osd_render_stats_video_bitrate_history_get_height());
-      xStats -= osd_render_stats_video_bitrate_history_get_width() + xSpacing;
-   }
-
-   if ( s_bDebugStatsShowAll || (g_pCurrentModel->osd_params.osd_flags2[g_iCurrentOSDVehicleLayout] & OSD_FLAG_EXT_SHOW_STATS_VIDEO) )
-   {
-      float hStat = osd_render_stats_video_decode_get_height(pCS->iDeveloperMode, false, g_pSM_RadioStats, g_psmvds, g_psmvds_history, g_pSM_ControllerRetransmissionsStats, fStatsSize);
-      osd_render_stats_video_decode(xStats, yStats-hStat, pCS->iDeveloperMode, false, g_pSM_RadioStats, g_psmvds, g_psmvds_history, g_pSM_ControllerRetransmissionsStats, fStatsSize);
-      xStats -= osd_render_stats_video_decode_get_width(pCS->iDeveloperMode, false, g_pSM_RadioStats, g_psmvds, g_psmvds_history, g_pSM_ControllerRetransmissionsStats, fStatsSize) + xSpacing;
-      if ( p->iDebugShowVideoSnapshotOnDiscard )
-      if ( s_uOSDSnapshotTakeTime > 1 && g_TimeNow < s_uOSDSnapshotTakeTime + 15000 )
-      {
-         hStat = osd_render_stats_video_decode_get_height(pCS->iDeveloperMode, true, &s_OSDSnapshot_RadioStats, &s_OSDSnapshot_VideoDecodeStats, &s_OSDSnapshot_VideoDecodeHist, &s_OSDSnapshot_ControllerVideoRetransmissionsStats, fStatsSize);
-         osd_render_stats_video_decode(xStats, yStats-hStat, pCS->iDeveloperMode, true, &s_OSDSnapshot_RadioStats, &s_OSDSnapshot_VideoDecodeStats, &s_OSDSnapshot_VideoDecodeHist, &s_OSDSnapshot_ControllerVideoRetransmissionsStats, fStatsSize);
-         xStats -= osd_render_stats_video_decode_get_width(pCS->iDeveloperMode, true, &s_OSDSnapshot_RadioStats, &s_OSDSnapshot_VideoDecodeStats, &s_OSDSnapshot_VideoDecodeHist, &s_OSDSnapshot_ControllerVideoRetransmissionsStats, fStatsSize) + xSpacing;
-      }
-   }
-
-   if ( s_bDebugStatsShowAll || (g_pCurrentModel->osd_params.osd_flags2[g_iCurrentOSDVehicleLayout] & OSD_FLAG_EXT_SHOW_STATS_RADIO_LINKS) )
-   if ( NULL != g_pSM_RadioStats )
-   {
-      osd_render_stats_radio_links( xStats, yStats-osd_render_stats_radio_links_get_height(g_pSM_RadioStats, fStatsSize), "Radio Links", g_pSM_RadioStats, fStatsSize);
-      xStats -= osd_render_stats_radio_links_get_width(g_pSM_RadioStats, fStatsSize) + xSpacing;
-   }
-
-   if ( s_bDebugStatsShowAll || (g_pCurrentModel->osd_params.osd_flags2[g_iCurrentOSDVehicleLayout] & OSD_FLAG_EXT_SHOW_STATS_RADIO_INTERFACES) )
-   if ( NULL != g_pSM_RadioStats )
-   {
-      osd_render_stats_radio_interfaces( xStats, yStats-osd_render_stats_radio_interfaces_get_height(g_pSM_RadioStats, fStatsSize), "Radio Interfaces", g_pSM_RadioStats, fStatsSize);
-      xStats -= osd_render_stats_radio_interfaces_get_width(g_pSM_RadioStats, fStatsSize) + xSpacing;
-   }
-
-   if ( s_bDebugStatsShowAll || (g_pCurrentModel->osd_params.osd_flags[g_iCurrentOSDVehicleLayout] & OSD_FLAG_SHOW_EFFICIENCY_STATS) )
-   {
-      osd_render_stats_efficiency(xStats, yStats - osd_render_stats_efficiency_get_height(fStatsSize), fStatsSize);
-      xStats -= osd_render_stats_efficiency_get_width(fStatsSize) + xSpacing;
-   }
-
-   if ( s_bDebugStatsShowAll || (g_pCurrentModel->osd_params.osd_flags2[g_iCurrentOSDVehicleLayout] & OSD_FLAG_EXT_SHOW_STATS_RC) )
-   {
-      osd_render_stats_rc(xStats, yStats-osd_render_stats_rc_get_height(fStatsSize), fStatsSize);
-      xStats -= osd_render_stats_rc_get_width(fStatsSize) + xSpacing;
-   }
-
-}
-
-void _osd_render_stats_panels_vertical()
-{
-   ControllerSettings* pCS = get_ControllerSettings();
-   Preferences* p = get_Preferences();
-   float fStatsSize = 1.0;
-  
-   float hBar = osd_getBarHeight();
-   float hBar2 = osd_getSecondBarHeight();
-   if ( g_pCurrentModel->osd_params.osd_flags2[g_iCurrentOSDVehicleLayout] & OSD_FLAG_EXT_LAYOUT_LEFT_RIGHT )
-   {
-      hBar = 0.0;
-      hBar2 = 0.0;
-   }
-
-   float yMin = osd_getMarginY() + hBar + hBar2 + 0.04; 
-   float yMax = 1.0-osd_getMarginY() - hBar - hBar2 - 0.03;
-   
-   if ( g_pCurrentModel->osd_params.layout == osdLayoutLean )
-      yMax -= 0.05; 
-
-   float yStats = yMin;
-   float xStats = 0.99-osd_getMarginX();
-   float fMaxColumnWidth = 0.0;
-   float fSpacingH = 0.01;
-   float fSpacingV = 0.01;
-
-   if ( g_pCurrentModel->osd_params.osd_flags2[g_iCurrentOSDVehicleLayout] & OSD_FLAG_EXT_LAYOUT_LEFT_RIGHT )
-      xStats -= osd_getVerticalBarWidth();
-
-   if ( pCS->iDeveloperMode || s_bDebugStatsShowAll )
-   if ( p->iDebugShowDevVideoStats || p->iDebugShowDevRadioStats )
-   {
-      if ( yStats + osd_render_stats_dev_get_height() > yMax )
-      {
-         yStats = yMin;
-         xStats -= fMaxColumnWidth + fSpacingH;
-         fMaxColumnWidth = 0.0;
-      }     
-      osd_render_stats_dev(xStats-osd_render_stats_dev_get_width(), yStats, fStatsSize);
-      yStats += osd_render_stats_dev_get_height();
-      yStats += fSpacingV;
-      if ( fMaxColumnWidth < osd_render_stats_dev_get_width() )
-         fMaxColumnWidth = osd_render_stats_dev_get_width();
-   }
-
-   if ( pCS->iDeveloperMode || s_bDebugStatsShowAll )
-   if ( p->iDebugShowVehicleVideoGraphs )
-   {
-      if ( yStats + osd_render_stats_video_graphs_get_height() > yMax )
-      {
-         yStats = yMin;
-         xStats -= fMaxColumnWidth + fSpacingH;
-         fMaxColumnWidth = 0.0;
-      }     
-      osd_render_stats_video_graphs(xStats-osd_render_stats_video_graphs_get_width(), yStats);
-      yStats += osd_render_stats_video_graphs_get_height();
-      yStats += fSpacingV;
-      if ( fMaxColumnWidth < osd_render_stats_video_graphs_get_width() )
-         fMaxColumnWidth = osd_render_stats_video_graphs_get_width();
-   }
-
-   if ( pCS->iDeveloperMode || s_bDebugStatsShowAll )
-   if ( p->iDebugShowVehicleVideoStats )
-   {
-      if ( yStats + osd_render_stats_video_stats_get_height() > yMax )
-      {
-         yStats = yMin;
-         xStats -= fMaxColumnWidth + fSpacingH;
-         fMaxColumnWidth = 0.0;
-      }     
-      osd_render_stats_video_stats(xStats-osd_render_stats_video_stats_get_width(), yStats);
-      yStats += osd_render_stats_video_stats_get_height();
-      yStats += fSpacingV;
-      if ( fMaxColumnWidth < osd_render_stats_video_stats_get_width() )
-         fMaxColumnWidth = osd_render_stats_video_stats_get_width();
-   }
-
-   if ( pCS->iDeveloperMode || s_bDebugStatsShowAll )
-   if ( NULL != g_pCurrentModel && (g_pCurrentModel->uDeveloperFlags & DEVELOPER_FLAGS_BIT_SEND_BACK_VEHICLE_TX_GAP) )
-   {
-      if ( yStats + osd_render_stats_graphs_vehicle_tx_gap_get_height() > yMax )
-      {
-         yStats = yMin;
-         xStats -= fMaxColumnWidth + fSpacingH;
-         fMaxColumnWidth = 0.0;
-      }     
-      osd_render_stats_graphs_vehicle_tx_gap(xStats-osd_render_stats_graphs_vehicle_tx_gap_get_width(), yStats);
-      yStats += osd_render_stats_graphs_vehicle_tx_gap_get_height();
-      yStats += fSpacingV;
-      if ( fMaxColumnWidth < osd_render_stats_graphs_vehicle_tx_gap_get_width() )
-         fMaxColumnWidth = osd_render_stats_graphs_vehicle_tx_gap_get_width();
-   }
-
-   if ( pCS->iDeveloperMode || s_bDebugStatsShowAll )
-   if ( NULL != g_pCurrentModel && (g_pCurrentModel->osd_params.osd_flags3[g_iCurrentOSDVehicleLayout] & OSD_FLAG3_SHOW_VIDEO_BITRATE_HISTORY) )
-   {
-      if ( yStats + osd_render_stats_video_bitrate_history_get_height() > yMax )
-      {
-         yStats = yMin;
-         xStats -= fMaxColumnWidth + fSpacingH;
-         fMaxColumnWidth = 0.0;
-      }     
-      osd_render_stats_video_bitrate_history(xStats-osd_render_stats_video_bitrate_history_get_width(), yStats);
-      yStats += osd_render_stats_video_bitrate_history_get_height();
-      yStats += fSpacingV;
-      if ( fMaxColumnWidth < osd_render_stats_video_bitrate_history_get_width() )
-         fMaxColumnWidth = osd_render_stats_video_bitrate_history_get_width();
-   }
-
-   if ( s_bDebugStatsShowAll || (g_pCurrentModel->osd_params.osd_flags[g_iCurrentOSDVehicleLayout] & OSD_FLAG_SHOW_EFFICIENCY_STATS) )
-   {
-      if ( yStats + osd_render_stats_efficiency_get_height(fStatsSize) > yMax )
-      {
-         yStats = yMin;
-         xStats -= fMaxColumnWidth + fSpacingH;
-         fMaxColumnWidth = 0.0;
-      }  
-      osd_render_stats_efficiency(xStats-osd_render_stats_efficiency_get_width(1.0), yStats, fStatsSize);
-      yStats += osd_render_stats_efficiency_get_height(fStatsSize);
-      yStats += fSpacingV;
-      if ( fMaxColumnWidth < osd_render_stats_efficiency_get_width(fStatsSize) )
-         fMaxColumnWidth = osd_render_stats_efficiency_get_width(fStatsSize);
-   }
-
-   if ( s_bDebugStatsShowAll || (g_pCurrentModel->osd_params.osd_flags2[g_iCurrentOSDVehicleLayout] & OSD_FLAG_EXT_SHOW_STATS_RADIO_LINKS) )
-   if ( NULL != g_pSM_RadioStats )
-   {
-      if ( yStats + osd_render_stats_radio_links_get_height(g_pSM_RadioStats, fStatsSize) > yMax )
-      {
-         yStats = yMin;
-         xStats -= fMaxColumnWidth + fSpacingH;
-         fMaxColumnWidth = 0.0;
-      }         
-      osd_render_stats_radio_links( xStats-osd_render_stats_radio_links_get_width(g_pSM_RadioStats, fStatsSize), yStats, "Radio Links", g_pSM_RadioStats, fStatsSize);
-      yStats += osd_render_stats_radio_links_get_height(g_pSM_RadioStats, fStatsSize);
-      yStats += fSpacingV;
-      if ( fMaxColumnWidth < osd_render_stats_radio_links_get_width(g_pSM_RadioStats, fStatsSize) )
-         fMaxColumnWidth = osd_render_stats_radio_links_get_width(g_pSM_RadioStats, fStatsSize);
-   }
-
-   if ( s_bDebugStatsShowAll || (g_pCurrentModel->osd_params.osd_flags2[g_iCurrentOSDVehicleLayout] & OSD_FLAG_EXT_SHOW_STATS_RADIO_INTERFACES) )
-   if ( NULL != g_pSM_RadioStats )
-   {
-      if ( yStats + osd_render_stats_radio_interfaces_get_height(g_pSM_RadioStats, fStatsSize) > yMax )
-      {
-         yStats = yMin;
-         xStats -= fMaxColumnWidth + fSpacingH;
-         fMaxColumnWidth = 0.0;
-      }         
-      osd_render_stats_radio_interfaces( xStats-osd_render_stats_radio_interfaces_get_width(g_pSM_RadioStats, fStatsSize), yStats, "Radio Interfaces", g_pSM_RadioStats, fStatsSize);
-      yStats += osd_render_stats_radio_interfaces_get_height(g_pSM_RadioStats, fStatsSize);
-      yStats += fSpacingV;
-      if ( fMaxColumnWidth < osd_render_stats_radio_interfaces_get_width(g_pSM_RadioStats, fStatsSize) )
-         fMaxColumnWidth = osd_render_stats_radio_interfaces_get_width(g_pSM_RadioStats, fStatsSize);
-   }
-
-   if ( s_bDebugStatsShowAll || (g_pCurrentModel->osd_params.osd_flags2[g_iCurrentOSDVehicleLayout] & OSD_FLAG_EXT_SHOW_STATS_RC) )
-   {
-      if ( yStats + osd_render_stats_rc_get_height(fStatsSize) > yMax )
-      {
-         yStats = yMin;
-         xStats -= fMaxColumnWidth + fSpacingH;
-         fMaxColumnWidth = 0.0;
-      }  
-      osd_render_stats_rc(xStats-osd_render_stats_rc_get_width(fStatsSize), yStats, fStatsSize);
-      yStats += osd_render_stats_rc_get_height(fStatsSize);
-      yStats += fSpacingV;
-      if ( fMaxColumnWidth < osd_render_stats_rc_get_width(fStatsSize) )
-         fMaxColumnWidth = osd_render_stats_rc_get_width(fStatsSize);
-   }
-
-   if ( s_bDebugStatsShowAll || (g_pCurrentModel->osd_params.osd_flags2[g_iCurrentOSDVehicleLayout] & OSD_FLAG_EXT_SHOW_STATS_VIDEO) )
-   {
-      if ( yStats + osd_render_stats_video_decode_get_height(pCS->iDeveloperMode, false, g_pSM_RadioStats, g_psmvds, g_psmvds_history, g_pSM_ControllerRetransmissionsStats, fStatsSize) > yMax )
-      {
-         yStats = yMin;
-         xStats -= fMaxColumnWidth + fSpacingH;
-         fMaxColumnWidth = 0.0;
-      }         
-      osd_render_stats_video_decode(xStats - osd_render_stats_video_decode_get_width(pCS->iDeveloperMode, false,  g_pSM_RadioStats, g_psmvds, g_psmvds_history, g_pSM_ControllerRetransmissionsStats, fStatsSize), yStats, pCS->iDeveloperMode, false, g_pSM_RadioStats, g_psmvds, g_psmvds_history, g_pSM_ControllerRetransmissionsStats, fStatsSize);
-      yStats += osd_render_stats_video_decode_get_height(pCS->iDeveloperMode, false, g_pSM_RadioStats, g_psmvds, g_psmvds_history, g_pSM_ControllerRetransmissionsStats, fStatsSize);
-      yStats += fSpacingV;
-      if ( fMaxColumnWidth < osd_render_stats_video_decode_get_width(pCS->iDeveloperMode, false,  g_pSM_RadioStats, g_psmvds, g_psmvds_history, g_pSM_ControllerRetransmissionsStats, fStatsSize) )
-         fMaxColumnWidth = osd_render_stats_video_decode_get_width(pCS->iDeveloperMode, false,  g_pSM_RadioStats, g_psmvds, g_psmvds_history, g_pSM_ControllerRetransmissionsStats, fStatsSize);
-   }
-
-   if ( p->iDebugShowFullRXStats )
-      osd_render_stats_full_rx_port();
-}
-
 void _osd_stats_swap_pannels(int iIndex1, int iIndex2)
 {
    int tmp = s_iOSDStatsBoundingBoxesIds[iIndex1];
@@ -5166,6 +4905,117 @@ void _osd_stats_autoarange_bottom()
    }
 }
 
+void _osd_stats_measure_panel(int iPanelId, float* pfWidth, float* pfHeight)
+{
+   ControllerSettings* pCS = get_ControllerSettings();
+   float fWidth = 0.0;
+   float fHeight = 0.0;
+   switch ( iPanelId )
+   {
+      case 1: fWidth = osd_render_stats_dev_get_width(); fHeight = osd_render_stats_dev_get_height(); break;
+      case 2: fWidth = osd_render_stats_video_graphs_get_width(); fHeight = osd_render_stats_video_graphs_get_height(); break;
+      case 3: fWidth = osd_render_stats_video_stats_get_width(); fHeight = osd_render_stats_video_stats_get_height(); break;
+      case 4: fWidth = osd_render_stats_graphs_vehicle_tx_gap_get_width(); fHeight = osd_render_stats_graphs_vehicle_tx_gap_get_height(); break;
+      case 5: fWidth = osd_render_stats_video_bitrate_history_get_width(); fHeight = osd_render_stats_video_bitrate_history_get_height(); break;
+      case 6:
+         fWidth = osd_render_stats_video_decode_get_width(pCS->iDeveloperMode, false, g_pSM_RadioStats, g_psmvds, g_psmvds_history, g_pSM_ControllerRetransmissionsStats, 1.0);
+         fHeight = osd_render_stats_video_decode_get_height(pCS->iDeveloperMode, false, g_pSM_RadioStats, g_psmvds, g_psmvds_history, g_pSM_ControllerRetransmissionsStats, 1.0);
+         break;
+      case 7: fWidth = osd_render_stats_radio_links_get_width(g_pSM_RadioStats, 1.0); fHeight = osd_render_stats_radio_links_get_height(g_pSM_RadioStats, 1.0); break;
+      case 8: fWidth = osd_render_stats_radio_interfaces_get_width(g_pSM_RadioStats, 1.0); fHeight = osd_render_stats_radio_interfaces_get_height(g_pSM_RadioStats, 1.0); break;
+      case 9: fWidth = osd_render_stats_efficiency_get_width(1.0); fHeight = osd_render_stats_efficiency_get_height(1.0); break;
+      case 10: fWidth = osd_render_stats_rc_get_width(1.0); fHeight = osd_render_stats_rc_get_height(1.0); break;
+      case 11:
+         fWidth = osd_render_stats_video_decode_get_width(pCS->iDeveloperMode, true, &s_OSDSnapshot_RadioStats, &s_OSDSnapshot_VideoDecodeStats, &s_OSDSnapshot_VideoDecodeHist, &s_OSDSnapshot_ControllerVideoRetransmissionsStats, 1.0);
+         fHeight = osd_render_stats_video_decode_get_height(pCS->iDeveloperMode, true, &s_OSDSnapshot_RadioStats, &s_OSDSnapshot_VideoDecodeStats, &s_OSDSnapshot_VideoDecodeHist, &s_OSDSnapshot_ControllerVideoRetransmissionsStats, 1.0);
+         break;
+      case 12: fWidth = osd_render_stats_video_stream_info_get_width(); fHeight = osd_render_stats_video_stream_info_get_height(); break;
+      case 14: fWidth = osd_render_stats_adaptive_video_get_width(); fHeight = osd_render_stats_adaptive_video_get_height(); break;
+   }
+   *pfWidth = fWidth;
+   *pfHeight = fHeight;
+}
+
+void _osd_stats_render_panel(int iPanelId, float xPos, float yPos)
+{
+   ControllerSettings* pCS = get_ControllerSettings();
+   switch ( iPanelId )
+   {
+      case 1: osd_render_stats_dev(xPos, yPos, 1.0); break;
+      case 2: osd_render_stats_video_graphs(xPos, yPos); break;
+      case 3: osd_render_stats_video_stats(xPos, yPos); break;
+      case 4: osd_render_stats_graphs_vehicle_tx_gap(xPos, yPos); break;
+      case 5: osd_render_stats_video_bitrate_history(xPos, yPos); break;
+      case 6: osd_render_stats_video_decode(xPos, yPos, pCS->iDeveloperMode, false, g_pSM_RadioStats, g_psmvds, g_psmvds_history, g_pSM_ControllerRetransmissionsStats, 1.0); break;
+      case 7: osd_render_stats_radio_links(xPos, yPos, "Radio Links", g_pSM_RadioStats, 1.0); break;
+      case 8: osd_render_stats_radio_interfaces(xPos, yPos, "Radio Interfaces", g_pSM_RadioStats, 1.0); break;
+      case 9: osd_render_stats_efficiency(xPos, yPos, 1.0); break;
+      case 10: osd_render_stats_rc(xPos, yPos, 1.0); break;
+      case 11: osd_render_stats_video_decode(xPos, yPos, pCS->iDeveloperMode, true, &s_OSDSnapshot_RadioStats, &s_OSDSnapshot_VideoDecodeStats, &s_OSDSnapshot_VideoDecodeHist, &s_OSDSnapshot_ControllerVideoRetransmissionsStats, 1.0); break;
+      case 12: osd_render_stats_video_stream_info(xPos, yPos); break;
+      case 14: osd_render_stats_adaptive_video(xPos, yPos); break;
+   }
+}
+
+void _osd_stats_add_panel(int iPanelId)
+{
+   int i = s_OSDStatsLayoutMeasured.iCount;
+   if ( i >= OSD_STATS_MAX_PANELS )
+      return;
+   s_OSDStatsLayoutMeasured.iIds[i] = iPanelId;
+   _osd_stats_measure_panel(iPanelId, &(s_OSDStatsLayoutMeasured.fWidths[i]), &(s_OSDStatsLayoutMeasured.fHeights[i]));
+   s_OSDStatsLayoutMeasured.iCount++;
+}
+
+// Renders the panel on it's display list instead of the screen
+
+void _osd_stats_record_panel(int iPanelId, float xPos, float yPos)
+{
+   if ( (iPanelId < 0) || (iPanelId >= OSD_STATS_MAX_PANEL_ID) )
+      return;
+   if ( NULL == s_pOSDStatsPanelsDisplayLists[iPanelId] )
+      s_pOSDStatsPanelsDisplayLists[iPanelId] = new RenderEngineDisplayList();
+
+   RenderEngine* pRenderEngine = g_pRenderEngine;
+   s_pOSDStatsPanelsDisplayLists[iPanelId]->startRecording(pRenderEngine);
+   g_pRenderEngine = s_pOSDStatsPanelsDisplayLists[iPanelId];
+   _osd_stats_render_panel(iPanelId, xPos, yPos);
+   g_pRenderEngine = pRenderEngine;
+   s_pOSDStatsPanelsDisplayLists[iPanelId]->endRecording();
+
+   s_fOSDStatsPanelsRecordedX[iPanelId] = xPos;
+   s_fOSDStatsPanelsRecordedY[iPanelId] = yPos;
+   s_uOSDStatsPanelsCountRecordings++;
+}
+
+void _osd_stats_arrange_panels()
+{
+   memcpy(&s_OSDStatsLayoutArranged, &s_OSDStatsLayoutMeasured, sizeof(t_osd_stats_layout_key));
+   s_uOSDStatsPanelsCountArrangements++;
+
+   s_iCountOSDStatsBoundingBoxes = s_OSDStatsLayoutMeasured.iCount;
+   s_fOSDStatsWindowsMinimBoxHeight = 2.0;
+   for( int i=0; i<s_iCountOSDStatsBoundingBoxes; i++ )
+   {
+      s_iOSDStatsBoundingBoxesIds[i] = s_OSDStatsLayoutMeasured.iIds[i];
+      s_iOSDStatsBoundingBoxesW[i] = s_OSDStatsLayoutMeasured.fWidths[i];
+      s_iOSDStatsBoundingBoxesH[i] = s_OSDStatsLayoutMeasured.fHeights[i];
+      s_iOSDStatsBoundingBoxesColumns[i] = -1;
+
+      if ( s_iOSDStatsBoundingBoxesH[i] < s_fOSDStatsWindowsMinimBoxHeight  )
+         s_fOSDStatsWindowsMinimBoxHeight = s_iOSDStatsBoundingBoxesH[i];
+   }
+
+   if ( s_OSDStatsLayoutMeasured.uOSDPreferences & OSD_PREFERENCES_BIT_FLAG_ARANGE_STATS_WINDOWS_LEFT )
+      _osd_stats_autoarange_left(0, 0);
+   else if ( s_OSDStatsLayoutMeasured.uOSDPreferences & OSD_PREFERENCES_BIT_FLAG_ARANGE_STATS_WINDOWS_RIGHT )
+      _osd_stats_autoarange_right(0, 0);
+   else if ( s_OSDStatsLayoutMeasured.uOSDPreferences & OSD_PREFERENCES_BIT_FLAG_ARANGE_STATS_WINDOWS_BOTTOM )
+      _osd_stats_autoarange_bottom();
+   else
+      _osd_stats_autoarange_top();
+}
+
 void osd_render_stats_panels()
 {
    if ( NULL == g_pCurrentModel )
@@ -5187,8 +5037,6 @@ void osd_render_stats_panels()
    for( int i=0; i<10; i++ )
       s_fOSDStatsColumnsWidths[i] = g_fOSDStatsForcePanelWidth;
 
-   s_iCountOSDStatsBoundingBoxes = 0;
-
    g_fOSDStatsBgTransparency = 1.0;
    switch ( ((g_pCurrentModel->osd_params.osd_preferences[g_pCurrentModel->osd_params.layout])>>20) & 0x0F )
    {
@@ -5222,187 +5070,201 @@ void osd_render_stats_panels()
    if ( s_fOSDStatsMarginVTop < 0.01 )
       s_fOSDStatsMarginVTop = 0.01;
    
-   if ( g_pCurrentModel->osd_params.osd_flags3[g_iCurrentOSDVehicleLayout] & OSD_FLAG3_SHOW_CONTROLLER_ADAPTIVE_VIDEO_INFO )
-   if ( NULL != g_pSM_ControllerVehiclesAdaptiveVideoInfo )
-   {
-      s_iOSDStatsBoundingBoxesIds[s_iCountOSDStatsBoundingBoxes] = 14;
-      s_iOSDStatsBoundingBoxesW[s_iCountOSDStatsBoundingBoxes] = osd_render_stats_adaptive_video_get_width();
-      s_iOSDStatsBoundingBoxesH[s_iCountOSDStatsBoundingBoxes] = osd_render_stats_adaptive_video_get_height();
-      s_iCountOSDStatsBoundingBoxes++;
-   }
+   u32 uRefreshInterval = 100;
+   if ( (pCS->nGraphRadioRefreshInterval > 0) && (pCS->nGraphRadioRefreshInterval < (int)uRefreshInterval) )
+      uRefreshInterval = pCS->nGraphRadioRefreshInterval;
+   if ( (pCS->nGraphVideoRefreshInterval > 0) && (pCS->nGraphVideoRefreshInterval < (int)uRefreshInterval) )
+      uRefreshInterval = pCS->nGraphVideoRefreshInterval;
 
-   if ( s_bDebugStatsShowAll || (g_pCurrentModel->osd_params.osd_flags2[g_iCurrentOSDVehicleLayout] & OSD_FLAG_EXT_SHOW_STATS_RADIO_LINKS) )
-   if ( NULL != g_pSM_RadioStats )
+   if ( s_bOSDStatsPanelsInvalidated || s_bOSDStatsPanelsUncached ||
+        (g_TimeNow >= s_uOSDStatsPanelsLastRefreshTime + uRefreshInterval) ||
+        (g_TimeNow < s_uOSDStatsPanelsLastRefreshTime) )
    {
-      s_iOSDStatsBoundingBoxesIds[s_iCountOSDStatsBoundingBoxes] = 7;
-      s_iOSDStatsBoundingBoxesW[s_iCountOSDStatsBoundingBoxes] = osd_render_stats_radio_links_get_width(g_pSM_RadioStats, 1.0);
-      s_iOSDStatsBoundingBoxesH[s_iCountOSDStatsBoundingBoxes] = osd_render_stats_radio_links_get_height(g_pSM_RadioStats, 1.0);
-      s_iCountOSDStatsBoundingBoxes++;
-   }
+      s_bOSDStatsPanelsInvalidated = false;
+      s_uOSDStatsPanelsLastRefreshTime = g_TimeNow;
 
-   if ( s_bDebugStatsShowAll || (g_pCurrentModel->osd_params.osd_flags2[g_iCurrentOSDVehicleLayout] & OSD_FLAG_EXT_SHOW_STATS_RADIO_INTERFACES) )
-   if ( NULL != g_pSM_RadioStats )
-   {
-      s_iOSDStatsBoundingBoxesIds[s_iCountOSDStatsBoundingBoxes] = 8;
-      s_iOSDStatsBoundingBoxesW[s_iCountOSDStatsBoundingBoxes] = osd_render_stats_radio_interfaces_get_width(g_pSM_RadioStats, 1.0);
-      s_iOSDStatsBoundingBoxesH[s_iCountOSDStatsBoundingBoxes] = osd_render_stats_radio_interfaces_get_height(g_pSM_RadioStats, 1.0);
-      s_iCountOSDStatsBoundingBoxes++;
-   }
+      // Measure
 
-   if ( s_bDebugStatsShowAll || (g_pCurrentModel->osd_params.osd_flags2[g_iCurrentOSDVehicleLayout] & OSD_FLAG_EXT_SHOW_STATS_VIDEO) )
-   {
-      s_iOSDStatsBoundingBoxesIds[s_iCountOSDStatsBoundingBoxes] = 6;
-      s_iOSDStatsBoundingBoxesW[s_iCountOSDStatsBoundingBoxes] = osd_render_stats_video_decode_get_width(pCS->iDeveloperMode, false, g_pSM_RadioStats, g_psmvds, g_psmvds_history, g_pSM_ControllerRetransmissionsStats, 1.0);
-      s_iOSDStatsBoundingBoxesH[s_iCountOSDStatsBoundingBoxes] = osd_render_stats_video_decode_get_height(pCS->iDeveloperMode, false, g_pSM_RadioStats, g_psmvds, g_psmvds_history, g_pSM_ControllerRetransmissionsStats, 1.0);
-      s_iCountOSDStatsBoundingBoxes++;
-   }
+      memset(&s_OSDStatsLayoutMeasured, 0, sizeof(t_osd_stats_layout_key));
+      s_OSDStatsLayoutMeasured.fMarginH = s_fOSDStatsMarginH;
+      s_OSDStatsLayoutMeasured.fMarginV = s_fOSDStatsMarginV;
+      s_OSDStatsLayoutMeasured.fMarginVTop = s_fOSDStatsMarginVTop;
+      s_OSDStatsLayoutMeasured.fSpacingH = s_fOSDStatsSpacingH;
+      s_OSDStatsLayoutMeasured.fSpacingV = s_fOSDStatsSpacingV;
+      s_OSDStatsLayoutMeasured.fForcePanelWidth = g_fOSDStatsForcePanelWidth;
+      s_OSDStatsLayoutMeasured.uOSDPreferences = g_pCurrentModel->osd_params.osd_preferences[g_iCurrentOSDVehicleLayout];
 
-   if ( p->iDebugShowVideoSnapshotOnDiscard )
-   if ( g_bHasVideoDecodeStatsSnapshot )
-   {
-      s_iOSDStatsBoundingBoxesIds[s_iCountOSDStatsBoundingBoxes] = 11;
-      s_iOSDStatsBoundingBoxesW[s_iCountOSDStatsBoundingBoxes] = osd_render_stats_video_decode_get_width(pCS->iDeveloperMode, true, &s_OSDSnapshot_RadioStats, &s_OSDSnapshot_VideoDecodeStats, &s_OSDSnapshot_VideoDecodeHist, &s_OSDSnapshot_ControllerVideoRetransmissionsStats, 1.0);
-      s_iOSDStatsBoundingBoxesH[s_iCountOSDStatsBoundingBoxes] = osd_render_stats_video_decode_get_height(pCS->iDeveloperMode, true, &s_OSDSnapshot_RadioStats, &s_OSDSnapshot_VideoDecodeStats, &s_OSDSnapshot_VideoDecodeHist, &s_OSDSnapshot_ControllerVideoRetransmissionsStats, 1.0);
-      s_iCountOSDStatsBoundingBoxes++;
-   }
+      if ( g_pCurrentModel->osd_params.osd_flags3[g_iCurrentOSDVehicleLayout] & OSD_FLAG3_SHOW_CONTROLLER_ADAPTIVE_VIDEO_INFO )
+      if ( NULL != g_pSM_ControllerVehiclesAdaptiveVideoInfo )
+         _osd_stats_add_panel(14);
 
-   if ( s_bDebugStatsShowAll || (g_pCurrentModel->osd_params.osd_flags[g_iCurrentOSDVehicleLayout] & OSD_FLAG_SHOW_EFFICIENCY_STATS) )
-   {
-      s_iOSDStatsBoundingBoxesIds[s_iCountOSDStatsBoundingBoxes] = 9;
-      s_iOSDStatsBoundingBoxesW[s_iCountOSDStatsBoundingBoxes] = osd_render_stats_efficiency_get_width(1.0);
-      s_iOSDStatsBoundingBoxesH[s_iCountOSDStatsBoundingBoxes] = osd_render_stats_efficiency_get_height(1.0);
-      s_iCountOSDStatsBoundingBoxes++;
-   }
+      if ( s_bDebugStatsShowAll || (g_pCurrentModel->osd_params.osd_flags2[g_iCurrentOSDVehicleLayout] & OSD_FLAG_EXT_SHOW_STATS_RADIO_LINKS) )
+      if ( NULL != g_pSM_RadioStats )
+         _osd_stats_add_panel(7);
 
-   if ( s_bDebugStatsShowAll || (g_pCurrentModel->osd_params.osd_flags[g_iCurrentOSDVehicleLayout] & OSD_FLAG_SHOW_STATS_VIDEO_INFO) )
-   {
-      s_iOSDStatsBoundingBoxesIds[s_iCountOSDStatsBoundingBoxes] = 12;
-      s_iOSDStatsBoundingBoxesW[s_iCountOSDStatsBoundingBoxes] = osd_render_stats_video_stream_info_get_width();
-      s_iOSDStatsBoundingBoxesH[s_iCountOSDStatsBoundingBoxes] = osd_render_stats_video_stream_info_get_height();
-      s_iCountOSDStatsBoundingBoxes++;
-   }
+      if ( s_bDebugStatsShowAll || (g_pCurrentModel->osd_params.osd_flags2[g_iCurrentOSDVehicleLayout] & OSD_FLAG_EXT_SHOW_STATS_RADIO_INTERFACES) )
+      if ( NULL != g_pSM_RadioStats )
+         _osd_stats_add_panel(8);
 
-   if ( s_bDebugStatsShowAll || (g_pCurrentModel->osd_params.osd_flags2[g_iCurrentOSDVehicleLayout] & OSD_FLAG_EXT_SHOW_STATS_RC) )
-   {
-      s_iOSDStatsBoundingBoxesIds[s_iCountOSDStatsBoundingBoxes] = 10;
-      s_iOSDStatsBoundingBoxesW[s_iCountOSDStatsBoundingBoxes] = osd_render_stats_rc_get_width(1.0);
-      s_iOSDStatsBoundingBoxesH[s_iCountOSDStatsBoundingBoxes] = osd_render_stats_rc_get_height(1.0);
-      s_iCountOSDStatsBoundingBoxes++;
-   }
+      if ( s_bDebugStatsShowAll || (g_pCurrentModel->osd_params.osd_flags2[g_iCurrentOSDVehicleLayout] & OSD_FLAG_EXT_SHOW_STATS_VIDEO) )
+         _osd_stats_add_panel(6);
 
-   if ( pCS->iDeveloperMode || s_bDebugStatsShowAll )
-   if ( p->iDebugShowDevVideoStats || p->iDebugShowDevRadioStats )
-   {
-      s_iOSDStatsBoundingBoxesIds[s_iCountOSDStatsBoundingBoxes] = 1;
-      s_iOSDStatsBoundingBoxesW[s_iCountOSDStatsBoundingBoxes] = osd_render_stats_dev_get_width();
-      s_iOSDStatsBoundingBoxesH[s_iCountOSDStatsBoundingBoxes] = osd_render_stats_dev_get_height();
-      s_iCountOSDStatsBoundingBoxes++;
-   }
+      if ( p->iDebugShowVideoSnapshotOnDiscard )
+      if ( g_bHasVideoDecodeStatsSnapshot )
+         _osd_stats_add_panel(11);
 
-   if ( pCS->iDeveloperMode || s_bDebugStatsShowAll )
-   if ( NULL != g_pCurrentModel && (g_pCurrentModel->uDeveloperFlags & DEVELOPER_FLAGS_BIT_SEND_BACK_VEHICLE_TX_GAP) )
-   {
-      s_iOSDStatsBoundingBoxesIds[s_iCountOSDStatsBoundingBoxes] = 4;
-      s_iOSDStatsBoundingBoxesW[s_iCountOSDStatsBoundingBoxes] = osd_render_stats_graphs_vehicle_tx_gap_get_width();
-      s_iOSDStatsBoundingBoxesH[s_iCountOSDStatsBoundingBoxes] = osd_render_stats_graphs_vehicle_tx_gap_get_height();
-      s_iCountOSDStatsBoundingBoxes++;
-   }
+      if ( s_bDebugStatsShowAll || (g_pCurrentModel->osd_params.osd_flags[g_iCurrentOSDVehicleLayout] & OSD_FLAG_SHOW_EFFICIENCY_STATS) )
+         _osd_stats_add_panel(9);
 
-   if ( NULL != g_pCurrentModel && (g_pCurrentModel->osd_params.osd_flags3[g_iCurrentOSDVehicleLayout] & OSD_FLAG3_SHOW_VIDEO_BITRATE_HISTORY) )
-   {
-      s_iOSDStatsBoundingBoxesIds[s_iCountOSDStatsBoundingBoxes] = 5;
-      s_iOSDStatsBoundingBoxesW[s_iCountOSDStatsBoundingBoxes] = osd_render_stats_video_bitrate_history_get_width();
-      s_iOSDStatsBoundingBoxesH[s_iCountOSDStatsBoundingBoxes] = osd_render_stats_video_bitrate_history_get_height();
-      s_iCountOSDStatsBoundingBoxes++;
-   }
+      if ( s_bDebugStatsShowAll || (g_pCurrentModel->osd_params.osd_flags[g_iCurrentOSDVehicleLayout] & OSD_FLAG_SHOW_STATS_VIDEO_INFO) )
+         _osd_stats_add_panel(12);
 
-   if ( pCS->iDeveloperMode || s_bDebugStatsShowAll )
-   if ( p->iDebugShowVehicleVideoStats )
-   {
-      s_iOSDStatsBoundingBoxesIds[s_iCountOSDStatsBoundingBoxes] = 3;
-      s_iOSDStatsBoundingBoxesW[s_iCountOSDStatsBoundingBoxes] = osd_render_stats_video_stats_get_width();
-      s_iOSDStatsBoundingBoxesH[s_iCountOSDStatsBoundingBoxes] = osd_render_stats_video_stats_get_height();
-      s_iCountOSDStatsBoundingBoxes++;
-   }
+      if ( s_bDebugStatsShowAll || (g_pCurrentModel->osd_params.osd_flags2[g_iCurrentOSDVehicleLayout] & OSD_FLAG_EXT_SHOW_STATS_RC) )
+         _osd_stats_add_panel(10);
 
-   if ( pCS->iDeveloperMode || s_bDebugStatsShowAll )
-   if ( p->iDebugShowVehicleVideoGraphs )
-   {
-      s_iOSDStatsBoundingBoxesIds[s_iCountOSDStatsBoundingBoxes] = 2;
-      s_iOSDStatsBoundingBoxesW[s_iCountOSDStatsBoundingBoxes] = osd_render_stats_video_graphs_get_width();
-      s_iOSDStatsBoundingBoxesH[s_iCountOSDStatsBoundingBoxes] = osd_render_stats_video_graphs_get_height();
-      s_iCountOSDStatsBoundingBoxes++;
-   }
+      if ( pCS->iDeveloperMode || s_bDebugStatsShowAll )
+      if ( p->iDebugShowDevVideoStats || p->iDebugShowDevRadioStats )
+         _osd_stats_add_panel(1);
 
-   s_fOSDStatsWindowsMinimBoxHeight = 2.0;
-   for( int i=0; i<s_iCountOSDStatsBoundingBoxes; i++ )
-   {
-      s_iOSDStatsBoundingBoxesColumns[i] = -1;
+      if ( pCS->iDeveloperMode || s_bDebugStatsShowAll )
+      if ( NULL != g_pCurrentModel && (g_pCurrentModel->uDeveloperFlags & DEVELOPER_FLAGS_BIT_SEND_BACK_VEHICLE_TX_GAP) )
+         _osd_stats_add_panel(4);
 
-      if ( s_iOSDStatsBoundingBoxesH[i] < s_fOSDStatsWindowsMinimBoxHeight  )
-         s_fOSDStatsWindowsMinimBoxHeight = s_iOSDStatsBoundingBoxesH[i];
-   }
+      if ( NULL != g_pCurrentModel && (g_pCurrentModel->osd_params.osd_flags3[g_iCurrentOSDVehicleLayout] & OSD_FLAG3_SHOW_VIDEO_BITRATE_HISTORY) )
+         _osd_stats_add_panel(5);
 
+      if ( pCS->iDeveloperMode || s_bDebugStatsShowAll )
+      if ( p->iDebugShowVehicleVideoStats )
+         _osd_stats_add_panel(3);
 
-   // Auto arange
+      if ( pCS->iDeveloperMode || s_bDebugStatsShowAll )
+      if ( p->iDebugShowVehicleVideoGraphs )
+         _osd_stats_add_panel(2);
 
-   if ( g_pCurrentModel->osd_params.osd_preferences[g_iCurrentOSDVehicleLayout] & OSD_PREFERENCES_BIT_FLAG_ARANGE_STATS_WINDOWS_LEFT )
-      _osd_stats_autoarange_left(0, 0);
-   else if ( g_pCurrentModel->osd_params.osd_preferences[g_iCurrentOSDVehicleLayout] & OSD_PREFERENCES_BIT_FLAG_ARANGE_STATS_WINDOWS_RIGHT )
-      _osd_stats_autoarange_right(0, 0);
-   else if ( g_pCurrentModel->osd_params.osd_preferences[g_iCurrentOSDVehicleLayout] & OSD_PREFERENCES_BIT_FLAG_ARANGE_STATS_WINDOWS_BOTTOM )
-      _osd_stats_autoarange_bottom();
-   else
-      _osd_stats_autoarange_top();
+      // Auto arange, only if the panels or their sizes changed
+
+      if ( s_bOSDStatsPanelsUncached || (0 != memcmp(&s_OSDStatsLayoutMeasured, &s_OSDStatsLayoutArranged, sizeof(t_osd_stats_layout_key))) )
+         _osd_stats_arrange_panels();
+
+      if ( ! s_bOSDStatsPanelsUncached )
+      for( int i=0; i<s_iCountOSDStatsBoundingBoxes; i++ )
+         _osd_stats_record_panel(s_iOSDStatsBoundingBoxesIds[i], s_iOSDStatsBoundingBoxesX[i], s_iOSDStatsBoundingBoxesY[i]);
+   }
 
    // Draw
 
    for( int i=0; i<s_iCountOSDStatsBoundingBoxes; i++ )
    {
-      if ( s_iOSDStatsBoundingBoxesIds[i] == 14 )
-         osd_render_stats_adaptive_video(s_iOSDStatsBoundingBoxesX[i], s_iOSDStatsBoundingBoxesY[i]);
-      
-      if ( s_iOSDStatsBoundingBoxesIds[i] == 1 )
-         osd_render_stats_dev(s_iOSDStatsBoundingBoxesX[i], s_iOSDStatsBoundingBoxesY[i], 1.0);
+      int iPanelId = s_iOSDStatsBoundingBoxesIds[i];
+      if ( s_bOSDStatsPanelsUncached )
+      {
+         _osd_stats_render_panel(iPanelId, s_iOSDStatsBoundingBoxesX[i], s_iOSDStatsBoundingBoxesY[i]);
+         continue;
+      }
+      if ( (iPanelId < 0) || (iPanelId >= OSD_STATS_MAX_PANEL_ID) || (NULL == s_pOSDStatsPanelsDisplayLists[iPanelId]) )
+         continue;
+      s_pOSDStatsPanelsDisplayLists[iPanelId]->replay(g_pRenderEngine,
+          s_iOSDStatsBoundingBoxesX[i] - s_fOSDStatsPanelsRecordedX[iPanelId],
+          s_iOSDStatsBoundingBoxesY[i] - s_fOSDStatsPanelsRecordedY[iPanelId]);
+   }
 
-      if ( s_iOSDStatsBoundingBoxesIds[i] == 2 )
-         osd_render_stats_video_graphs(s_iOSDStatsBoundingBoxesX[i], s_iOSDStatsBoundingBoxesY[i]);
+   if ( p->iDebugShowFullRXStats )
+      osd_render_stats_full_rx_port();
+}
 
-      if ( s_iOSDStatsBoundingBoxesIds[i] == 3 )
-         osd_render_stats_video_stats(s_iOSDStatsBoundingBoxesX[i], s_iOSDStatsBoundingBoxesY[i]);
+static void _osd_stats_benchmark_get_lists_stats(u32* puAllocations, u32* puMemory)
+{
+   *puAllocations = 0;
+   *puMemory = 0;
+   for( int i=0; i<OSD_STATS_MAX_PANEL_ID; i++ )
+   {
+      if ( NULL == s_pOSDStatsPanelsDisplayLists[i] )
+         continue;
+      *puAllocations += s_pOSDStatsPanelsDisplayLists[i]->getStats()->uAllocations;
+      *puMemory += s_pOSDStatsPanelsDisplayLists[i]->getStats()->uMemory;
+   }
+}
 
-      if ( s_iOSDStatsBoundingBoxesIds[i] == 4 )
-         osd_render_stats_graphs_vehicle_tx_gap(s_iOSDStatsBoundingBoxesX[i], s_iOSDStatsBoundingBoxesY[i]);
+// Renders the stats panels on the current render engine (usually an offscreen one) for iFrames frames,
+// first measuring, arranging and drawing the panels on each frame (as without the panels cache), then using the cache.
+// It enables all the developer stats panels on the current model and preferences, so it's meant
+// to run in a process that exits after it.
 
-      if ( s_iOSDStatsBoundingBoxesIds[i] == 5 )
-         osd_render_stats_video_bitrate_history(s_iOSDStatsBoundingBoxesX[i], s_iOSDStatsBoundingBoxesY[i]);
+void osd_stats_run_benchmark(int iFrames)
+{
+   if ( (NULL == g_pRenderEngine) || (NULL == g_pCurrentModel) )
+   {
+      log_softerror_and_alarm("[OSDStats] Can't run the stats benchmark, no render engine or model.");
+      return;
+   }
+   if ( iFrames < 1 )
+      iFrames = 1;
 
-      if ( s_iOSDStatsBoundingBoxesIds[i] == 6 )
-         osd_render_stats_video_decode(s_iOSDStatsBoundingBoxesX[i], s_iOSDStatsBoundingBoxesY[i], pCS->iDeveloperMode, false, g_pSM_RadioStats, g_psmvds, g_psmvds_history, g_pSM_ControllerRetransmissionsStats, 1.0);
+   ControllerSettings* pCS = get_ControllerSettings();
+   Preferences* p = get_Preferences();
+   int iLayout = g_pCurrentModel->osd_params.layout;
 
-      if ( s_iOSDStatsBoundingBoxesIds[i] == 11 )
-         osd_render_stats_video_decode(s_iOSDStatsBoundingBoxesX[i], s_iOSDStatsBoundingBoxesY[i], pCS->iDeveloperMode, true, &s_OSDSnapshot_RadioStats, &s_OSDSnapshot_VideoDecodeStats, &s_OSDSnapshot_VideoDecodeHist, &s_OSDSnapshot_ControllerVideoRetransmissionsStats, 1.0);
+   s_bDebugStatsShowAll = true;
+   pCS->iDeveloperMode = 1;
+   p->iDebugShowDevVideoStats = 1;
+   p->iDebugShowVehicleVideoStats = 1;
+   p->iDebugShowVehicleVideoGraphs = 1;
+   g_pCurrentModel->uDeveloperFlags |= DEVELOPER_FLAGS_BIT_SEND_BACK_VEHICLE_TX_GAP;
+   g_pCurrentModel->osd_params.osd_flags3[iLayout] |= OSD_FLAG3_SHOW_CONTROLLER_ADAPTIVE_VIDEO_INFO | OSD_FLAG3_SHOW_VIDEO_BITRATE_HISTORY;
 
-      if ( s_iOSDStatsBoundingBoxesIds[i] == 12 )
-         osd_render_stats_video_stream_info(s_iOSDStatsBoundingBoxesX[i], s_iOSDStatsBoundingBoxesY[i]);
-      
-      if ( s_iOSDStatsBoundingBoxesIds[i] == 7 )
-         osd_render_stats_radio_links( s_iOSDStatsBoundingBoxesX[i], s_iOSDStatsBoundingBoxesY[i], "Radio Links", g_pSM_RadioStats, 1.0);
+   // No processes running: render empty stats
 
-      if ( s_iOSDStatsBoundingBoxesIds[i] == 8 )
-         osd_render_stats_radio_interfaces( s_iOSDStatsBoundingBoxesX[i], s_iOSDStatsBoundingBoxesY[i], "Radio Interfaces", g_pSM_RadioStats, 1.0);
+   if ( NULL == g_pSM_ControllerVehiclesAdaptiveVideoInfo )
+      g_pSM_ControllerVehiclesAdaptiveVideoInfo = (shared_mem_controller_vehicles_adaptive_video_info*) calloc(1, sizeof(shared_mem_controller_vehicles_adaptive_video_info));
+   if ( NULL == g_pSM_RadioStats )
+      g_pSM_RadioStats = (shared_mem_radio_stats*) calloc(1, sizeof(shared_mem_radio_stats));
+   if ( NULL == g_pSM_VideoInfoStats )
+      g_pSM_VideoInfoStats = (shared_mem_video_info_stats*) calloc(1, sizeof(shared_mem_video_info_stats));
+   if ( NULL == g_pSM_VideoInfoStatsRadioIn )
+      g_pSM_VideoInfoStatsRadioIn = (shared_mem_video_info_stats*) calloc(1, sizeof(shared_mem_video_info_stats));
+   if ( NULL == g_psmvds )
+      g_psmvds = (shared_mem_video_decode_stats*) calloc(1, sizeof(shared_mem_video_decode_stats));
+   if ( NULL == g_psmvds_history )
+      g_psmvds_history = (shared_mem_video_decode_stats_history*) calloc(1, sizeof(shared_mem_video_decode_stats_history));
+   if ( NULL == g_pSM_ControllerRetransmissionsStats )
+      g_pSM_ControllerRetransmissionsStats = (shared_mem_controller_retransmissions_stats*) calloc(1, sizeof(shared_mem_controller_retransmissions_stats));
+   if ( NULL == g_pSM_VideoLinkStats )
+      g_pSM_VideoLinkStats = (shared_mem_video_link_stats_and_overwrites*) calloc(1, sizeof(shared_mem_video_link_stats_and_overwrites));
+   if ( NULL == g_pSM_VideoLinkGraphs )
+      g_pSM_VideoLinkGraphs = (shared_mem_video_link_graphs*) calloc(1, sizeof(shared_mem_video_link_graphs));
+   if ( NULL == g_pPHDownstreamInfoRC )
+      g_pPHDownstreamInfoRC = (t_packet_header_rc_info_downstream*) calloc(1, sizeof(t_packet_header_rc_info_downstream));
 
-      if ( s_iOSDStatsBoundingBoxesIds[i] == 9 )
-         osd_render_stats_efficiency(s_iOSDStatsBoundingBoxesX[i], s_iOSDStatsBoundingBoxesY[i], 1.0);
+   log_line("[OSDStats] Running stats panels benchmark, %d frames, %d x %d ...", iFrames, g_pRenderEngine->getScreenWidth(), g_pRenderEngine->getScreenHeight());
 
-      if ( s_iOSDStatsBoundingBoxesIds[i] == 10 )
-         osd_render_stats_rc(s_iOSDStatsBoundingBoxesX[i], s_iOSDStatsBoundingBoxesY[i], 1.0);
+   for( int iPass=0; iPass<2; iPass++ )
+   {
+      s_bOSDStatsPanelsUncached = (0 == iPass);
+      s_bOSDStatsPanelsInvalidated = true;
 
-      //char szBuff[32];
-      //sprintf(szBuff, "%d", i);
-      //g_pRenderEngine->drawText(s_iOSDStatsBoundingBoxesX[i], s_iOSDStatsBoundingBoxesY[i], s_idFontStats, szBuff);
-   }
+      u32 uAllocationsStart, uMemoryStart, uAllocationsEnd, uMemoryEnd;
+      _osd_stats_benchmark_get_lists_stats(&uAllocationsStart, &uMemoryStart);
+      u32 uRecordingsStart = s_uOSDStatsPanelsCountRecordings;
+      u32 uArrangementsStart = s_uOSDStatsPanelsCountArrangements;
 
-   if ( p->iDebugShowFullRXStats )
-      osd_render_stats_full_rx_port();
+      u32 uTimeStart = get_current_timestamp_micros();
+      for( int i=0; i<iFrames; i++ )
+      {
+         // 60 fps
+         g_TimeNow += 16;
+         osd_render_stats_panels();
+      }
+      u32 uTime = get_current_timestamp_micros() - uTimeStart;
+      _osd_stats_benchmark_get_lists_stats(&uAllocationsEnd, &uMemoryEnd);
+
+      char szBuff[256];
+      snprintf(szBuff, sizeof(szBuff), "%s: %d panels, %u us/frame, %u panels recordings, %u arrangements, %u display lists allocations (%u bytes total)",
+         (0 == iPass)?"Uncached (measure, arrange, draw each frame)":"Cached (record each stats refresh, replay each frame)",
+         s_iCountOSDStatsBoundingBoxes, uTime/iFrames,
+         s_uOSDStatsPanelsCountRecordings - uRecordingsStart, s_uOSDStatsPanelsCountArrangements - uArrangementsStart,
+         uAllocationsEnd - uAllocationsStart, uMemoryEnd);
+      log_line("[OSDStats] %s", szBuff);
+      printf("%s\n", szBuff);
+   }
+   s_bOSDStatsPanelsUncached = false;
 }
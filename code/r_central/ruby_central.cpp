@@ -38,6 +38,8 @@ Code written by: Petru Soroaga, 2021-2023
 #include "../base/shared_mem.h"
 #include "../base/base.h"
 #include "../base/hardware.h"
+#include "../base/system_metrics.h"
+#include "../base/frame_scheduler.h"
 #include "../base/hdmi.h"
 #include "../base/config.h"
 #include "../base/ctrl_settings.h"
@@ -55,6 +57,7 @@ Code written by: Petru Soroaga, 2021-2023
 #include "osd.h"
 #include "osd_common.h"
 #include "osd_plugins.h"
+#include "osd_stats.h"
 #include "menu.h"
 #include "popup.h"
 #include "shared_vars.h"
@@ -97,7 +100,6 @@ static u32 s_iMicroTimeOSDRender = 0;
 
 static u32 s_TimeLastRender = 0;
 static u32 s_TimeLastCPUCompute = 0;
-static u32 s_TimeLastCPUSpeed = 0;
 
 static u32 s_TimeCentralInitializationComplete = 0;
 static u32 s_TimeLastMenuInput = 0;
@@ -901,6 +903,7 @@ void render_all(u32 timeNow, bool bForceBackground, bool bDoInputLoop)
 
       if ( p->iShowCPULoad )
       {
+         float xTasks = xPos;
          xPos += 0.02*osd_getScaleOSD();
          sprintf(szBuff, "UI FPS: %d", s_iRubyFPS);
          osd_show_value(xPos, yPos, szBuff, g_idFontOSD );
@@ -916,6 +919,23 @@ void render_all(u32 timeNow, bool bForceBackground, bool bDoInputLoop)
          xPos += 0.1*osd_getScaleOSD();
          sprintf(szBuff, "OSD: %d ms/sec", (int)(s_iMicroTimeOSDRender*s_iRubyFPS/1000.0));
          osd_show_value(xPos, yPos, szBuff, g_idFontOSD );
+
+         // Main loop tasks: avg/max duration, missed deadlines, deferred runs
+         char szTasks[512];
+         szTasks[0] = 0;
+         for( int i=0; i<frame_scheduler_get_tasks_count(); i++ )
+         {
+            t_frame_scheduler_task_stats stats;
+            if ( ! frame_scheduler_get_task_stats(i, &stats) )
+               continue;
+            char szTask[96];
+            snprintf(szTask, sizeof(szTask), "%s%s: %.1f/%.1f ms, %u late, %u def", (0 == i)?"":"; ", frame_scheduler_get_task_name(i),
+               stats.uAvgDurationMicros/1000.0, stats.uMaxDurationMicros/1000.0, stats.uDeadlineMisses, stats.uDeferred);
+            if ( strlen(szTasks) + strlen(szTask) < sizeof(szTasks) )
+               strcat(szTasks, szTask);
+         }
+         if ( 0 != szTasks[0] )
+            osd_show_value(xTasks, yPos + osd_getFontHeight(), szTasks, g_idFontOSD );
       }
    }
 
@@ -961,41 +981,17 @@ void compute_cpu_load(u32 timeNow)
 
    s_TimeLastCPUCompute = timeNow;
 
-   FILE* fd = NULL;
-   static unsigned long long valgcpu[4] = {0,0,0,0};
-   unsigned long long tmp[4];
-   unsigned long long total;
-   int temp = 0;
-
-   fd = fopen("/proc/stat", "r");
-   fscanf(fd, "%*s %llu %llu %llu %llu", &tmp[0], &tmp[1], &tmp[2], &tmp[3] );
-   fclose(fd);
-   //printf("\n%llu, %llu, %llu, %llu", tmp[0], tmp[1], tmp[2], tmp[3] );
-   
-   if ( tmp[0] < valgcpu[0] || tmp[1] < valgcpu[1] || tmp[2] < valgcpu[2] || tmp[3] < valgcpu[3] )
-         g_ControllerCPULoad = 0;
-   else
-   {
-      total = (tmp[0] - valgcpu[0]) + (tmp[1] - valgcpu[1]) + (tmp[2] - valgcpu[2]);
-      if ( (total + (tmp[3] - valgcpu[3])) != 0 )
-         g_ControllerCPULoad = (total * 100) / (total + (tmp[3] - valgcpu[3]));
-   }
-      
-   valgcpu[0] = tmp[0]; valgcpu[1] = tmp[1]; valgcpu[2] = tmp[2]; valgcpu[3] = tmp[3]; 
-   //printf("\nCPU: %d %%\n", pDPVT->cpu_load);
-
-
-   if ( timeNow < s_TimeLastCPUSpeed + 5000 )
+   // Sampled natively on the system metrics thread, no file or shell access from the render loop
+   shared_mem_system_metrics metrics;
+   if ( ! system_metrics_get(&metrics) )
       return;
-   
-   s_TimeLastCPUSpeed = timeNow;
 
-   fd = fopen("/sys/class/thermal/thermal_zone0/temp", "r");
-   fscanf(fd, "%d", &temp);
-   fclose(fd);
-   g_ControllerTemp = temp/1000;
-
-   g_ControllerCPUSpeed = hardware_get_cpu_speed();
+   if ( metrics.uValidFlags & SYSTEM_METRICS_VALID_CPU_LOAD )
+      g_ControllerCPULoad = (int)metrics.uCPULoadPercent;
+   if ( metrics.uValidFlags & SYSTEM_METRICS_VALID_TEMPERATURE )
+      g_ControllerTemp = metrics.iTemperatureC;
+   if ( metrics.uValidFlags & SYSTEM_METRICS_VALID_CPU_SPEED )
+      g_ControllerCPUSpeed = (int)metrics.uCPUSpeedMHz;
 }
 
 void ruby_start_recording()
@@ -1032,11 +1028,11 @@ void ruby_start_recording()
    }
 
    g_uVideoRecordStartTime = get_current_timestamp_ms();
-   if ( 1 == hw_execute_bash_command_raw("df -m /home/pi/ruby | grep root", szBuff) )
+   shared_mem_system_metrics metrics;
+   if ( system_metrics_get(&metrics) && (metrics.uValidFlags & SYSTEM_METRICS_VALID_DISK_ROOT) )
    {
       char szTemp[1024];
-      long lb, lu, lf;
-      sscanf(szBuff, "%s %ld %ld %ld", szTemp, &lb, &lu, &lf);
+      long lf = (long)(metrics.disks[SYSTEM_METRICS_DISK_ROOT].uFreeKb/1024);
       if ( lf < 200 )
       {
          sprintf(szTemp, "You don't have enough free space on the SD card to start recording (%d Mb free). Move your media files to USB memory stick.", (int)lf);
@@ -2103,7 +2099,8 @@ void packets_scope_input_loop()
    }
 }
 
-void ruby_input_loop(bool bNoKeys)
+// Keys, menus and commands
+static void _ruby_input_loop_keys(bool bNoKeys)
 {
    ControllerSettings* pCS = get_ControllerSettings();
 
@@ -2137,7 +2134,11 @@ void ruby_input_loop(bool bNoKeys)
          }
       }
    }
+}
 
+// Pairing, links and local stats
+static void _ruby_links_loop()
+{
    if ( 0 == hardware_get_radio_interfaces_count() )
       return;
 
@@ -2159,47 +2160,66 @@ void ruby_input_loop(bool bNoKeys)
    }
 }
 
-void main_loop_r_central()
+void ruby_input_loop(bool bNoKeys)
 {
-   ControllerSettings* pCS = get_ControllerSettings();
+   _ruby_input_loop_keys(bNoKeys);
+   _ruby_links_loop();
+}
 
-   hardware_sleep_ms(2);
-   
-   try_read_messages_from_router(7);
+// Main loop tasks, once the start sequence is completed. See frame_scheduler.h
+// They all touch the UI state (menus, popups, models), so they run on the main thread, except the CPU load
+// that only reads the system metrics shared memory.
 
-   ruby_input_loop(false);
+static int s_iCentralTaskRender = -1;
+static int s_iCentralTaskRenderFPS = 0;
 
-   if ( s_StartSequence != START_SEQ_COMPLETED && s_StartSequence != START_SEQ_FAILED )
-   {
-      hardware_sleep_ms(5);
-      start_loop();
-      render_all(g_TimeNow, false, false);
-      if ( NULL != s_pProcessStatsCentral )
-         s_pProcessStatsCentral->lastActiveTime = g_TimeNow;
-      return;
-   }
+static void _central_task_update_time()
+{
+   g_TimeNow = get_current_timestamp_ms();
+   g_TimeNowMicros = get_current_timestamp_micros();
+}
 
-   if ( s_StartSequence != START_SEQ_COMPLETED )
-      return;
+// Idle task: waits for router messages until the next due task
+static void _central_task_router(void* pContext, u32 uBudgetMicros)
+{
+   _central_task_update_time();
+   try_read_messages_from_router((uBudgetMicros+500)/1000);
+}
 
-   compute_cpu_load(g_TimeNow);
+static void _central_task_render(void* pContext, u32 uBudgetMicros)
+{
+   _central_task_update_time();
+   ruby_signal_alive();
+   s_TimeLastRender = g_TimeNow;
+   render_all(g_TimeNow, false, false);
+   if ( NULL != s_pProcessStatsCentral )
+      s_pProcessStatsCentral->lastActiveTime = g_TimeNow;
 
-   int dt = 1000/15;
-   if ( 0 != pCS->iRenderFPS )
-      dt = 1000/pCS->iRenderFPS;
-   if ( g_TimeNow >= s_TimeLastRender+dt )
-   {
-      ruby_signal_alive();
-      s_TimeLastRender = g_TimeNow;
-      render_all(g_TimeNow, false, false);
-      if ( NULL != s_pProcessStatsCentral )
-         s_pProcessStatsCentral->lastActiveTime = g_TimeNow;
+   if ( g_bIsReinit )
+   if ( s_iFPSCount > 5 )
+      quit = true;
+}
 
-      if ( g_bIsReinit )
-      if ( s_iFPSCount > 5 )
-         quit = true;
-   }
+static void _central_task_input(void* pContext, u32 uBudgetMicros)
+{
+   _central_task_update_time();
+   _ruby_input_loop_keys(false);
+}
+
+static void _central_task_links(void* pContext, u32 uBudgetMicros)
+{
+   _central_task_update_time();
+   _ruby_links_loop();
+}
+
+static void _central_task_cpu_load(void* pContext, u32 uBudgetMicros)
+{
+   compute_cpu_load(get_current_timestamp_ms());
+}
 
+static void _central_task_hdmi_check(void* pContext, u32 uBudgetMicros)
+{
+   _central_task_update_time();
    if ( g_bIsHDMIConfirmation )
    if ( NULL != s_pMenuConfirmHDMI )
    if ( g_TimeNow > s_TimeCentralInitializationComplete + 10000 )
@@ -2239,6 +2259,56 @@ void main_loop_r_central()
    }
 }
 
+static void _central_update_render_period()
+{
+   ControllerSettings* pCS = get_ControllerSettings();
+   if ( (s_iCentralTaskRender >= 0) && (s_iCentralTaskRenderFPS == pCS->iRenderFPS) )
+      return;
+   s_iCentralTaskRenderFPS = pCS->iRenderFPS;
+   u32 uPeriodMicros = 1000000/15;
+   if ( 0 != pCS->iRenderFPS )
+      uPeriodMicros = 1000000/pCS->iRenderFPS;
+
+   if ( s_iCentralTaskRender >= 0 )
+   {
+      frame_scheduler_set_task_period(s_iCentralTaskRender, uPeriodMicros);
+      return;
+   }
+
+   frame_scheduler_init(NULL, NULL);
+   s_iCentralTaskRender = frame_scheduler_add_task("render", FRAME_SCHEDULER_PRIORITY_CRITICAL, uPeriodMicros, 10000, 0, _central_task_render, NULL);
+   frame_scheduler_add_task("router", FRAME_SCHEDULER_PRIORITY_CRITICAL, 0, 1000, FRAME_SCHEDULER_FLAG_IDLE, _central_task_router, NULL);
+   frame_scheduler_add_task("input", FRAME_SCHEDULER_PRIORITY_HIGH, 10000, 1000, 0, _central_task_input, NULL);
+   frame_scheduler_add_task("links", FRAME_SCHEDULER_PRIORITY_HIGH, 20000, 1000, 0, _central_task_links, NULL);
+   frame_scheduler_add_task("cpu", FRAME_SCHEDULER_PRIORITY_LOW, 500000, 100, FRAME_SCHEDULER_FLAG_WORKER, _central_task_cpu_load, NULL);
+   frame_scheduler_add_task("hdmi", FRAME_SCHEDULER_PRIORITY_LOW, 1000000, 100, 0, _central_task_hdmi_check, NULL);
+}
+
+void main_loop_r_central()
+{
+   if ( s_StartSequence == START_SEQ_COMPLETED )
+   {
+      _central_update_render_period();
+      frame_scheduler_run();
+      return;
+   }
+
+   hardware_sleep_ms(2);
+   
+   try_read_messages_from_router(7);
+
+   ruby_input_loop(false);
+
+   if ( s_StartSequence != START_SEQ_COMPLETED && s_StartSequence != START_SEQ_FAILED )
+   {
+      hardware_sleep_ms(5);
+      start_loop();
+      render_all(g_TimeNow, false, false);
+      if ( NULL != s_pProcessStatsCentral )
+         s_pProcessStatsCentral->lastActiveTime = g_TimeNow;
+   }
+}
+
 void ruby_signal_alive()
 {
    if ( NULL != s_pProcessStatsCentral )
@@ -2348,6 +2418,24 @@ int main(int argc, char *argv[])
       */
    }
 
+   if ( strcmp(argv[argc-1], "-benchstats") == 0 )
+   {
+      log_line("Running OSD stats panels benchmark (offscreen)...");
+      load_Preferences();
+      load_ControllerSettings();
+      g_pRenderEngine = render_init_offscreen_engine(1920, 1080);
+      load_resources();
+      if ( NULL == g_pCurrentModel )
+      {
+         g_pCurrentModel = new Model();
+         g_pCurrentModel->resetToDefaults(false);
+      }
+      g_TimeNow = get_current_timestamp_ms();
+      osd_stats_run_benchmark(600);
+      log_line("Done running OSD stats panels benchmark. Exit now.");
+      return 0;
+   }
+
    g_bIsHDMIConfirmation = false;
    if ( access( FILE_TMP_HDMI_CHANGED, R_OK ) != -1 )
       g_bIsHDMIConfirmation = true;
@@ -2362,6 +2450,8 @@ int main(int argc, char *argv[])
 
    ruby_clear_all_ipc_channels();
 
+   system_metrics_sampler_start(SHARED_MEM_SYSTEM_METRICS, SYSTEM_METRICS_SAMPLE_INTERVAL_MS);
+
    s_pProcessStatsCentral = shared_mem_process_stats_open_write(SHARED_MEM_WATCHDOG_CENTRAL);
    if ( NULL == s_pProcessStatsCentral )
       log_softerror_and_alarm("Failed to open shared mem for ruby_central process watchdog for writing: %s", SHARED_MEM_WATCHDOG_CENTRAL);
@@ -2451,9 +2541,14 @@ int main(int argc, char *argv[])
       }
    }
    
+   frame_scheduler_log_stats();
+   frame_scheduler_release();
+
    if ( ! g_bIsReinit )
       pairing_stop();
    controller_stop_i2c();
+   media_uninit();
+   system_metrics_sampler_stop();
    for( int i=0; i<g_iPluginsOSDCount; i++ )
       if ( NULL != g_pPluginsOSD[i] )
       if ( NULL != g_pPluginsOSD[i]->pLibrary )
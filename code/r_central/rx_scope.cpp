@@ -12,28 +12,23 @@ Code written by: Petru Soroaga, 2021-2023
 #include "rx_scope.h"
 #include "../base/base.h"
 #include "../base/config.h"
+#include "../base/hardware_radio_sik.h"
 #include "../radio/radiolink.h"
+#include "../radio/rx_scope_capture.h"
 
 #include "../renderer/render_engine.h"
 #include "pairing.h"
 #include "shared_vars.h"
 
-typedef struct
-{
-   int received_bytes;
-   int received_video;
-   int received_video_retransmission;
-   int received_telemetry;
-   int received_commands;
-} scope_rx_slice_info_t;  
-
 #define RXSCOPE_SLICES 2000
 
-static scope_rx_slice_info_t s_RXScopeRXSlices[RXSCOPE_SLICES];
+// Snapshot of the capture timeline, taken at each render
+static t_rx_scope_slice s_RXScopeRXSlices[RXSCOPE_SLICES];
 
 static bool s_bRXScopeStarted = false;
 static bool s_bRXScopeWasPairingStarted = false;
-static int  s_RXScopeInterfaceRx = -1;
+static int  s_RXScopeInterfacesRx[MAX_RADIO_INTERFACES];
+static int  s_RXScopeInterfacesRxCount = 0;
 static int  s_RXScopePage = 0;
 static int  s_RXScopeZoom = 0;
 static bool s_RXScopePaused = false;
@@ -59,8 +54,8 @@ static int s_RXScopeSliceInterval = 1000; // in microseconds
 static int s_RXScopeSlicesCount = 1000;
 static int s_RXScopeCurrentSliceIndex = -1;
 
-static int s_RXScopeThisFramePackets = 0;
-static int s_RXScopeThisFrameKb = 0;
+static u32 s_RXScopeLastStatsPackets = 0;
+static u32 s_RXScopeLastStatsBytes = 0;
 
 static int s_RXScopeLastFramePackets = 0;
 static int s_RXScopeLastFrameKb = 0;
@@ -76,21 +71,29 @@ void rx_scope_start()
    s_bRXScopeWasPairingStarted = pairing_isStarted();
    pairing_stop();
 
-   s_RXScopeInterfaceRx = 0;
-   radio_open_interface_for_read(0, RADIO_PORT_ROUTER_DOWNLINK);
-
-   for( int i=0; i<RXSCOPE_SLICES; i++ )
+   // Capture on all the radio interfaces that can be read in monitor mode
+   t_rx_scope_capture_params params;
+   rx_scope_capture_params_reset(&params);
+   s_RXScopeInterfacesRxCount = 0;
+   for( int i=0; i<hardware_get_radio_interfaces_count(); i++ )
    {
-      s_RXScopeRXSlices[i].received_bytes = 0;
-      s_RXScopeRXSlices[i].received_video = 0;
-      s_RXScopeRXSlices[i].received_video_retransmission = 0;
-      s_RXScopeRXSlices[i].received_telemetry = 0;
-      s_RXScopeRXSlices[i].received_commands = 0;
+      if ( hardware_radio_index_is_sik_radio(i) )
+         continue;
+      if ( radio_open_interface_for_read(i, RADIO_PORT_ROUTER_DOWNLINK) <= 0 )
+         continue;
+      s_RXScopeInterfacesRx[s_RXScopeInterfacesRxCount] = i;
+      s_RXScopeInterfacesRxCount++;
+      params.iInterfaces[params.iInterfacesCount] = i;
+      params.iInterfacesCount++;
    }
+
+   memset(s_RXScopeRXSlices, 0, sizeof(s_RXScopeRXSlices));
    s_RXScopeCurrentSliceIndex = -1;
 
    s_RXScopeSliceInterval = 1; // ms
    s_RXScopeSlicesCount = 1000;
+   params.uSliceMicros = s_RXScopeSliceInterval * 1000;
+   rx_scope_capture_start(&params);
 
    s_RXScopePaused = false;
 
@@ -100,8 +103,8 @@ void rx_scope_start()
    s_RXScopeDataFPS = 0;
    s_RXScopeRenderFPS = 0;
 
-   s_RXScopeThisFramePackets = 0;
-   s_RXScopeThisFrameKb = 0;
+   s_RXScopeLastStatsPackets = 0;
+   s_RXScopeLastStatsBytes = 0;
    s_RXScopeLastFramePackets = 0;
    s_RXScopeLastFrameKb = 0;
 
@@ -113,8 +116,10 @@ void rx_scope_stop()
    if ( ! s_bRXScopeStarted )
       return;
 
-   radio_close_interface_for_read(s_RXScopeInterfaceRx);
-   s_RXScopeInterfaceRx = -1;
+   rx_scope_capture_stop();
+   for( int i=0; i<s_RXScopeInterfacesRxCount; i++ )
+      radio_close_interface_for_read(s_RXScopeInterfacesRx[i]);
+   s_RXScopeInterfacesRxCount = 0;
 
    s_bRXScopeStarted = false;
    
@@ -122,6 +127,13 @@ void rx_scope_stop()
       pairing_start();
 }
 
+int rx_scope_set_pcap_export(const char* szFile)
+{
+   if ( ! s_bRXScopeStarted )
+      return 0;
+   return rx_scope_capture_set_pcap_export(szFile);
+}
+
 bool rx_scope_is_started()
 {
    return s_bRXScopeStarted;
@@ -291,25 +303,25 @@ void rx_scope_render()
 
    for ( int i=0; i<slicesToRender; i++ )
    {
-      if ( 0 < s_RXScopeRXSlices[i].received_bytes )
+      if ( 0 < s_RXScopeRXSlices[i].uBytes )
       {
-         int lineH = (endY-startY) * s_RXScopeRXSlices[i].received_bytes/s_RXScopeYMax;
+         int lineH = (endY-startY) * s_RXScopeRXSlices[i].uBytes/s_RXScopeYMax;
          if ( lineH > endY-startY )
             lineH = endY-startY;
          Fill(255,255,255,1);
          Rect(posX, startY, sliceWidth-1, lineH);
       }
-      if ( s_RXScopeRXSlices[i].received_commands > 0 )
+      if ( s_RXScopeRXSlices[i].uCommands > 0 )
       {
          Fill(255,255,0,1);
          Rect(posX, startY-s_RXScopeRenderBottomBand, sliceWidth-1, s_RXScopeRenderBottomBand-10);
       }
-      if ( s_RXScopeRXSlices[i].received_telemetry > 0 )
+      if ( s_RXScopeRXSlices[i].uTelemetry > 0 )
       {
          Fill(0,0,255,1);
          Rect(posX, startY-s_RXScopeRenderBottomBand, sliceWidth-1, s_RXScopeRenderBottomBand-10);
       }
-      if ( s_RXScopeRXSlices[i].received_video_retransmission > 0 )
+      if ( s_RXScopeRXSlices[i].uVideoRetransmissions > 0 )
       {
          Fill(0,255,0,1);
          Rect(posX, startY-s_RXScopeRenderBottomBand, sliceWidth-1, s_RXScopeRenderBottomBand-10);
@@ -322,108 +334,24 @@ void rx_scope_render()
 */
 }
 
+// The capture thread keeps the timeline; here only a snapshot of the last second is taken
+
 void rx_scope_read_data()
 {
-   if ( -1 == s_RXScopeInterfaceRx )
-      return;
-
-   int miliSec = (s_RXScopeTimeNowMicroSeconds/1000) % 1000;
-   int sliceIndex = miliSec / s_RXScopeSliceInterval;   
-   if ( sliceIndex < 0 ) sliceIndex = 0;
-   if ( sliceIndex > s_RXScopeSlicesCount ) sliceIndex = s_RXScopeSlicesCount;
-
-   if ( sliceIndex != s_RXScopeCurrentSliceIndex )
-   {
-      s_RXScopeRXSlices[sliceIndex].received_bytes = 0;       
-      s_RXScopeRXSlices[sliceIndex].received_video = 0;       
-      s_RXScopeRXSlices[sliceIndex].received_video_retransmission = 0;       
-      s_RXScopeRXSlices[sliceIndex].received_telemetry = 0;       
-      s_RXScopeRXSlices[sliceIndex].received_commands = 0;       
-
-      int clearIndex = s_RXScopeCurrentSliceIndex+1;
-      if ( clearIndex > s_RXScopeSlicesCount )
-         clearIndex = 0;
-      while ( clearIndex != sliceIndex )
-      {
-         s_RXScopeRXSlices[clearIndex].received_bytes = 0;       
-         s_RXScopeRXSlices[clearIndex].received_video = 0;       
-         s_RXScopeRXSlices[clearIndex].received_video_retransmission = 0;       
-         s_RXScopeRXSlices[clearIndex].received_telemetry = 0;       
-         s_RXScopeRXSlices[clearIndex].received_commands = 0;       
-         clearIndex++;
-         if ( clearIndex > s_RXScopeSlicesCount )
-            clearIndex = 0;
-      }
-   }
-
-   if ( sliceIndex < s_RXScopeCurrentSliceIndex )
-   {
-      s_RXScopeLastFramePackets = s_RXScopeThisFramePackets;
-      s_RXScopeLastFrameKb = s_RXScopeThisFrameKb;
-      s_RXScopeThisFramePackets = 0;
-      s_RXScopeThisFrameKb = 0;
-   }
-
-   s_RXScopeCurrentSliceIndex = sliceIndex;
-
-
-   fd_set readset;
-   struct timeval to;
-   to.tv_sec = 0;
-   to.tv_usec = 400;
-         
-   int maxfd = -1;
-   FD_ZERO(&readset);
-   
-   radio_hw_info_t* pNICInfo = hardware_get_radio_info(s_RXScopeInterfaceRx);
-
-   FD_SET(pNICInfo->monitor_interface_read.selectable_fd, &readset);
-   if ( pNICInfo->monitor_interface_read.selectable_fd > maxfd )
-      maxfd = pNICInfo->monitor_interface_read.selectable_fd;
-
-   int n = select(maxfd+1, &readset, NULL, NULL, &to);
-   if ( n == 0 )
-      return;
-   if ( n < 0 )
+   t_rx_scope_capture_stats stats;
+   if ( ! rx_scope_capture_get_stats(&stats) )
       return;
 
-   if (! FD_ISSET(pNICInfo->monitor_interface_read.selectable_fd, &readset))
-      return;
+   // The last slices, aligned to the second, same as the scope's time axis
+   u32 uSecondStartSlice = stats.uLastSliceNumber - (stats.uLastSliceNumber % (u32)s_RXScopeSlicesCount);
+   u32 uLastSlice = uSecondStartSlice + (u32)s_RXScopeSlicesCount - 1;
+   rx_scope_capture_get_timeline(s_RXScopeRXSlices, s_RXScopeSlicesCount, uLastSlice);
+   s_RXScopeCurrentSliceIndex = (int)(stats.uLastSliceNumber - uSecondStartSlice);
 
-   u8* rxBuffer = NULL;
-   int rxLength = 0;
-   t_packet_header* pPH = NULL;
-
-   rxBuffer = radio_process_wlan_data_in(s_RXScopeInterfaceRx, &rxLength);
-   if ( NULL == rxBuffer )
-      return;
-   if ( rxLength < (int)(sizeof(t_packet_header)) )
-      return;
-
-   pPH = (t_packet_header*)rxBuffer;
-
-   if ( ! packet_check_crc(rxBuffer, rxLength) )
-      return;
-
-   //log_line("Received a packet type: %d", pdph->packetType);
-
-   s_RXScopeThisFramePackets++;
-   s_RXScopeThisFrameKb += rxLength;
-   s_RXScopeRXSlices[sliceIndex].received_bytes += rxLength;
-
-   if ( (pPH->packet_flags & PACKET_FLAGS_MASK_MODULE) == PACKET_COMPONENT_TELEMETRY )
-      s_RXScopeRXSlices[sliceIndex].received_telemetry++;
-   else if ( (pPH->packet_flags & PACKET_FLAGS_MASK_MODULE) == PACKET_COMPONENT_COMMANDS )
-      s_RXScopeRXSlices[sliceIndex].received_commands++;
-   else if ( (pPH->packet_flags & PACKET_FLAGS_MASK_MODULE) == PACKET_COMPONENT_RUBY )
-      s_RXScopeRXSlices[sliceIndex].received_commands++;
-   else if ( (pPH->packet_flags & PACKET_FLAGS_MASK_MODULE) == PACKET_COMPONENT_VIDEO )
-   {
-      if ( pPH->packet_flags & PACKET_FLAGS_BIT_RETRANSMITED )
-         s_RXScopeRXSlices[sliceIndex].received_video_retransmission++;
-      else
-         s_RXScopeRXSlices[sliceIndex].received_video++;
-   }
+   s_RXScopeLastFramePackets = (int)(stats.uPackets - s_RXScopeLastStatsPackets);
+   s_RXScopeLastFrameKb = (int)((stats.uBytes - s_RXScopeLastStatsBytes)/1000);
+   s_RXScopeLastStatsPackets = stats.uPackets;
+   s_RXScopeLastStatsBytes = stats.uBytes;
 }
 
 void rx_scope_on_page_change()
@@ -5,3 +5,6 @@ void rx_scope_stop();
 bool rx_scope_is_started();
 void rx_scope_loop();
 
+
+// Writes the captured radio frames to a pcap file (NULL or empty stops it)
+int rx_scope_set_pcap_export(const char* szFile);
@@ -17,6 +17,7 @@ Code written by: Petru Soroaga, 2021-2023
 #include "../base/ctrl_interfaces.h"
 #include "../base/ctrl_settings.h"
 #include "../base/shared_mem_i2c.h"
+#include "../base/i2c_scheduler.h"
 #include "ruby_i2c.h"
 
 #include <time.h>
@@ -28,12 +29,10 @@ Code written by: Petru Soroaga, 2021-2023
 bool g_bQuit = false;
 u32 g_TimeNow = 0;
 u32 g_TimeLastReloadCheck = 0;
-u32 g_TimeLastINARead = 0;
-u32 g_TimeLastRCInRead = 0;
 u32 g_TimeLastRCInFrameChange = 0;
 u32 g_TimeLastRCInReadFull = 0;
 
-u32 g_SleepTime = 50;
+u32 g_SleepTime = 50; // RC in and buttons read period
 
 bool g_bHasINA = false;
 int g_nINAAddress = 0;
@@ -62,8 +61,35 @@ t_shared_mem_i2c_rotary_encoder_buttons_events* g_pSMRotaryEncoderButtonsEvents
 u16 s_lastRCReadVals[I2C_DEVICE_PARAM_MAX_CHANNELS];
 u8 s_uLastFrameNumber = 0;
 
+int g_iRCInNotifyFd = -1;
+u32 g_TimeLastRCInNotifyOpen = 0;
+
+// Wakes up the RC TX process as soon as a new RC in frame is in the shared memory
+void _notify_rc_in_frame()
+{
+   if ( g_iRCInNotifyFd < 0 )
+   {
+      // No reader yet, retry once a second
+      if ( g_TimeNow < g_TimeLastRCInNotifyOpen + 1000 )
+         return;
+      g_TimeLastRCInNotifyOpen = g_TimeNow;
+      g_iRCInNotifyFd = shared_mem_i2c_controller_rc_in_open_notify_for_write();
+      if ( g_iRCInNotifyFd < 0 )
+         return;
+      log_line("Opened RC in notify pipe.");
+   }
+   if ( shared_mem_i2c_controller_rc_in_notify(g_iRCInNotifyFd) < 0 )
+   {
+      log_line("RC in notify pipe reader closed.");
+      close(g_iRCInNotifyFd);
+      g_iRCInNotifyFd = -1;
+   }
+}
+
 void close_files()
 {
+   i2c_scheduler_remove_all_devices();
+
    if ( g_nINAFd > 0 )
       close(g_nINAFd);
    g_nINAFd = 0;
@@ -404,470 +430,485 @@ void load_settings()
       else
          wiringPiI2CWriteReg8(file, I2C_DEVICE_COMMAND_ID_RC_IN_SET_INVERTED, 0);
    }
+
+   schedule_i2c_devices();
 }
 
-void checkReadINA()
-{
-   if (  g_TimeNow < g_TimeLastINARead )
-      g_TimeLastINARead = g_TimeNow;
+// Devices polled by the I2C scheduler
 
-   if ( g_TimeNow < g_TimeLastINARead + 300 )
-      return;
+typedef struct
+{
+   int iExternalIndex;
+   int iStep;
+   int iFirstChannel; // RC channels read on this step
+   int iChannels;
+   int iChannelsToRead; // RC channels read for this frame
+} t_i2c_poll_context;
+
+t_i2c_poll_context g_I2CPollContexts[I2C_SCHEDULER_MAX_DEVICES];
+int g_iCountI2CPollContexts = 0;
+
+// Pending rotary encoders/buttons events, from all the devices read in a scheduler run
+int g_iPendingButtonsEventsDevices = 0;
+u32 g_uPendingButtonsEvents = 0;
+u32 g_uPendingRotaryEvents = 0;
+u32 g_uPendingRotaryEvents2 = 0;
+u32 g_uPendingButtonsEventsTime = 0;
+
+int _get_bus_number(u8 uAddress)
+{
+   int iBus = hardware_get_i2c_device_bus_number(uAddress);
+   if ( iBus < 0 )
+      iBus = 1; // same bus wiringPi uses
+   return iBus;
+}
 
-   g_TimeLastINARead = g_TimeNow;
+// Register read, as wiringPiI2CReadReg8/16: register write, then read. The Pico devices are scheduled with
+// 2 messages per transfer, so each register is still a separate transaction.
+int _add_read_reg_msgs(struct i2c_msg* pMsgs, int iCountMsgs, u8* pBuffer, int* piOffset, u8 uRegister, int iLength)
+{
+   pBuffer[*piOffset] = uRegister;
+   pMsgs[iCountMsgs].flags = 0;
+   pMsgs[iCountMsgs].len = 1;
+   pMsgs[iCountMsgs].buf = &pBuffer[*piOffset];
+   pMsgs[iCountMsgs+1].flags = I2C_M_RD;
+   pMsgs[iCountMsgs+1].len = iLength;
+   pMsgs[iCountMsgs+1].buf = &pBuffer[(*piOffset)+1];
+   (*piOffset) += 1 + iLength;
+   return iCountMsgs + 2;
+}
 
-   if ( 0 < g_nINAFd )
-   if ( g_pDeviceInfoINA->uParams[0] == 0 || g_pDeviceInfoINA->uParams[0] == 2 )
+// External devices command: start flag, command, crc, then read the response.
+// One message per byte, the devices are scheduled with one message per transfer: same single byte
+// transactions as wiringPiI2CWrite/wiringPiI2CRead.
+int _add_command_msgs(struct i2c_msg* pMsgs, int iCountMsgs, u8* pBuffer, int* piOffset, u8 uCommand, int iResponseLength)
+{
+   u8* pCommand = &pBuffer[*piOffset];
+   pCommand[0] = I2C_COMMAND_START_FLAG;
+   pCommand[1] = uCommand;
+   pCommand[2] = base_compute_crc8(pCommand,2);
+   for( int i=0; i<3+iResponseLength; i++ )
    {
-      u32 valV  = wiringPiI2CReadReg16(g_nINAFd, 2); 
-      valV = revert_word(valV);
-      valV = (valV>>3)*4;
-      if ( NULL != g_pSMCurrent )
-      {
-         g_pSMCurrent->voltage = valV;
-         g_pSMCurrent->lastSetTime = g_TimeNow;
-      }
+      pMsgs[iCountMsgs].flags = (i < 3)?0:I2C_M_RD;
+      pMsgs[iCountMsgs].len = 1;
+      pMsgs[iCountMsgs].buf = &pBuffer[(*piOffset)+i];
+      iCountMsgs++;
    }
-   if ( 0 < g_nINAFd )
+   (*piOffset) += 3 + iResponseLength;
+   return iCountMsgs;
+}
+
+int _build_INA(int iDevice, void* pContext, struct i2c_msg* pMsgs, int iMaxMsgs, u8* pBuffer)
+{
+   int iCountMsgs = 0;
+   int iOffset = 0;
+   if ( g_pDeviceInfoINA->uParams[0] == 0 || g_pDeviceInfoINA->uParams[0] == 2 )
+      iCountMsgs = _add_read_reg_msgs(pMsgs, iCountMsgs, pBuffer, &iOffset, 2, 2);
    if ( g_pDeviceInfoINA->uParams[0] == 1 || g_pDeviceInfoINA->uParams[0] == 2 )
    {
-      u32 val = 4096;
-      val = ((val>>8) & 0xFF) | ((val & 0xFF) << 8);
-      wiringPiI2CWriteReg16 (g_nINAFd, 5, val); 
-
-      u32 valC  = wiringPiI2CReadReg16(g_nINAFd, 4); 
-      valC = revert_word(valC);
-      if ( NULL != g_pSMCurrent )
-      {
-         g_pSMCurrent->current = valC;
-         g_pSMCurrent->lastSetTime = g_TimeNow;
-      }
+      // Calibration register (4096), then the current register
+      pBuffer[iOffset] = 5;
+      pBuffer[iOffset+1] = (4096>>8) & 0xFF;
+      pBuffer[iOffset+2] = 4096 & 0xFF;
+      pMsgs[iCountMsgs].flags = 0;
+      pMsgs[iCountMsgs].len = 3;
+      pMsgs[iCountMsgs].buf = &pBuffer[iOffset];
+      iCountMsgs++;
+      iOffset += 3;
+      iCountMsgs = _add_read_reg_msgs(pMsgs, iCountMsgs, pBuffer, &iOffset, 4, 2);
    }
+   return iCountMsgs;
 }
 
-void _read_RCIn_OldMethod()
+int _on_read_INA(int iDevice, void* pContext, u8* pBuffer, u32 uTimeMs)
 {
-   if ( hardware_has_i2c_device_id(I2C_DEVICE_ADDRESS_PICO_RC_IN) )
-   if ( g_nFileRCIn <= 0 )
-   if ( NULL != g_pSMRCIn )
-   {
-      g_pSMRCIn->uFlags &= (~RC_IN_FLAG_HAS_INPUT); // No input
-      return;
-   }
+   if ( NULL == g_pSMCurrent )
+      return I2C_SCHEDULER_RESULT_OK;
 
-   if (	hardware_has_i2c_device_id(I2C_DEVICE_ADDRESS_PICO_EXTENDER) )
-   if ( g_nFilePicoExtender <= 0 )
-   if ( NULL != g_pSMRCIn )
+   // INA219 registers are big endian
+   int iOffset = 0;
+   if ( g_pDeviceInfoINA->uParams[0] == 0 || g_pDeviceInfoINA->uParams[0] == 2 )
    {
-      g_pSMRCIn->uFlags &= (~RC_IN_FLAG_HAS_INPUT); // No input
-      return;
+      u32 valV = (((u32)pBuffer[iOffset+1]) << 8) | pBuffer[iOffset+2];
+      valV = (valV>>3)*4;
+      g_pSMCurrent->voltage = valV;
+      g_pSMCurrent->lastSetTime = uTimeMs;
+      iOffset += 3;
    }
-
-   int file = g_nFileRCIn;
-   if ( g_nFilePicoExtender > 0 )
-      file = g_nFilePicoExtender;
-
-   int iFrameNumber = wiringPiI2CReadReg8(file, I2C_DEVICE_COMMAND_ID_RC_IN_GET_FRAME_NUMBER);
-
-   if ( iFrameNumber < 0 )
+   if ( g_pDeviceInfoINA->uParams[0] == 1 || g_pDeviceInfoINA->uParams[0] == 2 )
    {
-      g_pSMRCIn->uFlags &= (~RC_IN_FLAG_HAS_INPUT); // No input
-      return;
+      iOffset += 3;
+      u32 valC = (((u32)pBuffer[iOffset+1]) << 8) | pBuffer[iOffset+2];
+      g_pSMCurrent->current = valC;
+      g_pSMCurrent->lastSetTime = uTimeMs;
    }
+   return I2C_SCHEDULER_RESULT_OK;
+}
+
+// Pico RC In / Pico Extender: reads the frame number, then the channels if it's a new frame,
+// in steps of up to iMaxMsgs/2 channels
 
-   s_uLastFrameNumber = (u8)iFrameNumber;
+int _build_RCIn_Pico(int iDevice, void* pContext, struct i2c_msg* pMsgs, int iMaxMsgs, u8* pBuffer)
+{
+   t_i2c_poll_context* pPoll = (t_i2c_poll_context*)pContext;
+   int iOffset = 0;
+   if ( 0 == pPoll->iStep )
+      return _add_read_reg_msgs(pMsgs, 0, pBuffer, &iOffset, I2C_DEVICE_COMMAND_ID_RC_IN_GET_FRAME_NUMBER, 1);
 
-   if ( (u8)iFrameNumber == g_pSMRCIn->uFrameIndex )
+   if ( 1 == pPoll->iStep )
    {
-      if ( g_TimeNow > g_TimeLastRCInFrameChange + DEFAULT_RC_FAILSAFE_TIME )
+      int chToRead = 10;
+      if ( g_TimeNow >= g_TimeLastRCInReadFull + 100 )
       {
-         //log_line("To Remove No ISBUS/SBUS input 3");
-         g_pSMRCIn->uFlags &= (~RC_IN_FLAG_HAS_INPUT); // No input
+         g_TimeLastRCInReadFull = g_TimeNow;
+         chToRead = I2C_DEVICE_PARAM_MAX_CHANNELS;
       }
-      return;
+      if ( chToRead > I2C_DEVICE_PARAM_MAX_CHANNELS )
+         chToRead = I2C_DEVICE_PARAM_MAX_CHANNELS;
+      pPoll->iChannelsToRead = chToRead;
+      pPoll->iFirstChannel = 0;
    }
 
-   //log_line("Frame: %d", iFrameNumber);
-   g_pSMRCIn->uFlags |= RC_IN_FLAG_HAS_INPUT; // Has input
-   g_TimeLastRCInFrameChange =  g_TimeNow;
+   pPoll->iChannels = pPoll->iChannelsToRead - pPoll->iFirstChannel;
+   if ( pPoll->iChannels > iMaxMsgs/2 )
+      pPoll->iChannels = iMaxMsgs/2;
+   if ( 3*pPoll->iChannels > I2C_SCHEDULER_DEVICE_BUFFER_SIZE )
+      pPoll->iChannels = I2C_SCHEDULER_DEVICE_BUFFER_SIZE/3;
 
+   int iCountMsgs = 0;
+   for( int i=0; i<pPoll->iChannels; i++ )
+      iCountMsgs = _add_read_reg_msgs(pMsgs, iCountMsgs, pBuffer, &iOffset, I2C_DEVICE_COMMAND_ID_RC_IN_GET_CHANNEL+pPoll->iFirstChannel+i, 2);
+   return iCountMsgs;
+}
 
-   int chToRead = 10;
-   if ( chToRead > I2C_DEVICE_PARAM_MAX_CHANNELS )
-      chToRead = I2C_DEVICE_PARAM_MAX_CHANNELS;
+int _on_read_RCIn_Pico(int iDevice, void* pContext, u8* pBuffer, u32 uTimeMs)
+{
+   t_i2c_poll_context* pPoll = (t_i2c_poll_context*)pContext;
+   if ( NULL == g_pSMRCIn )
+      return I2C_SCHEDULER_RESULT_OK;
 
-   for( int i=0; i<chToRead; i++ )
-   {
-      s_lastRCReadVals[i] = wiringPiI2CReadReg16(file, I2C_DEVICE_COMMAND_ID_RC_IN_GET_CHANNEL+i);
-      if ( NULL != g_pDeviceInfoPicoExtender && 0 == g_pDeviceInfoPicoExtender->uParams[0] ) // SBUS
-         s_lastRCReadVals[i] = 1000 + 1000 * (((int)s_lastRCReadVals[i])-200) / 1600;
-   }
-   if ( g_TimeNow >= g_TimeLastRCInReadFull + 100 )
+   if ( 0 == pPoll->iStep )
    {
-      g_TimeLastRCInReadFull = g_TimeNow;
-      for( int i=chToRead; i<I2C_DEVICE_PARAM_MAX_CHANNELS; i++ )
+      u8 uFrameNumber = pBuffer[1];
+      s_uLastFrameNumber = uFrameNumber;
+      if ( uFrameNumber == g_pSMRCIn->uFrameIndex )
       {
-         s_lastRCReadVals[i] = wiringPiI2CReadReg16(file, I2C_DEVICE_COMMAND_ID_RC_IN_GET_CHANNEL+i);
-         if ( NULL != g_pDeviceInfoPicoExtender && 0 == g_pDeviceInfoPicoExtender->uParams[0] ) // SBUS
-            s_lastRCReadVals[i] = 1000 + 1000 * (((int)s_lastRCReadVals[i])-200) / 1600;
+         if ( uTimeMs > g_TimeLastRCInFrameChange + DEFAULT_RC_FAILSAFE_TIME )
+            g_pSMRCIn->uFlags &= (~RC_IN_FLAG_HAS_INPUT); // No input
+         return I2C_SCHEDULER_RESULT_OK;
       }
+      g_pSMRCIn->uFlags |= RC_IN_FLAG_HAS_INPUT; // Has input
+      g_TimeLastRCInFrameChange = uTimeMs;
+      pPoll->iStep = 1;
+      return I2C_SCHEDULER_RESULT_MORE;
    }
 
-   if ( NULL != g_pSMRCIn )
+   for( int i=0; i<pPoll->iChannels; i++ )
    {
-      int nCh = I2C_DEVICE_PARAM_MAX_CHANNELS;
-      if ( nCh > MAX_RC_CHANNELS )
-         nCh = MAX_RC_CHANNELS;
-
-      g_pSMRCIn->uTimeStamp = g_TimeNow;
-      g_pSMRCIn->uFrameIndex = (u8)iFrameNumber;
-      g_pSMRCIn->uChannelsCount = (u8)nCh;
-      for( int i=0; i<nCh; i++ )
-      {
-         if ( s_lastRCReadVals[i] < 2500 )
-            g_pSMRCIn->uChannels[i] = s_lastRCReadVals[i];
-         //else
-         //   log_line("%d: %u", i, (u32) s_lastRCReadVals[i]);
-      }
+      int iChannel = pPoll->iFirstChannel + i;
+      s_lastRCReadVals[iChannel] = ((u16)pBuffer[3*i+1]) | (((u16)pBuffer[3*i+2]) << 8);
+      if ( NULL != g_pDeviceInfoPicoExtender && 0 == g_pDeviceInfoPicoExtender->uParams[0] ) // SBUS
+         s_lastRCReadVals[iChannel] = 1000 + 1000 * (((int)s_lastRCReadVals[iChannel])-200) / 1600;
+   }
+   pPoll->iFirstChannel += pPoll->iChannels;
+   if ( pPoll->iFirstChannel < pPoll->iChannelsToRead )
+   {
+      pPoll->iStep++;
+      return I2C_SCHEDULER_RESULT_MORE;
    }
+   pPoll->iStep = 0;
 
-   /*
-   char szTmp[256];
-   char szOut[256];
-   sprintf(szOut, "Fr %d: ", iFrameNumber);
-   for( int i=0; i<12; i++ )
+   int nCh = I2C_DEVICE_PARAM_MAX_CHANNELS;
+   if ( nCh > MAX_RC_CHANNELS )
+      nCh = MAX_RC_CHANNELS;
+
+   g_pSMRCIn->uTimeStamp = uTimeMs;
+   g_pSMRCIn->uFrameIndex = s_uLastFrameNumber;
+   g_pSMRCIn->uChannelsCount = (u8)nCh;
+   for( int i=0; i<nCh; i++ )
    {
-      sprintf(szTmp, "%d ", (int)g_pSMRCIn->uChannels[i] );
-      strcat(szOut, szTmp);
+      if ( s_lastRCReadVals[i] < 2500 )
+         g_pSMRCIn->uChannels[i] = s_lastRCReadVals[i];
    }
-   log_line(szOut);
-   */
+   _notify_rc_in_frame();
+   return I2C_SCHEDULER_RESULT_OK;
 }
 
-void checkReadRCIn()
+void _on_error_RCIn_Pico(int iDevice, void* pContext, u32 uConsecutiveErrors)
 {
-   if ( NULL == g_pDeviceInfoRCIn && NULL == g_pDeviceInfoPicoExtender && (g_iHasExternalRCInputDevice==0) )
-      return;
-
-   if (  g_TimeNow < g_TimeLastRCInRead )
-      g_TimeLastRCInRead = g_TimeNow;
+   t_i2c_poll_context* pPoll = (t_i2c_poll_context*)pContext;
+   pPoll->iStep = 0;
+   if ( NULL != g_pSMRCIn )
+      g_pSMRCIn->uFlags &= (~RC_IN_FLAG_HAS_INPUT); // No input
+}
 
-   if ( g_TimeNow < g_TimeLastRCInRead + g_SleepTime )
-      return;
+// External devices RC input
 
-   g_TimeLastRCInRead = g_TimeNow;
- 
-   if ( NULL == g_pSMRCIn )
-      return;
+int _build_RCIn_External(int iDevice, void* pContext, struct i2c_msg* pMsgs, int iMaxMsgs, u8* pBuffer)
+{
+   int iOffset = 0;
+   if ( iMaxMsgs < 3+27 )
+      return 0;
+   return _add_command_msgs(pMsgs, 0, pBuffer, &iOffset, I2C_COMMAND_ID_RC_GET_CHANNELS, 27);
+}
 
-   if ( (g_nFileRCIn > 0) || (g_nFilePicoExtender > 0) )
+int _on_read_RCIn_External(int iDevice, void* pContext, u8* pBuffer, u32 uTimeMs)
+{
+   u8* bufferIn = &pBuffer[3];
+   u8 uCRC = base_compute_crc8(bufferIn,26);
+   if ( uCRC != bufferIn[26] )
    {
-   	  _read_RCIn_OldMethod();
-      return;
+      g_iReadRCInConsecutiveFailCount++;
+      return I2C_SCHEDULER_RESULT_ERROR;
    }
 
-   u8 bufferOut[64];
-   u8 bufferIn[64];
-   for( int iDevice=0; iDevice<g_nCountExternalDevices; iDevice++ )
-   {
-     	if ( ! (g_uListExternalDevicesFlags[iDevice] & I2C_CAPABILITY_FLAG_RC_INPUT) )
-         continue;
-   	  if ( g_pListExternalDevices[iDevice]->uParams[0] == 0 )
-   	     continue;
-   	  if ( g_nListFilesExternalDevices[iDevice] <= 0 )
-   	  {
-   	     g_pSMRCIn->uFlags &= (~RC_IN_FLAG_HAS_INPUT); // No input
-   	     return;
-      }
-
-      // Get device RC channels
+   g_iReadRCInConsecutiveFailCount = 0;
 
-      bufferOut[0] = I2C_COMMAND_START_FLAG;
-      bufferOut[1] = I2C_COMMAND_ID_RC_GET_CHANNELS;
-      bufferOut[2] = base_compute_crc8(bufferOut,2);
-      wiringPiI2CWrite(g_nListFilesExternalDevices[iDevice], bufferOut[0]);
-      wiringPiI2CWrite(g_nListFilesExternalDevices[iDevice], bufferOut[1]);
-      wiringPiI2CWrite(g_nListFilesExternalDevices[iDevice], bufferOut[2]);
-      for( int i=0; i<27; i++ )
-      {
-         int res = wiringPiI2CRead(g_nListFilesExternalDevices[iDevice]);
-         if ( res < 0 )
-         {
-            log_softerror_and_alarm("Failed to get I2C external device RC channels at address 0x%02X (external module), got: %d. ", g_pListExternalDevices[iDevice]->nI2CAddress, res);
-            g_iReadRCInConsecutiveFailCount++;
-            return;
-         }
-         bufferIn[i] = res;
-      }
-      u8 uCRC = base_compute_crc8(bufferIn,26);
-      if ( uCRC != bufferIn[26] )
-      {
-         //log_softerror_and_alarm("Failed to get I2C external device RC channels at address 0x%02X (external module), invalid CRC in response.", g_pListExternalDevices[iDevice]->nI2CAddress);
-         g_iReadRCInConsecutiveFailCount++;
-         return;      	
-      }
-
-      g_iReadRCInConsecutiveFailCount = 0;
+   if ( NULL == g_pSMRCIn )
+      return I2C_SCHEDULER_RESULT_OK;
 
-      if ( NULL != g_pSMRCIn )
-      {
-         int nCh = 16;
-         if ( nCh > MAX_RC_CHANNELS )
-            nCh = MAX_RC_CHANNELS;
+   int nCh = 16;
+   if ( nCh > MAX_RC_CHANNELS )
+      nCh = MAX_RC_CHANNELS;
 
-         g_pSMRCIn->uTimeStamp = g_TimeNow;
-         g_pSMRCIn->uFrameIndex = bufferIn[1];
-         if ( bufferIn[0] & 0x01 )
-            g_pSMRCIn->uFlags &= (~RC_IN_FLAG_HAS_INPUT); // No input
-         else
-            g_pSMRCIn->uFlags |= RC_IN_FLAG_HAS_INPUT;
+   g_pSMRCIn->uTimeStamp = uTimeMs;
+   g_pSMRCIn->uFrameIndex = bufferIn[1];
+   if ( bufferIn[0] & 0x01 )
+      g_pSMRCIn->uFlags &= (~RC_IN_FLAG_HAS_INPUT); // No input
+   else
+      g_pSMRCIn->uFlags |= RC_IN_FLAG_HAS_INPUT;
 
-         g_pSMRCIn->uChannelsCount = (u8)nCh;
-         for( int i=0; i<nCh; i++ )
-         {
-            u16 val = bufferIn[2+i];
-            if ( (i%2) == 0 )
-               val += (bufferIn[18+i/2] & 0x0F)*256;
-            else
-               val += (bufferIn[18+i/2]>>4)*256;
-            if ( val > 500 && val < 2500 )
-               g_pSMRCIn->uChannels[i] = val;
-         }
-      }
+   g_pSMRCIn->uChannelsCount = (u8)nCh;
+   for( int i=0; i<nCh; i++ )
+   {
+      u16 val = bufferIn[2+i];
+      if ( (i%2) == 0 )
+         val += (bufferIn[18+i/2] & 0x0F)*256;
+      else
+         val += (bufferIn[18+i/2]>>4)*256;
+      if ( val > 500 && val < 2500 )
+         g_pSMRCIn->uChannels[i] = val;
    }
+   _notify_rc_in_frame();
+   return I2C_SCHEDULER_RESULT_OK;
 }
 
-void checkReadRotaryEncoderAndButtons()
+void _on_error_RCIn_External(int iDevice, void* pContext, u32 uConsecutiveErrors)
 {
-   if ( NULL == g_pSMRotaryEncoderButtonsEvents )
-      return;
-
-   if ( NULL == g_pDeviceInfoPicoExtender && (! g_bHasExternalRotaryDevice) )
-      return;
+   t_i2c_poll_context* pPoll = (t_i2c_poll_context*)pContext;
+   if ( 1 == uConsecutiveErrors )
+      log_softerror_and_alarm("Failed to get I2C external device RC channels at address 0x%02X (external module).", g_pListExternalDevices[pPoll->iExternalIndex]->nI2CAddress);
+   g_iReadRCInConsecutiveFailCount++;
+}
 
-   ControllerSettings* pCS = get_ControllerSettings();
+// External devices rotary encoders and buttons
 
-   int iDevicesSignaledCount = 0;
+int _build_Buttons_External(int iDevice, void* pContext, struct i2c_msg* pMsgs, int iMaxMsgs, u8* pBuffer)
+{
+   t_i2c_poll_context* pPoll = (t_i2c_poll_context*)pContext;
+   u32 uFlags = g_uListExternalDevicesFlags[pPoll->iExternalIndex];
+   int iCountMsgs = 0;
+   int iOffset = 0;
+   if ( iMaxMsgs < 3*3+2+2+5 )
+      return 0;
+   if ( uFlags & I2C_CAPABILITY_FLAG_ROTARY2 )
+      iCountMsgs = _add_command_msgs(pMsgs, iCountMsgs, pBuffer, &iOffset, I2C_COMMAND_ID_GET_ROTARY_EVENTS2, 2);
+   if ( uFlags & I2C_CAPABILITY_FLAG_ROTARY )
+      iCountMsgs = _add_command_msgs(pMsgs, iCountMsgs, pBuffer, &iOffset, I2C_COMMAND_ID_GET_ROTARY_EVENTS, 2);
+   if ( uFlags & I2C_CAPABILITY_FLAG_BUTTONS )
+      iCountMsgs = _add_command_msgs(pMsgs, iCountMsgs, pBuffer, &iOffset, I2C_COMMAND_ID_GET_BUTTONS_EVENTS, 5);
+   return iCountMsgs;
+}
 
-   for( int i=0; i<g_nCountExternalDevices; i++ )
+int _on_read_Buttons_External(int iDevice, void* pContext, u8* pBuffer, u32 uTimeMs)
+{
+   t_i2c_poll_context* pPoll = (t_i2c_poll_context*)pContext;
+   u32 uFlags = g_uListExternalDevicesFlags[pPoll->iExternalIndex];
+   u32 uRotaryEvents = 0;
+   u32 uRotaryEvents2 = 0;
+   u32 uButtonsEvents = 0;
+   int iOffset = 0;
+
+   // Invalid CRCs are skipped silently, as the device has no events to report then
+   if ( uFlags & I2C_CAPABILITY_FLAG_ROTARY2 )
    {
-      if ( ! (g_uListExternalDevicesFlags[i] & I2C_CAPABILITY_FLAG_ROTARY2) )
-      if ( ! (g_uListExternalDevicesFlags[i] & I2C_CAPABILITY_FLAG_ROTARY) )
-      if ( ! (g_uListExternalDevicesFlags[i] & I2C_CAPABILITY_FLAG_BUTTONS) )
-         continue;
-      if ( g_nListFilesExternalDevices[i] <= 0 )
-         continue;
-
-      u8 bufferIn[8];
-      u8 bufferOut[8];
-      bool bGotRotaryEvents = false;
-      bool bGotRotaryEvents2 = false;
-      bool bGotButtonsEvents = false;
-      u32 uRotaryEvents = 0;
-      u32 uRotaryEvents2 = 0;
-      u32 uButtonsEvents = 0;
-
-      if ( g_uListExternalDevicesFlags[i] & I2C_CAPABILITY_FLAG_ROTARY2 )
-      {
-         bufferOut[0] = I2C_COMMAND_START_FLAG;
-         bufferOut[1] = I2C_COMMAND_ID_GET_ROTARY_EVENTS2;
-         bufferOut[2] = base_compute_crc8(bufferOut,2);
-
-         wiringPiI2CWrite(g_nListFilesExternalDevices[i], bufferOut[0]);
-         wiringPiI2CWrite(g_nListFilesExternalDevices[i], bufferOut[1]);
-         wiringPiI2CWrite(g_nListFilesExternalDevices[i], bufferOut[2]);
-         int res1 = wiringPiI2CRead(g_nListFilesExternalDevices[i]);
-         int res2 = wiringPiI2CRead(g_nListFilesExternalDevices[i]);
-         if ( res1 < 0 || res2 < 0 )
-         {
-            log_softerror_and_alarm("Failed to get rotary events2 from I2C external device at address 0x%02X (external module), got: %d, %d.", g_pListExternalDevices[i]->nI2CAddress, res1, res2);
-            continue;
-         }
-         bufferIn[0] = res1;
-         bufferIn[1] = base_compute_crc8(bufferIn,1);
-
-         if ( bufferIn[1] != res2 )
-         {
-            //log_softerror_and_alarm("Got invalid CRC on get rotary events from I2C external device at address 0x%02X (external module), got: %d, %d.", g_pListExternalDevices[i]->nI2CAddress, res1, res2);
-            continue;
-         }
-
-         // Has events?
-         if ( bufferIn[0] != 0 )
-         {
-            bGotRotaryEvents2 = true;
-            uRotaryEvents2 = bufferIn[0];
-         }
-      }
-
-      if ( g_uListExternalDevicesFlags[i] & I2C_CAPABILITY_FLAG_ROTARY )
-      {
-         bufferOut[0] = I2C_COMMAND_START_FLAG;
-         bufferOut[1] = I2C_COMMAND_ID_GET_ROTARY_EVENTS;
-         bufferOut[2] = base_compute_crc8(bufferOut,2);
-
-         wiringPiI2CWrite(g_nListFilesExternalDevices[i], bufferOut[0]);
-         wiringPiI2CWrite(g_nListFilesExternalDevices[i], bufferOut[1]);
-         wiringPiI2CWrite(g_nListFilesExternalDevices[i], bufferOut[2]);
-         int res1 = wiringPiI2CRead(g_nListFilesExternalDevices[i]);
-         int res2 = wiringPiI2CRead(g_nListFilesExternalDevices[i]);
-         if ( res1 < 0 || res2 < 0 )
-         {
-            log_softerror_and_alarm("Failed to get rotary events from I2C external device at address 0x%02X (external module), got: %d, %d.", g_pListExternalDevices[i]->nI2CAddress, res1, res2);
-            continue;
-         }
-         bufferIn[0] = res1;
-         bufferIn[1] = base_compute_crc8(bufferIn,1);
-
-         if ( bufferIn[1] != res2 )
-         {
-            //log_softerror_and_alarm("Got invalid CRC on get rotary events from I2C external device at address 0x%02X (external module), got: %d, %d.", g_pListExternalDevices[i]->nI2CAddress, res1, res2);
-            continue;
-         }
-
-         // Has events?
-         if ( bufferIn[0] != 0 )
-         {
-            bGotRotaryEvents = true;
-            uRotaryEvents = bufferIn[0];
-         }
-      }
-
-      if ( g_uListExternalDevicesFlags[i] & I2C_CAPABILITY_FLAG_BUTTONS )
-      {
-         bufferOut[0] = I2C_COMMAND_START_FLAG;
-         bufferOut[1] = I2C_COMMAND_ID_GET_BUTTONS_EVENTS;
-         bufferOut[2] = base_compute_crc8(bufferOut,2);
-
-         wiringPiI2CWrite(g_nListFilesExternalDevices[i], bufferOut[0]);
-         wiringPiI2CWrite(g_nListFilesExternalDevices[i], bufferOut[1]);
-         wiringPiI2CWrite(g_nListFilesExternalDevices[i], bufferOut[2]);
-         int res[5];
-         for( int k=0; k<5; k++ )
-            res[k] = wiringPiI2CRead(g_nListFilesExternalDevices[i]);
-
-         bool bFailed = false;
-
-         for( int k=0; k<5; k++ )
-         {
-            bufferIn[k] = (u8)res[k];
-            if ( res[k] < 0 )
-               bFailed = true;
-         }
-         if ( bFailed )
-         {
-            log_softerror_and_alarm("Failed to get buttons events from I2C external device at address 0x%02X (external module), got: %d, %d, %d, %d, %d.", g_pListExternalDevices[i]->nI2CAddress, res[0], res[1], res[2], res[3], res[4]);
-            continue;
-         }
-
-         u8 uCRC = base_compute_crc8(bufferIn,4);
-
-         if ( bufferIn[4] != uCRC )
-         {
-            //log_softerror_and_alarm("Got invalid CRC on get buttons events from I2C external device at address 0x%02X (external module), got: %d, %d, %d, %d, %d.", g_pListExternalDevices[i]->nI2CAddress, res[0], res[1], res[2], res[3], res[4]);
-            continue;
-         }
-
-         // Has events?
-
-         bool bHasEvents = false;
-         for( int k=0; k<4; k++ )
-         {
-            if ( res[k] > 0 )
-               bHasEvents = true;
-         }
-         if ( bHasEvents)
-         {
-            bGotButtonsEvents = true;
-            memcpy((u8*)&uButtonsEvents, bufferIn, 4);
-         }
-      }
-
-      if ( bGotRotaryEvents || bGotButtonsEvents || bGotRotaryEvents2 )
-      {
-         iDevicesSignaledCount++;
-         if ( 1 == iDevicesSignaledCount )
-         {
-            g_pSMRotaryEncoderButtonsEvents->uButtonsEvents = uButtonsEvents;
-            g_pSMRotaryEncoderButtonsEvents->uRotaryEncoderEvents = uRotaryEvents;
-            g_pSMRotaryEncoderButtonsEvents->uRotaryEncoder2Events = uRotaryEvents2;
-         }
-         else
-         {
-            g_pSMRotaryEncoderButtonsEvents->uButtonsEvents |= uButtonsEvents;
-            g_pSMRotaryEncoderButtonsEvents->uRotaryEncoderEvents |= uRotaryEvents;
-            g_pSMRotaryEncoderButtonsEvents->uRotaryEncoder2Events |= uRotaryEvents2;
-         }
-      }
+      u8* bufferIn = &pBuffer[iOffset+3];
+      if ( bufferIn[1] != base_compute_crc8(bufferIn,1) )
+         return I2C_SCHEDULER_RESULT_OK;
+      uRotaryEvents2 = bufferIn[0];
+      iOffset += 5;
+   }
+   if ( uFlags & I2C_CAPABILITY_FLAG_ROTARY )
+   {
+      u8* bufferIn = &pBuffer[iOffset+3];
+      if ( bufferIn[1] != base_compute_crc8(bufferIn,1) )
+         return I2C_SCHEDULER_RESULT_OK;
+      uRotaryEvents = bufferIn[0];
+      iOffset += 5;
+   }
+   if ( uFlags & I2C_CAPABILITY_FLAG_BUTTONS )
+   {
+      u8* bufferIn = &pBuffer[iOffset+3];
+      if ( bufferIn[4] != base_compute_crc8(bufferIn,4) )
+         return I2C_SCHEDULER_RESULT_OK;
+      memcpy((u8*)&uButtonsEvents, bufferIn, 4);
    }
 
-   if ( iDevicesSignaledCount > 0 )
+   if ( uRotaryEvents || uRotaryEvents2 || uButtonsEvents )
    {
-      g_pSMRotaryEncoderButtonsEvents->uEventIndex++;
-      g_pSMRotaryEncoderButtonsEvents->uTimeStamp = g_TimeNow;
-      g_pSMRotaryEncoderButtonsEvents->uCRC = base_compute_crc32((u8*)g_pSMRotaryEncoderButtonsEvents, sizeof(t_shared_mem_i2c_rotary_encoder_buttons_events) - sizeof(u32));
-      return;
+      g_iPendingButtonsEventsDevices++;
+      g_uPendingButtonsEvents |= uButtonsEvents;
+      g_uPendingRotaryEvents |= uRotaryEvents;
+      g_uPendingRotaryEvents2 |= uRotaryEvents2;
+      g_uPendingButtonsEventsTime = uTimeMs;
    }
+   return I2C_SCHEDULER_RESULT_OK;
+}
 
-   if ( g_nFilePicoExtender <= 0 )
-      return;
+void _on_error_Buttons_External(int iDevice, void* pContext, u32 uConsecutiveErrors)
+{
+   t_i2c_poll_context* pPoll = (t_i2c_poll_context*)pContext;
+   if ( 1 == uConsecutiveErrors )
+      log_softerror_and_alarm("Failed to get rotary/buttons events from I2C external device at address 0x%02X (external module).", g_pListExternalDevices[pPoll->iExternalIndex]->nI2CAddress);
+}
 
+// Pico Extender rotary encoder
 
-   int iValues = -1;
+int _build_Rotary_Pico(int iDevice, void* pContext, struct i2c_msg* pMsgs, int iMaxMsgs, u8* pBuffer)
+{
+   ControllerSettings* pCS = get_ControllerSettings();
+   int iOffset = 0;
    if ( pCS->nRotaryEncoderSpeed == 0 )
-      iValues = wiringPiI2CReadReg8(g_nFilePicoExtender, I2C_DEVICE_COMMAND_ID_PICO_EXTENDER_GET_ROTARY_ENCODER_ACTIONS);
-   else
-      iValues = wiringPiI2CReadReg8(g_nFilePicoExtender, I2C_DEVICE_COMMAND_ID_PICO_EXTENDER_GET_ROTARY_ENCODER_ACTIONS_SLOW);
+      return _add_read_reg_msgs(pMsgs, 0, pBuffer, &iOffset, I2C_DEVICE_COMMAND_ID_PICO_EXTENDER_GET_ROTARY_ENCODER_ACTIONS, 1);
+   return _add_read_reg_msgs(pMsgs, 0, pBuffer, &iOffset, I2C_DEVICE_COMMAND_ID_PICO_EXTENDER_GET_ROTARY_ENCODER_ACTIONS_SLOW, 1);
+}
 
-   if ( iValues < 0 )
-   {
-      //log_line("Failed to read rotary encoder");
-      return;
-   }
+int _on_read_Rotary_Pico(int iDevice, void* pContext, u8* pBuffer, u32 uTimeMs)
+{
+   int iValues = pBuffer[1];
 
    // No events ?
    if ( iValues == 0 || (iValues & 0xFF) == 0x80 )
-      return;
+      return I2C_SCHEDULER_RESULT_OK;
 
-   g_pSMRotaryEncoderButtonsEvents->uButtonsEvents = 0;
-   g_pSMRotaryEncoderButtonsEvents->uRotaryEncoderEvents = 0;
-   g_pSMRotaryEncoderButtonsEvents->uRotaryEncoder2Events = 0;
-   
+   u32 uRotaryEvents = 0;
    if ( iValues & (0x01<<1) )
-      g_pSMRotaryEncoderButtonsEvents->uRotaryEncoderEvents |= (1<<1);
+      uRotaryEvents |= (1<<1);
    else if ( iValues & 0x01 )
-      g_pSMRotaryEncoderButtonsEvents->uRotaryEncoderEvents |= 1;
+      uRotaryEvents |= 1;
 
    if ( iValues & (0x01<<2) )
    {
-      g_pSMRotaryEncoderButtonsEvents->uRotaryEncoderEvents |= (1<<3);
+      uRotaryEvents |= (1<<3);
       if ( iValues & (0x01<<4) )
-         g_pSMRotaryEncoderButtonsEvents->uRotaryEncoderEvents |= (1<<5);
+         uRotaryEvents |= (1<<5);
    }
    if ( iValues & (0x01<<3) )
    {
-      g_pSMRotaryEncoderButtonsEvents->uRotaryEncoderEvents |= (1<<2);
+      uRotaryEvents |= (1<<2);
       if ( iValues & (0x01<<5) )
-         g_pSMRotaryEncoderButtonsEvents->uRotaryEncoderEvents |= (1<<4);
+         uRotaryEvents |= (1<<4);
    }
-         
-   g_pSMRotaryEncoderButtonsEvents->uEventIndex++;
-   g_pSMRotaryEncoderButtonsEvents->uTimeStamp = g_TimeNow;
-   g_pSMRotaryEncoderButtonsEvents->uCRC = base_compute_crc32((u8*)g_pSMRotaryEncoderButtonsEvents, sizeof(t_shared_mem_i2c_rotary_encoder_buttons_events) - sizeof(u32));
 
+   g_iPendingButtonsEventsDevices++;
+   g_uPendingRotaryEvents |= uRotaryEvents;
+   g_uPendingButtonsEventsTime = uTimeMs;
+   return I2C_SCHEDULER_RESULT_OK;
+}
 
-   /*
-   char szBuff[32];
-   szBuff[0] = 0;
-   for( int i=0; i<8; i++ )
+// Events from all the devices read in the same scheduler run go out as a single event
+void publishRotaryEncoderAndButtonsEvents()
+{
+   if ( 0 == g_iPendingButtonsEventsDevices )
+      return;
+   if ( NULL != g_pSMRotaryEncoderButtonsEvents )
    {
-      if ( iValues & (0x01<<(7-i)) )
-         strcat(szBuff,"1");
-      else
-         strcat(szBuff,"0");
+      g_pSMRotaryEncoderButtonsEvents->uButtonsEvents = g_uPendingButtonsEvents;
+      g_pSMRotaryEncoderButtonsEvents->uRotaryEncoderEvents = (u8)g_uPendingRotaryEvents;
+      g_pSMRotaryEncoderButtonsEvents->uRotaryEncoder2Events = (u8)g_uPendingRotaryEvents2;
+      g_pSMRotaryEncoderButtonsEvents->uEventIndex++;
+      g_pSMRotaryEncoderButtonsEvents->uTimeStamp = g_uPendingButtonsEventsTime;
+      g_pSMRotaryEncoderButtonsEvents->uCRC = base_compute_crc32((u8*)g_pSMRotaryEncoderButtonsEvents, sizeof(t_shared_mem_i2c_rotary_encoder_buttons_events) - sizeof(u32));
    }
-   log_line(szBuff);
-   */
+   g_iPendingButtonsEventsDevices = 0;
+   g_uPendingButtonsEvents = 0;
+   g_uPendingRotaryEvents = 0;
+   g_uPendingRotaryEvents2 = 0;
+}
+
+void _schedule_device(u8 uAddress, int iPriority, u32 uPeriodMs, i2c_scheduler_build_callback pfBuild, i2c_scheduler_result_callback pfResult, i2c_scheduler_error_callback pfError, int iExternalIndex, int iMsgsPerTransfer)
+{
+   if ( g_iCountI2CPollContexts >= I2C_SCHEDULER_MAX_DEVICES )
+   {
+      log_softerror_and_alarm("Too many I2C devices to poll. Ignoring device 0x%02X.", uAddress);
+      return;
+   }
+   t_i2c_poll_context* pPoll = &g_I2CPollContexts[g_iCountI2CPollContexts];
+   pPoll->iExternalIndex = iExternalIndex;
+   pPoll->iStep = 0;
+   pPoll->iFirstChannel = 0;
+   pPoll->iChannels = 0;
+   pPoll->iChannelsToRead = 0;
+   int iDevice = i2c_scheduler_add_device(_get_bus_number(uAddress), uAddress, iPriority, uPeriodMs, pfBuild, pfResult, pfError, pPoll);
+   if ( iDevice < 0 )
+      return;
+   i2c_scheduler_set_device_msgs_per_transfer(iDevice, iMsgsPerTransfer);
+   g_iCountI2CPollContexts++;
+}
+
+// RC input first, then buttons/encoders, then power sensors
+void schedule_i2c_devices()
+{
+   i2c_scheduler_remove_all_devices();
+   g_iCountI2CPollContexts = 0;
+   g_iPendingButtonsEventsDevices = 0;
+
+   if ( NULL != g_pDeviceInfoRCIn || NULL != g_pDeviceInfoPicoExtender )
+   {
+      int file = g_nFileRCIn;
+      u8 uAddress = I2C_DEVICE_ADDRESS_PICO_RC_IN;
+      if ( NULL != g_pDeviceInfoPicoExtender )
+      {
+         file = g_nFilePicoExtender;
+         uAddress = I2C_DEVICE_ADDRESS_PICO_EXTENDER;
+      }
+      if ( file > 0 )
+         _schedule_device(uAddress, I2C_SCHEDULER_PRIORITY_RC_IN, g_SleepTime, _build_RCIn_Pico, _on_read_RCIn_Pico, _on_error_RCIn_Pico, -1, 2);
+      else if ( NULL != g_pSMRCIn )
+         g_pSMRCIn->uFlags &= (~RC_IN_FLAG_HAS_INPUT); // No input
+   }
+   else
+   {
+      for( int i=0; i<g_nCountExternalDevices; i++ )
+      {
+         if ( ! (g_uListExternalDevicesFlags[i] & I2C_CAPABILITY_FLAG_RC_INPUT) )
+            continue;
+         if ( g_pListExternalDevices[i]->uParams[0] == 0 )
+            continue;
+         if ( g_nListFilesExternalDevices[i] <= 0 )
+            continue;
+         _schedule_device((u8)g_pListExternalDevices[i]->nI2CAddress, I2C_SCHEDULER_PRIORITY_RC_IN, g_SleepTime,
+            _build_RCIn_External, _on_read_RCIn_External, _on_error_RCIn_External, i, 1);
+      }
+   }
+
+   if ( NULL != g_pSMRotaryEncoderButtonsEvents )
+   {
+      for( int i=0; i<g_nCountExternalDevices; i++ )
+      {
+         if ( ! (g_uListExternalDevicesFlags[i] & (I2C_CAPABILITY_FLAG_ROTARY | I2C_CAPABILITY_FLAG_ROTARY2 | I2C_CAPABILITY_FLAG_BUTTONS)) )
+            continue;
+         if ( g_nListFilesExternalDevices[i] <= 0 )
+            continue;
+         _schedule_device((u8)g_pListExternalDevices[i]->nI2CAddress, I2C_SCHEDULER_PRIORITY_BUTTONS, g_SleepTime,
+            _build_Buttons_External, _on_read_Buttons_External, _on_error_Buttons_External, i, 1);
+      }
+      if ( g_nFilePicoExtender > 0 )
+         _schedule_device(I2C_DEVICE_ADDRESS_PICO_EXTENDER, I2C_SCHEDULER_PRIORITY_BUTTONS, g_SleepTime, _build_Rotary_Pico, _on_read_Rotary_Pico, NULL, -1, 2);
+   }
+
+   if ( g_bHasINA && (g_nINAFd > 0) )
+      _schedule_device((u8)g_nINAAddress, I2C_SCHEDULER_PRIORITY_POWER, 300, _build_INA, _on_read_INA, NULL, -1, 0);
 }
 
 void handle_sigint(int sig) 
@@ -882,6 +923,7 @@ int main(int argc, char *argv[])
    signal(SIGINT, handle_sigint);
    signal(SIGTERM, handle_sigint);
    signal(SIGQUIT, handle_sigint);
+   signal(SIGPIPE, SIG_IGN); // the RC in notify pipe reader can go away
    
    if ( strcmp(argv[argc-1], "-ver") == 0 )
    {
@@ -931,6 +973,7 @@ int main(int argc, char *argv[])
    for( int i=0; i<I2C_DEVICE_PARAM_MAX_CHANNELS; i++ )
       s_lastRCReadVals[i] = 0;
 
+   i2c_scheduler_init(NULL);
    load_settings();
 
 
@@ -938,11 +981,17 @@ int main(int argc, char *argv[])
 
    while ( !g_bQuit )
    {
-      hardware_sleep_ms(g_SleepTime);
-      if ( g_bQuit )
-         break;
-
       g_TimeNow = get_current_timestamp_ms();
+      u32 uWaitMicros = i2c_scheduler_run();
+      publishRotaryEncoderAndButtonsEvents();
+
+      if ( g_iReadRCInConsecutiveFailCount > 10 )
+      {
+          g_iReadRCInConsecutiveFailCount = 0;
+          close_files();
+          load_settings();            
+          continue;
+      }
 
       if (  g_TimeNow >= g_TimeLastReloadCheck+300 )
       {
@@ -950,30 +999,40 @@ int main(int argc, char *argv[])
          if ( access( FILE_TMP_I2C_UPDATED, R_OK ) != -1 )
          {
          	  log_line("I2C devices settings changed. Reloading settings and setting up devices.");
+            i2c_scheduler_log_stats();
             close_files();
             load_settings();
             char szBuff[128];
             sprintf(szBuff, "rm -rf %s 2>/dev/null", FILE_TMP_I2C_UPDATED);
             hw_execute_bash_command_silent(szBuff, NULL);
+            continue;
          }
-      }
 
-      for( int i=0; i<g_nCountExternalDevices; i++ )
-         if ( ! g_bListExternalDevicesSetupCorrectly[i] )
-            _setup_external_device(i);
-      checkReadINA();
-      checkReadRCIn();
-      checkReadRotaryEncoderAndButtons();
-
-      if ( g_iReadRCInConsecutiveFailCount > 10 )
-      {
-          g_iReadRCInConsecutiveFailCount = 0;
-          close_files();
-          load_settings();            
+         bool bSetupDevices = false;
+         for( int i=0; i<g_nCountExternalDevices; i++ )
+            if ( ! g_bListExternalDevicesSetupCorrectly[i] )
+            if ( _setup_external_device(i) )
+               bSetupDevices = true;
+         if ( bSetupDevices )
+            schedule_i2c_devices();
       }
+
+      // Wakes up for the next device read deadline, or for the settings reload check
+      u32 uTimeNow = get_current_timestamp_ms();
+      u32 uMaxWaitMicros = 0;
+      if ( uTimeNow < g_TimeLastReloadCheck + 300 )
+         uMaxWaitMicros = (g_TimeLastReloadCheck + 300 - uTimeNow)*1000;
+      if ( uWaitMicros > uMaxWaitMicros )
+         uWaitMicros = uMaxWaitMicros;
+      if ( uWaitMicros > 0 )
+         hardware_sleep_micros(uWaitMicros);
    }
 
+   i2c_scheduler_log_stats();
+   i2c_scheduler_release();
    close_files();
+   if ( g_iRCInNotifyFd >= 0 )
+      close(g_iRCInNotifyFd);
    shared_mem_i2c_current_close(g_pSMCurrent);
    shared_mem_i2c_controller_rc_in_close(g_pSMRCIn);
    shared_mem_i2c_rotary_encoder_buttons_events_close(g_pSMRotaryEncoderButtonsEvents);
@@ -1,3 +1,8 @@
 #pragma once
 
 #include "../base/base.h"
+
+// Adds the found and set up devices to the I2C scheduler
+void schedule_i2c_devices();
+// Publishes the rotary encoders/buttons events read in the last scheduler run
+void publishRotaryEncoderAndButtonsEvents();
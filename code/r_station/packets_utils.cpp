@@ -13,6 +13,7 @@ Code written by: Petru Soroaga, 2021-2023
 #include "../base/config.h"
 #include "../base/flags.h"
 #include "../base/encr.h"
+#include "../base/encr_aead.h"
 #include "../base/hardware_radio.h"
 #include "../base/launchers.h"
 #include "../common/radio_stats.h"
@@ -26,6 +27,7 @@ Code written by: Petru Soroaga, 2021-2023
 #include "timers.h"
 
 static u8 s_RadioRawPacket[MAX_PACKET_TOTAL_SIZE];
+static u8 s_RadioSealedPackets[MAX_PACKET_TOTAL_SIZE];
 
 static u32 s_StreamsPacketIndex[MAX_RADIO_STREAMS];
 static u16 s_StreamsLastTxTime[MAX_RADIO_STREAMS];
@@ -333,6 +335,20 @@ int send_packet_to_radio_interfaces(u8* pPacketData, int nPacketLength)
       pData += pPH->total_length;
    }
 
+   // Encrypt (and authenticate) once, for all the radio interfaces, only for a vehicle that sent us sealed packets
+   // (it can open them too). Not for vehicles that can't parse the packet extra flags (s_bReceivedInvalidRadioPackets)
+   // or if the sealed packets don't fit: those use the per interface buffer encryption.
+   if ( be && (! s_bReceivedInvalidRadioPackets) && (g_pCurrentModel->vehicle_id == g_uVehicleIdCanOpenSealedPackets) )
+   {
+      int iSealedLength = encr_aead_seal_packets(pPacketData, nPacketLength, s_RadioSealedPackets, MAX_PACKET_TOTAL_SIZE);
+      if ( iSealedLength > 0 )
+      {
+         pPacketData = s_RadioSealedPackets;
+         nPacketLength = iSealedLength;
+         be = 0;
+      }
+   }
+
    // Send the final composed packet to each radio link
 
    for( int iLink=0; iLink<g_pCurrentModel->radioLinksParams.links_count; iLink++ )
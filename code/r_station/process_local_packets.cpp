@@ -45,6 +45,13 @@ void _process_local_control_packet(t_packet_header* pPH)
       return;
    }
 
+   // MAVLink frames delivered by the telemetry transport, for OSD plugins
+   if ( pPH->packet_type == PACKET_TYPE_TELEMETRY_RAW_DOWNLOAD )
+   {
+      ruby_ipc_channel_send_message(g_fIPCToCentral, (u8*)pPH, pPH->total_length);
+      return;
+   }
+
    if ( pPH->packet_type == PACKET_TYPE_LOCAL_CONTROLLER_RELOAD_CORE_PLUGINS )
    {
       log_line("Router received a local message to reload core plugins.");
@@ -17,6 +17,7 @@ Code written by: Petru Soroaga, 2021-2023
 #include "../base/launchers.h"
 #include "../base/ctrl_interfaces.h"
 #include "../base/encr.h"
+#include "../base/encr_aead.h"
 #include "../base/commands.h"
 #include "../base/ruby_ipc.h"
 #include "../base/camera_utils.h"
@@ -878,6 +879,15 @@ int _process_received_single_radio_packet(int interfaceIndex, u8* pData, int len
 
 // Returns 1 if end of a video block was reached
 
+// A vehicle that seals its packets can open ours: the uplink gets sealed for it from now on
+void _on_received_sealed_packet(t_packet_header* pPH)
+{
+   if ( pPH->vehicle_id_src == g_uVehicleIdCanOpenSealedPackets )
+      return;
+   g_uVehicleIdCanOpenSealedPackets = pPH->vehicle_id_src;
+   log_line("Received sealed (AEAD) packets from vehicle id %u. Sealing the packets sent to it.", pPH->vehicle_id_src);
+}
+
 int _process_received_full_radio_packet(int interfaceIndex)
 {
    if ( NULL != g_pProcessStats )
@@ -1001,11 +1011,29 @@ int _process_received_full_radio_packet(int interfaceIndex)
          return 0;
       }
 
+      // Sealed packets shrink when opened: move to the next packet by the received length
+      int iReceivedPacketLength = pPH->total_length;
+      if ( encr_aead_is_sealed_packet(pData) )
+      {
+         if ( 0 == encr_aead_open_packet(pData, nLength) )
+         {
+            if ( g_TimeNow > s_TimeLastLogWrongRxPacket + 2000 )
+            {
+               s_TimeLastLogWrongRxPacket = g_TimeNow;
+               log_softerror_and_alarm("Received encrypted packet that failed authentication (type: %d, %d bytes).", pPH->packet_type, iReceivedPacketLength);
+            }
+            pData += iReceivedPacketLength;
+            nLength -= iReceivedPacketLength;
+            continue;
+         }
+         _on_received_sealed_packet(pPH);
+      }
+
       int nResultPacket = _process_received_single_radio_packet(interfaceIndex, pData, pPH->total_length);
       if ( nResultPacket >= 0 )
          nReturn = nReturn | nResultPacket;
-      pData += pPH->total_length;
-      nLength -= pPH->total_length; 
+      pData += iReceivedPacketLength;
+      nLength -= iReceivedPacketLength; 
    }
 
    #ifdef PROFILE_RX
@@ -1083,7 +1111,21 @@ void _process_received_short_radio_packet(int iInterfaceIndex, u8* pPacket, int
          else
          {
             t_packet_header* pPH = (t_packet_header*)(pPacket+sizeof(t_packet_header_short));
-            _process_received_single_radio_packet(iInterfaceIndex, pPacket + sizeof(t_packet_header_short), pPH->total_length);
+            bool bSealed = encr_aead_is_sealed_packet((u8*)pPH);
+            if ( bSealed && (0 == encr_aead_open_packet((u8*)pPH, iPacketLength)) )
+            {
+               if ( g_TimeNow > s_TimeLastLogWrongRxPacket + 2000 )
+               {
+                  s_TimeLastLogWrongRxPacket = g_TimeNow;
+                  log_softerror_and_alarm("Received encrypted packet that failed authentication (type: %d, %d bytes).", pPH->packet_type, iPacketLength);
+               }
+            }
+            else
+            {
+               if ( bSealed )
+                  _on_received_sealed_packet(pPH);
+               _process_received_single_radio_packet(iInterfaceIndex, pPacket + sizeof(t_packet_header_short), pPH->total_length);
+            }
          }
       }
    }
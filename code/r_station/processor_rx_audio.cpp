@@ -16,140 +16,74 @@ Code written by: Petru Soroaga, 2021-2023
 #include "../radio/radiopackets2.h"
 #include "../radio/radiolink.h"
 #include "../radio/radiopacketsqueue.h"
-#include "../radio/fec.h" 
+#include "../common/audio_link.h"
 #include "packets_utils.h"
 
 #include "shared_vars.h"
 #include "timers.h"
 
-u32 s_uLastReceivedAudioBlock = MAX_U32;
-u32 s_uReceivedAudioDataPackets = 0;
-u32 s_uReceivedAudioFECPackets = 0;
-u32 s_uReceivedAudioPacketLength = 0;
-
-u32 s_AudioPacketsPerBlock = 0;
-u32 s_AudioFECPerBlock = 0;
-
-u8 s_BufferAudioPackets[MAX_AUDIO_PACKETS][MAX_PACKET_PAYLOAD];
-bool s_BufferAudioPacketsReceived[MAX_AUDIO_PACKETS];
-
-unsigned int fec_decode_audio_missing_packets[MAX_TOTAL_PACKETS_IN_BLOCK];
-unsigned int fec_decode_audio_fec_indexes[MAX_TOTAL_PACKETS_IN_BLOCK];
-u8* fec_decode_audio_data_packets[MAX_TOTAL_PACKETS_IN_BLOCK];
-u8* fec_decode_audio_fec_packets[MAX_TOTAL_PACKETS_IN_BLOCK];
-unsigned int missing_audio_packets_count_for_fec = 0;
-
-
-void _output_audio_block()
-{
-   if ( -1 == g_fPipeAudio )
-      return;
-
-   if ( s_uReceivedAudioDataPackets >= s_AudioPacketsPerBlock )
-   {
-      for( u32 i=0; i<s_AudioPacketsPerBlock; i++ )
-         write(g_fPipeAudio, &s_BufferAudioPackets[i][0], s_uReceivedAudioPacketLength);
-      //log_line("Sent block to audio pipe");
-      return;
-   }
-
-   if ( s_uReceivedAudioDataPackets + s_uReceivedAudioFECPackets < s_AudioPacketsPerBlock )
-   {
-      for( u32 i=0; i<s_AudioPacketsPerBlock; i++ )
-         if ( s_BufferAudioPacketsReceived[i] )
-            write(g_fPipeAudio, &s_BufferAudioPackets[i][0], s_uReceivedAudioPacketLength);
-      //log_line("Sent incomplete block to audio pipe");
-      return;
-   }
-
-   // Reconstruct block
-
-   // Add existing data packets, mark and count the ones that are missing
-
-   missing_audio_packets_count_for_fec = 0;
-   for( u32 i=0; i<s_AudioPacketsPerBlock; i++ )
-   {
-      fec_decode_audio_data_packets[i] = &s_BufferAudioPackets[i][0];
-      if ( ! s_BufferAudioPacketsReceived[i] )
-      {
-         fec_decode_audio_missing_packets[missing_audio_packets_count_for_fec] = i;
-         missing_audio_packets_count_for_fec++;
-      }
-   }
-
-   // Add the needed FEC packets to the list
-   unsigned int pos = 0;
-   for( u32 i=0; i<s_AudioFECPerBlock; i++ )
-   {
-      if ( s_BufferAudioPacketsReceived[i+s_AudioPacketsPerBlock] )
-      {
-         fec_decode_audio_fec_packets[pos] = &s_BufferAudioPackets[i+s_AudioPacketsPerBlock][0];
-         fec_decode_audio_fec_indexes[pos] = i;
-         pos++;
-         if ( pos == missing_audio_packets_count_for_fec )
-            break;
-      }
-   }
-
-   fec_decode(s_uReceivedAudioPacketLength, fec_decode_audio_data_packets, (unsigned int) s_AudioPacketsPerBlock, fec_decode_audio_fec_packets, fec_decode_audio_fec_indexes, fec_decode_audio_missing_packets, missing_audio_packets_count_for_fec );
-
-   for( u32 i=0; i<s_AudioPacketsPerBlock; i++ )
-      write(g_fPipeAudio, &s_BufferAudioPackets[i][0], s_uReceivedAudioPacketLength);
-   //log_line("Sent reconstructed block to audio pipe");
-}
+t_audio_rx_buffer s_AudioRxBuffer;
+bool s_bAudioRxBufferInitialized = false;
+u32 s_uAudioRxTimeLastStatsLog = 0;
+u8 s_AudioRxFrame[AUDIO_SEGMENT_SIZE];
 
 
 void init_processing_audio()
 {
-   for( int i=0; i<MAX_AUDIO_PACKETS; i++ )
-      s_BufferAudioPacketsReceived[i] = false;
+   int iDataPackets = g_pCurrentModel->audio_params.flags & 0xFF;
+   int iFECPackets = (g_pCurrentModel->audio_params.flags >> 8) & 0xFF;
 
-   s_uLastReceivedAudioBlock = MAX_U32;
+   if ( s_bAudioRxBufferInitialized )
+   if ( iDataPackets == s_AudioRxBuffer.iDataPackets && iFECPackets == s_AudioRxBuffer.iFECPackets )
+      return;
 
-   s_AudioPacketsPerBlock = g_pCurrentModel->audio_params.flags & 0xFF;
-   s_AudioFECPerBlock = (g_pCurrentModel->audio_params.flags >> 8) & 0xFF;
+   audio_rx_buffer_init(&s_AudioRxBuffer, iDataPackets, iFECPackets);
+   s_bAudioRxBufferInitialized = true;
+   log_line("[AudioRx] Init audio processing, scheme %d/%d", s_AudioRxBuffer.iDataPackets, s_AudioRxBuffer.iFECPackets);
 }
 
 void process_audio_packet(u8* pPacketBuffer)
 {
+   if ( ! s_bAudioRxBufferInitialized )
+      return;
+
    t_packet_header* pPH = (t_packet_header*)pPacketBuffer;
    u8* pData = pPacketBuffer + sizeof(t_packet_header);
    u32 segmentIndex = 0;
 
    memcpy((u8*)&segmentIndex, pData, sizeof(u32));
    pData += sizeof(u32);
-   u32 blockIndex = segmentIndex>>8;
-   u32 packetIndex = segmentIndex & 0xFF;
-   //log_line("Received audio segment %u/%d, size: %d bytes, scheme %u/%u", blockIndex, packetIndex, pPH->total_length-sizeof(u32), s_AudioPacketsPerBlock, s_AudioFECPerBlock);
 
-   if ( s_uLastReceivedAudioBlock != blockIndex && s_uLastReceivedAudioBlock != MAX_U32 )
+   int iLength = (int)pPH->total_length - (int)sizeof(t_packet_header) - (int)sizeof(u32);
+   if ( pPH->packet_flags & PACKET_FLAGS_BIT_EXTRA_DATA )
    {
-      _output_audio_block();
-      for( int i=0; i<MAX_AUDIO_PACKETS; i++ )
-         s_BufferAudioPacketsReceived[i] = false;
-      s_uReceivedAudioDataPackets = 0;
-      s_uReceivedAudioFECPackets = 0;
+      u8 size = *(((u8*)pPH) + pPH->total_length-1);
+      iLength -= size;
    }
+   //log_line("Received audio segment %u/%d, size: %d bytes", segmentIndex>>8, segmentIndex & 0xFF, iLength);
 
-   if ( packetIndex >= MAX_AUDIO_PACKETS )
-      return;
-
-   s_uLastReceivedAudioBlock = blockIndex;
+   audio_rx_buffer_add_segment(&s_AudioRxBuffer, segmentIndex, pData, iLength, get_current_timestamp_micros());
+   process_audio_periodic_loop();
+}
 
-   if ( s_BufferAudioPacketsReceived[packetIndex] )
+// Writes to the audio pipe the frames that are due for playout
+void process_audio_periodic_loop()
+{
+   if ( (! s_bAudioRxBufferInitialized) || (-1 == g_fPipeAudio) )
       return;
 
-   if ( packetIndex < s_AudioPacketsPerBlock )
-      s_uReceivedAudioDataPackets++;
-   else
-      s_uReceivedAudioFECPackets++;
+   u32 uTimeNowMicros = get_current_timestamp_micros();
+   int iLength = 0;
+   while ( (iLength = audio_rx_buffer_get_frame(&s_AudioRxBuffer, uTimeNowMicros, s_AudioRxFrame)) > 0 )
+      write(g_fPipeAudio, s_AudioRxFrame, iLength);
 
-   s_BufferAudioPacketsReceived[packetIndex] = true;
-   s_uReceivedAudioPacketLength = pPH->total_length-sizeof(u32);
-   if ( pPH->packet_flags & PACKET_FLAGS_BIT_EXTRA_DATA )
+   if ( g_TimeNow > s_uAudioRxTimeLastStatsLog + 20000 && s_AudioRxBuffer.stats.uFramesIn > 0 )
    {
-      u8 size = *(((u8*)pPH) + pPH->total_length-1);
-      s_uReceivedAudioPacketLength -= size;
+      s_uAudioRxTimeLastStatsLog = g_TimeNow;
+      t_audio_rx_stats* pStats = &s_AudioRxBuffer.stats;
+      log_line("[AudioRx] Frames in: %u, recovered: %u, late: %u, played: %u, concealed: %u lost + %u empty, underruns: %u, jitter: %u ms, depth: %u ms",
+         pStats->uFramesIn, pStats->uFramesRecovered, pStats->uFramesLate, pStats->uFramesPlayed,
+         pStats->uFramesConcealedLost, pStats->uFramesConcealedEmpty, pStats->uUnderruns,
+         pStats->uJitterMicros/1000, pStats->uTargetDepthMicros/1000);
    }
-   memcpy(&s_BufferAudioPackets[packetIndex][0], pData, s_uReceivedAudioPacketLength);
 }
@@ -5,3 +5,4 @@
 void init_processing_audio();
 
 void process_audio_packet(u8* pPacketBuffer);
+void process_audio_periodic_loop();
@@ -34,6 +34,7 @@ Code written by: Petru Soroaga, 2021-2023
 #include "../base/launchers.h"
 #include "../base/hardware.h"
 #include "../base/hw_procs.h"
+#include "../base/latency_trace.h"
 #include "../common/string_utils.h"
 #include "../radio/radiolink.h"
 #include "../radio/radiopackets2.h"
@@ -613,6 +614,7 @@ void _update_history_blocks_output(int rx_buffer_block_index, bool hasRetransmit
 
 void _reconstruct_block(int rx_buffer_block_index)
 {
+   LATENCY_TRACE_BEGIN(uTraceReconstruct);
 
    if ( g_PD_ControllerLinkStats.tmp_video_streams_blocks_reconstructed[0] < 254 )
       g_PD_ControllerLinkStats.tmp_video_streams_blocks_reconstructed[0]++;
@@ -667,6 +669,7 @@ void _reconstruct_block(int rx_buffer_block_index)
    }
   //_rx_video_log_line("Reconstructed block %u, had %d missing packets", s_pRXBlocksStack[rx_buffer_block_index]->video_block_index, s_FECInfo.missing_packets_count);
 
+   LATENCY_TRACE_END(LATENCY_TRACE_STAGE_STATION_RECONSTRUCT_BLOCK, uTraceReconstruct);
 }
 
 void _send_packet_to_output(int rx_buffer_block_index, int block_packet_index )
@@ -689,7 +692,9 @@ void _send_packet_to_output(int rx_buffer_block_index, int block_packet_index )
    int length = s_pRXBlocksStack[rx_buffer_block_index]->packetsInfo[block_packet_index].packet_length;
 
    //_rx_video_log_line("Output block %u/%d", s_pRXBlocksStack[rx_buffer_block_index]->video_block_index,block_packet_index);
+   LATENCY_TRACE_BEGIN(uTraceForward);
    processor_rx_video_forward_video_data(pBuffer, length);
+   LATENCY_TRACE_END(LATENCY_TRACE_STAGE_STATION_FORWARD_VIDEO, uTraceForward);
 }
 
 void shift_blocks_buffer()
@@ -709,6 +714,8 @@ void shift_blocks_buffer()
 
 void _push_first_block_out()
 {
+   LATENCY_TRACE_BEGIN(uTracePushBlock);
+
    #ifdef PROFILE_RX
    u32 uTimeStart = get_current_timestamp_ms();
    #endif
@@ -791,6 +798,7 @@ void _push_first_block_out()
       log_softerror_and_alarm("[Profile-Rx] Pushing first video block out (to player) took too long: %u ms.", dTime2);
    #endif
 
+   LATENCY_TRACE_END(LATENCY_TRACE_STAGE_STATION_PUSH_BLOCK_OUT, uTracePushBlock);
 }
 
 // Discard blocks, do not output them (unless blocks are good)
@@ -18,6 +18,7 @@ Code written by: Petru Soroaga, 2021-2023
 #include <errno.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/mount.h>
 #include <netdb.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -35,7 +36,9 @@ Code written by: Petru Soroaga, 2021-2023
 #include "../base/hw_procs.h"
 #include "../base/ruby_ipc.h"
 #include "../base/camera_utils.h"
+#include "../base/system_metrics.h"
 #include "../common/string_utils.h"
+#include "../common/mp4_recorder.h"
 #include "../radio/radiolink.h"
 #include "../radio/radiopackets2.h"
 
@@ -97,7 +100,9 @@ bool s_bRecording = false;
 
 u32 s_TimeStartRecording = MAX_U32;
 char s_szFileRecording[1024];
-int s_iFileVideo = -1;
+t_mp4_recorder s_Mp4Recorder;
+u32 s_uLastRecordingWriteErrors = 0;
+u32 s_uLastRecordingFragmentsDropped = 0;
 
 u32 s_TimeLastPeriodicChecksVideoRecording = 0;
 u32 s_TimeLastPeriodicChecksUSBForward = 0;
@@ -162,6 +167,36 @@ void _processor_rx_video_forward_create_eth_socket()
 }
 
 
+void _write_video_info_file(u32 uDurationMs)
+{
+   log_line("Writing video info file %s ...", TEMP_VIDEO_FILE_INFO);
+   FILE* fd = fopen(TEMP_VIDEO_FILE_INFO, "w");
+   if ( NULL == fd )
+   {
+      system("sudo mount -o remount,rw /");
+      char szTmp[128];
+      sprintf(szTmp, "rm -rf %s", TEMP_VIDEO_FILE_INFO);
+      hw_execute_bash_command(szTmp, NULL);
+      fd = fopen(TEMP_VIDEO_FILE_INFO, "w");
+   }
+
+   if ( NULL == fd )
+   {
+      FILE* fd = fopen(TEMP_VIDEO_FILE_PROCESS_ERROR, "a");
+      fprintf(fd, "%s\n", "Failed to create video recording info file.");
+      fclose(fd);
+      log_softerror_and_alarm("Failed to create video info file %s", TEMP_VIDEO_FILE_INFO);
+      return;
+   }
+   fprintf(fd, "%s\n", s_szFileRecording);
+   fprintf(fd, "%d %d\n", s_VDStatsCache.fps, uDurationMs/1000 );
+   fprintf(fd, "%d %d\n", s_VDStatsCache.width, s_VDStatsCache.height );
+   fclose(fd);
+
+   log_line("Created video info file %s", TEMP_VIDEO_FILE_INFO);
+   log_line("Video info file content: (%s, %d, %d seconds, %d, %d)", s_szFileRecording, s_VDStatsCache.fps, uDurationMs/1000, s_VDStatsCache.width, s_VDStatsCache.height);
+}
+
 void _start_recording()
 {
    if ( s_bRecording )
@@ -176,87 +211,60 @@ void _start_recording()
    Preferences* p = get_Preferences();
    if ( p->iVideoDestination == 1 )
    {
-      strcpy(s_szFileRecording, TEMP_VIDEO_MEM_FILE);
-      char szComm[256];
-      char szBuff[2048];
-      char szTemp[1024];
-   
-      sprintf(szComm, "umount %s", TEMP_VIDEO_MEM_FOLDER);
-      hw_execute_bash_command_silent(szComm, NULL);
-
-      hw_execute_bash_command_raw("free -m  | grep Mem", szBuff);
-      long lt, lu, lf;
-      sscanf(szBuff, "%s %ld %ld %ld", szTemp, &lt, &lu, &lf);
+      umount(TEMP_VIDEO_MEM_FOLDER);
+
+      // Free memory, same as the free column of free -m; sampled now if there is no sampler running
+      shared_mem_system_metrics metrics;
+      memset(&metrics, 0, sizeof(shared_mem_system_metrics));
+      if ( ! system_metrics_get(&metrics) )
+         system_metrics_sample_now(&metrics);
+      long lf = 0;
+      if ( metrics.uValidFlags & SYSTEM_METRICS_VALID_MEMORY )
+         lf = (long)(metrics.uMemFreeKb/1024);
       lf -= 200;
       if ( lf < 50 )
-         return;
-
-      sprintf(szComm, "mount -t tmpfs -o size=%dM tmpfs %s ", (int)lf, TEMP_VIDEO_MEM_FOLDER);
-      hw_execute_bash_command(szComm, NULL);
+         log_softerror_and_alarm("Video destination is memory, but there is not enough free memory (%d Mb). Recording to storage.", (int)(lf+200));
+      else
+      {
+         char szOptions[64];
+         sprintf(szOptions, "size=%dM", (int)lf);
+         if ( 0 != mount("tmpfs", TEMP_VIDEO_MEM_FOLDER, "tmpfs", 0, szOptions) )
+            log_softerror_and_alarm("Failed to mount the video memory disk %s (%d Mb), error: %d. Recording to storage.", TEMP_VIDEO_MEM_FOLDER, (int)lf, errno);
+         else
+         {
+            strcpy(s_szFileRecording, TEMP_VIDEO_MEM_FILE);
+            log_line("Recording video to memory disk (%d Mb).", (int)lf);
+         }
+      }
    }
 
-   if ( s_iFileVideo > 0 )
-      close(s_iFileVideo);
-
-   s_iFileVideo = open(s_szFileRecording, O_CREAT | O_WRONLY | O_NONBLOCK);
-   if ( -1 == s_iFileVideo )
+   if ( 0 != mp4_recorder_open(&s_Mp4Recorder, s_szFileRecording) )
    {
       FILE* fd = fopen(TEMP_VIDEO_FILE_PROCESS_ERROR, "a");
       fprintf(fd, "%s%s\n", "Failed to create video recording file ", s_szFileRecording);
       fclose(fd);
+      return;
    }
+   s_uLastRecordingWriteErrors = 0;
+   s_uLastRecordingFragmentsDropped = 0;
 
-   if ( RUBY_PIPES_EXTRA_FLAGS & O_NONBLOCK )
-   if ( 0 != fcntl(s_iFileVideo, F_SETFL, O_NONBLOCK) )
-      log_softerror_and_alarm("Failed to set nonblock flag on video recording file");
-
-   log_line("Video recording file flags: %s", str_get_pipe_flags(fcntl(s_iFileVideo, F_GETFL)));
-  
+   // Written now too, so that a recording cut by a power loss is still processed on the next start
+   _write_video_info_file(0);
    s_bRecording = true;
 }
 
 void _stop_recording()
 {
-   if ( -1 != s_iFileVideo )
-      close(s_iFileVideo);
-   s_iFileVideo = -1;
-
    log_line("Received request to stop recording video.");
    if ( ! s_bRecording )
    {
       log_line("Not recording. Do nothing.");
       return;
    }
-   u32 duration_ms = get_current_timestamp_ms() - s_TimeStartRecording;
-
-   log_line("Writing video info file %s ...", TEMP_VIDEO_FILE_INFO);
-   FILE* fd = fopen(TEMP_VIDEO_FILE_INFO, "w");
-   if ( NULL == fd )
-   {
-      system("sudo mount -o remount,rw /");
-      char szTmp[128];
-      sprintf(szTmp, "rm -rf %s", TEMP_VIDEO_FILE_INFO);
-      hw_execute_bash_command(szTmp, NULL);
-      fd = fopen(TEMP_VIDEO_FILE_INFO, "w");
-   }
+   mp4_recorder_close(&s_Mp4Recorder);
 
-   if ( NULL == fd )
-   {
-      FILE* fd = fopen(TEMP_VIDEO_FILE_PROCESS_ERROR, "a");
-      fprintf(fd, "%s\n", "Failed to create video recording info file.");
-      fclose(fd);
-      log_softerror_and_alarm("Failed to create video info file %s", TEMP_VIDEO_FILE_INFO);
-   }
-   else
-   {
-      fprintf(fd, "%s\n", s_szFileRecording);
-      fprintf(fd, "%d %d\n", s_VDStatsCache.fps, duration_ms/1000 );
-      fprintf(fd, "%d %d\n", s_VDStatsCache.width, s_VDStatsCache.height );
-      fclose(fd);
-   }
-
-   log_line("Created video info file %s", TEMP_VIDEO_FILE_INFO);
-   log_line("Video info file content: (%s, %d, %d seconds, %d, %d)", s_szFileRecording, s_VDStatsCache.fps, duration_ms/1000, s_VDStatsCache.width, s_VDStatsCache.height);
+   u32 duration_ms = get_current_timestamp_ms() - s_TimeStartRecording;
+   _write_video_info_file(duration_ms);
    hw_execute_bash_command("./ruby_video_proc &", NULL);
    s_bRecording = false;
    s_szFileRecording[0] = 0;
@@ -384,6 +392,7 @@ void _processor_rx_video_forward_parse_h264_stream(u8* pBuffer, int length)
 {
    int iFoundNALVideoFrame = 0;
    int iFoundPosition = -1;
+   int iRecordingSegmentStart = 0;
    u8* pTmp = pBuffer;
    
    for( int k=0; k<length; k++ )
@@ -394,7 +403,11 @@ void _processor_rx_video_forward_parse_h264_stream(u8* pBuffer, int length)
 
       if ( (s_uParseNALStartSequence & 0xFFFFFF00) == 0x0100 )
       {
+         int bIsLastSlice = 0;
          s_uParseLastNALTag = s_uParseNALStartSequence & 0b11111;
+         // A SPS starts a new key frame: keeps the slices count in sync
+         if ( s_uParseLastNALTag == 7 )
+            s_uParseNALCurrentSlices = 0;
          if ( s_uParseLastNALTag == 1 || s_uParseLastNALTag == 5 )
          {
             s_uParseNALCurrentSlices++;
@@ -404,12 +417,24 @@ void _processor_rx_video_forward_parse_h264_stream(u8* pBuffer, int length)
                iFoundNALVideoFrame = s_uParseLastNALTag;
                g_VideoInfoStats.uTmpCurrentFrameSize += k;
                iFoundPosition = k;
+               bIsLastSlice = 1;
             }
          }
          //if ((s_uParseVideoTag == 0x0121) || (s_uParseVideoTag == 0x0127))
+
+         // The NAL header is at k; the data before it (with this start code) ends the previous NAL
+         if ( s_bRecording )
+         {
+            mp4_recorder_add_nal_data(&s_Mp4Recorder, pBuffer + iRecordingSegmentStart, k - iRecordingSegmentStart);
+            mp4_recorder_start_nal(&s_Mp4Recorder, (int)s_uParseLastNALTag, bIsLastSlice, g_TimeNow);
+            iRecordingSegmentStart = k;
+         }
       }
    }
 
+   if ( s_bRecording )
+      mp4_recorder_add_nal_data(&s_Mp4Recorder, pBuffer + iRecordingSegmentStart, length - iRecordingSegmentStart);
+
    if ( ! iFoundNALVideoFrame )
    {
       g_VideoInfoStats.uTmpCurrentFrameSize += length;
@@ -451,8 +476,9 @@ void processor_rx_video_forward_video_data(u8* pBuffer, int length)
 {
    // Find start of video frame H264 NAL unit
 
+   // The recorder is fed by the stream parser, with the NALs and frames boundaries it finds
    if ( (! g_bSearching) && ( NULL != g_pCurrentModel ) )
-   if ( g_pCurrentModel->osd_params.osd_flags[g_pCurrentModel->osd_params.layout] & OSD_FLAG_SHOW_STATS_VIDEO_INFO)
+   if ( s_bRecording || (g_pCurrentModel->osd_params.osd_flags[g_pCurrentModel->osd_params.layout] & OSD_FLAG_SHOW_STATS_VIDEO_INFO) )
       _processor_rx_video_forward_parse_h264_stream(pBuffer, length);
 
    if ( -1 != s_fPipeVideoOutToPlayer )
@@ -505,34 +531,6 @@ void processor_rx_video_forward_video_data(u8* pBuffer, int length)
       write(s_VideoETHOutputInfo.s_ForwardETHVideoPipeFile, pBuffer, length);
    }
 
-   if ( s_bRecording && -1 != s_iFileVideo )
-   {
-      int iRes = write(s_iFileVideo, pBuffer, length);
-      if ( iRes != length )
-      {
-         u32 uFlags = 0;
-         if ( iRes >= 0 )
-            uFlags = ALARM_FLAG_IO_ERROR_VIDEO_USB_OUTPUT_TRUNCATED;
-         else
-         {
-            if ( EAGAIN == errno )
-               uFlags = ALARM_FLAG_IO_ERROR_VIDEO_USB_OUTPUT_WOULD_BLOCK;
-            else
-               uFlags = ALARM_FLAG_IO_ERROR_VIDEO_USB_OUTPUT;
-         }
-
-         if ( g_TimeNow > process_data_rx_video_get_last_time_video_changed() + 5000 )
-            send_alarm_to_central(ALARM_ID_CONTROLLER_IO_ERROR, uFlags,1);
-        
-         s_uLastIOErrorAlarmFlagsUSBPlayer = uFlags;
-      }
-      else if ( 0 != s_uLastIOErrorAlarmFlagsUSBPlayer )
-      {
-         s_uLastIOErrorAlarmFlagsUSBPlayer = 0;
-         send_alarm_to_central(ALARM_ID_CONTROLLER_IO_ERROR, 0,1);
-      }
-   }
-
    if ( s_VideoETHOutputInfo.s_bForwardIsETHForwardEnabled && (-1 != s_VideoETHOutputInfo.s_ForwardETHSocketVideo ) )
    {
       u8* pData = pBuffer;
@@ -717,6 +715,25 @@ void processor_rx_video_forward_loop()
    {
       s_TimeLastPeriodicChecksVideoRecording = g_TimeNow;
 
+      // The recording file is written by the recorder thread; its errors and drops are only checked here
+      if ( s_bRecording )
+      {
+         t_mp4_recorder_stats stats;
+         mp4_recorder_get_stats(&s_Mp4Recorder, &stats);
+         if ( stats.uWriteErrors != s_uLastRecordingWriteErrors )
+         {
+            s_uLastRecordingWriteErrors = stats.uWriteErrors;
+            if ( g_TimeNow > process_data_rx_video_get_last_time_video_changed() + 5000 )
+               send_alarm_to_central(ALARM_ID_CONTROLLER_IO_ERROR, ALARM_FLAG_IO_ERROR_VIDEO_USB_OUTPUT,1);
+            s_uLastIOErrorAlarmFlagsUSBPlayer = ALARM_FLAG_IO_ERROR_VIDEO_USB_OUTPUT;
+         }
+         if ( stats.uFragmentsDropped != s_uLastRecordingFragmentsDropped )
+         {
+            log_softerror_and_alarm("Video recording: storage is too slow, %u fragments (%u frames) dropped so far.", stats.uFragmentsDropped, stats.uFramesDropped);
+            s_uLastRecordingFragmentsDropped = stats.uFragmentsDropped;
+         }
+      }
+
       int val = 0;
       if ( NULL != s_pSemaphoreStartRecord )
       if ( 0 == sem_getvalue(s_pSemaphoreStartRecord, &val) )
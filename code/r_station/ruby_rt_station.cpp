@@ -24,6 +24,8 @@ Code written by: Petru Soroaga, 2021-2023
 #include "../base/hardware.h"
 #include "../base/hw_procs.h"
 #include "../base/ruby_ipc.h"
+#include "../base/latency_trace.h"
+#include "../base/system_metrics.h"
 #include "../common/string_utils.h"
 #include "../common/radio_stats.h"
 #include "../radio/radiolink.h"
@@ -49,15 +51,12 @@ Code written by: Petru Soroaga, 2021-2023
 int s_iFailedInitRadioInterface = -1;
 u32 s_TimeLastPipeCheck = 0;
 
-u8 s_BufferCommands[MAX_PACKET_TOTAL_SIZE];
 u8 s_PipeBufferCommands[MAX_PACKET_TOTAL_SIZE];
 int s_PipeBufferCommandsPos = 0;
 
-u8 s_BufferTelemetryUplink[MAX_PACKET_TOTAL_SIZE];
 u8 s_PipeBufferTelemetryUplink[MAX_PACKET_TOTAL_SIZE];
 int s_PipeBufferTelemetryUplinkPos = 0;  
 
-u8 s_BufferRCUplink[MAX_PACKET_TOTAL_SIZE];
 u8 s_PipeBufferRCUplink[MAX_PACKET_TOTAL_SIZE];
 int s_PipeBufferRCUplinkPos = 0;  
 
@@ -828,7 +827,7 @@ void _process_and_send_packets(int iCountPendingVideoRetransmissionsRequests)
    if ( g_bSearching || NULL == g_pCurrentModel || ( (NULL != g_pCurrentModel) && (g_pCurrentModel->is_spectator)) )
    {
       // Empty queue
-      packets_queue_init(&s_QueueRadioPackets);
+      packets_queue_clear(&s_QueueRadioPackets);
       return;
    }
 
@@ -959,41 +958,35 @@ void _process_and_send_packets(int iCountPendingVideoRetransmissionsRequests)
    }
 }
 
-void try_read_pipes()
+// Reads the messages straight into packets pool buffers and queues them without copying.
+// If the pool is empty, the messages wait in the pipe.
+static void _try_read_pipe_to_queues(int iPipeFd, u8* pPipeBuffer, int* pPipeBufferPos, int iMaxPacketsToRead)
 {
-   int maxPacketsToRead = 5;
-   maxPacketsToRead += DEFAULT_UPLOAD_PACKET_CONFIRMATION_FREQUENCY;
-   while ( (maxPacketsToRead > 0) && NULL != ruby_ipc_try_read_message(g_fIPCFromCentral, 50, s_PipeBufferCommands, &s_PipeBufferCommandsPos, s_BufferCommands) )
-   {
-      maxPacketsToRead--;
-      t_packet_header* pPH = (t_packet_header*)s_BufferCommands;      
-      if ( (pPH->packet_flags & PACKET_FLAGS_MASK_MODULE) == PACKET_COMPONENT_LOCAL_CONTROL )
-         packets_queue_add_packet(&s_QueueControlPackets, s_BufferCommands); 
-      else
-         packets_queue_add_packet(&s_QueueRadioPackets, s_BufferCommands); 
-   }
-
-   maxPacketsToRead = 5;
-   while ( (maxPacketsToRead > 0) && NULL != ruby_ipc_try_read_message(g_fIPCFromTelemetry, 50, s_PipeBufferTelemetryUplink, &s_PipeBufferTelemetryUplinkPos, s_BufferTelemetryUplink) )
+   while ( iMaxPacketsToRead > 0 )
    {
-      maxPacketsToRead--;
-      t_packet_header* pPH = (t_packet_header*)s_BufferTelemetryUplink;      
+      t_packet_buffer* pPacket = packets_pool_alloc();
+      if ( NULL == pPacket )
+         break;
+      if ( NULL == ruby_ipc_try_read_message(iPipeFd, 50, pPipeBuffer, pPipeBufferPos, pPacket->packet_buffer) )
+      {
+         packets_pool_release(pPacket);
+         break;
+      }
+      iMaxPacketsToRead--;
+      t_packet_header* pPH = (t_packet_header*)pPacket->packet_buffer;
+      pPacket->packet_length = pPH->total_length;
       if ( (pPH->packet_flags & PACKET_FLAGS_MASK_MODULE) == PACKET_COMPONENT_LOCAL_CONTROL )
-         packets_queue_add_packet(&s_QueueControlPackets, s_BufferTelemetryUplink); 
+         packets_queue_add_buffer(&s_QueueControlPackets, pPacket, PACKETS_QUEUE_CLASS_CONTROL);
       else
-         packets_queue_add_packet(&s_QueueRadioPackets, s_BufferTelemetryUplink); 
+         packets_queue_add_buffer(&s_QueueRadioPackets, pPacket, packets_queue_get_packet_class(pPacket->packet_buffer));
    }
+}
 
-   maxPacketsToRead = 5;
-   while ( (maxPacketsToRead > 0) && NULL != ruby_ipc_try_read_message(g_fIPCFromRC, 50, s_PipeBufferRCUplink, &s_PipeBufferRCUplinkPos, s_BufferRCUplink) )
-   {
-      maxPacketsToRead--;
-      t_packet_header* pPH = (t_packet_header*)s_BufferRCUplink;      
-      if ( (pPH->packet_flags & PACKET_FLAGS_MASK_MODULE) == PACKET_COMPONENT_LOCAL_CONTROL )
-         packets_queue_add_packet(&s_QueueControlPackets, s_BufferRCUplink); 
-      else
-         packets_queue_add_packet(&s_QueueRadioPackets, s_BufferRCUplink);
-   }
+void try_read_pipes()
+{
+   _try_read_pipe_to_queues(g_fIPCFromCentral, s_PipeBufferCommands, &s_PipeBufferCommandsPos, 5 + DEFAULT_UPLOAD_PACKET_CONFIRMATION_FREQUENCY);
+   _try_read_pipe_to_queues(g_fIPCFromTelemetry, s_PipeBufferTelemetryUplink, &s_PipeBufferTelemetryUplinkPos, 5);
+   _try_read_pipe_to_queues(g_fIPCFromRC, s_PipeBufferRCUplink, &s_PipeBufferRCUplinkPos, 5);
 }
 
 void init_shared_memory_objects()
@@ -1057,6 +1050,8 @@ void init_shared_memory_objects()
    else
       log_line("Opened shared mem for video rx process watchdog stats for writing.");
 
+   LATENCY_TRACE_INIT(SHARED_MEM_LATENCY_TRACE_STATION);
+
    if ( NULL != g_pProcessStats )
    {
       g_pProcessStats->alarmFlags = 0;
@@ -1170,7 +1165,7 @@ void _router_periodic_loop()
       PH.vehicle_id_dest = g_pCurrentModel->vehicle_id;
       PH.total_headers_length = sizeof(t_packet_header);
       PH.total_length = sizeof(t_packet_header) + sizeof(u32);
-      PH.extra_flags = 0;
+      PH.extra_flags = PACKET_EXTRA_FLAGS_VALID | PACKET_EXTRA_FLAGS_BIT_CAN_OPEN_AEAD;
       u8 packet[MAX_PACKET_TOTAL_SIZE];
       memcpy(packet, (u8*)&PH, sizeof(t_packet_header));
       memcpy(packet + sizeof(t_packet_header), &s_uPairingRequestsSentCount, sizeof(u32));
@@ -1354,6 +1349,7 @@ int main (int argc, char *argv[])
    log_line("");
 
    u32 uTimeLastMemoryCheck = 0;
+   u32 uTimeLastQueuesStatsLog = 0;
    u32 uCountMemoryChecks = 0;
 
    u32 uMaxLoopTime = DEFAULT_MAX_LOOP_TIME_MILISECONDS;
@@ -1369,22 +1365,28 @@ int main (int argc, char *argv[])
       g_TimeNow = get_current_timestamp_ms();
       g_TimeNowMicros = get_current_timestamp_micros();
       u32 tTime0 = g_TimeNow;
+      LATENCY_TRACE_PERIODIC(g_TimeNow);
 
       if ( (0 == uCountMemoryChecks && (g_TimeNow > g_TimeStart+6000)) || (g_TimeNow > uTimeLastMemoryCheck + 60000) )
       {
          uCountMemoryChecks++;
          uTimeLastMemoryCheck = g_TimeNow;
-         char szOutput[2048];
-         if ( 1 == hw_execute_bash_command_raw("df -m /home/pi/ruby | grep root", szOutput) )
+         // Sampled by ruby_central on its system metrics thread
+         shared_mem_system_metrics metrics;
+         if ( system_metrics_get(&metrics) && (metrics.uValidFlags & SYSTEM_METRICS_VALID_DISK_ROOT) )
          {
-            char szTemp[1024];
-            long lb, lu, lMemoryFreeMb;
-            sscanf(szOutput, "%s %ld %ld %ld", szTemp, &lb, &lu, &lMemoryFreeMb);
+            long lMemoryFreeMb = (long)(metrics.disks[SYSTEM_METRICS_DISK_ROOT].uFreeKb/1024);
             if ( lMemoryFreeMb < 200 )
                send_alarm_to_central(ALARM_ID_CONTROLLER_LOW_STORAGE_SPACE, (u32)lMemoryFreeMb, 1);
          }
       }
 
+      if ( g_TimeNow > uTimeLastQueuesStatsLog + 30000 )
+      {
+         uTimeLastQueuesStatsLog = g_TimeNow;
+         packets_queue_log_stats(&s_QueueRadioPackets, "radio out");
+      }
+
       _router_periodic_loop();
       
       u32 tTime1 = get_current_timestamp_ms();
@@ -1409,7 +1411,12 @@ int main (int argc, char *argv[])
       for( int i=0; i<6; i++ )
       {
          if ( receivedAny > 0 )
+         {
+            // Traced only once select() reported data, so the time spent waiting for packets is left out
+            LATENCY_TRACE_BEGIN(uTraceReceive);
             nEndOfVideoBlock |= process_received_radio_packets();
+            LATENCY_TRACE_END(LATENCY_TRACE_STAGE_STATION_RECEIVE_RADIO, uTraceReceive);
+         }
          else
             break;
          receivedAny = try_receive_radio_packets(200);
@@ -1433,6 +1440,8 @@ int main (int argc, char *argv[])
          video_link_adaptive_periodic_loop();
       }
 
+      process_audio_periodic_loop();
+
       u32 tTime5 = get_current_timestamp_ms();
       
       int iContainsVideoRequestsCount = 0;
@@ -1522,8 +1531,10 @@ int main (int argc, char *argv[])
    
    if ( ! process_data_rx_video_uninit() )
       log_softerror_and_alarm("Failed to uninit process packets rx video");
+   video_link_adaptive_uninit();
 
    shared_mem_process_stats_close(SHARED_MEM_WATCHDOG_ROUTER_RX, g_pProcessStats);
+   LATENCY_TRACE_UNINIT();
    shared_mem_video_link_stats_close(g_pSM_VideoLinkStats);
    shared_mem_video_link_graphs_close(g_pSM_VideoLinkGraphs);
    shared_mem_radio_stats_close(g_pSM_RadioStats);
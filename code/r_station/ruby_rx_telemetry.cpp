@@ -14,6 +14,7 @@ Code written by: Petru Soroaga, 2021-2023
 #include "../base/shared_mem.h"
 #include "../radio/radiolink.h"
 #include "../radio/radiopackets2.h"
+#include "../radio/radio_packets_chain.h"
 #include "../base/commands.h"
 #include "../base/config.h"
 #include "../base/models.h"
@@ -22,6 +23,8 @@ Code written by: Petru Soroaga, 2021-2023
 #include "../base/controller_utils.h"
 #include "../base/ruby_ipc.h"
 #include "../common/string_utils.h"
+#include "../common/telemetry_transport.h"
+#include "../common/telemetry_hub.h"
 
 #include "timers.h"
 
@@ -91,21 +94,30 @@ u32 s_LastReceivedStreamPacketIndexFromRouter = MAX_U32;
 u32 s_TimeLastUplinkKbpsComputation = 0;
 u32 s_uUplink_bps = 0;
 
+// MAVLink aware reliable transport with the vehicle, used instead of the raw segments once the vehicle uses it too
+t_telemetry_transport s_TelemetryTransport;
+bool s_bTelemetryTransportEnabled = false;
+u32 s_uTimeLastTelemetryTransportHello = 0;
+u8  s_uTelemetryTransportDelivered[RAW_TELEMETRY_MAX_BUFFER]; // delivered frames, sent to central for OSD plugins
+int s_iTelemetryTransportDeliveredCount = 0;
+u32 s_uTelemetryTransportDeliveredSegmentIndex = 0;
+
+// All the telemetry outputs/inputs on the controller (serial port, USB tethered device, network GCSes)
+t_telemetry_hub s_TelemetryHub;
+int s_iTelemetryHubSerialClientId = -1;
+
 typedef struct
 {
    bool bUSBTethering;
    u32 TimeLastUSBTetheringCheck;
    char szIPUSB[32];
-   struct sockaddr_in sockAddrUSBDevice;
-   int socketUSBOutput;
-   int usbBlockSize;
-   u8 usbBuffer[2048];
-   int usbBufferPos;
+   int iHubClientId;
 } t_telemetry_usb_output_info;
 
 t_telemetry_usb_output_info s_TelemetryUSBOutputInfo;
 
 void checkTelemetrySettingsOnControllerChanged();
+void _output_telemetry_data(u8* pTelemetryData, int len);
 
 
 void process_datalink_packet_download(u8* pBuffer, int length)
@@ -178,41 +190,7 @@ void process_data_telemetry_raw_download(u8* pBuffer, int length)
 
    //log_line("Received downloaded raw telemetry: segment index (last/now): %u/%u, total serial: %u, total size: %u, len: %d", s_uRawTelemetryLastReceivedDownloadedSegmentIndex, pPHTR->telem_segment_index, pPHTR->telem_total_serial, pPHTR->telem_total_data, len);
 
-   if ( NULL == g_pCurrentModel )
-      return;
-
-   if ( s_TelemetryUSBOutputInfo.bUSBTethering && 0 != s_TelemetryUSBOutputInfo.szIPUSB[0] )
-   if ( -1 != s_TelemetryUSBOutputInfo.socketUSBOutput )
-   {
-      memcpy( &(s_TelemetryUSBOutputInfo.usbBuffer[s_TelemetryUSBOutputInfo.usbBufferPos]), pTelemetryData, len );
-      s_TelemetryUSBOutputInfo.usbBufferPos += len;
-
-      while ( s_TelemetryUSBOutputInfo.usbBufferPos >= s_TelemetryUSBOutputInfo.usbBlockSize )
-      {
-         sendto(s_TelemetryUSBOutputInfo.socketUSBOutput, s_TelemetryUSBOutputInfo.usbBuffer, s_TelemetryUSBOutputInfo.usbBlockSize,
-               0, (struct sockaddr *)&s_TelemetryUSBOutputInfo.sockAddrUSBDevice, sizeof(s_TelemetryUSBOutputInfo.sockAddrUSBDevice) );
-         //log_line("Sent USB temeletry packet, size: %d", s_TelemetryUSBOutputInfo.usbBlockSize);
-         for( int i=0; i<(s_TelemetryUSBOutputInfo.usbBufferPos-s_TelemetryUSBOutputInfo.usbBlockSize); i++ )
-            s_TelemetryUSBOutputInfo.usbBuffer[i] = s_TelemetryUSBOutputInfo.usbBuffer[i+s_TelemetryUSBOutputInfo.usbBlockSize];
-         s_TelemetryUSBOutputInfo.usbBufferPos -= s_TelemetryUSBOutputInfo.usbBlockSize;
-      }
-   }
-
-   if ( NULL == g_pCurrentModel || (g_pCurrentModel->is_spectator && (!(g_pCurrentModel->telemetry_params.flags & TELEMETRY_FLAGS_SPECTATOR_ENABLE))) )
-      return;
-
-   if ( g_bOutputTelemetryToSerial && (-1 != g_iSerialPortTelemetry) )
-   if ( len != write(g_iSerialPortTelemetry, pTelemetryData, len) )
-      log_softerror_and_alarm("Failed to write to serial port for telemetry output on controller.");
-
-   if ( g_pCurrentModel->telemetry_params.flags & TELEMETRY_FLAGS_SEND_FULL_PACKETS_TO_CONTROLLER )
-   {
-      // Send the raw telemetry to central too, for OSD plugins consumption
-      pPH->packet_flags &= (~PACKET_FLAGS_MASK_MODULE);
-      pPH->packet_flags |= PACKET_COMPONENT_LOCAL_CONTROL;
-      packet_compute_crc(pBuffer, length);
-      ruby_ipc_channel_send_message(s_fIPCToRouter, pBuffer, length);
-   }
+   _output_telemetry_data(pTelemetryData, len);
 
    /*
    log_buffer(buffer, length);
@@ -225,6 +203,83 @@ void process_data_telemetry_raw_download(u8* pBuffer, int length)
    */
 }
 
+// Telemetry received from the vehicle goes to all the telemetry hub clients (USB tethering, serial port, network GCSes).
+// It's queued here and written without blocking by telemetry_hub_flush() in the main loop.
+// (The serial port is a hub client only when not a spectator, see init_serial_ports)
+void _output_telemetry_data(u8* pTelemetryData, int len)
+{
+   if ( NULL == g_pCurrentModel )
+      return;
+   telemetry_hub_send(&s_TelemetryHub, pTelemetryData, len, g_TimeNow);
+}
+
+// The router sends the raw telemetry segments to central directly. The frames delivered by the
+// telemetry transport are sent to central (through the router) as raw telemetry packets, for OSD plugins consumption.
+void _send_telemetry_transport_frames_to_central()
+{
+   if ( (s_iTelemetryTransportDeliveredCount <= 0) || (NULL == g_pCurrentModel) )
+      return;
+
+   t_packet_header PH;
+   t_packet_header_telemetry_raw PHTR;
+
+   PH.packet_flags = PACKET_COMPONENT_LOCAL_CONTROL;
+   PH.packet_type =  PACKET_TYPE_TELEMETRY_RAW_DOWNLOAD;
+   PH.stream_packet_idx = (STREAM_ID_DATA) << PACKET_FLAGS_MASK_SHIFT_STREAM_INDEX;
+   PH.vehicle_id_src = g_pCurrentModel->vehicle_id;
+   PH.vehicle_id_dest = g_uControllerId;
+   PH.total_headers_length = sizeof(t_packet_header)+sizeof(t_packet_header_telemetry_raw);
+   PH.total_length = sizeof(t_packet_header)+sizeof(t_packet_header_telemetry_raw) + s_iTelemetryTransportDeliveredCount;
+   PH.extra_flags = 0;
+
+   PHTR.telem_segment_index = s_uTelemetryTransportDeliveredSegmentIndex;
+   PHTR.telem_total_data = s_TelemetryTransport.stats.uFramesDelivered;
+   PHTR.telem_total_serial = 0;
+
+   u8 buffer[MAX_PACKET_TOTAL_SIZE];
+   memcpy(buffer, (u8*)&PH, sizeof(t_packet_header));
+   memcpy(buffer+sizeof(t_packet_header), (u8*)&PHTR, sizeof(t_packet_header_telemetry_raw));
+   memcpy(buffer+sizeof(t_packet_header)+sizeof(t_packet_header_telemetry_raw), s_uTelemetryTransportDelivered, s_iTelemetryTransportDeliveredCount);
+   packet_compute_crc(buffer, PH.total_length);
+   ruby_ipc_channel_send_message(s_fIPCToRouter, buffer, PH.total_length);
+
+   s_iTelemetryTransportDeliveredCount = 0;
+   s_uTelemetryTransportDeliveredSegmentIndex++;
+}
+
+void _on_telemetry_transport_deliver(const u8* pFrame, int iFrameLength, void* pContext)
+{
+   _output_telemetry_data((u8*)pFrame, iFrameLength);
+
+   if ( s_iTelemetryTransportDeliveredCount + iFrameLength > RAW_TELEMETRY_MAX_BUFFER )
+      _send_telemetry_transport_frames_to_central();
+   memcpy(&(s_uTelemetryTransportDelivered[s_iTelemetryTransportDeliveredCount]), pFrame, iFrameLength);
+   s_iTelemetryTransportDeliveredCount += iFrameLength;
+}
+
+void process_data_telemetry_mavlink_download(u8* pBuffer, int length)
+{
+   t_packet_header* pPH = (t_packet_header*)pBuffer;
+
+   if ( ! s_bTelemetryTransportEnabled )
+   {
+      log_line("Vehicle uses the MAVLink telemetry transport, switching to it from raw telemetry segments.");
+      s_bTelemetryTransportEnabled = true;
+      telemetryBufferToVehicleCount = 0;
+   }
+
+   int len = pPH->total_length - sizeof(t_packet_header);
+   if ( pPH->packet_flags & PACKET_FLAGS_BIT_EXTRA_DATA )
+   {
+      u8 size = *(((u8*)pPH) + pPH->total_length-1);
+      len -= size;
+   }
+   if ( ! telemetry_transport_on_packet(&s_TelemetryTransport, pBuffer + sizeof(t_packet_header), len, g_TimeNow) )
+      log_softerror_and_alarm("Received invalid MAVLink telemetry transport packet (%d bytes).", len);
+
+   _send_telemetry_transport_frames_to_central();
+}
+
 void _process_data_rc_telemetry(u8* pBuffer, int length)
 {
    if ( NULL != s_pPHDownstreamInfoRC )
@@ -296,29 +351,24 @@ void upload_telemetry_packet()
    s_uRawTelemetryUploadTotalSend += telemetryBufferToVehicleCount;
    s_uUplink_bps += telemetryBufferToVehicleCount * 8;
 
-   t_packet_header PH;
-   t_packet_header_telemetry_raw PHTR;
+   u8 buffer[MAX_PACKET_TOTAL_SIZE];
+   t_packets_chain_builder chainBuilder;
+   packets_chain_builder_init(&chainBuilder, buffer, MAX_PACKET_TOTAL_SIZE);
+   t_packet_header* pPH = packets_chain_builder_add(&chainBuilder, PACKET_COMPONENT_TELEMETRY, PACKET_TYPE_TELEMETRY_RAW_UPLOAD,
+      (STREAM_ID_DATA) << PACKET_FLAGS_MASK_SHIFT_STREAM_INDEX, g_uControllerId, g_pCurrentModel->vehicle_id,
+      sizeof(t_packet_header)+sizeof(t_packet_header_telemetry_raw), telemetryBufferToVehicleCount);
+   if ( NULL == pPH )
+      return;
 
-   PH.packet_flags = PACKET_COMPONENT_TELEMETRY;
-   PH.packet_type =  PACKET_TYPE_TELEMETRY_RAW_UPLOAD;
-   PH.stream_packet_idx = (STREAM_ID_DATA) << PACKET_FLAGS_MASK_SHIFT_STREAM_INDEX;
-   PH.vehicle_id_src = g_uControllerId;
-   PH.vehicle_id_dest = g_pCurrentModel->vehicle_id;
-   PH.total_headers_length = sizeof(t_packet_header)+sizeof(t_packet_header_telemetry_raw);
-   PH.total_length = sizeof(t_packet_header)+sizeof(t_packet_header_telemetry_raw) + telemetryBufferToVehicleCount;
-      
-   PHTR.telem_segment_index = s_uRawTelemetryUploadSegmentIndex;
-   PHTR.telem_total_data = s_uRawTelemetryUploadTotalSend;
-   PHTR.telem_total_serial = s_uRawTelemetryUploadTotalReadFromSerial;
+   t_packet_header_telemetry_raw* pPHTR = (t_packet_header_telemetry_raw*)(((u8*)pPH) + sizeof(t_packet_header));
+   pPHTR->telem_segment_index = s_uRawTelemetryUploadSegmentIndex;
+   pPHTR->telem_total_data = s_uRawTelemetryUploadTotalSend;
+   pPHTR->telem_total_serial = s_uRawTelemetryUploadTotalReadFromSerial;
 
-   //log_line("Sending raw telemetry to controller, segment index: %u, total serial: %u, total data: %u, length: %d", dptr.telem_segment_index, dptr.telem_total_serial, dptr.telem_total_data, telemetryBufferToVehicleCount);
+   //log_line("Sending raw telemetry to controller, segment index: %u, total serial: %u, total data: %u, length: %d", pPHTR->telem_segment_index, pPHTR->telem_total_serial, pPHTR->telem_total_data, telemetryBufferToVehicleCount);
 
-   u8 buffer[MAX_PACKET_TOTAL_SIZE];
-   memcpy(buffer, (u8*)&PH, sizeof(t_packet_header));
-   memcpy(buffer+sizeof(t_packet_header), (u8*)&PHTR, sizeof(t_packet_header_telemetry_raw));
-   memcpy(buffer+sizeof(t_packet_header)+sizeof(t_packet_header_telemetry_raw), telemetryBufferToVehicle, telemetryBufferToVehicleCount);
-   packet_compute_crc(buffer, PH.total_length);
-   ruby_ipc_channel_send_message(s_fIPCToRouter, buffer, PH.total_length);
+   memcpy(((u8*)pPH) + pPH->total_headers_length, telemetryBufferToVehicle, telemetryBufferToVehicleCount);
+   ruby_ipc_channel_send_message(s_fIPCToRouter, buffer, packets_chain_builder_finalize(&chainBuilder));
  
    telemetryBufferToVehicleLastSendTime = g_TimeNow;
    telemetryBufferToVehicleCount = 0;
@@ -326,6 +376,39 @@ void upload_telemetry_packet()
 }
 
 
+void upload_telemetry_transport_packets()
+{
+   if ( NULL == g_pCurrentModel || g_pCurrentModel->is_spectator )
+      return;
+   if ( g_bUpdateInProgress )
+      return;
+
+   u8 buffer[MAX_PACKET_TOTAL_SIZE];
+   int iMaxPayload = TELEMETRY_TRANSPORT_MAX_PAYLOAD;
+   if ( iMaxPayload > MAX_PACKET_TOTAL_SIZE - (int)sizeof(t_packet_header) )
+      iMaxPayload = MAX_PACKET_TOTAL_SIZE - (int)sizeof(t_packet_header);
+
+   int iLength = 0;
+   while ( (iLength = telemetry_transport_get_packet(&s_TelemetryTransport, buffer + sizeof(t_packet_header), iMaxPayload, g_TimeNow)) > 0 )
+   {
+      if ( NULL != g_pProcessStats )
+         g_pProcessStats->lastIPCOutgoingTime = g_TimeNow;
+      s_uUplink_bps += iLength * 8;
+
+      t_packet_header PH;
+      PH.packet_flags = PACKET_COMPONENT_TELEMETRY;
+      PH.packet_type =  PACKET_TYPE_TELEMETRY_MAVLINK_UPLOAD;
+      PH.stream_packet_idx = (STREAM_ID_DATA) << PACKET_FLAGS_MASK_SHIFT_STREAM_INDEX;
+      PH.vehicle_id_src = g_uControllerId;
+      PH.vehicle_id_dest = g_pCurrentModel->vehicle_id;
+      PH.total_headers_length = sizeof(t_packet_header)+sizeof(t_packet_header_telemetry_transport);
+      PH.total_length = sizeof(t_packet_header) + iLength;
+      memcpy(buffer, (u8*)&PH, sizeof(t_packet_header));
+      packet_compute_crc(buffer, PH.total_length);
+      ruby_ipc_channel_send_message(s_fIPCToRouter, buffer, PH.total_length);
+   }
+}
+
 void upload_datalink_packet()
 {
    if ( NULL == g_pCurrentModel || g_pCurrentModel->is_spectator )
@@ -364,55 +447,40 @@ void upload_datalink_packet()
    s_uDataLinkUploadSegmentIndex++;
 }
 
-void try_read_serial_telemetry()
+// Uplink data read by the telemetry hub from any of its clients (the serial port or a GCS)
+void _on_telemetry_hub_uplink(const u8* pData, int iLength, int iClientId, void* pContext)
 {
-   if ( -1 == g_iSerialPortTelemetry )
-      return;
    if ( NULL == g_pCurrentModel || g_pCurrentModel->is_spectator )
       return;
 
-   u8 bufferIn[RAW_TELEMETRY_MAX_BUFFER];
-   struct timeval to;
-   to.tv_sec = 0;
-   to.tv_usec = 1000; // 1 ms
-   fd_set readset;   
-   FD_ZERO(&readset);
-   FD_SET(g_iSerialPortTelemetry, &readset);
-   int res = select(g_iSerialPortTelemetry+1, &readset, NULL, NULL, &to);
-   if ( res <= 0 )
-      return;
-   if ( ! FD_ISSET(g_iSerialPortTelemetry, &readset) )
-      return;
+   if ( iClientId == s_iTelemetryHubSerialClientId )
+      s_uRawTelemetryUploadTotalReadFromSerial += iLength;
+   //log_line("Uplink from telemetry hub client %d: %d bytes.", iClientId, iLength);
 
-   int length = read(g_iSerialPortTelemetry, bufferIn, RAW_TELEMETRY_MAX_BUFFER);
-   if ( length <= 0 )
+   if ( s_bTelemetryTransportEnabled )
+   {
+      telemetry_transport_add_serial_data(&s_TelemetryTransport, pData, iLength, g_TimeNow);
       return;
+   }
 
-   s_uRawTelemetryUploadTotalReadFromSerial += length;
-   //log_line("Serial total read: %d, read %d bytes.", s_uRawTelemetryUploadTotalReadFromSerial, length);
-   /*
-      char szBuff[2000];
-      memcpy(szBuff, &bufferIn[0], length);
-      szBuff[length] = 0;
-      log_line("Sending data: %s", szBuff);
-   */
-   u8* pData = &bufferIn[0];
+   const u8* pIn = pData;
+   int length = iLength;
    while ( length > 0 )
    {
          if ( telemetryBufferToVehicleCount + length < telemetryBufferToVehicleMaxSize )
          {
-            memcpy(&(telemetryBufferToVehicle[telemetryBufferToVehicleCount]), pData, length);
+            memcpy(&(telemetryBufferToVehicle[telemetryBufferToVehicleCount]), pIn, length);
             telemetryBufferToVehicleCount += length;
             return;
          }
          int chunkSize = telemetryBufferToVehicleMaxSize-telemetryBufferToVehicleCount;
-         memcpy(&(telemetryBufferToVehicle[telemetryBufferToVehicleCount]), pData, chunkSize);
+         memcpy(&(telemetryBufferToVehicle[telemetryBufferToVehicleCount]), pIn, chunkSize);
          telemetryBufferToVehicleCount += chunkSize;
-         pData += chunkSize;
+         pIn += chunkSize;
          length -= chunkSize;
          upload_telemetry_packet();
    }
-}  
+}
 
 void try_read_serial_datalink()
 {
@@ -467,7 +535,7 @@ void try_read_messages_from_router()
 {
    int maxMessagesToRead = 10;
    int timeoutReadPipeMicroseconds = 1000;
-   if ( g_bInputTelemetryFromSerial )
+   if ( g_bInputTelemetryFromSerial || (telemetry_hub_get_clients_count(&s_TelemetryHub) > 0) )
       timeoutReadPipeMicroseconds = 500;
  
    while ( (maxMessagesToRead > 0) && NULL != ruby_ipc_try_read_message(s_fIPCFromRouter, timeoutReadPipeMicroseconds, s_PipeBufferTelemetryDownlink, &s_PipeBufferTelemetryDownlinkPos, s_BufferTelemetryDownlink) )
@@ -500,6 +568,12 @@ void try_read_messages_from_router()
                s_LastReceivedStreamPacketIndexFromRouter = MAX_U32;
                s_uDataLinkLastReceivedDownloadedSegmentIndex = MAX_U32;
                s_uRawTelemetryLastReceivedDownloadedSegmentIndex = MAX_U32;
+
+               // The vehicle might be a different one: negotiate the telemetry transport again
+               s_bTelemetryTransportEnabled = false;
+               s_iTelemetryTransportDeliveredCount = 0;
+               telemetry_transport_reset(&s_TelemetryTransport, g_TimeNow);
+               telemetry_hub_set_mavlink(&s_TelemetryHub, (g_pCurrentModel->telemetry_params.fc_telemetry_type == MODEL_TELEMETRY_TYPE_MAVLINK)?1:0);
             }
 
             if ( pPH->packet_type == PACKET_TYPE_LOCAL_CONTROL_UPDATE_STARTED )
@@ -560,6 +634,8 @@ void try_read_messages_from_router()
          process_datalink_packet_download(s_BufferTelemetryDownlink, pPH->total_length);
       else if ( pPH->packet_type == PACKET_TYPE_TELEMETRY_RAW_DOWNLOAD )
          process_data_telemetry_raw_download(s_BufferTelemetryDownlink, pPH->total_length);
+      else if ( pPH->packet_type == PACKET_TYPE_TELEMETRY_MAVLINK_DOWNLOAD )
+         process_data_telemetry_mavlink_download(s_BufferTelemetryDownlink, pPH->total_length);
       else if ( pPH->packet_type == PACKET_TYPE_RC_TELEMETRY )
          _process_data_rc_telemetry(s_BufferTelemetryDownlink, pPH->total_length);
       else if ( pPH->packet_type == PACKET_TYPE_RUBY_TELEMETRY_VIDEO_LINK_DEV_STATS )
@@ -684,6 +760,35 @@ void init_serial_ports()
    if ( -1 != g_iSerialPortTelemetry )
    if ( -1 != g_iSerialPortIndexTelemetryInput )
       g_bInputTelemetryFromSerial = true;
+
+   if ( g_bOutputTelemetryToSerial || g_bInputTelemetryFromSerial )
+   {
+      u32 uFlags = 0;
+      if ( g_bOutputTelemetryToSerial )
+         uFlags |= TELEMETRY_HUB_FLAG_DOWNLINK;
+      if ( g_bInputTelemetryFromSerial )
+         uFlags |= TELEMETRY_HUB_FLAG_UPLINK;
+      s_iTelemetryHubSerialClientId = telemetry_hub_add_serial(&s_TelemetryHub, g_iSerialPortTelemetry, uFlags, pPortInfo->szName);
+   }
+}
+
+// Starts/stops the telemetry hub servers for network GCSes, as set in the controller settings
+void _apply_telemetry_hub_settings()
+{
+   ControllerSettings* pCS = get_ControllerSettings();
+
+   telemetry_hub_set_remote_clients_rate_filter(&s_TelemetryHub, pCS->iTelemetryHubClientsMaxRateHz);
+
+   if ( (pCS->iTelemetryHubUDPPort == s_TelemetryHub.iUDPServerPort) && (pCS->iTelemetryHubTCPPort == s_TelemetryHub.iTCPServerPort) )
+      return;
+
+   telemetry_hub_stop_listening(&s_TelemetryHub);
+   if ( pCS->iTelemetryHubUDPPort > 0 )
+   if ( ! telemetry_hub_listen_udp(&s_TelemetryHub, pCS->iTelemetryHubUDPPort) )
+      log_softerror_and_alarm("Failed to start the telemetry UDP server on port %d.", pCS->iTelemetryHubUDPPort);
+   if ( pCS->iTelemetryHubTCPPort > 0 )
+   if ( ! telemetry_hub_listen_tcp(&s_TelemetryHub, pCS->iTelemetryHubTCPPort) )
+      log_softerror_and_alarm("Failed to start the telemetry TCP server on port %d.", pCS->iTelemetryHubTCPPort);
 }
 
 void checkTelemetrySettingsOnControllerChanged()
@@ -696,13 +801,14 @@ void checkTelemetrySettingsOnControllerChanged()
 
    if ( s_TelemetryUSBOutputInfo.bUSBTethering )
    {
-      if ( -1 != s_TelemetryUSBOutputInfo.socketUSBOutput )
-         close(s_TelemetryUSBOutputInfo.socketUSBOutput);
-      s_TelemetryUSBOutputInfo.socketUSBOutput = -1;
+      telemetry_hub_remove_client(&s_TelemetryHub, s_TelemetryUSBOutputInfo.iHubClientId);
+      s_TelemetryUSBOutputInfo.iHubClientId = -1;
       s_TelemetryUSBOutputInfo.bUSBTethering = false;
       log_line("Telemetry Output to USB closed momentarly due to telemetry serial ports settings changed.");
    }
 
+   _apply_telemetry_hub_settings();
+
 
    // Telemetry serial port changed ?
 
@@ -764,6 +870,8 @@ void checkTelemetrySettingsOnControllerChanged()
       close(g_iSerialPortDataLink);
    g_iSerialPortDataLink = -1;
 
+   telemetry_hub_remove_client(&s_TelemetryHub, s_iTelemetryHubSerialClientId);
+   s_iTelemetryHubSerialClientId = -1;
    if ( -1 != g_iSerialPortTelemetry )
       close(g_iSerialPortTelemetry);
    g_iSerialPortTelemetry = -1;
@@ -786,9 +894,8 @@ void periodic_checks()
 
    if ( s_TelemetryUSBOutputInfo.bUSBTethering && pCS->iTelemetryForwardUSBType == 0 )
    {
-      if ( -1 != s_TelemetryUSBOutputInfo.socketUSBOutput )
-         close(s_TelemetryUSBOutputInfo.socketUSBOutput);
-      s_TelemetryUSBOutputInfo.socketUSBOutput = -1;
+      telemetry_hub_remove_client(&s_TelemetryHub, s_TelemetryUSBOutputInfo.iHubClientId);
+      s_TelemetryUSBOutputInfo.iHubClientId = -1;
       s_TelemetryUSBOutputInfo.bUSBTethering = false;
       log_line("Telemetry Output to USB disabled.");
    }
@@ -808,16 +915,11 @@ void periodic_checks()
          }
          log_line("USB Device Tethered for Telemetry Output. Device IP: %s", s_TelemetryUSBOutputInfo.szIPUSB);
 
-         s_TelemetryUSBOutputInfo.socketUSBOutput = socket(AF_INET , SOCK_DGRAM, 0);
-         if ( s_TelemetryUSBOutputInfo.socketUSBOutput != -1 && 0 != s_TelemetryUSBOutputInfo.szIPUSB[0] )
-         {
-            memset(&s_TelemetryUSBOutputInfo.sockAddrUSBDevice, 0, sizeof(s_TelemetryUSBOutputInfo.sockAddrUSBDevice));
-            s_TelemetryUSBOutputInfo.sockAddrUSBDevice.sin_family = AF_INET;
-            s_TelemetryUSBOutputInfo.sockAddrUSBDevice.sin_addr.s_addr = inet_addr(s_TelemetryUSBOutputInfo.szIPUSB);
-            s_TelemetryUSBOutputInfo.sockAddrUSBDevice.sin_port = htons( pCS->iTelemetryForwardUSBPort );
-         }
-         s_TelemetryUSBOutputInfo.usbBlockSize = pCS->iTelemetryForwardUSBPacketSize;
-         s_TelemetryUSBOutputInfo.usbBufferPos = 0;
+         // The tethered device can send telemetry to the vehicle too, on the socket it gets the telemetry from
+         s_TelemetryUSBOutputInfo.iHubClientId = -1;
+         if ( 0 != s_TelemetryUSBOutputInfo.szIPUSB[0] )
+            s_TelemetryUSBOutputInfo.iHubClientId = telemetry_hub_add_udp_client(&s_TelemetryHub, s_TelemetryUSBOutputInfo.szIPUSB, pCS->iTelemetryForwardUSBPort,
+               TELEMETRY_HUB_FLAG_DOWNLINK | TELEMETRY_HUB_FLAG_UPLINK, pCS->iTelemetryForwardUSBPacketSize, "usb");
          s_TelemetryUSBOutputInfo.bUSBTethering = true;
          return;
       }
@@ -825,10 +927,8 @@ void periodic_checks()
       if ( access(TEMP_USB_TETHERING_DEVICE, R_OK) == -1 )
       {
          log_line("Tethered USB Device for Telemetry Output Unplugged.");
-         if ( -1 != s_TelemetryUSBOutputInfo.socketUSBOutput )
-            close(s_TelemetryUSBOutputInfo.socketUSBOutput);
-         s_TelemetryUSBOutputInfo.socketUSBOutput = -1;
-         s_TelemetryUSBOutputInfo.usbBufferPos = 0;
+         telemetry_hub_remove_client(&s_TelemetryHub, s_TelemetryUSBOutputInfo.iHubClientId);
+         s_TelemetryUSBOutputInfo.iHubClientId = -1;
          s_TelemetryUSBOutputInfo.bUSBTethering = false;
       }
    }
@@ -911,7 +1011,11 @@ int main(int argc, char *argv[])
 
    load_ControllerInterfacesSettings();
    load_ControllerSettings();
+   telemetry_hub_init(&s_TelemetryHub, _on_telemetry_hub_uplink, NULL);
+   if ( NULL != g_pCurrentModel )
+      telemetry_hub_set_mavlink(&s_TelemetryHub, (g_pCurrentModel->telemetry_params.fc_telemetry_type == MODEL_TELEMETRY_TYPE_MAVLINK)?1:0);
    init_serial_ports();
+   _apply_telemetry_hub_settings();
 
    Preferences* p = get_Preferences();   
    if ( p->nLogLevel != 0 )
@@ -920,13 +1024,16 @@ int main(int argc, char *argv[])
    s_TelemetryUSBOutputInfo.bUSBTethering = false;
    s_TelemetryUSBOutputInfo.TimeLastUSBTetheringCheck = 0;
    s_TelemetryUSBOutputInfo.szIPUSB[0] = 0;
-   s_TelemetryUSBOutputInfo.socketUSBOutput = -1;
-   s_TelemetryUSBOutputInfo.usbBlockSize = 1024;
-   s_TelemetryUSBOutputInfo.usbBufferPos = 0;
+   s_TelemetryUSBOutputInfo.iHubClientId = -1;
 
    radio_enable_crc_gen(1);
 
    open_shared_mem_objects();
+
+   g_TimeNow = get_current_timestamp_ms();
+   telemetry_transport_init(&s_TelemetryTransport, _on_telemetry_transport_deliver, NULL, g_TimeNow);
+   if ( g_iSerialPortTelemetrySpeed > 0 )
+      telemetry_transport_set_rate(&s_TelemetryTransport, g_iSerialPortTelemetrySpeed/10, g_TimeNow);
  
    log_line("Started all ok. Running now.");
    log_line("--------------------------------");
@@ -950,14 +1057,23 @@ int main(int argc, char *argv[])
 
       periodic_checks();
 
-      if ( g_bInputTelemetryFromSerial )
+      // Until the vehicle answers, let it know this controller can use the telemetry transport.
+      // Once in use, keep sending acks on an idle uplink, or the vehicle goes back to raw telemetry segments
+      if ( (NULL != g_pCurrentModel) && (! g_pCurrentModel->is_spectator) )
+      if ( g_pCurrentModel->telemetry_params.fc_telemetry_type == MODEL_TELEMETRY_TYPE_MAVLINK )
+      if ( g_TimeNow >= s_uTimeLastTelemetryTransportHello + (s_bTelemetryTransportEnabled?TELEMETRY_TRANSPORT_KEEPALIVE_MS:500) )
       {
-         try_read_serial_telemetry();
-         if ( telemetryBufferToVehicleCount >= RAW_TELEMETRY_MIN_SEND_LENGTH || 
-             (telemetryBufferToVehicleCount > 0 && g_TimeNow >= telemetryBufferToVehicleLastSendTime + RAW_TELEMETRY_SEND_TIMEOUT ) )
-            upload_telemetry_packet();
+         s_uTimeLastTelemetryTransportHello = g_TimeNow;
+         telemetry_transport_request_ack(&s_TelemetryTransport, g_TimeNow);
       }
 
+      telemetry_hub_poll(&s_TelemetryHub, g_bInputTelemetryFromSerial?1000:0, g_TimeNow);
+      if ( telemetryBufferToVehicleCount >= RAW_TELEMETRY_MIN_SEND_LENGTH || 
+          (telemetryBufferToVehicleCount > 0 && g_TimeNow >= telemetryBufferToVehicleLastSendTime + RAW_TELEMETRY_SEND_TIMEOUT ) )
+         upload_telemetry_packet();
+
+      upload_telemetry_transport_packets();
+
       if ( -1 != g_iSerialPortDataLink )
       {
          try_read_serial_datalink();
@@ -967,6 +1083,7 @@ int main(int argc, char *argv[])
       }
 
       try_read_messages_from_router();
+      telemetry_hub_flush(&s_TelemetryHub, g_TimeNow);
 
       u32 tNow = get_current_timestamp_ms();
 
@@ -986,6 +1103,9 @@ int main(int argc, char *argv[])
 
    log_line("Stopping...");
 
+   telemetry_hub_log_stats(&s_TelemetryHub);
+   telemetry_hub_close(&s_TelemetryHub);
+
    if ( -1 != g_iSerialPortDataLink )
       close(g_iSerialPortDataLink);
    g_iSerialPortDataLink = -1;
@@ -999,11 +1119,8 @@ int main(int argc, char *argv[])
    s_fIPCFromRouter = -1;
    s_fIPCToRouter = -1;
     
-   if ( -1 != s_TelemetryUSBOutputInfo.socketUSBOutput )
-      close(s_TelemetryUSBOutputInfo.socketUSBOutput);
-   s_TelemetryUSBOutputInfo.socketUSBOutput = -1;
+   s_TelemetryUSBOutputInfo.iHubClientId = -1;
    s_TelemetryUSBOutputInfo.bUSBTethering = false;
-   s_TelemetryUSBOutputInfo.usbBufferPos = 0;
 
    shared_mem_rc_downstream_info_close(s_pPHDownstreamInfoRC);
    shared_mem_process_stats_close(SHARED_MEM_WATCHDOG_TELEMETRY_RX, g_pProcessStats);
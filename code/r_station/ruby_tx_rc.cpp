@@ -42,6 +42,7 @@ Code written by: Petru Soroaga, 2021-2023
 #include "timers.h"
 
 #include <sys/resource.h>
+#include <sys/epoll.h>
 #include <semaphore.h>
 
 
@@ -80,6 +81,14 @@ u16 s_ComputedRCValues[MAX_RC_CHANNELS];
 u32 s_uLastTimeStampRCInFrame = 0;
 u8 s_uLastFrameIndexRCIn = 0;
 
+// The loop waits on the joystick and the RC in notify pipe, so new input is sent right away
+// (frames still go out at the RC rate when the input does not change).
+int s_iEpollFd = -1;
+int s_iEpollJoystickFd = -1;
+int s_iRCInNotifyFd = -1;
+bool s_bNewInput = false;
+u32 s_uTimeLastRCFrameSentMicros = 0;
+
 void init_controller_settings();
 
 void populate_rc_data( t_packet_header_rc_full_frame_upstream* pPHRCF )
@@ -135,7 +144,7 @@ bool handle_joysticks()
    if ( NULL == s_pJoystick || NULL == s_pCII )
       return false;
    
-   int countEvents = hardware_read_joystick(s_pCII->currentHardwareIndex, 5);
+   int countEvents = hardware_joystick_read_events(s_pJoystick);
    if ( countEvents < 0 )
    {
       log_line("Hardware: failed to read joystick.");
@@ -147,11 +156,69 @@ bool handle_joysticks()
    g_iFPSTotalJoystickEvents += countEvents;
    if ( countEvents > g_iFPSMaxJoystickEvents )
       g_iFPSMaxJoystickEvents = countEvents;
+   if ( countEvents > 0 )
+      s_bNewInput = true;
 
    memcpy(&s_JoystickLocalInfo, s_pJoystick, sizeof(hw_joystick_info_t));
    return true;
 }
 
+void _update_epoll_inputs()
+{
+   if ( s_iEpollFd < 0 )
+      return;
+
+   int fdJoystick = -1;
+   if ( NULL != s_pCII && NULL != s_pJoystick && hardware_is_joystick_opened(s_pCII->currentHardwareIndex) )
+      fdJoystick = s_pJoystick->fd;
+   if ( fdJoystick == s_iEpollJoystickFd )
+      return;
+
+   // A closed fd is already out of the epoll set
+   if ( s_iEpollJoystickFd >= 0 )
+      epoll_ctl(s_iEpollFd, EPOLL_CTL_DEL, s_iEpollJoystickFd, NULL);
+   s_iEpollJoystickFd = -1;
+   if ( fdJoystick < 0 )
+      return;
+
+   struct epoll_event ev;
+   memset(&ev, 0, sizeof(ev));
+   ev.events = EPOLLIN;
+   ev.data.fd = fdJoystick;
+   if ( 0 != epoll_ctl(s_iEpollFd, EPOLL_CTL_ADD, fdJoystick, &ev) )
+      log_softerror_and_alarm("Failed to add joystick to the input wait list, error: %d", errno);
+   else
+      s_iEpollJoystickFd = fdJoystick;
+}
+
+// Waits for input or for the next frame due time, at most 10 ms
+void _wait_for_input(long miliSecInterval)
+{
+   int iTimeoutMs = 10;
+   if ( NULL != g_pCurrentModel && g_pCurrentModel->rc_params.rc_enabled && (!g_bSearching) && (!g_bUpdateInProgress) )
+   {
+      u32 uTimeNow = get_current_timestamp_ms();
+      if ( uTimeNow >= g_TimeLastRCFrameSent + miliSecInterval )
+         iTimeoutMs = 0;
+      else if ( (int)(g_TimeLastRCFrameSent + miliSecInterval - uTimeNow) < iTimeoutMs )
+         iTimeoutMs = (int)(g_TimeLastRCFrameSent + miliSecInterval - uTimeNow);
+   }
+
+   if ( s_iEpollFd < 0 )
+   {
+      hardware_sleep_ms(iTimeoutMs);
+      return;
+   }
+
+   struct epoll_event events[4];
+   int iCount = epoll_wait(s_iEpollFd, events, 4, iTimeoutMs);
+   for( int i=0; i<iCount; i++ )
+   {
+      if ( events[i].data.fd == s_iRCInNotifyFd )
+         shared_mem_i2c_controller_rc_in_clear_notify(s_iRCInNotifyFd);
+   }
+}
+
 
 void try_read_pipes()
 {
@@ -299,6 +366,20 @@ int main (int argc, char *argv[])
    init_controller_settings();
    load_ControllerInterfacesSettings();
 
+   s_iEpollFd = epoll_create1(0);
+   if ( s_iEpollFd < 0 )
+      log_softerror_and_alarm("Failed to create input wait list, error: %d. Using fixed interval polling.", errno);
+   s_iRCInNotifyFd = shared_mem_i2c_controller_rc_in_open_notify_for_read();
+   if ( s_iEpollFd >= 0 && s_iRCInNotifyFd >= 0 )
+   {
+      struct epoll_event ev;
+      memset(&ev, 0, sizeof(ev));
+      ev.events = EPOLLIN;
+      ev.data.fd = s_iRCInNotifyFd;
+      if ( 0 != epoll_ctl(s_iEpollFd, EPOLL_CTL_ADD, s_iRCInNotifyFd, &ev) )
+         log_softerror_and_alarm("Failed to add RC in notify pipe to the input wait list, error: %d", errno);
+   }
+
    if ( ! g_bSearching )
       controllerInterfacesEnumJoysticks();
 
@@ -332,7 +413,8 @@ int main (int argc, char *argv[])
    while ( !g_bQuit )
    { 
       g_iFPSFramesCount++;
-      hardware_sleep_ms(10);
+      _update_epoll_inputs();
+      _wait_for_input(miliSecInterval);
 
       if ( NULL != s_pProcessStats )
       {
@@ -352,7 +434,13 @@ int main (int argc, char *argv[])
          g_iFPSTotalJoystickEvents = 0;
       }
 
-      try_read_pipes();
+      // Reading the pipes waits up to 1 ms, do it at most every 10 ms
+      if ( g_TimeNow >= g_TimeLastPipesCheck + 10 )
+      {
+         g_TimeLastPipesCheck = g_TimeNow;
+         try_read_pipes();
+         g_TimeNow = get_current_timestamp_ms();
+      }
 
       if ( g_bSearching || g_bUpdateInProgress )
       {
@@ -386,6 +474,7 @@ int main (int argc, char *argv[])
             {
                s_uLastTimeStampRCInFrame = s_pSM_RCIn->uTimeStamp;
                s_uLastFrameIndexRCIn = s_pSM_RCIn->uFrameIndex;
+               s_bNewInput = true;
                int nCh = g_pCurrentModel->rc_params.channelsCount;
                if ( nCh > (int)(s_pSM_RCIn->uChannelsCount) )
                   nCh = (int)(s_pSM_RCIn->uChannelsCount);
@@ -405,7 +494,12 @@ int main (int argc, char *argv[])
             g_PHRCFUpstream.flags &= (~RC_FULL_FRAME_FLAGS_HAS_INPUT);
       }
 
-      if ( g_TimeNow < g_TimeLastRCFrameSent + miliSecInterval )
+      // New input goes out right away, but no closer than half the RC interval to the previous frame
+      u32 uTimeNowMicros = get_current_timestamp_micros();
+      bool bSendNow = (g_TimeNow >= g_TimeLastRCFrameSent + miliSecInterval);
+      if ( s_bNewInput && (uTimeNowMicros - s_uTimeLastRCFrameSentMicros >= (u32)miliSecInterval*500) )
+         bSendNow = true;
+      if ( ! bSendNow )
       {
          _update_loop_info(tTime0);
          continue;
@@ -413,11 +507,15 @@ int main (int argc, char *argv[])
 
       u32 miliSec = g_TimeNow - g_TimeLastRCFrameSent;
       g_TimeLastRCFrameSent = g_TimeNow;
+      s_uTimeLastRCFrameSentMicros = uTimeNowMicros;
+      s_bNewInput = false;
 
       if ( g_pCurrentModel->rc_params.inputType == RC_INPUT_TYPE_USB )
       {
          for( int i=0; i<(int)(g_pCurrentModel->rc_params.channelsCount); i++ )
             s_ComputedRCValues[i] = (u16) compute_controller_rc_value(g_pCurrentModel, i, (float)(s_ComputedRCValues[i]), NULL, &s_JoystickLocalInfo, s_pCII, miliSec);
+         // Button presses are edges between frames
+         hardware_joystick_store_previous_values(s_pJoystick);
       }
 
       populate_rc_data(&g_PHRCFUpstream);
@@ -433,7 +531,7 @@ int main (int argc, char *argv[])
       gPH.vehicle_id_dest = g_pCurrentModel->vehicle_id;
       gPH.total_headers_length = sizeof(t_packet_header)+sizeof(t_packet_header_rc_full_frame_upstream);
       gPH.total_length = gPH.total_headers_length;
-      
+
       u8 buffer[MAX_PACKET_TOTAL_SIZE];
       memcpy(buffer, &gPH, sizeof(t_packet_header));
       memcpy(buffer+sizeof(t_packet_header), (u8*)&g_PHRCFUpstream, sizeof(t_packet_header_rc_full_frame_upstream));
@@ -448,6 +546,10 @@ int main (int argc, char *argv[])
 
    if ( NULL != s_pCII )
       hardware_close_joystick(s_pCII->currentHardwareIndex);
+   if ( s_iEpollFd >= 0 )
+      close(s_iEpollFd);
+   if ( s_iRCInNotifyFd >= 0 )
+      close(s_iRCInNotifyFd);
 
    ruby_close_ipc_channel(s_fIPCFromRouter);
    ruby_close_ipc_channel(s_fIPCToRouter);
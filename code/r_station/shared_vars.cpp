@@ -13,6 +13,7 @@ bool g_bSearching = false;
 u32  g_uSearchFrequency = 0;
 bool g_bUpdateInProgress = false;
 bool s_bReceivedInvalidRadioPackets = false;
+u32 g_uVehicleIdCanOpenSealedPackets = MAX_U32; // last vehicle that sent sealed packets
 
 u8 s_uLastPingSentId = 0xFF;
 u8 s_uLastPingRecvId = 0xFF;
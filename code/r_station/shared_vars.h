@@ -25,6 +25,7 @@ extern bool g_bSearching;
 extern u32  g_uSearchFrequency;
 extern bool g_bUpdateInProgress;
 extern bool s_bReceivedInvalidRadioPackets;
+extern u32 g_uVehicleIdCanOpenSealedPackets;
 
 extern u8 s_uLastPingSentId;
 extern u8 s_uLastPingRecvId;
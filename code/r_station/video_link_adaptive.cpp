@@ -13,6 +13,8 @@ Code written by: Petru Soroaga, 2021-2023
 #include "../base/config.h"
 #include "../base/models.h"
 #include "../radio/radiopacketsqueue.h"
+#include "../common/adaptive_video_controllers.h"
+#include "../common/adaptive_video_trace.h"
 
 #include "shared_vars.h"
 #include "timers.h"
@@ -25,6 +27,12 @@ extern t_packet_queue s_QueueRadioPackets;
 
 u32 s_uPauseAdjustmensUntilTime = 0;
 
+t_adaptive_video_levels s_AdaptiveVideoLevels;
+int s_iAdaptiveVideoController = -1;
+const t_adaptive_video_controller* s_pAdaptiveVideoController = NULL;
+int s_iAdaptiveVideoTraceController = -1;
+bool s_bAdaptiveVideoTraceDone = false; // stopped on max size or on a write error, until the setting is turned off and on
+
 void video_link_adaptive_init()
 {
    memset((u8*)&g_ControllerVehiclesAdaptiveVideoInfo, 0, sizeof(shared_mem_controller_vehicles_adaptive_video_info));
@@ -45,10 +53,16 @@ void video_link_adaptive_init()
       g_ControllerVehiclesAdaptiveVideoInfo.vehicles[i].iLastRequestedLevelShiftRetryCount = 0;
    }
    s_uPauseAdjustmensUntilTime = 0;
+   s_iAdaptiveVideoController = -1; // the controller state is reset on the next adjustment
    log_line("Initialized adaptive video info.");
    video_link_keyframe_init();
 }
 
+void video_link_adaptive_uninit()
+{
+   adaptive_video_trace_stop_recording();
+}
+
 void video_line_adaptive_switch_to_med_level()
 {
    video_link_adaptive_init();
@@ -123,210 +137,84 @@ void _video_link_adaptive_check_send_to_vehicle()
       g_ControllerVehiclesAdaptiveVideoInfo.vehicles[0].iLastRequestedLevelShiftRetryCount = 20;
 }
 
-void _video_link_adaptive_check_adjust_video_params()
+void _video_link_adaptive_update_levels()
 {
-   int adaptiveVideoIsOn = ((g_pCurrentModel->video_link_profiles[g_pCurrentModel->video_params.user_selected_video_link_profile].encoding_extra_flags) & ENCODING_EXTRA_FLAG_ENABLE_ADAPTIVE_VIDEO_LINK_PARAMS)?1:0;
-   if ( ! adaptiveVideoIsOn )
-      return;
-
-   _video_link_adaptive_check_send_to_vehicle();
-
-   //float fParamsChangeStrength = 0.9*(float)g_pCurrentModel->video_params.videoAdjustmentStrength / 10.0;
-   
-   if ( g_TimeNow < g_ControllerVehiclesAdaptiveVideoInfo.vehicles[0].uTimeLastLevelShiftDown + 50 )
-      return;
-   if ( g_TimeNow < g_ControllerVehiclesAdaptiveVideoInfo.vehicles[0].uTimeLastLevelShiftUp + 50 )
-      return;
+   memset((u8*)&s_AdaptiveVideoLevels, 0, sizeof(t_adaptive_video_levels));
+
+   int iProfile = g_pCurrentModel->video_params.user_selected_video_link_profile;
+   s_AdaptiveVideoLevels.iLevelsHQ = g_pCurrentModel->get_video_link_profile_max_level_shifts(iProfile);
+   s_AdaptiveVideoLevels.iLevelsMQ = g_pCurrentModel->get_video_link_profile_max_level_shifts(VIDEO_PROFILE_MQ);
+   s_AdaptiveVideoLevels.iLevelsLQ = g_pCurrentModel->get_video_link_profile_max_level_shifts(VIDEO_PROFILE_LQ);
+   s_AdaptiveVideoLevels.iVideoPacketLength = g_pCurrentModel->video_link_profiles[iProfile].packet_length;
+
+   // The vehicle never uses more video bitrate on MQ/LQ than on the user profile (0 is the user profile bitrate)
+   u32 uUserBitrate = g_pCurrentModel->video_link_profiles[iProfile].bitrate_fixed_bps;
+   u32 uMQBitrate = g_pCurrentModel->video_link_profiles[VIDEO_PROFILE_MQ].bitrate_fixed_bps;
+   u32 uLQBitrate = g_pCurrentModel->video_link_profiles[VIDEO_PROFILE_LQ].bitrate_fixed_bps;
+   if ( (0 == uMQBitrate) || (uMQBitrate > uUserBitrate) )
+      uMQBitrate = uUserBitrate;
+   if ( (0 == uLQBitrate) || (uLQBitrate > uMQBitrate) )
+      uLQBitrate = uMQBitrate;
+
+   adaptive_video_levels_add_profile(&s_AdaptiveVideoLevels, g_pCurrentModel->video_link_profiles[iProfile].block_packets, g_pCurrentModel->video_link_profiles[iProfile].block_fecs, s_AdaptiveVideoLevels.iLevelsHQ, uUserBitrate);
+   adaptive_video_levels_add_profile(&s_AdaptiveVideoLevels, g_pCurrentModel->video_link_profiles[VIDEO_PROFILE_MQ].block_packets, g_pCurrentModel->video_link_profiles[VIDEO_PROFILE_MQ].block_fecs, s_AdaptiveVideoLevels.iLevelsMQ, uMQBitrate);
+   if ( ! (g_pCurrentModel->video_link_profiles[iProfile].encoding_extra_flags & ENCODING_EXTRA_FLAG_USE_MEDIUM_ADAPTIVE_VIDEO) )
+      adaptive_video_levels_add_profile(&s_AdaptiveVideoLevels, g_pCurrentModel->video_link_profiles[VIDEO_PROFILE_LQ].block_packets, g_pCurrentModel->video_link_profiles[VIDEO_PROFILE_LQ].block_fecs, s_AdaptiveVideoLevels.iLevelsLQ, uLQBitrate);
+}
 
-   int iLevelsHQ = g_pCurrentModel->get_video_link_profile_max_level_shifts(g_pCurrentModel->video_params.user_selected_video_link_profile);
-   int iLevelsMQ = g_pCurrentModel->get_video_link_profile_max_level_shifts(VIDEO_PROFILE_MQ);
-   int iLevelsLQ = g_pCurrentModel->get_video_link_profile_max_level_shifts(VIDEO_PROFILE_LQ);
-   int iMaxLevels = 1 + iLevelsHQ;
-   iMaxLevels += 1 + iLevelsMQ;
-   if ( ! (g_pCurrentModel->video_link_profiles[g_pCurrentModel->video_params.user_selected_video_link_profile].encoding_extra_flags & ENCODING_EXTRA_FLAG_USE_MEDIUM_ADAPTIVE_VIDEO) )
-      iMaxLevels += 1 + iLevelsLQ;
-
-   float fParamsChangeStrength = (float)g_pCurrentModel->video_params.videoAdjustmentStrength / 10.0;
-   
-   // When on HQ video profile, switch faster to MQ video profile;
-   
-   if ( g_ControllerVehiclesAdaptiveVideoInfo.vehicles[0].iLastRequestedLevelShift < iLevelsHQ )
+void _video_link_adaptive_check_controller()
+{
+   int iController = ADAPTIVE_VIDEO_CONTROLLER_BASELINE;
+   int iRecordTrace = 0;
+   if ( NULL != g_pControllerSettings )
    {
-      fParamsChangeStrength += 0.2;
-      if ( fParamsChangeStrength > 1.0 )
-         fParamsChangeStrength = 1.0;
+      iController = g_pControllerSettings->iAdaptiveVideoController;
+      iRecordTrace = g_pControllerSettings->iAdaptiveVideoRecordTrace;
    }
 
-   // Max intervals is MAX_CONTROLLER_ADAPTIVE_VIDEO_INFO_INTERVALS * 20 ms = 4 seconds
-   // Minus one because the current index is still processing/invalid
-
-   int iIntervalsToCheckDown = (1.0-0.4*fParamsChangeStrength) * MAX_CONTROLLER_ADAPTIVE_VIDEO_INFO_INTERVALS;
-   int iIntervalsToCheckUp = (1.0-0.3*fParamsChangeStrength) * MAX_CONTROLLER_ADAPTIVE_VIDEO_INFO_INTERVALS;
-   if ( iIntervalsToCheckDown >= MAX_CONTROLLER_ADAPTIVE_VIDEO_INFO_INTERVALS-1 )
-      iIntervalsToCheckDown = MAX_CONTROLLER_ADAPTIVE_VIDEO_INFO_INTERVALS-2;
-   if ( iIntervalsToCheckUp >= MAX_CONTROLLER_ADAPTIVE_VIDEO_INFO_INTERVALS-1 )
-      iIntervalsToCheckUp = MAX_CONTROLLER_ADAPTIVE_VIDEO_INFO_INTERVALS-2;
-
-   int iIntervalsSinceLastShiftDown = (g_TimeNow - g_ControllerVehiclesAdaptiveVideoInfo.vehicles[0].uTimeLastLevelShiftDown) / g_ControllerVehiclesAdaptiveVideoInfo.vehicles[0].uUpdateInterval;
-   if ( iIntervalsToCheckDown > iIntervalsSinceLastShiftDown )
-      iIntervalsToCheckDown = iIntervalsSinceLastShiftDown;
-   if ( iIntervalsToCheckDown <= 0 )
-      iIntervalsToCheckDown = 1;
-
-   g_ControllerVehiclesAdaptiveVideoInfo.vehicles[0].uIntervalsAdaptive1 = ((u16)iIntervalsToCheckDown) | (((u16)iIntervalsToCheckUp)<<16);
-   
-   int iCountReconstructedDown = 0;
-   int iLongestReconstructionDown = 0;
-   int iCountRetransmissionsDown = 0;
-   int iCountReRetransmissionsDown = 0;
-   int iCountMissingSegmentsDown = 0;
-
-   int iCountReconstructedUp = 0;
-   int iLongestReconstructionUp = 0;
-   int iCountRetransmissionsUp = 0;
-   int iCountReRetransmissionsUp = 0;
-   int iCountMissingSegmentsUp = 0;
-
-   int iIndex = g_ControllerVehiclesAdaptiveVideoInfo.vehicles[0].uCurrentIntervalIndex - 1;
-   if ( iIndex < 0 )
-      iIndex = MAX_CONTROLLER_ADAPTIVE_VIDEO_INFO_INTERVALS-1;
-
-   int iCurrentReconstructionLength = 0;
-
-   for( int i=0; i<iIntervalsToCheckDown; i++ )
+   if ( iController != s_iAdaptiveVideoController )
    {
-      iIndex--;
-      if ( iIndex < 0 )
-         iIndex = MAX_CONTROLLER_ADAPTIVE_VIDEO_INFO_INTERVALS-1;
-      iCountReconstructedDown += (g_ControllerVehiclesAdaptiveVideoInfo.vehicles[0].uIntervalsOuputRecontructedVideoPackets[iIndex]!=0)?1:0;
-      iCountRetransmissionsDown += (g_ControllerVehiclesAdaptiveVideoInfo.vehicles[0].uIntervalsRequestedRetransmissions[iIndex]!=0)?1:0;
-      iCountReRetransmissionsDown += (g_ControllerVehiclesAdaptiveVideoInfo.vehicles[0].uIntervalsRetriedRetransmissions[iIndex]!=0)?1:0;
-      iCountMissingSegmentsDown += (g_ControllerVehiclesAdaptiveVideoInfo.vehicles[0].uIntervalsMissingVideoPackets[iIndex]!=0)?1:0;
-   
-      if ( g_ControllerVehiclesAdaptiveVideoInfo.vehicles[0].uIntervalsOuputRecontructedVideoPackets[iIndex] != 0 )
-         iCurrentReconstructionLength++;
-      else
-      {
-         if ( iCurrentReconstructionLength > iLongestReconstructionDown )
-            iLongestReconstructionDown = iCurrentReconstructionLength;
-         iCurrentReconstructionLength = 0;
-      }
+      s_iAdaptiveVideoController = iController;
+      s_pAdaptiveVideoController = adaptive_video_get_controller(iController);
+      s_pAdaptiveVideoController->pfReset();
+      log_line("Video adaptive: using the %s controller.", s_pAdaptiveVideoController->szName);
    }
 
-   iCountReconstructedUp = iCountReconstructedDown;
-   iCountRetransmissionsUp = iCountRetransmissionsDown;
-   iCountReRetransmissionsUp = iCountReRetransmissionsDown;
-   iCountMissingSegmentsUp = iCountMissingSegmentsDown;
-   iLongestReconstructionUp = iLongestReconstructionDown;
+   // A trace is for one controller only
+   if ( adaptive_video_trace_is_recording() && (iController != s_iAdaptiveVideoTraceController) )
+      adaptive_video_trace_stop_recording();
 
-   for( int i=iIntervalsToCheckDown; i<iIntervalsToCheckUp; i++ )
+   if ( iRecordTrace && (! adaptive_video_trace_is_recording()) && (! s_bAdaptiveVideoTraceDone) )
    {
-      iIndex--;
-      if ( iIndex < 0 )
-         iIndex = MAX_CONTROLLER_ADAPTIVE_VIDEO_INFO_INTERVALS-1;
-      iCountReconstructedUp += (g_ControllerVehiclesAdaptiveVideoInfo.vehicles[0].uIntervalsOuputRecontructedVideoPackets[iIndex]!=0)?1:0;
-      iCountRetransmissionsUp += (g_ControllerVehiclesAdaptiveVideoInfo.vehicles[0].uIntervalsRequestedRetransmissions[iIndex]!=0)?1:0;
-      iCountReRetransmissionsUp += (g_ControllerVehiclesAdaptiveVideoInfo.vehicles[0].uIntervalsRetriedRetransmissions[iIndex]!=0)?1:0;
-      iCountMissingSegmentsUp += (g_ControllerVehiclesAdaptiveVideoInfo.vehicles[0].uIntervalsMissingVideoPackets[iIndex]!=0)?1:0;
-   
-      if ( g_ControllerVehiclesAdaptiveVideoInfo.vehicles[0].uIntervalsOuputRecontructedVideoPackets[iIndex] != 0 )
-         iCurrentReconstructionLength++;
-      else
-      {
-         if ( iCurrentReconstructionLength > iLongestReconstructionUp )
-            iLongestReconstructionUp = iCurrentReconstructionLength;
-         iCurrentReconstructionLength = 0;
-      }
+      if ( ! adaptive_video_trace_start_recording(FILE_ADAPTIVE_VIDEO_TRACE, g_ControllerVehiclesAdaptiveVideoInfo.vehicles[0].uUpdateInterval, g_pCurrentModel->video_params.videoAdjustmentStrength, s_iAdaptiveVideoController, &s_AdaptiveVideoLevels) )
+         s_bAdaptiveVideoTraceDone = true;
+      s_iAdaptiveVideoTraceController = iController;
    }
+   if ( (! iRecordTrace) && adaptive_video_trace_is_recording() )
+      adaptive_video_trace_stop_recording();
+   if ( ! iRecordTrace )
+      s_bAdaptiveVideoTraceDone = false;
+}
 
-   // Check for shift down
+void _video_link_adaptive_check_adjust_video_params()
+{
+   int adaptiveVideoIsOn = ((g_pCurrentModel->video_link_profiles[g_pCurrentModel->video_params.user_selected_video_link_profile].encoding_extra_flags) & ENCODING_EXTRA_FLAG_ENABLE_ADAPTIVE_VIDEO_LINK_PARAMS)?1:0;
+   if ( ! adaptiveVideoIsOn )
+      return;
 
-   int iThresholdReconstructedDown = 2 + (1.0-fParamsChangeStrength)*iIntervalsToCheckDown;
-   int iThresholdRetransmissionsDown = 2 + (1.0-fParamsChangeStrength)*iIntervalsToCheckDown;
-   int iThresholdLongestRecontructionDown = 2 + (1.0-fParamsChangeStrength)*iIntervalsToCheckDown/2.0;
+   _video_link_adaptive_check_send_to_vehicle();
 
-   u32 uMinTimeSinceLastShift = iIntervalsToCheckDown * g_ControllerVehiclesAdaptiveVideoInfo.vehicles[0].uUpdateInterval;
-   if ( iThresholdReconstructedDown * g_ControllerVehiclesAdaptiveVideoInfo.vehicles[0].uUpdateInterval < uMinTimeSinceLastShift )
-      uMinTimeSinceLastShift = iThresholdReconstructedDown * g_ControllerVehiclesAdaptiveVideoInfo.vehicles[0].uUpdateInterval;
-   if ( iThresholdRetransmissionsDown * g_ControllerVehiclesAdaptiveVideoInfo.vehicles[0].uUpdateInterval < uMinTimeSinceLastShift )
-      uMinTimeSinceLastShift = iThresholdRetransmissionsDown * g_ControllerVehiclesAdaptiveVideoInfo.vehicles[0].uUpdateInterval;
+   _video_link_adaptive_update_levels();
+   _video_link_adaptive_check_controller();
 
-   if ( uMinTimeSinceLastShift < 70 )
-      uMinTimeSinceLastShift = 70;
-   if ( uMinTimeSinceLastShift > 500 )
-      uMinTimeSinceLastShift = 500;
-   if ( g_TimeNow > g_ControllerVehiclesAdaptiveVideoInfo.vehicles[0].uTimeLastLevelShiftDown + uMinTimeSinceLastShift )
+   if ( adaptive_video_trace_is_recording() )
    {
-      if ( (iCountReconstructedDown > iThresholdReconstructedDown) ||
-           (iLongestReconstructionDown > iThresholdLongestRecontructionDown) )
-      {
-         g_ControllerVehiclesAdaptiveVideoInfo.vehicles[0].uTimeLastLevelShiftDown = g_TimeNow;
-         g_ControllerVehiclesAdaptiveVideoInfo.vehicles[0].iLastRequestedLevelShift++;
-         
-         // Skip data:fec == 1:1 leves
-         if ( g_ControllerVehiclesAdaptiveVideoInfo.vehicles[0].iLastRequestedLevelShift == iLevelsHQ )
-            g_ControllerVehiclesAdaptiveVideoInfo.vehicles[0].iLastRequestedLevelShift++;
-         if ( g_ControllerVehiclesAdaptiveVideoInfo.vehicles[0].iLastRequestedLevelShift == iLevelsHQ + iLevelsMQ + 1 )
-            g_ControllerVehiclesAdaptiveVideoInfo.vehicles[0].iLastRequestedLevelShift++;
-         if ( g_ControllerVehiclesAdaptiveVideoInfo.vehicles[0].iLastRequestedLevelShift == iLevelsHQ + iLevelsMQ + iLevelsLQ + 2 )
-            g_ControllerVehiclesAdaptiveVideoInfo.vehicles[0].iLastRequestedLevelShift++;
-
-         if ( g_ControllerVehiclesAdaptiveVideoInfo.vehicles[0].iLastRequestedLevelShift >= iMaxLevels - 1 )
-            g_ControllerVehiclesAdaptiveVideoInfo.vehicles[0].iLastRequestedLevelShift = iMaxLevels - 1;
-      }
-
-      if ( (iCountRetransmissionsDown > iThresholdRetransmissionsDown) ||
-           (iCountReRetransmissionsDown > 0) )
-      {
-         g_ControllerVehiclesAdaptiveVideoInfo.vehicles[0].uTimeLastLevelShiftDown = g_TimeNow;
-         if ( g_ControllerVehiclesAdaptiveVideoInfo.vehicles[0].iLastRequestedLevelShift <= iLevelsHQ+1 )
-            g_ControllerVehiclesAdaptiveVideoInfo.vehicles[0].iLastRequestedLevelShift = iLevelsHQ+2;
-         else if ( g_ControllerVehiclesAdaptiveVideoInfo.vehicles[0].iLastRequestedLevelShift <= iLevelsHQ+1 + iLevelsMQ+1)
-            g_ControllerVehiclesAdaptiveVideoInfo.vehicles[0].iLastRequestedLevelShift = iLevelsHQ+iLevelsMQ+3;
-         else 
-            g_ControllerVehiclesAdaptiveVideoInfo.vehicles[0].iLastRequestedLevelShift = iMaxLevels - 1;
-
-         if ( g_ControllerVehiclesAdaptiveVideoInfo.vehicles[0].iLastRequestedLevelShift >= iMaxLevels - 1 )
-            g_ControllerVehiclesAdaptiveVideoInfo.vehicles[0].iLastRequestedLevelShift = iMaxLevels - 1;
-      }
+      adaptive_video_trace_add_interval(&g_ControllerVehiclesAdaptiveVideoInfo.vehicles[0], g_TimeNow);
+      if ( ! adaptive_video_trace_is_recording() )
+         s_bAdaptiveVideoTraceDone = true;
    }
 
-   // Check for shift up ?
-   // Only if we did not shifted down or up recently
-
-   int iThresholdReconstructedUp = 2 + (1.0-fParamsChangeStrength)*14.0;
-   int iThresholdLongestRecontructionUp = 2 + (1.0-fParamsChangeStrength)*6.0;
-   u32 uTimeForShiftUp = 1000 - (500.0*fParamsChangeStrength);
-   if ( uTimeForShiftUp < 100 )
-      uTimeForShiftUp = 100;
-   if ( uTimeForShiftUp > 1000 )
-      uTimeForShiftUp = 1000;
-   g_ControllerVehiclesAdaptiveVideoInfo.vehicles[0].uIntervalsAdaptive2 = ((u32)iThresholdReconstructedUp) | (((u32)iThresholdLongestRecontructionUp)<<8);
-   g_ControllerVehiclesAdaptiveVideoInfo.vehicles[0].uIntervalsAdaptive2 |= (((u32)iThresholdReconstructedDown)<<16) | (((u32)iThresholdLongestRecontructionDown)<<24);
-   
-   if ( g_TimeNow > g_ControllerVehiclesAdaptiveVideoInfo.vehicles[0].uTimeLastLevelShiftDown + uTimeForShiftUp )
-   if ( g_TimeNow > g_ControllerVehiclesAdaptiveVideoInfo.vehicles[0].uTimeLastLevelShiftUp + uTimeForShiftUp )
-   {
-      if ( iCountReconstructedUp < iThresholdReconstructedUp )
-      if ( iLongestReconstructionUp < iThresholdLongestRecontructionUp )
-      if ( iCountRetransmissionsUp < 5 )
-      {
-         g_ControllerVehiclesAdaptiveVideoInfo.vehicles[0].uTimeLastLevelShiftUp = g_TimeNow;
-         if ( g_ControllerVehiclesAdaptiveVideoInfo.vehicles[0].iLastRequestedLevelShift > 0 )
-         {
-            g_ControllerVehiclesAdaptiveVideoInfo.vehicles[0].iLastRequestedLevelShift--;
-            // Skip data:fec == 1:1 leves
-            if ( g_ControllerVehiclesAdaptiveVideoInfo.vehicles[0].iLastRequestedLevelShift == iLevelsHQ )
-               g_ControllerVehiclesAdaptiveVideoInfo.vehicles[0].iLastRequestedLevelShift--;
-            if ( g_ControllerVehiclesAdaptiveVideoInfo.vehicles[0].iLastRequestedLevelShift == iLevelsHQ + iLevelsMQ + 1 )
-               g_ControllerVehiclesAdaptiveVideoInfo.vehicles[0].iLastRequestedLevelShift--;
-            if ( g_ControllerVehiclesAdaptiveVideoInfo.vehicles[0].iLastRequestedLevelShift == iLevelsHQ + iLevelsMQ + iLevelsLQ + 2 )
-               g_ControllerVehiclesAdaptiveVideoInfo.vehicles[0].iLastRequestedLevelShift--;
-         }
-         if ( g_ControllerVehiclesAdaptiveVideoInfo.vehicles[0].iLastRequestedLevelShift < 0 )
-            g_ControllerVehiclesAdaptiveVideoInfo.vehicles[0].iLastRequestedLevelShift = 0;
-      }
-   }   
+   s_pAdaptiveVideoController->pfAdjust(&g_ControllerVehiclesAdaptiveVideoInfo.vehicles[0], &s_AdaptiveVideoLevels, g_pCurrentModel->video_params.videoAdjustmentStrength, g_TimeNow);
 }
 
 void video_link_adaptive_periodic_loop()
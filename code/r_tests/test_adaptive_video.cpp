@@ -0,0 +1,186 @@
+#include "../base/base.h"
+#include "../base/config.h"
+#include "../common/adaptive_video_controllers.h"
+#include "../common/adaptive_video_trace.h"
+
+#include <unistd.h>
+#include <math.h>
+
+// Replays synthetic link traces against the adaptive video controllers and compares them:
+// on a steady marginal link the estimator controller must stall less and get more video through than the
+// baseline one, without flapping between levels; on fades and outages it must not stall more or longer.
+// Also checks the block failure model and that a saved trace loads back the same.
+// Usage: test_adaptive_video [-duration seconds] [-seed N]
+
+int s_iDurationSec = 300;
+u32 s_uSeed = 1234;
+int s_iFailed = 0;
+
+void _log_score(const char* szName, const t_adaptive_video_replay_score* pScore)
+{
+   log_line("  %-10s stalls: %u intervals, %u events, longest %u ms; blocks failed: %u/%u; switches: %u down, %u up; avg level: %.2f; goodput: %.0f kbps",
+      szName, pScore->uStallIntervals, pScore->uStallEvents, pScore->uLongestStallMs, pScore->uFailedBlocks, pScore->uBlocks,
+      pScore->uSwitchesDown, pScore->uSwitchesUp, pScore->fAverageLevel, pScore->fGoodputKbps);
+}
+
+void _run_scenario(const char* szName, const t_adaptive_video_channel* pChannel, t_adaptive_video_replay_score* pBaseline, t_adaptive_video_replay_score* pEstimator)
+{
+   t_adaptive_video_levels levels;
+   adaptive_video_trace_get_default_levels(&levels);
+   t_adaptive_video_trace trace;
+   if ( ! adaptive_video_trace_generate(&trace, &levels, pChannel, s_iDurationSec*1000, s_uSeed) )
+   {
+      log_line("Failed to generate the %s trace <- FAILED", szName);
+      s_iFailed = 1;
+      return;
+   }
+   adaptive_video_trace_replay(&trace, ADAPTIVE_VIDEO_CONTROLLER_BASELINE, -1, s_uSeed, pBaseline);
+   adaptive_video_trace_replay(&trace, ADAPTIVE_VIDEO_CONTROLLER_ESTIMATOR, -1, s_uSeed, pEstimator);
+   adaptive_video_trace_free(&trace);
+
+   log_line("Scenario %s (%d seconds):", szName, s_iDurationSec);
+   _log_score("baseline", pBaseline);
+   _log_score("estimator", pEstimator);
+}
+
+void _check_failure_model()
+{
+   t_adaptive_video_levels levels;
+   adaptive_video_trace_get_default_levels(&levels);
+   log_line("Levels: %d (HQ %d, MQ %d, LQ %d)", levels.iCountLevels, levels.iLevelsHQ, levels.iLevelsMQ, levels.iLevelsLQ);
+
+   // No loss: never fails; more EC: fails less; bursts make it worse
+   float fNoLoss = adaptive_video_get_block_failure_probability(&levels, 0, 0.0, 1.0);
+   float fLevel0 = adaptive_video_get_block_failure_probability(&levels, 0, 0.1, 1.0);
+   float fLevel3 = adaptive_video_get_block_failure_probability(&levels, 3, 0.1, 1.0);
+   float fBursts = adaptive_video_get_block_failure_probability(&levels, 0, 0.1, 4.0);
+   log_line("Block failure at 10%% loss: level 0: %.5f, level 3: %.5f, level 0 with bursts of 4: %.5f", fLevel0, fLevel3, fBursts);
+   if ( fNoLoss != 0.0 || ! (fLevel3 < fLevel0) || ! (fBursts > fLevel0) )
+   {
+      log_line("Block failure model is wrong <- FAILED");
+      s_iFailed = 1;
+   }
+
+   // 12 data + 6 EC, 10% independent losses: P(more than 6 of 18 lost) is 0.00117
+   if ( fabs(fLevel0 - 0.00117) > 0.0001 )
+   {
+      log_line("Block failure probability %.5f, expected 0.00117 <- FAILED", fLevel0);
+      s_iFailed = 1;
+   }
+}
+
+void _check_save_load()
+{
+   t_adaptive_video_levels levels;
+   adaptive_video_trace_get_default_levels(&levels);
+   t_adaptive_video_channel channel;
+   memset(&channel, 0, sizeof(t_adaptive_video_channel));
+   channel.fLossGood = 0.05;
+   channel.iOutagePeriodMs = 5000;
+   channel.iOutageDurationMs = 200;
+
+   t_adaptive_video_trace trace;
+   t_adaptive_video_trace traceLoaded;
+   adaptive_video_trace_generate(&trace, &levels, &channel, 20000, s_uSeed);
+   const char* szFile = "/tmp/test_adaptive_video_trace.bin";
+   if ( (! adaptive_video_trace_save(szFile, &trace)) || (! adaptive_video_trace_load(szFile, &traceLoaded)) )
+   {
+      log_line("Failed to save and load a trace <- FAILED");
+      s_iFailed = 1;
+   }
+   else
+   {
+      if ( traceLoaded.iCountRecords != trace.iCountRecords ||
+           0 != memcmp(&traceLoaded.header, &trace.header, sizeof(t_adaptive_video_trace_header)) ||
+           0 != memcmp(traceLoaded.pRecords, trace.pRecords, trace.iCountRecords*sizeof(t_adaptive_video_trace_record)) )
+      {
+         log_line("Loaded trace differs from the saved one <- FAILED");
+         s_iFailed = 1;
+      }
+      log_line("Saved and loaded a trace of %d intervals", traceLoaded.iCountRecords);
+      adaptive_video_trace_free(&traceLoaded);
+   }
+   adaptive_video_trace_free(&trace);
+   unlink(szFile);
+}
+
+int main(int argc, char *argv[])
+{
+   log_init("TestAdaptiveVideo");
+   log_enable_stdout();
+
+   for( int i=1; i<argc; i++ )
+   {
+      if ( 0 == strcmp(argv[i], "-duration") && i < argc-1 )
+         s_iDurationSec = atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-seed") && i < argc-1 )
+         s_uSeed = (u32)atoi(argv[++i]);
+   }
+   if ( s_iDurationSec < 10 )
+      s_iDurationSec = 10;
+
+   _check_failure_model();
+   _check_save_load();
+
+   t_adaptive_video_replay_score scoreBaseline;
+   t_adaptive_video_replay_score scoreEstimator;
+   t_adaptive_video_channel channel;
+
+   // Steady marginal link: random losses around what the top levels can handle. The estimator must get more
+   // video through, with no more failed blocks than the baseline (or than twice its target), and not flap
+   // between levels (at most one switch each 5 seconds)
+   memset(&channel, 0, sizeof(t_adaptive_video_channel));
+   channel.fLossGood = 0.06;
+   channel.fLossBad = 0.1;
+   channel.fGoodToBad = 0.02;
+   channel.fBadToGood = 0.05;
+   _run_scenario("marginal", &channel, &scoreBaseline, &scoreEstimator);
+   float fFailedBaseline = (float)scoreBaseline.uFailedBlocks / (float)(scoreBaseline.uBlocks + 1);
+   float fFailedEstimator = (float)scoreEstimator.uFailedBlocks / (float)(scoreEstimator.uBlocks + 1);
+   if ( (fFailedEstimator > fFailedBaseline && fFailedEstimator > 2.0*ADAPTIVE_VIDEO_ESTIMATOR_TARGET_BLOCK_FAILURE) || scoreEstimator.fGoodputKbps <= scoreBaseline.fGoodputKbps )
+   {
+      log_line("Estimator is not better than the baseline on a marginal link <- FAILED");
+      s_iFailed = 1;
+   }
+   if ( (scoreEstimator.uSwitchesDown + scoreEstimator.uSwitchesUp) * 5 > (u32)s_iDurationSec )
+   {
+      log_line("Estimator switches levels too often on a marginal link <- FAILED");
+      s_iFailed = 1;
+   }
+
+   // Clean link with deep fades each 10 seconds and a short outage each 30 seconds
+   memset(&channel, 0, sizeof(t_adaptive_video_channel));
+   channel.fLossGood = 0.01;
+   channel.fLossBad = 0.05;
+   channel.fGoodToBad = 0.01;
+   channel.fBadToGood = 0.1;
+   channel.iFadePeriodMs = 10000;
+   channel.iFadeDurationMs = 1500;
+   channel.fFadeLoss = 0.3;
+   channel.iOutagePeriodMs = 30000;
+   channel.iOutageDurationMs = 300;
+   _run_scenario("fades", &channel, &scoreBaseline, &scoreEstimator);
+   if ( scoreEstimator.uStallIntervals > scoreBaseline.uStallIntervals || scoreEstimator.uLongestStallMs > scoreBaseline.uLongestStallMs )
+   {
+      log_line("Estimator stalls more or longer than the baseline on fades <- FAILED");
+      s_iFailed = 1;
+   }
+
+   // Clean link: both stay on the top levels
+   memset(&channel, 0, sizeof(t_adaptive_video_channel));
+   channel.fLossGood = 0.005;
+   _run_scenario("clean", &channel, &scoreBaseline, &scoreEstimator);
+   if ( scoreEstimator.fAverageLevel > 0.5 || scoreEstimator.uStallIntervals > 0 || scoreEstimator.uSwitchesDown > 2 )
+   {
+      log_line("Estimator does not stay on the top levels on a clean link <- FAILED");
+      s_iFailed = 1;
+   }
+
+   if ( s_iFailed )
+   {
+      log_line("Test FAILED");
+      return 1;
+   }
+   log_line("Test PASSED");
+   return 0;
+}
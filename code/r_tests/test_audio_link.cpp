@@ -0,0 +1,258 @@
+#include "../base/base.h"
+#include "../radio/radiopackets2.h"
+#include "../radio/radio_sim.h"
+#include "../radio/fec.h"
+#include "../common/audio_link.h"
+
+#include <math.h>
+
+// Offline audio link test: feeds a WAV file, at its real byte rate, through the vehicle audio TX ring
+// (blocks + FEC) and the station audio RX (FEC recovery, jitter buffer, concealment) over a lossy
+// simulated radio link, in simulation time. Reports the capture to playout latency and the underruns,
+// and checks that every frame played is the one captured.
+//
+// Usage: test_audio_link [options]
+//   -wav file            input WAV file (default sample.wav, a generated tone if missing)
+//   -block d,f           data and FEC packets per block (default 4,2)
+//   -loss spec           loss: none | uniform:rate | ge:p_gb,p_bg,loss_good,loss_bad (default uniform:0.05)
+//   -latency ms, -jitter ms, -reorder rate
+//   -seed n              random seed
+//   -out file            write the played stream (WAV) to a file
+
+#define SIM_STEP_MICROS 1000
+#define SIM_TAIL_MICROS 2000000
+
+char s_szWavFile[256] = "sample.wav";
+char s_szOutFile[256] = "";
+int s_iBlockData = 4;
+int s_iBlockFec = 2;
+u32 s_uSeed = 1234;
+
+t_radio_sim_link* s_pLink = NULL;
+u32 s_uTimeNow = 0;
+
+t_audio_tx_buffer s_TxBuffer;
+t_audio_rx_buffer s_RxBuffer;
+
+u8* s_pStream = NULL;
+int s_iStreamLength = 0;
+u32 s_uBytesPerSecond = AUDIO_DEFAULT_BYTES_PER_SECOND;
+
+void _send_segment(u32 uSegmentIndex, u8* pData, int iLength, void* pContext)
+{
+   u8 packet[MAX_PACKET_TOTAL_SIZE];
+   memcpy(packet, (u8*)&uSegmentIndex, sizeof(u32));
+   memcpy(packet + sizeof(u32), pData, iLength);
+   radio_sim_link_write(s_pLink, packet, iLength + sizeof(u32), s_uTimeNow);
+}
+
+bool _load_wav(const char* szFile)
+{
+   FILE* fd = fopen(szFile, "rb");
+   if ( NULL == fd )
+      return false;
+   fseek(fd, 0, SEEK_END);
+   s_iStreamLength = (int)ftell(fd);
+   fseek(fd, 0, SEEK_SET);
+   s_pStream = (u8*)malloc(s_iStreamLength);
+   if ( NULL == s_pStream || s_iStreamLength != (int)fread(s_pStream, 1, s_iStreamLength, fd) )
+   {
+      fclose(fd);
+      return false;
+   }
+   fclose(fd);
+   if ( s_iStreamLength < 44 || 0 != memcmp(s_pStream, "RIFF", 4) )
+      return false;
+   memcpy((u8*)&s_uBytesPerSecond, s_pStream+28, sizeof(u32));
+   return true;
+}
+
+// Ten seconds of 44100 Hz mono 16 bits tone, same format as the vehicle capture
+void _generate_wav()
+{
+   int iSamples = 441000;
+   s_uBytesPerSecond = 88200;
+   s_iStreamLength = 44 + iSamples*2;
+   s_pStream = (u8*)malloc(s_iStreamLength);
+   u32 uValue;
+   u16 uValue16;
+   memcpy(s_pStream, "RIFF", 4);
+   uValue = s_iStreamLength - 8; memcpy(s_pStream+4, &uValue, 4);
+   memcpy(s_pStream+8, "WAVEfmt ", 8);
+   uValue = 16; memcpy(s_pStream+16, &uValue, 4);
+   uValue16 = 1; memcpy(s_pStream+20, &uValue16, 2);
+   uValue16 = 1; memcpy(s_pStream+22, &uValue16, 2);
+   uValue = 44100; memcpy(s_pStream+24, &uValue, 4);
+   uValue = s_uBytesPerSecond; memcpy(s_pStream+28, &uValue, 4);
+   uValue16 = 2; memcpy(s_pStream+32, &uValue16, 2);
+   uValue16 = 16; memcpy(s_pStream+34, &uValue16, 2);
+   memcpy(s_pStream+36, "data", 4);
+   uValue = iSamples*2; memcpy(s_pStream+40, &uValue, 4);
+   for( int i=0; i<iSamples; i++ )
+   {
+      short sample = (short)(8000.0 * sin(2.0 * 3.14159265 * 440.0 * i / 44100.0));
+      memcpy(s_pStream + 44 + i*2, &sample, 2);
+   }
+}
+
+int main(int argc, char *argv[])
+{
+   log_init("TestAudioLink");
+   log_enable_stdout();
+
+   t_radio_sim_link_params params;
+   radio_sim_link_params_reset(&params);
+   params.iLossModel = RADIO_SIM_LOSS_UNIFORM;
+   params.fLossRate = 0.05;
+   params.uLatencyMicros = 2000;
+   params.uJitterMicros = 20000;
+
+   for( int i=1; i<argc; i++ )
+   {
+      if ( 0 == strcmp(argv[i], "-wav") && i < argc-1 )
+         strncpy(s_szWavFile, argv[++i], sizeof(s_szWavFile)-1);
+      else if ( 0 == strcmp(argv[i], "-out") && i < argc-1 )
+         strncpy(s_szOutFile, argv[++i], sizeof(s_szOutFile)-1);
+      else if ( 0 == strcmp(argv[i], "-block") && i < argc-1 )
+         sscanf(argv[++i], "%d,%d", &s_iBlockData, &s_iBlockFec);
+      else if ( 0 == strcmp(argv[i], "-loss") && i < argc-1 )
+      {
+         if ( ! radio_sim_parse_loss_model(argv[++i], &params) )
+         {
+            log_line("Invalid loss spec: %s", argv[i]);
+            return 1;
+         }
+      }
+      else if ( 0 == strcmp(argv[i], "-latency") && i < argc-1 )
+         params.uLatencyMicros = 1000 * atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-jitter") && i < argc-1 )
+         params.uJitterMicros = 1000 * atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-reorder") && i < argc-1 )
+         params.fReorderRate = atof(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-seed") && i < argc-1 )
+         s_uSeed = (u32)atoi(argv[++i]);
+   }
+
+   if ( ! _load_wav(s_szWavFile) )
+   {
+      log_line("Can't read WAV file %s, using a generated tone.", s_szWavFile);
+      if ( NULL != s_pStream )
+         free(s_pStream);
+      _generate_wav();
+   }
+
+   fec_init();
+   s_pLink = radio_sim_link_create(&params, s_uSeed);
+   audio_tx_buffer_init(&s_TxBuffer);
+   audio_rx_buffer_init(&s_RxBuffer, s_iBlockData, s_iBlockFec);
+
+   FILE* fOut = NULL;
+   if ( 0 != s_szOutFile[0] )
+      fOut = fopen(s_szOutFile, "wb");
+
+   int iSegments = s_iStreamLength / AUDIO_SEGMENT_SIZE;
+   u32* pCaptureTimes = (u32*)malloc(sizeof(u32) * (iSegments+1));
+   int iCaptured = 0;
+   int iFed = 0;
+
+   u8 packet[MAX_PACKET_TOTAL_SIZE];
+   u8 frame[AUDIO_SEGMENT_SIZE];
+   u32 uFramesMismatch = 0;
+   u32 uLastPlayed = 0;
+   double dLatencySumMs = 0.0;
+   u32 uLatencyCount = 0;
+   u32 uLatencyMaxMicros = 0;
+   u32 uLatencyMinMicros = MAX_U32;
+   u32 uStreamMicros = (u32)((double)s_iStreamLength * 1000000.0 / s_uBytesPerSecond);
+
+   for( s_uTimeNow = 0; s_uTimeNow < uStreamMicros + SIM_TAIL_MICROS; s_uTimeNow += SIM_STEP_MICROS )
+   {
+      // Vehicle: capture at the stream rate, then send all the complete blocks
+      int iFeedTo = (int)((double)s_uTimeNow * s_uBytesPerSecond / 1000000.0);
+      if ( iFeedTo > s_iStreamLength )
+         iFeedTo = s_iStreamLength;
+      if ( iFeedTo > iFed )
+      {
+         audio_tx_buffer_add_data(&s_TxBuffer, s_pStream + iFed, iFeedTo - iFed);
+         iFed = iFeedTo;
+      }
+      while ( iCaptured < iSegments && iFed >= (iCaptured+1) * AUDIO_SEGMENT_SIZE )
+         pCaptureTimes[iCaptured++] = s_uTimeNow;
+      while ( audio_tx_buffer_send_block(&s_TxBuffer, s_iBlockData, s_iBlockFec, _send_segment, NULL) > 0 );
+
+      // Station: receive, then play out what is due
+      int iLength = 0;
+      while ( (iLength = radio_sim_link_read(s_pLink, packet, sizeof(packet), s_uTimeNow)) > 0 )
+      {
+         u32 uSegmentIndex = 0;
+         memcpy((u8*)&uSegmentIndex, packet, sizeof(u32));
+         audio_rx_buffer_add_segment(&s_RxBuffer, uSegmentIndex, packet + sizeof(u32), iLength - sizeof(u32), s_uTimeNow);
+      }
+
+      while ( (iLength = audio_rx_buffer_get_frame(&s_RxBuffer, s_uTimeNow, frame)) > 0 )
+      {
+         if ( NULL != fOut )
+            fwrite(frame, 1, iLength, fOut);
+         if ( s_RxBuffer.stats.uFramesPlayed == uLastPlayed )
+            continue;
+         uLastPlayed = s_RxBuffer.stats.uFramesPlayed;
+
+         u32 uSequence = s_RxBuffer.uNextPlaySequence - 1;
+         if ( (int)uSequence >= iCaptured || 0 != memcmp(frame, s_pStream + uSequence * AUDIO_SEGMENT_SIZE, iLength) )
+         {
+            uFramesMismatch++;
+            continue;
+         }
+         u32 uLatency = s_uTimeNow - pCaptureTimes[uSequence];
+         dLatencySumMs += uLatency/1000.0;
+         uLatencyCount++;
+         if ( uLatency > uLatencyMaxMicros )
+            uLatencyMaxMicros = uLatency;
+         if ( uLatency < uLatencyMinMicros )
+            uLatencyMinMicros = uLatency;
+      }
+
+      // Everything sent was played out (the empty buffer at the end of the stream is not an underrun).
+      // The last partial block is never sent.
+      if ( iFed == s_iStreamLength && s_RxBuffer.uNextPlaySequence >= s_TxBuffer.uReadCounter )
+         break;
+   }
+
+   if ( NULL != fOut )
+      fclose(fOut);
+
+   t_audio_rx_stats* pStats = &s_RxBuffer.stats;
+   t_radio_sim_link_stats* pLinkStats = &s_pLink->stats;
+   log_line("Stream: %d bytes at %u bytes/sec (%.1f s), %d segments of %d bytes (%.1f ms), block %d/%d",
+      s_iStreamLength, s_uBytesPerSecond, uStreamMicros/1000000.0, iSegments, AUDIO_SEGMENT_SIZE,
+      audio_rx_buffer_get_frame_micros(&s_RxBuffer)/1000.0, s_RxBuffer.iDataPackets, s_RxBuffer.iFECPackets);
+   log_line("Link: %u packets sent, %u lost, %u reordered", pLinkStats->uPacketsIn, pLinkStats->uPacketsLost, pLinkStats->uPacketsReordered);
+   log_line("Frames: %u in, %u recovered by FEC, %u late, %u played, %u skipped, %u inserted",
+      pStats->uFramesIn, pStats->uFramesRecovered, pStats->uFramesLate, pStats->uFramesPlayed, pStats->uFramesSkipped, pStats->uFramesInserted);
+   log_line("Concealed: %u lost frames, %u empty buffer frames; underruns: %u",
+      pStats->uFramesConcealedLost, pStats->uFramesConcealedEmpty, pStats->uUnderruns);
+   log_line("Jitter: %.1f ms, peak delay: %.1f ms, buffer depth: %.1f ms",
+      pStats->uJitterMicros/1000.0, pStats->uPeakDelayMicros/1000.0, pStats->uTargetDepthMicros/1000.0);
+   if ( uLatencyCount > 0 )
+      log_line("Capture to playout latency: avg %.1f ms, min %.1f ms, max %.1f ms",
+         dLatencySumMs/uLatencyCount, uLatencyMinMicros/1000.0, uLatencyMaxMicros/1000.0);
+
+   int iResult = 0;
+   if ( uFramesMismatch > 0 )
+   {
+      log_line("FAILED: %u played frames do not match the captured ones.", uFramesMismatch);
+      iResult = 1;
+   }
+   // Frames the jitter buffer dropped to shrink the delay are not lost by the link
+   if ( pStats->uFramesPlayed + pStats->uFramesSkipped < (u32)(iSegments * 8 / 10) )
+   {
+      log_line("FAILED: only %u of %d frames were played.", pStats->uFramesPlayed, iSegments);
+      iResult = 1;
+   }
+
+   radio_sim_link_destroy(s_pLink);
+   free(pCaptureTimes);
+   free(s_pStream);
+   log_line(iResult?"FAILED":"PASSED");
+   return iResult;
+}
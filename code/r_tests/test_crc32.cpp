@@ -0,0 +1,232 @@
+#include "../base/base.h"
+#include "../base/crc32.h"
+
+#include <time.h>
+
+// Checks that all the CRC32 implementations the CPU supports give the same results as the original
+// byte at a time code (copied below), for all lengths and alignments, incremental updates over chained
+// sub-packets and the CRC field at an offset. Then benchmarks them on radio and IPC packet sizes.
+// Usage: test_crc32 [-loops N]
+
+int s_iFailed = 0;
+int s_iLoops = 20000;
+
+u32 s_uReferenceTable[256];
+
+void _init_reference()
+{
+   for( u32 i=0; i<256; i++ )
+   {
+      u32 c = i;
+      for( int k=0; k<8; k++ )
+         c = (c & 1)?(0xEDB88320 ^ (c >> 1)):(c >> 1);
+      s_uReferenceTable[i] = c;
+   }
+}
+
+// The original base_compute_crc32
+u32 _reference_crc32(u8 *buf, int length)
+{
+   u8* p = buf;
+   u32 crc;
+   crc = ~0U;
+
+   while (length--)
+   {
+      crc = s_uReferenceTable[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+   }
+   return crc ^ ~0U;
+}
+
+void _fill_random(u8* pBuffer, int iLength)
+{
+   for( int i=0; i<iLength; i++ )
+      pBuffer[i] = rand() & 0xFF;
+}
+
+void _check_implementation(int iImpl, u8* pBuffer, int iBufferSize)
+{
+   crc32_set_implementation(iImpl);
+   const char* szName = crc32_get_implementation_name(iImpl);
+   int iErrors = 0;
+
+   u8 uCheck[] = "123456789";
+   if ( 0xCBF43926 != crc32_compute(uCheck, 9) )
+   {
+      log_line("%s: CRC of \"123456789\" is %08X, expected CBF43926 <- FAILED", szName, crc32_compute(uCheck, 9));
+      iErrors++;
+   }
+
+   // All lengths up to a few radio packets, at all alignments
+   for( int iLen=0; iLen<=600 && 0 == iErrors; iLen++ )
+   for( int iOffset=0; iOffset<16; iOffset++ )
+   {
+      u32 uRef = _reference_crc32(pBuffer+iOffset, iLen);
+      u32 uCRC = crc32_compute(pBuffer+iOffset, iLen);
+      if ( uRef != uCRC )
+      {
+         log_line("%s: length %d, offset %d: %08X, expected %08X <- FAILED", szName, iLen, iOffset, uCRC, uRef);
+         iErrors++;
+         break;
+      }
+   }
+
+   // Random large lengths
+   for( int i=0; i<200 && 0 == iErrors; i++ )
+   {
+      int iOffset = rand() % 64;
+      int iLen = rand() % (iBufferSize - 64);
+      if ( _reference_crc32(pBuffer+iOffset, iLen) != crc32_compute(pBuffer+iOffset, iLen) )
+      {
+         log_line("%s: length %d, offset %d: wrong CRC <- FAILED", szName, iLen, iOffset);
+         iErrors++;
+      }
+   }
+
+   // Incremental, over random splits in sub-packets
+   for( int i=0; i<2000 && 0 == iErrors; i++ )
+   {
+      int iLen = rand() % 3000;
+      u32 uRef = _reference_crc32(pBuffer, iLen);
+      u32 uState = crc32_begin();
+      int iPos = 0;
+      while ( iPos < iLen )
+      {
+         int iChunk = 1 + rand() % 300;
+         if ( iPos + iChunk > iLen )
+            iChunk = iLen - iPos;
+         uState = crc32_update(uState, pBuffer+iPos, iChunk);
+         iPos += iChunk;
+      }
+      if ( crc32_end(uState) != uRef )
+      {
+         log_line("%s: incremental CRC of %d bytes is wrong <- FAILED", szName, iLen);
+         iErrors++;
+      }
+   }
+
+   // CRC field at an offset: at 0 it is the radio packets CRC (packet_compute_crc)
+   u8 uPacket[1500];
+   for( int i=0; i<200 && 0 == iErrors; i++ )
+   {
+      int iLen = 8 + rand() % 1400;
+      int iCRCOffset = (i < 100)?0:(rand() % (iLen-4));
+      _fill_random(uPacket, iLen);
+      crc32_store_at(uPacket, iLen, iCRCOffset);
+
+      u8 uTmp[1500];
+      memcpy(uTmp, uPacket, iLen);
+      memmove(uTmp+iCRCOffset, uTmp+iCRCOffset+4, iLen-iCRCOffset-4);
+      u32 uRef = _reference_crc32(uTmp, iLen-4);
+      u32 uStored;
+      memcpy(&uStored, uPacket+iCRCOffset, sizeof(u32));
+      if ( uStored != uRef || (! crc32_check_at(uPacket, iLen, iCRCOffset)) )
+      {
+         log_line("%s: CRC at offset %d in %d bytes is wrong <- FAILED", szName, iCRCOffset, iLen);
+         iErrors++;
+      }
+      uPacket[rand() % iLen] ^= 1 << (rand() % 8);
+      if ( crc32_check_at(uPacket, iLen, iCRCOffset) )
+      {
+         log_line("%s: corrupted packet passed the CRC check <- FAILED", szName);
+         iErrors++;
+      }
+   }
+
+   if ( iErrors )
+      s_iFailed = 1;
+   else
+      log_line("%s: all results match the original implementation", szName);
+}
+
+double _get_time()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0;
+}
+
+void _benchmark(u8* pBuffer)
+{
+   // Short headers, telemetry, video packets (default 1250), max radio packet, IPC messages
+   int iSizes[] = { 16, 64, 300, 1250, 1500, 4096 };
+   int iCountSizes = sizeof(iSizes)/sizeof(iSizes[0]);
+
+   log_line("Throughput in MB/s, %d packets of each size:", s_iLoops);
+   char szLine[256];
+   strcpy(szLine, "             ");
+   for( int i=0; i<iCountSizes; i++ )
+      sprintf(szLine+strlen(szLine), " %8d", iSizes[i]);
+   log_line("%s", szLine);
+
+   for( int iImpl=0; iImpl<CRC32_IMPL_COUNT; iImpl++ )
+   {
+      if ( ! crc32_set_implementation(iImpl) )
+         continue;
+      sprintf(szLine, "%-12s ", crc32_get_implementation_name(iImpl));
+      u32 uSum = 0;
+      for( int i=0; i<iCountSizes; i++ )
+      {
+         double fStart = _get_time();
+         for( int k=0; k<s_iLoops; k++ )
+            uSum += crc32_compute(pBuffer + (k & 0x0F), iSizes[i]);
+         double fTime = _get_time() - fStart;
+         if ( fTime < 0.000001 )
+            fTime = 0.000001;
+         sprintf(szLine+strlen(szLine), " %8.0f", (double)iSizes[i] * (double)s_iLoops / fTime / 1000000.0);
+      }
+      log_line("%s  (%08X)", szLine, uSum);
+   }
+}
+
+int main(int argc, char *argv[])
+{
+   log_init("TestCRC32");
+   log_enable_stdout();
+
+   for( int i=1; i<argc; i++ )
+   {
+      if ( 0 == strcmp(argv[i], "-loops") && i < argc-1 )
+         s_iLoops = atoi(argv[++i]);
+   }
+   if ( s_iLoops < 1 )
+      s_iLoops = 1;
+
+   _init_reference();
+   srand(1234);
+   int iBufferSize = 70000;
+   u8* pBuffer = (u8*)malloc(iBufferSize);
+   _fill_random(pBuffer, iBufferSize);
+
+   int iDefault = crc32_get_implementation();
+   log_line("Default implementation: %s", crc32_get_implementation_name(iDefault));
+
+   for( int iImpl=0; iImpl<CRC32_IMPL_COUNT; iImpl++ )
+   {
+      if ( ! crc32_is_implementation_supported(iImpl) )
+      {
+         log_line("%s: not supported on this CPU", crc32_get_implementation_name(iImpl));
+         continue;
+      }
+      _check_implementation(iImpl, pBuffer, iBufferSize);
+   }
+
+   crc32_set_implementation(iDefault);
+   if ( base_compute_crc32(pBuffer, 1250) != _reference_crc32(pBuffer, 1250) )
+   {
+      log_line("base_compute_crc32 differs from the original <- FAILED");
+      s_iFailed = 1;
+   }
+
+   _benchmark(pBuffer);
+   crc32_set_implementation(iDefault);
+   free(pBuffer);
+
+   if ( s_iFailed )
+   {
+      log_line("Test FAILED");
+      return 1;
+   }
+   log_line("Test PASSED");
+   return 0;
+}
@@ -0,0 +1,350 @@
+#include "../base/base.h"
+#include "../base/crc32.h"
+#include "../base/encr_aead.h"
+#include "../radio/radiopackets2.h"
+
+#include <time.h>
+
+// Known answer tests for ChaCha20, Poly1305, ChaCha20-Poly1305 (RFC 8439) and HChaCha20, on all the
+// ChaCha20 implementations of this build; then seals and opens chained radio packets (round trip,
+// tampering, wrong key) and benchmarks encrypted video packets against plaintext.
+// Usage: test_encr_aead [-loops N]
+
+int s_iFailed = 0;
+int s_iLoops = 20000;
+
+static const char* s_szSunscreen = "Ladies and Gentlemen of the class of '99: If I could offer you only one tip for the future, sunscreen would be it.";
+
+int _from_hex(const char* szHex, u8* pOut)
+{
+   int iCount = 0;
+   while ( szHex[0] && szHex[1] )
+   {
+      unsigned int uByte = 0;
+      sscanf(szHex, "%2x", &uByte);
+      pOut[iCount++] = (u8)uByte;
+      szHex += 2;
+   }
+   return iCount;
+}
+
+void _check(const char* szName, const u8* pResult, const char* szExpectedHex)
+{
+   u8 uExpected[256];
+   int iLength = _from_hex(szExpectedHex, uExpected);
+   if ( 0 != memcmp(pResult, uExpected, iLength) )
+   {
+      log_line("%s: wrong result <- FAILED", szName);
+      s_iFailed = 1;
+   }
+}
+
+void _check_known_answers()
+{
+   u8 uKey[32], uNonce[12], uAAD[12], uBuffer[256], uTag[16];
+   int iLength = strlen(s_szSunscreen);
+
+   // RFC 8439 2.4.2
+   for( int i=0; i<32; i++ )
+      uKey[i] = i;
+   _from_hex("000000000000004a00000000", uNonce);
+   memcpy(uBuffer, s_szSunscreen, iLength);
+   chacha20_xor(uKey, uNonce, 1, uBuffer, iLength);
+   _check("ChaCha20 (RFC 8439 2.4.2)", uBuffer, "6e2e359a2568f98041ba0728dd0d6981e97e7aec1d4360c20a27afccfd9fae0bf91b65c5524733ab8f593dabcd62b3571639d624e65152ab8f530c359f0861d807ca0dbf500d6a6156a38e088a22b65e52bc514d16ccf806818ce91ab77937365af90bbf74a35be6b40b8eedf2785e42874d");
+
+   // RFC 8439 2.5.2
+   _from_hex("85d6be7857556d337f4452fe42d506a80103808afb0db2fd4abff6af4149f51b", uKey);
+   poly1305_mac(uTag, uKey, (const u8*)"Cryptographic Forum Research Group", 34);
+   _check("Poly1305 (RFC 8439 2.5.2)", uTag, "a8061dc1305136c6c22b8baf0c0127a9");
+
+   // RFC 8439 2.8.2
+   for( int i=0; i<32; i++ )
+      uKey[i] = 0x80 + i;
+   _from_hex("070000004041424344454647", uNonce);
+   _from_hex("50515253c0c1c2c3c4c5c6c7", uAAD);
+   memcpy(uBuffer, s_szSunscreen, iLength);
+   chacha20_poly1305_encrypt(uKey, uNonce, uAAD, 12, uBuffer, iLength, uTag);
+   _check("ChaCha20-Poly1305 (RFC 8439 2.8.2) cipher text", uBuffer, "d31a8d34648e60db7b86afbc53ef7ec2a4aded51296e08fea9e2b5a736ee62d63dbea45e8ca9671282fafb69da92728b1a71de0a9e060b2905d6a5b67ecd3b3692ddbd7f2d778b8c9803aee328091b58fab324e4fad675945585808b4831d7bc3ff4def08e4b7a9de576d26586cec64b6116");
+   _check("ChaCha20-Poly1305 (RFC 8439 2.8.2) tag", uTag, "1ae10b594f09e26a7e902ecbd0600691");
+   if ( ! chacha20_poly1305_decrypt(uKey, uNonce, uAAD, 12, uBuffer, iLength, uTag) || 0 != memcmp(uBuffer, s_szSunscreen, iLength) )
+   {
+      log_line("ChaCha20-Poly1305 decryption failed <- FAILED");
+      s_iFailed = 1;
+   }
+   uAAD[0] ^= 1;
+   memcpy(uBuffer, s_szSunscreen, iLength);
+   chacha20_poly1305_encrypt(uKey, uNonce, uAAD, 12, uBuffer, iLength, uTag);
+   uAAD[0] ^= 1;
+   if ( chacha20_poly1305_decrypt(uKey, uNonce, uAAD, 12, uBuffer, iLength, uTag) )
+   {
+      log_line("ChaCha20-Poly1305 accepted a wrong AAD <- FAILED");
+      s_iFailed = 1;
+   }
+
+   // XChaCha20 draft (draft-irtf-cfrg-xchacha) 2.2.1, 16 bytes input
+   u8 uHInput[16];
+   for( int i=0; i<32; i++ )
+      uKey[i] = i;
+   _from_hex("000000090000004a0000000031415927", uHInput);
+   hchacha20(uBuffer, uKey, uHInput);
+   _check("HChaCha20", uBuffer, "82413b4227b27bfed30e42508a877d73a0f9e4d58a74a853c12ec41326d3ecdc");
+}
+
+// Long buffers go through the 4 blocks paths: compare with the portable one
+void _check_implementations_match()
+{
+   u8 uKey[32], uNonce[12];
+   u8* pRef = (u8*)malloc(5000);
+   u8* pBuf = (u8*)malloc(5000);
+   for( int i=0; i<32; i++ )
+      uKey[i] = rand();
+   for( int i=0; i<12; i++ )
+      uNonce[i] = rand();
+   for( int iImpl=1; iImpl<CHACHA20_IMPL_COUNT; iImpl++ )
+   {
+      if ( ! chacha20_is_implementation_supported(iImpl) )
+         continue;
+      for( int iLength=0; iLength<5000; iLength += 1 + iLength/8 )
+      {
+         for( int i=0; i<iLength; i++ )
+            pRef[i] = pBuf[i] = rand();
+         chacha20_set_implementation(CHACHA20_IMPL_PORTABLE);
+         chacha20_xor(uKey, uNonce, 7, pRef, iLength);
+         chacha20_set_implementation(iImpl);
+         chacha20_xor(uKey, uNonce, 7, pBuf, iLength);
+         if ( 0 != memcmp(pRef, pBuf, iLength) )
+         {
+            log_line("%s: differs from the portable ChaCha20 on %d bytes <- FAILED", chacha20_get_implementation_name(iImpl), iLength);
+            s_iFailed = 1;
+            break;
+         }
+      }
+   }
+   free(pRef);
+   free(pBuf);
+}
+
+// Builds iCount chained radio packets of iPayload bytes each; returns the total length
+int _build_packets(u8* pBuffer, int iCount, int iPayload, u32 uFirstIndex, u8 uFlags)
+{
+   int iPos = 0;
+   for( int k=0; k<iCount; k++ )
+   {
+      t_packet_header* pPH = (t_packet_header*)(pBuffer + iPos);
+      memset(pPH, 0, sizeof(t_packet_header));
+      pPH->packet_flags = PACKET_COMPONENT_VIDEO | uFlags;
+      pPH->packet_type = PACKET_TYPE_VIDEO_DATA_FULL;
+      pPH->stream_packet_idx = (STREAM_ID_VIDEO_1 << PACKET_FLAGS_MASK_SHIFT_STREAM_INDEX) | (uFirstIndex + k);
+      pPH->total_headers_length = sizeof(t_packet_header) + 8;
+      pPH->total_length = sizeof(t_packet_header) + iPayload;
+      pPH->vehicle_id_src = 123456;
+      pPH->vehicle_id_dest = 654321;
+      for( int i=0; i<iPayload; i++ )
+         pBuffer[iPos + sizeof(t_packet_header) + i] = rand();
+      packet_compute_crc(pBuffer + iPos, pPH->total_length);
+      iPos += pPH->total_length;
+   }
+   return iPos;
+}
+
+void _check_packets()
+{
+   u8 uPlain[MAX_PACKET_TOTAL_SIZE];
+   u8 uSealed[MAX_PACKET_TOTAL_SIZE];
+   u8 uTmp[MAX_PACKET_TOTAL_SIZE];
+
+   encr_aead_set_pass_phrase((const u8*)"test pass phrase", 16);
+
+   int iPlainLength = _build_packets(uPlain, 3, 300, 10, 0);
+   int iSealedLength = encr_aead_seal_packets(uPlain, iPlainLength, uSealed, MAX_PACKET_TOTAL_SIZE);
+   if ( iSealedLength != iPlainLength + 3*ENCR_AEAD_OVERHEAD )
+   {
+      log_line("Sealed chained packets have the wrong length: %d <- FAILED", iSealedLength);
+      s_iFailed = 1;
+      return;
+   }
+
+   // Open each packet like the radio rx loops do, check it matches the plain one
+   int iPosSealed = 0;
+   int iPosPlain = 0;
+   for( int k=0; k<3; k++ )
+   {
+      t_packet_header* pPH = (t_packet_header*)(uSealed + iPosSealed);
+      int iReceivedLength = pPH->total_length;
+      if ( ! packet_check_crc(uSealed + iPosSealed, iReceivedLength) || ! encr_aead_is_sealed_packet(uSealed + iPosSealed) )
+      {
+         log_line("Sealed packet %d has a wrong CRC or flags <- FAILED", k);
+         s_iFailed = 1;
+      }
+      if ( 0 == memcmp(uSealed + iPosSealed + sizeof(t_packet_header), uPlain + iPosPlain + sizeof(t_packet_header), 32) )
+      {
+         log_line("Sealed packet %d is not encrypted <- FAILED", k);
+         s_iFailed = 1;
+      }
+
+      // Tampered copies must be rejected and left unchanged
+      for( int iOffset=4; iOffset<iReceivedLength; iOffset += 37 )
+      {
+         memcpy(uTmp, uSealed + iPosSealed, iReceivedLength);
+         uTmp[iOffset] ^= 0x10;
+         if ( encr_aead_open_packet(uTmp, iReceivedLength) )
+         {
+            log_line("Tampered packet (byte %d) was accepted <- FAILED", iOffset);
+            s_iFailed = 1;
+            break;
+         }
+      }
+
+      int iOpenLength = encr_aead_open_packet(uSealed + iPosSealed, iSealedLength - iPosSealed);
+      t_packet_header* pPHPlain = (t_packet_header*)(uPlain + iPosPlain);
+      if ( (iOpenLength != pPHPlain->total_length) ||
+           (0 != memcmp(uSealed + iPosSealed + sizeof(t_packet_header), uPlain + iPosPlain + sizeof(t_packet_header), iOpenLength - sizeof(t_packet_header))) ||
+           (((t_packet_header*)(uSealed + iPosSealed))->stream_packet_idx != pPHPlain->stream_packet_idx) ||
+           (! packet_check_crc(uSealed + iPosSealed, iOpenLength)) )
+      {
+         log_line("Opened packet %d differs from the plain one <- FAILED", k);
+         s_iFailed = 1;
+      }
+      iPosSealed += iReceivedLength;
+      iPosPlain += pPHPlain->total_length;
+   }
+
+   // Headers only CRC (video packets)
+   iPlainLength = _build_packets(uPlain, 1, 1000, 20, PACKET_FLAGS_BIT_HEADERS_ONLY_CRC);
+   iSealedLength = encr_aead_seal_packets(uPlain, iPlainLength, uSealed, MAX_PACKET_TOTAL_SIZE);
+   t_packet_header* pPH = (t_packet_header*)uSealed;
+   if ( pPH->crc != crc32_compute(uSealed + sizeof(u32), pPH->total_headers_length - sizeof(u32)) )
+   {
+      log_line("Sealed packet with headers only CRC has a wrong CRC <- FAILED");
+      s_iFailed = 1;
+   }
+
+   // Wrong key
+   memcpy(uTmp, uSealed, iSealedLength);
+   encr_aead_set_pass_phrase((const u8*)"other pass phrase", 17);
+   if ( encr_aead_open_packet(uTmp, iSealedLength) )
+   {
+      log_line("Packet opened with the wrong pass phrase <- FAILED");
+      s_iFailed = 1;
+   }
+   encr_aead_set_pass_phrase((const u8*)"test pass phrase", 16);
+   if ( encr_aead_open_packet(uTmp, iSealedLength) != iPlainLength )
+   {
+      log_line("Packet did not open with the right pass phrase <- FAILED");
+      s_iFailed = 1;
+   }
+
+   // Too big to seal
+   iPlainLength = _build_packets(uPlain, 1, MAX_PACKET_TOTAL_SIZE - sizeof(t_packet_header) - 10, 30, 0);
+   if ( encr_aead_seal_packets(uPlain, iPlainLength, uSealed, MAX_PACKET_TOTAL_SIZE) >= 0 )
+   {
+      log_line("Sealed a packet bigger than the output buffer <- FAILED");
+      s_iFailed = 1;
+   }
+   log_line("Sealed and opened chained radio packets");
+}
+
+double _get_time()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0;
+}
+
+// A video packet (default 1250 bytes of video data) sent on 2 radio interfaces: plaintext just builds the
+// radio frame for each interface; encrypted seals it once, then builds the frames; the receiver opens it
+void _benchmark()
+{
+   u8 uPlain[MAX_PACKET_TOTAL_SIZE];
+   u8 uSealed[MAX_PACKET_TOTAL_SIZE];
+   u8 uFrame[MAX_PACKET_TOTAL_SIZE];
+   int iPlainLength = _build_packets(uPlain, 1, MAX_PACKET_PAYLOAD, 0, PACKET_FLAGS_BIT_HEADERS_ONLY_CRC);
+   double fMB = (double)iPlainLength * (double)s_iLoops / 1000000.0;
+   u32 uSum = 0;
+
+   double fStart = _get_time();
+   for( int k=0; k<s_iLoops; k++ )
+   for( int i=0; i<2; i++ )
+   {
+      memcpy(uFrame, uPlain, iPlainLength);
+      uSum += uFrame[k % iPlainLength];
+   }
+   double fPlain = _get_time() - fStart;
+   log_line("Plaintext video packets: %.0f MB/s", fMB / (fPlain + 0.000001));
+
+   for( int iImpl=0; iImpl<CHACHA20_IMPL_COUNT; iImpl++ )
+   {
+      if ( ! chacha20_set_implementation(iImpl) )
+         continue;
+      fStart = _get_time();
+      for( int k=0; k<s_iLoops; k++ )
+      {
+         int iSealedLength = encr_aead_seal_packets(uPlain, iPlainLength, uSealed, MAX_PACKET_TOTAL_SIZE);
+         for( int i=0; i<2; i++ )
+         {
+            memcpy(uFrame, uSealed, iSealedLength);
+            uSum += uFrame[k % iSealedLength];
+         }
+      }
+      double fSeal = _get_time() - fStart;
+
+      fStart = _get_time();
+      for( int k=0; k<s_iLoops; k++ )
+      {
+         memcpy(uFrame, uSealed, MAX_PACKET_TOTAL_SIZE);
+         uSum += encr_aead_open_packet(uFrame, MAX_PACKET_TOTAL_SIZE);
+      }
+      double fOpen = _get_time() - fStart;
+      log_line("Encrypted video packets (%s): seal %.0f MB/s, open %.0f MB/s, %.1f us per packet", chacha20_get_implementation_name(iImpl),
+         fMB / (fSeal + 0.000001), fMB / (fOpen + 0.000001), fSeal * 1000000.0 / (double)s_iLoops);
+   }
+   log_line("(checksum %u)", uSum);
+}
+
+int main(int argc, char *argv[])
+{
+   log_init("TestEncrAEAD");
+   log_enable_stdout();
+
+   for( int i=1; i<argc; i++ )
+   {
+      if ( 0 == strcmp(argv[i], "-loops") && i < argc-1 )
+         s_iLoops = atoi(argv[++i]);
+   }
+   if ( s_iLoops < 1 )
+      s_iLoops = 1;
+   srand(1234);
+
+   int iDefault = chacha20_get_implementation();
+   log_line("Default ChaCha20 implementation: %s", chacha20_get_implementation_name(iDefault));
+
+   for( int iImpl=0; iImpl<CHACHA20_IMPL_COUNT; iImpl++ )
+   {
+      if ( ! chacha20_set_implementation(iImpl) )
+      {
+         log_line("%s: not supported on this build", chacha20_get_implementation_name(iImpl));
+         continue;
+      }
+      int iFailedBefore = s_iFailed;
+      s_iFailed = 0;
+      _check_known_answers();
+      if ( ! s_iFailed )
+         log_line("%s: known answer tests passed", chacha20_get_implementation_name(iImpl));
+      s_iFailed |= iFailedBefore;
+   }
+   _check_implementations_match();
+
+   chacha20_set_implementation(iDefault);
+   _check_packets();
+   _benchmark();
+   chacha20_set_implementation(iDefault);
+   encr_aead_reset_key();
+
+   if ( s_iFailed )
+   {
+      log_line("Test FAILED");
+      return 1;
+   }
+   log_line("Test PASSED");
+   return 0;
+}
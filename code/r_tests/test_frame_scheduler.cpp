@@ -0,0 +1,296 @@
+#include "../base/base.h"
+#include "../base/hardware.h"
+#include "../base/frame_scheduler.h"
+
+// Tests the frame budget scheduler with synthetic tasks on a simulated clock (each task advances the clock
+// by its cost): the critical render task keeps its deadlines while low priority tasks overload the loop
+// (the same tasks run as a plain loop do miss them), a high priority task that never fits is not starved,
+// and slow worker tasks (real clock) don't hold back the main thread.
+// Usage: test_frame_scheduler [-seconds N] (N: simulated seconds for each overload test)
+
+#define RENDER_PERIOD 33333
+#define RENDER_COST 8000
+
+int s_iFailed = 0;
+int s_iSeconds = 10;
+
+u32 s_uSimTimeMicros = 0;
+
+void _fail(const char* szText)
+{
+   log_line("%s <- FAILED", szText);
+   s_iFailed = 1;
+}
+
+u32 _sim_get_time(void* pContext)
+{
+   return s_uSimTimeMicros;
+}
+
+typedef struct
+{
+   const char* szName;
+   int iPriority;
+   u32 uPeriodMicros;
+   u32 uCostMicros;
+   u32 uJitterPercent; // the cost is up to this percent longer, random
+} t_synthetic_task;
+
+u32 _synthetic_cost(t_synthetic_task* pTask)
+{
+   u32 uCost = pTask->uCostMicros;
+   if ( pTask->uJitterPercent > 0 )
+      uCost += (u32)(rand() % (pTask->uCostMicros*pTask->uJitterPercent/100 + 1));
+   return uCost;
+}
+
+void _synthetic_task_run(void* pContext, u32 uBudgetMicros)
+{
+   s_uSimTimeMicros += _synthetic_cost((t_synthetic_task*)pContext);
+}
+
+// Waits on the (empty) router pipe for the whole budget
+void _synthetic_router_run(void* pContext, u32 uBudgetMicros)
+{
+   s_uSimTimeMicros += 50 + uBudgetMicros;
+}
+
+// Render task: records its own lateness, independent of the scheduler stats
+u32 s_uRenderNextMicros = 0;
+u32 s_uRenderMisses = 0;
+u32 s_uRenderRuns = 0;
+u32 s_uRenderMaxLate = 0;
+
+void _render_check_deadline()
+{
+   int iLate = (int)(s_uSimTimeMicros - s_uRenderNextMicros);
+   if ( iLate > (int)s_uRenderMaxLate )
+      s_uRenderMaxLate = (u32)iLate;
+   if ( iLate*100 > RENDER_PERIOD*FRAME_SCHEDULER_MISS_PERCENT )
+      s_uRenderMisses++;
+   s_uRenderRuns++;
+   s_uRenderNextMicros += RENDER_PERIOD;
+   if ( (int)(s_uRenderNextMicros - s_uSimTimeMicros) <= 0 )
+      s_uRenderNextMicros = s_uSimTimeMicros + RENDER_PERIOD;
+}
+
+void _render_reset(u32 uTimeStart)
+{
+   s_uRenderNextMicros = uTimeStart;
+   s_uRenderMisses = 0;
+   s_uRenderRuns = 0;
+   s_uRenderMaxLate = 0;
+}
+
+void _synthetic_render_run(void* pContext, u32 uBudgetMicros)
+{
+   _render_check_deadline();
+   s_uSimTimeMicros += _synthetic_cost((t_synthetic_task*)pContext);
+}
+
+t_synthetic_task s_RenderTask = { "render", FRAME_SCHEDULER_PRIORITY_CRITICAL, RENDER_PERIOD, RENDER_COST, 10 };
+t_synthetic_task s_InputTask = { "input", FRAME_SCHEDULER_PRIORITY_HIGH, 10000, 1500, 30 };
+t_synthetic_task s_OverloadTasks[] =
+{
+   { "model_reload", FRAME_SCHEDULER_PRIORITY_LOW, 50000, 20000, 15 },
+   { "stats_panels", FRAME_SCHEDULER_PRIORITY_LOW, 100000, 16000, 15 },
+   { "shell_call", FRAME_SCHEDULER_PRIORITY_LOW, 200000, 12000, 15 }
+};
+#define OVERLOAD_TASKS_COUNT (int)(sizeof(s_OverloadTasks)/sizeof(s_OverloadTasks[0]))
+
+// The same tasks in a plain loop: each due task runs in turn, then a fixed router wait
+void _test_plain_loop()
+{
+   t_synthetic_task* pTasks[OVERLOAD_TASKS_COUNT+2];
+   u32 uNextDue[OVERLOAD_TASKS_COUNT+2];
+   int iCount = 0;
+   pTasks[iCount++] = &s_RenderTask;
+   pTasks[iCount++] = &s_InputTask;
+   for( int i=0; i<OVERLOAD_TASKS_COUNT; i++ )
+      pTasks[iCount++] = &s_OverloadTasks[i];
+
+   srand(1);
+   s_uSimTimeMicros = 1000000;
+   _render_reset(s_uSimTimeMicros);
+   for( int i=0; i<iCount; i++ )
+      uNextDue[i] = s_uSimTimeMicros;
+
+   u32 uTimeEnd = s_uSimTimeMicros + (u32)s_iSeconds*1000000;
+   while ( (int)(uTimeEnd - s_uSimTimeMicros) > 0 )
+   {
+      for( int i=0; i<iCount; i++ )
+      {
+         if ( (int)(uNextDue[i] - s_uSimTimeMicros) > 0 )
+            continue;
+         uNextDue[i] += pTasks[i]->uPeriodMicros;
+         if ( (int)(uNextDue[i] - s_uSimTimeMicros) <= 0 )
+            uNextDue[i] = s_uSimTimeMicros + pTasks[i]->uPeriodMicros;
+         if ( pTasks[i] == &s_RenderTask )
+            _synthetic_render_run(pTasks[i], 0);
+         else
+            _synthetic_task_run(pTasks[i], 0);
+      }
+      _synthetic_router_run(NULL, 2000);
+   }
+   log_line("Plain loop: %u renders, %u missed deadlines, max late: %u us", s_uRenderRuns, s_uRenderMisses, s_uRenderMaxLate);
+   if ( 0 == s_uRenderMisses )
+      _fail("The overload tasks should make the plain loop miss render deadlines");
+}
+
+void _test_overload()
+{
+   srand(1);
+   s_uSimTimeMicros = 1000000;
+   _render_reset(s_uSimTimeMicros);
+   frame_scheduler_init(_sim_get_time, NULL);
+   int iRender = frame_scheduler_add_task(s_RenderTask.szName, s_RenderTask.iPriority, s_RenderTask.uPeriodMicros, s_RenderTask.uCostMicros, 0, _synthetic_render_run, &s_RenderTask);
+   int iInput = frame_scheduler_add_task(s_InputTask.szName, s_InputTask.iPriority, s_InputTask.uPeriodMicros, s_InputTask.uCostMicros, 0, _synthetic_task_run, &s_InputTask);
+   int iRouter = frame_scheduler_add_task("router", FRAME_SCHEDULER_PRIORITY_CRITICAL, 0, 0, FRAME_SCHEDULER_FLAG_IDLE, _synthetic_router_run, NULL);
+   int iFirstOverload = frame_scheduler_get_tasks_count();
+   for( int i=0; i<OVERLOAD_TASKS_COUNT; i++ )
+      frame_scheduler_add_task(s_OverloadTasks[i].szName, s_OverloadTasks[i].iPriority, s_OverloadTasks[i].uPeriodMicros, s_OverloadTasks[i].uCostMicros, 0, _synthetic_task_run, &s_OverloadTasks[i]);
+
+   u32 uTimeEnd = s_uSimTimeMicros + (u32)s_iSeconds*1000000;
+   u32 uPasses = 0;
+   while ( (int)(uTimeEnd - s_uSimTimeMicros) > 0 )
+   {
+      frame_scheduler_run();
+      uPasses++;
+   }
+   frame_scheduler_log_stats();
+   log_line("Scheduler: %u passes, %u renders, %u missed deadlines, max late: %u us", uPasses, s_uRenderRuns, s_uRenderMisses, s_uRenderMaxLate);
+
+   t_frame_scheduler_task_stats stats;
+   frame_scheduler_get_task_stats(iRender, &stats);
+   u32 uExpectedRenders = (u32)s_iSeconds*1000000/RENDER_PERIOD;
+   if ( (0 != s_uRenderMisses) || (0 != stats.uDeadlineMisses) )
+      _fail("Render missed deadlines");
+   if ( s_uRenderRuns + 2 < uExpectedRenders )
+      _fail("Render ran too few times");
+
+   // The loop is overloaded (more than 100% of the time): the input is handled at least once per frame
+   frame_scheduler_get_task_stats(iInput, &stats);
+   if ( stats.uRuns < uExpectedRenders )
+      _fail("Input task ran less than once per frame");
+
+   frame_scheduler_get_task_stats(iRouter, &stats);
+   if ( stats.uRuns < uPasses )
+      _fail("Router task did not run on each pass");
+
+   for( int i=0; i<OVERLOAD_TASKS_COUNT; i++ )
+   {
+      frame_scheduler_get_task_stats(iFirstOverload+i, &stats);
+      if ( 0 == stats.uRuns )
+         _fail("Low priority task never ran");
+      if ( 0 == stats.uDeferred )
+         _fail("Low priority task was never deferred");
+   }
+   frame_scheduler_release();
+}
+
+// A high priority task that never fits between two renders still runs, forced after the max deferrals
+void _test_no_starvation()
+{
+   t_synthetic_task heavyTask = { "heavy", FRAME_SCHEDULER_PRIORITY_HIGH, 100000, RENDER_PERIOD - RENDER_COST + 3000, 0 };
+   srand(2);
+   s_uSimTimeMicros = 0xFFFFFFFF - 2000000; // wraps around during the test
+   _render_reset(s_uSimTimeMicros);
+   frame_scheduler_init(_sim_get_time, NULL);
+   frame_scheduler_add_task(s_RenderTask.szName, s_RenderTask.iPriority, s_RenderTask.uPeriodMicros, s_RenderTask.uCostMicros, 0, _synthetic_render_run, &s_RenderTask);
+   int iHeavy = frame_scheduler_add_task(heavyTask.szName, heavyTask.iPriority, heavyTask.uPeriodMicros, heavyTask.uCostMicros, 0, _synthetic_task_run, &heavyTask);
+   frame_scheduler_add_task("router", FRAME_SCHEDULER_PRIORITY_CRITICAL, 0, 0, FRAME_SCHEDULER_FLAG_IDLE, _synthetic_router_run, NULL);
+
+   u32 uTimeEnd = s_uSimTimeMicros + (u32)s_iSeconds*1000000;
+   while ( (int)(uTimeEnd - s_uSimTimeMicros) > 0 )
+      frame_scheduler_run();
+   frame_scheduler_log_stats();
+
+   t_frame_scheduler_task_stats stats;
+   frame_scheduler_get_task_stats(iHeavy, &stats);
+   if ( stats.uRuns < (u32)s_iSeconds )
+      _fail("High priority task was starved");
+   if ( (0 == stats.uForced) || (stats.uDeferred < stats.uForced*FRAME_SCHEDULER_MAX_DEFERRED) )
+      _fail("High priority task should be held back before it is forced");
+   // Only the forced runs can make the render late
+   if ( s_uRenderMisses > stats.uForced )
+      _fail("Render missed more deadlines than the forced runs");
+   frame_scheduler_release();
+}
+
+// Worker tasks, real clock
+
+typedef struct
+{
+   u32 uSleepMicros;
+   volatile u32 uRuns;
+} t_worker_task;
+
+void _worker_task_run(void* pContext, u32 uBudgetMicros)
+{
+   t_worker_task* pTask = (t_worker_task*)pContext;
+   hardware_sleep_micros(pTask->uSleepMicros);
+   pTask->uRuns++;
+}
+
+void _real_task_run(void* pContext, u32 uBudgetMicros)
+{
+   hardware_sleep_micros(1000);
+}
+
+void _test_worker()
+{
+   t_worker_task slowTask = { 30000, 0 };
+   frame_scheduler_init(NULL, NULL);
+   int iCritical = frame_scheduler_add_task("critical", FRAME_SCHEDULER_PRIORITY_CRITICAL, 10000, 1000, 0, _real_task_run, NULL);
+   int iSlow = frame_scheduler_add_task("slow_worker", FRAME_SCHEDULER_PRIORITY_LOW, 10000, 0, FRAME_SCHEDULER_FLAG_WORKER, _worker_task_run, &slowTask);
+
+   u32 uTimeEnd = get_current_timestamp_ms() + 500;
+   while ( get_current_timestamp_ms() < uTimeEnd )
+   {
+      u32 uWait = frame_scheduler_run();
+      if ( uWait > 0 )
+         hardware_sleep_micros(uWait);
+   }
+   frame_scheduler_wait_worker();
+   frame_scheduler_log_stats();
+
+   t_frame_scheduler_task_stats stats;
+   frame_scheduler_get_task_stats(iCritical, &stats);
+   if ( stats.uRuns < 40 )
+      _fail("Critical task held back by the worker task");
+   frame_scheduler_get_task_stats(iSlow, &stats);
+   if ( (0 == stats.uRuns) || (stats.uRuns != slowTask.uRuns) )
+      _fail("Worker task did not run");
+   if ( 0 == stats.uSkippedBusy )
+      _fail("Worker task runs should be skipped while the worker is busy");
+   if ( stats.uAvgDurationMicros < slowTask.uSleepMicros )
+      _fail("Worker task duration not measured");
+   frame_scheduler_release();
+}
+
+int main(int argc, char *argv[])
+{
+   log_init("TestFrameScheduler");
+   log_enable_stdout();
+
+   for( int i=1; i<argc; i++ )
+   {
+      if ( 0 == strcmp(argv[i], "-seconds") && i < argc-1 )
+         s_iSeconds = atoi(argv[++i]);
+   }
+   if ( s_iSeconds < 1 )
+      s_iSeconds = 1;
+
+   _test_plain_loop();
+   _test_overload();
+   _test_no_starvation();
+   _test_worker();
+
+   if ( s_iFailed )
+   {
+      log_line("Test FAILED");
+      return 1;
+   }
+   log_line("Test PASSED");
+   return 0;
+}
@@ -0,0 +1,317 @@
+#include "../base/base.h"
+#include "../base/hardware.h"
+#include "../base/gpio_input.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+// Tests the GPIO input thread: pins sampled from a fake sysfs gpio folder (kept opened, debounced,
+// active low pins, long presses) and pins driven by a pipe edge source (edge latency, bounces,
+// short taps seen after the fact, full events queue).
+// Usage: test_gpio_input [-loops N] (N: times to run the tests)
+
+int s_iFailed = 0;
+int s_iLoops = 1;
+char s_szSysfsPath[128];
+
+void _fail(const char* szText)
+{
+   log_line("%s <- FAILED", szText);
+   s_iFailed = 1;
+}
+
+void _write_value(int iPin, const char* szValue)
+{
+   char szFile[256];
+   snprintf(szFile, sizeof(szFile), "%s/gpio%d/value", s_szSysfsPath, iPin);
+   int fd = open(szFile, O_WRONLY | O_TRUNC | O_CREAT, 0644);
+   if ( fd < 0 )
+   {
+      _fail("Can't write fake gpio value file");
+      return;
+   }
+   if ( (int)strlen(szValue) != write(fd, szValue, strlen(szValue)) )
+      _fail("Can't write fake gpio value");
+   close(fd);
+}
+
+void _create_pin(int iPin, const char* szValue)
+{
+   char szFolder[256];
+   snprintf(szFolder, sizeof(szFolder), "%s/gpio%d", s_szSysfsPath, iPin);
+   mkdir(szFolder, 0755);
+   _write_value(iPin, szValue);
+}
+
+// Collects the events queued so far
+
+typedef struct
+{
+   int iCount;
+   t_gpio_input_event events[256];
+} t_events;
+
+void _get_events(t_events* pEvents)
+{
+   memset(pEvents, 0, sizeof(t_events));
+   t_gpio_input_event event;
+   while ( gpio_input_get_event(&event) )
+   {
+      if ( pEvents->iCount < 256 )
+         memcpy(&(pEvents->events[pEvents->iCount]), &event, sizeof(t_gpio_input_event));
+      pEvents->iCount++;
+   }
+}
+
+int _count_events(t_events* pEvents, int iPin, u8 uType)
+{
+   int iCount = 0;
+   for( int i=0; i<pEvents->iCount && i<256; i++ )
+   {
+      if ( (pEvents->events[i].iPin == iPin) && (pEvents->events[i].uType == uType) )
+         iCount++;
+   }
+   return iCount;
+}
+
+void _test_sysfs()
+{
+   t_events events;
+   log_line("Sampled fake sysfs pins...");
+
+   strcpy(s_szSysfsPath, "/tmp/test_gpio_input_XXXXXX");
+   if ( NULL == mkdtemp(s_szSysfsPath) )
+   {
+      _fail("Can't create fake sysfs folder");
+      return;
+   }
+   _create_pin(5, "0\n");
+   _create_pin(6, "1\n");
+
+   gpio_input_set_sysfs_path(s_szSysfsPath);
+   gpio_input_set_timings(40, 200, 50);
+   if ( ! gpio_input_add_pin(5, 0) )
+      _fail("Add pin 5");
+   if ( ! gpio_input_add_pin(6, 1) )
+      _fail("Add pin 6 (active low)");
+   if ( gpio_input_add_pin(7, 0) )
+      _fail("Added a pin with no value file");
+   if ( ! gpio_input_start() )
+   {
+      _fail("Start");
+      return;
+   }
+
+   // Start levels are not events
+   hardware_sleep_ms(50);
+   _get_events(&events);
+   if ( events.iCount != 0 )
+      _fail("Events for the start levels");
+   if ( (gpio_input_get_level(5) != 0) || (gpio_input_get_level(6) != 1) || (gpio_input_get_level(7) != -1) )
+      _fail("Start levels");
+
+   // Press with bounces: one press
+   u32 uTimeStart = get_current_timestamp_ms();
+   _write_value(5, "1\n");
+   for( int i=0; i<3; i++ )
+   {
+      hardware_sleep_ms(2);
+      _write_value(5, "0\n");
+      hardware_sleep_ms(2);
+      _write_value(5, "1\n");
+   }
+   hardware_sleep_ms(80);
+   _get_events(&events);
+   if ( (events.iCount != 1) || (_count_events(&events, 5, GPIO_INPUT_EVENT_PRESS) != 1) )
+   {
+      for( int i=0; i<events.iCount && i<256; i++ )
+         log_line("Event %d: pin %d, type %d, time %u", i, events.events[i].iPin, events.events[i].uType, events.events[i].uTimeMs - uTimeStart);
+      _fail("Bouncing press");
+   }
+   else if ( (events.events[0].uTimeMs < uTimeStart) || (events.events[0].uTimeMs > uTimeStart + 2*GPIO_INPUT_SAMPLE_INTERVAL_MS + 5) )
+      _fail("Press timestamp");
+   log_line("Press seen after %u ms (sampled)", (events.iCount > 0)?(events.events[0].uTimeMs - uTimeStart):0);
+
+   // Held: long press after 200 ms, then every 50 ms
+   hardware_sleep_ms(250);
+   _get_events(&events);
+   int iLong = _count_events(&events, 5, GPIO_INPUT_EVENT_LONG_PRESS);
+   log_line("Long press events: %d", iLong);
+   if ( (iLong < 2) || (iLong > 4) )
+      _fail("Long press events count");
+   for( int i=0; i<iLong && i<256; i++ )
+   {
+      if ( events.events[i].uRepeatCount != i )
+         _fail("Long press repeat count");
+   }
+
+   // Release
+   _write_value(5, "0\n");
+   hardware_sleep_ms(50);
+   _get_events(&events);
+   if ( (_count_events(&events, 5, GPIO_INPUT_EVENT_RELEASE) != 1) || (_count_events(&events, 5, GPIO_INPUT_EVENT_PRESS) != 0) ||
+        (events.events[events.iCount-1].uType != GPIO_INPUT_EVENT_RELEASE) )
+      _fail("Release");
+
+   // Active low pin
+   _write_value(6, "0\n");
+   hardware_sleep_ms(50);
+   _get_events(&events);
+   if ( (events.iCount != 1) || (_count_events(&events, 6, GPIO_INPUT_EVENT_PRESS) != 1) || (events.events[0].uLevel != 0) )
+      _fail("Active low press");
+   _write_value(6, "1\n");
+   hardware_sleep_ms(50);
+   _get_events(&events);
+   if ( (events.iCount != 1) || (_count_events(&events, 6, GPIO_INPUT_EVENT_RELEASE) != 1) )
+      _fail("Active low release");
+
+   // The value file is kept opened: a new file with the same name is not seen
+   char szFile[256];
+   snprintf(szFile, sizeof(szFile), "%s/gpio5/value", s_szSysfsPath);
+   unlink(szFile);
+   _write_value(5, "1\n");
+   hardware_sleep_ms(50);
+   _get_events(&events);
+   if ( events.iCount != 0 )
+      _fail("Value file was opened again");
+
+   gpio_input_stop();
+
+   char szComm[256];
+   snprintf(szComm, sizeof(szComm), "rm -rf %s", s_szSysfsPath);
+   if ( 0 != system(szComm) )
+      log_line("Failed to remove %s", s_szSysfsPath);
+}
+
+void _test_stream()
+{
+   t_events events;
+   int fd[2];
+   log_line("Pipe edge source pin...");
+
+   if ( 0 != pipe(fd) )
+   {
+      _fail("Pipe");
+      return;
+   }
+   gpio_input_set_timings(20, 10000, 1000);
+   if ( ! gpio_input_add_pin_stream(30, fd[0], 0) )
+      _fail("Add stream pin");
+   if ( ! gpio_input_start() )
+   {
+      _fail("Start");
+      return;
+   }
+
+   // Edge latency
+   u32 uMaxLatency = 0;
+   for( int i=0; i<10; i++ )
+   {
+      u32 uTimeStart = get_current_timestamp_micros();
+      if ( 1 != write(fd[1], "1", 1) )
+         _fail("Write pipe");
+      u32 uLatency = 0;
+      while ( ! gpio_input_get_event(NULL) )
+      {
+         uLatency = get_current_timestamp_micros() - uTimeStart;
+         if ( uLatency > 100000 )
+            break;
+      }
+      uLatency = get_current_timestamp_micros() - uTimeStart;
+      if ( uLatency > uMaxLatency )
+         uMaxLatency = uLatency;
+      hardware_sleep_ms(30);
+      if ( 1 != write(fd[1], "0", 1) )
+         _fail("Write pipe");
+      hardware_sleep_ms(30);
+      _get_events(&events);
+      if ( (events.iCount != 1) || (_count_events(&events, 30, GPIO_INPUT_EVENT_RELEASE) != 1) )
+         _fail("Press/release");
+   }
+   log_line("Max press latency: %u us", uMaxLatency);
+   if ( uMaxLatency > 20000 )
+      _fail("Press latency");
+
+   // Bounces on press and release
+   if ( 5 != write(fd[1], "10101", 5) )
+      _fail("Write pipe");
+   hardware_sleep_ms(3);
+   if ( 4 != write(fd[1], "0101", 4) )
+      _fail("Write pipe");
+   hardware_sleep_ms(40);
+   if ( 1 != write(fd[1], "0", 1) )
+      _fail("Write pipe");
+   hardware_sleep_ms(3);
+   if ( 3 != write(fd[1], "1\n0", 3) )
+      _fail("Write pipe");
+   hardware_sleep_ms(40);
+   _get_events(&events);
+   if ( (events.iCount != 2) || (_count_events(&events, 30, GPIO_INPUT_EVENT_PRESS) != 1) || (_count_events(&events, 30, GPIO_INPUT_EVENT_RELEASE) != 1) )
+      _fail("Bounces");
+
+   // A short tap is seen later, with both events
+   if ( 1 != write(fd[1], "1", 1) )
+      _fail("Write pipe");
+   hardware_sleep_ms(5);
+   if ( 1 != write(fd[1], "0", 1) )
+      _fail("Write pipe");
+   hardware_sleep_ms(100);
+   _get_events(&events);
+   if ( (events.iCount != 2) || (events.events[0].uType != GPIO_INPUT_EVENT_PRESS) || (events.events[1].uType != GPIO_INPUT_EVENT_RELEASE) )
+      _fail("Short tap");
+   else if ( events.events[1].uTimeMs - events.events[0].uTimeMs < 20 )
+      _fail("Short tap not debounced");
+
+   // Full queue: events are dropped, not overwritten
+   gpio_input_set_timings(1, 10000, 1000);
+   u32 uDroppedStart = gpio_input_get_dropped_events_count();
+   for( int i=0; i<GPIO_INPUT_EVENTS_QUEUE_SIZE; i++ )
+   {
+      if ( 1 != write(fd[1], (i%2)?"0":"1", 1) )
+         _fail("Write pipe");
+      hardware_sleep_ms(3);
+   }
+   hardware_sleep_ms(20);
+   if ( 1 != write(fd[1], "1", 1) )
+      _fail("Write pipe");
+   hardware_sleep_ms(20);
+   _get_events(&events);
+   if ( (events.iCount != GPIO_INPUT_EVENTS_QUEUE_SIZE) || (events.events[0].uType != GPIO_INPUT_EVENT_PRESS) )
+      _fail("Full queue");
+   if ( gpio_input_get_dropped_events_count() == uDroppedStart )
+      _fail("Dropped events count");
+
+   // Edge source closed
+   close(fd[1]);
+   hardware_sleep_ms(20);
+   gpio_input_stop();
+   close(fd[0]);
+}
+
+int main(int argc, char *argv[])
+{
+   log_init("TestGPIOInput");
+   log_enable_stdout();
+
+   for( int i=1; i<argc; i++ )
+   {
+      if ( 0 == strcmp(argv[i], "-loops") && i < argc-1 )
+         s_iLoops = atoi(argv[++i]);
+   }
+   if ( s_iLoops < 1 )
+      s_iLoops = 1;
+
+   for( int i=0; i<s_iLoops; i++ )
+   {
+      _test_sysfs();
+      _test_stream();
+   }
+
+   if ( s_iFailed )
+   {
+      log_line("Test FAILED");
+      return 1;
+   }
+   log_line("Test PASSED");
+   return 0;
+}
@@ -0,0 +1,446 @@
+#include "../base/base.h"
+#include "../base/i2c_scheduler.h"
+
+// Tests the I2C devices scheduler on a simulated I2C bus (simulated clock, bytes transfer time and
+// devices response times): priorities and batching, deadlines of the RC input device when a slow
+// power sensor is read too, failing devices backoff, multi step reads and invalid responses,
+// reads larger than the messages capacity and devices read with separate transactions.
+// Usage: test_i2c_scheduler [-loops N] (N: times to run the tests)
+
+#define MOCK_BYTE_MICROS 90 // 100 kHz bus
+
+int s_iFailed = 0;
+int s_iLoops = 1;
+
+void _fail(const char* szText)
+{
+   log_line("%s <- FAILED", szText);
+   s_iFailed = 1;
+}
+
+// Simulated bus
+
+typedef struct
+{
+   int iBus;
+   u8 uAddress;
+   u32 uResponseMicros; // for each message
+   int bNack;
+   u8 uRegister;
+   u8 uRegisters[256];
+   u32 uMaxTransactionMsgs; // largest transaction this device was part of
+} t_mock_device;
+
+typedef struct
+{
+   u32 uTimeMicros;
+   int iCountDevices;
+   t_mock_device devices[8];
+   u32 uTransactions;
+   u32 uFailedTransactions;
+   u32 uMaxMsgs;
+   int bPriorityOrderBroken; // the test devices addresses increase with the priority
+} t_mock_bus;
+
+t_mock_bus s_MockBus;
+
+t_mock_device* _mock_find_device(int iBus, u8 uAddress)
+{
+   for( int i=0; i<s_MockBus.iCountDevices; i++ )
+   {
+      if ( (s_MockBus.devices[i].iBus == iBus) && (s_MockBus.devices[i].uAddress == uAddress) )
+         return &s_MockBus.devices[i];
+   }
+   return NULL;
+}
+
+t_mock_device* _mock_add_device(int iBus, u8 uAddress, u32 uResponseMicros)
+{
+   t_mock_device* pDevice = &s_MockBus.devices[s_MockBus.iCountDevices];
+   s_MockBus.iCountDevices++;
+   memset(pDevice, 0, sizeof(t_mock_device));
+   pDevice->iBus = iBus;
+   pDevice->uAddress = uAddress;
+   pDevice->uResponseMicros = uResponseMicros;
+   for( int i=0; i<256; i++ )
+      pDevice->uRegisters[i] = (u8)i;
+   return pDevice;
+}
+
+int _mock_transfer(void* pContext, int iBus, struct i2c_msg* pMsgs, int iCount)
+{
+   s_MockBus.uTransactions++;
+   if ( (u32)iCount > s_MockBus.uMaxMsgs )
+      s_MockBus.uMaxMsgs = iCount;
+
+   for( int i=0; i<iCount; i++ )
+   {
+      if ( (i > 0) && (pMsgs[i].addr < pMsgs[i-1].addr) )
+         s_MockBus.bPriorityOrderBroken = 1;
+      t_mock_device* pDevice = _mock_find_device(iBus, (u8)pMsgs[i].addr);
+      if ( (NULL != pDevice) && ((u32)iCount > pDevice->uMaxTransactionMsgs) )
+         pDevice->uMaxTransactionMsgs = iCount;
+      // Address byte
+      s_MockBus.uTimeMicros += MOCK_BYTE_MICROS;
+      if ( (NULL == pDevice) || pDevice->bNack )
+      {
+         s_MockBus.uFailedTransactions++;
+         return -1;
+      }
+      s_MockBus.uTimeMicros += pDevice->uResponseMicros + MOCK_BYTE_MICROS * pMsgs[i].len;
+      if ( pMsgs[i].flags & I2C_M_RD )
+      {
+         for( int k=0; k<pMsgs[i].len; k++ )
+            pMsgs[i].buf[k] = pDevice->uRegisters[pDevice->uRegister++];
+      }
+      else if ( pMsgs[i].len > 0 )
+      {
+         pDevice->uRegister = pMsgs[i].buf[0];
+         for( int k=1; k<pMsgs[i].len; k++ )
+            pDevice->uRegisters[(u8)(pMsgs[i].buf[0]+k-1)] = pMsgs[i].buf[k];
+      }
+   }
+   return iCount;
+}
+
+u32 _mock_get_time(void* pContext)
+{
+   return s_MockBus.uTimeMicros;
+}
+
+// Test devices: read iRegisters registers of iLength bytes
+
+typedef struct
+{
+   u8 uAddress;
+   int iRegisters;
+   int iLength;
+   int iSteps; // multi step reads
+   int iStep;
+   int iResult; // returned by the result callback
+   u32 uReads;
+   u32 uErrors;
+   u32 uLastTimeMs;
+   int bWrongTime;
+   int bWrongData;
+} t_test_device;
+
+int _build(int iDevice, void* pContext, struct i2c_msg* pMsgs, int iMaxMsgs, u8* pBuffer)
+{
+   t_test_device* pTest = (t_test_device*)pContext;
+   int iOffset = 0;
+   // Oversized reads are still reported with their messages count
+   for( int i=0; i<pTest->iRegisters && 2*i+1 < iMaxMsgs; i++ )
+   {
+      pBuffer[iOffset] = (u8)(0x10*pTest->iStep + i*pTest->iLength);
+      pMsgs[2*i].flags = 0;
+      pMsgs[2*i].len = 1;
+      pMsgs[2*i].buf = &pBuffer[iOffset];
+      pMsgs[2*i+1].flags = I2C_M_RD;
+      pMsgs[2*i+1].len = pTest->iLength;
+      pMsgs[2*i+1].buf = &pBuffer[iOffset+1];
+      iOffset += 1 + pTest->iLength;
+   }
+   return 2*pTest->iRegisters;
+}
+
+int _on_result(int iDevice, void* pContext, u8* pBuffer, u32 uTimeMs)
+{
+   t_test_device* pTest = (t_test_device*)pContext;
+   if ( uTimeMs != s_MockBus.uTimeMicros/1000 )
+      pTest->bWrongTime = 1;
+   int iOffset = 0;
+   for( int i=0; i<pTest->iRegisters; i++ )
+   {
+      for( int k=0; k<pTest->iLength; k++ )
+      {
+         if ( pBuffer[iOffset+1+k] != (u8)(0x10*pTest->iStep + i*pTest->iLength + k) )
+            pTest->bWrongData = 1;
+      }
+      iOffset += 1 + pTest->iLength;
+   }
+   pTest->uLastTimeMs = uTimeMs;
+   if ( pTest->iStep + 1 < pTest->iSteps )
+   {
+      pTest->iStep++;
+      return I2C_SCHEDULER_RESULT_MORE;
+   }
+   pTest->iStep = 0;
+   pTest->uReads++;
+   return pTest->iResult;
+}
+
+void _on_error(int iDevice, void* pContext, u32 uConsecutiveErrors)
+{
+   t_test_device* pTest = (t_test_device*)pContext;
+   pTest->iStep = 0;
+   pTest->uErrors++;
+}
+
+void _init_test_device(t_test_device* pTest, u8 uAddress, int iRegisters, int iLength)
+{
+   memset(pTest, 0, sizeof(t_test_device));
+   pTest->uAddress = uAddress;
+   pTest->iRegisters = iRegisters;
+   pTest->iLength = iLength;
+   pTest->iSteps = 1;
+   pTest->iResult = I2C_SCHEDULER_RESULT_OK;
+}
+
+void _init_mock_bus()
+{
+   memset(&s_MockBus, 0, sizeof(t_mock_bus));
+   s_MockBus.uTimeMicros = 1000000;
+   t_i2c_bus_ops busOps;
+   busOps.pContext = &s_MockBus;
+   busOps.pfTransfer = _mock_transfer;
+   busOps.pfGetTimeMicros = _mock_get_time;
+   i2c_scheduler_init(&busOps);
+}
+
+// Main loop: runs the scheduler, then sleeps till the next deadline
+void _run_for(u32 uMicros)
+{
+   u32 uTimeEnd = s_MockBus.uTimeMicros + uMicros;
+   while ( (int)(s_MockBus.uTimeMicros - uTimeEnd) < 0 )
+   {
+      u32 uWait = i2c_scheduler_run();
+      if ( 0 == uWait )
+         uWait = 100;
+      s_MockBus.uTimeMicros += uWait;
+   }
+}
+
+void _check_device(t_test_device* pTest, const char* szName)
+{
+   if ( pTest->bWrongTime )
+      log_line("%s: wrong read time", szName);
+   if ( pTest->bWrongData )
+      log_line("%s: wrong read data", szName);
+   if ( pTest->bWrongTime || pTest->bWrongData )
+      _fail("Read results");
+}
+
+void _test_priorities()
+{
+   log_line("Priorities and batching...");
+   t_test_device rcIn, buttons, power;
+   _init_mock_bus();
+   _mock_add_device(1, 0x40, 50);
+   _mock_add_device(1, 0x41, 50);
+   _mock_add_device(1, 0x42, 200);
+   _init_test_device(&rcIn, 0x40, 3, 2);
+   _init_test_device(&buttons, 0x41, 1, 5);
+   _init_test_device(&power, 0x42, 2, 2);
+
+   // Added in reverse priority order
+   int iPower = i2c_scheduler_add_device(1, 0x42, I2C_SCHEDULER_PRIORITY_POWER, 300, _build, _on_result, _on_error, &power);
+   int iButtons = i2c_scheduler_add_device(1, 0x41, I2C_SCHEDULER_PRIORITY_BUTTONS, 20, _build, _on_result, _on_error, &buttons);
+   int iRCIn = i2c_scheduler_add_device(1, 0x40, I2C_SCHEDULER_PRIORITY_RC_IN, 20, _build, _on_result, _on_error, &rcIn);
+
+   _run_for(10000000);
+   log_line("RC in: %u reads, buttons: %u reads, power: %u reads, %u transactions", rcIn.uReads, buttons.uReads, power.uReads, s_MockBus.uTransactions);
+   i2c_scheduler_log_stats();
+
+   if ( (rcIn.uReads < 495) || (rcIn.uReads > 505) || (buttons.uReads < 495) || (buttons.uReads > 505) )
+      _fail("Reads count");
+   if ( (power.uReads < 32) || (power.uReads > 35) )
+      _fail("Power reads count");
+   if ( s_MockBus.uTransactions > rcIn.uReads + 5 )
+      _fail("Reads not batched");
+   if ( i2c_scheduler_get_device_stats(iRCIn)->uDeadlineMisses || i2c_scheduler_get_device_stats(iButtons)->uDeadlineMisses || i2c_scheduler_get_device_stats(iPower)->uDeadlineMisses )
+      _fail("Missed deadlines");
+   if ( i2c_scheduler_get_device_stats(iRCIn)->uMaxLatenessMicros > 200 )
+      _fail("RC in read late");
+   if ( s_MockBus.uFailedTransactions != 0 )
+      _fail("Failed transactions");
+   if ( s_MockBus.bPriorityOrderBroken )
+      _fail("Transactions not in priority order");
+   _check_device(&rcIn, "RC in");
+   _check_device(&buttons, "Buttons");
+   _check_device(&power, "Power");
+
+   // The batch starts with the highest priority device: first transaction after the power sensor is due
+   s_MockBus.uTimeMicros += 300000;
+   u32 uTransactions = s_MockBus.uTransactions;
+   u32 uRCInReads = rcIn.uReads;
+   u32 uPowerReads = power.uReads;
+   i2c_scheduler_run();
+   if ( (s_MockBus.uTransactions != uTransactions + 1) || (rcIn.uReads != uRCInReads + 1) || (power.uReads != uPowerReads + 1) )
+      _fail("Due devices not read in one transaction");
+   i2c_scheduler_release();
+}
+
+void _test_deadlines()
+{
+   log_line("RC in deadlines with a slow power sensor...");
+   t_test_device rcIn, power;
+   _init_mock_bus();
+   _mock_add_device(1, 0x40, 50);
+   _mock_add_device(1, 0x42, 6000); // 12 ms for a read
+   _init_test_device(&rcIn, 0x40, 3, 2);
+   _init_test_device(&power, 0x42, 1, 2);
+
+   int iRCIn = i2c_scheduler_add_device(1, 0x40, I2C_SCHEDULER_PRIORITY_RC_IN, 20, _build, _on_result, _on_error, &rcIn);
+   // Not aligned with the RC in deadlines
+   int iPower = i2c_scheduler_add_device(1, 0x42, I2C_SCHEDULER_PRIORITY_POWER, 310, _build, _on_result, _on_error, &power);
+
+   _run_for(10000000);
+   t_i2c_scheduler_device_stats* pRCInStats = i2c_scheduler_get_device_stats(iRCIn);
+   t_i2c_scheduler_device_stats* pPowerStats = i2c_scheduler_get_device_stats(iPower);
+   log_line("RC in: %u reads, max late: %u us; power: %u reads, %u deferred, avg duration: %u us",
+      rcIn.uReads, pRCInStats->uMaxLatenessMicros, power.uReads, pPowerStats->uDeferred, pPowerStats->uAvgDurationMicros);
+
+   if ( rcIn.uReads < 495 )
+      _fail("RC in reads count");
+   if ( pPowerStats->uDeferred == 0 )
+      _fail("Power sensor reads not deferred");
+   if ( power.uReads < 28 )
+      _fail("Power sensor starved");
+   // Only the first power read (duration not known yet) can delay the RC in read
+   if ( pRCInStats->uMaxLatenessMicros > 13000 )
+      _fail("RC in late");
+   u32 uMaxLateness = pRCInStats->uMaxLatenessMicros;
+   pRCInStats->uMaxLatenessMicros = 0;
+   _run_for(5000000);
+   log_line("RC in max late, after the first read: %u us (%u us before)", pRCInStats->uMaxLatenessMicros, uMaxLateness);
+   if ( pRCInStats->uMaxLatenessMicros > 1000 )
+      _fail("RC in late after learning the power sensor read duration");
+   _check_device(&rcIn, "RC in");
+   _check_device(&power, "Power");
+   i2c_scheduler_release();
+}
+
+void _test_backoff()
+{
+   log_line("Failing device backoff...");
+   t_test_device rcIn, buttons;
+   _init_mock_bus();
+   _mock_add_device(1, 0x40, 50);
+   t_mock_device* pMockButtons = _mock_add_device(1, 0x41, 50);
+   _init_test_device(&rcIn, 0x40, 3, 2);
+   _init_test_device(&buttons, 0x41, 1, 5);
+   int iRCIn = i2c_scheduler_add_device(1, 0x40, I2C_SCHEDULER_PRIORITY_RC_IN, 20, _build, _on_result, _on_error, &rcIn);
+   int iButtons = i2c_scheduler_add_device(1, 0x41, I2C_SCHEDULER_PRIORITY_BUTTONS, 20, _build, _on_result, _on_error, &buttons);
+
+   pMockButtons->bNack = 1;
+   _run_for(10000000);
+   t_i2c_scheduler_device_stats* pStats = i2c_scheduler_get_device_stats(iButtons);
+   log_line("RC in: %u reads; failing device: %u errors, backoff: %u ms", rcIn.uReads, buttons.uErrors, pStats->uBackoffMs);
+   if ( rcIn.uReads < 495 )
+      _fail("RC in reads with a failing device on the bus");
+   if ( (buttons.uErrors < 5) || (buttons.uErrors > 12) || (buttons.uReads != 0) )
+      _fail("Failing device reads");
+   if ( pStats->uBackoffMs != I2C_SCHEDULER_MAX_BACKOFF_MS )
+      _fail("Backoff");
+   if ( i2c_scheduler_get_device_stats(iRCIn)->uErrors != 0 )
+      _fail("Errors on the good device");
+
+   // Recovers
+   pMockButtons->bNack = 0;
+   _run_for(I2C_SCHEDULER_MAX_BACKOFF_MS*1000 + 1000000);
+   log_line("Recovered device: %u reads", buttons.uReads);
+   if ( (buttons.uReads < 45) || (pStats->uConsecutiveErrors != 0) || (pStats->uBackoffMs != 0) )
+      _fail("Device recovery");
+
+   // Invalid responses are backed off too, without the bus error callback
+   u32 uErrors = buttons.uErrors;
+   u32 uReads = buttons.uReads;
+   buttons.iResult = I2C_SCHEDULER_RESULT_ERROR;
+   _run_for(5000000);
+   log_line("Invalid responses: %u reads", buttons.uReads - uReads);
+   if ( (pStats->uConsecutiveErrors == 0) || (buttons.uErrors != uErrors) || (buttons.uReads - uReads > 10) )
+      _fail("Invalid responses");
+   _check_device(&rcIn, "RC in");
+   i2c_scheduler_release();
+}
+
+void _test_steps()
+{
+   log_line("Multi step reads...");
+   t_test_device rcIn;
+   _init_mock_bus();
+   _mock_add_device(2, 0x40, 50);
+   _init_test_device(&rcIn, 0x40, 1, 1);
+   rcIn.iSteps = 3;
+   int iRCIn = i2c_scheduler_add_device(2, 0x40, I2C_SCHEDULER_PRIORITY_RC_IN, 20, _build, _on_result, _on_error, &rcIn);
+
+   u32 uTimeStart = s_MockBus.uTimeMicros;
+   i2c_scheduler_run();
+   if ( (rcIn.uReads != 1) || (s_MockBus.uTransactions != 3) )
+      _fail("Steps not read in the same run");
+   _run_for(1000000 - (s_MockBus.uTimeMicros - uTimeStart));
+   log_line("%u reads, %u transactions", rcIn.uReads, s_MockBus.uTransactions);
+   if ( (rcIn.uReads < 49) || (rcIn.uReads > 51) || (s_MockBus.uTransactions != 3*rcIn.uReads) )
+      _fail("Multi step reads period");
+   if ( i2c_scheduler_get_device_stats(iRCIn)->uDeadlineMisses != 0 )
+      _fail("Multi step reads deadlines");
+   _check_device(&rcIn, "RC in");
+   i2c_scheduler_release();
+}
+
+void _test_transfers()
+{
+   log_line("Messages capacity and separate transactions...");
+   t_test_device rcIn, buttons, power;
+   _init_mock_bus();
+   t_mock_device* pMockRCIn = _mock_add_device(1, 0x40, 50);
+   t_mock_device* pMockButtons = _mock_add_device(1, 0x41, 50);
+   _mock_add_device(1, 0x42, 50);
+   _init_test_device(&rcIn, 0x40, 3, 2);
+   _init_test_device(&buttons, 0x41, 2, 1);
+   _init_test_device(&power, 0x42, I2C_SCHEDULER_MAX_DEVICE_MSGS/2 + 1, 2);
+   int iRCIn = i2c_scheduler_add_device(1, 0x40, I2C_SCHEDULER_PRIORITY_RC_IN, 20, _build, _on_result, _on_error, &rcIn);
+   i2c_scheduler_add_device(1, 0x41, I2C_SCHEDULER_PRIORITY_BUTTONS, 20, _build, _on_result, _on_error, &buttons);
+   int iPower = i2c_scheduler_add_device(1, 0x42, I2C_SCHEDULER_PRIORITY_POWER, 100, _build, _on_result, _on_error, &power);
+   i2c_scheduler_set_device_msgs_per_transfer(iRCIn, 2);
+
+   _run_for(2000000);
+   t_i2c_scheduler_device_stats* pPowerStats = i2c_scheduler_get_device_stats(iPower);
+   log_line("RC in: %u reads, largest transaction: %u messages; buttons: %u reads, largest transaction: %u messages; oversized: %u reads, %u errors",
+      rcIn.uReads, pMockRCIn->uMaxTransactionMsgs, buttons.uReads, pMockButtons->uMaxTransactionMsgs, power.uReads, pPowerStats->uErrors);
+   if ( (rcIn.uReads < 99) || (buttons.uReads < 99) )
+      _fail("Reads count");
+   if ( pMockRCIn->uMaxTransactionMsgs != 2 )
+      _fail("Separate transactions");
+   if ( pMockButtons->uMaxTransactionMsgs != 4 )
+      _fail("Device batched with a separate transactions device");
+   if ( (power.uReads != 0) || (pPowerStats->uErrors == 0) || (s_MockBus.uMaxMsgs > I2C_SCHEDULER_MAX_DEVICE_MSGS) )
+      _fail("Oversized read not rejected");
+   if ( s_MockBus.uFailedTransactions != 0 )
+      _fail("Failed transactions");
+   _check_device(&rcIn, "RC in");
+   _check_device(&buttons, "Buttons");
+   i2c_scheduler_release();
+}
+
+int main(int argc, char *argv[])
+{
+   log_init("TestI2CScheduler");
+   log_enable_stdout();
+
+   for( int i=1; i<argc; i++ )
+   {
+      if ( 0 == strcmp(argv[i], "-loops") && i < argc-1 )
+         s_iLoops = atoi(argv[++i]);
+   }
+   if ( s_iLoops < 1 )
+      s_iLoops = 1;
+
+   for( int i=0; i<s_iLoops; i++ )
+   {
+      _test_priorities();
+      _test_deadlines();
+      _test_backoff();
+      _test_steps();
+      _test_transfers();
+   }
+
+   if ( s_iFailed )
+   {
+      log_line("Test FAILED");
+      return 1;
+   }
+   log_line("Test PASSED");
+   return 0;
+}
@@ -0,0 +1,217 @@
+#define FEATURE_LATENCY_TRACE 1
+
+#include "../base/base.h"
+#include "../base/config.h"
+#include "../base/latency_trace.h"
+#include "../radio/fec.h"
+
+// Checks the latency trace histograms (buckets, percentiles) and measures the tracing
+// overhead on a synthetic FEC encode/decode workload, same trace points as the routers use.
+// Usage: test_latency_trace [-blocks N] [-block d,f] [-packet N]
+
+int s_iBlocks = 20000;
+int s_iDataPackets = 8;
+int s_iFECPackets = 4;
+int s_iPacketLength = 1024;
+u32 s_uFECErrors = 0;
+
+#define MAX_PACKETS 64
+
+int _check_buckets()
+{
+   int iResult = 0;
+   for( u32 u=0; u<100000; u++ )
+   {
+      int iBucket = latency_trace_bucket_for_value(u);
+      if ( iBucket < 0 || iBucket >= LATENCY_TRACE_BUCKETS )
+      {
+         log_line("FAILED: value %u is in invalid bucket %d", u, iBucket);
+         return 1;
+      }
+      if ( u > latency_trace_bucket_upper_value(iBucket) )
+         iResult = 1;
+      if ( iBucket > 0 && u <= latency_trace_bucket_upper_value(iBucket-1) )
+         iResult = 1;
+   }
+   if ( latency_trace_bucket_for_value(MAX_U32) != LATENCY_TRACE_BUCKETS-1 )
+      iResult = 1;
+   if ( iResult )
+      log_line("FAILED: bucket bounds are not consistent.");
+   return iResult;
+}
+
+// Percentile values are bucket upper bounds, so allow for the bucket width (25% of the value)
+int _check_value(const char* szName, u32 uValue, u32 uExpected)
+{
+   bool bOk = (uValue >= uExpected) && (uValue <= uExpected + uExpected/4 + 1);
+   log_line("%s: %u, expected %u %s", szName, uValue, uExpected, bOk?"":"<- FAILED");
+   return bOk?0:1;
+}
+
+int _check_percentiles()
+{
+   int iResult = 0;
+
+   // Uniform 1..10000 ns
+   latency_trace_reset();
+   for( u32 u=1; u<=10000; u++ )
+      latency_trace_add_sample(0, u);
+   t_latency_trace_histogram* pHistogram = &(latency_trace_get_local_data()->stages[0]);
+   if ( pHistogram->uCount != 10000 || pHistogram->uMaxNanos != 10000 )
+      iResult = 1;
+   iResult |= _check_value("Uniform p50", latency_trace_get_percentile(pHistogram, 50.0), 5000);
+   iResult |= _check_value("Uniform p99", latency_trace_get_percentile(pHistogram, 99.0), 9900);
+   iResult |= _check_value("Uniform p100", latency_trace_get_percentile(pHistogram, 100.0), 10000);
+
+   // Long tail: 990 samples at 2 us, 10 samples at 1 ms
+   latency_trace_reset();
+   for( int i=0; i<990; i++ )
+      latency_trace_add_sample(1, 2000);
+   for( int i=0; i<10; i++ )
+      latency_trace_add_sample(1, 1000000);
+   pHistogram = &(latency_trace_get_local_data()->stages[1]);
+   iResult |= _check_value("Tail p50", latency_trace_get_percentile(pHistogram, 50.0), 2000);
+   iResult |= _check_value("Tail p99", latency_trace_get_percentile(pHistogram, 99.0), 2000);
+   iResult |= _check_value("Tail p99.5", latency_trace_get_percentile(pHistogram, 99.5), 1000000);
+   if ( (u32)(pHistogram->dTotalNanos/pHistogram->uCount) != 11980 )
+      iResult = 1;
+
+   // Out of range stages are ignored
+   latency_trace_add_sample(-1, 10);
+   latency_trace_add_sample(LATENCY_TRACE_STAGES_COUNT, 10);
+   if ( latency_trace_get_local_data()->uTotalSamples != 1000 )
+      iResult = 1;
+
+   latency_trace_reset();
+   if ( iResult )
+      log_line("FAILED: percentiles on known distributions.");
+   return iResult;
+}
+
+u32 _run_fec_workload(bool bTrace)
+{
+   u8* pDataPackets[MAX_PACKETS];
+   u8* pFECPackets[MAX_PACKETS];
+   u8* pDecodeFECPackets[MAX_PACKETS];
+   unsigned int uFECIndexes[MAX_PACKETS];
+   unsigned int uMissingIndexes[MAX_PACKETS];
+
+   for( int i=0; i<s_iDataPackets; i++ )
+      pDataPackets[i] = (u8*)malloc(s_iPacketLength);
+   for( int i=0; i<s_iFECPackets; i++ )
+      pFECPackets[i] = (u8*)malloc(s_iPacketLength);
+
+   u32 uErrors = 0;
+   u32 uStart = latency_trace_now_nanos();
+   for( int iBlock=0; iBlock<s_iBlocks; iBlock++ )
+   {
+      for( int i=0; i<s_iDataPackets; i++ )
+         memset(pDataPackets[i], (u8)(iBlock+i), s_iPacketLength);
+
+      if ( bTrace )
+      {
+         LATENCY_TRACE_BEGIN(uTraceEncode);
+         fec_encode(s_iPacketLength, pDataPackets, s_iDataPackets, pFECPackets, s_iFECPackets);
+         LATENCY_TRACE_END(LATENCY_TRACE_STAGE_VEHICLE_FEC_ENCODE, uTraceEncode);
+      }
+      else
+         fec_encode(s_iPacketLength, pDataPackets, s_iDataPackets, pFECPackets, s_iFECPackets);
+
+      // Lose as many data packets as there are FEC packets, then rebuild them (missing indexes must be in order)
+      int iMissing = s_iFECPackets;
+      for( int i=0; i<iMissing; i++ )
+      {
+         uMissingIndexes[i] = (iBlock % (s_iDataPackets - iMissing + 1)) + i;
+         memset(pDataPackets[uMissingIndexes[i]], 0, s_iPacketLength);
+         uFECIndexes[i] = i;
+         pDecodeFECPackets[i] = pFECPackets[i];
+      }
+      if ( bTrace )
+      {
+         LATENCY_TRACE_BEGIN(uTraceDecode);
+         fec_decode(s_iPacketLength, pDataPackets, s_iDataPackets, pDecodeFECPackets, uFECIndexes, uMissingIndexes, iMissing);
+         LATENCY_TRACE_END(LATENCY_TRACE_STAGE_STATION_RECONSTRUCT_BLOCK, uTraceDecode);
+      }
+      else
+         fec_decode(s_iPacketLength, pDataPackets, s_iDataPackets, pDecodeFECPackets, uFECIndexes, uMissingIndexes, iMissing);
+
+      for( int i=0; i<iMissing; i++ )
+         if ( pDataPackets[uMissingIndexes[i]][s_iPacketLength-1] != (u8)(iBlock+uMissingIndexes[i]) )
+            uErrors++;
+   }
+   u32 uTime = latency_trace_now_nanos() - uStart;
+
+   for( int i=0; i<s_iDataPackets; i++ )
+      free(pDataPackets[i]);
+   for( int i=0; i<s_iFECPackets; i++ )
+      free(pFECPackets[i]);
+
+   if ( uErrors > 0 )
+      log_line("FAILED: %u packets were not reconstructed correctly.", uErrors);
+   s_uFECErrors += uErrors;
+   return uTime;
+}
+
+int main(int argc, char *argv[])
+{
+   log_init("TestLatencyTrace");
+   log_enable_stdout();
+
+   for( int i=1; i<argc; i++ )
+   {
+      if ( 0 == strcmp(argv[i], "-blocks") && i < argc-1 )
+         s_iBlocks = atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-block") && i < argc-1 )
+         sscanf(argv[++i], "%d,%d", &s_iDataPackets, &s_iFECPackets);
+      else if ( 0 == strcmp(argv[i], "-packet") && i < argc-1 )
+         s_iPacketLength = atoi(argv[++i]);
+   }
+   if ( s_iDataPackets < 1 || s_iDataPackets > MAX_PACKETS/2 || s_iFECPackets < 1 || s_iFECPackets > s_iDataPackets )
+   {
+      log_line("Invalid block scheme %d/%d", s_iDataPackets, s_iFECPackets);
+      return 1;
+   }
+
+   int iResult = 0;
+   iResult |= _check_buckets();
+
+   // Local only, no shared memory
+   latency_trace_init(NULL);
+   iResult |= _check_percentiles();
+
+   fec_init();
+   _run_fec_workload(false);
+   u32 uTimeNoTrace = _run_fec_workload(false);
+   latency_trace_reset();
+   u32 uTimeTrace = _run_fec_workload(true);
+
+   shared_mem_latency_trace* pData = latency_trace_get_local_data();
+   for( int i=0; i<LATENCY_TRACE_STAGES_COUNT; i++ )
+   {
+      t_latency_trace_histogram* pHistogram = &(pData->stages[i]);
+      if ( 0 == pHistogram->uCount )
+         continue;
+      log_line("%-20s count: %u, avg: %.1f us, p50: %.1f us, p99: %.1f us, max: %.1f us", latency_trace_get_stage_name(i), pHistogram->uCount,
+         pHistogram->dTotalNanos/pHistogram->uCount/1000.0,
+         latency_trace_get_percentile(pHistogram, 50.0)/1000.0,
+         latency_trace_get_percentile(pHistogram, 99.0)/1000.0,
+         pHistogram->uMaxNanos/1000.0);
+   }
+
+   // The wall clock difference between the two runs is mostly noise at this scale,
+   // so the pass criteria uses the calibrated cost of a trace point.
+   double dOverheadPercent = 100.0 * (double)pData->uTotalSamples * (double)pData->uSampleCostNanos / (double)uTimeTrace;
+   log_line("%d blocks of %d/%d x %d bytes: %.1f ms without tracing, %.1f ms with tracing.", s_iBlocks, s_iDataPackets, s_iFECPackets, s_iPacketLength, uTimeNoTrace/1000000.0, uTimeTrace/1000000.0);
+   log_line("%u trace points at %u ns each, overhead: %.3f%%", pData->uTotalSamples, pData->uSampleCostNanos, dOverheadPercent);
+   if ( s_uFECErrors > 0 )
+      iResult = 1;
+   if ( dOverheadPercent >= 1.0 )
+   {
+      log_line("FAILED: tracing overhead is over 1%%");
+      iResult = 1;
+   }
+
+   latency_trace_uninit();
+   log_line(iResult?"FAILED":"PASSED");
+   return iResult;
+}
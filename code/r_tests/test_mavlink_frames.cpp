@@ -0,0 +1,260 @@
+#include "../base/base.h"
+#include "../common/mavlink_frames.h"
+
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+// Compares the block MAVLink frame extractor with the per char mavlink_parse_char path.
+// Usage: test_mavlink_frames [captured_mavlink_stream.bin] [-chunk N] [-loops N] [-save file]
+// With no input file, a synthetic stream (mixed messages with line noise) is generated,
+// and a clean synthetic stream is used to check both parsers find exactly the same frames.
+
+u8* s_pStream = NULL;
+int s_iStreamLength = 0;
+int s_iChunkSize = 270;
+int s_iLoops = 20;
+
+u32 s_uDispatchedIds[4];
+u32 s_uCharParserMsgIdSum = 0;
+u32 s_uExtractorMsgIdSum = 0;
+
+mavlink_message_t s_MsgDecoded;
+
+void _generate_stream(bool bAddNoise)
+{
+   int iMaxLength = 4*1024*1024;
+   s_pStream = (u8*)malloc(iMaxLength);
+   s_iStreamLength = 0;
+   srand(1234);
+
+   mavlink_message_t msg;
+   u8 buffer[MAVLINK_MAX_PACKET_LEN];
+   u8 uSeq = 0;
+   while ( s_iStreamLength < iMaxLength - 2*MAVLINK_MAX_PACKET_LEN )
+   {
+      switch ( rand() % 8 )
+      {
+         case 0: mavlink_msg_heartbeat_pack(1, 1, &msg, MAV_TYPE_QUADROTOR, MAV_AUTOPILOT_ARDUPILOTMEGA, 0, 5, MAV_STATE_ACTIVE); break;
+         case 1: mavlink_msg_attitude_pack(1, 1, &msg, uSeq*10, 0.1f, 0.2f, 0.3f, 0.01f, 0.02f, 0.03f); break;
+         case 2: mavlink_msg_global_position_int_pack(1, 1, &msg, uSeq*10, 450000000, 250000000, 100000, 50000, 10, 20, 30, 9000); break;
+         case 3: mavlink_msg_vfr_hud_pack(1, 1, &msg, 12.0f, 13.0f, 90, 50, 100.0f, 1.0f); break;
+         case 4: mavlink_msg_raw_imu_pack(1, 1, &msg, uSeq, 1, 2, 3, 4, 5, 6, 7, 8, 9); break;
+         case 5: mavlink_msg_scaled_imu2_pack(1, 1, &msg, uSeq, 1, 2, 3, 4, 5, 6, 7, 8, 9); break;
+         case 6: mavlink_msg_servo_output_raw_pack(1, 1, &msg, uSeq, 0, 1500, 1500, 1500, 1500, 1000, 1000, 1000, 1000, 0, 0, 0, 0, 0, 0, 0, 0); break;
+         default: mavlink_msg_sys_status_pack(1, 1, &msg, 0, 0, 0, 500, 12000, 1500, 80, 0, 0, 0, 0, 0, 0); break;
+      }
+      uSeq++;
+      int iLen = mavlink_msg_to_send_buffer(buffer, &msg);
+      memcpy(s_pStream + s_iStreamLength, buffer, iLen);
+      s_iStreamLength += iLen;
+
+      // Some line noise, including fake STX bytes
+      if ( bAddNoise && ((rand() % 50) == 0) )
+      {
+         int iNoise = 1 + rand() % 20;
+         for( int i=0; i<iNoise; i++ )
+            s_pStream[s_iStreamLength++] = ((rand()%4) == 0)?MAVLINK_STX:(u8)rand();
+      }
+   }
+}
+
+bool _load_stream(const char* szFile)
+{
+   FILE* fd = fopen(szFile, "rb");
+   if ( NULL == fd )
+      return false;
+   fseek(fd, 0, SEEK_END);
+   long lSize = ftell(fd);
+   fseek(fd, 0, SEEK_SET);
+   if ( lSize <= 0 )
+   {
+      fclose(fd);
+      return false;
+   }
+   s_pStream = (u8*)malloc(lSize);
+   s_iStreamLength = fread(s_pStream, 1, lSize, fd);
+   fclose(fd);
+   return s_iStreamLength > 0;
+}
+
+double _get_cpu_time_ms()
+{
+   struct rusage usage;
+   getrusage(RUSAGE_SELF, &usage);
+   return usage.ru_utime.tv_sec*1000.0 + usage.ru_utime.tv_usec/1000.0 + usage.ru_stime.tv_sec*1000.0 + usage.ru_stime.tv_usec/1000.0;
+}
+
+double _get_wall_time_ms()
+{
+   struct timeval tv;
+   gettimeofday(&tv, NULL);
+   return tv.tv_sec*1000.0 + tv.tv_usec/1000.0;
+}
+
+u32 run_char_parser()
+{
+   mavlink_message_t msg;
+   mavlink_status_t status;
+   memset(&status, 0, sizeof(status));
+   u32 uFrames = 0;
+   for( int iPos=0; iPos<s_iStreamLength; iPos += s_iChunkSize )
+   {
+      int iLen = s_iStreamLength - iPos;
+      if ( iLen > s_iChunkSize )
+         iLen = s_iChunkSize;
+      for( int i=0; i<iLen; i++ )
+      {
+         if ( mavlink_parse_char(MAVLINK_COMM_1, s_pStream[iPos+i], &msg, &status) )
+         {
+            uFrames++;
+            s_uCharParserMsgIdSum += msg.msgid + msg.seq;
+         }
+      }
+   }
+   return uFrames;
+}
+
+void _on_frame(const u8* pFrame, int iFrameLength, u32 uMsgId, void* pContext)
+{
+   mavlink_frames_to_message(pFrame, iFrameLength, &s_MsgDecoded);
+   s_uExtractorMsgIdSum += s_MsgDecoded.msgid + s_MsgDecoded.seq;
+}
+
+u32 run_extractor(t_mavlink_frame_extractor* pExtractor)
+{
+   u32 uFrames = 0;
+   for( int iPos=0; iPos<s_iStreamLength; iPos += s_iChunkSize )
+   {
+      int iLen = s_iStreamLength - iPos;
+      if ( iLen > s_iChunkSize )
+         iLen = s_iChunkSize;
+      uFrames += mavlink_frames_parse(pExtractor, s_pStream + iPos, iLen, NULL);
+   }
+   return uFrames;
+}
+
+int main(int argc, char *argv[])
+{
+   log_init_local_only("TestMAVLinkFrames");
+   log_enable_stdout();
+
+   const char* szInputFile = NULL;
+   const char* szSaveFile = NULL;
+   for( int i=1; i<argc; i++ )
+   {
+      if ( 0 == strcmp(argv[i], "-chunk") && i < argc-1 )
+         s_iChunkSize = atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-loops") && i < argc-1 )
+         s_iLoops = atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-save") && i < argc-1 )
+         szSaveFile = argv[++i];
+      else
+         szInputFile = argv[i];
+   }
+   if ( s_iChunkSize < 1 )
+      s_iChunkSize = 1;
+   if ( s_iLoops < 1 )
+      s_iLoops = 1;
+
+   if ( NULL != szInputFile )
+   {
+      if ( ! _load_stream(szInputFile) )
+      {
+         log_line("Can't read input stream file %s", szInputFile);
+         return 1;
+      }
+      log_line("Loaded %d bytes from %s", s_iStreamLength, szInputFile);
+   }
+   else
+   {
+      _generate_stream(true);
+      log_line("Generated synthetic stream of %d bytes", s_iStreamLength);
+      if ( NULL != szSaveFile )
+      {
+         FILE* fd = fopen(szSaveFile, "wb");
+         if ( NULL != fd )
+         {
+            fwrite(s_pStream, 1, s_iStreamLength, fd);
+            fclose(fd);
+         }
+      }
+   }
+
+   int iResult = 0;
+   t_mavlink_frame_extractor extractor;
+
+   // Correctness on a clean stream: both parsers must find exactly the same frames
+   if ( NULL == szInputFile )
+   {
+      u8* pNoisyStream = s_pStream;
+      int iNoisyLength = s_iStreamLength;
+      _generate_stream(false);
+      mavlink_frames_init(&extractor);
+      mavlink_frames_set_default_handler(&extractor, _on_frame);
+      u32 uFramesChar = run_char_parser();
+      u32 uFramesBlock = run_extractor(&extractor);
+      log_line("Clean stream frames: per char parser: %u, block extractor: %u", uFramesChar, uFramesBlock);
+      if ( uFramesChar != uFramesBlock || s_uCharParserMsgIdSum != s_uExtractorMsgIdSum )
+      {
+         log_line("FAILED: parsers disagree on clean stream (ids checksum %u / %u)", s_uCharParserMsgIdSum, s_uExtractorMsgIdSum);
+         iResult = 1;
+      }
+      free(s_pStream);
+      s_pStream = pNoisyStream;
+      s_iStreamLength = iNoisyLength;
+   }
+
+   // On a noisy stream the extractor rescans after a false STX, so it must find at least as many frames
+   mavlink_frames_init(&extractor);
+   mavlink_frames_set_default_handler(&extractor, _on_frame);
+   u32 uFramesChar = run_char_parser();
+   u32 uFramesBlock = run_extractor(&extractor);
+   log_line("Frames found: per char parser: %u, block extractor: %u (bad CRC: %u, unknown ids: %u, discarded bytes: %u)",
+      uFramesChar, uFramesBlock, extractor.uFramesBadCRC, extractor.uFramesUnknownId, extractor.uBytesDiscarded);
+   if ( uFramesBlock < uFramesChar )
+   {
+      log_line("FAILED: block extractor lost frames");
+      iResult = 1;
+   }
+
+   // Benchmark
+   double dCpu = _get_cpu_time_ms();
+   double dWall = _get_wall_time_ms();
+   u32 uTotal = 0;
+   for( int i=0; i<s_iLoops; i++ )
+      uTotal += run_char_parser();
+   double dCpuChar = _get_cpu_time_ms() - dCpu;
+   double dWallChar = _get_wall_time_ms() - dWall;
+
+   dCpu = _get_cpu_time_ms();
+   dWall = _get_wall_time_ms();
+   for( int i=0; i<s_iLoops; i++ )
+      run_extractor(&extractor);
+   double dCpuBlock = _get_cpu_time_ms() - dCpu;
+   double dWallBlock = _get_wall_time_ms() - dWall;
+
+   // Filtered: only the few messages the OSD decodes have handlers
+   t_mavlink_frame_extractor extractorFiltered;
+   mavlink_frames_init(&extractorFiltered);
+   mavlink_frames_set_handler(&extractorFiltered, MAVLINK_MSG_ID_HEARTBEAT, _on_frame);
+   mavlink_frames_set_handler(&extractorFiltered, MAVLINK_MSG_ID_GLOBAL_POSITION_INT, _on_frame);
+   mavlink_frames_set_handler(&extractorFiltered, MAVLINK_MSG_ID_VFR_HUD, _on_frame);
+   mavlink_frames_set_handler(&extractorFiltered, MAVLINK_MSG_ID_ATTITUDE, _on_frame);
+   mavlink_frames_set_handler(&extractorFiltered, MAVLINK_MSG_ID_SYS_STATUS, _on_frame);
+   dCpu = _get_cpu_time_ms();
+   dWall = _get_wall_time_ms();
+   for( int i=0; i<s_iLoops; i++ )
+      run_extractor(&extractorFiltered);
+   double dCpuFiltered = _get_cpu_time_ms() - dCpu;
+   double dWallFiltered = _get_wall_time_ms() - dWall;
+
+   double dMB = (double)s_iStreamLength * s_iLoops / (1024.0*1024.0);
+   log_line("Chunk size: %d bytes, %d loops, %.1f MB parsed per run", s_iChunkSize, s_iLoops, dMB);
+   log_line("Per char parser:  %.1f ms CPU, %.1f ms wall, %.0f frames/sec", dCpuChar, dWallChar, uTotal*1000.0/dWallChar);
+   log_line("Block extractor:  %.1f ms CPU, %.1f ms wall, %.0f frames/sec", dCpuBlock, dWallBlock, uTotal*1000.0/dWallBlock);
+   log_line("Block + filter:   %.1f ms CPU, %.1f ms wall, %.0f frames/sec (%u dispatched, %u filtered)", dCpuFiltered, dWallFiltered, uTotal*1000.0/dWallFiltered, extractorFiltered.uFramesDispatched, extractorFiltered.uFramesFiltered);
+
+   log_line(iResult?"FAILED":"PASSED");
+   return iResult;
+}
@@ -0,0 +1,423 @@
+#include "../base/base.h"
+#include "../base/config.h"
+#include "../base/hardware.h"
+#include "../base/hw_procs.h"
+#include "../base/models.h"
+
+#include <time.h>
+#include <sys/time.h>
+#include <new>
+
+// Round trip test for the binary model store:
+// loads each text model file given on the command line, converts it to the binary format,
+// loads it back and compares it field by field. Then benchmarks text vs binary vs shared store loads.
+// Usage: test_model_store [-iterations N] model1.mdl [model2.mdl ...]
+// With no model file, a default model is generated and used, along with older model fixtures made from it:
+// text models saved by older builds (without the newest extra lines) and an older binary schema.
+
+#define TEST_TEXT_FILE "tmp/test_model_store.mdl"
+
+int s_iFailedChecks = 0;
+
+void _check_bytes(const char* szName, const void* p1, const void* p2, int iSize)
+{
+   if ( 0 == memcmp(p1, p2, iSize) )
+      return;
+   const u8* pB1 = (const u8*)p1;
+   const u8* pB2 = (const u8*)p2;
+   int iOffset = 0;
+   while ( iOffset < iSize && pB1[iOffset] == pB2[iOffset] )
+      iOffset++;
+   log_softerror_and_alarm("Field [%s] differs (first difference at byte %d of %d).", szName, iOffset, iSize);
+   s_iFailedChecks++;
+}
+
+#define CHECK_FIELD(f) _check_bytes(#f, &(pText->f), &(pBinary->f), sizeof(pText->f))
+
+// Strings are compared up to the terminator: the bytes after it are whatever was in the buffer before
+void _check_string(const char* szName, const char* sz1, const char* sz2, int iSize)
+{
+   if ( 0 == strncmp(sz1, sz2, iSize) )
+      return;
+   log_softerror_and_alarm("Field [%s] differs: [%.*s] / [%.*s].", szName, iSize, sz1, iSize, sz2);
+   s_iFailedChecks++;
+}
+
+void _check_camera_value(const char* szName, int iCamera, int iProfile, double dValue1, double dValue2)
+{
+   if ( dValue1 == dValue2 )
+      return;
+   log_softerror_and_alarm("Field [camera %d, profile %d: %s] differs: %g / %g.", iCamera, iProfile, szName, dValue1, dValue2);
+   s_iFailedChecks++;
+}
+
+#define CHECK_PROFILE_FIELD(f) _check_camera_value(#f, i, k, (double)pProfileText->f, (double)pProfileBinary->f)
+
+// Cameras are compared field by field: the camera profiles have padding bytes (after drc)
+// that are not loaded from the text model, so they can differ between two models
+void compare_cameras(Model* pText, Model* pBinary)
+{
+   for( int i=0; i<MODEL_MAX_CAMERAS; i++ )
+   {
+      type_camera_parameters* pCamText = &(pText->camera_params[i]);
+      type_camera_parameters* pCamBinary = &(pBinary->camera_params[i]);
+      _check_camera_value("iCurrentProfile", i, -1, pCamText->iCurrentProfile, pCamBinary->iCurrentProfile);
+      _check_camera_value("iCameraType", i, -1, pCamText->iCameraType, pCamBinary->iCameraType);
+      _check_camera_value("iForcedCameraType", i, -1, pCamText->iForcedCameraType, pCamBinary->iForcedCameraType);
+      _check_string("szCameraName", pCamText->szCameraName, pCamBinary->szCameraName, MAX_CAMERA_NAME_LENGTH);
+
+      for( int k=0; k<MODEL_CAMERA_PROFILES; k++ )
+      {
+         camera_profile_parameters_t* pProfileText = &(pCamText->profiles[k]);
+         camera_profile_parameters_t* pProfileBinary = &(pCamBinary->profiles[k]);
+         CHECK_PROFILE_FIELD(flags);
+         CHECK_PROFILE_FIELD(flip_image);
+         CHECK_PROFILE_FIELD(brightness);
+         CHECK_PROFILE_FIELD(contrast);
+         CHECK_PROFILE_FIELD(saturation);
+         CHECK_PROFILE_FIELD(sharpness);
+         CHECK_PROFILE_FIELD(exposure);
+         CHECK_PROFILE_FIELD(whitebalance);
+         CHECK_PROFILE_FIELD(metering);
+         CHECK_PROFILE_FIELD(drc);
+         CHECK_PROFILE_FIELD(analogGain);
+         CHECK_PROFILE_FIELD(awbGainB);
+         CHECK_PROFILE_FIELD(awbGainR);
+         CHECK_PROFILE_FIELD(fovV);
+         CHECK_PROFILE_FIELD(fovH);
+         CHECK_PROFILE_FIELD(vstab);
+         CHECK_PROFILE_FIELD(ev);
+         CHECK_PROFILE_FIELD(iso);
+         CHECK_PROFILE_FIELD(shutterspeed);
+         CHECK_PROFILE_FIELD(wdr);
+         CHECK_PROFILE_FIELD(dayNightMode);
+      }
+   }
+}
+
+void compare_models(Model* pText, Model* pBinary)
+{
+   CHECK_FIELD(bDeveloperMode);
+   CHECK_FIELD(uDeveloperFlags);
+   CHECK_FIELD(uModelFlags);
+   CHECK_FIELD(board_type);
+   _check_string("vehicle_name", pText->vehicle_name, pBinary->vehicle_name, MAX_VEHICLE_NAME_LENGTH);
+   CHECK_FIELD(vehicle_id);
+   CHECK_FIELD(controller_id);
+   CHECK_FIELD(sw_version);
+   CHECK_FIELD(is_spectator);
+   CHECK_FIELD(vehicle_type);
+   CHECK_FIELD(clock_sync_type);
+   CHECK_FIELD(alarms);
+   CHECK_FIELD(enableDHCP);
+   CHECK_FIELD(camera_rc_channels);
+   CHECK_FIELD(enc_flags);
+   CHECK_FIELD(iGPSCount);
+   CHECK_FIELD(niceRC);
+   CHECK_FIELD(niceRouter);
+   CHECK_FIELD(ioNiceRouter);
+   CHECK_FIELD(niceTelemetry);
+   CHECK_FIELD(niceVideo);
+   CHECK_FIELD(niceOthers);
+   CHECK_FIELD(ioNiceVideo);
+   CHECK_FIELD(iOverVoltage);
+   CHECK_FIELD(iFreqARM);
+   CHECK_FIELD(iFreqGPU);
+   CHECK_FIELD(iCameraCount);
+   CHECK_FIELD(iCurrentCamera);
+   CHECK_FIELD(hardware_info);
+   CHECK_FIELD(radioInterfacesParams);
+   CHECK_FIELD(radioLinksParams);
+   compare_cameras(pText, pBinary);
+   CHECK_FIELD(video_params);
+   CHECK_FIELD(video_link_profiles);
+   CHECK_FIELD(osd_params);
+   CHECK_FIELD(rc_params);
+   CHECK_FIELD(telemetry_params);
+   CHECK_FIELD(audio_params);
+   CHECK_FIELD(functions_params);
+   CHECK_FIELD(relay_params);
+   CHECK_FIELD(alarms_params);
+   CHECK_FIELD(m_Stats);
+
+   if ( pText->getSaveCount() != pBinary->getSaveCount() )
+   {
+      log_softerror_and_alarm("Save count differs: %d / %d", pText->getSaveCount(), pBinary->getSaveCount());
+      s_iFailedChecks++;
+   }
+}
+
+// A model built in zeroed memory: the structs padding is never loaded from a text model,
+// so the compared models must start with the same (zero) padding bytes
+class ZeroedModel
+{
+   public:
+      ZeroedModel() { memset(m_uMemory, 0, sizeof(m_uMemory)); m_pModel = new (m_uMemory) Model(); }
+      ~ZeroedModel() { m_pModel->~Model(); }
+      Model& get() { return *m_pModel; }
+
+   private:
+      alignas(Model) u8 m_uMemory[sizeof(Model)];
+      Model* m_pModel;
+};
+
+u32 _get_time_us()
+{
+   struct timeval tv;
+   gettimeofday(&tv, NULL);
+   return (u32)(tv.tv_sec*1000000 + tv.tv_usec);
+}
+
+// Older binary schema fixture: video link profiles without their last field (bitrate_fixed_bps)
+// and only the first two cameras. Rewrites the sections of a binary model buffer that way.
+int _make_older_binary_model(const u8* pBuffer, u8* pOutput)
+{
+   t_model_binary_header header;
+   memcpy((u8*)&header, pBuffer, sizeof(t_model_binary_header));
+   int iPos = sizeof(t_model_binary_header);
+   int iOutputPos = sizeof(t_model_binary_header);
+   for( u32 u=0; u<header.uSectionsCount; u++ )
+   {
+      t_model_binary_section_header section;
+      memcpy((u8*)&section, pBuffer + iPos, sizeof(t_model_binary_section_header));
+      iPos += sizeof(t_model_binary_section_header);
+      const u8* pData = pBuffer + iPos;
+      iPos += section.uElementSize * section.uElementsCount;
+
+      u32 uSize = section.uElementSize;
+      u32 uCount = section.uElementsCount;
+      if ( section.uSectionId == MODEL_BINARY_SECTION_VIDEO_PROFILES )
+         uSize -= sizeof(u32);
+      if ( section.uSectionId == MODEL_BINARY_SECTION_CAMERAS )
+         uCount = 2;
+      u8* pOutputData = pOutput + iOutputPos + sizeof(t_model_binary_section_header);
+      for( u32 i=0; i<uCount; i++ )
+         memcpy(pOutputData + i*uSize, pData + i*section.uElementSize, uSize);
+      section.uElementSize = uSize;
+      section.uElementsCount = uCount;
+      section.uCRC = base_compute_crc32(pOutputData, uSize*uCount);
+      memcpy(pOutput + iOutputPos, (u8*)&section, sizeof(t_model_binary_section_header));
+      iOutputPos += sizeof(t_model_binary_section_header) + uSize*uCount;
+   }
+   header.uTotalLength = iOutputPos;
+   header.uHeaderCRC = base_compute_crc32((u8*)&header, sizeof(t_model_binary_header) - sizeof(u32));
+   memcpy(pOutput, (u8*)&header, sizeof(t_model_binary_header));
+   return iOutputPos;
+}
+
+// Loading the older schema must copy the stored part of each element and keep the current values
+// for the missing fields and elements
+void test_older_binary_model(Model& modelText, const u8* pBuffer, int iLength)
+{
+   u8* pOlder = (u8*)malloc(MODEL_BINARY_MAX_SIZE);
+   int iOlderLength = _make_older_binary_model(pBuffer, pOlder);
+
+   ZeroedModel zeroedOlder;
+   Model& modelOlder = zeroedOlder.get();
+   modelOlder.loadFromBinaryBuffer(pBuffer, iLength, true);
+   for( int i=0; i<MAX_VIDEO_LINK_PROFILES; i++ )
+      modelOlder.video_link_profiles[i].bitrate_fixed_bps = 1000000 + i;
+   for( int i=2; i<MODEL_MAX_CAMERAS; i++ )
+      modelOlder.camera_params[i].iForcedCameraType = 77;
+
+   if ( ! modelOlder.loadFromBinaryBuffer(pOlder, iOlderLength, true) )
+   {
+      log_softerror_and_alarm("Failed to load the older binary schema model.");
+      s_iFailedChecks++;
+      free(pOlder);
+      return;
+   }
+   log_line("Loaded older binary schema model (%d bytes).", iOlderLength);
+
+   for( int i=0; i<MAX_VIDEO_LINK_PROFILES; i++ )
+   {
+      _check_bytes("older video_link_profiles", &(modelText.video_link_profiles[i]), &(modelOlder.video_link_profiles[i]), sizeof(type_video_link_profile) - sizeof(u32));
+      if ( modelOlder.video_link_profiles[i].bitrate_fixed_bps != (u32)(1000000 + i) )
+      {
+         log_softerror_and_alarm("Video link profile %d field missing from the older schema was overwritten.", i);
+         s_iFailedChecks++;
+      }
+   }
+   for( int i=0; i<MODEL_MAX_CAMERAS; i++ )
+   {
+      int iExpected = (i < 2)?modelText.camera_params[i].iForcedCameraType:77;
+      if ( modelOlder.camera_params[i].iForcedCameraType != iExpected )
+      {
+         log_softerror_and_alarm("Camera %d loaded wrong from the older schema (forced type: %d, expected %d).", i, modelOlder.camera_params[i].iForcedCameraType, iExpected);
+         s_iFailedChecks++;
+      }
+   }
+   free(pOlder);
+}
+
+void test_model_file(const char* szFile, int iIterations)
+{
+   char szComm[256];
+   char szBinaryFile[256];
+   sprintf(szComm, "cp -rf %s %s", szFile, TEST_TEXT_FILE);
+   hw_execute_bash_command(szComm, NULL);
+   model_get_binary_file_name(TEST_TEXT_FILE, szBinaryFile);
+   unlink(szBinaryFile);
+
+   log_line("--------------------------------------");
+   log_line("Testing model file: %s", szFile);
+
+   ZeroedModel zeroedText;
+   Model& modelText = zeroedText.get();
+   if ( ! modelText.loadFromTextFile(TEST_TEXT_FILE, true) )
+   {
+      log_softerror_and_alarm("Failed to load text model %s", szFile);
+      s_iFailedChecks++;
+      return;
+   }
+   log_line("Text model version: %d", modelText.getLoadedFileVersion());
+
+   // Migration: loading through the generic path must create the binary file
+   ZeroedModel zeroedMigrated;
+   Model& modelMigrated = zeroedMigrated.get();
+   if ( ! modelMigrated.loadFromFile(TEST_TEXT_FILE, true) || access(szBinaryFile, R_OK) == -1 )
+   {
+      log_softerror_and_alarm("Migration from text model did not create the binary model.");
+      s_iFailedChecks++;
+   }
+
+   ZeroedModel zeroedBinary;
+   Model& modelBinary = zeroedBinary.get();
+   if ( ! modelBinary.loadFromBinaryFile(szBinaryFile, true) )
+   {
+      log_softerror_and_alarm("Failed to load binary model %s", szBinaryFile);
+      s_iFailedChecks++;
+      return;
+   }
+   compare_models(&modelText, &modelBinary);
+
+   // A text model with an unreadable save count must not load the binary model
+   FILE* fd = fopen(TEST_TEXT_FILE, "w");
+   if ( NULL != fd )
+   {
+      fprintf(fd, "invalid\n");
+      fclose(fd);
+   }
+   ZeroedModel zeroedInvalid;
+   if ( zeroedInvalid.get().loadFromFile(TEST_TEXT_FILE, true) )
+   {
+      log_softerror_and_alarm("Binary model loaded for a text model with an unreadable save count.");
+      s_iFailedChecks++;
+   }
+   hw_execute_bash_command(szComm, NULL);
+
+   // Buffer round trip and corrupted section detection
+   u8* pBuffer = (u8*)malloc(MODEL_BINARY_MAX_SIZE);
+   int iLength = modelText.saveToBinaryBuffer(pBuffer, MODEL_BINARY_MAX_SIZE);
+   log_line("Binary model size: %d bytes", iLength);
+   ZeroedModel zeroedBuffer;
+   Model& modelBuffer = zeroedBuffer.get();
+   if ( ! modelBuffer.loadFromBinaryBuffer(pBuffer, iLength, true) )
+      s_iFailedChecks++;
+   else
+      compare_models(&modelText, &modelBuffer);
+
+   pBuffer[iLength/2] ^= 0x5A;
+   if ( modelBuffer.loadFromBinaryBuffer(pBuffer, iLength, true) )
+   {
+      log_softerror_and_alarm("Corrupted binary model was not detected.");
+      s_iFailedChecks++;
+   }
+   if ( modelBuffer.loadFromBinaryBuffer(pBuffer, iLength/3, true) )
+   {
+      log_softerror_and_alarm("Truncated binary model was not detected.");
+      s_iFailedChecks++;
+   }
+   test_older_binary_model(modelText, pBuffer, iLength);
+   free(pBuffer);
+
+   // Benchmark
+   Model modelBench;
+   u32 uTime = _get_time_us();
+   for( int i=0; i<iIterations; i++ )
+      modelBench.loadFromTextFile(TEST_TEXT_FILE, true);
+   u32 uTimeText = _get_time_us() - uTime;
+
+   uTime = _get_time_us();
+   for( int i=0; i<iIterations; i++ )
+      modelBench.loadFromBinaryFile(szBinaryFile, true);
+   u32 uTimeBinary = _get_time_us() - uTime;
+
+   u32 uGeneration = 0;
+   int iChanged = 0;
+   uTime = _get_time_us();
+   for( int i=0; i<iIterations; i++ )
+   {
+      if ( model_shared_store_get_generation(&uGeneration) )
+      if ( uGeneration != modelBench.getLoadedStoreGeneration() )
+         iChanged++;
+   }
+   u32 uTimeCheck = _get_time_us() - uTime;
+
+   log_line("Load time per iteration (%d iterations): text: %u us, binary: %u us, change check: %.3f us (%d changed)",
+      iIterations, uTimeText/iIterations, uTimeBinary/iIterations, (float)uTimeCheck/(float)iIterations, iChanged);
+
+   unlink(TEST_TEXT_FILE);
+   unlink(szBinaryFile);
+}
+
+// Text model fixtures saved by older builds: they end before the extra lines added since
+// (the last lines of a version 8 text model), which load with their default values
+void test_older_text_models(const char* szFile)
+{
+   char szComm[1024];
+   char szOlderFile[256];
+   for( int iMissingLines=1; iMissingLines<=5; iMissingLines++ )
+   {
+      sprintf(szOlderFile, "tmp/test_model_older_%d.mdl", iMissingLines);
+      sprintf(szComm, "head -n -%d %s > %s", iMissingLines, szFile, szOlderFile);
+      hw_execute_bash_command(szComm, NULL);
+      test_model_file(szOlderFile, 1);
+
+      Model modelOlder;
+      if ( modelOlder.loadFromTextFile(szOlderFile, true) )
+      if ( modelOlder.radioInterfacesParams.txPowerSiK != DEFAULT_RADIO_SIK_TX_POWER )
+      {
+         log_softerror_and_alarm("Older text model %d: missing SiK tx power did not load its default value.", iMissingLines);
+         s_iFailedChecks++;
+      }
+      unlink(szOlderFile);
+   }
+}
+
+int main(int argc, char *argv[])
+{
+   log_init("TestModelStore");
+   log_enable_stdout();
+
+   int iIterations = 100;
+   int iFirstFile = 1;
+   if ( argc > 2 && 0 == strcmp(argv[1], "-iterations") )
+   {
+      iIterations = atoi(argv[2]);
+      if ( iIterations < 1 )
+         iIterations = 1;
+      iFirstFile = 3;
+   }
+
+   hw_execute_bash_command("mkdir -p tmp", NULL);
+
+   if ( iFirstFile >= argc )
+   {
+      Model modelDefault;
+      modelDefault.resetToDefaults(true);
+      modelDefault.saveToFile("tmp/test_model_default.mdl", false);
+      test_model_file("tmp/test_model_default.mdl", iIterations);
+      test_older_text_models("tmp/test_model_default.mdl");
+   }
+   for( int i=iFirstFile; i<argc; i++ )
+      test_model_file(argv[i], iIterations);
+
+   if ( s_iFailedChecks > 0 )
+   {
+      log_line("FAILED: %d checks failed.", s_iFailedChecks);
+      return 1;
+   }
+   log_line("PASSED: all model store checks.");
+   return 0;
+}
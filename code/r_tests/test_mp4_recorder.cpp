@@ -0,0 +1,609 @@
+#include "../base/base.h"
+#include "../common/mp4_recorder.h"
+
+#include <signal.h>
+#include <sys/stat.h>
+
+// Fragmented MP4 recorder test: feeds a H264 stream (a file, or a generated one) in random sized chunks
+// through the same start code parsing the station does, then validates the recorded file: box structure,
+// avcC, samples count and sizes, key frames at fragments start, decode times. Checks that the file
+// converts back to the same raw H264 stream and that a truncated copy still plays up to its last complete fragment.
+// Then records to a pipe nobody reads (a stalled storage): feeding the recorder must not block, and the fragments
+// that don't fit in the write queue must be dropped and counted.
+//
+// Usage: test_mp4_recorder [options]
+//   -in file       input raw H264 file (default: a generated 1280x720 stream)
+//   -slices n      slices per frame of the input stream (default 1)
+//   -fps n         frames per second the stream is fed at (default 30)
+//   -out file      recorded file (default /tmp/test_mp4_recorder.mp4)
+
+char s_szInFile[256] = "";
+char s_szOutFile[256] = "/tmp/test_mp4_recorder.mp4";
+int s_iSlices = 1;
+int s_iFPS = 30;
+
+u8* s_pStream = NULL;
+int s_iStreamLength = 0;
+int s_iStreamAlloc = 0;
+
+typedef struct
+{
+   int iFragments;
+   int iSamples;
+   int iKeySamples;
+   int iNALs;
+   int iWidth;
+   int iHeight;
+   bool bTruncated;
+} t_mp4_check;
+
+//----------------------------------------------------
+// Generated stream
+
+typedef struct
+{
+   u8 uData[64];
+   int iBitPos;
+} t_bit_writer;
+
+static void _bits_put(t_bit_writer* pW, u32 uValue, int iCount)
+{
+   for( int i=iCount-1; i>=0; i-- )
+   {
+      if ( (uValue >> i) & 0x01 )
+         pW->uData[pW->iBitPos/8] |= 0x80 >> (pW->iBitPos%8);
+      pW->iBitPos++;
+   }
+}
+
+static void _bits_put_ue(t_bit_writer* pW, u32 uValue)
+{
+   uValue++;
+   int iBits = 0;
+   while ( (uValue >> iBits) > 1 )
+      iBits++;
+   _bits_put(pW, 0, iBits);
+   _bits_put(pW, uValue, iBits+1);
+}
+
+static void _stream_add(const u8* pData, int iLength)
+{
+   if ( s_iStreamLength + iLength > s_iStreamAlloc )
+   {
+      s_iStreamAlloc = 2*(s_iStreamLength + iLength);
+      s_pStream = (u8*)realloc(s_pStream, s_iStreamAlloc);
+   }
+   memcpy(s_pStream + s_iStreamLength, pData, iLength);
+   s_iStreamLength += iLength;
+}
+
+static void _stream_add_nal(const u8* pNAL, int iLength)
+{
+   static const u8 uStartCode[4] = { 0, 0, 0, 1 };
+   _stream_add(uStartCode, 4);
+   _stream_add(pNAL, iLength);
+}
+
+// 10 seconds, 1280x720, a key frame each second, an access unit delimiter before each frame
+void _generate_stream()
+{
+   t_bit_writer w;
+   memset(&w, 0, sizeof(w));
+   _bits_put(&w, 0x67, 8);
+   _bits_put(&w, 66, 8); // baseline
+   _bits_put(&w, 0xC0, 8);
+   _bits_put(&w, 31, 8); // level 3.1
+   _bits_put_ue(&w, 0); // sps id
+   _bits_put_ue(&w, 4); // log2 max frame num - 4
+   _bits_put_ue(&w, 2); // poc type
+   _bits_put_ue(&w, 1); // ref frames
+   _bits_put(&w, 0, 1);
+   _bits_put_ue(&w, 79); // width in MBs - 1
+   _bits_put_ue(&w, 44); // height in MBs - 1
+   _bits_put(&w, 1, 1); // frame mbs only
+   _bits_put(&w, 1, 1);
+   _bits_put(&w, 0, 1); // no cropping
+   _bits_put(&w, 0, 1); // no VUI
+   _bits_put(&w, 1, 1); // stop bit
+   u8 uSPS[64];
+   int iSPSLength = (w.iBitPos+7)/8;
+   memcpy(uSPS, w.uData, iSPSLength);
+   u8 uPPS[4] = { 0x68, 0xCE, 0x38, 0x80 };
+   u8 uAUD[2] = { 0x09, 0xF0 };
+   u8 uSlice[8000];
+
+   for( int iFrame=0; iFrame<10*s_iFPS; iFrame++ )
+   {
+      bool bKey = (0 == (iFrame % s_iFPS));
+      _stream_add_nal(uAUD, 2);
+      if ( bKey )
+      {
+         _stream_add_nal(uSPS, iSPSLength);
+         _stream_add_nal(uPPS, 4);
+      }
+      for( int iSlice=0; iSlice<s_iSlices; iSlice++ )
+      {
+         int iLength = bKey?(4000 + rand()%4000):(200 + rand()%2000);
+         uSlice[0] = bKey?0x65:0x41;
+         for( int i=1; i<iLength; i++ )
+            uSlice[i] = 1 + rand()%255;
+         _stream_add_nal(uSlice, iLength);
+      }
+   }
+}
+
+bool _load_stream(const char* szFile)
+{
+   FILE* fd = fopen(szFile, "rb");
+   if ( NULL == fd )
+      return false;
+   fseek(fd, 0, SEEK_END);
+   s_iStreamLength = (int)ftell(fd);
+   s_iStreamAlloc = s_iStreamLength;
+   fseek(fd, 0, SEEK_SET);
+   s_pStream = (u8*)malloc(s_iStreamLength);
+   bool bOk = (NULL != s_pStream) && (s_iStreamLength == (int)fread(s_pStream, 1, s_iStreamLength, fd));
+   fclose(fd);
+   return bOk;
+}
+
+//----------------------------------------------------
+// Feeding, same start code parsing as the station video forward
+
+u32 s_uParseStartSequence = 0xFFFFFFFF;
+int s_iParseSlices = 0;
+int s_iFramesParsed = 0;
+int s_iNALsParsed = 0; // without the access unit delimiters
+
+void _parse_and_record(t_mp4_recorder* pRecorder, u8* pBuffer, int iLength, u32 uTimeNow)
+{
+   int iSegmentStart = 0;
+   for( int k=0; k<iLength; k++ )
+   {
+      s_uParseStartSequence = (s_uParseStartSequence << 8) | pBuffer[k];
+      if ( (s_uParseStartSequence & 0xFFFFFF00) != 0x0100 )
+         continue;
+      int iType = s_uParseStartSequence & 0x1F;
+      int bIsLastSlice = 0;
+      if ( iType == 7 )
+         s_iParseSlices = 0;
+      if ( iType == 1 || iType == 5 )
+      {
+         s_iParseSlices++;
+         if ( s_iParseSlices >= s_iSlices )
+         {
+            s_iParseSlices = 0;
+            bIsLastSlice = 1;
+            s_iFramesParsed++;
+         }
+      }
+      if ( iType != 9 )
+         s_iNALsParsed++;
+      mp4_recorder_add_nal_data(pRecorder, pBuffer + iSegmentStart, k - iSegmentStart);
+      mp4_recorder_start_nal(pRecorder, iType, bIsLastSlice, uTimeNow);
+      iSegmentStart = k;
+   }
+   mp4_recorder_add_nal_data(pRecorder, pBuffer + iSegmentStart, iLength - iSegmentStart);
+}
+
+//----------------------------------------------------
+// Validation
+
+static u32 _u32(const u8* p)
+{
+   return (((u32)p[0]) << 24) | (((u32)p[1]) << 16) | (((u32)p[2]) << 8) | p[3];
+}
+
+static const u8* _find_box(const u8* pData, int iLength, const char* szType)
+{
+   for( int i=4; i+4<=iLength; i++ )
+      if ( 0 == memcmp(pData+i, szType, 4) )
+         return pData+i-4;
+   return NULL;
+}
+
+bool _validate_mp4(const char* szFile, t_mp4_check* pCheck)
+{
+   memset(pCheck, 0, sizeof(t_mp4_check));
+   FILE* fd = fopen(szFile, "rb");
+   if ( NULL == fd )
+      return false;
+   fseek(fd, 0, SEEK_END);
+   int iLength = (int)ftell(fd);
+   fseek(fd, 0, SEEK_SET);
+   u8* pFile = (u8*)malloc(iLength+1);
+   bool bRead = (iLength == (int)fread(pFile, 1, iLength, fd));
+   fclose(fd);
+   if ( ! bRead )
+   {
+      free(pFile);
+      return false;
+   }
+
+   bool bOk = true;
+   int iPos = 0;
+   int iBox = 0;
+   unsigned long long uDecodeTime = 0;
+   const u8* pMoof = NULL;
+   u32 uMoofSize = 0;
+   u32 uSampleSizes[MP4_RECORDER_FRAGMENT_MAX_SAMPLES];
+   u32 uSamplesCount = 0;
+
+   while ( bOk && iPos + 8 <= iLength )
+   {
+      u32 uSize = _u32(pFile+iPos);
+      const u8* pType = pFile+iPos+4;
+      if ( uSize < 8 )
+      {
+         log_line("Invalid box size %u at %d", uSize, iPos);
+         bOk = false;
+         break;
+      }
+      if ( iPos + (int)uSize > iLength )
+      {
+         pCheck->bTruncated = true;
+         break;
+      }
+      const u8* pBox = pFile+iPos;
+
+      if ( 0 == iBox && 0 != memcmp(pType, "ftyp", 4) )
+         { log_line("First box is not ftyp"); bOk = false; }
+      if ( 1 == iBox )
+      {
+         if ( 0 != memcmp(pType, "moov", 4) )
+            { log_line("Second box is not moov"); bOk = false; break; }
+         const u8* pAvcC = _find_box(pBox+8, uSize-8, "avcC");
+         const u8* pMvex = _find_box(pBox+8, uSize-8, "mvex");
+         const u8* pTkhd = _find_box(pBox+8, uSize-8, "tkhd");
+         if ( NULL == pAvcC || NULL == pMvex || NULL == pTkhd )
+            { log_line("Missing avcC, mvex or tkhd box"); bOk = false; break; }
+         int iSPSLength = (pAvcC[14] << 8) | pAvcC[15];
+         const u8* pSPS = pAvcC + 16;
+         if ( pAvcC[8] != 1 || pAvcC[12] != 0xFF || pAvcC[13] != 0xE1 || pAvcC[9] != pSPS[1] || (pSPS[0] & 0x1F) != 7 )
+            { log_line("Invalid avcC box"); bOk = false; }
+         if ( 0 != mp4_parse_h264_sps(pSPS, iSPSLength, &pCheck->iWidth, &pCheck->iHeight) )
+            { log_line("Can't parse the SPS"); bOk = false; }
+         int iTkhdWidth = _u32(pTkhd + 8 + 4 + 72) >> 16;
+         int iTkhdHeight = _u32(pTkhd + 8 + 4 + 76) >> 16;
+         if ( iTkhdWidth != pCheck->iWidth || iTkhdHeight != pCheck->iHeight )
+            { log_line("Track size %dx%d does not match the SPS %dx%d", iTkhdWidth, iTkhdHeight, pCheck->iWidth, pCheck->iHeight); bOk = false; }
+      }
+      if ( iBox >= 2 && (iBox % 2) == 0 )
+      {
+         if ( 0 != memcmp(pType, "moof", 4) )
+            { log_line("Expected a moof box at %d", iPos); bOk = false; break; }
+         pMoof = pBox;
+         uMoofSize = uSize;
+         const u8* pMfhd = _find_box(pBox+8, uSize-8, "mfhd");
+         const u8* pTfdt = _find_box(pBox+8, uSize-8, "tfdt");
+         const u8* pTrun = _find_box(pBox+8, uSize-8, "trun");
+         if ( NULL == pMfhd || NULL == pTfdt || NULL == pTrun )
+            { log_line("Missing mfhd, tfdt or trun box"); bOk = false; break; }
+         if ( (int)_u32(pMfhd+12) != pCheck->iFragments+1 )
+            { log_line("Invalid fragment sequence number %u", _u32(pMfhd+12)); bOk = false; }
+         unsigned long long uBaseTime = (((unsigned long long)_u32(pTfdt+12)) << 32) | _u32(pTfdt+16);
+         if ( uBaseTime != uDecodeTime )
+            { log_line("Fragment %d decode time %llu, expected %llu", pCheck->iFragments+1, uBaseTime, uDecodeTime); bOk = false; }
+         if ( (_u32(pTrun+8) & 0xFFFFFF) != 0x701 )
+            { log_line("Unexpected trun flags"); bOk = false; break; }
+         uSamplesCount = _u32(pTrun+12);
+         if ( uSamplesCount == 0 || uSamplesCount > MP4_RECORDER_FRAGMENT_MAX_SAMPLES )
+            { log_line("Invalid samples count %u", uSamplesCount); bOk = false; break; }
+         if ( _u32(pTrun+16) != uMoofSize + 8 )
+            { log_line("Invalid data offset"); bOk = false; }
+         for( u32 i=0; i<uSamplesCount; i++ )
+         {
+            const u8* pEntry = pTrun + 20 + 12*i;
+            uDecodeTime += _u32(pEntry);
+            uSampleSizes[i] = _u32(pEntry+4);
+            u32 uFlags = _u32(pEntry+8);
+            if ( uFlags == 0x02000000 )
+               pCheck->iKeySamples++;
+            if ( 0 == i && uFlags != 0x02000000 && 0 == pCheck->iFragments )
+               { log_line("First sample of the file is not a key frame"); bOk = false; }
+         }
+      }
+      if ( iBox >= 3 && (iBox % 2) == 1 )
+      {
+         if ( 0 != memcmp(pType, "mdat", 4) || NULL == pMoof )
+            { log_line("Expected a mdat box at %d", iPos); bOk = false; break; }
+         // Each sample is a whole number of length prefixed NALs, the first one being key if flagged so
+         u32 uOffset = 8;
+         for( u32 i=0; i<uSamplesCount && bOk; i++ )
+         {
+            u32 uEnd = uOffset + uSampleSizes[i];
+            if ( uEnd > uSize )
+               { log_line("Samples exceed the mdat size"); bOk = false; break; }
+            while ( uOffset < uEnd )
+            {
+               u32 uNAL = _u32(pBox + uOffset);
+               if ( uNAL == 0 || uOffset + 4 + uNAL > uEnd )
+                  { log_line("Invalid NAL length in sample %u", i); bOk = false; break; }
+               if ( (pBox[uOffset+4] & 0x1F) == 9 )
+                  { log_line("Access unit delimiter stored"); bOk = false; }
+               pCheck->iNALs++;
+               uOffset += 4 + uNAL;
+            }
+         }
+         if ( bOk && uOffset != uSize )
+            { log_line("mdat size %u does not match the samples sizes %u", uSize, uOffset); bOk = false; }
+         pCheck->iSamples += uSamplesCount;
+         pCheck->iFragments++;
+         pMoof = NULL;
+      }
+      iPos += uSize;
+      iBox++;
+   }
+   if ( iPos < iLength && ! pCheck->bTruncated )
+      pCheck->bTruncated = true;
+   if ( iBox < 2 )
+      bOk = false;
+   free(pFile);
+   return bOk;
+}
+
+// Count of the start code NALs in a raw H264 buffer, without the access unit delimiters
+// The storage stalls: the recorder writes to a pipe that is never read. Returns false on failure.
+bool _test_stalled_storage()
+{
+   char szFifo[300];
+   snprintf(szFifo, sizeof(szFifo), "%s.fifo", s_szOutFile);
+   unlink(szFifo);
+   if ( 0 != mkfifo(szFifo, 0644) )
+   {
+      log_line("Can't create the pipe %s, skipping the stalled storage test.", szFifo);
+      return true;
+   }
+   // Opened for reading (and never read) so the recorder can open it for writing
+   int fdReader = open(szFifo, O_RDONLY | O_NONBLOCK);
+   t_mp4_recorder recorder;
+   if ( fdReader < 0 || 0 != mp4_recorder_open(&recorder, szFifo) )
+   {
+      log_line("Can't open the pipe %s.", szFifo);
+      if ( fdReader >= 0 )
+         close(fdReader);
+      unlink(szFifo);
+      return false;
+   }
+
+   // Blocking writes would hang the feeding here; the alarm ends the test in that case
+   alarm(20);
+   s_uParseStartSequence = 0xFFFFFFFF;
+   s_iParseSlices = 0;
+   s_iFramesParsed = 0;
+   int iPos = 0;
+   while ( iPos < s_iStreamLength )
+   {
+      int iChunk = 1 + rand() % 1400;
+      if ( iChunk > s_iStreamLength - iPos )
+         iChunk = s_iStreamLength - iPos;
+      u32 uTimeNow = 1000 + (u32)(s_iFramesParsed * 1000 / s_iFPS);
+      _parse_and_record(&recorder, s_pStream + iPos, iChunk, uTimeNow);
+      iPos += iChunk;
+   }
+   alarm(0);
+   t_mp4_recorder_stats statsFeed;
+   mp4_recorder_get_stats(&recorder, &statsFeed);
+
+   // Let the writer thread fill the pipe and block, then the storage fails: the blocked write and the queued ones end with errors
+   usleep(100000);
+   close(fdReader);
+   mp4_recorder_close(&recorder);
+   unlink(szFifo);
+
+   t_mp4_recorder_stats stats = recorder.stats;
+   log_line("Stalled storage: %d frames fed, %u fragments dropped while feeding, then %u frames written, %u dropped, %u fragments dropped, %u write errors, %llu bytes written",
+      s_iFramesParsed, statsFeed.uFragmentsDropped, stats.uFramesWritten, stats.uFramesDropped, stats.uFragmentsDropped, stats.uWriteErrors, stats.uBytesWritten);
+   if ( 0 == statsFeed.uFragmentsDropped || 0 == stats.uWriteErrors )
+   {
+      log_line("Stalled storage did not drop fragments or report write errors.");
+      return false;
+   }
+   if ( (int)(stats.uFramesWritten + stats.uFramesDropped) != s_iFramesParsed )
+   {
+      log_line("Stalled storage: frames written + dropped: %u, frames fed: %d", stats.uFramesWritten + stats.uFramesDropped, s_iFramesParsed);
+      return false;
+   }
+   return true;
+}
+
+int _count_nals(const u8* pData, int iLength)
+{
+   int iCount = 0;
+   for( int i=0; i+3<iLength; i++ )
+      if ( pData[i] == 0 && pData[i+1] == 0 && pData[i+2] == 1 && (pData[i+3] & 0x1F) != 9 )
+         iCount++;
+   return iCount;
+}
+
+int main(int argc, char *argv[])
+{
+   log_init("TestMP4Recorder");
+   log_enable_stdout();
+
+   for( int i=1; i<argc; i++ )
+   {
+      if ( 0 == strcmp(argv[i], "-in") && i < argc-1 )
+         strncpy(s_szInFile, argv[++i], sizeof(s_szInFile)-1);
+      else if ( 0 == strcmp(argv[i], "-out") && i < argc-1 )
+         strncpy(s_szOutFile, argv[++i], sizeof(s_szOutFile)-1);
+      else if ( 0 == strcmp(argv[i], "-slices") && i < argc-1 )
+         s_iSlices = atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-fps") && i < argc-1 )
+         s_iFPS = atoi(argv[++i]);
+   }
+   if ( s_iSlices < 1 )
+      s_iSlices = 1;
+   if ( s_iFPS < 1 )
+      s_iFPS = 30;
+
+   bool bGenerated = false;
+   if ( 0 == s_szInFile[0] || ! _load_stream(s_szInFile) )
+   {
+      if ( 0 != s_szInFile[0] )
+         log_line("Can't read H264 file %s, using a generated stream.", s_szInFile);
+      s_iStreamLength = 0;
+      srand(1234);
+      _generate_stream();
+      bGenerated = true;
+   }
+   log_line("Input stream: %d bytes, %d slices per frame, fed at %d fps", s_iStreamLength, s_iSlices, s_iFPS);
+
+   // Feed it in radio packet sized chunks; the time moves one frame for each frame parsed
+   t_mp4_recorder recorder;
+   if ( 0 != mp4_recorder_open(&recorder, s_szOutFile) )
+   {
+      log_line("Test FAILED: can't create %s", s_szOutFile);
+      return 1;
+   }
+   srand(4321);
+   int iPos = 0;
+   while ( iPos < s_iStreamLength )
+   {
+      int iChunk = 1 + rand() % 1400;
+      if ( iChunk > s_iStreamLength - iPos )
+         iChunk = s_iStreamLength - iPos;
+      u32 uTimeNow = 1000 + (u32)(s_iFramesParsed * 1000 / s_iFPS);
+      _parse_and_record(&recorder, s_pStream + iPos, iChunk, uTimeNow);
+      iPos += iChunk;
+      // The storage keeps up with a real time stream: wait for the queued writes
+      while ( mp4_recorder_get_pending_writes(&recorder) > 0 )
+         usleep(200);
+   }
+   // The last frame ends when the recording stops
+   mp4_recorder_close(&recorder);
+
+   t_mp4_recorder_stats stats = recorder.stats;
+   log_line("Recorded %u frames in %u fragments, %llu bytes, %u frames dropped, %u fragments dropped, %u write errors",
+      stats.uFramesWritten, stats.uFragmentsWritten, stats.uBytesWritten, stats.uFramesDropped, stats.uFragmentsDropped, stats.uWriteErrors);
+
+   bool bPassed = true;
+   t_mp4_check check;
+   if ( ! _validate_mp4(s_szOutFile, &check) || check.bTruncated )
+   {
+      log_line("Recorded file is not valid.");
+      bPassed = false;
+   }
+   log_line("File: %d fragments, %d samples (%d key), %d NALs, %d x %d", check.iFragments, check.iSamples, check.iKeySamples, check.iNALs, check.iWidth, check.iHeight);
+
+   if ( check.iSamples != (int)stats.uFramesWritten || check.iFragments != (int)stats.uFragmentsWritten )
+   {
+      log_line("Samples/fragments in the file do not match the recorder stats.");
+      bPassed = false;
+   }
+   if ( check.iSamples + (int)stats.uFramesDropped != s_iFramesParsed )
+   {
+      log_line("Frames recorded + dropped: %d, frames fed: %d", check.iSamples + (int)stats.uFramesDropped, s_iFramesParsed);
+      bPassed = false;
+   }
+   if ( bGenerated )
+   {
+      if ( stats.uFramesDropped != 0 || check.iWidth != 1280 || check.iHeight != 720 ||
+           check.iKeySamples != 10 || check.iFragments < 9 || check.iNALs != _count_nals(s_pStream, s_iStreamLength) )
+      {
+         log_line("Recorded file does not match the generated stream.");
+         bPassed = false;
+      }
+   }
+
+   // Back to raw H264: the SPS/PPS from the header, then the NALs of the samples
+   char szExtracted[300];
+   snprintf(szExtracted, sizeof(szExtracted), "%s.h264", s_szOutFile);
+   int iFrames = mp4_file_extract_h264(s_szOutFile, szExtracted);
+   FILE* fd = fopen(szExtracted, "rb");
+   u8* pExtracted = (u8*)malloc(s_iStreamLength + 1024);
+   int iExtractedLength = 0;
+   if ( NULL != fd )
+   {
+      iExtractedLength = (int)fread(pExtracted, 1, s_iStreamLength + 1024, fd);
+      fclose(fd);
+   }
+   log_line("Extracted %d frames (slices), %d bytes", iFrames, iExtractedLength);
+   if ( iFrames != check.iSamples * s_iSlices || _count_nals(pExtracted, iExtractedLength) != check.iNALs + 2 )
+   {
+      log_line("Extracted stream does not match the recorded file.");
+      bPassed = false;
+   }
+   if ( bGenerated )
+   {
+      // Same NALs as the input stream, without the access unit delimiters
+      u8* pExpected = (u8*)malloc(s_iStreamLength);
+      int iExpectedLength = 0;
+      int iStart = -1;
+      for( int i=0; i<=s_iStreamLength; i++ )
+      {
+         bool bStartCode = (i+4 <= s_iStreamLength) && s_pStream[i] == 0 && s_pStream[i+1] == 0 && s_pStream[i+2] == 0 && s_pStream[i+3] == 1;
+         if ( ! bStartCode && i < s_iStreamLength )
+            continue;
+         if ( iStart >= 0 && (s_pStream[iStart+4] & 0x1F) != 9 )
+         {
+            memcpy(pExpected + iExpectedLength, s_pStream + iStart, i - iStart);
+            iExpectedLength += i - iStart;
+         }
+         iStart = i;
+      }
+      // The first key frame's SPS/PPS are both in the header and in the first sample
+      int iHeaderLength = 0;
+      for( int i=4; i+4<=iExtractedLength; i++ )
+         if ( pExtracted[i] == 0 && pExtracted[i+1] == 0 && pExtracted[i+2] == 0 && pExtracted[i+3] == 1 && (pExtracted[i+4] & 0x1F) == 7 )
+         {
+            iHeaderLength = i;
+            break;
+         }
+      if ( iExtractedLength - iHeaderLength != iExpectedLength || 0 != memcmp(pExtracted + iHeaderLength, pExpected, iExpectedLength) )
+      {
+         log_line("Extracted stream content differs from the input stream.");
+         bPassed = false;
+      }
+      free(pExpected);
+   }
+
+   // A recording cut in the middle still has all the fragments before the cut
+   // (the extraction also keeps the whole NALs of the partial fragment)
+   char szTruncated[300];
+   snprintf(szTruncated, sizeof(szTruncated), "%s.cut.mp4", s_szOutFile);
+   fd = fopen(s_szOutFile, "rb");
+   FILE* fdCut = fopen(szTruncated, "wb");
+   if ( NULL != fd && NULL != fdCut )
+   {
+      fseek(fd, 0, SEEK_END);
+      long lSize = ftell(fd);
+      fseek(fd, 0, SEEK_SET);
+      long lCut = lSize*6/10;
+      u8* pBuffer = (u8*)malloc(lCut);
+      if ( lCut == (long)fread(pBuffer, 1, lCut, fd) )
+         fwrite(pBuffer, 1, lCut, fdCut);
+      free(pBuffer);
+   }
+   if ( NULL != fd )
+      fclose(fd);
+   if ( NULL != fdCut )
+      fclose(fdCut);
+
+   t_mp4_check checkCut;
+   bool bCutValid = _validate_mp4(szTruncated, &checkCut);
+   int iCutFrames = mp4_file_extract_h264(szTruncated, szExtracted);
+   log_line("Truncated file: %d complete fragments, %d samples, %d frames extracted", checkCut.iFragments, checkCut.iSamples, iCutFrames);
+   if ( ! bCutValid || checkCut.iFragments < 1 || checkCut.iSamples * s_iSlices > iCutFrames )
+   {
+      log_line("Truncated file is not playable up to the cut.");
+      bPassed = false;
+   }
+
+   free(pExtracted);
+   unlink(szExtracted);
+   unlink(szTruncated);
+
+   signal(SIGPIPE, SIG_IGN);
+   if ( ! _test_stalled_storage() )
+      bPassed = false;
+   free(s_pStream);
+
+   if ( ! bPassed )
+   {
+      log_line("Test FAILED");
+      return 1;
+   }
+   log_line("Test PASSED");
+   return 0;
+}
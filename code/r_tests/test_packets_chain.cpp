@@ -0,0 +1,380 @@
+#include "../base/base.h"
+#include "../radio/radiopackets2.h"
+#include "../radio/radio_packets_chain.h"
+
+#include <time.h>
+
+// Checks the chained packets builder and iterator: packets built in place are read back identical and with
+// valid CRCs, the builder bounds are respected, and malformed chains (random corruptions, truncations,
+// bad lengths) never make the iterator return a packet outside the buffer.
+// Then benchmarks composing and parsing chained packets with the builder/iterator against the usual
+// stack headers + memcpy composing and the unchecked total_length walk.
+// Usage: test_packets_chain [-fuzz N] [-loops N]
+
+int s_iFailed = 0;
+int s_iFuzzIterations = 200000;
+int s_iLoops = 500000;
+
+void _fail(const char* szText)
+{
+   log_line("%s <- FAILED", szText);
+   s_iFailed = 1;
+}
+
+double _get_time()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0;
+}
+
+bool _check_packet_crc(t_packet_header* pPH)
+{
+   if ( pPH->packet_flags & PACKET_FLAGS_BIT_HEADERS_ONLY_CRC )
+      return packet_check_crc((u8*)pPH, pPH->total_headers_length);
+   return packet_check_crc((u8*)pPH, pPH->total_length);
+}
+
+// Builds a random valid chain in pBuilder (packets added in place and appended), returns the number of packets
+int _build_random_chain(t_packets_chain_builder* pBuilder, u32 uSeed)
+{
+   int iCount = 0;
+   while ( true )
+   {
+      int iHeadersLength = sizeof(t_packet_header) + (rand() % 3) * 12;
+      int iPayloadLength = rand() % 300;
+      u8 uFlags = PACKET_COMPONENT_TELEMETRY;
+      if ( rand() % 2 )
+         uFlags |= PACKET_FLAGS_BIT_HEADERS_ONLY_CRC;
+
+      if ( rand() % 4 )
+      {
+         t_packet_header* pPH = packets_chain_builder_add(pBuilder, uFlags, PACKET_TYPE_RUBY_TELEMETRY_EXTENDED, uSeed + iCount, 1, 2, iHeadersLength, iPayloadLength);
+         if ( NULL == pPH )
+            break;
+         u8* pData = ((u8*)pPH) + sizeof(t_packet_header);
+         for( int i=0; i<iHeadersLength + iPayloadLength - (int)sizeof(t_packet_header); i++ )
+            pData[i] = (u8)(uSeed + iCount*13 + i);
+      }
+      else
+      {
+         u8 packet[MAX_PACKET_TOTAL_SIZE];
+         t_packet_header* pPH = (t_packet_header*)packet;
+         memset(pPH, 0, sizeof(t_packet_header));
+         pPH->packet_flags = uFlags;
+         pPH->packet_type = PACKET_TYPE_RUBY_TELEMETRY_EXTENDED;
+         pPH->stream_packet_idx = uSeed + iCount;
+         pPH->vehicle_id_src = 1;
+         pPH->vehicle_id_dest = 2;
+         pPH->total_headers_length = iHeadersLength;
+         pPH->total_length = iHeadersLength + iPayloadLength;
+         for( int i=sizeof(t_packet_header); i<pPH->total_length; i++ )
+            packet[i] = (u8)(uSeed + iCount*13 + i - sizeof(t_packet_header));
+         if ( uFlags & PACKET_FLAGS_BIT_HEADERS_ONLY_CRC )
+            packet_compute_crc(packet, pPH->total_headers_length);
+         else
+            packet_compute_crc(packet, pPH->total_length);
+         if ( ! packets_chain_builder_append(pBuilder, packet, pPH->total_length) )
+            break;
+      }
+      iCount++;
+   }
+   return iCount;
+}
+
+void _test_build_and_parse()
+{
+   u8 buffer[MAX_PACKET_TOTAL_SIZE];
+   char szBuff[256];
+   for( int k=0; k<2000; k++ )
+   {
+      t_packets_chain_builder builder;
+      packets_chain_builder_init(&builder, buffer, 200 + rand() % (MAX_PACKET_TOTAL_SIZE-200));
+      int iCount = _build_random_chain(&builder, k*1000);
+      int iLength = packets_chain_builder_finalize(&builder);
+      if ( (iLength != builder.iLength) || (iLength > builder.iMaxLength) || (iCount != builder.iCountPackets) )
+      {
+         sprintf(szBuff, "Builder state invalid: length %d of max %d, %d packets of %d", iLength, builder.iMaxLength, builder.iCountPackets, iCount);
+         _fail(szBuff);
+         return;
+      }
+
+      t_packets_chain_iterator iterator;
+      packets_chain_iterator_init(&iterator, buffer, iLength);
+      t_packet_header* pPH = NULL;
+      int iIndex = 0;
+      while ( NULL != (pPH = packets_chain_iterator_next(&iterator)) )
+      {
+         if ( pPH->stream_packet_idx != (u32)(k*1000 + iIndex) || pPH->vehicle_id_src != 1 || pPH->vehicle_id_dest != 2 )
+            _fail("Wrong packet header read back");
+         if ( ! _check_packet_crc(pPH) )
+            _fail("Wrong packet CRC read back");
+         u8* pData = ((u8*)pPH) + sizeof(t_packet_header);
+         for( int i=0; i<pPH->total_length - (int)sizeof(t_packet_header); i++ )
+            if ( pData[i] != (u8)(k*1000 + iIndex*13 + i) )
+            {
+               _fail("Wrong packet content read back");
+               break;
+            }
+         iIndex++;
+      }
+      if ( (iterator.iError != PACKETS_CHAIN_OK) || (iIndex != iCount) || (packets_chain_validate(buffer, iLength) != iCount) )
+      {
+         sprintf(szBuff, "Read back %d packets of %d, error %d", iIndex, iCount, iterator.iError);
+         _fail(szBuff);
+         return;
+      }
+      if ( s_iFailed )
+         return;
+   }
+
+   // Bounds and invalid input
+   t_packets_chain_builder builder;
+   packets_chain_builder_init(&builder, buffer, 100);
+   if ( NULL != packets_chain_builder_add(&builder, 0, 0, 0, 0, 0, sizeof(t_packet_header), 101 - sizeof(t_packet_header)) )
+      _fail("Builder added a packet past its max length");
+   if ( NULL != packets_chain_builder_add(&builder, 0, 0, 0, 0, 0, sizeof(t_packet_header)-1, 10) )
+      _fail("Builder added a packet with headers smaller than the packet header");
+   if ( NULL == packets_chain_builder_add(&builder, 0, 0, 0, 0, 0, sizeof(t_packet_header), 100 - sizeof(t_packet_header)) )
+      _fail("Builder did not add a packet filling its max length");
+   if ( 0 != packets_chain_builder_get_free_space(&builder) )
+      _fail("Builder free space not zero when full");
+
+   u8 packet[64];
+   memset(packet, 0, sizeof(packet));
+   t_packet_header* pPH = (t_packet_header*)packet;
+   pPH->total_headers_length = sizeof(t_packet_header);
+   pPH->total_length = 40;
+   packets_chain_builder_init(&builder, buffer, MAX_PACKET_TOTAL_SIZE);
+   if ( packets_chain_builder_append(&builder, packet, 64) )
+      _fail("Builder appended packets with a wrong length");
+   pPH->total_headers_length = 41;
+   if ( packets_chain_builder_append(&builder, packet, 40) )
+      _fail("Builder appended a packet with headers larger than the packet");
+   pPH->total_headers_length = sizeof(t_packet_header);
+   if ( ! packets_chain_builder_append(&builder, packet, 40) || builder.iLength != 40 )
+      _fail("Builder did not append a valid packet");
+
+   if ( NULL != packets_chain_iterator_next(NULL) )
+      _fail("Iterator returned a packet from NULL");
+   t_packets_chain_iterator iterator;
+   packets_chain_iterator_init(&iterator, NULL, 100);
+   if ( NULL != packets_chain_iterator_next(&iterator) )
+      _fail("Iterator returned a packet from a NULL buffer");
+   if ( 0 != packets_chain_validate(buffer, 0) )
+      _fail("Empty chain not valid");
+}
+
+// Corrupts valid chains and checks the iterator never returns a packet outside the buffer and always ends
+void _test_malformed_chains()
+{
+   u8 source[MAX_PACKET_TOTAL_SIZE];
+   int iCountErrors[4] = { 0, 0, 0, 0 };
+   char szBuff[256];
+
+   for( int k=0; k<s_iFuzzIterations; k++ )
+   {
+      t_packets_chain_builder builder;
+      packets_chain_builder_init(&builder, source, MAX_PACKET_PAYLOAD);
+      _build_random_chain(&builder, k);
+      int iLength = packets_chain_builder_finalize(&builder);
+
+      int iMode = rand() % 5;
+      switch ( iMode )
+      {
+         case 0: // random bytes
+            for( int i=0; i<1 + rand()%8; i++ )
+               source[rand() % iLength] = (u8)rand();
+            break;
+         case 1: // truncated
+            iLength = rand() % (iLength+1);
+            break;
+         case 2: // random total length on a random packet
+         case 3: // random total headers length on a random packet
+         {
+            t_packets_chain_iterator iterator;
+            packets_chain_iterator_init(&iterator, source, iLength);
+            int iTarget = rand() % (builder.iCountPackets + 1);
+            t_packet_header* pPH = NULL;
+            for( int i=0; i<=iTarget; i++ )
+               pPH = packets_chain_iterator_next(&iterator);
+            if ( NULL == pPH )
+               break;
+            u16 uValue = (u16)((rand() % 2)?(rand() % 64):rand());
+            if ( iMode == 2 )
+               pPH->total_length = uValue;
+            else
+               pPH->total_headers_length = uValue;
+            break;
+         }
+         default: // all random
+            iLength = rand() % MAX_PACKET_TOTAL_SIZE;
+            for( int i=0; i<iLength; i++ )
+               source[i] = (u8)rand();
+            break;
+      }
+
+      // Exactly sized copy, so any read past the end is caught by memory checkers
+      u8* pChain = (u8*)malloc(iLength > 0 ? iLength : 1);
+      memcpy(pChain, source, iLength);
+
+      t_packets_chain_iterator iterator;
+      packets_chain_iterator_init(&iterator, pChain, iLength);
+      t_packet_header* pPH = NULL;
+      int iTotal = 0;
+      int iCount = 0;
+      while ( NULL != (pPH = packets_chain_iterator_next(&iterator)) )
+      {
+         u8* pPacket = (u8*)pPH;
+         if ( (pPacket < pChain) || (pPacket + pPH->total_length > pChain + iLength) ||
+              (pPH->total_length < sizeof(t_packet_header)) || (pPH->total_headers_length < sizeof(t_packet_header)) ||
+              (pPH->total_headers_length > pPH->total_length) || (pPacket != pChain + iTotal) )
+         {
+            sprintf(szBuff, "Iterator returned an invalid packet (offset %d, length %d, headers %d) from a chain of %d bytes", (int)(pPacket - pChain), pPH->total_length, pPH->total_headers_length, iLength);
+            _fail(szBuff);
+            free(pChain);
+            return;
+         }
+         iTotal += pPH->total_length;
+         iCount++;
+         if ( iCount > iLength/(int)sizeof(t_packet_header) )
+         {
+            _fail("Iterator does not end");
+            free(pChain);
+            return;
+         }
+      }
+      if ( (iterator.iError == PACKETS_CHAIN_OK) && (iTotal != iLength) )
+         _fail("Iterator ended before the chain end without an error");
+      if ( (iterator.iError != PACKETS_CHAIN_OK) != (packets_chain_validate(pChain, iLength) < 0) )
+         _fail("Validate and iterator disagree");
+      iCountErrors[iterator.iError]++;
+      free(pChain);
+      if ( s_iFailed )
+         return;
+   }
+   log_line("Malformed chains: %d iterations, valid: %d, truncated: %d, bad length: %d, bad headers length: %d",
+      s_iFuzzIterations, iCountErrors[PACKETS_CHAIN_OK], iCountErrors[PACKETS_CHAIN_ERROR_TRUNCATED], iCountErrors[PACKETS_CHAIN_ERROR_LENGTH], iCountErrors[PACKETS_CHAIN_ERROR_HEADERS_LENGTH]);
+}
+
+void _benchmark()
+{
+   u8 data[512];
+   u8 buffer[MAX_PACKET_TOTAL_SIZE];
+   u32 uSum = 0;
+   for( int i=0; i<(int)sizeof(data); i++ )
+      data[i] = (u8)rand();
+
+   for( int iDataLength = 32; iDataLength <= 512; iDataLength *= 4 )
+   {
+      // As composed before: headers on the stack, copied with the data to the send buffer
+      double fStart = _get_time();
+      for( int k=0; k<s_iLoops; k++ )
+      {
+         t_packet_header PH;
+         t_packet_header_telemetry_raw PHTR;
+         PH.packet_flags = PACKET_COMPONENT_TELEMETRY;
+         PH.packet_type = PACKET_TYPE_TELEMETRY_RAW_UPLOAD;
+         PH.stream_packet_idx = (STREAM_ID_DATA) << PACKET_FLAGS_MASK_SHIFT_STREAM_INDEX;
+         PH.vehicle_id_src = 1;
+         PH.vehicle_id_dest = 2;
+         PH.total_headers_length = sizeof(t_packet_header)+sizeof(t_packet_header_telemetry_raw);
+         PH.total_length = sizeof(t_packet_header)+sizeof(t_packet_header_telemetry_raw) + iDataLength;
+         PHTR.telem_segment_index = k;
+         PHTR.telem_total_data = k;
+         PHTR.telem_total_serial = k;
+         memcpy(buffer, (u8*)&PH, sizeof(t_packet_header));
+         memcpy(buffer+sizeof(t_packet_header), (u8*)&PHTR, sizeof(t_packet_header_telemetry_raw));
+         memcpy(buffer+sizeof(t_packet_header)+sizeof(t_packet_header_telemetry_raw), data, iDataLength);
+         packet_compute_crc(buffer, PH.total_length);
+         uSum += buffer[k % PH.total_length];
+      }
+      double fOld = _get_time() - fStart;
+
+      fStart = _get_time();
+      for( int k=0; k<s_iLoops; k++ )
+      {
+         t_packets_chain_builder builder;
+         packets_chain_builder_init(&builder, buffer, MAX_PACKET_TOTAL_SIZE);
+         t_packet_header* pPH = packets_chain_builder_add(&builder, PACKET_COMPONENT_TELEMETRY, PACKET_TYPE_TELEMETRY_RAW_UPLOAD,
+            (STREAM_ID_DATA) << PACKET_FLAGS_MASK_SHIFT_STREAM_INDEX, 1, 2, sizeof(t_packet_header)+sizeof(t_packet_header_telemetry_raw), iDataLength);
+         t_packet_header_telemetry_raw* pPHTR = (t_packet_header_telemetry_raw*)(((u8*)pPH) + sizeof(t_packet_header));
+         pPHTR->telem_segment_index = k;
+         pPHTR->telem_total_data = k;
+         pPHTR->telem_total_serial = k;
+         memcpy(((u8*)pPH) + pPH->total_headers_length, data, iDataLength);
+         int iLength = packets_chain_builder_finalize(&builder);
+         uSum += buffer[k % iLength];
+      }
+      double fNew = _get_time() - fStart;
+      log_line("Compose %3d bytes telemetry packet: stack headers + memcpy %.0f ns, builder in place %.0f ns", iDataLength,
+         fOld * 1000000000.0 / (double)s_iLoops, fNew * 1000000000.0 / (double)s_iLoops);
+   }
+
+   // Parse a full radio frame of chained packets
+   t_packets_chain_builder builder;
+   packets_chain_builder_init(&builder, buffer, MAX_PACKET_PAYLOAD);
+   while ( NULL != packets_chain_builder_add(&builder, PACKET_COMPONENT_TELEMETRY, PACKET_TYPE_RUBY_TELEMETRY_EXTENDED, 0, 1, 2, sizeof(t_packet_header), 40) )
+   {
+   }
+   int iLength = packets_chain_builder_finalize(&builder);
+
+   double fStart = _get_time();
+   for( int k=0; k<s_iLoops; k++ )
+   {
+      u8* pData = buffer;
+      int nLength = iLength;
+      while ( nLength > 0 )
+      {
+         t_packet_header* pPH = (t_packet_header*)pData;
+         uSum += pPH->packet_type;
+         nLength -= pPH->total_length;
+         pData += pPH->total_length;
+      }
+   }
+   double fOld = _get_time() - fStart;
+
+   fStart = _get_time();
+   for( int k=0; k<s_iLoops; k++ )
+   {
+      t_packets_chain_iterator iterator;
+      t_packet_header* pPH = NULL;
+      packets_chain_iterator_init(&iterator, buffer, iLength);
+      while ( NULL != (pPH = packets_chain_iterator_next(&iterator)) )
+         uSum += pPH->packet_type;
+   }
+   double fNew = _get_time() - fStart;
+   log_line("Parse %d chained packets (%d bytes): unchecked walk %.0f ns, checked iterator %.0f ns", builder.iCountPackets, iLength,
+      fOld * 1000000000.0 / (double)s_iLoops, fNew * 1000000000.0 / (double)s_iLoops);
+   log_line("(checksum %u)", uSum);
+}
+
+int main(int argc, char *argv[])
+{
+   log_init_local_only("TestPacketsChain");
+   log_enable_stdout();
+
+   for( int i=1; i<argc; i++ )
+   {
+      if ( 0 == strcmp(argv[i], "-fuzz") && i < argc-1 )
+         s_iFuzzIterations = atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-loops") && i < argc-1 )
+         s_iLoops = atoi(argv[++i]);
+   }
+   if ( s_iLoops < 1 )
+      s_iLoops = 1;
+   srand(1);
+
+   _test_build_and_parse();
+   if ( ! s_iFailed )
+      _test_malformed_chains();
+   _benchmark();
+
+   if ( s_iFailed )
+   {
+      log_line("Test FAILED");
+      return 1;
+   }
+   log_line("Test PASSED");
+   return 0;
+}
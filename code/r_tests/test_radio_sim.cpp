@@ -0,0 +1,659 @@
+#include "../base/base.h"
+#include "../base/models.h"
+#include "../base/ctrl_settings.h"
+#include "../radio/radiopackets2.h"
+#include "../radio/radiopacketsqueue.h"
+#include "../radio/radio_sim.h"
+#include "../radio/fec.h"
+#include "../r_vehicle/processor_tx_video.h"
+#include "../r_vehicle/packets_utils.h"
+#include "../r_vehicle/utils_vehicle.h"
+#include "../r_station/processor_rx_video.h"
+#include "../r_station/processor_rx_video_forward.h"
+#include "../r_station/video_link_adaptive.h"
+#include "../r_station/video_link_keyframe.h"
+
+#include <time.h>
+
+// Offline video link test: runs the vehicle video TX processor (processor_tx_video) and the station
+// video RX processor (processor_rx_video) over simulated radio links, in simulation time, with no radio hardware.
+// This test stands in for both router processes: it owns the globals the two processors use, and
+// routes their radio output and retransmission requests through the simulated links.
+//
+// Usage: test_radio_sim [options]
+//   -duration s          simulated seconds (default 20)
+//   -bitrate kbps        video bitrate (default 6000)
+//   -block d,f           data and FEC packets per block (default 8,4)
+//   -packet bytes        video packet payload size (default 1100)
+//   -loss spec           downlink loss: none | uniform:rate | ge:p_gb,p_bg,loss_good,loss_bad
+//   -uplinkloss spec     uplink loss, same format
+//   -latency ms, -jitter ms, -reorder rate, -bandwidth kbps, -queue packets (downlink queue size)
+//   -noretr              disable retransmissions
+//   -maxwait ms          retransmissions window: max time to wait for a block before dropping it (default 100)
+//   -seed n              random seed
+//   -pcap file           write all downlink packets to a pcap file
+//   -replay file         feed the station RX from a pcap file instead of the simulated vehicle
+
+#define SIM_STEP_MICROS 1000
+// The processors compare g_TimeNow against their timeouts, so the clock does not start at zero
+#define SIM_TIME_OFFSET_MS 10000
+#define SIM_PAYLOAD_HEADER 8
+
+#define STAGE_VEHICLE_TX 0
+#define STAGE_VEHICLE_RETR 1
+#define STAGE_RADIO 2
+#define STAGE_STATION_RX 3
+#define STAGE_STATION_LOOP 4
+#define STAGE_COUNT 5
+
+const char* s_szStageNames[STAGE_COUNT] = { "Vehicle video TX (read + FEC + send)", "Vehicle retransmissions", "Radio links (sim)", "Station video RX (+ FEC decode, output)", "Station video RX loop (retr requests)" };
+double s_dStageCPUMs[STAGE_COUNT];
+
+int s_iDurationSec = 20;
+int s_iBitrateKbps = 6000;
+int s_iBlockData = 8;
+int s_iBlockFec = 4;
+int s_iPacketLength = 1100;
+bool s_bRetransmissions = true;
+u32 s_uMaxWaitMicros = 100000;
+bool s_bCheckPayloads = true;
+
+t_radio_sim_link* s_pDownlink = NULL;
+t_radio_sim_link* s_pUplink = NULL;
+FILE* s_fPcapOut = NULL;
+u32 s_uTimeNow = 0;
+
+typedef struct
+{
+   u32 uPacketsIn;
+   u32 uPacketsSent;
+   u32 uRetrRequestsReceived;
+   u32 uRetrPacketsSent;
+
+   u32 uPacketsReceived;
+   u32 uPacketsBadCRC;
+   u32 uRetrPacketsReceived;
+   u32 uRetrRequestsSent;
+   u32 uPacketsOutput;
+   u32 uPacketsLost;
+   u32 uPacketsOutOfOrder;
+   u32 uPacketsCorrupted;
+   u32 uBytesOutput;
+   double dPacketLatencySumMs;
+   u32 uPacketLatencyMaxMicros;
+} t_sim_stats;
+
+t_sim_stats s_Stats;
+u32 s_uNextPacketIn = 0;
+u32 s_uNextPacketOut = 0;
+bool s_bOutputStarted = false;
+double s_dTXPendingBytes = 0.0;
+
+//----------------------------------------------------------
+// Globals of the vehicle and station processes, used by the two processors
+
+u32 g_TimeNow = 0;
+bool g_bDebug = false;
+Model* g_pCurrentModel = NULL;
+u32 g_uControllerId = 0;
+
+ProcessorTxVideo* g_pProcessorTxVideo = NULL;
+bool g_bVideoPaused = false;
+int g_iFramesSinceLastH264KeyFrame = 0;
+u32 g_TimeLastVideoPacketIn = 0;
+t_packet_header_ruby_telemetry_extended_extra_info_retransmissions g_PHTE_Retransmissions;
+t_packet_header_vehicle_tx_history g_PHVehicleTxStats;
+shared_mem_video_link_stats_and_overwrites g_SM_VideoLinkStats;
+shared_mem_video_link_graphs g_SM_VideoLinkGraphs;
+shared_mem_video_info_stats g_VideoInfoStats;
+shared_mem_video_info_stats g_VideoInfoStatsRadioOut;
+
+FILE* g_fdLogFile = NULL;
+ControllerSettings* g_pControllerSettings = NULL;
+bool g_bSearching = false;
+bool g_bUpdateInProgress = false;
+u32 g_uTimeLastReceivedResponseToAMessage = 0;
+t_packet_queue s_QueueRadioPackets;
+shared_mem_controller_vehicles_adaptive_video_info g_ControllerVehiclesAdaptiveVideoInfo;
+shared_mem_video_decode_stats_history g_VideoDecodeStatsHistory;
+shared_mem_controller_retransmissions_stats g_ControllerRetransmissionsStats;
+t_packet_data_controller_link_stats g_PD_ControllerLinkStats;
+
+double _get_cpu_time_ms()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+   return ts.tv_sec*1000.0 + ts.tv_nsec/1000000.0;
+}
+
+void _set_time(u32 uTimeMicros)
+{
+   s_uTimeNow = uTimeMicros;
+   g_TimeNow = SIM_TIME_OFFSET_MS + uTimeMicros/1000;
+}
+
+// Each video packet carries its sequence number and send time, then a pattern from the sequence number
+
+void _fill_payload(u8* pPayload, u32 uPacketIndex, u32 uTime)
+{
+   memcpy(pPayload, &uPacketIndex, sizeof(u32));
+   memcpy(pPayload+4, &uTime, sizeof(u32));
+   for( int i=SIM_PAYLOAD_HEADER; i<s_iPacketLength; i++ )
+      pPayload[i] = (u8)(uPacketIndex*31 + i);
+}
+
+bool _check_payload(u8* pPayload, u32 uPacketIndex)
+{
+   for( int i=SIM_PAYLOAD_HEADER; i<s_iPacketLength; i++ )
+      if ( pPayload[i] != (u8)(uPacketIndex*31 + i) )
+         return false;
+   return true;
+}
+
+//----------------------------------------------------------
+// Vehicle side: the vehicle router's radio output and its other modules
+
+int send_packet_to_radio_interfaces(u8* pPacketData, int nPacketLength)
+{
+   t_packet_header* pPH = (t_packet_header*)pPacketData;
+   if ( nPacketLength < (int)sizeof(t_packet_header) || nPacketLength > MAX_PACKET_TOTAL_SIZE )
+      return -1;
+
+   u8 uBuffer[MAX_PACKET_TOTAL_SIZE];
+   memcpy(uBuffer, pPacketData, nPacketLength);
+   if ( pPH->packet_flags & PACKET_FLAGS_BIT_HEADERS_ONLY_CRC )
+      packet_compute_crc(uBuffer, pPH->total_headers_length);
+   else
+      packet_compute_crc(uBuffer, pPH->total_length);
+
+   if ( pPH->packet_flags & PACKET_FLAGS_BIT_RETRANSMITED )
+      s_Stats.uRetrPacketsSent++;
+   s_Stats.uPacketsSent++;
+
+   if ( NULL != s_fPcapOut )
+      radio_sim_pcap_write_packet(s_fPcapOut, uBuffer, nPacketLength, s_uTimeNow);
+   double dTime = _get_cpu_time_ms();
+   radio_sim_link_write(s_pDownlink, uBuffer, nPacketLength, s_uTimeNow);
+   s_dStageCPUMs[STAGE_RADIO] += _get_cpu_time_ms() - dTime;
+   return 0;
+}
+
+int get_last_tx_video_datarate_mbps()
+{
+   return 0;
+}
+
+void send_control_message_to_raspivid(u8 parameter, u8 value)
+{
+}
+
+void vehicle_init()
+{
+   g_pProcessorTxVideo = new ProcessorTxVideo(0,0);
+   g_pProcessorTxVideo->init();
+   // The video pacer runs on the system clock; it stays off here, as when the video is paused,
+   // and the simulated link bandwidth spaces the packets, in simulation time
+   g_bVideoPaused = true;
+   process_data_tx_video_init();
+}
+
+void vehicle_uninit()
+{
+   process_data_tx_video_uninit();
+   g_pProcessorTxVideo->uninit();
+   delete g_pProcessorTxVideo;
+   g_pProcessorTxVideo = NULL;
+}
+
+// Same as the vehicle router reading the camera pipe: the data goes straight into the TX blocks buffers
+
+void vehicle_read_video_input()
+{
+   double dTime = _get_cpu_time_ms();
+   s_dTXPendingBytes += (double)s_iBitrateKbps * 1000.0 / 8.0 * (double)SIM_STEP_MICROS / 1000000.0;
+   while ( s_dTXPendingBytes >= s_iPacketLength )
+   {
+      u8 uPayload[MAX_PACKET_TOTAL_SIZE];
+      _fill_payload(uPayload, s_uNextPacketIn, s_uTimeNow);
+      s_uNextPacketIn++;
+      s_Stats.uPacketsIn++;
+      int iPos = 0;
+      while ( iPos < s_iPacketLength )
+      {
+         int iCount = process_data_tx_video_get_current_buffer_to_read_size();
+         if ( iCount > s_iPacketLength - iPos )
+            iCount = s_iPacketLength - iPos;
+         memcpy(process_data_tx_video_get_current_buffer_to_read_pointer(), uPayload + iPos, iCount);
+         process_data_tx_video_on_data_read_complete(iCount);
+         iPos += iCount;
+      }
+      s_dTXPendingBytes -= s_iPacketLength;
+
+      int iReadyToSend = process_data_tx_video_has_packets_ready_to_send();
+      if ( iReadyToSend > 0 )
+         process_data_tx_video_send_packets_ready_to_send(iReadyToSend);
+   }
+   process_data_tx_video_loop();
+   s_dStageCPUMs[STAGE_VEHICLE_TX] += _get_cpu_time_ms() - dTime;
+}
+
+void vehicle_periodic()
+{
+   vehicle_read_video_input();
+
+   u8 uBuffer[MAX_PACKET_TOTAL_SIZE];
+   while ( true )
+   {
+      double dTime = _get_cpu_time_ms();
+      int iLength = radio_sim_link_read(s_pUplink, uBuffer, sizeof(uBuffer), s_uTimeNow);
+      s_dStageCPUMs[STAGE_RADIO] += _get_cpu_time_ms() - dTime;
+      if ( iLength <= 0 )
+         break;
+      t_packet_header* pPH = (t_packet_header*)uBuffer;
+      if ( iLength < (int)sizeof(t_packet_header) || (int)pPH->total_length > iLength || ! packet_check_crc(uBuffer, pPH->total_length) )
+         continue;
+      if ( (pPH->packet_flags & PACKET_FLAGS_MASK_MODULE) != PACKET_COMPONENT_VIDEO )
+         continue;
+      dTime = _get_cpu_time_ms();
+      s_Stats.uRetrRequestsReceived++;
+      process_data_tx_video_command(0, uBuffer);
+      s_dStageCPUMs[STAGE_VEHICLE_RETR] += _get_cpu_time_ms() - dTime;
+   }
+}
+
+//----------------------------------------------------------
+// Station side: the station router's video output and its other modules
+
+void processor_rx_video_forward_init()
+{
+}
+
+void processor_rx_video_forward_uninit()
+{
+}
+
+void processor_rx_video_forward_video_data(u8* pBuffer, int length)
+{
+   s_Stats.uPacketsOutput++;
+   s_Stats.uBytesOutput += length;
+   if ( ! s_bCheckPayloads )
+      return;
+
+   u32 uPacketIndex = 0;
+   u32 uTimeSent = 0;
+   memcpy(&uPacketIndex, pBuffer, sizeof(u32));
+   memcpy(&uTimeSent, pBuffer+4, sizeof(u32));
+   if ( length != s_iPacketLength || uPacketIndex >= s_uNextPacketIn || ! _check_payload(pBuffer, uPacketIndex) )
+   {
+      s_Stats.uPacketsCorrupted++;
+      return;
+   }
+   if ( s_bOutputStarted && uPacketIndex < s_uNextPacketOut )
+   {
+      s_Stats.uPacketsOutOfOrder++;
+      return;
+   }
+   if ( s_bOutputStarted )
+      s_Stats.uPacketsLost += uPacketIndex - s_uNextPacketOut;
+   s_bOutputStarted = true;
+   s_uNextPacketOut = uPacketIndex+1;
+
+   u32 uLatency = s_uTimeNow - uTimeSent;
+   s_Stats.dPacketLatencySumMs += uLatency/1000.0;
+   if ( uLatency > s_Stats.uPacketLatencyMaxMicros )
+      s_Stats.uPacketLatencyMaxMicros = uLatency;
+}
+
+void video_link_adaptive_init()
+{
+}
+
+void video_line_adaptive_switch_to_med_level()
+{
+}
+
+void video_link_adaptive_set_intial_video_adjustment_level(int iCurrentVideoProfile, u8 uDataPackets, u8 uECPackets)
+{
+}
+
+void video_link_keyframe_init()
+{
+}
+
+void video_link_keyframe_set_intial_received_level(int iReceivedKeyframe)
+{
+}
+
+bool station_init()
+{
+   packets_queue_init(&s_QueueRadioPackets);
+   return process_data_rx_video_init();
+}
+
+void station_process_radio_frame(u8* pBuffer, int iLength)
+{
+   // Stands in for the pings answered by the vehicle: the link to the vehicle is up while packets come in
+   g_uTimeLastReceivedResponseToAMessage = g_TimeNow;
+
+   // A radio frame can hold several Ruby packets
+   while ( iLength >= (int)sizeof(t_packet_header) )
+   {
+      t_packet_header* pPH = (t_packet_header*)pBuffer;
+      int iPacketLength = pPH->total_length;
+      if ( iPacketLength < (int)sizeof(t_packet_header) || iPacketLength > iLength )
+         iPacketLength = iLength;
+      int iCRCLength = (pPH->packet_flags & PACKET_FLAGS_BIT_HEADERS_ONLY_CRC)?pPH->total_headers_length:pPH->total_length;
+      if ( iCRCLength > iPacketLength || ! packet_check_crc(pBuffer, iCRCLength) )
+         s_Stats.uPacketsBadCRC++;
+      else if ( (pPH->packet_flags & PACKET_FLAGS_MASK_MODULE) == PACKET_COMPONENT_VIDEO && pPH->packet_type == PACKET_TYPE_VIDEO_DATA_FULL &&
+                iPacketLength >= (int)(sizeof(t_packet_header) + sizeof(t_packet_header_video_full)) )
+      {
+         s_Stats.uPacketsReceived++;
+         if ( pPH->packet_flags & PACKET_FLAGS_BIT_RETRANSMITED )
+            s_Stats.uRetrPacketsReceived++;
+         process_data_rx_video_on_new_packet(0, pBuffer, iPacketLength);
+      }
+      pBuffer += iPacketLength;
+      iLength -= iPacketLength;
+   }
+}
+
+void station_periodic()
+{
+   u8 uBuffer[MAX_PACKET_TOTAL_SIZE];
+   while ( true )
+   {
+      double dTime = _get_cpu_time_ms();
+      int iLength = radio_sim_link_read(s_pDownlink, uBuffer, sizeof(uBuffer), s_uTimeNow);
+      s_dStageCPUMs[STAGE_RADIO] += _get_cpu_time_ms() - dTime;
+      if ( iLength <= 0 )
+         break;
+      dTime = _get_cpu_time_ms();
+      station_process_radio_frame(uBuffer, iLength);
+      s_dStageCPUMs[STAGE_STATION_RX] += _get_cpu_time_ms() - dTime;
+   }
+
+   double dTime = _get_cpu_time_ms();
+   process_data_rx_video_loop();
+   s_dStageCPUMs[STAGE_STATION_LOOP] += _get_cpu_time_ms() - dTime;
+
+   // The retransmission requests queued by the RX processor go to the vehicle
+   while ( packets_queue_has_packets(&s_QueueRadioPackets) )
+   {
+      int iLength = 0;
+      u8* pPacket = packets_queue_pop_packet(&s_QueueRadioPackets, &iLength);
+      if ( NULL == pPacket )
+         break;
+      t_packet_header* pPH = (t_packet_header*)pPacket;
+      if ( iLength < (int)sizeof(t_packet_header) || (int)pPH->total_length > iLength )
+         continue;
+      packet_compute_crc(pPacket, pPH->total_length);
+      s_Stats.uRetrRequestsSent++;
+      dTime = _get_cpu_time_ms();
+      radio_sim_link_write(s_pUplink, pPacket, pPH->total_length, s_uTimeNow);
+      s_dStageCPUMs[STAGE_RADIO] += _get_cpu_time_ms() - dTime;
+   }
+}
+
+//----------------------------------------------------------
+
+void _setup_model()
+{
+   g_pCurrentModel = new Model();
+   g_pCurrentModel->resetToDefaults(true);
+   // A default model is a spectator one, that never requests retransmissions
+   g_pCurrentModel->is_spectator = false;
+   g_pCurrentModel->clock_sync_type = CLOCK_SYNC_TYPE_NONE;
+
+   int iProfile = g_pCurrentModel->video_params.user_selected_video_link_profile;
+   type_video_link_profile* pProfile = &(g_pCurrentModel->video_link_profiles[iProfile]);
+   pProfile->block_packets = s_iBlockData;
+   pProfile->block_fecs = s_iBlockFec;
+   pProfile->packet_length = s_iPacketLength;
+   pProfile->bitrate_fixed_bps = s_iBitrateKbps*1000;
+   pProfile->encoding_extra_flags &= ~(ENCODING_EXTRA_FLAG_ENABLE_ADAPTIVE_VIDEO_LINK_PARAMS | ENCODING_EXTRA_FLAG_ENABLE_RETRANSMISSIONS | 0xFF00);
+   if ( s_bRetransmissions )
+      pProfile->encoding_extra_flags |= ENCODING_EXTRA_FLAG_ENABLE_RETRANSMISSIONS;
+   // Retransmissions window, in 5 ms units
+   u32 uWindow = s_uMaxWaitMicros/5000;
+   if ( uWindow > 255 )
+      uWindow = 255;
+   pProfile->encoding_extra_flags |= uWindow << 8;
+
+   memset(&g_SM_VideoLinkStats, 0, sizeof(g_SM_VideoLinkStats));
+   g_SM_VideoLinkStats.overwrites.currentVideoLinkProfile = iProfile;
+
+   reset_ControllerSettings();
+   g_pControllerSettings = get_ControllerSettings();
+}
+
+int run_replay(const char* szFile)
+{
+   FILE* fd = radio_sim_pcap_open_read(szFile);
+   if ( NULL == fd )
+      return -1;
+
+   u8 uBuffer[MAX_PACKET_TOTAL_SIZE];
+   u32 uTimePacket = 0;
+   u32 uTimeFirst = 0;
+   bool bFirst = true;
+   int iFrames = 0;
+   while ( true )
+   {
+      int iLength = radio_sim_pcap_read_packet(fd, uBuffer, sizeof(uBuffer), &uTimePacket);
+      if ( iLength <= 0 )
+         break;
+      if ( bFirst )
+      {
+         uTimeFirst = uTimePacket;
+         bFirst = false;
+      }
+      // Replayed packets go through the downlink too, so loss and delays can be added to a real capture
+      _set_time(uTimePacket - uTimeFirst);
+      radio_sim_link_write(s_pDownlink, uBuffer, iLength, s_uTimeNow);
+      station_periodic();
+      iFrames++;
+   }
+   fclose(fd);
+   u32 uEnd = s_uTimeNow + s_uMaxWaitMicros + 1000000;
+   while ( s_uTimeNow < uEnd )
+   {
+      _set_time(s_uTimeNow + SIM_STEP_MICROS);
+      station_periodic();
+   }
+   log_line("Replayed %d radio frames from %s", iFrames, szFile);
+   return s_uTimeNow;
+}
+
+void run_simulation()
+{
+   u32 uEnd = s_iDurationSec * 1000000;
+   for( _set_time(0); s_uTimeNow < uEnd; _set_time(s_uTimeNow + SIM_STEP_MICROS) )
+   {
+      vehicle_periodic();
+      station_periodic();
+   }
+   // Let the in flight packets and retransmissions settle, with no new video
+   int iBitrate = s_iBitrateKbps;
+   s_iBitrateKbps = 0;
+   u32 uSettle = s_uTimeNow + s_uMaxWaitMicros + 200000;
+   for( ; s_uTimeNow < uSettle; _set_time(s_uTimeNow + SIM_STEP_MICROS) )
+   {
+      vehicle_periodic();
+      station_periodic();
+   }
+   s_iBitrateKbps = iBitrate;
+}
+
+bool _parse_args(int argc, char *argv[], t_radio_sim_link_params* pDown, t_radio_sim_link_params* pUp, u32* puSeed, const char** pszPcap, const char** pszReplay)
+{
+   for( int i=1; i<argc; i++ )
+   {
+      bool bHasValue = (i < argc-1);
+      if ( 0 == strcmp(argv[i], "-noretr") )
+         s_bRetransmissions = false;
+      else if ( ! bHasValue )
+         return false;
+      else if ( 0 == strcmp(argv[i], "-duration") )
+         s_iDurationSec = atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-bitrate") )
+         s_iBitrateKbps = atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-block") )
+      {
+         if ( 2 != sscanf(argv[++i], "%d,%d", &s_iBlockData, &s_iBlockFec) )
+            return false;
+      }
+      else if ( 0 == strcmp(argv[i], "-packet") )
+         s_iPacketLength = atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-loss") )
+      {
+         if ( ! radio_sim_parse_loss_model(argv[++i], pDown) )
+            return false;
+      }
+      else if ( 0 == strcmp(argv[i], "-uplinkloss") )
+      {
+         if ( ! radio_sim_parse_loss_model(argv[++i], pUp) )
+            return false;
+      }
+      else if ( 0 == strcmp(argv[i], "-latency") )
+         pDown->uLatencyMicros = pUp->uLatencyMicros = atoi(argv[++i])*1000;
+      else if ( 0 == strcmp(argv[i], "-jitter") )
+         pDown->uJitterMicros = pUp->uJitterMicros = atoi(argv[++i])*1000;
+      else if ( 0 == strcmp(argv[i], "-reorder") )
+         pDown->fReorderRate = atof(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-bandwidth") )
+         pDown->uBandwidthBitsPerSec = atoi(argv[++i])*1000;
+      else if ( 0 == strcmp(argv[i], "-queue") )
+         pDown->iMaxQueuedPackets = atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-maxwait") )
+         s_uMaxWaitMicros = atoi(argv[++i])*1000;
+      else if ( 0 == strcmp(argv[i], "-seed") )
+         *puSeed = (u32)atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-pcap") )
+         *pszPcap = argv[++i];
+      else if ( 0 == strcmp(argv[i], "-replay") )
+         *pszReplay = argv[++i];
+      else
+         return false;
+   }
+   if ( s_iBlockData < 1 || s_iBlockData > MAX_DATA_PACKETS_IN_BLOCK || s_iBlockFec < 0 || s_iBlockFec > MAX_FECS_PACKETS_IN_BLOCK )
+      return false;
+   // The RX processor drops video packets shorter than 100 bytes
+   if ( s_iPacketLength < 100 || s_iPacketLength > MAX_PACKET_PAYLOAD )
+      return false;
+   return true;
+}
+
+int main(int argc, char *argv[])
+{
+   log_init_local_only("TestRadioSim");
+   log_enable_stdout();
+
+   t_radio_sim_link_params paramsDown;
+   t_radio_sim_link_params paramsUp;
+   radio_sim_link_params_reset(&paramsDown);
+   radio_sim_link_params_reset(&paramsUp);
+   u32 uSeed = 1;
+   const char* szPcap = NULL;
+   const char* szReplay = NULL;
+   if ( ! _parse_args(argc, argv, &paramsDown, &paramsUp, &uSeed, &szPcap, &szReplay) )
+   {
+      printf("Usage: test_radio_sim [-duration s] [-bitrate kbps] [-block d,f] [-packet bytes] [-loss spec] [-uplinkloss spec]\n");
+      printf("   [-latency ms] [-jitter ms] [-reorder rate] [-bandwidth kbps] [-queue packets] [-noretr] [-maxwait ms] [-seed n] [-pcap file] [-replay file]\n");
+      printf("   loss spec: none | uniform:rate | ge:p_good_to_bad,p_bad_to_good,loss_good,loss_bad\n");
+      return 1;
+   }
+   if ( NULL != szReplay )
+   {
+      // A capture holds real video, with no known payload; there is no vehicle to answer retransmissions
+      s_bCheckPayloads = false;
+      s_bRetransmissions = false;
+   }
+
+   fec_init();
+   memset(&s_Stats, 0, sizeof(s_Stats));
+   memset(s_dStageCPUMs, 0, sizeof(s_dStageCPUMs));
+   s_pDownlink = radio_sim_link_create(&paramsDown, uSeed);
+   s_pUplink = radio_sim_link_create(&paramsUp, uSeed*7919+1);
+   if ( NULL == s_pDownlink || NULL == s_pUplink )
+      return 1;
+
+   _set_time(0);
+   _setup_model();
+   if ( NULL == szReplay )
+      vehicle_init();
+   if ( ! station_init() )
+   {
+      log_line("FAILED: can't initialize the video RX processor.");
+      return 1;
+   }
+
+   if ( NULL != szPcap )
+      s_fPcapOut = radio_sim_pcap_open_write(szPcap);
+
+   struct timespec tsStart, tsEnd;
+   clock_gettime(CLOCK_MONOTONIC, &tsStart);
+   double dCPUStart = _get_cpu_time_ms();
+
+   u32 uSimDurationMicros = s_iDurationSec * 1000000;
+   if ( NULL != szReplay )
+   {
+      int iRes = run_replay(szReplay);
+      if ( iRes < 0 )
+         return 1;
+      uSimDurationMicros = iRes;
+   }
+   else
+      run_simulation();
+
+   double dCPUTotal = _get_cpu_time_ms() - dCPUStart;
+   clock_gettime(CLOCK_MONOTONIC, &tsEnd);
+   double dWallMs = (tsEnd.tv_sec - tsStart.tv_sec)*1000.0 + (tsEnd.tv_nsec - tsStart.tv_nsec)/1000000.0;
+
+   if ( NULL != s_fPcapOut )
+      fclose(s_fPcapOut);
+
+   log_line("------------------------------------------");
+   log_line("Simulated %.1f s of video link in %.1f ms (%.1f ms CPU)", uSimDurationMicros/1000000.0, dWallMs, dCPUTotal);
+   log_line("Downlink: %u packets in, %u lost, %u dropped on full queue, %u reordered, %u delivered, max queue: %u",
+      s_pDownlink->stats.uPacketsIn, s_pDownlink->stats.uPacketsLost, s_pDownlink->stats.uPacketsDroppedQueueFull,
+      s_pDownlink->stats.uPacketsReordered, s_pDownlink->stats.uPacketsDelivered, s_pDownlink->stats.uMaxQueuedPackets);
+   log_line("Uplink: %u packets in, %u lost, %u delivered", s_pUplink->stats.uPacketsIn, s_pUplink->stats.uPacketsLost, s_pUplink->stats.uPacketsDelivered);
+   log_line("Vehicle: %u video packets in, %u packets sent (%u retransmitted); %u retransmission requests received (%u unique segments, %u retried)",
+      s_Stats.uPacketsIn, s_Stats.uPacketsSent, s_Stats.uRetrPacketsSent, s_Stats.uRetrRequestsReceived,
+      g_PHTE_Retransmissions.totalReceivedRetransmissionsRequestsSegmentsUnique, g_PHTE_Retransmissions.totalReceivedRetransmissionsRequestsSegmentsRetried);
+   log_line("Station: %u packets received (%u retransmitted, %u bad CRC); %u retransmission requests sent for %u segments",
+      s_Stats.uPacketsReceived, s_Stats.uRetrPacketsReceived, s_Stats.uPacketsBadCRC, s_Stats.uRetrRequestsSent, g_ControllerRetransmissionsStats.totalRequestedSegments);
+   if ( s_bCheckPayloads )
+      log_line("Video packets: %u output, %u lost, %u out of order, %u corrupted", s_Stats.uPacketsOutput, s_Stats.uPacketsLost, s_Stats.uPacketsOutOfOrder, s_Stats.uPacketsCorrupted);
+   else
+      log_line("Video packets: %u output", s_Stats.uPacketsOutput);
+   if ( uSimDurationMicros > 0 && NULL != szReplay )
+      log_line("Video throughput: %.1f kbps", (double)s_Stats.uBytesOutput*8.0*1000.0/(double)uSimDurationMicros);
+   else if ( uSimDurationMicros > 0 )
+      log_line("Video throughput: %.1f kbps out of %d kbps", (double)s_Stats.uBytesOutput*8.0*1000.0/(double)uSimDurationMicros, s_iBitrateKbps);
+   if ( s_bCheckPayloads && s_Stats.uPacketsOutput > 0 )
+      log_line("Packet latency: avg %.2f ms, max %.2f ms", s_Stats.dPacketLatencySumMs/s_Stats.uPacketsOutput, s_Stats.uPacketLatencyMaxMicros/1000.0);
+   u32 uOutputBlocks = s_Stats.uPacketsOutput/s_iBlockData;
+   for( int i=0; i<STAGE_COUNT; i++ )
+      log_line("CPU %-40s %8.2f ms (%.2f us per output block)", s_szStageNames[i], s_dStageCPUMs[i], (uOutputBlocks > 0)?(s_dStageCPUMs[i]*1000.0/uOutputBlocks):0.0);
+
+   process_data_rx_video_uninit();
+   if ( NULL == szReplay )
+      vehicle_uninit();
+   delete g_pCurrentModel;
+   radio_sim_link_destroy(s_pDownlink);
+   radio_sim_link_destroy(s_pUplink);
+
+   if ( s_Stats.uPacketsCorrupted > 0 || s_Stats.uPacketsOutOfOrder > 0 )
+   {
+      log_line("FAILED: corrupted or out of order video packets were output.");
+      return 1;
+   }
+   if ( NULL == szReplay && 0 == s_Stats.uPacketsOutput )
+   {
+      log_line("FAILED: no video was output.");
+      return 1;
+   }
+   return 0;
+}
@@ -0,0 +1,229 @@
+#include "../base/base.h"
+#include "../base/config.h"
+#include "../radio/radiolink.h"
+#include "../radio/radioflags.h"
+#include "../radio/radio_tx_templates.h"
+
+#include <time.h>
+
+// Checks that radio packets built from the prebuilt radio headers templates are identical to the ones
+// built by radio_build_packet, for legacy and MCS datarates, radio flags, ports, lengths and chained packets
+// (with whole packet and headers only CRCs), copied or built in place, then benchmarks both ways of building a packet.
+// Usage: test_radio_tx_templates [-loops N]
+
+int s_iFailed = 0;
+int s_iLoops = 200000;
+
+void _fail(const char* szText)
+{
+   log_line("%s <- FAILED", szText);
+   s_iFailed = 1;
+}
+
+double _get_time()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0;
+}
+
+// Fills the buffer with iCount chained packets of random content, returns the total length
+int _build_chained_packets(u8* pBuffer, int iLength, int iCount, u32 uIndex)
+{
+   for( int i=0; i<iLength; i++ )
+      pBuffer[i] = (u8)rand();
+   if ( iCount < 1 )
+      iCount = 1;
+   if ( iLength < iCount * (int)sizeof(t_packet_header) )
+      iCount = iLength / sizeof(t_packet_header);
+
+   int iPos = 0;
+   for( int i=0; i<iCount; i++ )
+   {
+      int iPacketLength = (i == iCount-1)?(iLength - iPos):(iLength / iCount);
+      t_packet_header* pPH = (t_packet_header*)(pBuffer + iPos);
+      pPH->packet_flags = PACKET_COMPONENT_TELEMETRY;
+      if ( rand() % 2 )
+         pPH->packet_flags |= PACKET_FLAGS_BIT_HEADERS_ONLY_CRC;
+      pPH->packet_type = PACKET_TYPE_RUBY_TELEMETRY_EXTENDED;
+      pPH->stream_packet_idx = uIndex + i;
+      pPH->total_headers_length = sizeof(t_packet_header);
+      pPH->total_length = iPacketLength;
+      iPos += iPacketLength;
+   }
+   return iPos;
+}
+
+void _test_same_output(int iPayloadMode)
+{
+   int iDataRates[] = { 2, 6, 12, 18, 24, 48, 54, -1, -2, -3, -5, -7 };
+   u32 uRadioFlags[] = {
+      DEFAULT_RADIO_FRAMES_FLAGS,
+      RADIO_FLAGS_FRAME_TYPE_DATA | RADIO_FLAGS_HT20,
+      RADIO_FLAGS_FRAME_TYPE_DATA | RADIO_FLAGS_HT40 | RADIO_FLAGS_SHORT_GI | RADIO_FLAGS_APPLY_MCS_FLAGS_ON_VEHICLE,
+      RADIO_FLAGS_FRAME_TYPE_DATA | RADIO_FLAGS_HT20 | RADIO_FLAGS_STBC | RADIO_FLAGS_LDPC | RADIO_FLAGS_APPLY_MCS_FLAGS_ON_VEHICLE,
+      RADIO_FLAGS_FRAME_TYPE_RTS | RADIO_FLAGS_HT20 };
+   int iPorts[] = { RADIO_PORT_ROUTER_DOWNLINK, RADIO_PORT_ROUTER_UPLINK };
+   int iLengths[] = { (int)sizeof(t_packet_header), 64, 333, 800, MAX_PACKET_PAYLOAD };
+
+   u8 packet[MAX_PACKET_TOTAL_SIZE];
+   u8 packetCopy[MAX_PACKET_TOTAL_SIZE];
+   u8 rawBuilder[MAX_PACKET_TOTAL_SIZE];
+   u8 rawTemplate[MAX_PACKET_TOTAL_SIZE];
+   u8 frameInPlace[RADIO_TX_TEMPLATE_MAX_HEADER + MAX_PACKET_TOTAL_SIZE];
+   char szBuff[256];
+   int iCompared = 0;
+
+   for( int r=0; r<(int)(sizeof(iDataRates)/sizeof(iDataRates[0])); r++ )
+   for( int f=0; f<(int)(sizeof(uRadioFlags)/sizeof(uRadioFlags[0])); f++ )
+   for( int p=0; p<(int)(sizeof(iPorts)/sizeof(iPorts[0])); p++ )
+   {
+      t_radio_tx_template txTemplate;
+      if ( ! radio_tx_template_init(&txTemplate, iDataRates[r], uRadioFlags[f], iPorts[p]) )
+      {
+         sprintf(szBuff, "Can't create template for datarate %d, radio flags %u, port %d", iDataRates[r], uRadioFlags[f], iPorts[p]);
+         _fail(szBuff);
+         continue;
+      }
+
+      for( int l=0; l<(int)(sizeof(iLengths)/sizeof(iLengths[0])); l++ )
+      for( int iChained=1; iChained<=3; iChained++ )
+      {
+         int iLength = _build_chained_packets(packet, iLengths[l], iChained, iCompared);
+         memcpy(packetCopy, packet, iLength);
+
+         // Other packets may have been built in between with other datarates or flags
+         radio_set_out_datarate(iDataRates[r]);
+         radio_set_frames_flags(uRadioFlags[f]);
+         int iLengthBuilder = radio_build_packet(rawBuilder, packet, iLength, iPorts[p], 0, 0, NULL);
+         int iLengthTemplate = radio_tx_template_build_packet(&txTemplate, iPayloadMode, rawTemplate, packetCopy, iLength);
+         iCompared++;
+
+         if ( (iLengthBuilder != iLengthTemplate) || (0 != memcmp(rawBuilder, rawTemplate, iLengthBuilder)) )
+         {
+            sprintf(szBuff, "Different packets for datarate %d, radio flags %u, port %d, %d bytes in %d chained packets (lengths: %d, %d)",
+               iDataRates[r], uRadioFlags[f], iPorts[p], iLength, iChained, iLengthBuilder, iLengthTemplate);
+            _fail(szBuff);
+            return;
+         }
+
+         // Built in place, with room for the radio headers before the packets
+         u8* pRawInPlace = NULL;
+         memcpy(frameInPlace + RADIO_TX_TEMPLATE_MAX_HEADER, packetCopy, iLength);
+         int iLengthInPlace = radio_tx_template_build_packet_in_place(&txTemplate, iPayloadMode, frameInPlace + RADIO_TX_TEMPLATE_MAX_HEADER, iLength, &pRawInPlace);
+         if ( (iLengthBuilder != iLengthInPlace) || (NULL == pRawInPlace) || (0 != memcmp(rawBuilder, pRawInPlace, iLengthBuilder)) )
+         {
+            sprintf(szBuff, "Different packets built in place for datarate %d, radio flags %u, port %d, %d bytes in %d chained packets (lengths: %d, %d)",
+               iDataRates[r], uRadioFlags[f], iPorts[p], iLength, iChained, iLengthBuilder, iLengthInPlace);
+            _fail(szBuff);
+            return;
+         }
+      }
+   }
+   log_line("Compared %d packets built by radio_build_packet and from templates (copied and in place): all identical.", iCompared);
+}
+
+void _test_invalid_input(int iPayloadMode)
+{
+   u8 packet[MAX_PACKET_TOTAL_SIZE];
+   u8 raw[MAX_PACKET_TOTAL_SIZE];
+   t_radio_tx_template txTemplate;
+   memset(&txTemplate, 0, sizeof(txTemplate));
+
+   _build_chained_packets(packet, 200, 1, 0);
+   if ( 0 != radio_tx_template_build_packet(&txTemplate, iPayloadMode, raw, packet, 200) )
+      _fail("Uninitialized template built a packet");
+   if ( 0 != radio_tx_template_build_packet(NULL, iPayloadMode, raw, packet, 200) )
+      _fail("NULL template built a packet");
+   if ( ! radio_tx_template_init(&txTemplate, DEFAULT_RADIO_DATARATE, DEFAULT_RADIO_FRAMES_FLAGS, RADIO_PORT_ROUTER_DOWNLINK) )
+   {
+      _fail("Can't create default template");
+      return;
+   }
+   if ( 0 != radio_tx_template_build_packet(&txTemplate, iPayloadMode, raw, packet, 0) )
+      _fail("Template built an empty packet");
+   if ( 0 != radio_tx_template_build_packet(&txTemplate, iPayloadMode, raw, packet, MAX_PACKET_TOTAL_SIZE) )
+      _fail("Template built a packet larger than the max radio packet");
+   if ( 0 != radio_tx_template_build_packet(&txTemplate, RADIO_TX_PAYLOAD_MODE_BUILDER, raw, packet, 200) )
+      _fail("Template built a packet in builder mode");
+}
+
+void _benchmark(int iPayloadMode)
+{
+   u8 packet[MAX_PACKET_TOTAL_SIZE];
+   u8 raw[MAX_PACKET_TOTAL_SIZE];
+   u32 uSum = 0;
+
+   t_radio_tx_template txTemplate;
+   if ( ! radio_tx_template_init(&txTemplate, -3, DEFAULT_RADIO_FRAMES_FLAGS, RADIO_PORT_ROUTER_DOWNLINK) )
+   {
+      _fail("Can't create benchmark template");
+      return;
+   }
+
+   for( int iSize=64; iSize<=MAX_PACKET_PAYLOAD; iSize = (iSize < MAX_PACKET_PAYLOAD/4)?(iSize*4):MAX_PACKET_PAYLOAD )
+   {
+      int iLength = _build_chained_packets(packet, iSize, 1, 0);
+
+      // As before: datarate and radio flags set, then the packet built, for each packet sent
+      double fStart = _get_time();
+      for( int k=0; k<s_iLoops; k++ )
+      {
+         packet[sizeof(t_packet_header)] = (u8)k;
+         radio_set_out_datarate(-3);
+         radio_set_frames_flags(DEFAULT_RADIO_FRAMES_FLAGS);
+         int iTotal = radio_build_packet(raw, packet, iLength, RADIO_PORT_ROUTER_DOWNLINK, 0, 0, NULL);
+         uSum += raw[iTotal-1];
+      }
+      double fBuilder = _get_time() - fStart;
+
+      fStart = _get_time();
+      if ( iPayloadMode != RADIO_TX_PAYLOAD_MODE_BUILDER )
+      for( int k=0; k<s_iLoops; k++ )
+      {
+         packet[sizeof(t_packet_header)] = (u8)k;
+         int iTotal = radio_tx_template_build_packet(&txTemplate, iPayloadMode, raw, packet, iLength);
+         uSum += raw[iTotal-1];
+      }
+      double fTemplate = _get_time() - fStart;
+
+      log_line("Build %4d bytes radio packets: radio_build_packet %.0f ns, template %.0f ns per packet", iSize,
+         fBuilder * 1000000000.0 / (double)s_iLoops, fTemplate * 1000000000.0 / (double)s_iLoops);
+      if ( iSize == MAX_PACKET_PAYLOAD )
+         break;
+   }
+   log_line("(checksum %u)", uSum);
+}
+
+int main(int argc, char *argv[])
+{
+   log_init_local_only("TestRadioTXTemplates");
+   log_enable_stdout();
+
+   for( int i=1; i<argc; i++ )
+   {
+      if ( 0 == strcmp(argv[i], "-loops") && i < argc-1 )
+         s_iLoops = atoi(argv[++i]);
+   }
+   if ( s_iLoops < 1 )
+      s_iLoops = 1;
+   srand(1);
+
+   int iPayloadMode = radio_tx_templates_detect_payload_mode();
+   if ( iPayloadMode == RADIO_TX_PAYLOAD_MODE_BUILDER )
+      log_line("Radio packets can't be built from templates on this build, the vehicle will use radio_build_packet for all packets.");
+   else
+   {
+      _test_same_output(iPayloadMode);
+      _test_invalid_input(iPayloadMode);
+   }
+   _benchmark(iPayloadMode);
+
+   if ( s_iFailed )
+   {
+      log_line("Test FAILED");
+      return 1;
+   }
+   log_line("Test PASSED");
+   return 0;
+}
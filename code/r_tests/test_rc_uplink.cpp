@@ -0,0 +1,379 @@
+#include "../base/base.h"
+#include "../base/config.h"
+#include "../base/hardware.h"
+#include "../radio/radiopackets2.h"
+#include "../radio/radiopackets_rc.h"
+
+#include <time.h>
+#include <sys/time.h>
+#include <sys/epoll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <linux/joystick.h>
+
+// RC uplink latency test: a virtual joystick (a pipe fed with js_event records by a generator thread)
+// drives a RC TX loop, that sends the frames on a file backed link. A receiver thread tails the file,
+// drops packets at random and decodes the frames the way the vehicle does.
+// Runs the event driven loop (epoll on the joystick, as ruby_tx_rc) and the old fixed polling loop,
+// reports the input to decode latency distribution of both and checks all decoded frames.
+// Usage: test_rc_uplink [-seconds N] [-fps N] [-loss percent] [-seed N] [-link file]
+
+#define MAX_TEST_INPUTS 20000
+#define MAX_TEST_FRAMES 20000
+
+int s_iSeconds = 5;
+int s_iFPS = 50;
+int s_iLossPercent = 10;
+unsigned int s_uSeed = 1;
+char s_szLinkFile[256] = "/tmp/test_rc_uplink.bin";
+int s_iChannels = 8;
+
+volatile bool s_bGeneratorDone = false;
+volatile bool s_bTxDone = false;
+int s_fdJoystickWrite = -1;
+
+// Inputs: the value of the axis and the time it was written to the joystick
+int s_iInputsCount = 0;
+u32 s_uInputTimeMicros[MAX_TEST_INPUTS];
+bool s_bInputDecoded[MAX_TEST_INPUTS];
+
+// Frames sent, by sequence
+int s_iFramesSent = 0;
+u16 s_uFramesSentCh0[MAX_TEST_FRAMES];
+u16 s_uFramesSentCh1[MAX_TEST_FRAMES];
+
+typedef struct
+{
+   u32 uLatencies[MAX_TEST_INPUTS];
+   int iLatenciesCount;
+   int iFramesReceived;
+   int iFramesLost;
+   int iFramesDropped;
+   int iMismatches;
+} t_rx_results;
+
+t_rx_results s_RxResults;
+
+void* _thread_generator(void* pParam)
+{
+   unsigned int uSeed = s_uSeed;
+   u32 uTimeEnd = get_current_timestamp_ms() + s_iSeconds*1000;
+   while ( get_current_timestamp_ms() < uTimeEnd && s_iInputsCount < MAX_TEST_INPUTS )
+   {
+      // Stick moves every 2 to 40 ms. The input index goes in the axes values (channel 0: low part, channel 1: high part)
+      hardware_sleep_micros(2000 + rand_r(&uSeed) % 38000);
+      struct js_event ev[2];
+      memset(ev, 0, sizeof(ev));
+      ev[0].type = JS_EVENT_AXIS;
+      ev[0].number = 0;
+      ev[0].value = s_iInputsCount % 1000;
+      ev[1].type = JS_EVENT_AXIS;
+      ev[1].number = 1;
+      ev[1].value = s_iInputsCount / 1000;
+      s_uInputTimeMicros[s_iInputsCount] = get_current_timestamp_micros();
+      s_bInputDecoded[s_iInputsCount] = false;
+      s_iInputsCount++;
+      if ( write(s_fdJoystickWrite, ev, sizeof(ev)) != (int)sizeof(ev) )
+         log_softerror_and_alarm("Failed to write joystick events.");
+   }
+   s_bGeneratorDone = true;
+   return NULL;
+}
+
+void _on_frame_decoded(int iSequence, u16* pChannels, u32 uTimeNowMicros)
+{
+   s_RxResults.iFramesReceived++;
+   if ( iSequence < 0 || iSequence >= s_iFramesSent )
+   {
+      s_RxResults.iMismatches++;
+      return;
+   }
+   if ( pChannels[0] != s_uFramesSentCh0[iSequence] || pChannels[1] != s_uFramesSentCh1[iSequence] )
+   {
+      s_RxResults.iMismatches++;
+      return;
+   }
+   if ( pChannels[0] < 1000 || pChannels[1] < 1000 )
+      return;
+   int iInput = (pChannels[1]-1000)*1000 + (pChannels[0]-1000);
+   if ( iInput < 0 || iInput >= s_iInputsCount || s_bInputDecoded[iInput] )
+      return;
+   s_bInputDecoded[iInput] = true;
+   s_RxResults.uLatencies[s_RxResults.iLatenciesCount++] = uTimeNowMicros - s_uInputTimeMicros[iInput];
+}
+
+void* _thread_receiver(void* pParam)
+{
+   unsigned int uSeed = s_uSeed + 17;
+   int fd = open(s_szLinkFile, O_RDONLY);
+   if ( fd < 0 )
+      return NULL;
+
+   u8 uBuffer[MAX_PACKET_TOTAL_SIZE*4];
+   int iBufferPos = 0;
+   int iLastSequence = -1;
+   while ( true )
+   {
+      int iRead = read(fd, uBuffer + iBufferPos, sizeof(uBuffer) - iBufferPos);
+      if ( iRead <= 0 )
+      {
+         if ( s_bTxDone )
+            break;
+         hardware_sleep_micros(100);
+         continue;
+      }
+      iBufferPos += iRead;
+
+      while ( iBufferPos >= 2 )
+      {
+         int iLength = uBuffer[0] | (((int)uBuffer[1]) << 8);
+         if ( iBufferPos < 2 + iLength )
+            break;
+         u8* pPacket = uBuffer + 2;
+         u32 uTimeNowMicros = get_current_timestamp_micros();
+         bool bDrop = ((int)(rand_r(&uSeed) % 100) < s_iLossPercent);
+         t_packet_header* pPH = (t_packet_header*)pPacket;
+         if ( bDrop )
+            s_RxResults.iFramesDropped++;
+         else if ( packet_check_crc(pPacket, pPH->total_length) && pPH->packet_type == PACKET_TYPE_RC_FULL_FRAME )
+         {
+            t_packet_header_rc_full_frame_upstream* pPHRCF = (t_packet_header_rc_full_frame_upstream*)(pPacket + sizeof(t_packet_header));
+
+            // Full sequence from the last one and the 8 bits frame index
+            int iSequence = iLastSequence + 1 + (u8)(pPHRCF->rc_frame_index - (u8)(iLastSequence+1));
+            s_RxResults.iFramesLost += iSequence - iLastSequence - 1;
+
+            u16 uChannels[MAX_RC_CHANNELS];
+            for( int i=0; i<MAX_RC_CHANNELS; i++ )
+               uChannels[i] = packet_header_rc_full_get_rc_channel_value(pPHRCF, i);
+            _on_frame_decoded(iSequence, uChannels, uTimeNowMicros);
+            iLastSequence = iSequence;
+         }
+         memmove(uBuffer, uBuffer + 2 + iLength, iBufferPos - 2 - iLength);
+         iBufferPos -= 2 + iLength;
+      }
+   }
+   close(fd);
+   return NULL;
+}
+
+int s_fdLink = -1;
+t_packet_header_rc_full_frame_upstream s_Frame;
+
+void _send_frame(hw_joystick_info_t* pJoystick)
+{
+   if ( s_iFramesSent >= MAX_TEST_FRAMES )
+      return;
+
+   s_Frame.rc_frame_index++;
+   s_Frame.flags = RC_FULL_FRAME_FLAGS_HAS_INPUT;
+   u16 uCh0 = (u16)(1000 + pJoystick->axesValues[0]);
+   u16 uCh1 = (u16)(1000 + pJoystick->axesValues[1]);
+   packet_header_rc_full_set_rc_channel_value(&s_Frame, 0, uCh0);
+   packet_header_rc_full_set_rc_channel_value(&s_Frame, 1, uCh1);
+   for( int i=2; i<s_iChannels; i++ )
+      packet_header_rc_full_set_rc_channel_value(&s_Frame, i, 1500);
+   s_uFramesSentCh0[s_iFramesSent] = uCh0;
+   s_uFramesSentCh1[s_iFramesSent] = uCh1;
+   s_iFramesSent++;
+
+   u8 uBuffer[MAX_PACKET_TOTAL_SIZE+2];
+   u8* pPacket = uBuffer + 2;
+   t_packet_header PH;
+   memset(&PH, 0, sizeof(PH));
+   PH.packet_flags = PACKET_COMPONENT_RC;
+   PH.packet_type = PACKET_TYPE_RC_FULL_FRAME;
+   PH.total_headers_length = sizeof(t_packet_header) + sizeof(t_packet_header_rc_full_frame_upstream);
+   PH.total_length = PH.total_headers_length;
+   memcpy(pPacket, &PH, sizeof(t_packet_header));
+   memcpy(pPacket + sizeof(t_packet_header), &s_Frame, sizeof(t_packet_header_rc_full_frame_upstream));
+   packet_compute_crc(pPacket, PH.total_length);
+
+   uBuffer[0] = PH.total_length & 0xFF;
+   uBuffer[1] = (PH.total_length >> 8) & 0xFF;
+   if ( write(s_fdLink, uBuffer, PH.total_length + 2) != PH.total_length + 2 )
+      log_softerror_and_alarm("Failed to write to link file.");
+}
+
+// Same as ruby_tx_rc: waits on the joystick until the next frame is due, sends new input right away,
+// no closer than half the RC interval to the previous frame
+void _run_tx_event_driven(hw_joystick_info_t* pJoystick)
+{
+   int iIntervalMs = 1000/s_iFPS;
+   int fdEpoll = epoll_create1(0);
+   struct epoll_event ev;
+   memset(&ev, 0, sizeof(ev));
+   ev.events = EPOLLIN;
+   ev.data.fd = pJoystick->fd;
+   epoll_ctl(fdEpoll, EPOLL_CTL_ADD, pJoystick->fd, &ev);
+
+   u32 uTimeLastSent = 0;
+   u32 uTimeLastSentMicros = 0;
+   bool bNewInput = false;
+   while ( ! s_bGeneratorDone )
+   {
+      int iTimeoutMs = 10;
+      u32 uTimeNow = get_current_timestamp_ms();
+      if ( uTimeNow >= uTimeLastSent + iIntervalMs )
+         iTimeoutMs = 0;
+      else if ( (int)(uTimeLastSent + iIntervalMs - uTimeNow) < iTimeoutMs )
+         iTimeoutMs = (int)(uTimeLastSent + iIntervalMs - uTimeNow);
+      struct epoll_event events[2];
+      epoll_wait(fdEpoll, events, 2, iTimeoutMs);
+
+      if ( hardware_joystick_read_events(pJoystick) > 0 )
+         bNewInput = true;
+      uTimeNow = get_current_timestamp_ms();
+      u32 uTimeNowMicros = get_current_timestamp_micros();
+      bool bSendNow = (uTimeNow >= uTimeLastSent + iIntervalMs);
+      if ( bNewInput && (uTimeNowMicros - uTimeLastSentMicros >= (u32)iIntervalMs*500) )
+         bSendNow = true;
+      if ( ! bSendNow )
+         continue;
+      uTimeLastSent = uTimeNow;
+      uTimeLastSentMicros = uTimeNowMicros;
+      bNewInput = false;
+      _send_frame(pJoystick);
+   }
+   close(fdEpoll);
+}
+
+// The previous ruby_tx_rc loop: 10 ms sleep, joystick read for 5 ms, frame sent at the RC interval
+void _run_tx_polling(hw_joystick_info_t* pJoystick)
+{
+   int iIntervalMs = 1000/s_iFPS;
+   u32 uTimeLastSent = 0;
+   while ( ! s_bGeneratorDone )
+   {
+      hardware_sleep_ms(10);
+      u32 uTimeEnd = get_current_timestamp_micros() + 5000;
+      while ( get_current_timestamp_micros() < uTimeEnd )
+      {
+         hardware_sleep_micros(200);
+         hardware_joystick_read_events(pJoystick);
+      }
+      u32 uTimeNow = get_current_timestamp_ms();
+      if ( uTimeNow < uTimeLastSent + iIntervalMs )
+         continue;
+      uTimeLastSent = uTimeNow;
+      _send_frame(pJoystick);
+   }
+}
+
+int _compare_u32(const void* a, const void* b)
+{
+   u32 ua = *(const u32*)a;
+   u32 ub = *(const u32*)b;
+   return (ua < ub)?-1:((ua > ub)?1:0);
+}
+
+u32 _percentile(int iPercent)
+{
+   if ( 0 == s_RxResults.iLatenciesCount )
+      return 0;
+   int iIndex = (s_RxResults.iLatenciesCount-1) * iPercent / 100;
+   return s_RxResults.uLatencies[iIndex];
+}
+
+// Returns the 90th percentile latency in microseconds, MAX_U32 on errors
+u32 _run_test(bool bEventDriven)
+{
+   int fdPipe[2];
+   if ( 0 != pipe(fdPipe) )
+      return MAX_U32;
+   fcntl(fdPipe[0], F_SETFL, fcntl(fdPipe[0], F_GETFL) | O_NONBLOCK);
+   s_fdJoystickWrite = fdPipe[1];
+
+   hw_joystick_info_t joystick;
+   memset(&joystick, 0, sizeof(joystick));
+   joystick.fd = fdPipe[0];
+   joystick.countAxes = 2;
+
+   s_fdLink = open(s_szLinkFile, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+   if ( s_fdLink < 0 )
+   {
+      log_softerror_and_alarm("Can't create link file %s", s_szLinkFile);
+      return MAX_U32;
+   }
+
+   memset(&s_RxResults, 0, sizeof(s_RxResults));
+   memset(&s_Frame, 0, sizeof(s_Frame));
+   s_Frame.rc_frame_index = 0xFF; // first frame sent is index 0, sequence 0
+   s_iInputsCount = 0;
+   s_iFramesSent = 0;
+   s_bGeneratorDone = false;
+   s_bTxDone = false;
+
+   pthread_t threadRx, threadGenerator;
+   pthread_create(&threadRx, NULL, &_thread_receiver, NULL);
+   pthread_create(&threadGenerator, NULL, &_thread_generator, NULL);
+
+   if ( bEventDriven )
+      _run_tx_event_driven(&joystick);
+   else
+      _run_tx_polling(&joystick);
+
+   pthread_join(threadGenerator, NULL);
+   s_bTxDone = true;
+   pthread_join(threadRx, NULL);
+   close(s_fdLink);
+   close(fdPipe[0]);
+   close(fdPipe[1]);
+   unlink(s_szLinkFile);
+
+   qsort(s_RxResults.uLatencies, s_RxResults.iLatenciesCount, sizeof(u32), _compare_u32);
+   log_line("%s loop: %d inputs, %d frames sent, %d dropped by the link, %d lost",
+      bEventDriven?"Event driven":"Polling", s_iInputsCount, s_iFramesSent, s_RxResults.iFramesDropped, s_RxResults.iFramesLost);
+   log_line("   Input to decode latency (%d inputs decoded): p50 %.2f ms, p90 %.2f ms, p99 %.2f ms, max %.2f ms",
+      s_RxResults.iLatenciesCount, _percentile(50)/1000.0, _percentile(90)/1000.0, _percentile(99)/1000.0,
+      (s_RxResults.iLatenciesCount > 0)?(s_RxResults.uLatencies[s_RxResults.iLatenciesCount-1]/1000.0):0.0);
+   if ( 0 != s_RxResults.iMismatches )
+   {
+      log_line("   %d decoded frames do not match the sent frames", s_RxResults.iMismatches);
+      return MAX_U32;
+   }
+   if ( 0 == s_RxResults.iLatenciesCount )
+      return MAX_U32;
+   return _percentile(90);
+}
+
+int main(int argc, char *argv[])
+{
+   log_init("TestRCUplink");
+   log_enable_stdout();
+
+   for( int i=1; i<argc; i++ )
+   {
+      if ( 0 == strcmp(argv[i], "-seconds") && i < argc-1 )
+         s_iSeconds = atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-fps") && i < argc-1 )
+         s_iFPS = atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-loss") && i < argc-1 )
+         s_iLossPercent = atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-seed") && i < argc-1 )
+         s_uSeed = (unsigned int)atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-link") && i < argc-1 )
+         strncpy(s_szLinkFile, argv[++i], sizeof(s_szLinkFile)-1);
+   }
+   if ( s_iFPS < 1 )
+      s_iFPS = 1;
+   if ( s_iFPS > 500 )
+      s_iFPS = 500;
+
+   log_line("RC uplink test: %d seconds, %d frames/sec, %d%% link loss", s_iSeconds, s_iFPS, s_iLossPercent);
+
+   u32 uP90EventDriven = _run_test(true);
+   u32 uP90Polling = _run_test(false);
+
+   int iResult = 0;
+   if ( MAX_U32 == uP90EventDriven || MAX_U32 == uP90Polling )
+      iResult = 1;
+   if ( uP90EventDriven >= uP90Polling )
+   {
+      log_line("Event driven loop is not faster than the polling loop.");
+      iResult = 1;
+   }
+   log_line(iResult?"FAILED":"PASSED");
+   return iResult;
+}
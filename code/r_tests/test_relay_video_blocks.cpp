@@ -0,0 +1,936 @@
+#include "../base/base.h"
+#include "../base/encr_aead.h"
+#include "../radio/radiopackets2.h"
+#include "../radio/radio_sim.h"
+#include "../radio/fec.h"
+#include "../common/relay_video_blocks.h"
+
+// Two hops video relaying test: relayed vehicle -> relay vehicle -> controller, over simulated radio links
+// with independent loss on each hop, in simulation time. Compares the relay forwarding the packets as they are
+// received (retransmission requests go all the way to the relayed vehicle) with the relay rebuilding the video
+// blocks (FEC recovery and new FEC on the relay, retransmissions answered from the relay blocks).
+// Reports the delivered blocks ratio and the blocks latency on the controller for both.
+// With encryption, the relayed vehicle and the controller seal their packets and the relay must forward them
+// as they are in both modes (the controller checks every packet is authentic).
+//
+// Usage: test_relay_video_blocks [options]
+//   -duration s          simulated seconds for each run (default 10)
+//   -bitrate kbps        video bitrate (default 4000)
+//   -block d,f           data and FEC packets per block on the relayed vehicle (default 8,4)
+//   -relayfec n          FEC packets per block from the relay to the controller (default: same as relayed vehicle)
+//   -packet bytes        video packet payload size (default 1100)
+//   -loss1 spec          loss on the first hop (relayed vehicle <-> relay), both directions
+//   -loss2 spec          loss on the second hop (relay <-> controller), both directions
+//                        spec: none | uniform:rate | ge:p_good_to_bad,p_bad_to_good,loss_good,loss_bad
+//                        with no loss given, a set of loss scenarios is run
+//   -latency ms          latency of each hop (default 2)
+//   -noretr              disable retransmissions
+//   -encrypt             seal the video packets and the retransmission requests (default: a run with and without)
+//   -maxwait ms          max time the controller waits for a block (default 100)
+//   -seed n              random seed
+
+#define SIM_STEP_MICROS 1000
+#define SIM_RX_BLOCKS 256
+#define SIM_TX_HISTORY_BLOCKS 256
+#define SIM_MAX_RETR_ENTRIES 60
+
+#define RELAY_MODE_FORWARD 0
+#define RELAY_MODE_BLOCKS 1
+
+int s_iFailed = 0;
+int s_iDurationSec = 10;
+int s_iBitrateKbps = 4000;
+int s_iBlockData = 8;
+int s_iBlockFec = 4;
+int s_iRelayFec = RELAY_VIDEO_BLOCKS_SAME_FECS;
+int s_iPacketLength = 1100;
+bool s_bRetransmissions = true;
+bool s_bEncryption = false;
+u32 s_uLatencyMicros = 2000;
+u32 s_uMaxWaitMicros = 100000;
+u32 s_uRetrWaitMicros = 15000;
+u32 s_uRetrIntervalMicros = 20000;
+u32 s_uSeed = 1;
+
+typedef struct
+{
+   u32 uBlocksSent;
+   u32 uRetrPacketsSent; // by the relayed vehicle
+   u32 uBlocksOutput;
+   u32 uBlocksLost;
+   u32 uBlocksCorrupted;
+   u32 uRetrRequestsSent; // by the controller
+   double dLatencySumMs;
+   u32 uLatencyMaxMicros;
+   u32 uHop2Packets;
+   u32 uPacketsNotAuthentic; // sealed packets that failed to open on the controller or the relayed vehicle
+} t_sim_stats;
+
+typedef struct
+{
+   u32 uBlockIndex;
+   int iPackets;
+   u8 packets[MAX_TOTAL_PACKETS_IN_BLOCK][MAX_PACKET_TOTAL_SIZE];
+   int iPacketsLength[MAX_TOTAL_PACKETS_IN_BLOCK];
+} t_tx_sim_block;
+
+typedef struct
+{
+   u32 uBlockIndex;
+   int iDataPackets;
+   int iFecPackets;
+   int iPacketLength;
+   u8 bReceived[MAX_TOTAL_PACKETS_IN_BLOCK];
+   u8* pPackets[MAX_TOTAL_PACKETS_IN_BLOCK];
+   int iReceivedData;
+   int iReceivedFec;
+   u32 uTimeFirstReceived;
+   u32 uTimeLastRetrRequest;
+} t_rx_sim_block;
+
+t_sim_stats s_Stats;
+u32 s_uTimeNow = 0;
+int s_iRelayMode = RELAY_MODE_FORWARD;
+
+t_radio_sim_link* s_pHop1Down = NULL; // relayed vehicle -> relay
+t_radio_sim_link* s_pHop1Up = NULL; // relay -> relayed vehicle
+t_radio_sim_link* s_pHop2Down = NULL; // relay -> controller
+t_radio_sim_link* s_pHop2Up = NULL; // controller -> relay
+t_relay_video_blocks* s_pRelayBlocks = NULL;
+
+t_tx_sim_block* s_pTXHistory = NULL;
+u32 s_uTXNextBlockIndex = 0;
+u32 s_uTXStreamPacketIndex = 0;
+double s_dTXPendingBytes = 0.0;
+
+t_rx_sim_block s_RXBlocks[SIM_RX_BLOCKS];
+bool s_bRXStarted = false;
+u32 s_uRXNextOutputBlock = 0;
+u32 s_uRXMaxReceivedBlock = 0;
+u32 s_uRXLastRetrCheckTime = 0;
+u32 s_uRXRetrRequestId = 0;
+
+void _fail(const char* szText)
+{
+   log_line("%s <- FAILED", szText);
+   s_iFailed = 1;
+}
+
+void _fill_payload(u8* pPayload, u32 uBlockIndex, int iPacketIndex, u32 uTime)
+{
+   memcpy(pPayload, &uBlockIndex, sizeof(u32));
+   memcpy(pPayload+4, &uTime, sizeof(u32));
+   pPayload[8] = (u8)iPacketIndex;
+   for( int i=9; i<s_iPacketLength; i++ )
+      pPayload[i] = (u8)(uBlockIndex*31 + iPacketIndex*7 + i);
+}
+
+bool _check_payload(u8* pPayload, u32 uBlockIndex, int iPacketIndex)
+{
+   u32 uIndex = 0;
+   memcpy(&uIndex, pPayload, sizeof(u32));
+   if ( uIndex != uBlockIndex || pPayload[8] != (u8)iPacketIndex )
+      return false;
+   for( int i=9; i<s_iPacketLength; i++ )
+      if ( pPayload[i] != (u8)(uBlockIndex*31 + iPacketIndex*7 + i) )
+         return false;
+   return true;
+}
+
+void _compute_crc(u8* pPacket)
+{
+   t_packet_header* pPH = (t_packet_header*)pPacket;
+   if ( pPH->packet_flags & PACKET_FLAGS_BIT_HEADERS_ONLY_CRC )
+      packet_compute_crc(pPacket, pPH->total_headers_length);
+   else
+      packet_compute_crc(pPacket, pPH->total_length);
+}
+
+bool _check_crc(u8* pPacket, int iLength)
+{
+   t_packet_header* pPH = (t_packet_header*)pPacket;
+   if ( iLength < (int)sizeof(t_packet_header) || pPH->total_length > iLength )
+      return false;
+   int iCRCLength = (pPH->packet_flags & PACKET_FLAGS_BIT_HEADERS_ONLY_CRC)?pPH->total_headers_length:pPH->total_length;
+   if ( iCRCLength > iLength )
+      return false;
+   return packet_check_crc(pPacket, iCRCLength);
+}
+
+// Seals the packet (if encryption is enabled) and sends it on the radio link
+void _send_packet(t_radio_sim_link* pLink, u8* pPacket, int iLength)
+{
+   if ( ! s_bEncryption )
+   {
+      radio_sim_link_write(pLink, pPacket, iLength, s_uTimeNow);
+      return;
+   }
+   u8 uSealed[MAX_PACKET_TOTAL_SIZE + ENCR_AEAD_OVERHEAD];
+   int iSealedLength = encr_aead_seal_packets(pPacket, iLength, uSealed, sizeof(uSealed));
+   if ( iSealedLength <= 0 )
+   {
+      _fail("Failed to seal a packet");
+      return;
+   }
+   radio_sim_link_write(pLink, uSealed, iSealedLength, s_uTimeNow);
+}
+
+// Checks the CRC and opens the packet if it's sealed. Returns the plain packet length, 0 if it has to be dropped
+int _receive_packet(u8* pPacket, int iLength)
+{
+   if ( ! _check_crc(pPacket, iLength) )
+      return 0;
+   if ( ! encr_aead_is_sealed_packet(pPacket) )
+   {
+      if ( s_bEncryption )
+         _fail("Received a plain packet with encryption enabled");
+      return iLength;
+   }
+   iLength = encr_aead_open_packet(pPacket, iLength);
+   if ( iLength <= 0 )
+      s_Stats.uPacketsNotAuthentic++;
+   return iLength;
+}
+
+//----------------------------------------------------------
+// Relayed vehicle
+
+void vehicle_send_block()
+{
+   t_tx_sim_block* pBlock = &s_pTXHistory[s_uTXNextBlockIndex % SIM_TX_HISTORY_BLOCKS];
+   pBlock->uBlockIndex = s_uTXNextBlockIndex;
+   pBlock->iPackets = s_iBlockData + s_iBlockFec;
+
+   u8* pDataPackets[MAX_DATA_PACKETS_IN_BLOCK];
+   u8* pFecPackets[MAX_FECS_PACKETS_IN_BLOCK];
+   int iHeadersLength = sizeof(t_packet_header) + sizeof(t_packet_header_video_full);
+
+   for( int i=0; i<pBlock->iPackets; i++ )
+   {
+      u8* pPacket = pBlock->packets[i];
+      t_packet_header* pPH = (t_packet_header*)pPacket;
+      t_packet_header_video_full* pPHVF = (t_packet_header_video_full*)(pPacket + sizeof(t_packet_header));
+      memset(pPacket, 0, iHeadersLength);
+      pPH->packet_flags = PACKET_COMPONENT_VIDEO | PACKET_FLAGS_BIT_HEADERS_ONLY_CRC;
+      pPH->packet_type = PACKET_TYPE_VIDEO_DATA_FULL;
+      pPH->total_headers_length = iHeadersLength;
+      pPH->total_length = iHeadersLength + s_iPacketLength;
+      pPH->vehicle_id_src = 2;
+      pPH->vehicle_id_dest = 0;
+      pPHVF->video_type = VIDEO_TYPE_H264;
+      pPHVF->video_width = 1280;
+      pPHVF->video_height = 720;
+      pPHVF->block_packets = s_iBlockData;
+      pPHVF->block_fecs = s_iBlockFec;
+      pPHVF->video_packet_length = s_iPacketLength;
+      pPHVF->video_block_index = pBlock->uBlockIndex;
+      pPHVF->video_block_packet_index = i;
+      pBlock->iPacketsLength[i] = pPH->total_length;
+
+      if ( i < s_iBlockData )
+      {
+         _fill_payload(pPacket + iHeadersLength, pBlock->uBlockIndex, i, s_uTimeNow);
+         pDataPackets[i] = pPacket + iHeadersLength;
+      }
+      else
+         pFecPackets[i-s_iBlockData] = pPacket + iHeadersLength;
+   }
+   if ( s_iBlockFec > 0 )
+      fec_encode(s_iPacketLength, pDataPackets, s_iBlockData, pFecPackets, s_iBlockFec);
+
+   for( int i=0; i<pBlock->iPackets; i++ )
+   {
+      t_packet_header* pPH = (t_packet_header*)pBlock->packets[i];
+      pPH->stream_packet_idx = (STREAM_ID_VIDEO_1 << PACKET_FLAGS_MASK_SHIFT_STREAM_INDEX) | (s_uTXStreamPacketIndex & PACKET_FLAGS_MASK_STREAM_PACKET_IDX);
+      s_uTXStreamPacketIndex++;
+      _compute_crc(pBlock->packets[i]);
+      _send_packet(s_pHop1Down, pBlock->packets[i], pPH->total_length);
+   }
+   s_Stats.uBlocksSent++;
+   s_uTXNextBlockIndex++;
+}
+
+void vehicle_process_retransmission_request(u8* pPacket, int iLength)
+{
+   t_packet_header* pPH = (t_packet_header*)pPacket;
+   if ( pPH->packet_type != PACKET_TYPE_VIDEO_REQ_MULTIPLE_PACKETS2 )
+      return;
+   if ( iLength < (int)(sizeof(t_packet_header) + sizeof(u32) + 2) )
+      return;
+
+   u32 uRetrId = 0;
+   memcpy(&uRetrId, pPacket + sizeof(t_packet_header), sizeof(u32));
+   u8* pData = pPacket + sizeof(t_packet_header) + sizeof(u32);
+   int iCount = pData[1];
+   pData += 2;
+   if ( iLength < (int)(sizeof(t_packet_header) + sizeof(u32) + 2 + iCount*6) )
+      return;
+
+   for( int i=0; i<iCount; i++ )
+   {
+      u32 uBlockIndex = 0;
+      memcpy(&uBlockIndex, pData, sizeof(u32));
+      int iPacketIndex = pData[4];
+      pData += 6;
+
+      t_tx_sim_block* pBlock = &s_pTXHistory[uBlockIndex % SIM_TX_HISTORY_BLOCKS];
+      if ( pBlock->uBlockIndex != uBlockIndex || iPacketIndex >= pBlock->iPackets || uBlockIndex >= s_uTXNextBlockIndex )
+         continue;
+      u8 uBuffer[MAX_PACKET_TOTAL_SIZE];
+      memcpy(uBuffer, pBlock->packets[iPacketIndex], pBlock->iPacketsLength[iPacketIndex]);
+      t_packet_header* pPHRetr = (t_packet_header*)uBuffer;
+      t_packet_header_video_full* pPHVF = (t_packet_header_video_full*)(uBuffer + sizeof(t_packet_header));
+      pPHRetr->packet_flags |= PACKET_FLAGS_BIT_RETRANSMITED;
+      pPHRetr->stream_packet_idx = (STREAM_ID_VIDEO_1 << PACKET_FLAGS_MASK_SHIFT_STREAM_INDEX) | (s_uTXStreamPacketIndex & PACKET_FLAGS_MASK_STREAM_PACKET_IDX);
+      s_uTXStreamPacketIndex++;
+      pPHVF->video_width = (uRetrId >> 16) & 0xFFFF;
+      pPHVF->video_height = uRetrId & 0xFFFF;
+      _compute_crc(uBuffer);
+      _send_packet(s_pHop1Down, uBuffer, pPHRetr->total_length);
+      s_Stats.uRetrPacketsSent++;
+   }
+}
+
+void vehicle_periodic(bool bSendVideo)
+{
+   if ( bSendVideo )
+   {
+      s_dTXPendingBytes += (double)s_iBitrateKbps * 1000.0 / 8.0 * (double)SIM_STEP_MICROS / 1000000.0;
+      while ( s_dTXPendingBytes >= s_iPacketLength * s_iBlockData )
+      {
+         vehicle_send_block();
+         s_dTXPendingBytes -= s_iPacketLength * s_iBlockData;
+      }
+   }
+
+   u8 uBuffer[MAX_PACKET_TOTAL_SIZE];
+   int iLength = 0;
+   while ( (iLength = radio_sim_link_read(s_pHop1Up, uBuffer, sizeof(uBuffer), s_uTimeNow)) > 0 )
+   {
+      iLength = _receive_packet(uBuffer, iLength);
+      if ( iLength > 0 )
+         vehicle_process_retransmission_request(uBuffer, iLength);
+   }
+}
+
+//----------------------------------------------------------
+// Relay vehicle
+
+void _relay_send_to_controller(u8* pPacket, int iLength, void* pContext)
+{
+   radio_sim_link_write(s_pHop2Down, pPacket, iLength, s_uTimeNow);
+   s_Stats.uHop2Packets++;
+}
+
+void relay_periodic()
+{
+   u8 uBuffer[MAX_PACKET_TOTAL_SIZE];
+   int iLength = 0;
+   while ( (iLength = radio_sim_link_read(s_pHop1Down, uBuffer, sizeof(uBuffer), s_uTimeNow)) > 0 )
+   {
+      if ( ! _check_crc(uBuffer, iLength) )
+         continue;
+      if ( s_iRelayMode == RELAY_MODE_BLOCKS )
+      if ( relay_video_blocks_on_packet(s_pRelayBlocks, uBuffer, iLength) )
+         continue;
+      _relay_send_to_controller(uBuffer, iLength, NULL);
+   }
+
+   while ( (iLength = radio_sim_link_read(s_pHop2Up, uBuffer, sizeof(uBuffer), s_uTimeNow)) > 0 )
+   {
+      if ( ! _check_crc(uBuffer, iLength) )
+         continue;
+      if ( s_iRelayMode == RELAY_MODE_BLOCKS )
+      {
+         u8 uRequest[MAX_PACKET_TOTAL_SIZE];
+         int iRequestLength = relay_video_blocks_on_retransmission_request(s_pRelayBlocks, uBuffer, iLength, uRequest);
+         if ( iRequestLength > 0 )
+            radio_sim_link_write(s_pHop1Up, uRequest, iRequestLength, s_uTimeNow);
+         if ( iRequestLength >= 0 )
+            continue;
+      }
+      radio_sim_link_write(s_pHop1Up, uBuffer, iLength, s_uTimeNow);
+   }
+}
+
+//----------------------------------------------------------
+// Controller
+
+void _rx_reset_block(t_rx_sim_block* pBlock, u32 uBlockIndex)
+{
+   pBlock->uBlockIndex = uBlockIndex;
+   pBlock->iDataPackets = 0;
+   pBlock->iFecPackets = 0;
+   pBlock->iPacketLength = 0;
+   pBlock->iReceivedData = 0;
+   pBlock->iReceivedFec = 0;
+   pBlock->uTimeFirstReceived = 0;
+   pBlock->uTimeLastRetrRequest = 0;
+   memset(pBlock->bReceived, 0, sizeof(pBlock->bReceived));
+}
+
+void _controller_output_block(t_rx_sim_block* pBlock)
+{
+   if ( pBlock->iReceivedData < pBlock->iDataPackets )
+   {
+      u8* pDataPackets[MAX_DATA_PACKETS_IN_BLOCK];
+      u8* pFecPackets[MAX_FECS_PACKETS_IN_BLOCK];
+      unsigned int uFecIndexes[MAX_FECS_PACKETS_IN_BLOCK];
+      unsigned int uMissingIndexes[MAX_DATA_PACKETS_IN_BLOCK];
+      unsigned int uMissing = 0;
+      for( int i=0; i<pBlock->iDataPackets; i++ )
+      {
+         pDataPackets[i] = pBlock->pPackets[i];
+         if ( ! pBlock->bReceived[i] )
+            uMissingIndexes[uMissing++] = i;
+      }
+      unsigned int uPos = 0;
+      for( int i=0; i<pBlock->iFecPackets && uPos < uMissing; i++ )
+      {
+         if ( ! pBlock->bReceived[pBlock->iDataPackets + i] )
+            continue;
+         pFecPackets[uPos] = pBlock->pPackets[pBlock->iDataPackets + i];
+         uFecIndexes[uPos] = i;
+         uPos++;
+      }
+      fec_decode(pBlock->iPacketLength, pDataPackets, pBlock->iDataPackets, pFecPackets, uFecIndexes, uMissingIndexes, uMissing);
+   }
+
+   bool bOk = true;
+   for( int i=0; i<pBlock->iDataPackets; i++ )
+      if ( ! _check_payload(pBlock->pPackets[i], pBlock->uBlockIndex, i) )
+         bOk = false;
+   if ( ! bOk )
+      s_Stats.uBlocksCorrupted++;
+
+   u32 uTimeSent = 0;
+   memcpy(&uTimeSent, pBlock->pPackets[0]+4, sizeof(u32));
+   u32 uLatency = s_uTimeNow - uTimeSent;
+   s_Stats.dLatencySumMs += uLatency/1000.0;
+   if ( uLatency > s_Stats.uLatencyMaxMicros )
+      s_Stats.uLatencyMaxMicros = uLatency;
+   s_Stats.uBlocksOutput++;
+}
+
+u32 _controller_get_block_wait_start(u32 uBlockIndex)
+{
+   for( u32 u=uBlockIndex; u<=s_uRXMaxReceivedBlock; u++ )
+   {
+      t_rx_sim_block* pBlock = &s_RXBlocks[u % SIM_RX_BLOCKS];
+      if ( pBlock->uBlockIndex == u )
+         return pBlock->uTimeFirstReceived;
+   }
+   return s_uTimeNow;
+}
+
+void _controller_advance_output()
+{
+   while ( s_bRXStarted && s_uRXNextOutputBlock <= s_uRXMaxReceivedBlock )
+   {
+      t_rx_sim_block* pBlock = &s_RXBlocks[s_uRXNextOutputBlock % SIM_RX_BLOCKS];
+      bool bReceived = (pBlock->uBlockIndex == s_uRXNextOutputBlock) && (pBlock->iDataPackets > 0);
+      if ( bReceived && (pBlock->iReceivedData + pBlock->iReceivedFec >= pBlock->iDataPackets) )
+         _controller_output_block(pBlock);
+      else if ( (s_uTimeNow - _controller_get_block_wait_start(s_uRXNextOutputBlock)) > s_uMaxWaitMicros || (s_uRXMaxReceivedBlock - s_uRXNextOutputBlock) >= SIM_RX_BLOCKS-1 )
+         s_Stats.uBlocksLost++;
+      else
+         break;
+      _rx_reset_block(pBlock, MAX_U32);
+      s_uRXNextOutputBlock++;
+   }
+}
+
+void controller_process_packet(u8* pPacket, int iLength)
+{
+   t_packet_header* pPH = (t_packet_header*)pPacket;
+   iLength = _receive_packet(pPacket, iLength);
+   if ( iLength < (int)(sizeof(t_packet_header) + sizeof(t_packet_header_video_full)) )
+      return;
+   if ( (pPH->packet_flags & PACKET_FLAGS_MASK_MODULE) != PACKET_COMPONENT_VIDEO || pPH->packet_type != PACKET_TYPE_VIDEO_DATA_FULL )
+      return;
+
+   t_packet_header_video_full* pPHVF = (t_packet_header_video_full*)(pPacket + sizeof(t_packet_header));
+   u32 uBlockIndex = pPHVF->video_block_index;
+   int iPacketIndex = pPHVF->video_block_packet_index;
+   if ( pPHVF->block_packets == 0 || pPHVF->block_packets > MAX_DATA_PACKETS_IN_BLOCK || pPHVF->block_fecs > MAX_FECS_PACKETS_IN_BLOCK )
+      return;
+   if ( iPacketIndex >= pPHVF->block_packets + pPHVF->block_fecs || pPHVF->video_packet_length > MAX_PACKET_TOTAL_SIZE )
+      return;
+
+   if ( ! s_bRXStarted )
+   {
+      s_bRXStarted = true;
+      s_uRXNextOutputBlock = uBlockIndex;
+      s_uRXMaxReceivedBlock = uBlockIndex;
+   }
+   if ( uBlockIndex < s_uRXNextOutputBlock )
+      return;
+   t_rx_sim_block* pBlock = &s_RXBlocks[uBlockIndex % SIM_RX_BLOCKS];
+   if ( uBlockIndex > s_uRXMaxReceivedBlock )
+   {
+      s_uRXMaxReceivedBlock = uBlockIndex;
+      if ( pBlock->uBlockIndex != MAX_U32 && pBlock->uBlockIndex != uBlockIndex )
+         _controller_advance_output();
+      if ( uBlockIndex < s_uRXNextOutputBlock )
+         return;
+   }
+
+   if ( pBlock->uBlockIndex != uBlockIndex )
+   {
+      _rx_reset_block(pBlock, uBlockIndex);
+      pBlock->uTimeFirstReceived = s_uTimeNow;
+   }
+   pBlock->iDataPackets = pPHVF->block_packets;
+   pBlock->iFecPackets = pPHVF->block_fecs;
+   pBlock->iPacketLength = pPHVF->video_packet_length;
+   if ( pBlock->bReceived[iPacketIndex] )
+      return;
+   pBlock->bReceived[iPacketIndex] = 1;
+   memcpy(pBlock->pPackets[iPacketIndex], pPacket + pPH->total_headers_length, pBlock->iPacketLength);
+   if ( iPacketIndex < pBlock->iDataPackets )
+      pBlock->iReceivedData++;
+   else
+      pBlock->iReceivedFec++;
+
+   _controller_advance_output();
+}
+
+void controller_request_retransmissions()
+{
+   u8 uPacket[MAX_PACKET_TOTAL_SIZE];
+   u8* pEntries = uPacket + sizeof(t_packet_header) + sizeof(u32) + 2;
+   int iCount = 0;
+
+   for( u32 uBlockIndex = s_uRXNextOutputBlock; uBlockIndex <= s_uRXMaxReceivedBlock && iCount < SIM_MAX_RETR_ENTRIES; uBlockIndex++ )
+   {
+      t_rx_sim_block* pBlock = &s_RXBlocks[uBlockIndex % SIM_RX_BLOCKS];
+      int iDataPackets = s_iBlockData;
+      int iHave = 0;
+      if ( pBlock->uBlockIndex == uBlockIndex )
+      {
+         if ( (s_uTimeNow - pBlock->uTimeFirstReceived) < s_uRetrWaitMicros )
+            continue;
+         if ( (s_uTimeNow - pBlock->uTimeLastRetrRequest) < s_uRetrIntervalMicros )
+            continue;
+         iDataPackets = (pBlock->iDataPackets > 0)?pBlock->iDataPackets:s_iBlockData;
+         iHave = pBlock->iReceivedData + pBlock->iReceivedFec;
+         pBlock->uTimeLastRetrRequest = s_uTimeNow;
+      }
+      else
+      {
+         if ( uBlockIndex == s_uRXMaxReceivedBlock )
+            continue;
+         _rx_reset_block(pBlock, uBlockIndex);
+         pBlock->uTimeFirstReceived = s_uTimeNow;
+         pBlock->uTimeLastRetrRequest = s_uTimeNow;
+      }
+
+      int iNeeded = iDataPackets - iHave;
+      for( int i=0; i<iDataPackets && iNeeded > 0 && iCount < SIM_MAX_RETR_ENTRIES; i++ )
+      {
+         if ( pBlock->bReceived[i] )
+            continue;
+         memcpy(pEntries + iCount*6, &uBlockIndex, sizeof(u32));
+         pEntries[iCount*6+4] = (u8)i;
+         pEntries[iCount*6+5] = 0;
+         iCount++;
+         iNeeded--;
+      }
+   }
+   if ( 0 == iCount )
+      return;
+
+   t_packet_header* pPH = (t_packet_header*)uPacket;
+   memset(pPH, 0, sizeof(t_packet_header));
+   pPH->packet_flags = PACKET_COMPONENT_VIDEO;
+   pPH->packet_type = PACKET_TYPE_VIDEO_REQ_MULTIPLE_PACKETS2;
+   pPH->vehicle_id_src = 0;
+   pPH->vehicle_id_dest = 2;
+   pPH->total_headers_length = sizeof(t_packet_header);
+   pPH->total_length = sizeof(t_packet_header) + sizeof(u32) + 2 + iCount*6;
+   s_uRXRetrRequestId++;
+   pPH->stream_packet_idx = (STREAM_ID_DATA << PACKET_FLAGS_MASK_SHIFT_STREAM_INDEX) | (s_uRXRetrRequestId & PACKET_FLAGS_MASK_STREAM_PACKET_IDX);
+   memcpy(uPacket + sizeof(t_packet_header), &s_uRXRetrRequestId, sizeof(u32));
+   uPacket[sizeof(t_packet_header) + sizeof(u32)] = 0;
+   uPacket[sizeof(t_packet_header) + sizeof(u32) + 1] = (u8)iCount;
+   _compute_crc(uPacket);
+   _send_packet(s_pHop2Up, uPacket, pPH->total_length);
+   s_Stats.uRetrRequestsSent++;
+}
+
+void controller_periodic()
+{
+   u8 uBuffer[MAX_PACKET_TOTAL_SIZE];
+   int iLength = 0;
+   while ( (iLength = radio_sim_link_read(s_pHop2Down, uBuffer, sizeof(uBuffer), s_uTimeNow)) > 0 )
+      controller_process_packet(uBuffer, iLength);
+
+   _controller_advance_output();
+
+   if ( s_bRetransmissions && s_bRXStarted )
+   if ( s_uTimeNow - s_uRXLastRetrCheckTime >= 5000 )
+   {
+      s_uRXLastRetrCheckTime = s_uTimeNow;
+      controller_request_retransmissions();
+   }
+}
+
+//----------------------------------------------------------
+
+void _reset_simulation()
+{
+   memset(&s_Stats, 0, sizeof(s_Stats));
+   s_uTimeNow = 0;
+   s_uTXNextBlockIndex = 0;
+   s_uTXStreamPacketIndex = 0;
+   s_dTXPendingBytes = 0.0;
+   for( int i=0; i<SIM_TX_HISTORY_BLOCKS; i++ )
+      s_pTXHistory[i].uBlockIndex = MAX_U32;
+   for( int i=0; i<SIM_RX_BLOCKS; i++ )
+      _rx_reset_block(&s_RXBlocks[i], MAX_U32);
+   s_bRXStarted = false;
+   s_uRXNextOutputBlock = 0;
+   s_uRXMaxReceivedBlock = 0;
+   s_uRXLastRetrCheckTime = 0;
+   s_uRXRetrRequestId = 0;
+}
+
+// Same seeds for both relay modes, so both see the same loss patterns on the radio links
+t_sim_stats run_simulation(int iRelayMode, t_radio_sim_link_params* pParamsHop1, t_radio_sim_link_params* pParamsHop2, t_relay_video_blocks_stats* pRelayStats)
+{
+   _reset_simulation();
+   s_iRelayMode = iRelayMode;
+   s_pHop1Down = radio_sim_link_create(pParamsHop1, s_uSeed);
+   s_pHop1Up = radio_sim_link_create(pParamsHop1, s_uSeed*7919+1);
+   s_pHop2Down = radio_sim_link_create(pParamsHop2, s_uSeed*104729+3);
+   s_pHop2Up = radio_sim_link_create(pParamsHop2, s_uSeed*15485863+5);
+   s_pRelayBlocks = relay_video_blocks_create(s_iRelayFec, _relay_send_to_controller, NULL);
+
+   u32 uEnd = s_iDurationSec * 1000000;
+   u32 uSettle = uEnd + s_uMaxWaitMicros + 300000;
+   for( s_uTimeNow = 0; s_uTimeNow < uSettle; s_uTimeNow += SIM_STEP_MICROS )
+   {
+      vehicle_periodic(s_uTimeNow < uEnd);
+      relay_periodic();
+      controller_periodic();
+   }
+
+   if ( NULL != pRelayStats )
+      memcpy(pRelayStats, &(s_pRelayBlocks->stats), sizeof(t_relay_video_blocks_stats));
+   relay_video_blocks_destroy(s_pRelayBlocks);
+   radio_sim_link_destroy(s_pHop1Down);
+   radio_sim_link_destroy(s_pHop1Up);
+   radio_sim_link_destroy(s_pHop2Down);
+   radio_sim_link_destroy(s_pHop2Up);
+   return s_Stats;
+}
+
+double _get_delivered_percent(t_sim_stats* pStats)
+{
+   if ( 0 == pStats->uBlocksSent )
+      return 0.0;
+   return 100.0 * (double)(pStats->uBlocksOutput - pStats->uBlocksCorrupted) / (double)pStats->uBlocksSent;
+}
+
+void _log_result(const char* szMode, t_sim_stats* pStats)
+{
+   log_line("   %-16s delivered: %6.2f%% (%u of %u blocks, %u lost, %u corrupted), latency avg: %5.1f ms, max: %5.1f ms, retr: %u requests, %u packets resent by relayed vehicle, %u packets on hop 2",
+      szMode, _get_delivered_percent(pStats), pStats->uBlocksOutput, pStats->uBlocksSent, pStats->uBlocksLost, pStats->uBlocksCorrupted,
+      (pStats->uBlocksOutput > 0)?(pStats->dLatencySumMs/pStats->uBlocksOutput):0.0, pStats->uLatencyMaxMicros/1000.0,
+      pStats->uRetrRequestsSent, pStats->uRetrPacketsSent, pStats->uHop2Packets);
+}
+
+void run_scenario(const char* szLoss1, const char* szLoss2)
+{
+   t_radio_sim_link_params paramsHop1;
+   t_radio_sim_link_params paramsHop2;
+   radio_sim_link_params_reset(&paramsHop1);
+   radio_sim_link_params_reset(&paramsHop2);
+   if ( (! radio_sim_parse_loss_model(szLoss1, &paramsHop1)) || (! radio_sim_parse_loss_model(szLoss2, &paramsHop2)) )
+   {
+      _fail("Invalid loss spec");
+      return;
+   }
+   paramsHop1.uLatencyMicros = s_uLatencyMicros;
+   paramsHop2.uLatencyMicros = s_uLatencyMicros;
+
+   t_relay_video_blocks_stats relayStats;
+   t_sim_stats statsForward = run_simulation(RELAY_MODE_FORWARD, &paramsHop1, &paramsHop2, NULL);
+   t_sim_stats statsBlocks = run_simulation(RELAY_MODE_BLOCKS, &paramsHop1, &paramsHop2, &relayStats);
+
+   log_line("Hop 1 loss: %s, hop 2 loss: %s%s", szLoss1, szLoss2, s_bEncryption?", encrypted":"");
+   _log_result("Forward packets", &statsForward);
+   _log_result("Relay blocks", &statsBlocks);
+   log_line("   Relay: %u data packets recovered, %u FEC packets sent, %u blocks incomplete, %u of %u requested packets answered by the relay, %u sealed packets and %u sealed requests forwarded",
+      relayStats.uDataPacketsRecovered, relayStats.uFecPacketsOut, relayStats.uBlocksIncomplete,
+      relayStats.uRetrPacketsFromCache, relayStats.uRetrPacketsRequested,
+      relayStats.uPacketsSealed, relayStats.uRetrRequestsSealed);
+
+   char szBuff[256];
+   if ( statsForward.uBlocksCorrupted > 0 || statsBlocks.uBlocksCorrupted > 0 )
+   {
+      sprintf(szBuff, "Corrupted blocks on the controller (forward: %u, relay blocks: %u)", statsForward.uBlocksCorrupted, statsBlocks.uBlocksCorrupted);
+      _fail(szBuff);
+   }
+   if ( statsForward.uPacketsNotAuthentic > 0 || statsBlocks.uPacketsNotAuthentic > 0 )
+   {
+      sprintf(szBuff, "Sealed packets not authentic after the relay (forward: %u, relay blocks: %u)", statsForward.uPacketsNotAuthentic, statsBlocks.uPacketsNotAuthentic);
+      _fail(szBuff);
+   }
+   // Sealed packets can't be rebuilt by the relay: all of them must be forwarded as they are
+   if ( s_bEncryption )
+   if ( relayStats.uPacketsIn > 0 || relayStats.uPacketsOut > 0 || relayStats.uPacketsSealed == 0 )
+      _fail("Sealed video packets were not forwarded as they are by the relay");
+   if ( s_bEncryption && s_bRetransmissions )
+   if ( statsBlocks.uRetrRequestsSent > 0 && relayStats.uRetrRequestsSealed == 0 )
+      _fail("Sealed retransmission requests were not forwarded as they are by the relay");
+   if ( (paramsHop1.iLossModel == RADIO_SIM_LOSS_NONE) && (paramsHop2.iLossModel == RADIO_SIM_LOSS_NONE) )
+   if ( statsForward.uBlocksOutput != statsForward.uBlocksSent || statsBlocks.uBlocksOutput != statsBlocks.uBlocksSent )
+      _fail("Blocks lost with no loss on the radio links");
+   // Rebuilding the blocks on the relay can only add recovery chances, with the same FEC on the second hop
+   if ( s_iRelayFec == RELAY_VIDEO_BLOCKS_SAME_FECS || s_iRelayFec >= s_iBlockFec )
+   if ( _get_delivered_percent(&statsBlocks) + 0.5 < _get_delivered_percent(&statsForward) )
+   {
+      sprintf(szBuff, "Relay blocks delivered less blocks than forwarding packets (%.2f%% vs %.2f%%)", _get_delivered_percent(&statsBlocks), _get_delivered_percent(&statsForward));
+      _fail(szBuff);
+   }
+}
+
+// Checks the relay on its own: FEC recovery, new FEC count, retransmissions from the cache and forwarded requests
+u8 s_uUnitPackets[MAX_TOTAL_PACKETS_IN_BLOCK][MAX_PACKET_TOTAL_SIZE];
+int s_iUnitPacketsCount = 0;
+
+void _unit_send(u8* pPacket, int iLength, void* pContext)
+{
+   if ( s_iUnitPacketsCount < MAX_TOTAL_PACKETS_IN_BLOCK )
+      memcpy(s_uUnitPackets[s_iUnitPacketsCount++], pPacket, iLength);
+}
+
+void test_relay_unit()
+{
+   _reset_simulation();
+   t_relay_video_blocks* pRelay = relay_video_blocks_create(6, _unit_send, NULL);
+   t_radio_sim_link_params params;
+   radio_sim_link_params_reset(&params);
+   s_pHop1Down = radio_sim_link_create(&params, 1);
+   vehicle_send_block();
+
+   // Data packets 1 and 3 lost
+   u8 uBuffer[MAX_PACKET_TOTAL_SIZE];
+   s_uTimeNow = 100000;
+   int iLength = 0;
+   while ( (iLength = radio_sim_link_read(s_pHop1Down, uBuffer, sizeof(uBuffer), s_uTimeNow)) > 0 )
+   {
+      t_packet_header_video_full* pPHVF = (t_packet_header_video_full*)(uBuffer + sizeof(t_packet_header));
+      if ( pPHVF->video_block_packet_index == 1 || pPHVF->video_block_packet_index == 3 )
+         continue;
+      if ( 1 != relay_video_blocks_on_packet(pRelay, uBuffer, iLength) )
+         _fail("Video packet not taken by the relay");
+   }
+
+   if ( s_iUnitPacketsCount != s_iBlockData + 6 )
+   {
+      char szBuff[128];
+      sprintf(szBuff, "Relay sent %d packets, expected %d data and 6 FEC packets", s_iUnitPacketsCount, s_iBlockData);
+      _fail(szBuff);
+   }
+   int iData = 0;
+   for( int i=0; i<s_iUnitPacketsCount; i++ )
+   {
+      t_packet_header* pPH = (t_packet_header*)s_uUnitPackets[i];
+      t_packet_header_video_full* pPHVF = (t_packet_header_video_full*)(s_uUnitPackets[i] + sizeof(t_packet_header));
+      if ( ! _check_crc(s_uUnitPackets[i], pPH->total_length) )
+         _fail("Relay sent a packet with a wrong CRC");
+      if ( pPHVF->block_fecs != 6 || pPHVF->block_packets != s_iBlockData )
+         _fail("Relay sent a packet with a wrong FEC scheme");
+      if ( pPHVF->video_block_packet_index < s_iBlockData )
+      {
+         iData++;
+         if ( ! _check_payload(s_uUnitPackets[i] + pPH->total_headers_length, 0, pPHVF->video_block_packet_index) )
+            _fail("Relay sent a wrong data packet");
+      }
+   }
+   if ( iData != s_iBlockData )
+      _fail("Relay did not send all the data packets");
+
+   // The relay FEC packets must recover the block on their own
+   _rx_reset_block(&s_RXBlocks[0], 0);
+   t_rx_sim_block* pBlock = &s_RXBlocks[0];
+   pBlock->iDataPackets = s_iBlockData;
+   pBlock->iFecPackets = 6;
+   pBlock->iPacketLength = s_iPacketLength;
+   for( int i=0; i<s_iUnitPacketsCount; i++ )
+   {
+      t_packet_header* pPH = (t_packet_header*)s_uUnitPackets[i];
+      t_packet_header_video_full* pPHVF = (t_packet_header_video_full*)(s_uUnitPackets[i] + sizeof(t_packet_header));
+      int iIndex = pPHVF->video_block_packet_index;
+      if ( iIndex < 6 && iIndex < s_iBlockData )
+         continue;
+      pBlock->bReceived[iIndex] = 1;
+      memcpy(pBlock->pPackets[iIndex], s_uUnitPackets[i] + pPH->total_headers_length, s_iPacketLength);
+      if ( iIndex < s_iBlockData )
+         pBlock->iReceivedData++;
+      else
+         pBlock->iReceivedFec++;
+   }
+   u32 uCorrupted = s_Stats.uBlocksCorrupted;
+   _controller_output_block(pBlock);
+   if ( s_Stats.uBlocksCorrupted != uCorrupted )
+      _fail("Block not recovered from the relay FEC packets");
+
+   // Request: block 0 packet 2 (cached), block 5 packet 0 (unknown, forwarded), block 0 FEC 9 (cached, relay FEC numbering)
+   u8 uRequest[MAX_PACKET_TOTAL_SIZE];
+   u8 uOut[MAX_PACKET_TOTAL_SIZE];
+   t_packet_header* pPH = (t_packet_header*)uRequest;
+   memset(pPH, 0, sizeof(t_packet_header));
+   pPH->packet_flags = PACKET_COMPONENT_VIDEO;
+   pPH->packet_type = PACKET_TYPE_VIDEO_REQ_MULTIPLE_PACKETS2;
+   pPH->total_headers_length = sizeof(t_packet_header);
+   u32 uRetrId = 0x12345678;
+   int iPos = sizeof(t_packet_header);
+   memcpy(uRequest + iPos, &uRetrId, sizeof(u32));
+   iPos += sizeof(u32);
+   uRequest[iPos++] = 0;
+   uRequest[iPos++] = 3;
+   u32 uBlocks[3] = { 0, 5, 0 };
+   u8 uIndexes[3] = { 2, 0, (u8)(s_iBlockData + 1) };
+   for( int i=0; i<3; i++ )
+   {
+      memcpy(uRequest + iPos, &uBlocks[i], sizeof(u32));
+      uRequest[iPos+4] = uIndexes[i];
+      uRequest[iPos+5] = 0;
+      iPos += 6;
+   }
+   uRequest[iPos++] = 0xAB; // link stats after the entries
+   pPH->total_length = iPos;
+   _compute_crc(uRequest);
+
+   s_iUnitPacketsCount = 0;
+   int iOutLength = relay_video_blocks_on_retransmission_request(pRelay, uRequest, iPos, uOut);
+   if ( s_iUnitPacketsCount != 2 )
+      _fail("Relay did not answer the cached packets");
+   for( int i=0; i<s_iUnitPacketsCount; i++ )
+   {
+      t_packet_header* pPHRetr = (t_packet_header*)s_uUnitPackets[i];
+      t_packet_header_video_full* pPHVF = (t_packet_header_video_full*)(s_uUnitPackets[i] + sizeof(t_packet_header));
+      if ( ! (pPHRetr->packet_flags & PACKET_FLAGS_BIT_RETRANSMITED) )
+         _fail("Relay answered with a packet not marked as retransmitted");
+      if ( ((((u32)pPHVF->video_width) << 16) | pPHVF->video_height) != uRetrId )
+         _fail("Relay answered with a wrong retransmission id");
+   }
+   u32 uOutId = 0;
+   u32 uOutBlock = 0;
+   memcpy(&uOutId, uOut + sizeof(t_packet_header), sizeof(u32));
+   memcpy(&uOutBlock, uOut + sizeof(t_packet_header) + sizeof(u32) + 2, sizeof(u32));
+   if ( iOutLength != (int)(sizeof(t_packet_header) + sizeof(u32) + 2 + 6 + 1) || ! _check_crc(uOut, iOutLength) ||
+        uOutId != uRetrId || uOut[sizeof(t_packet_header) + sizeof(u32) + 1] != 1 || uOutBlock != 5 || uOut[iOutLength-1] != 0xAB )
+      _fail("Wrong retransmission request forwarded to the relayed vehicle");
+
+   relay_video_blocks_destroy(pRelay);
+   radio_sim_link_destroy(s_pHop1Down);
+   s_pHop1Down = NULL;
+}
+
+bool _parse_args(int argc, char *argv[], const char** pszLoss1, const char** pszLoss2)
+{
+   for( int i=1; i<argc; i++ )
+   {
+      bool bHasValue = (i < argc-1);
+      if ( 0 == strcmp(argv[i], "-noretr") )
+         s_bRetransmissions = false;
+      else if ( 0 == strcmp(argv[i], "-encrypt") )
+         s_bEncryption = true;
+      else if ( ! bHasValue )
+         return false;
+      else if ( 0 == strcmp(argv[i], "-duration") )
+         s_iDurationSec = atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-bitrate") )
+         s_iBitrateKbps = atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-block") )
+      {
+         if ( 2 != sscanf(argv[++i], "%d,%d", &s_iBlockData, &s_iBlockFec) )
+            return false;
+      }
+      else if ( 0 == strcmp(argv[i], "-relayfec") )
+         s_iRelayFec = atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-packet") )
+         s_iPacketLength = atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-loss1") )
+         *pszLoss1 = argv[++i];
+      else if ( 0 == strcmp(argv[i], "-loss2") )
+         *pszLoss2 = argv[++i];
+      else if ( 0 == strcmp(argv[i], "-latency") )
+         s_uLatencyMicros = atoi(argv[++i])*1000;
+      else if ( 0 == strcmp(argv[i], "-maxwait") )
+         s_uMaxWaitMicros = atoi(argv[++i])*1000;
+      else if ( 0 == strcmp(argv[i], "-seed") )
+         s_uSeed = (u32)atoi(argv[++i]);
+      else
+         return false;
+   }
+   if ( s_iBlockData < 1 || s_iBlockData > MAX_DATA_PACKETS_IN_BLOCK || s_iBlockFec < 0 || s_iBlockFec > MAX_FECS_PACKETS_IN_BLOCK )
+      return false;
+   if ( s_iRelayFec > MAX_FECS_PACKETS_IN_BLOCK )
+      return false;
+   if ( s_iPacketLength < 16 || s_iPacketLength > MAX_PACKET_PAYLOAD )
+      return false;
+   return true;
+}
+
+int main(int argc, char *argv[])
+{
+   log_init_local_only("TestRelayVideoBlocks");
+   log_enable_stdout();
+
+   const char* szLoss1 = NULL;
+   const char* szLoss2 = NULL;
+   if ( ! _parse_args(argc, argv, &szLoss1, &szLoss2) )
+   {
+      printf("Usage: test_relay_video_blocks [-duration s] [-bitrate kbps] [-block d,f] [-relayfec n] [-packet bytes]\n");
+      printf("   [-loss1 spec] [-loss2 spec] [-latency ms] [-noretr] [-encrypt] [-maxwait ms] [-seed n]\n");
+      printf("   loss spec: none | uniform:rate | ge:p_good_to_bad,p_bad_to_good,loss_good,loss_bad\n");
+      return 1;
+   }
+
+   fec_init();
+   const char* szPass = "test-relay-pass-phrase";
+   encr_aead_set_pass_phrase((const u8*)szPass, strlen(szPass));
+   s_pTXHistory = (t_tx_sim_block*)malloc(sizeof(t_tx_sim_block)*SIM_TX_HISTORY_BLOCKS);
+   if ( NULL == s_pTXHistory )
+      return 1;
+   for( int i=0; i<SIM_RX_BLOCKS; i++ )
+   for( int k=0; k<MAX_TOTAL_PACKETS_IN_BLOCK; k++ )
+      s_RXBlocks[i].pPackets[k] = (u8*)malloc(MAX_PACKET_TOTAL_SIZE);
+
+   test_relay_unit();
+
+   if ( (NULL != szLoss1) || (NULL != szLoss2) )
+      run_scenario((NULL != szLoss1)?szLoss1:"none", (NULL != szLoss2)?szLoss2:"none");
+   else
+   {
+      const char* szScenarios[][2] = {
+         { "none", "none" },
+         { "uniform:0.05", "uniform:0.05" },
+         { "uniform:0.15", "uniform:0.15" },
+         { "uniform:0.25", "uniform:0.05" },
+         { "uniform:0.05", "uniform:0.25" },
+         { "ge:0.02,0.3,0.01,0.7", "ge:0.02,0.3,0.01,0.7" } };
+      for( int i=0; i<(int)(sizeof(szScenarios)/sizeof(szScenarios[0])); i++ )
+         run_scenario(szScenarios[i][0], szScenarios[i][1]);
+
+      if ( ! s_bEncryption )
+      {
+         s_bEncryption = true;
+         run_scenario("none", "none");
+         run_scenario("uniform:0.05", "uniform:0.05");
+      }
+   }
+
+   if ( s_iFailed )
+   {
+      log_line("Test FAILED");
+      return 1;
+   }
+   log_line("Test PASSED");
+   return 0;
+}
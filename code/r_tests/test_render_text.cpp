@@ -0,0 +1,168 @@
+#include "../base/base.h"
+#include "../base/config.h"
+#include "../base/hardware.h"
+
+#include <time.h>
+#include <sys/time.h>
+
+#include "../renderer/render_engine_raw.h"
+#include "../renderer/render_engine_raw_text_cache.h"
+
+// Render benchmark for the raw renderer text path: draws an OSD like text load (static labels,
+// slowly changing values, a fast changing timer, a few colors and fonts) into an offscreen buffer,
+// first with the text caches disabled (glyph by glyph blits) then enabled, and reports the frame times.
+// Usage: test_render_text [-frames N] [-fonts folder] [-size WxH]
+
+int s_iFrames = 600;
+char s_szFontsFolder[256] = "res/";
+int s_iWidth = 1280;
+int s_iHeight = 720;
+
+static const char* s_szLabels[] =
+{
+   "Alt:", "Dist:", "Speed:", "Vspd:", "Home:", "Batt:", "Curr:", "mAh:", "RSSI:", "Link:",
+   "Sats:", "HDOP:", "Thr:", "Mode:", "Video:", "Rec:", "CPU:", "Temp:", "Radio:", "Ch:",
+   "Pitch:", "Roll:", "Heading:", "Time:", "Wind:", "Eff:", "Lat:", "Lon:", "Rx:", "Tx:"
+};
+
+double _get_micros()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec*1000000.0 + ts.tv_nsec/1000.0;
+}
+
+void _draw_osd_frame(RenderEngineRaw* pEngine, u32* pFonts, int iFrame, bool bUseTextWidth)
+{
+   double colorWhite[4] = {255,255,255,1.0};
+   double colorYellow[4] = {255,250,80,1.0};
+   double colorRed[4] = {255,60,60,0.9};
+   char szBuff[64];
+
+   // Values change 10 times a second at 60 fps, except the timer
+   int iTick = iFrame/6;
+   int iCountLabels = sizeof(s_szLabels)/sizeof(s_szLabels[0]);
+   for( int i=0; i<iCountLabels; i++ )
+   {
+      float xPos = 0.02 + 0.32 * (i%3);
+      float yPos = 0.04 + 0.028 * (i/3);
+      pEngine->setColors(colorWhite);
+      pEngine->drawText(xPos, yPos, pFonts[0], s_szLabels[i]);
+      float fWidth = 0.08;
+      if ( bUseTextWidth )
+         fWidth = pEngine->textWidth(0.0, pFonts[0], s_szLabels[i]);
+
+      sprintf(szBuff, "%d.%d", (iTick*(i+3)) % 500, (iTick+i) % 10);
+      pEngine->setColors((i%7 == 0)?colorYellow:colorWhite);
+      pEngine->drawText(xPos + fWidth + 0.005, yPos, pFonts[1], szBuff);
+   }
+
+   // Right aligned values block
+   for( int i=0; i<10; i++ )
+   {
+      sprintf(szBuff, "%d dBm", -40 - ((iTick + i*7) % 50));
+      pEngine->setColors(colorWhite);
+      pEngine->drawTextLeft(0.98, 0.40 + 0.03*i, pFonts[1], szBuff);
+   }
+
+   // Warnings and the fast changing timer
+   pEngine->setColors(colorRed);
+   pEngine->drawText(0.40, 0.80, pFonts[2], "Low battery!");
+   sprintf(szBuff, "%02d:%02d.%03d", (iFrame/3600)%60, (iFrame/60)%60, (iFrame*16)%1000);
+   pEngine->setColors(colorWhite);
+   pEngine->drawText(0.45, 0.90, pFonts[2], szBuff);
+
+   // A long message line (over the span cache length)
+   pEngine->setColors(colorYellow);
+   pEngine->drawText(0.02, 0.95, pFonts[0], "Vehicle telemetry: link quality good, video stream 8 Mbps, adaptive video active, radio interfaces 2 of 2 active, no alarms");
+}
+
+double _run_frames(RenderEngineRaw* pEngine, u32* pFonts, int iFrames)
+{
+   double dTotal = 0.0;
+   for( int iFrame=0; iFrame<iFrames; iFrame++ )
+   {
+      pEngine->startFrame();
+      double dStart = _get_micros();
+      _draw_osd_frame(pEngine, pFonts, iFrame, true);
+      dTotal += _get_micros() - dStart;
+   }
+   return dTotal/iFrames;
+}
+
+int main(int argc, char *argv[])
+{
+   log_init("TestRenderText");
+   log_enable_stdout();
+
+   for( int i=1; i<argc; i++ )
+   {
+      if ( 0 == strcmp(argv[i], "-frames") && i < argc-1 )
+         s_iFrames = atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-fonts") && i < argc-1 )
+         snprintf(s_szFontsFolder, sizeof(s_szFontsFolder)-1, "%s/", argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-size") && i < argc-1 )
+         sscanf(argv[++i], "%dx%d", &s_iWidth, &s_iHeight);
+   }
+
+   RenderEngineRaw* pEngine = new RenderEngineRaw(s_iWidth, s_iHeight);
+
+   const char* szFonts[3] = { "font_ariobold_18.dsc", "font_bt_bold_20.dsc", "font_ariobold_28.dsc" };
+   u32 uFonts[3];
+   for( int i=0; i<3; i++ )
+   {
+      char szFile[512];
+      snprintf(szFile, sizeof(szFile)-1, "%s%s", s_szFontsFolder, szFonts[i]);
+      uFonts[i] = pEngine->loadFont(szFile);
+      if ( 0 == uFonts[i] )
+      {
+         log_line("Failed to load font %s", szFile);
+         return 1;
+      }
+   }
+
+   int iBufferSize = s_iWidth * s_iHeight * 4;
+   u8* pFrameNoCache = (u8*)malloc(iBufferSize);
+
+   pEngine->setTextCacheEnabled(false);
+   _run_frames(pEngine, uFonts, 30);
+   double dTimeNoCache = _run_frames(pEngine, uFonts, s_iFrames);
+   pEngine->startFrame();
+   _draw_osd_frame(pEngine, uFonts, 1234, false);
+   memcpy(pFrameNoCache, pEngine->getBackBuffer(), iBufferSize);
+
+   pEngine->setTextCacheEnabled(true);
+   double dTimeCache = _run_frames(pEngine, uFonts, s_iFrames);
+   pEngine->startFrame();
+   _draw_osd_frame(pEngine, uFonts, 1234, false);
+
+   // Compare a frame drawn both ways, at fixed positions: the cached text widths are summed
+   // in pixels, so texts placed after a measured text can land one pixel apart.
+   // Premultiplied blending can also round differently by one.
+   int iMaxDiff = 0;
+   u32 uDiffPixels = 0;
+   u8* pFrameCache = pEngine->getBackBuffer();
+   for( int i=0; i<iBufferSize; i++ )
+   {
+      int iDiff = abs((int)pFrameCache[i] - (int)pFrameNoCache[i]);
+      if ( iDiff > iMaxDiff )
+         iMaxDiff = iDiff;
+      if ( iDiff > 2 )
+         uDiffPixels++;
+   }
+
+   t_raw_text_cache_stats* pStats = pEngine->getTextCache()->getStats();
+   log_line("%d frames at %dx%d:", s_iFrames, s_iWidth, s_iHeight);
+   log_line("   No text cache:   %.1f us/frame", dTimeNoCache);
+   log_line("   With text cache: %.1f us/frame (%.1fx)", dTimeCache, (dTimeCache > 0.0)?(dTimeNoCache/dTimeCache):0.0);
+   log_line("   Spans: %u hits, %u misses, %u KB; atlases: %u hits, %u misses; widths: %u hits, %u misses",
+      pStats->uSpanHits, pStats->uSpanMisses, pStats->uSpansMemory/1024, pStats->uAtlasHits, pStats->uAtlasMisses, pStats->uAdvanceHits, pStats->uAdvanceMisses);
+   log_line("   Compared frame difference: max %d, %u values differ by more than 2", iMaxDiff, uDiffPixels);
+
+   free(pFrameNoCache);
+   delete pEngine;
+
+   int iResult = (uDiffPixels > 0)?1:0;
+   log_line(iResult?"FAILED":"PASSED");
+   return iResult;
+}
@@ -0,0 +1,352 @@
+#include "../base/base.h"
+#include "../base/hardware.h"
+#include "../radio/radiopackets2.h"
+#include "../radio/radio_sim.h"
+#include "../radio/rx_scope_capture.h"
+
+// Tests the RX scope capture engine with pcap files as input (no radio hardware):
+// frames classification into the timeline slices (video, retransmissions, telemetry, commands, chained
+// packets, bad CRC, RSSI), the capture stats, the pcap export (read back and compared to the input),
+// then a larger capture read by snapshots while the capture thread writes the timeline.
+// Usage: test_rx_scope_capture [-loops N] (N: thousands of frames for the larger capture)
+
+#define TEST_PCAP_INPUT "/tmp/test_rx_scope_in.pcap"
+#define TEST_PCAP_EXPORT "/tmp/test_rx_scope_out.pcap"
+#define TEST_PCAP_TIME_START 7000000
+
+int s_iFailed = 0;
+int s_iLoops = 20;
+
+void _fail(const char* szText)
+{
+   log_line("%s <- FAILED", szText);
+   s_iFailed = 1;
+}
+
+// Builds a Ruby packet (headers + payload) at pBuffer, returns its length
+
+int _build_packet(u8* pBuffer, u8 uComponent, u8 uFlags, u8 uType, int iLength)
+{
+   t_packet_header* pPH = (t_packet_header*)pBuffer;
+   memset(pBuffer, 0, iLength);
+   pPH->packet_flags = uComponent | uFlags;
+   pPH->packet_type = uType;
+   pPH->total_headers_length = sizeof(t_packet_header);
+   pPH->total_length = iLength;
+   pPH->vehicle_id_src = 1;
+   for( int i=sizeof(t_packet_header); i<iLength; i++ )
+      pBuffer[i] = (u8)(i*13 + uComponent);
+   packet_compute_crc(pBuffer, iLength);
+   return iLength;
+}
+
+typedef struct
+{
+   u32 uTime;
+   u8 data[MAX_PACKET_TOTAL_SIZE];
+   int iLength;
+   int iRSSI;
+} t_test_frame;
+
+t_test_frame s_Frames[8];
+int s_iFramesCount = 0;
+
+t_test_frame* _add_frame(u32 uTime, int iRSSI)
+{
+   t_test_frame* pFrame = &s_Frames[s_iFramesCount];
+   s_iFramesCount++;
+   pFrame->uTime = uTime;
+   pFrame->iRSSI = iRSSI;
+   pFrame->iLength = 0;
+   return pFrame;
+}
+
+void _check_slice(t_rx_scope_slice* pSlice, u32 uSliceNumber, u32 uPackets, u32 uBytes, u32 uBadCRC, u32 uVideo, u32 uRetr, u32 uTelemetry, u32 uCommands, u32 uOther, int iRSSIMin, int iRSSIMax, u32 uRSSICount)
+{
+   char szBuff[256];
+   if ( (pSlice->uSliceNumber != uSliceNumber) || (pSlice->uPackets != uPackets) || (pSlice->uBytes != uBytes) ||
+        (pSlice->uBadCRC != uBadCRC) || (pSlice->uVideo != uVideo) || (pSlice->uVideoRetransmissions != uRetr) ||
+        (pSlice->uTelemetry != uTelemetry) || (pSlice->uCommands != uCommands) || (pSlice->uOther != uOther) ||
+        (pSlice->uRSSICount != uRSSICount) )
+   {
+      sprintf(szBuff, "Slice %u: got %u packets, %u bytes, bad CRC %u, video %u/%u, telemetry %u, commands %u, other %u, RSSI count %u",
+         pSlice->uSliceNumber, pSlice->uPackets, pSlice->uBytes, pSlice->uBadCRC, pSlice->uVideo, pSlice->uVideoRetransmissions,
+         pSlice->uTelemetry, pSlice->uCommands, pSlice->uOther, pSlice->uRSSICount);
+      _fail(szBuff);
+      return;
+   }
+   if ( (uRSSICount > 0) && ((pSlice->iRSSIMin != iRSSIMin) || (pSlice->iRSSIMax != iRSSIMax)) )
+   {
+      sprintf(szBuff, "Slice %u: got RSSI %d..%d, expected %d..%d", uSliceNumber, pSlice->iRSSIMin, pSlice->iRSSIMax, iRSSIMin, iRSSIMax);
+      _fail(szBuff);
+   }
+}
+
+bool _wait_input_done(t_rx_scope_capture_stats* pStats)
+{
+   for( int i=0; i<500; i++ )
+   {
+      if ( rx_scope_capture_get_stats(pStats) && pStats->bInputDone )
+         return true;
+      hardware_sleep_ms(10);
+   }
+   return false;
+}
+
+void _test_classification()
+{
+   u8* pData = NULL;
+   t_test_frame* pFrame = NULL;
+   s_iFramesCount = 0;
+
+   // Slice 0: video, retransmitted video, telemetry
+   pFrame = _add_frame(TEST_PCAP_TIME_START, -50);
+   pFrame->iLength = _build_packet(pFrame->data, PACKET_COMPONENT_VIDEO, 0, PACKET_TYPE_VIDEO_DATA_FULL, 300);
+   pFrame = _add_frame(TEST_PCAP_TIME_START + 200, -60);
+   pFrame->iLength = _build_packet(pFrame->data, PACKET_COMPONENT_VIDEO, PACKET_FLAGS_BIT_RETRANSMITED, PACKET_TYPE_VIDEO_DATA_FULL, 300);
+   pFrame = _add_frame(TEST_PCAP_TIME_START + 900, -40);
+   pFrame->iLength = _build_packet(pFrame->data, PACKET_COMPONENT_TELEMETRY, 0, PACKET_TYPE_RUBY_TELEMETRY_EXTENDED, 200);
+
+   // Slice 1: chained telemetry + command, no RSSI
+   pFrame = _add_frame(TEST_PCAP_TIME_START + 1500, RADIO_SIM_PCAP_NO_RSSI);
+   pFrame->iLength = _build_packet(pFrame->data, PACKET_COMPONENT_TELEMETRY, 0, PACKET_TYPE_RUBY_TELEMETRY_EXTENDED, 100);
+   pFrame->iLength += _build_packet(pFrame->data + pFrame->iLength, PACKET_COMPONENT_COMMANDS, 0, PACKET_TYPE_COMMAND, 80);
+
+   // Slice 2: command with a bad CRC
+   pFrame = _add_frame(TEST_PCAP_TIME_START + 2100, -70);
+   pFrame->iLength = _build_packet(pFrame->data, PACKET_COMPONENT_COMMANDS, 0, PACKET_TYPE_COMMAND, 120);
+   pFrame->data[100] ^= 0x55;
+
+   // Slice 5: Ruby packet and an other component packet
+   pFrame = _add_frame(TEST_PCAP_TIME_START + 5000, -55);
+   pFrame->iLength = _build_packet(pFrame->data, PACKET_COMPONENT_RUBY, 0, PACKET_TYPE_RUBY_PING_CLOCK, 50);
+   pFrame = _add_frame(TEST_PCAP_TIME_START + 5999, RADIO_SIM_PCAP_NO_RSSI);
+   pFrame->iLength = _build_packet(pFrame->data, PACKET_COMPONENT_RC, 0, PACKET_TYPE_RC_TELEMETRY, 60);
+
+   FILE* fd = radio_sim_pcap_open_write(TEST_PCAP_INPUT);
+   if ( NULL == fd )
+   {
+      _fail("Create the input pcap file");
+      return;
+   }
+   for( int i=0; i<s_iFramesCount; i++ )
+      radio_sim_pcap_write_packet_ex(fd, s_Frames[i].data, s_Frames[i].iLength, s_Frames[i].uTime, s_Frames[i].iRSSI);
+   fclose(fd);
+
+   t_rx_scope_capture_params params;
+   rx_scope_capture_params_reset(&params);
+   params.uSliceMicros = 1000;
+   strcpy(params.szPcapInput, TEST_PCAP_INPUT);
+   strcpy(params.szPcapExport, TEST_PCAP_EXPORT);
+   if ( ! rx_scope_capture_start(&params) )
+   {
+      _fail("Start the capture");
+      return;
+   }
+
+   t_rx_scope_capture_stats stats;
+   if ( ! _wait_input_done(&stats) )
+      _fail("Read all the pcap input");
+   rx_scope_capture_stop();
+   rx_scope_capture_get_stats(&stats);
+
+   if ( (stats.uPackets != 7) || (stats.uBytes != 1210) || (stats.uBadCRC != 1) || (stats.uLastSliceNumber != 5) ||
+        (stats.uTimeLastPacketMicros != 5999) || (stats.uPacketsExported != 7) || (stats.uExportErrors != 0) || (stats.uInterfacePackets[0] != 7) )
+   {
+      char szBuff[256];
+      sprintf(szBuff, "Stats: %u frames, %u bytes, %u bad CRC, last slice %u, last time %u, %u exported",
+         stats.uPackets, stats.uBytes, stats.uBadCRC, stats.uLastSliceNumber, stats.uTimeLastPacketMicros, stats.uPacketsExported);
+      _fail(szBuff);
+   }
+
+   t_rx_scope_slice slices[8];
+   if ( 6 != rx_scope_capture_get_timeline(slices, 6, MAX_U32) )
+      _fail("Get the timeline");
+   _check_slice(&slices[0], 0, 3, 800, 0, 1, 1, 1, 0, 0, -60, -40, 3);
+   if ( slices[0].iRSSISum != -150 )
+      _fail("Slice 0 RSSI sum");
+   _check_slice(&slices[1], 1, 1, 180, 0, 0, 0, 1, 1, 0, 0, 0, 0);
+   _check_slice(&slices[2], 2, 1, 120, 1, 0, 0, 0, 0, 0, -70, -70, 1);
+   _check_slice(&slices[3], 3, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+   _check_slice(&slices[4], 4, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+   _check_slice(&slices[5], 5, 2, 110, 0, 0, 0, 0, 1, 1, -55, -55, 1);
+
+   // An older window, ending at a given slice; slices before the capture start are empty
+   if ( 4 != rx_scope_capture_get_timeline(slices, 4, 2) )
+      _fail("Get the timeline window");
+   _check_slice(&slices[0], MAX_U32, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+   _check_slice(&slices[1], 0, 3, 800, 0, 1, 1, 1, 0, 0, -60, -40, 3);
+   _check_slice(&slices[3], 2, 1, 120, 1, 0, 0, 0, 0, 0, -70, -70, 1);
+
+   // The export has the same frames, RSSI and relative times
+   fd = radio_sim_pcap_open_read(TEST_PCAP_EXPORT);
+   if ( NULL == fd )
+   {
+      _fail("Open the exported pcap file");
+      return;
+   }
+   u8 buffer[MAX_PACKET_TOTAL_SIZE];
+   int iCount = 0;
+   while ( true )
+   {
+      u32 uTime = 0;
+      int iRSSI = 0;
+      int iLength = radio_sim_pcap_read_packet_ex(fd, buffer, sizeof(buffer), &uTime, &iRSSI);
+      if ( iLength <= 0 )
+         break;
+      if ( iCount >= s_iFramesCount )
+      {
+         iCount++;
+         continue;
+      }
+      pData = s_Frames[iCount].data;
+      if ( (iLength != s_Frames[iCount].iLength) || (0 != memcmp(buffer, pData, iLength)) ||
+           (iRSSI != s_Frames[iCount].iRSSI) || (uTime != s_Frames[iCount].uTime - TEST_PCAP_TIME_START) )
+      {
+         char szBuff[128];
+         sprintf(szBuff, "Exported frame %d: length %d, RSSI %d, time %u", iCount, iLength, iRSSI, uTime);
+         _fail(szBuff);
+      }
+      iCount++;
+   }
+   fclose(fd);
+   if ( iCount != s_iFramesCount )
+      _fail("Exported frames count");
+   log_line("Classification and export test done.");
+}
+
+// Larger capture, in real time, with one packet per frame and fixed lengths per component, so each
+// snapshot slice must be consistent: packets and bytes add up from the per component counters.
+
+#define LARGE_VIDEO_LENGTH 1000
+#define LARGE_RETR_LENGTH 900
+#define LARGE_TELEMETRY_LENGTH 300
+#define LARGE_COMMANDS_LENGTH 100
+
+void _test_snapshots()
+{
+   int iFrames = s_iLoops * 1000;
+   u8 buffer[MAX_PACKET_TOTAL_SIZE];
+   u32 uTotalBytes = 0;
+   u32 uTime = TEST_PCAP_TIME_START;
+
+   FILE* fd = radio_sim_pcap_open_write(TEST_PCAP_INPUT);
+   if ( NULL == fd )
+   {
+      _fail("Create the input pcap file");
+      return;
+   }
+   // Bursts of frames (like video blocks) with gaps, about 1 second for 10k frames
+   for( int i=0; i<iFrames; i++ )
+   {
+      int iLength = 0;
+      if ( (i % 10) == 9 )
+         iLength = _build_packet(buffer, PACKET_COMPONENT_TELEMETRY, 0, PACKET_TYPE_RUBY_TELEMETRY_EXTENDED, LARGE_TELEMETRY_LENGTH);
+      else if ( (i % 25) == 7 )
+         iLength = _build_packet(buffer, PACKET_COMPONENT_COMMANDS, 0, PACKET_TYPE_COMMAND, LARGE_COMMANDS_LENGTH);
+      else if ( (i % 12) == 5 )
+         iLength = _build_packet(buffer, PACKET_COMPONENT_VIDEO, PACKET_FLAGS_BIT_RETRANSMITED, PACKET_TYPE_VIDEO_DATA_FULL, LARGE_RETR_LENGTH);
+      else
+         iLength = _build_packet(buffer, PACKET_COMPONENT_VIDEO, 0, PACKET_TYPE_VIDEO_DATA_FULL, LARGE_VIDEO_LENGTH);
+      radio_sim_pcap_write_packet_ex(fd, buffer, iLength, uTime, -40 - (i % 30));
+      uTotalBytes += iLength;
+      uTime += ((i % 16) == 15)?1500:30;
+   }
+   fclose(fd);
+
+   t_rx_scope_capture_params params;
+   rx_scope_capture_params_reset(&params);
+   params.uSliceMicros = 500;
+   params.bPcapInputRealTime = 1;
+   strcpy(params.szPcapInput, TEST_PCAP_INPUT);
+   if ( ! rx_scope_capture_start(&params) )
+   {
+      _fail("Start the capture");
+      return;
+   }
+
+   static t_rx_scope_slice slices[RX_SCOPE_CAPTURE_SLICES];
+   t_rx_scope_capture_stats stats;
+   u32 uSnapshots = 0;
+   u32 uSlicesChecked = 0;
+   u32 uBadSlices = 0;
+   u32 uLastPackets = 0;
+   bool bDone = false;
+   while ( ! bDone )
+   {
+      if ( ! rx_scope_capture_get_stats(&stats) )
+         continue;
+      bDone = stats.bInputDone;
+      if ( stats.uPackets < uLastPackets )
+         _fail("Stats went back");
+      uLastPackets = stats.uPackets;
+
+      int iCount = rx_scope_capture_get_timeline(slices, 1000, MAX_U32);
+      uSnapshots++;
+      for( int i=0; i<iCount; i++ )
+      {
+         t_rx_scope_slice* pSlice = &slices[i];
+         if ( 0 == pSlice->uPackets )
+            continue;
+         uSlicesChecked++;
+         u32 uPackets = pSlice->uVideo + pSlice->uVideoRetransmissions + pSlice->uTelemetry + pSlice->uCommands;
+         u32 uBytes = pSlice->uVideo * LARGE_VIDEO_LENGTH + pSlice->uVideoRetransmissions * LARGE_RETR_LENGTH +
+                      pSlice->uTelemetry * LARGE_TELEMETRY_LENGTH + pSlice->uCommands * LARGE_COMMANDS_LENGTH;
+         if ( (uPackets != pSlice->uPackets) || (uBytes != pSlice->uBytes) || (pSlice->uRSSICount != pSlice->uPackets) ||
+              (pSlice->iRSSIMin < -69) || (pSlice->iRSSIMax > -40) || (0 != pSlice->uBadCRC) || (0 != pSlice->uOther) )
+            uBadSlices++;
+      }
+      hardware_sleep_micros(200);
+   }
+   rx_scope_capture_stop();
+   rx_scope_capture_get_stats(&stats);
+
+   log_line("%u snapshots, %u slices checked, %u inconsistent; %u frames in %u wake ups (max %u per wake up).",
+      uSnapshots, uSlicesChecked, uBadSlices, stats.uPackets, stats.uWakeups, stats.uMaxPacketsPerWakeup);
+   if ( uBadSlices > 0 )
+      _fail("Inconsistent snapshot slices");
+   if ( (uSnapshots < 10) || (0 == uSlicesChecked) )
+      _fail("Snapshots taken while capturing");
+   if ( (stats.uPackets != (u32)iFrames) || (stats.uBytes != uTotalBytes) || (stats.uBadCRC != 0) )
+      _fail("Large capture totals");
+
+   // The whole last part of the timeline adds up to the frames in it
+   int iCount = rx_scope_capture_get_timeline(slices, RX_SCOPE_CAPTURE_SLICES, MAX_U32);
+   u32 uPacketsInTimeline = 0;
+   for( int i=0; i<iCount; i++ )
+      uPacketsInTimeline += slices[i].uPackets;
+   u32 uSlicesCaptured = stats.uLastSliceNumber + 1;
+   if ( (uSlicesCaptured <= RX_SCOPE_CAPTURE_SLICES) && (uPacketsInTimeline != (u32)iFrames) )
+      _fail("Timeline totals");
+   if ( (uSlicesCaptured > RX_SCOPE_CAPTURE_SLICES) && ((uPacketsInTimeline == 0) || (uPacketsInTimeline > (u32)iFrames)) )
+      _fail("Timeline totals (wrapped)");
+   log_line("Snapshots test done.");
+}
+
+int main(int argc, char *argv[])
+{
+   log_init("TestRxScopeCapture");
+   log_enable_stdout();
+
+   for( int i=1; i<argc; i++ )
+   {
+      if ( 0 == strcmp(argv[i], "-loops") && i < argc-1 )
+         s_iLoops = atoi(argv[++i]);
+   }
+   if ( s_iLoops < 1 )
+      s_iLoops = 1;
+
+   _test_classification();
+   _test_snapshots();
+
+   unlink(TEST_PCAP_INPUT);
+   unlink(TEST_PCAP_EXPORT);
+
+   if ( s_iFailed )
+   {
+      log_line("Test FAILED");
+      return 1;
+   }
+   log_line("Test PASSED");
+   return 0;
+}
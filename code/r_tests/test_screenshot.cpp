@@ -0,0 +1,184 @@
+#include "../base/base.h"
+#include "../base/config.h"
+
+#include <time.h>
+#include <unistd.h>
+
+#include "../renderer/render_engine_raw.h"
+#include "../renderer/render_screenshot.h"
+#define LODEPNG_NO_COMPILE_CPP
+#include "../renderer/lodepng.h"
+
+// Headless screenshot test: renders frames into an offscreen raw renderer, captures them and queues them
+// to the background PNG writer, like the UI does on the screenshot button. Checks that the render loop
+// is not blocked (capture + queue time vs. the encode time), that the queue stays bounded (extra requests
+// are rejected, not waited for), and that each decoded PNG matches the captured frame pixel by pixel.
+// Usage: test_screenshot [-size WxH] [-count N] [-folder path]
+
+int s_iWidth = 1280;
+int s_iHeight = 720;
+int s_iCount = 6;
+char s_szFolder[256] = "/tmp";
+
+double _get_micros()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec*1000000.0 + ts.tv_nsec/1000.0;
+}
+
+void _draw_frame(RenderEngineRaw* pEngine, int iFrame)
+{
+   double colorBg[4] = {20, 40, 60, 1.0};
+   double colorBox[4] = {(double)((iFrame*40) % 256), 200, 30, 1.0};
+   double colorLine[4] = {255, 255, 255, 0.7};
+
+   pEngine->startFrame();
+   pEngine->setColors(colorBg);
+   pEngine->drawRect(0.0, 0.0, 1.0, 0.2);
+   pEngine->setColors(colorBox);
+   pEngine->drawRoundRect(0.1 + 0.05*iFrame, 0.3, 0.3, 0.3, 0.02);
+   pEngine->fillCircle(0.8, 0.7, 0.1);
+   pEngine->setColors(colorLine);
+   for( int i=0; i<20; i++ )
+      pEngine->drawLine(0.0, 0.04*i, 1.0, 1.0 - 0.04*i);
+   pEngine->endFrame();
+}
+
+bool _check_png(const char* szFile, const u8* pExpected, int iWidth, int iHeight)
+{
+   u8* pDecoded = NULL;
+   unsigned int uWidth = 0, uHeight = 0;
+   unsigned int uError = lodepng_decode32_file(&pDecoded, &uWidth, &uHeight, szFile);
+   if ( 0 != uError )
+   {
+      log_line("Failed to decode %s: %s", szFile, lodepng_error_text(uError));
+      return false;
+   }
+   bool bOk = ((int)uWidth == iWidth) && ((int)uHeight == iHeight) && (0 == memcmp(pDecoded, pExpected, iWidth*iHeight*4));
+   if ( ! bOk )
+      log_line("Decoded %s (%u x %u) differs from the captured frame", szFile, uWidth, uHeight);
+   free(pDecoded);
+   return bOk;
+}
+
+int main(int argc, char *argv[])
+{
+   log_init("TestScreenshot");
+   log_enable_stdout();
+
+   for( int i=1; i<argc; i++ )
+   {
+      if ( 0 == strcmp(argv[i], "-size") && i < argc-1 )
+         sscanf(argv[++i], "%dx%d", &s_iWidth, &s_iHeight);
+      else if ( 0 == strcmp(argv[i], "-count") && i < argc-1 )
+         s_iCount = atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-folder") && i < argc-1 )
+         strncpy(s_szFolder, argv[++i], sizeof(s_szFolder)-1);
+   }
+   if ( s_iCount < 1 )
+      s_iCount = 1;
+
+   RenderEngineRaw* pEngine = new RenderEngineRaw(s_iWidth, s_iHeight);
+   bool bPassed = true;
+
+   // One at a time: each one is written and matches its frame
+   u8** pExpected = (u8**)malloc(s_iCount * sizeof(u8*));
+   double dMaxQueueMicros = 0;
+   for( int i=0; i<s_iCount; i++ )
+   {
+      char szFile[512];
+      snprintf(szFile, sizeof(szFile), "%s/test_screenshot_%d.png", s_szFolder, i);
+      unlink(szFile);
+      _draw_frame(pEngine, i);
+
+      double dStart = _get_micros();
+      int iWidth = 0, iHeight = 0;
+      u8* pFrame = pEngine->captureFrame(&iWidth, &iHeight);
+      if ( NULL == pFrame || iWidth != s_iWidth || iHeight != s_iHeight )
+      {
+         log_line("Failed to capture the frame.");
+         return 1;
+      }
+      pExpected[i] = (u8*)malloc(iWidth*iHeight*4);
+      memcpy(pExpected[i], pFrame, iWidth*iHeight*4);
+      if ( ! render_screenshot_writer_add(pFrame, iWidth, iHeight, szFile) )
+      {
+         log_line("Screenshot %d was rejected with an empty queue.", i);
+         bPassed = false;
+      }
+      double dTime = _get_micros() - dStart;
+      if ( dTime > dMaxQueueMicros )
+         dMaxQueueMicros = dTime;
+      render_screenshot_writer_wait_idle();
+      if ( ! _check_png(szFile, pExpected[i], iWidth, iHeight) )
+         bPassed = false;
+   }
+   t_render_screenshot_stats* pStats = render_screenshot_writer_get_stats();
+   log_line("Capture + queue: %.2f ms max; PNG encode + write: %u ms (last)", dMaxQueueMicros/1000.0, pStats->uLastEncodeTimeMs);
+   if ( pStats->uSaved != (u32)s_iCount || dMaxQueueMicros/1000.0 >= (double)pStats->uLastEncodeTimeMs )
+   {
+      log_line("Screenshots were not saved in the background.");
+      bPassed = false;
+   }
+
+   // A burst: the render loop keeps going, the queue stays bounded, the accepted ones are all written
+   u32 uSavedBefore = pStats->uSaved;
+   int iAccepted = 0;
+   double dBurstStart = _get_micros();
+   for( int i=0; i<RENDER_SCREENSHOT_QUEUE_SIZE + 4; i++ )
+   {
+      char szFile[512];
+      snprintf(szFile, sizeof(szFile), "%s/test_screenshot_burst_%d.png", s_szFolder, i);
+      unlink(szFile);
+      _draw_frame(pEngine, i);
+      int iWidth = 0, iHeight = 0;
+      u8* pFrame = pEngine->captureFrame(&iWidth, &iHeight);
+      if ( render_screenshot_writer_add(pFrame, iWidth, iHeight, szFile) )
+         iAccepted++;
+      if ( render_screenshot_writer_get_pending() > RENDER_SCREENSHOT_QUEUE_SIZE + 1 )
+      {
+         log_line("Writer queue is over its size.");
+         bPassed = false;
+      }
+   }
+   double dBurstMs = (_get_micros() - dBurstStart)/1000.0;
+   render_screenshot_writer_wait_idle();
+   log_line("Burst of %d screenshots: %d accepted, %u rejected, render loop time %.2f ms",
+      RENDER_SCREENSHOT_QUEUE_SIZE + 4, iAccepted, pStats->uRejected, dBurstMs);
+   if ( iAccepted < 1 || iAccepted >= RENDER_SCREENSHOT_QUEUE_SIZE + 4 || pStats->uSaved - uSavedBefore != (u32)iAccepted )
+      bPassed = false;
+
+   // No partial (temporary) files are left
+   for( int i=0; i<RENDER_SCREENSHOT_QUEUE_SIZE + 4; i++ )
+   {
+      char szFile[512];
+      snprintf(szFile, sizeof(szFile), "%s/test_screenshot_burst_%d.png.tmp", s_szFolder, i);
+      if ( 0 == access(szFile, F_OK) )
+      {
+         log_line("Temporary file left: %s", szFile);
+         bPassed = false;
+      }
+      szFile[strlen(szFile)-4] = 0;
+      unlink(szFile);
+   }
+
+   render_screenshot_writer_stop();
+   for( int i=0; i<s_iCount; i++ )
+   {
+      char szFile[512];
+      snprintf(szFile, sizeof(szFile), "%s/test_screenshot_%d.png", s_szFolder, i);
+      unlink(szFile);
+      free(pExpected[i]);
+   }
+   free(pExpected);
+   delete pEngine;
+
+   if ( ! bPassed )
+   {
+      log_line("Test FAILED");
+      return 1;
+   }
+   log_line("Test PASSED");
+   return 0;
+}
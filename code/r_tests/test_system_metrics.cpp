@@ -0,0 +1,233 @@
+#include "../base/base.h"
+#include "../base/config.h"
+#include "../base/hardware.h"
+#include "../base/hw_procs.h"
+#include "../base/system_metrics.h"
+
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/mman.h>
+
+// Points the system metrics sampler at a fake /proc and /sys tree and checks the values it reads:
+// CPU load from two /proc/stat samples, memory, temperature, CPU speed, throttled flags, disk space
+// (against statvfs), missing files, and the shared memory snapshot published by the sampler thread.
+// Usage: test_system_metrics [-folder path]
+
+#define TEST_SHARED_MEM_NAME "/SYSTEM_SHARED_MEM_RUBY_TEST_SYSTEM_METRICS"
+
+char s_szFolder[256] = "/tmp/test_system_metrics";
+int s_iFailed = 0;
+
+void _write_file(const char* szFile, const char* szContent)
+{
+   char szPath[512];
+   snprintf(szPath, sizeof(szPath), "%s%s", s_szFolder, szFile);
+
+   // Create the parent folders
+   for( char* p = szPath+1; *p; p++ )
+   {
+      if ( *p != '/' )
+         continue;
+      *p = 0;
+      mkdir(szPath, 0777);
+      *p = '/';
+   }
+   FILE* fd = fopen(szPath, "w");
+   if ( NULL == fd )
+   {
+      log_line("Can't create file %s", szPath);
+      s_iFailed = 1;
+      return;
+   }
+   fputs(szContent, fd);
+   fclose(fd);
+}
+
+void _remove_file(const char* szFile)
+{
+   char szPath[512];
+   snprintf(szPath, sizeof(szPath), "%s%s", s_szFolder, szFile);
+   unlink(szPath);
+}
+
+void _check(const char* szName, long lValue, long lExpected)
+{
+   log_line("%s: %ld, expected %ld %s", szName, lValue, lExpected, (lValue == lExpected)?"":"<- FAILED");
+   if ( lValue != lExpected )
+      s_iFailed = 1;
+}
+
+void _write_proc_stat(unsigned long long uBusy, unsigned long long uIdle)
+{
+   // user nice system idle iowait irq softirq steal guest guest_nice, busy time split over user and system
+   char szBuff[512];
+   snprintf(szBuff, sizeof(szBuff),
+      "cpu  %llu 0 %llu %llu 0 0 0 0 0 0\ncpu0 %llu 0 %llu %llu 0 0 0 0 0 0\nintr 12345\nctxt 6789\n",
+      uBusy - uBusy/4, uBusy/4, uIdle, uBusy - uBusy/4, uBusy/4, uIdle);
+   _write_file("/proc/stat", szBuff);
+}
+
+void _write_fake_tree()
+{
+   _write_proc_stat(1000, 9000);
+   _write_file("/proc/meminfo",
+      "MemTotal:         948304 kB\n"
+      "MemFree:          612340 kB\n"
+      "MemAvailable:     731208 kB\n"
+      "Buffers:           20644 kB\n"
+      "Cached:           135112 kB\n");
+   _write_file("/sys/class/thermal/thermal_zone0/temp", "48312\n");
+   _write_file("/sys/devices/system/cpu/cpu0/cpufreq/scaling_cur_freq", "1200000\n");
+   _write_file("/sys/devices/platform/soc/soc:firmware/get_throttled", "50005\n");
+}
+
+void _check_disk(shared_mem_system_metrics* pMetrics, int iDisk, const char* szFolder)
+{
+   struct statvfs info;
+   if ( 0 != statvfs(szFolder, &info) )
+   {
+      log_line("Can't statvfs %s", szFolder);
+      s_iFailed = 1;
+      return;
+   }
+   u32 uTotalKb = (u32)(((unsigned long long)info.f_blocks * info.f_frsize) / 1024);
+   u32 uFreeKb = (u32)(((unsigned long long)info.f_bavail * info.f_frsize) / 1024);
+   if ( ! (pMetrics->uValidFlags & (SYSTEM_METRICS_VALID_DISK_ROOT << iDisk)) )
+   {
+      log_line("Disk %d (%s) was not read <- FAILED", iDisk, szFolder);
+      s_iFailed = 1;
+      return;
+   }
+   _check("Disk total Kb", pMetrics->disks[iDisk].uTotalKb, uTotalKb);
+   // Other processes can write in between, allow a few Mb of difference for the free space
+   long lDiff = (long)pMetrics->disks[iDisk].uFreeKb - (long)uFreeKb;
+   log_line("Disk free Kb: %u, statvfs: %u %s", pMetrics->disks[iDisk].uFreeKb, uFreeKb, (labs(lDiff) < 8192)?"":"<- FAILED");
+   if ( labs(lDiff) >= 8192 )
+      s_iFailed = 1;
+   if ( pMetrics->disks[iDisk].uUsedKb > pMetrics->disks[iDisk].uTotalKb )
+      s_iFailed = 1;
+}
+
+int main(int argc, char *argv[])
+{
+   log_init("TestSystemMetrics");
+   log_enable_stdout();
+
+   for( int i=1; i<argc; i++ )
+   {
+      if ( 0 == strcmp(argv[i], "-folder") && i < argc-1 )
+         strncpy(s_szFolder, argv[++i], sizeof(s_szFolder)-1);
+   }
+
+   _write_fake_tree();
+   char szProcRoot[300];
+   char szSysRoot[300];
+   char szDiskFolder[300];
+   strcpy(szProcRoot, s_szFolder);
+   strcpy(szSysRoot, s_szFolder);
+   snprintf(szDiskFolder, sizeof(szDiskFolder), "%s/proc", s_szFolder);
+   system_metrics_set_root_folders(szProcRoot, szSysRoot);
+   system_metrics_set_disk_folder(SYSTEM_METRICS_DISK_ROOT, s_szFolder);
+   system_metrics_set_disk_folder(SYSTEM_METRICS_DISK_TEMP, szDiskFolder);
+   system_metrics_set_disk_folder(SYSTEM_METRICS_DISK_MEMDISK, "/dev/shm");
+
+   // First sample: everything but the CPU load (needs two samples)
+   shared_mem_system_metrics metrics;
+   memset(&metrics, 0, sizeof(shared_mem_system_metrics));
+   system_metrics_sample_now(&metrics);
+   log_line("First sample took %u us", metrics.uLastSampleMicros);
+   _check("CPU load valid", (metrics.uValidFlags & SYSTEM_METRICS_VALID_CPU_LOAD)?1:0, 0);
+   _check("CPU speed Mhz", metrics.uCPUSpeedMHz, 1200);
+   _check("Temperature C", metrics.iTemperatureC, 48);
+   _check("Throttled", metrics.uThrottled, 0x50005);
+   _check("Throttled compact", system_metrics_get_compact_throttled_flags(metrics.uThrottled), 0x55);
+   _check("Memory total Kb", metrics.uMemTotalKb, 948304);
+   _check("Memory free Kb", metrics.uMemFreeKb, 612340);
+   _check("Memory available Kb", metrics.uMemAvailableKb, 731208);
+   _check_disk(&metrics, SYSTEM_METRICS_DISK_ROOT, s_szFolder);
+   _check_disk(&metrics, SYSTEM_METRICS_DISK_TEMP, szDiskFolder);
+   _check_disk(&metrics, SYSTEM_METRICS_DISK_MEMDISK, "/dev/shm");
+
+   // 300 busy out of 1000 total since the previous sample: 30%
+   _write_proc_stat(1300, 9700);
+   system_metrics_sample_now(&metrics);
+   _check("CPU load valid", (metrics.uValidFlags & SYSTEM_METRICS_VALID_CPU_LOAD)?1:0, 1);
+   _check("CPU load %", metrics.uCPULoadPercent, 30);
+
+   // Counters going back (reset) give no load value, the next sample is valid again
+   _write_proc_stat(100, 200);
+   system_metrics_sample_now(&metrics);
+   _check("CPU load valid after counters reset", (metrics.uValidFlags & SYSTEM_METRICS_VALID_CPU_LOAD)?1:0, 0);
+   _write_proc_stat(200, 200);
+   system_metrics_sample_now(&metrics);
+   _check("CPU load % (all busy)", metrics.uCPULoadPercent, 100);
+
+   // Missing files (old kernel, no firmware driver, non Pi board) and a missing disk folder
+   _remove_file("/sys/devices/platform/soc/soc:firmware/get_throttled");
+   _remove_file("/sys/devices/system/cpu/cpu0/cpufreq/scaling_cur_freq");
+   _write_file("/proc/meminfo", "MemTotal:  1000 kB\nMemFree:    400 kB\n");
+   system_metrics_set_disk_folder(SYSTEM_METRICS_DISK_TEMP, "/nonexistent/folder");
+   system_metrics_sample_now(&metrics);
+   _check("Throttled valid", (metrics.uValidFlags & SYSTEM_METRICS_VALID_THROTTLED)?1:0, 0);
+   _check("CPU speed valid", (metrics.uValidFlags & SYSTEM_METRICS_VALID_CPU_SPEED)?1:0, 0);
+   _check("Temperature valid", (metrics.uValidFlags & SYSTEM_METRICS_VALID_TEMPERATURE)?1:0, 1);
+   _check("Memory available Kb (no MemAvailable)", metrics.uMemAvailableKb, 400);
+   _check("Disk temp valid", (metrics.uValidFlags & SYSTEM_METRICS_VALID_DISK_TEMP)?1:0, 0);
+   _check("Disk temp total Kb", metrics.disks[SYSTEM_METRICS_DISK_TEMP].uTotalKb, 0);
+   system_metrics_set_disk_folder(SYSTEM_METRICS_DISK_TEMP, szDiskFolder);
+
+   // The sampler thread publishes to the shared memory; a reader sees the changes of the fake tree
+   _write_fake_tree();
+   if ( ! system_metrics_sampler_start(TEST_SHARED_MEM_NAME, 100) )
+   {
+      log_line("Failed to start the sampler <- FAILED");
+      s_iFailed = 1;
+   }
+   else
+   {
+      shared_mem_system_metrics* pShared = system_metrics_open_for_read(TEST_SHARED_MEM_NAME);
+      shared_mem_system_metrics snapshot;
+      memset(&snapshot, 0, sizeof(shared_mem_system_metrics));
+      if ( NULL == pShared || ! system_metrics_read_snapshot(pShared, &snapshot) )
+      {
+         log_line("Failed to read the shared memory snapshot <- FAILED");
+         s_iFailed = 1;
+      }
+      _check("Snapshot temperature C", snapshot.iTemperatureC, 48);
+      u32 uSamples = snapshot.uSamplesCount;
+
+      _write_file("/sys/class/thermal/thermal_zone0/temp", "71500\n");
+      _write_proc_stat(1500, 10500);
+      hardware_sleep_ms(350);
+      if ( NULL != pShared )
+         system_metrics_read_snapshot(pShared, &snapshot);
+      log_line("Samples published in 350 ms: %u", snapshot.uSamplesCount - uSamples);
+      if ( snapshot.uSamplesCount - uSamples < 2 )
+         s_iFailed = 1;
+      _check("Snapshot temperature C (updated)", snapshot.iTemperatureC, 71);
+      _check("Snapshot throttled", snapshot.uThrottled, 0x50005);
+
+      u32 uTimeStart = get_current_timestamp_ms();
+      system_metrics_sampler_stop();
+      u32 uStopTime = get_current_timestamp_ms() - uTimeStart;
+      log_line("Sampler stopped in %u ms", uStopTime);
+      if ( uStopTime > 50 )
+         s_iFailed = 1;
+      if ( NULL != pShared )
+         munmap(pShared, sizeof(shared_mem_system_metrics));
+   }
+   shm_unlink(TEST_SHARED_MEM_NAME);
+
+   char szComm[512];
+   snprintf(szComm, sizeof(szComm), "rm -rf %s", s_szFolder);
+   hw_execute_bash_command(szComm, NULL);
+
+   if ( s_iFailed )
+   {
+      log_line("Test FAILED");
+      return 1;
+   }
+   log_line("Test PASSED");
+   return 0;
+}
@@ -0,0 +1,517 @@
+#include "../base/base.h"
+#include "../base/config.h"
+#include "../base/hardware.h"
+#include "../common/mavlink_frames.h"
+#include "../common/telemetry_hub.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+// Telemetry hub test with local clients: several UDP clients (learned by the hub UDP server),
+// a TCP client that never reads and a serial port (a socket pair).
+// Checks that every client gets all the frames in order, that a stuck client only loses its own data,
+// the per client rate filter, and that the uplink frames of all clients reach the vehicle side whole.
+// Measures the downlink fan-out throughput.
+// Usage: test_telemetry_hub [-clients N] [-frames N] [-loops N]
+
+#define TEST_MAX_CLIENTS 12
+
+int s_iFailed = 0;
+int s_iLoops = 1;
+int s_iClients = 4;
+int s_iFrames = 5000;
+
+void _fail(const char* szText)
+{
+   log_line("%s <- FAILED", szText);
+   s_iFailed = 1;
+}
+
+// A local client socket and what it received
+
+typedef struct
+{
+   int iFd;
+   t_mavlink_frame_extractor extractor;
+   u32 uFrames;
+   u32 uLastCounter;
+   u32 uOutOfOrder;
+   u32 uAttitudes;
+   u32 uStatusTexts;
+   u32 uBytes;
+} t_test_client;
+
+t_test_client s_Clients[TEST_MAX_CLIENTS];
+
+void _on_client_frame(const u8* pFrame, int iFrameLength, u32 uMsgId, void* pContext)
+{
+   t_test_client* pClient = (t_test_client*)pContext;
+   pClient->uFrames++;
+   if ( uMsgId == MAVLINK_MSG_ID_STATUSTEXT )
+   {
+      pClient->uStatusTexts++;
+      return;
+   }
+   if ( uMsgId != MAVLINK_MSG_ID_ATTITUDE )
+      return;
+   mavlink_message_t msg;
+   mavlink_frames_to_message(pFrame, iFrameLength, &msg);
+   u32 uCounter = mavlink_msg_attitude_get_time_boot_ms(&msg);
+   if ( (pClient->uAttitudes > 0) && (uCounter <= pClient->uLastCounter) )
+      pClient->uOutOfOrder++;
+   pClient->uLastCounter = uCounter;
+   pClient->uAttitudes++;
+}
+
+void _client_init(t_test_client* pClient, int iFd)
+{
+   memset(pClient, 0, sizeof(t_test_client));
+   pClient->iFd = iFd;
+   mavlink_frames_init(&pClient->extractor);
+   mavlink_frames_set_default_handler(&pClient->extractor, _on_client_frame);
+   int iFlags = fcntl(iFd, F_GETFL, 0);
+   fcntl(iFd, F_SETFL, iFlags | O_NONBLOCK);
+   int iSize = 1024*1024;
+   setsockopt(iFd, SOL_SOCKET, SO_RCVBUF, &iSize, sizeof(iSize));
+}
+
+void _client_read(t_test_client* pClient)
+{
+   u8 uBuffer[4096];
+   int iRes = 0;
+   while ( (iRes = recv(pClient->iFd, uBuffer, sizeof(uBuffer), MSG_DONTWAIT)) > 0 )
+   {
+      pClient->uBytes += iRes;
+      mavlink_frames_parse(&pClient->extractor, uBuffer, iRes, pClient);
+   }
+}
+
+int _open_udp_client(int iHubPort)
+{
+   int iFd = socket(AF_INET, SOCK_DGRAM, 0);
+   struct sockaddr_in addr;
+   memset(&addr, 0, sizeof(addr));
+   addr.sin_family = AF_INET;
+   addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+   addr.sin_port = htons(iHubPort);
+   connect(iFd, (struct sockaddr*)&addr, sizeof(addr));
+   return iFd;
+}
+
+int _open_tcp_client(int iHubPort, int iReceiveBuffer)
+{
+   int iFd = socket(AF_INET, SOCK_STREAM, 0);
+   if ( iReceiveBuffer > 0 )
+      setsockopt(iFd, SOL_SOCKET, SO_RCVBUF, &iReceiveBuffer, sizeof(iReceiveBuffer));
+   struct sockaddr_in addr;
+   memset(&addr, 0, sizeof(addr));
+   addr.sin_family = AF_INET;
+   addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+   addr.sin_port = htons(iHubPort);
+   if ( connect(iFd, (struct sockaddr*)&addr, sizeof(addr)) < 0 )
+   {
+      close(iFd);
+      return -1;
+   }
+   return iFd;
+}
+
+int _pack_frame(u8* pBuffer, mavlink_message_t* pMsg)
+{
+   return mavlink_msg_to_send_buffer(pBuffer, pMsg);
+}
+
+int _pack_attitude(u8* pBuffer, u32 uCounter)
+{
+   mavlink_message_t msg;
+   mavlink_msg_attitude_pack(1, 1, &msg, uCounter, 0.1f, 0.2f, 0.3f, 0.01f, 0.02f, 0.03f);
+   return _pack_frame(pBuffer, &msg);
+}
+
+int _pack_heartbeat(u8* pBuffer, u8 uSysId)
+{
+   mavlink_message_t msg;
+   mavlink_msg_heartbeat_pack(uSysId, 190, &msg, MAV_TYPE_GCS, MAV_AUTOPILOT_INVALID, 0, 0, MAV_STATE_ACTIVE);
+   return _pack_frame(pBuffer, &msg);
+}
+
+// Uplink frames seen on the vehicle side
+
+typedef struct
+{
+   u32 uFrames;
+   u32 uBadFrames;
+   u32 uLastSeq;
+   u32 uOutOfOrder;
+} t_test_uplink;
+
+t_test_uplink s_Uplink[TELEMETRY_HUB_MAX_CLIENTS];
+
+void _on_uplink(const u8* pData, int iLength, int iClientId, void* pContext)
+{
+   if ( (iClientId < 0) || (iClientId >= TELEMETRY_HUB_MAX_CLIENTS) )
+      return;
+   t_test_uplink* pUp = &(s_Uplink[iClientId]);
+   u32 uMsgId = 0;
+   if ( (mavlink_frames_check_frame(pData, iLength, &uMsgId) != iLength) || (uMsgId != MAVLINK_MSG_ID_COMMAND_LONG) )
+   {
+      pUp->uBadFrames++;
+      return;
+   }
+   mavlink_message_t msg;
+   mavlink_frames_to_message(pData, iLength, &msg);
+   u32 uSeq = (u32)mavlink_msg_command_long_get_param1(&msg);
+   if ( (pUp->uFrames > 0) && (uSeq != pUp->uLastSeq + 1) )
+      pUp->uOutOfOrder++;
+   pUp->uLastSeq = uSeq;
+   pUp->uFrames++;
+}
+
+t_telemetry_hub s_Hub;
+
+// Polls the hub until the expected count of clients is registered
+int _wait_clients(int iCount)
+{
+   for( int i=0; i<200; i++ )
+   {
+      telemetry_hub_poll(&s_Hub, 1000, get_current_timestamp_ms());
+      if ( telemetry_hub_get_clients_count(&s_Hub) >= iCount )
+         return 1;
+   }
+   return 0;
+}
+
+void _test_udp_fan_out(int iClients)
+{
+   log_line("UDP fan-out to %d clients, %d frames...", iClients, s_iFrames);
+   telemetry_hub_init(&s_Hub, _on_uplink, NULL);
+   telemetry_hub_set_mavlink(&s_Hub, 1);
+   if ( ! telemetry_hub_listen_udp(&s_Hub, 0) )
+   {
+      _fail("Listen UDP");
+      return;
+   }
+   u8 uFrame[MAVLINK_MAX_PACKET_LEN];
+   for( int i=0; i<iClients; i++ )
+   {
+      _client_init(&s_Clients[i], _open_udp_client(s_Hub.iUDPServerPort));
+      int iLen = _pack_heartbeat(uFrame, 255-i);
+      send(s_Clients[i].iFd, uFrame, iLen, 0);
+   }
+   if ( ! _wait_clients(iClients) )
+      _fail("UDP clients registered");
+
+   // Frames come in bursts, as from the radio; the clients read between bursts
+   u32 uTimeStart = get_current_timestamp_ms();
+   unsigned long long uHubMicros = 0;
+   u32 uBytes = 0;
+   for( int i=0; i<s_iFrames; )
+   {
+      unsigned long long uStart = get_current_timestamp_micros();
+      for( int k=0; (k<20) && (i<s_iFrames); k++, i++ )
+      {
+         int iLen = _pack_attitude(uFrame, i+1);
+         // Frames cut at random points, as in the raw telemetry segments
+         int iCut = rand() % iLen;
+         telemetry_hub_send(&s_Hub, uFrame, iCut, get_current_timestamp_ms());
+         telemetry_hub_send(&s_Hub, uFrame + iCut, iLen - iCut, get_current_timestamp_ms());
+         uBytes += iLen;
+      }
+      telemetry_hub_flush(&s_Hub, get_current_timestamp_ms());
+      uHubMicros += get_current_timestamp_micros() - uStart;
+      for( int c=0; c<iClients; c++ )
+         _client_read(&s_Clients[c]);
+   }
+   for( int k=0; k<50; k++ )
+   {
+      telemetry_hub_flush(&s_Hub, get_current_timestamp_ms());
+      for( int c=0; c<iClients; c++ )
+         _client_read(&s_Clients[c]);
+      hardware_sleep_ms(1);
+   }
+   u32 uTime = get_current_timestamp_ms() - uTimeStart;
+   log_line("Fan-out: %u bytes to %d clients, hub time: %llu us (%.1f MB/s delivered), total %u ms",
+      uBytes, iClients, uHubMicros, (uHubMicros > 0)?((double)uBytes*iClients/uHubMicros):0.0, uTime);
+
+   for( int c=0; c<iClients; c++ )
+   {
+      t_test_client* pClient = &(s_Clients[c]);
+      if ( (pClient->uAttitudes != (u32)s_iFrames) || (pClient->uOutOfOrder > 0) || (pClient->extractor.uBytesDiscarded > 0) )
+      {
+         log_line("Client %d: %u frames of %d, out of order: %u, discarded bytes: %u", c, pClient->uAttitudes, s_iFrames, pClient->uOutOfOrder, pClient->extractor.uBytesDiscarded);
+         _fail("UDP client frames");
+      }
+   }
+   // Fairness: all got the same bytes
+   for( int c=1; c<iClients; c++ )
+   {
+      if ( s_Clients[c].uBytes != s_Clients[0].uBytes )
+         _fail("UDP clients got different data");
+   }
+   telemetry_hub_log_stats(&s_Hub);
+   for( int c=0; c<iClients; c++ )
+      close(s_Clients[c].iFd);
+   telemetry_hub_close(&s_Hub);
+}
+
+void _test_stuck_client()
+{
+   log_line("Stuck TCP client and serial port...");
+   telemetry_hub_init(&s_Hub, _on_uplink, NULL);
+   telemetry_hub_set_mavlink(&s_Hub, 1);
+   if ( (! telemetry_hub_listen_udp(&s_Hub, 0)) || (! telemetry_hub_listen_tcp(&s_Hub, 0)) )
+   {
+      _fail("Listen");
+      return;
+   }
+   u8 uFrame[MAVLINK_MAX_PACKET_LEN];
+   _client_init(&s_Clients[0], _open_udp_client(s_Hub.iUDPServerPort));
+   int iLen = _pack_heartbeat(uFrame, 255);
+   send(s_Clients[0].iFd, uFrame, iLen, 0);
+
+   // The TCP client never reads
+   int iStuckFd = _open_tcp_client(s_Hub.iTCPServerPort, 4096);
+
+   // Serial port: downlink only
+   int iSerial[2];
+   socketpair(AF_UNIX, SOCK_STREAM, 0, iSerial);
+   _client_init(&s_Clients[1], iSerial[1]);
+   int iSerialClient = telemetry_hub_add_serial(&s_Hub, iSerial[0], TELEMETRY_HUB_FLAG_DOWNLINK, "serial");
+
+   if ( ! _wait_clients(3) )
+      _fail("Clients registered");
+
+   int iFrames = s_iFrames * 4;
+   u32 uMaxCallMicros = 0;
+   for( int i=0; i<iFrames; )
+   {
+      unsigned long long uStart = get_current_timestamp_micros();
+      for( int k=0; (k<20) && (i<iFrames); k++, i++ )
+      {
+         iLen = _pack_attitude(uFrame, i+1);
+         telemetry_hub_send(&s_Hub, uFrame, iLen, get_current_timestamp_ms());
+      }
+      telemetry_hub_flush(&s_Hub, get_current_timestamp_ms());
+      u32 uMicros = (u32)(get_current_timestamp_micros() - uStart);
+      if ( uMicros > uMaxCallMicros )
+         uMaxCallMicros = uMicros;
+      _client_read(&s_Clients[0]);
+      _client_read(&s_Clients[1]);
+   }
+   for( int k=0; k<50; k++ )
+   {
+      telemetry_hub_flush(&s_Hub, get_current_timestamp_ms());
+      _client_read(&s_Clients[0]);
+      _client_read(&s_Clients[1]);
+      hardware_sleep_ms(1);
+   }
+
+   int iStuckId = -1;
+   for( int i=0; i<TELEMETRY_HUB_MAX_CLIENTS; i++ )
+   {
+      if ( s_Hub.clients[i].bUsed && (s_Hub.clients[i].iType == TELEMETRY_HUB_CLIENT_TCP) )
+         iStuckId = i;
+   }
+   telemetry_hub_log_stats(&s_Hub);
+   log_line("Max send+flush time: %u us", uMaxCallMicros);
+
+   if ( (iStuckId < 0) || (0 == s_Hub.clients[iStuckId].stats.uBytesDropped) || (0 == s_Hub.clients[iStuckId].stats.uWritesBlocked) )
+      _fail("Stuck client data dropped");
+   if ( (s_Clients[0].uAttitudes != (u32)iFrames) || (s_Clients[0].uOutOfOrder > 0) )
+      _fail("UDP client with a stuck client");
+   if ( (s_Clients[1].uAttitudes != (u32)iFrames) || (s_Clients[1].uOutOfOrder > 0) )
+      _fail("Serial client with a stuck client");
+
+   // Data from a downlink only client is not routed
+   memset(s_Uplink, 0, sizeof(s_Uplink));
+   send(iSerial[1], uFrame, iLen, 0);
+   for( int k=0; k<5; k++ )
+      telemetry_hub_poll(&s_Hub, 1000, get_current_timestamp_ms());
+   if ( (s_Uplink[iSerialClient].uFrames > 0) || (s_Uplink[iSerialClient].uBadFrames > 0) )
+      _fail("Downlink only client routed to uplink");
+
+   // The stuck client goes away
+   if ( iStuckFd >= 0 )
+      close(iStuckFd);
+   for( int k=0; k<20; k++ )
+   {
+      telemetry_hub_poll(&s_Hub, 1000, get_current_timestamp_ms());
+      telemetry_hub_flush(&s_Hub, get_current_timestamp_ms());
+   }
+   if ( (iStuckId >= 0) && s_Hub.clients[iStuckId].bUsed )
+      _fail("Disconnected TCP client removed");
+
+   telemetry_hub_remove_client(&s_Hub, iSerialClient);
+   close(iSerial[0]);
+   close(iSerial[1]);
+   close(s_Clients[0].iFd);
+   telemetry_hub_close(&s_Hub);
+}
+
+void _test_rate_filter()
+{
+   log_line("Rate filter...");
+   telemetry_hub_init(&s_Hub, _on_uplink, NULL);
+   telemetry_hub_set_mavlink(&s_Hub, 1);
+   int iPair[2][2];
+   int iIds[2];
+   for( int i=0; i<2; i++ )
+   {
+      socketpair(AF_UNIX, SOCK_STREAM, 0, iPair[i]);
+      _client_init(&s_Clients[i], iPair[i][1]);
+      iIds[i] = telemetry_hub_add_serial(&s_Hub, iPair[i][0], TELEMETRY_HUB_FLAG_DOWNLINK, (0 == i)?"all":"5 Hz");
+   }
+   telemetry_hub_set_client_rate_filter(&s_Hub, iIds[1], 5);
+
+   // 2 seconds: attitude at 50 Hz, a status text every 100 ms
+   u8 uFrame[MAVLINK_MAX_PACKET_LEN];
+   u32 uStatusTexts = 0;
+   for( u32 uTime=0; uTime<2000; uTime += 20 )
+   {
+      int iLen = _pack_attitude(uFrame, uTime+1);
+      telemetry_hub_send(&s_Hub, uFrame, iLen, uTime);
+      if ( 0 == (uTime % 100) )
+      {
+         mavlink_message_t msg;
+         char szText[MAVLINK_MSG_STATUSTEXT_FIELD_TEXT_LEN];
+         memset(szText, 0, sizeof(szText));
+         strcpy(szText, "Test message");
+         mavlink_msg_statustext_pack(1, 1, &msg, MAV_SEVERITY_INFO, szText);
+         iLen = _pack_frame(uFrame, &msg);
+         telemetry_hub_send(&s_Hub, uFrame, iLen, uTime);
+         uStatusTexts++;
+      }
+      telemetry_hub_flush(&s_Hub, uTime);
+      _client_read(&s_Clients[0]);
+      _client_read(&s_Clients[1]);
+   }
+   log_line("Rate filter: attitudes: %u (all) / %u (5 Hz), status texts: %u / %u of %u",
+      s_Clients[0].uAttitudes, s_Clients[1].uAttitudes, s_Clients[0].uStatusTexts, s_Clients[1].uStatusTexts, uStatusTexts);
+   if ( s_Clients[0].uAttitudes != 100 )
+      _fail("Unfiltered client");
+   if ( (s_Clients[1].uAttitudes < 9) || (s_Clients[1].uAttitudes > 11) )
+      _fail("Filtered client stream rate");
+   if ( (s_Clients[0].uStatusTexts != uStatusTexts) || (s_Clients[1].uStatusTexts != uStatusTexts) )
+      _fail("Transactional messages filtered");
+
+   for( int i=0; i<2; i++ )
+   {
+      telemetry_hub_remove_client(&s_Hub, iIds[i]);
+      close(iPair[i][0]);
+      close(iPair[i][1]);
+   }
+   telemetry_hub_close(&s_Hub);
+}
+
+void _test_uplink(int iClients)
+{
+   log_line("Uplink from %d UDP clients and a TCP client...", iClients);
+   memset(s_Uplink, 0, sizeof(s_Uplink));
+   telemetry_hub_init(&s_Hub, _on_uplink, NULL);
+   telemetry_hub_set_mavlink(&s_Hub, 1);
+   if ( (! telemetry_hub_listen_udp(&s_Hub, 0)) || (! telemetry_hub_listen_tcp(&s_Hub, 0)) )
+   {
+      _fail("Listen");
+      return;
+   }
+   int iFds[TEST_MAX_CLIENTS+1];
+   for( int i=0; i<iClients; i++ )
+      iFds[i] = _open_udp_client(s_Hub.iUDPServerPort);
+   iFds[iClients] = _open_tcp_client(s_Hub.iTCPServerPort, 0);
+
+   // Each client sends its own sequence; the TCP one in odd sized chunks that split the frames
+   int iFrames = 300;
+   u8 uFrame[MAVLINK_MAX_PACKET_LEN];
+   u8 uTCPBuffer[MAVLINK_MAX_PACKET_LEN*4];
+   int iTCPBytes = 0;
+   for( int f=0; f<iFrames; f++ )
+   {
+      for( int c=0; c<=iClients; c++ )
+      {
+         mavlink_message_t msg;
+         mavlink_msg_command_long_pack(200+c, 190, &msg, 1, 1, MAV_CMD_DO_SET_MODE, 0, (float)f, 0, 0, 0, 0, 0, 0);
+         int iLen = _pack_frame(uFrame, &msg);
+         if ( c < iClients )
+         {
+            send(iFds[c], uFrame, iLen, 0);
+            continue;
+         }
+         memcpy(uTCPBuffer + iTCPBytes, uFrame, iLen);
+         iTCPBytes += iLen;
+         // Leaves a random tail (a partial frame) for the next send
+         int iChunk = iTCPBytes - rand() % 30;
+         if ( iChunk <= 0 )
+            continue;
+         send(iFds[c], uTCPBuffer, iChunk, 0);
+         memmove(uTCPBuffer, uTCPBuffer + iChunk, iTCPBytes - iChunk);
+         iTCPBytes -= iChunk;
+      }
+      telemetry_hub_poll(&s_Hub, 0, get_current_timestamp_ms());
+   }
+   if ( iTCPBytes > 0 )
+      send(iFds[iClients], uTCPBuffer, iTCPBytes, 0);
+   for( int k=0; k<100; k++ )
+      telemetry_hub_poll(&s_Hub, 1000, get_current_timestamp_ms());
+
+   int iFound = 0;
+   for( int i=0; i<TELEMETRY_HUB_MAX_CLIENTS; i++ )
+   {
+      if ( ! s_Hub.clients[i].bUsed )
+         continue;
+      iFound++;
+      t_test_uplink* pUp = &(s_Uplink[i]);
+      log_line("Uplink client %d (%s): %u frames, bad: %u, out of order: %u", i, s_Hub.clients[i].szName, pUp->uFrames, pUp->uBadFrames, pUp->uOutOfOrder);
+      if ( (pUp->uFrames != (u32)iFrames) || (pUp->uBadFrames > 0) || (pUp->uOutOfOrder > 0) )
+         _fail("Uplink frames");
+   }
+   if ( iFound != iClients + 1 )
+      _fail("Uplink clients");
+
+   for( int i=0; i<=iClients; i++ )
+      close(iFds[i]);
+   telemetry_hub_close(&s_Hub);
+}
+
+int main(int argc, char *argv[])
+{
+   log_init_local_only("TestTelemetryHub");
+   log_enable_stdout();
+
+   for( int i=1; i<argc; i++ )
+   {
+      if ( 0 == strcmp(argv[i], "-clients") && i < argc-1 )
+         s_iClients = atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-frames") && i < argc-1 )
+         s_iFrames = atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-loops") && i < argc-1 )
+         s_iLoops = atoi(argv[++i]);
+   }
+   if ( s_iLoops < 1 )
+      s_iLoops = 1;
+   if ( s_iClients < 1 )
+      s_iClients = 1;
+   if ( s_iClients > TEST_MAX_CLIENTS )
+      s_iClients = TEST_MAX_CLIENTS;
+   if ( s_iFrames < 100 )
+      s_iFrames = 100;
+
+   for( int i=0; i<s_iLoops; i++ )
+   {
+      _test_udp_fan_out(s_iClients);
+      _test_stuck_client();
+      _test_rate_filter();
+      _test_uplink(s_iClients);
+   }
+
+   if ( s_iFailed )
+   {
+      log_line("Test FAILED");
+      return 1;
+   }
+   log_line("Test PASSED");
+   return 0;
+}
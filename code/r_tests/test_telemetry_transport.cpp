@@ -0,0 +1,780 @@
+#include "../base/base.h"
+#include "../base/config.h"
+#include "../common/mavlink_frames.h"
+#include "../common/telemetry_transport.h"
+
+// Loopback test of the MAVLink telemetry transport (vehicle and controller endpoints over a lossy simulated link),
+// compared with the raw telemetry segments path (fixed size chunks of the serial stream, lost chunks lost).
+// Measures the frames delivered (stream and transactional), their latency and the airtime used.
+// Usage: test_telemetry_transport [mavlink_log.tlog|captured_mavlink_stream.bin] [-loss N] [-rate N] [-serial N] [-loops N]
+//   -loss: radio packets lost in each direction, percent; -rate: transport rate budget, bytes/sec;
+//   -serial: serial speed used to time a raw captured stream (a .tlog has its own timestamps)
+// With no log file, a synthetic flight is used: telemetry streams down, a parameters download,
+// a mission upload, commands and status texts, GCS heartbeats and RC overrides up.
+
+#define TEST_LINK_DELAY_MS 5
+#define TEST_LINK_MAX_PACKETS 256
+#define TEST_RAW_SEGMENT_SIZE 300 // as the vehicle and controller raw telemetry buffers
+#define TEST_RAW_SEND_LENGTH RAW_TELEMETRY_MIN_SEND_LENGTH
+#define TEST_RAW_SEND_TIMEOUT_MS RAW_TELEMETRY_SEND_TIMEOUT
+
+#define TEST_DIRECTION_DOWN 0
+#define TEST_DIRECTION_UP 1
+
+int s_iFailed = 0;
+int s_iLoops = 1;
+int s_iLoss = -1;
+u32 s_uRate = TELEMETRY_TRANSPORT_DEFAULT_RATE;
+u32 s_uSerialSpeed = 57600;
+
+// Source frames, sorted by time
+
+typedef struct
+{
+   u32 uTime;
+   int iDirection;
+   int bTransactional;
+   u32 uHash;
+   int iOffset; // in s_pFramesData
+   int iLength;
+   int bDelivered;
+} t_test_frame;
+
+t_test_frame* s_pFrames = NULL;
+int s_iFramesCount = 0;
+int s_iFramesMax = 0;
+u8* s_pFramesData = NULL;
+int s_iFramesDataLength = 0;
+int s_iFramesDataMax = 0;
+
+void _fail(const char* szText)
+{
+   log_line("%s <- FAILED", szText);
+   s_iFailed = 1;
+}
+
+u32 _hash(const u8* pData, int iLength)
+{
+   u32 uHash = 2166136261u;
+   for( int i=0; i<iLength; i++ )
+      uHash = (uHash ^ pData[i]) * 16777619u;
+   return uHash;
+}
+
+void _add_source_frame(u32 uTime, int iDirection, const u8* pFrame, int iLength)
+{
+   if ( s_iFramesCount >= s_iFramesMax )
+   {
+      s_iFramesMax = (s_iFramesMax > 0)?(2*s_iFramesMax):4096;
+      s_pFrames = (t_test_frame*)realloc(s_pFrames, s_iFramesMax*sizeof(t_test_frame));
+   }
+   if ( s_iFramesDataLength + iLength > s_iFramesDataMax )
+   {
+      s_iFramesDataMax = (s_iFramesDataMax > 0)?(2*s_iFramesDataMax):(256*1024);
+      s_pFramesData = (u8*)realloc(s_pFramesData, s_iFramesDataMax);
+   }
+   u32 uMsgId = 0;
+   if ( pFrame[0] == MAVLINK_STX )
+      uMsgId = ((u32)pFrame[7]) | (((u32)pFrame[8])<<8) | (((u32)pFrame[9])<<16);
+   else
+      uMsgId = pFrame[5];
+
+   t_test_frame* pTF = &(s_pFrames[s_iFramesCount]);
+   pTF->uTime = uTime;
+   pTF->iDirection = iDirection;
+   pTF->bTransactional = (telemetry_transport_get_message_class(uMsgId) == TELEMETRY_TRANSPORT_CLASS_TRANSACTIONAL);
+   pTF->uHash = _hash(pFrame, iLength);
+   pTF->iOffset = s_iFramesDataLength;
+   pTF->iLength = iLength;
+   pTF->bDelivered = 0;
+   memcpy(s_pFramesData + s_iFramesDataLength, pFrame, iLength);
+   s_iFramesDataLength += iLength;
+   s_iFramesCount++;
+}
+
+void _add_source_message(u32 uTime, int iDirection, mavlink_message_t* pMsg)
+{
+   u8 buffer[MAVLINK_MAX_PACKET_LEN];
+   int iLen = mavlink_msg_to_send_buffer(buffer, pMsg);
+   _add_source_frame(uTime, iDirection, buffer, iLen);
+}
+
+int _compare_frames(const void* pA, const void* pB)
+{
+   const t_test_frame* pFA = (const t_test_frame*)pA;
+   const t_test_frame* pFB = (const t_test_frame*)pB;
+   if ( pFA->uTime != pFB->uTime )
+      return (pFA->uTime < pFB->uTime)?-1:1;
+   return (pFA->iOffset < pFB->iOffset)?-1:1;
+}
+
+void _generate_flight(u32 uDurationMs)
+{
+   mavlink_message_t msg;
+   for( u32 t=0; t<uDurationMs; t++ )
+   {
+      // Downlink streams
+      if ( (t % 1000) == 0 )
+         mavlink_msg_heartbeat_pack(1, 1, &msg, MAV_TYPE_QUADROTOR, MAV_AUTOPILOT_ARDUPILOTMEGA, 0, 5, MAV_STATE_ACTIVE), _add_source_message(t, TEST_DIRECTION_DOWN, &msg);
+      if ( (t % 40) == 0 )
+         mavlink_msg_attitude_pack(1, 1, &msg, t, 0.1f, 0.2f, 0.3f, 0.01f, 0.02f, 0.03f), _add_source_message(t, TEST_DIRECTION_DOWN, &msg);
+      if ( (t % 100) == 10 )
+         mavlink_msg_global_position_int_pack(1, 1, &msg, t, 450000000, 250000000, 100000, 50000, 10, 20, 30, 9000), _add_source_message(t, TEST_DIRECTION_DOWN, &msg);
+      if ( (t % 100) == 20 )
+         mavlink_msg_vfr_hud_pack(1, 1, &msg, 12.0f, 13.0f, 90, 50, (float)t, 1.0f), _add_source_message(t, TEST_DIRECTION_DOWN, &msg);
+      if ( (t % 100) == 30 )
+         mavlink_msg_raw_imu_pack(1, 1, &msg, t, 1, 2, 3, 4, 5, 6, 7, 8, 9), _add_source_message(t, TEST_DIRECTION_DOWN, &msg);
+      if ( (t % 100) == 50 )
+         mavlink_msg_servo_output_raw_pack(1, 1, &msg, t, 0, 1500, 1500, 1500, 1500, 1000, 1000, 1000, 1000, 0, 0, 0, 0, 0, 0, 0, 0), _add_source_message(t, TEST_DIRECTION_DOWN, &msg);
+      if ( (t % 500) == 70 )
+         mavlink_msg_sys_status_pack(1, 1, &msg, 0, 0, 0, 500, 12000, t % 3000, 80, 0, 0, 0, 0, 0, 0), _add_source_message(t, TEST_DIRECTION_DOWN, &msg);
+
+      // Uplink streams: GCS heartbeat and RC overrides
+      if ( (t % 1000) == 500 )
+         mavlink_msg_heartbeat_pack(255, 190, &msg, MAV_TYPE_GCS, MAV_AUTOPILOT_INVALID, 0, 0, MAV_STATE_ACTIVE), _add_source_message(t, TEST_DIRECTION_UP, &msg);
+      if ( (t % 50) == 5 )
+      {
+         mavlink_rc_channels_override_t rc;
+         memset(&rc, 0, sizeof(rc));
+         rc.target_system = 1;
+         rc.target_component = 1;
+         rc.chan1_raw = 1000 + (t/50) % 1000;
+         rc.chan2_raw = 1000 + (t/50000);
+         mavlink_msg_rc_channels_override_encode(255, 190, &msg, &rc);
+         _add_source_message(t, TEST_DIRECTION_UP, &msg);
+      }
+
+      // Parameters download: request up, 300 values down
+      if ( t == 2000 )
+      {
+         mavlink_param_request_list_t req;
+         memset(&req, 0, sizeof(req));
+         req.target_system = 1;
+         mavlink_msg_param_request_list_encode(255, 190, &msg, &req);
+         _add_source_message(t, TEST_DIRECTION_UP, &msg);
+      }
+      if ( (t >= 2050) && (t < 2050 + 300*10) && ((t % 10) == 0) )
+      {
+         mavlink_param_value_t param;
+         memset(&param, 0, sizeof(param));
+         snprintf(param.param_id, sizeof(param.param_id), "PARAM_%d", (int)(t-2050)/10);
+         param.param_value = (float)t;
+         param.param_count = 300;
+         param.param_index = (t-2050)/10;
+         param.param_type = MAV_PARAM_TYPE_REAL32;
+         mavlink_msg_param_value_encode(1, 1, &msg, &param);
+         _add_source_message(t, TEST_DIRECTION_DOWN, &msg);
+      }
+
+      // Mission upload: items up, requests and the final ack down
+      if ( (t >= 8000) && (t < 8000 + 60*30) && ((t % 30) == 0) )
+      {
+         int iSeq = (t-8000)/30;
+         mavlink_mission_request_int_t request;
+         memset(&request, 0, sizeof(request));
+         request.target_system = 255;
+         request.target_component = 190;
+         request.seq = iSeq;
+         mavlink_msg_mission_request_int_encode(1, 1, &msg, &request);
+         _add_source_message(t, TEST_DIRECTION_DOWN, &msg);
+
+         mavlink_mission_item_int_t item;
+         memset(&item, 0, sizeof(item));
+         item.target_system = 1;
+         item.target_component = 1;
+         item.seq = iSeq;
+         item.command = MAV_CMD_NAV_WAYPOINT;
+         item.x = 450000000 + iSeq*100;
+         item.y = 250000000 + iSeq*100;
+         item.z = 50.0f;
+         mavlink_msg_mission_item_int_encode(255, 190, &msg, &item);
+         _add_source_message(t+5, TEST_DIRECTION_UP, &msg);
+      }
+      if ( t == 8000 + 60*30 )
+      {
+         mavlink_mission_ack_t ack;
+         memset(&ack, 0, sizeof(ack));
+         ack.target_system = 255;
+         ack.target_component = 190;
+         mavlink_msg_mission_ack_encode(1, 1, &msg, &ack);
+         _add_source_message(t, TEST_DIRECTION_DOWN, &msg);
+      }
+
+      // Commands up and their acks down, status texts down
+      if ( (t % 2000) == 1000 )
+      {
+         mavlink_command_long_t command;
+         memset(&command, 0, sizeof(command));
+         command.target_system = 1;
+         command.command = MAV_CMD_DO_SET_MODE;
+         command.param1 = (float)t;
+         mavlink_msg_command_long_encode(255, 190, &msg, &command);
+         _add_source_message(t, TEST_DIRECTION_UP, &msg);
+
+         mavlink_command_ack_t ack;
+         memset(&ack, 0, sizeof(ack));
+         ack.command = MAV_CMD_DO_SET_MODE;
+         ack.progress = (t/2000) % 100;
+         mavlink_msg_command_ack_encode(1, 1, &msg, &ack);
+         _add_source_message(t+30, TEST_DIRECTION_DOWN, &msg);
+      }
+      if ( (t % 3000) == 1500 )
+      {
+         char szText[50];
+         snprintf(szText, sizeof(szText), "Status at %u ms", t);
+         mavlink_msg_statustext_pack(1, 1, &msg, MAV_SEVERITY_INFO, szText);
+         _add_source_message(t, TEST_DIRECTION_DOWN, &msg);
+      }
+   }
+}
+
+// Loads a log as the downlink. A .tlog has a 8 bytes big endian microseconds timestamp before each frame;
+// a raw captured stream is timed by the serial speed.
+bool _load_log(const char* szFile)
+{
+   FILE* fd = fopen(szFile, "rb");
+   if ( NULL == fd )
+      return false;
+   fseek(fd, 0, SEEK_END);
+   long lSize = ftell(fd);
+   fseek(fd, 0, SEEK_SET);
+   if ( lSize <= 0 )
+   {
+      fclose(fd);
+      return false;
+   }
+   u8* pData = (u8*)malloc(lSize);
+   int iLength = fread(pData, 1, lSize, fd);
+   fclose(fd);
+
+   bool bTLog = (strlen(szFile) > 5) && (0 == strcmp(szFile + strlen(szFile) - 5, ".tlog"));
+   unsigned long long uTimeFirst = 0;
+   int iPos = 0;
+   while ( iPos < iLength )
+   {
+      u32 uTime = (u32)((unsigned long long)iPos * 10 * 1000 / s_uSerialSpeed);
+      if ( bTLog )
+      {
+         if ( iPos + 8 > iLength )
+            break;
+         unsigned long long uStamp = 0;
+         for( int i=0; i<8; i++ )
+            uStamp = (uStamp << 8) | pData[iPos+i];
+         if ( 0 == uTimeFirst )
+            uTimeFirst = uStamp;
+         uTime = (u32)((uStamp - uTimeFirst)/1000);
+         iPos += 8;
+      }
+      int iRes = mavlink_frames_check_frame(pData + iPos, iLength - iPos, NULL);
+      if ( -2 == iRes )
+      {
+         // Not in the common dialect: take it by its header length
+         if ( pData[iPos] == MAVLINK_STX && iPos + 10 <= iLength )
+            iRes = 12 + pData[iPos+1] + ((pData[iPos+2] & MAVLINK_IFLAG_SIGNED)?MAVLINK_SIGNATURE_BLOCK_LEN:0);
+         else if ( iPos + 6 <= iLength )
+            iRes = 8 + pData[iPos+1];
+         if ( iPos + iRes > iLength )
+            iRes = 0;
+      }
+      if ( 0 == iRes )
+         break;
+      if ( iRes < 0 )
+      {
+         if ( bTLog )
+            break; // lost the records alignment
+         iPos++;
+         continue;
+      }
+      _add_source_frame(uTime, TEST_DIRECTION_DOWN, pData + iPos, iRes);
+      iPos += iRes;
+   }
+   free(pData);
+   return s_iFramesCount > 0;
+}
+
+// Delivery matching and stats
+
+typedef struct
+{
+   u32 uFrames[2];
+   u32 uDelivered[2];
+   unsigned long long uLatencyTotal[2];
+   u32 uLatencyMax[2];
+   u32 uOutOfOrder; // transactional frames delivered after a later one
+   u32 uUnknown; // delivered frames that were never sent (corrupted)
+   u32 uAirtimeBytes[2];
+   u32 uPackets[2];
+   u32 uDuration;
+} t_test_results;
+
+t_test_results s_Results;
+u32 s_uTimeNow = 0;
+int s_iMatchStart[2] = {0, 0};
+int s_iLastTransactional[2] = {-1, -1};
+
+void _reset_delivery()
+{
+   memset(&s_Results, 0, sizeof(s_Results));
+   for( int i=0; i<s_iFramesCount; i++ )
+   {
+      s_pFrames[i].bDelivered = 0;
+      s_Results.uFrames[s_pFrames[i].bTransactional]++;
+   }
+   s_iMatchStart[0] = s_iMatchStart[1] = 0;
+   s_iLastTransactional[0] = s_iLastTransactional[1] = -1;
+}
+
+void _on_frame_delivered(int iDirection, const u8* pFrame, int iLength)
+{
+   u32 uHash = _hash(pFrame, iLength);
+   while ( (s_iMatchStart[iDirection] < s_iFramesCount) &&
+           ((s_pFrames[s_iMatchStart[iDirection]].iDirection != iDirection) || s_pFrames[s_iMatchStart[iDirection]].bDelivered ||
+            (s_pFrames[s_iMatchStart[iDirection]].uTime + 10000 < s_uTimeNow)) )
+      s_iMatchStart[iDirection]++;
+
+   for( int i=s_iMatchStart[iDirection]; i<s_iFramesCount; i++ )
+   {
+      t_test_frame* pTF = &(s_pFrames[i]);
+      if ( pTF->uTime > s_uTimeNow )
+         break;
+      if ( (pTF->iDirection != iDirection) || pTF->bDelivered || (pTF->uHash != uHash) || (pTF->iLength != iLength) )
+         continue;
+      if ( 0 != memcmp(s_pFramesData + pTF->iOffset, pFrame, iLength) )
+         continue;
+      pTF->bDelivered = 1;
+      int iClass = pTF->bTransactional;
+      u32 uLatency = s_uTimeNow - pTF->uTime;
+      s_Results.uDelivered[iClass]++;
+      s_Results.uLatencyTotal[iClass] += uLatency;
+      if ( uLatency > s_Results.uLatencyMax[iClass] )
+         s_Results.uLatencyMax[iClass] = uLatency;
+      if ( iClass )
+      {
+         if ( i < s_iLastTransactional[iDirection] )
+            s_Results.uOutOfOrder++;
+         s_iLastTransactional[iDirection] = i;
+      }
+      return;
+   }
+   s_Results.uUnknown++;
+}
+
+void _log_results(const char* szName, int iLoss)
+{
+   for( int iClass=0; iClass<2; iClass++ )
+   {
+      u32 uCount = s_Results.uDelivered[iClass];
+      log_line("%s, loss %d%%: %s frames delivered: %u of %u (%.1f%%), latency avg: %u ms, max: %u ms", szName, iLoss,
+         iClass?"transactional":"stream", uCount, s_Results.uFrames[iClass],
+         (s_Results.uFrames[iClass] > 0)?(100.0*uCount/s_Results.uFrames[iClass]):100.0,
+         (uCount > 0)?(u32)(s_Results.uLatencyTotal[iClass]/uCount):0, s_Results.uLatencyMax[iClass]);
+   }
+   log_line("%s, loss %d%%: airtime down: %u bytes in %u packets, up: %u bytes in %u packets (%u bytes/sec total), out of order: %u, corrupted: %u",
+      szName, iLoss, s_Results.uAirtimeBytes[0], s_Results.uPackets[0], s_Results.uAirtimeBytes[1], s_Results.uPackets[1],
+      (s_Results.uDuration > 0)?(u32)((unsigned long long)(s_Results.uAirtimeBytes[0] + s_Results.uAirtimeBytes[1])*1000/s_Results.uDuration):0,
+      s_Results.uOutOfOrder, s_Results.uUnknown);
+}
+
+// Simulated radio link, one per direction: fixed delay, random loss
+
+typedef struct
+{
+   u8  uData[TEST_LINK_MAX_PACKETS][TELEMETRY_TRANSPORT_MAX_PAYLOAD+20];
+   int iLength[TEST_LINK_MAX_PACKETS];
+   u32 uArrival[TEST_LINK_MAX_PACKETS];
+   int iStart;
+   int iCount;
+} t_test_link;
+
+t_test_link s_Links[2];
+
+void _link_send(int iDirection, const u8* pData, int iLength, int iLoss)
+{
+   s_Results.uAirtimeBytes[iDirection] += iLength + sizeof(t_packet_header);
+   s_Results.uPackets[iDirection]++;
+   if ( (rand() % 100) < iLoss )
+      return;
+   t_test_link* pLink = &(s_Links[iDirection]);
+   if ( pLink->iCount >= TEST_LINK_MAX_PACKETS )
+      return;
+   int iIndex = (pLink->iStart + pLink->iCount) % TEST_LINK_MAX_PACKETS;
+   memcpy(pLink->uData[iIndex], pData, iLength);
+   pLink->iLength[iIndex] = iLength;
+   pLink->uArrival[iIndex] = s_uTimeNow + TEST_LINK_DELAY_MS;
+   pLink->iCount++;
+}
+
+// Returns the length of the next arrived packet, 0 if none
+int _link_receive(int iDirection, u8* pData)
+{
+   t_test_link* pLink = &(s_Links[iDirection]);
+   if ( (0 == pLink->iCount) || (pLink->uArrival[pLink->iStart] > s_uTimeNow) )
+      return 0;
+   int iLength = pLink->iLength[pLink->iStart];
+   memcpy(pData, pLink->uData[pLink->iStart], iLength);
+   pLink->iStart = (pLink->iStart + 1) % TEST_LINK_MAX_PACKETS;
+   pLink->iCount--;
+   return iLength;
+}
+
+void _reset_links()
+{
+   memset(s_Links, 0, sizeof(s_Links));
+}
+
+// Transport loopback
+
+void _on_deliver_down(const u8* pFrame, int iFrameLength, void* pContext)
+{
+   _on_frame_delivered(TEST_DIRECTION_DOWN, pFrame, iFrameLength);
+}
+
+void _on_deliver_up(const u8* pFrame, int iFrameLength, void* pContext)
+{
+   _on_frame_delivered(TEST_DIRECTION_UP, pFrame, iFrameLength);
+}
+
+t_telemetry_transport s_TTVehicle;
+t_telemetry_transport s_TTController;
+
+// Runs the source frames through the transport. uRestartTime: the vehicle endpoint restarts then (0: no restart)
+void _run_transport(int iLoss, u32 uRate, u32 uRestartTime)
+{
+   srand(7);
+   _reset_delivery();
+   _reset_links();
+   s_uTimeNow = 0;
+   telemetry_transport_init(&s_TTVehicle, _on_deliver_up, NULL, s_uTimeNow);
+   telemetry_transport_init(&s_TTController, _on_deliver_down, NULL, s_uTimeNow);
+   telemetry_transport_set_rate(&s_TTVehicle, uRate, s_uTimeNow);
+   telemetry_transport_set_rate(&s_TTController, uRate, s_uTimeNow);
+
+   u32 uEnd = (s_iFramesCount > 0)?(s_pFrames[s_iFramesCount-1].uTime + 5000):5000;
+   int iNext = 0;
+   u8 uPacket[TELEMETRY_TRANSPORT_MAX_PAYLOAD+20];
+   for( s_uTimeNow=0; s_uTimeNow<uEnd; s_uTimeNow++ )
+   {
+      if ( (0 != uRestartTime) && (s_uTimeNow == uRestartTime) )
+         telemetry_transport_reset(&s_TTVehicle, s_uTimeNow);
+
+      while ( (iNext < s_iFramesCount) && (s_pFrames[iNext].uTime <= s_uTimeNow) )
+      {
+         t_telemetry_transport* pTT = (s_pFrames[iNext].iDirection == TEST_DIRECTION_DOWN)?&s_TTVehicle:&s_TTController;
+         telemetry_transport_add_serial_data(pTT, s_pFramesData + s_pFrames[iNext].iOffset, s_pFrames[iNext].iLength, s_uTimeNow);
+         iNext++;
+      }
+
+      int iLength;
+      while ( (iLength = _link_receive(TEST_DIRECTION_DOWN, uPacket)) > 0 )
+         telemetry_transport_on_packet(&s_TTController, uPacket, iLength, s_uTimeNow);
+      while ( (iLength = _link_receive(TEST_DIRECTION_UP, uPacket)) > 0 )
+         telemetry_transport_on_packet(&s_TTVehicle, uPacket, iLength, s_uTimeNow);
+
+      for( int i=0; i<10; i++ )
+      {
+         iLength = telemetry_transport_get_packet(&s_TTVehicle, uPacket, TELEMETRY_TRANSPORT_MAX_PAYLOAD, s_uTimeNow);
+         if ( iLength <= 0 )
+            break;
+         _link_send(TEST_DIRECTION_DOWN, uPacket, iLength, iLoss);
+      }
+      for( int i=0; i<10; i++ )
+      {
+         iLength = telemetry_transport_get_packet(&s_TTController, uPacket, TELEMETRY_TRANSPORT_MAX_PAYLOAD, s_uTimeNow);
+         if ( iLength <= 0 )
+            break;
+         _link_send(TEST_DIRECTION_UP, uPacket, iLength, iLoss);
+      }
+   }
+   s_Results.uDuration = uEnd;
+}
+
+// Raw segments path, as before the transport: fixed size chunks of the serial stream, lost chunks break frames
+
+t_mavlink_frame_extractor s_RawExtractors[2];
+
+void _on_raw_frame(const u8* pFrame, int iFrameLength, u32 uMsgId, void* pContext)
+{
+   _on_frame_delivered((int)(long)pContext, pFrame, iFrameLength);
+}
+
+void _run_raw(int iLoss)
+{
+   srand(7);
+   _reset_delivery();
+   _reset_links();
+
+   u8 uBuffer[2][TEST_RAW_SEGMENT_SIZE];
+   int iCount[2] = {0, 0};
+   u32 uLastSend[2] = {0, 0};
+   for( int i=0; i<2; i++ )
+   {
+      mavlink_frames_init(&s_RawExtractors[i]);
+      mavlink_frames_set_default_handler(&s_RawExtractors[i], _on_raw_frame);
+   }
+
+   u32 uEnd = (s_iFramesCount > 0)?(s_pFrames[s_iFramesCount-1].uTime + 5000):5000;
+   int iNext = 0;
+   u8 uPacket[TELEMETRY_TRANSPORT_MAX_PAYLOAD+20];
+   int iHeader = sizeof(t_packet_header_telemetry_raw);
+   for( s_uTimeNow=0; s_uTimeNow<uEnd; s_uTimeNow++ )
+   {
+      while ( (iNext < s_iFramesCount) && (s_pFrames[iNext].uTime <= s_uTimeNow) )
+      {
+         int iDir = s_pFrames[iNext].iDirection;
+         const u8* pData = s_pFramesData + s_pFrames[iNext].iOffset;
+         int iLength = s_pFrames[iNext].iLength;
+         while ( iLength > 0 )
+         {
+            int iChunk = TEST_RAW_SEGMENT_SIZE - iCount[iDir];
+            if ( iChunk > iLength )
+               iChunk = iLength;
+            memcpy(&(uBuffer[iDir][iCount[iDir]]), pData, iChunk);
+            iCount[iDir] += iChunk;
+            pData += iChunk;
+            iLength -= iChunk;
+            if ( iCount[iDir] >= TEST_RAW_SEGMENT_SIZE )
+            {
+               memcpy(uPacket + iHeader, uBuffer[iDir], iCount[iDir]);
+               _link_send(iDir, uPacket, iHeader + iCount[iDir], iLoss);
+               iCount[iDir] = 0;
+               uLastSend[iDir] = s_uTimeNow;
+            }
+         }
+         iNext++;
+      }
+
+      for( int iDir=0; iDir<2; iDir++ )
+      {
+         int iLength;
+         while ( (iLength = _link_receive(iDir, uPacket)) > 0 )
+            mavlink_frames_parse(&s_RawExtractors[iDir], uPacket + iHeader, iLength - iHeader, (void*)(long)iDir);
+
+         if ( (iCount[iDir] >= TEST_RAW_SEND_LENGTH) || ((iCount[iDir] > 0) && (s_uTimeNow >= uLastSend[iDir] + TEST_RAW_SEND_TIMEOUT_MS)) )
+         {
+            memcpy(uPacket + iHeader, uBuffer[iDir], iCount[iDir]);
+            _link_send(iDir, uPacket, iHeader + iCount[iDir], iLoss);
+            iCount[iDir] = 0;
+            uLastSend[iDir] = s_uTimeNow;
+         }
+      }
+   }
+   s_Results.uDuration = uEnd;
+}
+
+// Checks
+
+void _test_classes_and_coalescing()
+{
+   log_line("Message classes and latest wins under congestion...");
+   if ( telemetry_transport_get_message_class(MAVLINK_MSG_ID_ATTITUDE) != TELEMETRY_TRANSPORT_CLASS_STREAM ||
+        telemetry_transport_get_message_class(MAVLINK_MSG_ID_HEARTBEAT) != TELEMETRY_TRANSPORT_CLASS_STREAM ||
+        telemetry_transport_get_message_class(MAVLINK_MSG_ID_PARAM_VALUE) != TELEMETRY_TRANSPORT_CLASS_TRANSACTIONAL ||
+        telemetry_transport_get_message_class(MAVLINK_MSG_ID_MISSION_ITEM_INT) != TELEMETRY_TRANSPORT_CLASS_TRANSACTIONAL ||
+        telemetry_transport_get_message_class(MAVLINK_MSG_ID_COMMAND_LONG) != TELEMETRY_TRANSPORT_CLASS_TRANSACTIONAL )
+      _fail("Message classes");
+
+   t_telemetry_transport tt;
+   telemetry_transport_init(&tt, NULL, NULL, 0);
+   tt.iTokens = 0; // congested
+   mavlink_message_t msg;
+   u8 buffer[MAVLINK_MAX_PACKET_LEN];
+   for( int i=0; i<5; i++ )
+   {
+      mavlink_msg_attitude_pack(1, 1, &msg, i, 0.1f, 0.2f, 0.3f, 0.01f, 0.02f, 0.03f);
+      int iLen = mavlink_msg_to_send_buffer(buffer, &msg);
+      telemetry_transport_add_serial_data(&tt, buffer, iLen, 0);
+   }
+   mavlink_msg_attitude_pack(1, 2, &msg, 0, 0.1f, 0.2f, 0.3f, 0.01f, 0.02f, 0.03f);
+   int iLen = mavlink_msg_to_send_buffer(buffer, &msg);
+   telemetry_transport_add_serial_data(&tt, buffer, iLen, 0);
+   if ( (tt.iQueued != 2) || (tt.stats.uStreamCoalesced != 4) )
+      _fail("Latest wins coalescing");
+   else
+   {
+      mavlink_attitude_t attitude;
+      mavlink_message_t decoded;
+      mavlink_frames_to_message(tt.queue[0].uFrame, tt.queue[0].iLength, &decoded);
+      mavlink_msg_attitude_decode(&decoded, &attitude);
+      if ( attitude.time_boot_ms != 4 )
+         _fail("Latest wins keeps the newest frame");
+   }
+
+   // Transactional frames are not coalesced
+   for( int i=0; i<3; i++ )
+   {
+      mavlink_msg_command_ack_pack(1, 1, &msg, MAV_CMD_DO_SET_MODE, 0, 0, 0, 0, 0);
+      iLen = mavlink_msg_to_send_buffer(buffer, &msg);
+      telemetry_transport_add_serial_data(&tt, buffer, iLen, 0);
+   }
+   if ( tt.iQueued != 5 )
+      _fail("Transactional frames queued");
+
+   // Serial stream cut anywhere, with line noise: whole frames only
+   telemetry_transport_reset(&tt, 0);
+   u8 stream[4096];
+   int iStreamLength = 0;
+   int iFramesExpected = 0;
+   srand(11);
+   while ( iStreamLength < (int)sizeof(stream) - 2*MAVLINK_MAX_PACKET_LEN )
+   {
+      mavlink_msg_param_value_pack(1, 1, &msg, "PARAM", (float)iFramesExpected, MAV_PARAM_TYPE_REAL32, 1000, iFramesExpected);
+      iLen = mavlink_msg_to_send_buffer(stream + iStreamLength, &msg);
+      iStreamLength += iLen;
+      iFramesExpected++;
+      if ( (rand() % 4) == 0 )
+      {
+         int iNoise = 1 + rand() % 8;
+         for( int i=0; i<iNoise; i++ )
+            stream[iStreamLength++] = ((rand()%3) == 0)?MAVLINK_STX:(u8)(rand() & 0x7F);
+      }
+   }
+   int iFrames = 0;
+   for( int iPos=0; iPos<iStreamLength; )
+   {
+      int iChunk = 1 + rand() % 100;
+      if ( iPos + iChunk > iStreamLength )
+         iChunk = iStreamLength - iPos;
+      iFrames += telemetry_transport_add_serial_data(&tt, stream + iPos, iChunk, 0);
+      iPos += iChunk;
+   }
+   log_line("Serial framing: %d frames of %d, %u noise bytes discarded", iFrames, iFramesExpected, tt.stats.uBytesDiscarded);
+   if ( (iFrames != iFramesExpected) || (tt.iQueued != iFramesExpected) || (0 == tt.stats.uBytesDiscarded) )
+      _fail("Serial framing");
+}
+
+void _test_loopback(int iLoss)
+{
+   _run_raw(iLoss);
+   _log_results("Raw segments", iLoss);
+   u32 uRawTransactional = s_Results.uDelivered[1];
+
+   _run_transport(iLoss, s_uRate, 0);
+   _log_results("Transport", iLoss);
+   telemetry_transport_log_stats(&s_TTVehicle, "vehicle");
+   telemetry_transport_log_stats(&s_TTController, "controller");
+
+   if ( s_Results.uUnknown > 0 )
+      _fail("Corrupted frames delivered");
+   if ( s_Results.uOutOfOrder > 0 )
+      _fail("Transactional frames out of order");
+   // Transactional frames are only dropped when the rate is below what the source sends (queue full)
+   u32 uTransactionalDropped = s_TTVehicle.stats.uTransactionalDropped + s_TTController.stats.uTransactionalDropped;
+   if ( s_Results.uDelivered[1] + uTransactionalDropped != s_Results.uFrames[1] )
+      _fail("Transactional frames lost");
+   if ( (0 == uTransactionalDropped) && (s_Results.uDelivered[1] < uRawTransactional) )
+      _fail("Fewer transactional frames than the raw segments");
+   if ( s_TTVehicle.stats.uGivenUp + s_TTController.stats.uGivenUp > 0 )
+      _fail("Transactional frames given up");
+
+   // Stream frames are sent once: about the link loss is lost (the ones coalesced or dropped under congestion are not sent)
+   u32 uStreamSent = s_Results.uFrames[0] - s_TTVehicle.stats.uStreamCoalesced - s_TTVehicle.stats.uStreamDropped -
+                     s_TTController.stats.uStreamCoalesced - s_TTController.stats.uStreamDropped;
+   u32 uStreamMin = (u32)((unsigned long long)uStreamSent * (100 - iLoss) * 90 / 10000);
+   if ( s_Results.uDelivered[0] < uStreamMin )
+      _fail("Stream frames delivered");
+   if ( (0 == iLoss) && (s_Results.uDelivered[0] > 0) &&
+        (s_Results.uLatencyTotal[0]/s_Results.uDelivered[0] > TELEMETRY_TRANSPORT_MAX_DELAY_MS + TEST_LINK_DELAY_MS) )
+      _fail("Stream frames latency");
+}
+
+void _test_congestion()
+{
+   // Rate budget below the telemetry: stream frames coalesce, the transactional ones still all go
+   u32 uRate = 2500;
+   int iLoss = 10;
+   _run_transport(iLoss, uRate, 0);
+   _log_results("Transport congested", iLoss);
+   telemetry_transport_log_stats(&s_TTVehicle, "vehicle");
+
+   if ( s_Results.uDelivered[1] != s_Results.uFrames[1] )
+      _fail("Congested: transactional frames lost");
+   if ( 0 == s_TTVehicle.stats.uStreamCoalesced )
+      _fail("Congested: no stream frames coalesced");
+   if ( s_Results.uUnknown > 0 )
+      _fail("Congested: corrupted frames delivered");
+   // Data packets keep to the budget (ack only packets go around it)
+   u32 uDataBytes = s_TTVehicle.stats.uBytesSent - s_TTVehicle.stats.uAckOnlyPackets*sizeof(t_packet_header_telemetry_transport);
+   u32 uBudget = (u32)((unsigned long long)uRate * s_Results.uDuration / 1000) + 2*TELEMETRY_TRANSPORT_MAX_PAYLOAD + s_TTVehicle.iBurstBytes;
+   if ( uDataBytes > uBudget )
+      _fail("Congested: rate budget");
+}
+
+void _test_restart()
+{
+   // The vehicle side restarts in the middle of the parameters download: the controller follows the new session
+   _run_transport(10, s_uRate, 2800);
+   _log_results("Transport vehicle restart", 10);
+   if ( s_Results.uUnknown > 0 )
+      _fail("Restart: corrupted frames delivered");
+   if ( s_Results.uDelivered[1] + 100 < s_Results.uFrames[1] )
+      _fail("Restart: transactional frames after the restart");
+   if ( s_TTController.stats.uFramesDelivered == 0 )
+      _fail("Restart: nothing delivered");
+}
+
+int main(int argc, char *argv[])
+{
+   log_init_local_only("TestTelemetryTransport");
+   log_enable_stdout();
+
+   const char* szLogFile = NULL;
+   for( int i=1; i<argc; i++ )
+   {
+      if ( 0 == strcmp(argv[i], "-loss") && i < argc-1 )
+         s_iLoss = atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-rate") && i < argc-1 )
+         s_uRate = atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-serial") && i < argc-1 )
+         s_uSerialSpeed = atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-loops") && i < argc-1 )
+         s_iLoops = atoi(argv[++i]);
+      else
+         szLogFile = argv[i];
+   }
+   if ( s_iLoops < 1 )
+      s_iLoops = 1;
+   if ( s_uSerialSpeed < 1200 )
+      s_uSerialSpeed = 1200;
+   if ( s_iLoss > 90 )
+      s_iLoss = 90;
+
+   if ( NULL != szLogFile )
+   {
+      if ( ! _load_log(szLogFile) )
+      {
+         log_line("Can't read MAVLink log %s", szLogFile);
+         return 1;
+      }
+      log_line("Loaded %d frames from %s", s_iFramesCount, szLogFile);
+   }
+   else
+      _generate_flight(20000);
+   qsort(s_pFrames, s_iFramesCount, sizeof(t_test_frame), _compare_frames);
+   log_line("Source: %d frames, %u ms", s_iFramesCount, (s_iFramesCount > 0)?s_pFrames[s_iFramesCount-1].uTime:0);
+
+   for( int i=0; i<s_iLoops; i++ )
+   {
+      _test_classes_and_coalescing();
+      if ( s_iLoss >= 0 )
+         _test_loopback(s_iLoss);
+      else
+      {
+         _test_loopback(0);
+         _test_loopback(10);
+         _test_loopback(30);
+      }
+      if ( NULL == szLogFile )
+      {
+         _test_congestion();
+         _test_restart();
+      }
+   }
+
+   if ( s_iFailed )
+   {
+      log_line("Test FAILED");
+      return 1;
+   }
+   log_line("Test PASSED");
+   return 0;
+}
@@ -0,0 +1,443 @@
+#include "../base/base.h"
+#include "../radio/radiopackets2.h"
+#include "../radio/radiopacketsqueue.h"
+#include "../common/tx_pacer.h"
+
+#include <math.h>
+
+// Tests the token bucket radio pacer: bucket limits, retransmissions first, traffic sent around the pacer,
+// max delay and full queue flushes. Then runs a simulated vehicle loop (video with I-frames, periodic
+// control packets) into a fake radio: a small adapter TX queue aired at a fixed rate, where a write blocks
+// the loop while the adapter queue is full (like the real injection does). Compares paced vs unpaced:
+// radio bursts, loop stalls, control packets latency, video jitter and throughput.
+// Usage: test_tx_pacer [-loops N] (N: simulated seconds)
+
+int s_iFailed = 0;
+int s_iLoops = 20;
+
+void _fail(const char* szText)
+{
+   log_line("%s <- FAILED", szText);
+   s_iFailed = 1;
+}
+
+// Collects the packets the pacer sends, in order
+
+typedef struct
+{
+   int iCount;
+   int iLengths[1024];
+   u32 uIds[1024];
+} t_collect_sink;
+
+int _collect_send(u8* pPacketData, int iPacketLength, void* pContext)
+{
+   t_collect_sink* pSink = (t_collect_sink*)pContext;
+   if ( pSink->iCount < 1024 )
+   {
+      pSink->iLengths[pSink->iCount] = iPacketLength;
+      memcpy(&(pSink->uIds[pSink->iCount]), pPacketData, sizeof(u32));
+      pSink->iCount++;
+   }
+   return 1;
+}
+
+void _add(t_tx_pacer* pPacer, u32 uId, int iLength, int bPriority, u32 uTime)
+{
+   u8 buffer[MAX_PACKET_TOTAL_SIZE];
+   memset(buffer, 0, sizeof(buffer));
+   memcpy(buffer, &uId, sizeof(u32));
+   tx_pacer_add_packet(pPacer, buffer, iLength, bPriority, uTime);
+}
+
+void _test_pacer()
+{
+   t_tx_pacer pacer;
+   t_collect_sink sink;
+   int iFreePool = packets_pool_get_free_count();
+
+   // Not paced: sent right away
+   memset(&sink, 0, sizeof(sink));
+   tx_pacer_init(&pacer, _collect_send, &sink);
+   for( int i=0; i<10; i++ )
+      _add(&pacer, i, 1000, 0, 0);
+   if ( (sink.iCount != 10) || (0 != tx_pacer_get_queued_count(&pacer)) )
+      _fail("Not paced packets sent right away");
+
+   // 8 Mbps: 1000 bytes each ms; burst is the minimum (2 max packets)
+   memset(&sink, 0, sizeof(sink));
+   tx_pacer_init(&pacer, _collect_send, &sink);
+   tx_pacer_set_rate(&pacer, 8000000, 1000);
+   tx_pacer_set_max_delay(&pacer, 1000000);
+   if ( pacer.iBurstBytes != 2*MAX_PACKET_TOTAL_SIZE )
+      _fail("Min burst size");
+   for( int i=0; i<20; i++ )
+      _add(&pacer, i, 1000, 0, 1000);
+   if ( 0 != sink.iCount )
+      _fail("Nothing sent with an empty bucket");
+   if ( tx_pacer_get_time_to_next_send(&pacer, 1000) != 1001 )
+      _fail("Time to next send");
+   tx_pacer_send_ready(&pacer, 2000);
+   if ( 1 != sink.iCount )
+      _fail("One packet after 1 ms");
+   for( u32 uTime=3000; uTime<=11000; uTime += 1000 )
+      tx_pacer_send_ready(&pacer, uTime);
+   if ( 10 != sink.iCount )
+      _fail("One packet each ms");
+   for( int i=0; i<sink.iCount; i++ )
+      if ( sink.uIds[i] != (u32)i )
+         _fail("FIFO order");
+
+   // Retransmissions go first
+   _add(&pacer, 100, 500, 1, 11000);
+   _add(&pacer, 101, 500, 1, 11000);
+   tx_pacer_send_ready(&pacer, 12000);
+   if ( (12 != sink.iCount) || (100 != sink.uIds[10]) || (101 != sink.uIds[11]) )
+      _fail("Priority packets first");
+
+   // Other traffic takes the tokens
+   tx_pacer_on_bypass_packet_sent(&pacer, 3000, 12000);
+   tx_pacer_send_ready(&pacer, 15000);
+   if ( 12 != sink.iCount )
+      _fail("Bypass traffic delays the paced packets");
+   tx_pacer_send_ready(&pacer, 16000);
+   if ( 13 != sink.iCount )
+      _fail("Paced packets resume after the bypass traffic");
+
+   // Max delay: all the packets that waited too long go now
+   tx_pacer_set_max_delay(&pacer, 10000);
+   tx_pacer_send_ready(&pacer, 21000);
+   if ( 0 != tx_pacer_get_queued_count(&pacer) )
+      _fail("Max delay flush");
+   if ( pacer.stats.uPacketsSentUnpaced == 0 )
+      _fail("Max delay flush counted");
+   if ( 22 != sink.iCount )
+      _fail("All sent");
+
+   // Full queue: the oldest goes out unpaced, nothing is lost
+   memset(&sink, 0, sizeof(sink));
+   tx_pacer_init(&pacer, _collect_send, &sink);
+   tx_pacer_set_rate(&pacer, 1000000, 0);
+   for( int i=0; i<TX_PACER_MAX_PACKETS+10; i++ )
+      _add(&pacer, i, 1000, 0, 0);
+   if ( (10 != sink.iCount) || (TX_PACER_MAX_PACKETS != tx_pacer_get_queued_count(&pacer)) || (0 != sink.uIds[0]) || (9 != sink.uIds[9]) )
+      _fail("Full queue");
+   tx_pacer_flush(&pacer, 0);
+   if ( (TX_PACER_MAX_PACKETS+10 != sink.iCount) || (0 != tx_pacer_get_queued_count(&pacer)) )
+      _fail("Flush");
+   for( int i=0; i<sink.iCount; i++ )
+      if ( sink.uIds[i] != (u32)i )
+         _fail("FIFO order after flush");
+
+   // Tx paused: the queued packets are dropped, not sent in a burst later
+   memset(&sink, 0, sizeof(sink));
+   tx_pacer_init(&pacer, _collect_send, &sink);
+   tx_pacer_set_rate(&pacer, 1000000, 0);
+   for( int i=0; i<20; i++ )
+      _add(&pacer, i, 1000, (i<2)?1:0, 0);
+   int iSentBeforeDrop = sink.iCount;
+   tx_pacer_drop_queued(&pacer);
+   tx_pacer_set_rate(&pacer, 0, 0);
+   tx_pacer_send_ready(&pacer, 100000);
+   if ( (sink.iCount != iSentBeforeDrop) || (0 != tx_pacer_get_queued_count(&pacer)) || (0 != pacer.iQueuedBytes) )
+      _fail("Drop queued");
+   if ( pacer.stats.uPacketsDropped != (u32)(20 - iSentBeforeDrop) )
+      _fail("Drop queued counted");
+
+   if ( packets_pool_get_free_count() != iFreePool )
+      _fail("Pool buffers leaked");
+
+   // Rate from video bitrate and radio datarate
+   if ( tx_pacer_compute_rate(0, 18000000) != 0 )
+      _fail("No video, no pacing");
+   if ( tx_pacer_compute_rate(4000000, 48000000) != 8000000 )
+      _fail("Rate with headroom");
+   if ( tx_pacer_compute_rate(8000000, 18000000) != 9000000 )
+      _fail("Rate capped by radio");
+   if ( tx_pacer_compute_rate(10000000, 12000000) != 11000000 )
+      _fail("Rate above the video bitrate");
+   log_line("Pacer tests done.");
+}
+
+// Simulated radio: a FIFO adapter queue of a few packets, aired at a fixed rate.
+// Writing to a full adapter queue blocks (the simulated loop time moves on) until a packet is aired.
+
+#define SIM_ADAPTER_QUEUE 16
+#define SIM_AIR_RATE_BPS 16000000
+#define SIM_VIDEO_BITRATE 6000000
+#define SIM_FPS 30
+#define SIM_KEYFRAME_INTERVAL 30
+#define SIM_KEYFRAME_SIZE_RATIO 6
+#define SIM_PACKET_SIZE 1250
+#define SIM_CONTROL_INTERVAL_MICROS 10000
+#define SIM_CONTROL_SIZE 200
+
+typedef struct
+{
+   u32 uTimeNow;
+   int iLengths[SIM_ADAPTER_QUEUE];
+   u32 uTimesAdded[SIM_ADAPTER_QUEUE];
+   u32 uTimesGenerated[SIM_ADAPTER_QUEUE];
+   int bControl[SIM_ADAPTER_QUEUE];
+   int iStart;
+   int iCount;
+   u32 uTimeAirBusyUntil;
+
+   int iMaxDepth;
+   u32 uStallTotalMicros;
+   u32 uStallMaxMicros;
+   unsigned long long uVideoBytesAired;
+   u32 uControlCount;
+   unsigned long long uControlLatencyTotal;
+   u32 uControlLatencyMax;
+   u32 uVideoCount;
+   u32 uTimeLastVideoWrite;
+   double dGapSum;
+   double dGapSumSq;
+   u32 uGapsCount;
+   int iBurstCount; // video packets written less than 100 us apart
+   int iMaxBurst;
+} t_sim_radio;
+
+t_sim_radio s_SimRadio;
+
+u32 _air_time(int iLength)
+{
+   return (u32)(((unsigned long long)iLength * 8000000) / SIM_AIR_RATE_BPS);
+}
+
+// Airs the packets done by the given time
+void _sim_radio_advance(u32 uTime)
+{
+   while ( s_SimRadio.iCount > 0 )
+   {
+      int iIndex = s_SimRadio.iStart;
+      u32 uStart = s_SimRadio.uTimeAirBusyUntil;
+      if ( s_SimRadio.uTimesAdded[iIndex] > uStart )
+         uStart = s_SimRadio.uTimesAdded[iIndex];
+      u32 uEnd = uStart + _air_time(s_SimRadio.iLengths[iIndex]);
+      if ( uEnd > uTime )
+         break;
+      s_SimRadio.uTimeAirBusyUntil = uEnd;
+      if ( s_SimRadio.bControl[iIndex] )
+      {
+         u32 uLatency = uEnd - s_SimRadio.uTimesGenerated[iIndex];
+         s_SimRadio.uControlCount++;
+         s_SimRadio.uControlLatencyTotal += uLatency;
+         if ( uLatency > s_SimRadio.uControlLatencyMax )
+            s_SimRadio.uControlLatencyMax = uLatency;
+      }
+      else
+         s_SimRadio.uVideoBytesAired += s_SimRadio.iLengths[iIndex];
+      s_SimRadio.iStart = (s_SimRadio.iStart+1) % SIM_ADAPTER_QUEUE;
+      s_SimRadio.iCount--;
+   }
+}
+
+// Time when the first packet in the adapter queue is done
+u32 _sim_radio_next_free_time()
+{
+   int iIndex = s_SimRadio.iStart;
+   u32 uStart = s_SimRadio.uTimeAirBusyUntil;
+   if ( s_SimRadio.uTimesAdded[iIndex] > uStart )
+      uStart = s_SimRadio.uTimesAdded[iIndex];
+   return uStart + _air_time(s_SimRadio.iLengths[iIndex]);
+}
+
+// Control latency is from the time the packet was generated: stalls of the loop count too
+void _sim_radio_write(int iLength, int bControl, u32 uTimeGenerated)
+{
+   _sim_radio_advance(s_SimRadio.uTimeNow);
+   if ( s_SimRadio.iCount >= SIM_ADAPTER_QUEUE )
+   {
+      u32 uFree = _sim_radio_next_free_time();
+      u32 uStall = uFree - s_SimRadio.uTimeNow;
+      s_SimRadio.uStallTotalMicros += uStall;
+      if ( uStall > s_SimRadio.uStallMaxMicros )
+         s_SimRadio.uStallMaxMicros = uStall;
+      s_SimRadio.uTimeNow = uFree;
+      _sim_radio_advance(s_SimRadio.uTimeNow);
+   }
+   int iIndex = (s_SimRadio.iStart + s_SimRadio.iCount) % SIM_ADAPTER_QUEUE;
+   s_SimRadio.iLengths[iIndex] = iLength;
+   s_SimRadio.uTimesAdded[iIndex] = s_SimRadio.uTimeNow;
+   s_SimRadio.bControl[iIndex] = bControl;
+   s_SimRadio.iCount++;
+   if ( s_SimRadio.iCount > s_SimRadio.iMaxDepth )
+      s_SimRadio.iMaxDepth = s_SimRadio.iCount;
+
+   s_SimRadio.uTimesGenerated[iIndex] = uTimeGenerated;
+   if ( bControl )
+      return;
+   s_SimRadio.uVideoCount++;
+   if ( s_SimRadio.uVideoCount > 1 )
+   {
+      double dGap = (double)(s_SimRadio.uTimeNow - s_SimRadio.uTimeLastVideoWrite);
+      s_SimRadio.dGapSum += dGap;
+      s_SimRadio.dGapSumSq += dGap*dGap;
+      s_SimRadio.uGapsCount++;
+      if ( dGap < 100 )
+         s_SimRadio.iBurstCount++;
+      else
+         s_SimRadio.iBurstCount = 1;
+      if ( s_SimRadio.iBurstCount > s_SimRadio.iMaxBurst )
+         s_SimRadio.iMaxBurst = s_SimRadio.iBurstCount;
+   }
+   s_SimRadio.uTimeLastVideoWrite = s_SimRadio.uTimeNow;
+}
+
+int _sim_radio_send(u8* pPacketData, int iPacketLength, void* pContext)
+{
+   _sim_radio_write(iPacketLength, 0, 0);
+   return 1;
+}
+
+typedef struct
+{
+   int iMaxDepth;
+   int iMaxBurst;
+   u32 uStallMaxMicros;
+   u32 uStallTotalMicros;
+   u32 uControlLatencyAvg;
+   u32 uControlLatencyMax;
+   u32 uJitterMicros;
+   u32 uThroughputBPS;
+   u32 uPacerDelayMaxMicros;
+} t_sim_result;
+
+void _run_simulation(int bPaced, int iSeconds, t_sim_result* pResult)
+{
+   memset(&s_SimRadio, 0, sizeof(s_SimRadio));
+   s_SimRadio.uTimeNow = 1;
+
+   t_tx_pacer pacer;
+   tx_pacer_init(&pacer, _sim_radio_send, NULL);
+   if ( bPaced )
+      tx_pacer_set_rate(&pacer, tx_pacer_compute_rate(SIM_VIDEO_BITRATE, SIM_AIR_RATE_BPS*2), s_SimRadio.uTimeNow);
+
+   // P-frames size so the average is the video bitrate
+   int iFramesBytes = SIM_VIDEO_BITRATE/8/SIM_FPS*SIM_KEYFRAME_INTERVAL;
+   int iPFrameBytes = iFramesBytes / (SIM_KEYFRAME_INTERVAL - 1 + SIM_KEYFRAME_SIZE_RATIO);
+   u32 uFrameInterval = 1000000/SIM_FPS;
+
+   u8 packet[MAX_PACKET_TOTAL_SIZE];
+   memset(packet, 0, sizeof(packet));
+
+   u32 uTimeEnd = (u32)iSeconds * 1000000;
+   u32 uNextFrame = 1;
+   u32 uNextControl = 1;
+   int iFrame = 0;
+   int iFrameRemainder = 0;
+   u32 uDelayMax = 0;
+
+   while ( s_SimRadio.uTimeNow < uTimeEnd )
+   {
+      if ( s_SimRadio.uTimeNow >= uNextControl )
+      {
+         u32 uGenerated = uNextControl;
+         uNextControl += SIM_CONTROL_INTERVAL_MICROS;
+         _sim_radio_write(SIM_CONTROL_SIZE, 1, uGenerated);
+         tx_pacer_on_bypass_packet_sent(&pacer, SIM_CONTROL_SIZE, s_SimRadio.uTimeNow);
+      }
+      if ( s_SimRadio.uTimeNow >= uNextFrame )
+      {
+         uNextFrame += uFrameInterval;
+         int iBytes = iPFrameBytes;
+         if ( 0 == (iFrame % SIM_KEYFRAME_INTERVAL) )
+            iBytes = iPFrameBytes * SIM_KEYFRAME_SIZE_RATIO;
+         iFrame++;
+         iBytes += iFrameRemainder;
+         // Whole packets go out with each frame, like complete video blocks
+         while ( iBytes >= SIM_PACKET_SIZE )
+         {
+            tx_pacer_add_packet(&pacer, packet, SIM_PACKET_SIZE, 0, s_SimRadio.uTimeNow);
+            iBytes -= SIM_PACKET_SIZE;
+         }
+         iFrameRemainder = iBytes;
+      }
+
+      tx_pacer_send_ready(&pacer, s_SimRadio.uTimeNow);
+      if ( pacer.stats.uDelayMaxMicros > uDelayMax )
+         uDelayMax = pacer.stats.uDelayMaxMicros;
+
+      // Next wake up: 1 ms loop, sooner for the paced packets, frames or control packets
+      u32 uNext = s_SimRadio.uTimeNow + 1000;
+      u32 uWait = tx_pacer_get_time_to_next_send(&pacer, s_SimRadio.uTimeNow);
+      if ( (0 != uWait) && (s_SimRadio.uTimeNow + uWait < uNext) )
+         uNext = s_SimRadio.uTimeNow + uWait;
+      if ( uNextFrame < uNext )
+         uNext = uNextFrame;
+      if ( uNextControl < uNext )
+         uNext = uNextControl;
+      if ( uNext < s_SimRadio.uTimeNow + 50 )
+         uNext = s_SimRadio.uTimeNow + 50;
+      s_SimRadio.uTimeNow = uNext;
+   }
+
+   memset(pResult, 0, sizeof(t_sim_result));
+   pResult->iMaxDepth = s_SimRadio.iMaxDepth;
+   pResult->iMaxBurst = s_SimRadio.iMaxBurst;
+   pResult->uStallMaxMicros = s_SimRadio.uStallMaxMicros;
+   pResult->uStallTotalMicros = s_SimRadio.uStallTotalMicros;
+   if ( s_SimRadio.uControlCount > 0 )
+      pResult->uControlLatencyAvg = (u32)(s_SimRadio.uControlLatencyTotal / s_SimRadio.uControlCount);
+   pResult->uControlLatencyMax = s_SimRadio.uControlLatencyMax;
+   if ( s_SimRadio.uGapsCount > 1 )
+   {
+      double dMean = s_SimRadio.dGapSum / s_SimRadio.uGapsCount;
+      double dVar = s_SimRadio.dGapSumSq / s_SimRadio.uGapsCount - dMean*dMean;
+      pResult->uJitterMicros = (dVar > 0)?(u32)sqrt(dVar):0;
+   }
+   pResult->uThroughputBPS = (u32)((s_SimRadio.uVideoBytesAired * 8 * 1000000) / uTimeEnd);
+   pResult->uPacerDelayMaxMicros = uDelayMax;
+
+   // What is still queued goes out now, not counted
+   tx_pacer_flush(&pacer, s_SimRadio.uTimeNow);
+
+   log_line("%s: max adapter queue %d packets, max burst %d packets, loop stalls max/total: %u/%u us, control latency avg/max: %u/%u us, video jitter %u us, throughput %u kbps, pacer max delay %u us",
+      bPaced?"Paced  ":"Unpaced", pResult->iMaxDepth, pResult->iMaxBurst, pResult->uStallMaxMicros, pResult->uStallTotalMicros,
+      pResult->uControlLatencyAvg, pResult->uControlLatencyMax, pResult->uJitterMicros, pResult->uThroughputBPS/1000, pResult->uPacerDelayMaxMicros);
+}
+
+void _test_simulation()
+{
+   t_sim_result unpaced, paced;
+   log_line("Simulating %d seconds: video %u kbps, %d fps, I-frames %dx every %d frames, radio %u kbps with a %d packets adapter queue, control packets every %d ms",
+      s_iLoops, SIM_VIDEO_BITRATE/1000, SIM_FPS, SIM_KEYFRAME_SIZE_RATIO, SIM_KEYFRAME_INTERVAL, SIM_AIR_RATE_BPS/1000, SIM_ADAPTER_QUEUE, SIM_CONTROL_INTERVAL_MICROS/1000);
+   _run_simulation(0, s_iLoops, &unpaced);
+   _run_simulation(1, s_iLoops, &paced);
+
+   if ( paced.iMaxBurst >= unpaced.iMaxBurst )
+      _fail("Paced bursts are smaller");
+   if ( paced.uStallMaxMicros > unpaced.uStallMaxMicros )
+      _fail("Paced loop stalls are shorter");
+   if ( paced.uControlLatencyMax >= unpaced.uControlLatencyMax )
+      _fail("Paced control latency is lower");
+   if ( (unsigned long long)paced.uThroughputBPS * 100 < (unsigned long long)unpaced.uThroughputBPS * 98 )
+      _fail("Paced throughput is the same");
+}
+
+int main(int argc, char *argv[])
+{
+   log_init("TestTxPacer");
+   log_enable_stdout();
+
+   for( int i=1; i<argc; i++ )
+   {
+      if ( 0 == strcmp(argv[i], "-loops") && i < argc-1 )
+         s_iLoops = atoi(argv[++i]);
+   }
+   if ( s_iLoops < 2 )
+      s_iLoops = 2;
+
+   _test_pacer();
+   _test_simulation();
+
+   if ( s_iFailed )
+   {
+      log_line("Test FAILED");
+      return 1;
+   }
+   log_line("Test PASSED");
+   return 0;
+}
@@ -0,0 +1,140 @@
+/*
+You can use this C/C++ code however you wish (for example, but not limited to:
+     as is, or by modifying it, or by adding new code, or by removing parts of the code;
+     in public or private projects, in new free or commercial products)
+     only if you get a priori written consent from Petru Soroaga (petrusoroaga@yahoo.com) for your specific use
+     and only if this copyright terms are preserved in the code.
+     This code is public for learning and academic purposes.
+Also, check the licences folder for additional licences terms.
+Code written by: Petru Soroaga, 2021-2023
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+
+#include "../base/base.h"
+#include "../base/config.h"
+#include "../common/adaptive_video_controllers.h"
+#include "../common/adaptive_video_trace.h"
+
+void _print_usage()
+{
+   printf("Usage: ruby_adaptive_video_replay [trace_file] [-strength N] [-seed N] [-gen loss_good loss_bad good_to_bad bad_to_good] [-fades period_ms duration_ms loss] [-outages period_ms duration_ms] [-duration seconds] [-save file]\n");
+   printf("Replays an adaptive video trace (recorded by the controller, default: %s) against all the adaptive video controllers and scores them.\n", FILE_ADAPTIVE_VIDEO_TRACE);
+   printf("With -gen, replays a synthetic trace of a two state link instead (loss rates 0..1, state switch probabilities per 20 ms interval).\n");
+}
+
+void _print_score(const char* szName, const t_adaptive_video_replay_score* pScore, u32 uUpdateInterval)
+{
+   float fSeconds = (float)pScore->uIntervals * (float)uUpdateInterval / 1000.0;
+   if ( fSeconds < 0.001 )
+      fSeconds = 0.001;
+   printf("   %-12s %8u %8u %8u %10.4f %7u %7u %8.1f %8.2f %10.0f\n",
+      szName, pScore->uStallIntervals, pScore->uStallEvents, pScore->uLongestStallMs,
+      (pScore->uBlocks > 0)?(float)pScore->uFailedBlocks/(float)pScore->uBlocks:0.0,
+      pScore->uSwitchesDown, pScore->uSwitchesUp, (float)(pScore->uSwitchesDown + pScore->uSwitchesUp) * 60.0 / fSeconds,
+      pScore->fAverageLevel, pScore->fGoodputKbps);
+}
+
+int main(int argc, char *argv[])
+{
+   char szTraceFile[256];
+   char szSaveFile[256];
+   strcpy(szTraceFile, FILE_ADAPTIVE_VIDEO_TRACE);
+   szSaveFile[0] = 0;
+   int iStrength = -1;
+   u32 uSeed = 1;
+   int iDurationSec = 300;
+   bool bGenerate = false;
+   t_adaptive_video_channel channel;
+   memset(&channel, 0, sizeof(t_adaptive_video_channel));
+
+   for( int i=1; i<argc; i++ )
+   {
+      if ( 0 == strcmp(argv[i], "-strength") && i < argc-1 )
+         iStrength = atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-seed") && i < argc-1 )
+         uSeed = (u32)atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-duration") && i < argc-1 )
+         iDurationSec = atoi(argv[++i]);
+      else if ( 0 == strcmp(argv[i], "-save") && i < argc-1 )
+         strncpy(szSaveFile, argv[++i], sizeof(szSaveFile)-1);
+      else if ( 0 == strcmp(argv[i], "-gen") && i < argc-4 )
+      {
+         bGenerate = true;
+         channel.fLossGood = atof(argv[++i]);
+         channel.fLossBad = atof(argv[++i]);
+         channel.fGoodToBad = atof(argv[++i]);
+         channel.fBadToGood = atof(argv[++i]);
+      }
+      else if ( 0 == strcmp(argv[i], "-fades") && i < argc-3 )
+      {
+         channel.iFadePeriodMs = atoi(argv[++i]);
+         channel.iFadeDurationMs = atoi(argv[++i]);
+         channel.fFadeLoss = atof(argv[++i]);
+      }
+      else if ( 0 == strcmp(argv[i], "-outages") && i < argc-2 )
+      {
+         channel.iOutagePeriodMs = atoi(argv[++i]);
+         channel.iOutageDurationMs = atoi(argv[++i]);
+      }
+      else if ( argv[i][0] != '-' )
+         strncpy(szTraceFile, argv[i], sizeof(szTraceFile)-1);
+      else
+      {
+         _print_usage();
+         return 0;
+      }
+   }
+
+   log_init("RubyAdaptiveVideoReplay");
+
+   t_adaptive_video_trace trace;
+   if ( bGenerate )
+   {
+      t_adaptive_video_levels levels;
+      adaptive_video_trace_get_default_levels(&levels);
+      if ( ! adaptive_video_trace_generate(&trace, &levels, &channel, iDurationSec*1000, uSeed) )
+      {
+         printf("Failed to generate the trace.\n");
+         return -1;
+      }
+      printf("Synthetic trace: %d seconds, loss %.3f / %.3f, state switch %.3f / %.3f", iDurationSec, channel.fLossGood, channel.fLossBad, channel.fGoodToBad, channel.fBadToGood);
+      if ( channel.iFadePeriodMs > 0 )
+         printf(", fades of %d ms each %d ms (loss %.2f)", channel.iFadeDurationMs, channel.iFadePeriodMs, channel.fFadeLoss);
+      if ( channel.iOutagePeriodMs > 0 )
+         printf(", outages of %d ms each %d ms", channel.iOutageDurationMs, channel.iOutagePeriodMs);
+      printf("\n");
+      if ( 0 != szSaveFile[0] )
+         adaptive_video_trace_save(szSaveFile, &trace);
+   }
+   else
+   {
+      if ( ! adaptive_video_trace_load(szTraceFile, &trace) )
+      {
+         printf("Can't load trace file %s\n", szTraceFile);
+         return -1;
+      }
+      printf("Trace %s: %d intervals (%.1f seconds), recorded with controller %d, adjustment strength %d\n",
+         szTraceFile, trace.iCountRecords, (float)trace.iCountRecords * (float)trace.header.uUpdateInterval / 1000.0,
+         trace.header.iController, trace.header.iAdjustmentStrength);
+   }
+
+   t_adaptive_video_levels* pLevels = &trace.header.levels;
+   printf("Levels (HQ %d, MQ %d, LQ %d):", pLevels->iLevelsHQ, pLevels->iLevelsMQ, pLevels->iLevelsLQ);
+   for( int i=0; i<pLevels->iCountLevels; i++ )
+      printf(" %d/%d@%.1f%s", pLevels->uDataPackets[i], pLevels->uECPackets[i], (float)pLevels->uVideoBitrate[i]/1000000.0, adaptive_video_is_level_skipped(pLevels, i)?"(skip)":"");
+   printf("\n\n");
+
+   printf("   %-12s %8s %8s %8s %10s %7s %7s %8s %8s %10s\n", "Controller", "Stalls", "Events", "Max ms", "Blk fail", "Down", "Up", "Sw/min", "Avg lvl", "Kbps");
+   for( int i=0; i<ADAPTIVE_VIDEO_CONTROLLERS_COUNT; i++ )
+   {
+      t_adaptive_video_replay_score score;
+      adaptive_video_trace_replay(&trace, i, iStrength, uSeed, &score);
+      _print_score(adaptive_video_get_controller(i)->szName, &score, trace.header.uUpdateInterval);
+   }
+   adaptive_video_trace_free(&trace);
+   return 0;
+}
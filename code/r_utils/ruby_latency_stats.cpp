@@ -0,0 +1,120 @@
+/*
+You can use this C/C++ code however you wish (for example, but not limited to:
+     as is, or by modifying it, or by adding new code, or by removing parts of the code;
+     in public or private projects, in new free or commercial products)
+     only if you get a priori written consent from Petru Soroaga (petrusoroaga@yahoo.com) for your specific use
+     and only if this copyright terms are preserved in the code.
+     This code is public for learning and academic purposes.
+Also, check the licences folder for additional licences terms.
+Code written by: Petru Soroaga, 2021-2023
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <signal.h>
+#include <string.h>
+
+#include "../base/base.h"
+#include "../base/config.h"
+#include "../base/hardware.h"
+#include "../base/shared_mem.h"
+#include "../base/latency_trace.h"
+
+bool gbQuit = false;
+
+void handle_sigint(int sig)
+{
+   gbQuit = true;
+}
+
+void _print_latency_stats(const char* szName, shared_mem_latency_trace* pSharedMem)
+{
+   shared_mem_latency_trace data;
+   if ( ! latency_trace_read_snapshot(pSharedMem, &data) )
+   {
+      printf("%s: data is being updated, try again.\n", szName);
+      return;
+   }
+
+   u32 uElapsedMs = data.uTimeLastUpdate - data.uTimeStart;
+   double dOverheadPercent = 0.0;
+   if ( uElapsedMs > 0 )
+      dOverheadPercent = 100.0 * (double)data.uTotalSamples * (double)data.uSampleCostNanos / ((double)uElapsedMs * 1000000.0);
+
+   printf("\n%s: %.1f seconds traced, %u samples, %u ns per trace point, tracing overhead: %.3f%%\n", szName, (float)uElapsedMs/1000.0, data.uTotalSamples, data.uSampleCostNanos, dOverheadPercent);
+   printf("   %-40s %10s %10s %10s %10s %10s\n", "Stage", "Count", "Avg (us)", "p50 (us)", "p99 (us)", "Max (us)");
+   for( int i=0; i<LATENCY_TRACE_STAGES_COUNT; i++ )
+   {
+      t_latency_trace_histogram* pHistogram = &(data.stages[i]);
+      if ( 0 == pHistogram->uCount )
+         continue;
+      printf("   %-40s %10u %10.1f %10.1f %10.1f %10.1f\n",
+         latency_trace_get_stage_name(i), pHistogram->uCount,
+         pHistogram->dTotalNanos/(double)pHistogram->uCount/1000.0,
+         (double)latency_trace_get_percentile(pHistogram, 50.0)/1000.0,
+         (double)latency_trace_get_percentile(pHistogram, 99.0)/1000.0,
+         (double)pHistogram->uMaxNanos/1000.0);
+   }
+}
+
+int main(int argc, char *argv[])
+{
+   signal(SIGINT, handle_sigint);
+   signal(SIGTERM, handle_sigint);
+   signal(SIGQUIT, handle_sigint);
+
+   bool bVehicle = true;
+   bool bStation = true;
+   bool bWatch = false;
+
+   for( int i=1; i<argc; i++ )
+   {
+      if ( 0 == strcmp(argv[i], "-vehicle") )
+         bStation = false;
+      else if ( 0 == strcmp(argv[i], "-station") )
+         bVehicle = false;
+      else if ( 0 == strcmp(argv[i], "-watch") )
+         bWatch = true;
+      else
+      {
+         printf("Usage: ruby_latency_stats [-vehicle] [-station] [-watch]\n");
+         printf("Shows the per stage video pipeline latency histograms (needs a build with FEATURE_LATENCY_TRACE).\n");
+         return 0;
+      }
+   }
+
+   log_init("RubyLatencyStats");
+
+   shared_mem_latency_trace* pVehicle = NULL;
+   shared_mem_latency_trace* pStation = NULL;
+   if ( bVehicle )
+      pVehicle = latency_trace_open_for_read(SHARED_MEM_LATENCY_TRACE_VEHICLE);
+   if ( bStation )
+      pStation = latency_trace_open_for_read(SHARED_MEM_LATENCY_TRACE_STATION);
+
+   if ( NULL == pVehicle && NULL == pStation )
+   {
+      printf("No latency trace data available. Is the router running and built with FEATURE_LATENCY_TRACE?\n");
+      return -1;
+   }
+
+   do
+   {
+      if ( NULL != pVehicle )
+         _print_latency_stats("Vehicle", pVehicle);
+      if ( NULL != pStation )
+         _print_latency_stats("Station", pStation);
+      fflush(stdout);
+      if ( bWatch )
+      for( int i=0; i<10 && (!gbQuit); i++ )
+         hardware_sleep_ms(100);
+   }
+   while ( bWatch && (!gbQuit) );
+
+   if ( NULL != pVehicle )
+      munmap(pVehicle, sizeof(shared_mem_latency_trace));
+   if ( NULL != pStation )
+      munmap(pStation, sizeof(shared_mem_latency_trace));
+   return 0;
+}
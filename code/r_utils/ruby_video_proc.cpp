@@ -16,6 +16,7 @@ Code written by: Petru Soroaga, 2021-2023
 #include "../base/launchers.h"
 #include "../base/models.h"
 #include "../common/string_utils.h"
+#include "../common/mp4_recorder.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <sys/resource.h>
@@ -79,16 +80,6 @@ bool store_video()
    }
    fclose(fd);
 
-   if ( NULL != strstr(szFileIn, TEMP_VIDEO_MEM_FOLDER) )
-   {
-      snprintf(szComm, 511, "nice -n %d mv %s %s", niceValue, szFileIn, TEMP_VIDEO_FILE);
-      hw_execute_bash_command(szComm, NULL);
-
-      sprintf(szComm, "umount %s", TEMP_VIDEO_MEM_FOLDER);
-      hw_execute_bash_command(szComm, NULL);
-      strcpy(szFileIn, TEMP_VIDEO_FILE);
-   }
-
    char szOutFile[512];
    char szOutFileInfo[512];
    szOutFile[0] = 0;
@@ -130,11 +121,13 @@ bool store_video()
    u32 timeNow = get_current_timestamp_ms();
    sprintf(szOutFileInfo, FILE_FORMAT_VIDEO_INFO, vehicle_name, g_iBootCount, timeNow/1000, timeNow%1000 );
 
-   strncpy(szOutFile, szOutFileInfo, 512);
-   szOutFile[strlen(szOutFile)-4] = 'h';
-   szOutFile[strlen(szOutFile)-3] = '2';
-   szOutFile[strlen(szOutFile)-2] = '6';
-   szOutFile[strlen(szOutFile)-1] = '4';
+   // Output file has the same extension as the recorded file (mp4, or h264 from older versions)
+   const char* szExtension = strrchr(szFileIn, '.');
+   if ( NULL == szExtension )
+      szExtension = ".h264";
+   strncpy(szOutFile, szOutFileInfo, 500);
+   szOutFile[strlen(szOutFile)-5] = 0;
+   strcat(szOutFile, szExtension);
 
    snprintf(szFileInfo, 1023, "%s%s", FOLDER_MEDIA, szOutFileInfo);
    fd = fopen(szFileInfo, "w");
@@ -157,6 +150,13 @@ bool store_video()
    hw_execute_bash_command(szComm, NULL);
    //launch_set_proc_priority("cp", 10,0,1);
 
+   // Release the memory disk the video was recorded to
+   if ( NULL != strstr(szFileIn, TEMP_VIDEO_MEM_FOLDER) )
+   {
+      sprintf(szComm, "umount %s", TEMP_VIDEO_MEM_FOLDER);
+      hw_execute_bash_command(szComm, NULL);
+   }
+
    sprintf(szComm, "rm -rf %s", TEMP_VIDEO_FILE_INFO);
    hw_execute_bash_command(szComm, NULL);
 
@@ -188,6 +188,16 @@ bool process_video(char* szFileInfo, char* szFileOut)
       return true;
    }
 
+   // Recordings are already MP4 files; only raw H264 ones (from older versions) need to be converted
+   int iLen = strlen(szFileIn);
+   if ( iLen > 4 && 0 == strcmp(szFileIn + iLen - 4, ".mp4") )
+   {
+      snprintf(szComm, 1023, "nice -n %d cp -f %s%s %s", niceValue, FOLDER_MEDIA, szFileIn, szFileOut);
+      hw_execute_bash_command(szComm, NULL);
+      log_line("Finished copying video: %s", szFileOut);
+      return true;
+   }
+
    // Convert input file to output file
    snprintf(szComm, 1023, "ffmpeg -framerate %d -y -i %s%s -c:v copy %s 2>&1 1>/dev/null", fps, FOLDER_MEDIA, szFileIn, szFileOut);
    log_line("Execute ffmpeg: %s", szComm);
@@ -237,6 +247,18 @@ int main(int argc, char *argv[])
    char szFileOut[1024];
    bool bStoreOnly = true;
 
+   // Converts a recorded MP4 file to raw H264, for the offline player
+   if ( argc >= 4 && 0 == strcmp(argv[1], "-extract") )
+   {
+      log_line("Extracting H264 stream from %s to %s", argv[2], argv[3]);
+      int iFrames = mp4_file_extract_h264(argv[2], argv[3]);
+      if ( iFrames < 0 )
+         log_softerror_and_alarm("Failed to extract H264 stream from %s", argv[2]);
+      else
+         log_line("Extracted %d video frames.", iFrames);
+      return (0);
+   }
+
    if ( argc >= 2 )
    {
       strcpy(szFileInfo, argv[1]);
@@ -13,6 +13,7 @@ Code written by: Petru Soroaga, 2021-2023
 #include "../base/base.h"
 #include "../base/flags.h"
 #include "../base/encr.h"
+#include "../base/encr_aead.h"
 #include "../base/commands.h"
 #include "../common/radio_stats.h"
 #include "../common/string_utils.h"
@@ -20,13 +21,18 @@ Code written by: Petru Soroaga, 2021-2023
 #include "timers.h"
 #include "processor_tx_video.h"
 #include "video_link_stats_overwrites.h"
+#include "radio_tx_routes.h"
 
 #include "../radio/radiopackets2.h"
 #include "../radio/radiolink.h"
+#include "../radio/radio_packets_chain.h"
 
 extern t_packet_queue s_QueueRadioPacketsOut;
 
 static u8 s_RadioRawPacket[MAX_PACKET_TOTAL_SIZE];
+// Both keep room for the radio headers before the packets, so they are sent without copying them again
+static u8 s_RadioTxFrame[RADIO_TX_TEMPLATE_MAX_HEADER + MAX_PACKET_TOTAL_SIZE];
+static u8 s_RadioSealedFrame[RADIO_TX_TEMPLATE_MAX_HEADER + MAX_PACKET_TOTAL_SIZE];
 
 static u32 s_StreamsCurrentPacketIndex[MAX_RADIO_STREAMS];
 static u16 s_LastPacketTxTime[MAX_RADIO_INTERFACES];
@@ -47,6 +53,11 @@ u32 s_uLastAlarmsRepeatCount = 0;
 u32 s_uLastAlarmsTime = 0;
 u32 s_uLastAlarmsCount = 0;
 
+u8* get_radio_tx_frame_packets_buffer()
+{
+   return s_RadioTxFrame + RADIO_TX_TEMPLATE_MAX_HEADER;
+}
+
 u32 get_stream_next_packet_index(int iStreamId)
 {
    u32 uVal = s_StreamsCurrentPacketIndex[iStreamId];
@@ -200,12 +211,12 @@ int send_packet_to_radio_interfaces(u8* pPacketData, int nPacketLength)
    memset(iCountChainedPackets, 0, MAX_RADIO_STREAMS*sizeof(int));
    memset(iTotalBytesOnEachStream, 0, MAX_RADIO_STREAMS*sizeof(int));
 
-   u8* pData = pPacketData;
-   int nLength = nPacketLength;
-   
-   while ( nLength > 0 )
+   t_packets_chain_iterator chainIterator;
+   t_packet_header* pPH = NULL;
+   packets_chain_iterator_init(&chainIterator, pPacketData, nPacketLength);
+   while ( NULL != (pPH = packets_chain_iterator_next(&chainIterator)) )
    {
-      t_packet_header* pPH = (t_packet_header*)pData;
+      u8* pData = (u8*)pPH;
 
       if ( 0 == uFirstPacketType )
          uFirstPacketType = pPH->packet_type;
@@ -233,11 +244,17 @@ int send_packet_to_radio_interfaces(u8* pPacketData, int nPacketLength)
       
       if ( uStreamId >= STREAM_ID_VIDEO_1 )
          bHasVideoPacket = true;
+   }
 
-      nLength -= pPH->total_length;
-      pData += pPH->total_length;
+   if ( chainIterator.iError != PACKETS_CHAIN_OK )
+   {
+      log_softerror_and_alarm("Invalid chained packets to send (error %d after %d packets, %d bytes). Packet not sent.", chainIterator.iError, chainIterator.iCountPackets, nPacketLength);
+      return 0;
    }
 
+   // Packets composed in the radio TX frame (or sealed in the sealed frame) have room for the radio headers before them
+   bool bHasRadioHeadersRoom = (pPacketData == get_radio_tx_frame_packets_buffer());
+
    int be = 0;
    if ( g_pCurrentModel->enc_flags != MODEL_ENC_FLAGS_NONE )
    if ( hpp() )
@@ -254,6 +271,22 @@ int send_packet_to_radio_interfaces(u8* pPacketData, int nPacketLength)
       }
    }
 
+   // Encrypt (and authenticate) once, for all the radio interfaces, if the controller can open sealed packets.
+   // Falls back to per interface buffer encryption for older controllers or if the sealed packets don't fit.
+   if ( be && g_bControllerCanOpenSealedPackets )
+   {
+      int iSealedLength = encr_aead_seal_packets(pPacketData, nPacketLength, s_RadioSealedFrame + RADIO_TX_TEMPLATE_MAX_HEADER, MAX_PACKET_TOTAL_SIZE);
+      if ( iSealedLength > 0 )
+      {
+         pPacketData = s_RadioSealedFrame + RADIO_TX_TEMPLATE_MAX_HEADER;
+         nPacketLength = iSealedLength;
+         bHasRadioHeadersRoom = true;
+         be = 0;
+      }
+      else
+         bHasRadioHeadersRoom = false;
+   }
+
    // Send packet on all radio links that can send this packet
    // Exception: Ping reply packet is sent only on the associated radio link for this ping
 
@@ -261,78 +294,41 @@ int send_packet_to_radio_interfaces(u8* pPacketData, int nPacketLength)
 
    bool bPacketSent = false;
 
-   for( int iRadioLinkId=0; iRadioLinkId<g_pCurrentModel->radioLinksParams.links_count; iRadioLinkId++ )
+   int iRoutesCount = radio_tx_routes_get_count();
+   for( int iRoute=0; iRoute<iRoutesCount; iRoute++ )
    {
-      if ( g_pCurrentModel->radioLinksParams.link_capabilities_flags[iRadioLinkId] & RADIO_HW_CAPABILITY_FLAG_DISABLED )
-         continue;
+      t_radio_tx_route* pRoute = radio_tx_routes_get(iRoute);
+      int iRadioLinkId = pRoute->iRadioLinkId;
+      int iRadioInterfaceIndex = pRoute->iRadioInterfaceIndex;
 
       if ( bHasPingPacket && (uPingRadioLinkId != 0xFF) )
       if ( iRadioLinkId != (int) uPingRadioLinkId )
          continue;
 
       // Do not send regular packets to controller using relay links
-      if ( g_pCurrentModel->radioLinksParams.link_capabilities_flags[iRadioLinkId] & RADIO_HW_CAPABILITY_FLAG_USED_FOR_RELAY )
-         continue;
-
-      if ( !(g_pCurrentModel->radioLinksParams.link_capabilities_flags[iRadioLinkId] & RADIO_HW_CAPABILITY_FLAG_CAN_TX) )
-         continue;
-
-      if ( bHasVideoPacket )
-      if ( ! (g_pCurrentModel->radioLinksParams.link_capabilities_flags[iRadioLinkId] & RADIO_HW_CAPABILITY_FLAG_CAN_USE_FOR_VIDEO) )
+      if ( pRoute->uFlags & RADIO_TX_ROUTE_FLAG_RELAY )
          continue;
 
-      if ( ! bHasVideoPacket )
-      if ( ! (g_pCurrentModel->radioLinksParams.link_capabilities_flags[iRadioLinkId] & RADIO_HW_CAPABILITY_FLAG_CAN_USE_FOR_DATA) )
+      if ( bHasVideoPacket && (!(pRoute->uFlags & RADIO_TX_ROUTE_FLAG_VIDEO)) )
          continue;
-
-      int iRadioInterfaceIndex = -1;
-      for( int k=0; k<g_pCurrentModel->radioInterfacesParams.interfaces_count; k++ )
-         if ( g_pCurrentModel->radioInterfacesParams.interface_link_id[k] == iRadioLinkId )
-         {
-            iRadioInterfaceIndex = k;
-            break;
-         }
-      if ( iRadioInterfaceIndex < 0 )
+      if ( (!bHasVideoPacket) && (!(pRoute->uFlags & RADIO_TX_ROUTE_FLAG_DATA)) )
          continue;
 
-
-      radio_hw_info_t* pRadioHWInfo = hardware_get_radio_info(iRadioInterfaceIndex);
-      if ( ! pRadioHWInfo->openedForWrite )
-         continue;
-      if ( g_pCurrentModel->radioInterfacesParams.interface_capabilities_flags[iRadioInterfaceIndex] & RADIO_HW_CAPABILITY_FLAG_DISABLED )
-         continue;
-      if ( !(g_pCurrentModel->radioInterfacesParams.interface_capabilities_flags[iRadioInterfaceIndex] & RADIO_HW_CAPABILITY_FLAG_CAN_TX) )
-         continue;
-      if ( bHasVideoPacket && (!(g_pCurrentModel->radioInterfacesParams.interface_capabilities_flags[iRadioInterfaceIndex] & RADIO_HW_CAPABILITY_FLAG_CAN_USE_FOR_VIDEO)) )
-         continue;
-      if ( (!bHasVideoPacket) && (!(g_pCurrentModel->radioInterfacesParams.interface_capabilities_flags[iRadioInterfaceIndex] & RADIO_HW_CAPABILITY_FLAG_CAN_USE_FOR_DATA)) )
-         continue;
-      
       u32 microT = get_current_timestamp_micros();
 
       // Send radio packet over SiK radios as individual packets
 
-      if ( hardware_radio_index_is_sik_radio(iRadioInterfaceIndex) )
+      if ( pRoute->uFlags & RADIO_TX_ROUTE_FLAG_SIK )
       {
-         pData = pPacketData;
-         nLength = nPacketLength;
          s_LastTxDataRates[iRadioInterfaceIndex][1] = g_pCurrentModel->radioInterfacesParams.interface_datarates[iRadioInterfaceIndex][1];
-         while ( nLength > 0 )
+         packets_chain_iterator_init(&chainIterator, pPacketData, nPacketLength);
+         while ( NULL != (pPH = packets_chain_iterator_next(&chainIterator)) )
          {
-            t_packet_header* pPH = (t_packet_header*)pData;
             if ( ! radio_can_send_packet_on_slow_link(iRadioLinkId, pPH->packet_type, 0, g_TimeNow) )
-            {
-               nLength -= pPH->total_length;
-               pData += pPH->total_length;
                continue;
-            }
             int iOutLen = radio_buffer_embed_packet_to_short_packet(pPH, s_RadioRawPacket, MAX_PACKET_TOTAL_SIZE);
             if ( iOutLen < (int)sizeof(t_packet_header_short) )
-            {
-               nLength -= pPH->total_length;
-               pData += pPH->total_length;
                continue;
-            }
             u32 uStreamId = (pPH->stream_packet_idx) >> PACKET_FLAGS_MASK_SHIFT_STREAM_INDEX;
 
             if ( radio_write_sik_packet(iRadioInterfaceIndex, s_RadioRawPacket, iOutLen) > 0 )
@@ -346,24 +342,14 @@ int send_packet_to_radio_interfaces(u8* pPacketData, int nPacketLength)
             }   
             else
                log_softerror_and_alarm("Failed to write to SiK radio interface %d.", iRadioInterfaceIndex+1);
-            nLength -= pPH->total_length;
-            pData += pPH->total_length;
          }
          continue;
       }
       
       nRateTx = _compute_packet_datarate(bHasVideoPacket, bIsRetransmited, iRadioLinkId, iRadioInterfaceIndex);
-      radio_set_out_datarate(nRateTx);
-
-      u32 radioFlags = g_pCurrentModel->radioInterfacesParams.interface_current_radio_flags[iRadioInterfaceIndex];
-      if ( ! (radioFlags & RADIO_FLAGS_APPLY_MCS_FLAGS_ON_VEHICLE) )
-      {
-         radioFlags &= ~(RADIO_FLAGS_STBC | RADIO_FLAGS_LDPC | RADIO_FLAGS_SHORT_GI | RADIO_FLAGS_HT40);
-         radioFlags |= RADIO_FLAGS_HT20;
-      }
-      radio_set_frames_flags(radioFlags);
 
       int totalLength = 0;
+      u8* pRawPacket = s_RadioRawPacket;
       if ( s_iPendingFrequencyChangeLinkId >= 0 && s_uPendingFrequencyChangeTo > 100 && s_uTimeFrequencyChangeRequest != 0 && g_TimeNow > s_uTimeFrequencyChangeRequest && s_uTimeFrequencyChangeRequest >= g_TimeNow - VEHICLE_SWITCH_FREQUENCY_AFTER_MS )
       {
          u8 extraData[32];
@@ -375,12 +361,14 @@ int send_packet_to_radio_interfaces(u8* pPacketData, int nPacketLength)
             extraData[4] = EXTRA_PACKET_INFO_TYPE_FREQ_CHANGE_LINK3;
          extraData[5] = 6;
          //log_line("Sending extra data: %d %d, %d, %d, %d, %d", extraData[5], extraData[4], extraData[3], extraData[2], extraData[1], extraData[0]);
-         totalLength = radio_build_packet(s_RadioRawPacket, pPacketData, nPacketLength, RADIO_PORT_ROUTER_DOWNLINK, be, 6, &extraData[0]);
+         totalLength = radio_tx_routes_build_packet(pRoute, nRateTx, RADIO_PORT_ROUTER_DOWNLINK, s_RadioRawPacket, pPacketData, nPacketLength, be, 6, &extraData[0]);
       }
+      else if ( bHasRadioHeadersRoom && (! be) )
+         totalLength = radio_tx_routes_build_packet_in_place(pRoute, nRateTx, RADIO_PORT_ROUTER_DOWNLINK, pPacketData, nPacketLength, s_RadioRawPacket, &pRawPacket);
       else
-         totalLength = radio_build_packet(s_RadioRawPacket, pPacketData, nPacketLength, RADIO_PORT_ROUTER_DOWNLINK, be, 0, NULL);
+         totalLength = radio_tx_routes_build_packet(pRoute, nRateTx, RADIO_PORT_ROUTER_DOWNLINK, s_RadioRawPacket, pPacketData, nPacketLength, be, 0, NULL);
 
-      if ( radio_write_packet(iRadioInterfaceIndex, s_RadioRawPacket, totalLength) )
+      if ( radio_write_packet(iRadioInterfaceIndex, pRawPacket, totalLength) )
       {       
          s_LastPacketTxTime[iRadioInterfaceIndex] = get_current_timestamp_micros() - microT;
          s_LastPacketsSumTxTime[iRadioInterfaceIndex] += s_LastPacketTxTime[iRadioInterfaceIndex];
@@ -468,6 +456,7 @@ int send_packet_to_radio_interfaces(u8* pPacketData, int nPacketLength)
    {
       s_countTXDataPacketsOutTemp += iCountChainedPackets[STREAM_ID_DATA];
       s_countTXCompactedPacketsOutTemp++;
+      process_data_tx_video_on_other_packet_sent(nPacketLength);
    }
 
    s_bSentAnyPacket = true;
@@ -2,6 +2,8 @@
 #include "../base/base.h"
 
 int send_packet_to_radio_interfaces(u8* pPacketData, int nPacketLength);
+// Packets composed here (up to MAX_PACKET_TOTAL_SIZE bytes) are sent without being copied again to the raw radio packets
+u8* get_radio_tx_frame_packets_buffer();
 u32 get_stream_next_packet_index(int iStreamId);
 int get_last_tx_used_datarate(int iInterface, int iType);
 int get_last_tx_video_datarate_mbps();
@@ -13,6 +13,7 @@ Code written by: Petru Soroaga, 2021-2023
 #include "parse_fc_telemetry_ltm.h"
 #include <math.h>
 #include "../../mavlink/common/mavlink.h"
+#include "../common/mavlink_frames.h"
 #include "../base/models.h"
 #include "../radio/radiopackets2.h"
 #include "shared_vars.h"
@@ -109,11 +110,28 @@ typedef enum ROVER_MODE
 } ROVER_MODE;
 #endif
  
-mavlink_status_t statusMav;
 mavlink_message_t msgMav;
 u32 s_vehicleMavId = 1;
 static int s_iAllowAnyVehicleSysId = 0;
 
+typedef struct
+{
+   t_packet_header_fc_telemetry* pphfct;
+   t_packet_header_ruby_telemetry_extended_v2* pPHRTE;
+   u8 vehicleType;
+} t_mav_parse_context;
+
+static t_mavlink_frame_extractor s_MAVLinkFrameExtractor;
+
+void _process_mav_message(t_packet_header_fc_telemetry* pdpfct, t_packet_header_ruby_telemetry_extended_v2* pPHRTE, u8 vehicleType);
+
+void _on_mav_frame(const u8* pFrame, int iFrameLength, u32 uMsgId, void* pContext)
+{
+   t_mav_parse_context* pParseContext = (t_mav_parse_context*)pContext;
+   mavlink_frames_to_message(pFrame, iFrameLength, &msgMav);
+   _process_mav_message(pParseContext->pphfct, pParseContext->pPHRTE, pParseContext->vehicleType);
+}
+
 
 void _rotate_point(float x, float y, float xCenter, float yCenter, float angle, float* px, float* py)
 {
@@ -141,6 +159,17 @@ void parse_telemetry_init(u32 vehicleMavId)
 
    s_szLastMessage[0] = 0;
    s_LastMessageTime = 0;
+
+   // Only the messages decoded by _process_mav_message get a handler, all other frames are just validated and skipped
+   mavlink_frames_init(&s_MAVLinkFrameExtractor);
+   u32 uHandledIds[] = { MAVLINK_MSG_ID_STATUSTEXT, MAVLINK_MSG_ID_STATUSTEXT_LONG, MAVLINK_MSG_ID_HEARTBEAT,
+      MAVLINK_MSG_ID_BATTERY_STATUS, MAVLINK_MSG_ID_SYS_STATUS, MAVLINK_MSG_ID_GLOBAL_POSITION_INT,
+      MAVLINK_MSG_ID_GPS_RAW_INT, MAVLINK_MSG_ID_GPS2_RAW, MAVLINK_MSG_ID_VFR_HUD, MAVLINK_MSG_ID_ATTITUDE,
+      MAVLINK_MSG_ID_RC_CHANNELS_RAW, MAVLINK_MSG_ID_RC_CHANNELS, MAVLINK_MSG_ID_RADIO_STATUS,
+      MAVLINK_MSG_ID_RAW_IMU, MAVLINK_MSG_ID_SCALED_IMU, MAVLINK_MSG_ID_HIGH_LATENCY, MAVLINK_MSG_ID_HIGH_LATENCY2,
+      MAVLINK_MSG_ID_SCALED_PRESSURE, MAVLINK_MSG_ID_WIND_COV, MAVLINK_MSG_ID_PARAM_VALUE };
+   for( int i=0; i<(int)(sizeof(uHandledIds)/sizeof(uHandledIds[0])); i++ )
+      mavlink_frames_set_handler(&s_MAVLinkFrameExtractor, uHandledIds[i], _on_mav_frame);
 }
 
 void parse_telemetry_allow_any_sysid(int iAllow)
@@ -599,22 +628,17 @@ bool parse_telemetry_from_fc( u8* buffer, int length, t_packet_header_fc_telemet
    if ( telemetry_type == TELEMETRY_TYPE_LTM )
       return parse_telemetry_from_fc_ltm(buffer, length, pphfct, pPHRTE, vehicleType);
 
-   //log_line("parsing %d bytes", length);
-   //printf("\nparsing %d bytes", length);
-   bool ret = false;
-   uint8_t c;
-   for( int i=0; i<length; i++)
+   t_mav_parse_context parseContext;
+   parseContext.pphfct = pphfct;
+   parseContext.pPHRTE = pPHRTE;
+   parseContext.vehicleType = vehicleType;
+
+   if ( mavlink_frames_parse(&s_MAVLinkFrameExtractor, buffer, length, &parseContext) > 0 )
    {
-      c = *buffer;
-      buffer++;
-      if (mavlink_parse_char(0, c, &msgMav, &statusMav))
-      {
-         g_TimeLastMessageFromFC = g_TimeNow;
-         ret = true;
-         _process_mav_message(pphfct, pPHRTE, vehicleType);
-      }
+      g_TimeLastMessageFromFC = g_TimeNow;
+      return true;
    }
-   return ret;
+   return false;
 }
 
 bool has_received_gps_info()
@@ -39,6 +39,7 @@ Code written by: Petru Soroaga, 2021-2023
 #include "video_link_check_bitrate.h"
 #include "video_link_auto_keyframe.h"
 #include "relay_rx.h"
+#include "radio_tx_routes.h"
 
 
 u32 _get_previous_frequency_switch(int nLink)
@@ -383,6 +384,7 @@ void process_local_control_packet(t_packet_header* pPH)
 
       if ( ! g_pCurrentModel->loadFromFile(FILE_CURRENT_VEHICLE_MODEL, false) )
          log_error_and_alarm("Can't load current model vehicle.");
+      radio_tx_routes_invalidate();
 
       if ( changeType == MODEL_CHANGED_CONTROLLER_TELEMETRY )
       {
@@ -649,7 +651,7 @@ void process_local_control_packet(t_packet_header* pPH)
          if ( g_pCurrentModel->audio_params.has_audio_device && g_pCurrentModel->audio_params.enabled )
          {
             log_line("Opening audio input stream: %s", FIFO_RUBY_AUDIO1);
-            s_fInputAudioStream = open(FIFO_RUBY_AUDIO1, O_RDONLY);
+            s_fInputAudioStream = open(FIFO_RUBY_AUDIO1, O_RDONLY | O_NONBLOCK);
             if ( s_fInputAudioStream < 0 )
                log_softerror_and_alarm("Failed to open audio input stream: %s", FIFO_RUBY_AUDIO1);
             else
@@ -5,6 +5,7 @@
 #include "../base/hw_procs.h"
 #include "../base/launchers.h"
 #include "../base/ruby_ipc.h"
+#include "../base/encr_aead.h"
 #include "../common/radio_stats.h"
 #include "../common/string_utils.h"
 #include "../radio/radiolink.h"
@@ -576,6 +577,25 @@ void _process_received_full_radio_packet(int iInterfaceIndex)
          return;
       }
 
+      // Sealed packets shrink when opened: move to the next packet by the received length
+      int iReceivedPacketLength = pPH->total_length;
+      if ( encr_aead_is_sealed_packet(pData) )
+      {
+         if ( 0 == encr_aead_open_packet(pData, nLength) )
+         {
+            if ( g_TimeNow > g_UplinkInfoRxStats[iInterfaceIndex].timeLastLogWrongRxPacket + 2000 )
+            {
+               g_UplinkInfoRxStats[iInterfaceIndex].timeLastLogWrongRxPacket = g_TimeNow;
+               log_softerror_and_alarm("Received encrypted packet that failed authentication (type: %d, %d bytes).", pPH->packet_type, iReceivedPacketLength);
+            }
+            pData += iReceivedPacketLength;
+            nLength -= iReceivedPacketLength;
+            continue;
+         }
+         // A controller that seals its packets can open ours
+         g_bControllerCanOpenSealedPackets = true;
+      }
+
       _mark_link_from_controller_present();
       
       u32 uStreamId = (pPH->stream_packet_idx)>>PACKET_FLAGS_MASK_SHIFT_STREAM_INDEX;
@@ -597,8 +617,8 @@ void _process_received_full_radio_packet(int iInterfaceIndex)
       if ( (s_StreamsMaxReceivedPacketIndex[uStreamId] != MAX_U32) && (s_StreamsMaxReceivedPacketIndex[uStreamId] > 10) )
       if ( (pPH->stream_packet_idx & PACKET_FLAGS_MASK_STREAM_PACKET_IDX) < s_StreamsMaxReceivedPacketIndex[uStreamId]-10 )
       {
-         pData += pPH->total_length;
-         nLength -= pPH->total_length;
+         pData += iReceivedPacketLength;
+         nLength -= iReceivedPacketLength;
          continue;   
       }
       
@@ -614,8 +634,8 @@ void _process_received_full_radio_packet(int iInterfaceIndex)
       }
 
       _process_received_radio_packet(iInterfaceIndex, pData, pPH->total_length);
-      pData += pPH->total_length;
-      nLength -= pPH->total_length;
+      pData += iReceivedPacketLength;
+      nLength -= iReceivedPacketLength;
    }
 
    #ifdef PROFILE_RX
@@ -90,6 +90,12 @@ int process_received_ruby_message(u8* pPacketBuffer)
 
       g_bReceivedPairingRequest = true;
       g_uControllerId = pPH->vehicle_id_src;
+
+      // Older controllers can't parse sealed packets: keep the legacy encryption for them
+      bool bCanOpenSealedPackets = (pPH->extra_flags & PACKET_EXTRA_FLAGS_VALID) && (pPH->extra_flags & PACKET_EXTRA_FLAGS_BIT_CAN_OPEN_AEAD);
+      if ( bCanOpenSealedPackets != g_bControllerCanOpenSealedPackets )
+         log_line("Controller %s sealed (AEAD) packets.", bCanOpenSealedPackets?"can open":"can't open");
+      g_bControllerCanOpenSealedPackets = bCanOpenSealedPackets;
       if ( g_pCurrentModel->controller_id != g_uControllerId )
       {
          g_pCurrentModel->controller_id = g_uControllerId;
@@ -16,25 +16,17 @@ Code written by: Petru Soroaga, 2021-2023
 #include "../radio/radiopackets2.h"
 #include "../radio/radiolink.h"
 #include "../radio/radiopacketsqueue.h"
-#include "../radio/fec.h" 
+#include "../common/audio_link.h"
 #include "radio_utils.h"
 #include "packets_utils.h"
 #include "shared_vars.h"
 #include "timers.h"
 
-
-u8 s_BufferAudio[MAX_AUDIO_PACKETS][MAX_PACKET_PAYLOAD];
-u8 s_BufferAudioFEC[10][MAX_PACKET_PAYLOAD];
-u32 s_BufferAudioCurrentWritePacket = 0;
-u32 s_BufferAudioWritePosition = 0;
-u32 s_BufferAudioTimeLastRead = 0;
+t_audio_tx_buffer s_AudioTxBuffer;
+bool s_bAudioTxBufferInitialized = false;
 u32 s_BufferAudioTimeLastKbps = 0;
 u32 s_BufferAudioDataCount = 0;
 u32 s_BufferAudioKbps = 0;
-u32 s_AudioSegmentIndex = 0;
-
-u8* p_fec_audio_packets[MAX_DATA_PACKETS_IN_BLOCK];
-u8* p_fec_audio_fecs[MAX_FECS_PACKETS_IN_BLOCK];
 
 
 u32 get_audio_bps()
@@ -42,40 +34,28 @@ u32 get_audio_bps()
    return s_BufferAudioKbps*1000;
 }
 
+// Reads all the audio captured so far straight into the ring buffer.
+// The capture pipe is opened non blocking, so this is called on every main loop and just returns when there is nothing to read.
 int try_read_audio_input(int fStream)
 {
    if ( -1 == fStream )
       return 0;
-   if ( g_TimeNow < s_BufferAudioTimeLastRead + 10 )
-      return 0;
-   s_BufferAudioTimeLastRead = g_TimeNow;
-
-   fd_set readset;
-   u8 buffer[MAX_PACKET_PAYLOAD];
-   u32 maxSegmentSize = MAX_PACKET_PAYLOAD-sizeof(u32);
-
-   FD_ZERO(&readset);
-   FD_SET(fStream, &readset);
-
-   struct timeval timePipeInput;
-   timePipeInput.tv_sec = 0;
-   timePipeInput.tv_usec = 100; // 0.1 miliseconds timeout
-
-   int selectResult = select(fStream+1, &readset, NULL, NULL, &timePipeInput);
-   if ( selectResult <= 0 )
-      return 0;
 
-   if( 0 == FD_ISSET(fStream, &readset) )
-      return 0;
+   if ( ! s_bAudioTxBufferInitialized )
+   {
+      audio_tx_buffer_init(&s_AudioTxBuffer);
+      s_bAudioTxBufferInitialized = true;
+   }
 
-   int count = read(fStream, buffer, maxSegmentSize);
+   u32 uSegmentsDropped = s_AudioTxBuffer.uSegmentsDropped;
+   int count = audio_tx_buffer_read(&s_AudioTxBuffer, fStream);
    if ( count < 0 )
    {
-      log_error_and_alarm("Failed to read from audio input fifo: %s, returned code: %d, error: %s", FIFO_RUBY_AUDIO1, count, strerror(errno));
+      log_error_and_alarm("Failed to read from audio input fifo: %s, error: %s", FIFO_RUBY_AUDIO1, strerror(errno));
       return -1;
    }
-   if ( count == 0 )
-      return 0;
+   if ( s_AudioTxBuffer.uSegmentsDropped != uSegmentsDropped )
+      log_softerror_and_alarm("Audio TX buffer full, dropped %u audio segments.", s_AudioTxBuffer.uSegmentsDropped - uSegmentsDropped);
 
    if ( s_BufferAudioTimeLastKbps < g_TimeNow-500 )
    {
@@ -86,42 +66,10 @@ int try_read_audio_input(int fStream)
    }
 
    s_BufferAudioDataCount += count;
-
-   while ( count > 0 )
-   {
-      if ( s_BufferAudioWritePosition + count <= maxSegmentSize )
-      {
-         memcpy(&s_BufferAudio[s_BufferAudioCurrentWritePacket][s_BufferAudioWritePosition], buffer, count );
-         s_BufferAudioWritePosition += count;
-         if ( s_BufferAudioWritePosition == maxSegmentSize )
-         {
-            s_BufferAudioWritePosition = 0;
-            s_BufferAudioCurrentWritePacket++;
-            if ( s_BufferAudioCurrentWritePacket >= MAX_AUDIO_PACKETS )
-               s_BufferAudioCurrentWritePacket = MAX_AUDIO_PACKETS-1;
-         }
-         count = 0;
-         break;
-      }
-      u32 dx = (maxSegmentSize-s_BufferAudioWritePosition);
-      memcpy(&s_BufferAudio[s_BufferAudioCurrentWritePacket][s_BufferAudioWritePosition], buffer, dx );
-      s_BufferAudioWritePosition += dx;
-      count -= dx;
-      for( int i= 0; i<count; i++ )
-         buffer[i] = buffer[i+dx];
-
-      if ( s_BufferAudioWritePosition >= maxSegmentSize )
-      {
-         s_BufferAudioWritePosition = 0;
-         s_BufferAudioCurrentWritePacket++;
-         if ( s_BufferAudioCurrentWritePacket >= MAX_AUDIO_PACKETS )
-            s_BufferAudioCurrentWritePacket = MAX_AUDIO_PACKETS-1;
-      }
-   }
-   return 0;
+   return count;
 }
 
-void send_first_audio_packet()
+void _send_audio_segment(u32 uSegmentIndex, u8* pData, int iLength, void* pContext)
 {
    t_packet_header PH;
    PH.packet_flags = PACKET_COMPONENT_AUDIO;
@@ -130,99 +78,34 @@ void send_first_audio_packet()
    PH.vehicle_id_src = g_pCurrentModel->vehicle_id;
    PH.vehicle_id_dest = 0;
    PH.total_headers_length = sizeof(t_packet_header);
-   PH.total_length = sizeof(t_packet_header) + MAX_PACKET_PAYLOAD;
+   PH.total_length = sizeof(t_packet_header) + sizeof(u32) + iLength;
 
    u8 packet[MAX_PACKET_TOTAL_SIZE];
    memcpy(packet, (u8*)&PH, sizeof(t_packet_header));
-   memcpy(packet+sizeof(t_packet_header), (u8*)&s_AudioSegmentIndex, sizeof(u32));
-   memcpy(packet+sizeof(t_packet_header)+sizeof(u32), &s_BufferAudio[0][0], MAX_PACKET_PAYLOAD-sizeof(u32));
+   memcpy(packet+sizeof(t_packet_header), (u8*)&uSegmentIndex, sizeof(u32));
+   memcpy(packet+sizeof(t_packet_header)+sizeof(u32), pData, iLength);
 
    send_packet_to_radio_interfaces(packet, PH.total_length);
-
-   s_AudioSegmentIndex += 0xFF;
-
-   for( u32 i=0; i<s_BufferAudioCurrentWritePacket; i++ )
-      memcpy(&s_BufferAudio[i][0], &s_BufferAudio[i+1][0], MAX_PACKET_PAYLOAD);
-   s_BufferAudioCurrentWritePacket--;
 }
 
+// Sends all the complete blocks captured so far, each as soon as it is complete
 int send_audio_packets()
 {
    if ( NULL == g_pCurrentModel || (! g_pCurrentModel->audio_params.has_audio_device) || (! g_pCurrentModel->audio_params.enabled) )
       return 0;
-   
-   u8 data_packets = g_pCurrentModel->audio_params.flags & 0xFF;
-   u8 fec_packets = ( g_pCurrentModel->audio_params.flags >> 8 ) & 0xFF;
-   unsigned int packetLength = MAX_PACKET_PAYLOAD - sizeof(u32);
-
-   //log_line("Sending audio encoding blocks: %d/%d, len: %d", data_packets, fec_packets, packetLength);
-   if ( fec_packets > 10 )
-      fec_packets = 10;
-
-   if ( 0 == fec_packets )
-   {
-      int countSent = 0;
-      int maxCountAudio = 3;
-      while( s_BufferAudioCurrentWritePacket > 0 && maxCountAudio > 0 )
-      {
-         send_first_audio_packet();
-         maxCountAudio--;
-         countSent++;
-      }
-      return countSent;
-   }
-
-   // Enough packets for a block ?
-   if ( s_BufferAudioCurrentWritePacket <= data_packets )
+   if ( ! s_bAudioTxBufferInitialized )
       return 0;
 
-   // Generate FEC packets
+   int data_packets = g_pCurrentModel->audio_params.flags & 0xFF;
+   int fec_packets = ( g_pCurrentModel->audio_params.flags >> 8 ) & 0xFF;
 
-   for( int i=0; i<data_packets; i++ )
-      p_fec_audio_packets[i] = &s_BufferAudio[i][0];
-
-   for( int i=0; i<fec_packets; i++ )
-      p_fec_audio_fecs[i] = &s_BufferAudioFEC[i][0];
-
-   fec_encode(packetLength, p_fec_audio_packets, (unsigned int)data_packets, p_fec_audio_fecs, (unsigned int)fec_packets);
-
-   t_packet_header PH;
-   PH.packet_flags = PACKET_COMPONENT_AUDIO;
-   PH.packet_type =  PACKET_TYPE_AUDIO_SEGMENT;
-   PH.stream_packet_idx = (STREAM_ID_VIDEO_1) << PACKET_FLAGS_MASK_SHIFT_STREAM_INDEX;
-   PH.vehicle_id_src = g_pCurrentModel->vehicle_id;
-   PH.vehicle_id_dest = 0;
-   PH.total_headers_length = sizeof(t_packet_header);
-   PH.total_length = sizeof(t_packet_header) + MAX_PACKET_PAYLOAD;
-
-   u8 packet[MAX_PACKET_TOTAL_SIZE];
-
-   for( int i=0; i<data_packets; i++ )
+   int countSent = 0;
+   while ( true )
    {
-      memcpy(packet, (u8*)&PH, sizeof(t_packet_header));
-      memcpy(packet+sizeof(t_packet_header), (u8*)&s_AudioSegmentIndex, sizeof(u32));
-      memcpy(packet+sizeof(t_packet_header)+sizeof(u32), &s_BufferAudio[i][0], MAX_PACKET_PAYLOAD-sizeof(u32));
-
-      send_packet_to_radio_interfaces(packet, PH.total_length);
-      s_AudioSegmentIndex++;
-
-      for( u32 i=0; i<s_BufferAudioCurrentWritePacket; i++ )
-         memcpy(&s_BufferAudio[i][0], &s_BufferAudio[i+1][0], MAX_PACKET_PAYLOAD);
-      s_BufferAudioCurrentWritePacket--;
-   }
-
-   for( int i=0; i<fec_packets; i++ )
-   {
-      memcpy(packet, (u8*)&PH, sizeof(t_packet_header));
-      memcpy(packet+sizeof(t_packet_header), (u8*)&s_AudioSegmentIndex, sizeof(u32));
-      memcpy(packet+sizeof(t_packet_header)+sizeof(u32), &s_BufferAudioFEC[i][0], MAX_PACKET_PAYLOAD-sizeof(u32));
-
-      send_packet_to_radio_interfaces(packet, PH.total_length);
-      s_AudioSegmentIndex++;
+      int count = audio_tx_buffer_send_block(&s_AudioTxBuffer, data_packets, fec_packets, _send_audio_segment, NULL);
+      if ( count <= 0 )
+         break;
+      countSent += count;
    }
-
-   u32 block = s_AudioSegmentIndex >> 8;
-   block++;
-   s_AudioSegmentIndex = block << 8;
-   return data_packets;
-}
\ No newline at end of file
+   return countSent;
+}
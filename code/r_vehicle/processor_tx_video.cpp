@@ -16,6 +16,8 @@ Code written by: Petru Soroaga, 2021-2023
 #include "../radio/radiopackets2.h"
 #include "../radio/fec.h"
 #include "../base/camera_utils.h"
+#include "../base/latency_trace.h"
+#include "../common/tx_pacer.h"
 #include "shared_vars.h"
 #include "timers.h"
 
@@ -61,6 +63,12 @@ bool s_bPendingEncodingSwitch = false;
 static u32 sTimeLastFecTimeCalculation = 0;
 static u32 sTimeTotalFecTimeMicroSec = 0;
 
+// Video packets go to radio through the pacer, so a video block (or an I-frame) is spread over a few ms
+// instead of being written back to back to the radio interfaces.
+static t_tx_pacer s_TxVideoPacer;
+static u32 s_uTimeLastTxVideoPacerUpdate = 0;
+static u32 s_uTimeLastTxVideoPacerStatsLog = 0;
+
 u32 s_uParseNALStartSequence = MAX_U32;
 u32 s_uParseNALCurrentSlices = 0;
 u32 s_uParseNALStartSequenceRadioOut = MAX_U32;
@@ -604,6 +612,38 @@ bool _inject_faults(int bufferIndex, u32 streamPacketIndex, int packetIndex, boo
    return false;
 }
 
+static int _send_paced_video_packet(u8* pPacketData, int iPacketLength, void* pContext)
+{
+   LATENCY_TRACE_BEGIN(uTraceSend);
+   send_packet_to_radio_interfaces(pPacketData, iPacketLength);
+   LATENCY_TRACE_END(LATENCY_TRACE_STAGE_VEHICLE_SEND_TO_RADIO, uTraceSend);
+   return 1;
+}
+
+// Pacing rate from the video bitrate (data + EC) and the slowest radio datarate used for video.
+// Not paced when there is no video to pace.
+
+static void _update_tx_video_pacer()
+{
+   u32 uRateBPS = 0;
+   if ( (NULL != g_pProcessorTxVideo) && (NULL != g_pCurrentModel) && g_pCurrentModel->hasCamera() && (! g_bVideoPaused) && (! s_bPauseVideoPacketsTX) )
+   {
+      u32 uVideoBitrate = g_pProcessorTxVideo->getCurrentTotalVideoBitrateAverage500Ms();
+      u32 uRadioDataRate = ((u32)get_last_tx_video_datarate_mbps())*1000*1000;
+      uRateBPS = tx_pacer_compute_rate(uVideoBitrate, uRadioDataRate);
+   }
+
+   if ( (0 == uRateBPS) && (0 != s_TxVideoPacer.uRateBPS) )
+      log_line("[TxPacer] Video pacing disabled.");
+   if ( (0 != uRateBPS) && (0 == s_TxVideoPacer.uRateBPS) )
+      log_line("[TxPacer] Video pacing enabled at %u kbps.", uRateBPS/1000);
+
+   // Not paced: what is still queued goes out at the next send_ready, unless tx is paused
+   if ( g_bVideoPaused || s_bPauseVideoPacketsTX )
+      tx_pacer_drop_queued(&s_TxVideoPacer);
+   tx_pacer_set_rate(&s_TxVideoPacer, uRateBPS, get_current_timestamp_micros());
+}
+
 // Sends a packet to radio
 
 void _send_packet(int bufferIndex, int packetIndex, bool isRetransmitted, bool isDuplicationPacket, bool isLastBlockToSend)
@@ -719,7 +759,8 @@ void _send_packet(int bufferIndex, int packetIndex, bool isRetransmitted, bool i
    if ( _inject_recoverable_faults(bufferIndex, pHeader->stream_packet_idx, packetIndex, isRetransmitted) )
       return;
 
-   send_packet_to_radio_interfaces(s_BlocksTxBuffers[bufferIndex].packetsInfo[packetIndex].pRawData, s_BlocksTxBuffers[bufferIndex].packetsInfo[packetIndex].packetLength);
+   // The pacer keeps a copy; retransmissions go before the queued video packets
+   tx_pacer_add_packet(&s_TxVideoPacer, s_BlocksTxBuffers[bufferIndex].packetsInfo[packetIndex].pRawData, s_BlocksTxBuffers[bufferIndex].packetsInfo[packetIndex].packetLength, isRetransmitted?1:0, get_current_timestamp_micros());
 
    if ( isRetransmitted )
    {
@@ -998,7 +1039,9 @@ bool _onNewCompletePacketReadFromInput()
          p_fec_data_fecs[i] = ((u8*)s_BlocksTxBuffers[s_currentReadBufferIndex].packetsInfo[s_CurrentPHVF.block_packets+i].pRawData) + sizeof(t_packet_header) + sizeof(t_packet_header_video_full);
 
       u32 tTemp = get_current_timestamp_micros();
+      LATENCY_TRACE_BEGIN(uTraceFEC);
       fec_encode(s_BlocksTxBuffers[s_currentReadBufferIndex].video_data_length, p_fec_data_packets, s_CurrentPHVF.block_packets, p_fec_data_fecs, s_CurrentPHVF.block_fecs);
+      LATENCY_TRACE_END(LATENCY_TRACE_STAGE_VEHICLE_FEC_ENCODE, uTraceFEC);
       tTemp = get_current_timestamp_micros() - tTemp;
       sTimeTotalFecTimeMicroSec += tTemp;
 
@@ -1145,6 +1188,10 @@ bool process_data_tx_video_init()
 
    s_CurrentMaxBlocksInBuffers = MAX_RXTX_BLOCKS_BUFFER;
 
+   tx_pacer_init(&s_TxVideoPacer, _send_paced_video_packet, NULL);
+   s_uTimeLastTxVideoPacerUpdate = 0;
+   s_uTimeLastTxVideoPacerStatsLog = get_current_timestamp_ms();
+
    g_TimeLastVideoPacketIn = get_current_timestamp_ms();
    _log_encoding_scheme();
 
@@ -1153,6 +1200,9 @@ bool process_data_tx_video_init()
 
 bool process_data_tx_video_uninit()
 {
+   tx_pacer_flush(&s_TxVideoPacer, get_current_timestamp_micros());
+   tx_pacer_set_rate(&s_TxVideoPacer, 0, get_current_timestamp_micros());
+
    for( int i=0; i<MAX_RXTX_BLOCKS_BUFFER; i++ )
    for( int k=0; k<MAX_TOTAL_PACKETS_IN_BLOCK; k++ )
    {
@@ -1392,9 +1442,36 @@ bool process_data_tx_video_loop()
 
    g_pProcessorTxVideo->periodicLoop();
 
+   if ( g_TimeNow >= s_uTimeLastTxVideoPacerUpdate + 100 )
+   {
+      s_uTimeLastTxVideoPacerUpdate = g_TimeNow;
+      _update_tx_video_pacer();
+   }
+   if ( g_TimeNow >= s_uTimeLastTxVideoPacerStatsLog + 30000 )
+   {
+      s_uTimeLastTxVideoPacerStatsLog = g_TimeNow;
+      tx_pacer_log_stats(&s_TxVideoPacer, "video");
+   }
+
+   process_data_tx_video_send_paced_packets();
    return true;
 }
 
+int process_data_tx_video_send_paced_packets()
+{
+   return tx_pacer_send_ready(&s_TxVideoPacer, get_current_timestamp_micros());
+}
+
+u32 process_data_tx_video_get_paced_packets_wait_micros()
+{
+   return tx_pacer_get_time_to_next_send(&s_TxVideoPacer, get_current_timestamp_micros());
+}
+
+void process_data_tx_video_on_other_packet_sent(int iPacketLength)
+{
+   tx_pacer_on_bypass_packet_sent(&s_TxVideoPacer, iPacketLength, get_current_timestamp_micros());
+}
+
 u8* process_data_tx_video_get_current_buffer_to_read_pointer()
 {
    return ((u8*)s_BlocksTxBuffers[s_currentReadBufferIndex].packetsInfo[s_currentReadBlockPacketIndex].pRawData)+sizeof(t_packet_header)+sizeof(t_packet_header_video_full) + s_BlocksTxBuffers[s_currentReadBufferIndex].packetsInfo[s_currentReadBlockPacketIndex].currentReadPosition;
@@ -1522,7 +1599,11 @@ bool process_data_tx_video_on_data_read_complete(int countRead)
 
    if ( s_BlocksTxBuffers[s_currentReadBufferIndex].packetsInfo[s_currentReadBlockPacketIndex].currentReadPosition < s_BlocksTxBuffers[s_currentReadBufferIndex].video_data_length )
       return false;
-   return _onNewCompletePacketReadFromInput();
+
+   LATENCY_TRACE_BEGIN(uTraceNewPacket);
+   bool bBlockComplete = _onNewCompletePacketReadFromInput();
+   LATENCY_TRACE_END(LATENCY_TRACE_STAGE_VEHICLE_NEW_VIDEO_PACKET, uTraceNewPacket);
+   return bBlockComplete;
 }
 
 void process_data_tx_video_signal_encoding_changed()
@@ -1540,6 +1621,7 @@ void process_data_tx_video_signal_model_changed()
 void process_data_tx_video_pause_tx()
 {
    s_bPauseVideoPacketsTX = true;
+   tx_pacer_drop_queued(&s_TxVideoPacer);
 }
 
 void process_data_tx_video_resume_tx()
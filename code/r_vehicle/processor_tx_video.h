@@ -59,6 +59,13 @@ int process_data_tx_video_has_block_ready_to_send();
 int process_data_tx_video_get_pending_blocks_to_send_count();
 int process_data_tx_video_send_first_complete_block(bool isLastBlockToSend);
 
+// Video packets are paced to radio. Sends the ones due now; returns how many were sent
+int process_data_tx_video_send_paced_packets();
+// Microseconds until the next paced video packet is due, 0 if due now or none pending
+u32 process_data_tx_video_get_paced_packets_wait_micros();
+// Other packets sent to radio take from the video pacing budget
+void process_data_tx_video_on_other_packet_sent(int iPacketLength);
+
 void process_data_tx_video_signal_encoding_changed();
 void process_data_tx_video_signal_model_changed();
 
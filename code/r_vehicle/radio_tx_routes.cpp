@@ -0,0 +1,187 @@
+/*
+You can use this C/C++ code however you wish (for example, but not limited to:
+     as is, or by modifying it, or by adding new code, or by removing parts of the code;
+     in public or private projects, in new free or commercial products)
+     only if you get a priori written consent from Petru Soroaga (petrusoroaga@yahoo.com) for your specific use
+     and only if this copyright terms are preserved in the code.
+     This code is public for learning and academic purposes.
+Also, check the licences folder for additional licences terms.
+Code written by: Petru Soroaga, 2021-2023
+*/
+
+#include "../base/base.h"
+#include "../base/config.h"
+#include "../base/hardware_radio_sik.h"
+#include "../radio/radiolink.h"
+#include "radio_tx_routes.h"
+#include "shared_vars.h"
+
+static t_radio_tx_route s_RadioTXRoutes[MAX_RADIO_INTERFACES];
+static int s_iRadioTXRoutesCount = 0;
+static bool s_bRadioTXRoutesValid = false;
+static int s_iRadioTXPayloadMode = RADIO_TX_PAYLOAD_MODE_BUILDER;
+
+static u32 s_uRadioTXRoutesRebuilds = 0;
+static u32 s_uRadioTXTemplatesBuilt = 0;
+static u32 s_uRadioTXPacketsFromTemplates = 0;
+static u32 s_uRadioTXPacketsFromBuilder = 0;
+static u32 s_uRadioTXPacketsInPlace = 0;
+
+void radio_tx_routes_invalidate()
+{
+   s_bRadioTXRoutesValid = false;
+}
+
+static void _radio_tx_routes_rebuild()
+{
+   s_iRadioTXRoutesCount = 0;
+   s_bRadioTXRoutesValid = true;
+   s_uRadioTXRoutesRebuilds++;
+   if ( NULL == g_pCurrentModel )
+      return;
+
+   s_iRadioTXPayloadMode = radio_tx_templates_detect_payload_mode();
+
+   for( int iRadioLinkId=0; iRadioLinkId<g_pCurrentModel->radioLinksParams.links_count; iRadioLinkId++ )
+   {
+      u32 uLinkFlags = g_pCurrentModel->radioLinksParams.link_capabilities_flags[iRadioLinkId];
+      if ( uLinkFlags & RADIO_HW_CAPABILITY_FLAG_DISABLED )
+         continue;
+      if ( !(uLinkFlags & RADIO_HW_CAPABILITY_FLAG_CAN_TX) )
+         continue;
+
+      // The radio link is sent on the first radio interface assigned to it
+      int iRadioInterfaceIndex = -1;
+      for( int k=0; k<g_pCurrentModel->radioInterfacesParams.interfaces_count; k++ )
+         if ( g_pCurrentModel->radioInterfacesParams.interface_link_id[k] == iRadioLinkId )
+         {
+            iRadioInterfaceIndex = k;
+            break;
+         }
+      if ( iRadioInterfaceIndex < 0 )
+         continue;
+
+      radio_hw_info_t* pRadioHWInfo = hardware_get_radio_info(iRadioInterfaceIndex);
+      if ( (NULL == pRadioHWInfo) || (! pRadioHWInfo->openedForWrite) )
+         continue;
+      u32 uInterfaceFlags = g_pCurrentModel->radioInterfacesParams.interface_capabilities_flags[iRadioInterfaceIndex];
+      if ( uInterfaceFlags & RADIO_HW_CAPABILITY_FLAG_DISABLED )
+         continue;
+      if ( !(uInterfaceFlags & RADIO_HW_CAPABILITY_FLAG_CAN_TX) )
+         continue;
+
+      t_radio_tx_route* pRoute = &(s_RadioTXRoutes[s_iRadioTXRoutesCount]);
+      memset(pRoute, 0, sizeof(t_radio_tx_route));
+      pRoute->iRadioLinkId = iRadioLinkId;
+      pRoute->iRadioInterfaceIndex = iRadioInterfaceIndex;
+      if ( (uLinkFlags & RADIO_HW_CAPABILITY_FLAG_CAN_USE_FOR_DATA) && (uInterfaceFlags & RADIO_HW_CAPABILITY_FLAG_CAN_USE_FOR_DATA) )
+         pRoute->uFlags |= RADIO_TX_ROUTE_FLAG_DATA;
+      if ( (uLinkFlags & RADIO_HW_CAPABILITY_FLAG_CAN_USE_FOR_VIDEO) && (uInterfaceFlags & RADIO_HW_CAPABILITY_FLAG_CAN_USE_FOR_VIDEO) )
+         pRoute->uFlags |= RADIO_TX_ROUTE_FLAG_VIDEO;
+      if ( uLinkFlags & RADIO_HW_CAPABILITY_FLAG_USED_FOR_RELAY )
+         pRoute->uFlags |= RADIO_TX_ROUTE_FLAG_RELAY;
+      if ( hardware_radio_index_is_sik_radio(iRadioInterfaceIndex) )
+         pRoute->uFlags |= RADIO_TX_ROUTE_FLAG_SIK;
+
+      u32 radioFlags = g_pCurrentModel->radioInterfacesParams.interface_current_radio_flags[iRadioInterfaceIndex];
+      if ( ! (radioFlags & RADIO_FLAGS_APPLY_MCS_FLAGS_ON_VEHICLE) )
+      {
+         radioFlags &= ~(RADIO_FLAGS_STBC | RADIO_FLAGS_LDPC | RADIO_FLAGS_SHORT_GI | RADIO_FLAGS_HT40);
+         radioFlags |= RADIO_FLAGS_HT20;
+      }
+      pRoute->uRadioFlags = radioFlags;
+      s_iRadioTXRoutesCount++;
+
+      log_line("[RadioTXRoutes] Route %d: radio link %d on radio interface %d, %s%s%s%s radio flags: %u",
+         s_iRadioTXRoutesCount, iRadioLinkId+1, iRadioInterfaceIndex+1,
+         (pRoute->uFlags & RADIO_TX_ROUTE_FLAG_DATA)?"data, ":"", (pRoute->uFlags & RADIO_TX_ROUTE_FLAG_VIDEO)?"video, ":"",
+         (pRoute->uFlags & RADIO_TX_ROUTE_FLAG_RELAY)?"relay, ":"", (pRoute->uFlags & RADIO_TX_ROUTE_FLAG_SIK)?"SiK, ":"", radioFlags);
+   }
+   log_line("[RadioTXRoutes] Computed %d radio TX routes.", s_iRadioTXRoutesCount);
+}
+
+int radio_tx_routes_get_count()
+{
+   if ( ! s_bRadioTXRoutesValid )
+      _radio_tx_routes_rebuild();
+   return s_iRadioTXRoutesCount;
+}
+
+t_radio_tx_route* radio_tx_routes_get(int iIndex)
+{
+   if ( (iIndex < 0) || (iIndex >= s_iRadioTXRoutesCount) )
+      return NULL;
+   return &(s_RadioTXRoutes[iIndex]);
+}
+
+static t_radio_tx_template* _radio_tx_routes_get_template(t_radio_tx_route* pRoute, int iDataRate, int iPort)
+{
+   for( int i=0; i<pRoute->iTemplatesCount; i++ )
+   {
+      if ( (pRoute->templates[i].iDataRate == iDataRate) && (pRoute->templates[i].iPort == iPort) )
+         return &(pRoute->templates[i]);
+   }
+
+   // New datarate or port on this route (ie. adaptive video changed the datarate): replace the oldest one
+   int iIndex = pRoute->iTemplatesCount;
+   if ( iIndex >= RADIO_TX_ROUTE_MAX_TEMPLATES )
+   {
+      iIndex = pRoute->iNextTemplateToReplace;
+      pRoute->iNextTemplateToReplace = (pRoute->iNextTemplateToReplace + 1) % RADIO_TX_ROUTE_MAX_TEMPLATES;
+   }
+   if ( ! radio_tx_template_init(&(pRoute->templates[iIndex]), iDataRate, pRoute->uRadioFlags, iPort) )
+      return NULL;
+   if ( iIndex == pRoute->iTemplatesCount )
+      pRoute->iTemplatesCount++;
+   s_uRadioTXTemplatesBuilt++;
+   return &(pRoute->templates[iIndex]);
+}
+
+int radio_tx_routes_build_packet(t_radio_tx_route* pRoute, int iDataRate, int iPort, u8* pRawPacket, u8* pPacketData, int nInputLength, int bEncrypt, int iExtraData, u8* pExtraData)
+{
+   if ( NULL == pRoute )
+      return 0;
+
+   if ( (! bEncrypt) && (0 == iExtraData) && (s_iRadioTXPayloadMode != RADIO_TX_PAYLOAD_MODE_BUILDER) )
+   {
+      t_radio_tx_template* pTemplate = _radio_tx_routes_get_template(pRoute, iDataRate, iPort);
+      int iLength = radio_tx_template_build_packet(pTemplate, s_iRadioTXPayloadMode, pRawPacket, pPacketData, nInputLength);
+      if ( iLength > 0 )
+      {
+         s_uRadioTXPacketsFromTemplates++;
+         return iLength;
+      }
+   }
+
+   s_uRadioTXPacketsFromBuilder++;
+   radio_set_out_datarate(iDataRate);
+   radio_set_frames_flags(pRoute->uRadioFlags);
+   return radio_build_packet(pRawPacket, pPacketData, nInputLength, iPort, bEncrypt, iExtraData, pExtraData);
+}
+
+int radio_tx_routes_build_packet_in_place(t_radio_tx_route* pRoute, int iDataRate, int iPort, u8* pPacketData, int nInputLength, u8* pRawPacketBuffer, u8** ppRawPacket)
+{
+   if ( (NULL == pRoute) || (NULL == ppRawPacket) )
+      return 0;
+
+   if ( s_iRadioTXPayloadMode != RADIO_TX_PAYLOAD_MODE_BUILDER )
+   {
+      t_radio_tx_template* pTemplate = _radio_tx_routes_get_template(pRoute, iDataRate, iPort);
+      int iLength = radio_tx_template_build_packet_in_place(pTemplate, s_iRadioTXPayloadMode, pPacketData, nInputLength, ppRawPacket);
+      if ( iLength > 0 )
+      {
+         s_uRadioTXPacketsFromTemplates++;
+         s_uRadioTXPacketsInPlace++;
+         return iLength;
+      }
+   }
+
+   *ppRawPacket = pRawPacketBuffer;
+   return radio_tx_routes_build_packet(pRoute, iDataRate, iPort, pRawPacketBuffer, pPacketData, nInputLength, 0, 0, NULL);
+}
+
+void radio_tx_routes_log_stats()
+{
+   log_line("[RadioTXRoutes] %d routes, %u rebuilds, %u headers templates built, packets built from templates: %u (in place: %u), by radio_build_packet: %u",
+      s_iRadioTXRoutesCount, s_uRadioTXRoutesRebuilds, s_uRadioTXTemplatesBuilt, s_uRadioTXPacketsFromTemplates, s_uRadioTXPacketsInPlace, s_uRadioTXPacketsFromBuilder);
+}
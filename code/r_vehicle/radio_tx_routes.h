@@ -0,0 +1,42 @@
+#pragma once
+#include "../base/base.h"
+#include "../radio/radio_tx_templates.h"
+
+// Radio TX routes of the vehicle: for each radio link that can send, the radio interface used
+// for it, what it can carry and the prebuilt radio headers for the datarates and ports used on it.
+// Computed from the current model and the opened radio interfaces, only after radio_tx_routes_invalidate()
+// (model reloaded, radio interfaces opened/closed), instead of on each sent packet.
+
+#define RADIO_TX_ROUTE_FLAG_DATA 0x01 // link and interface can be used for data
+#define RADIO_TX_ROUTE_FLAG_VIDEO 0x02 // link and interface can be used for video
+#define RADIO_TX_ROUTE_FLAG_RELAY 0x04 // relay link, used only for the relayed vehicle traffic
+#define RADIO_TX_ROUTE_FLAG_SIK 0x08 // SiK radio interface, sends short packets
+
+#define RADIO_TX_ROUTE_MAX_TEMPLATES 4 // datarate/port combinations kept for a route
+
+typedef struct
+{
+   int iRadioLinkId;
+   int iRadioInterfaceIndex;
+   u32 uFlags;
+   u32 uRadioFlags; // interface radio flags, without the MCS flags if they are not applied on vehicle
+   int iTemplatesCount;
+   int iNextTemplateToReplace;
+   t_radio_tx_template templates[RADIO_TX_ROUTE_MAX_TEMPLATES];
+} t_radio_tx_route;
+
+void radio_tx_routes_invalidate();
+// Rebuilds the routes if they where invalidated. Routes are ordered by radio link id
+int radio_tx_routes_get_count();
+t_radio_tx_route* radio_tx_routes_get(int iIndex);
+
+// Same output as radio_build_packet with the route radio flags and the given datarate.
+// Encrypted packets and packets with extra data are built with radio_build_packet.
+int radio_tx_routes_build_packet(t_radio_tx_route* pRoute, int iDataRate, int iPort, u8* pRawPacket, u8* pPacketData, int nInputLength, int bEncrypt, int iExtraData, u8* pExtraData);
+
+// Not encrypted packets, no extra data: the radio headers are written in place in the RADIO_TX_TEMPLATE_MAX_HEADER bytes
+// before pPacketData (see radio_tx_template_build_packet_in_place), or, if no template can be used, the packet is
+// built in pRawPacketBuffer. ppRawPacket is set to the start of the raw packet.
+int radio_tx_routes_build_packet_in_place(t_radio_tx_route* pRoute, int iDataRate, int iPort, u8* pPacketData, int nInputLength, u8* pRawPacketBuffer, u8** ppRawPacket);
+
+void radio_tx_routes_log_stats();
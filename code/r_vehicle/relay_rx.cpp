@@ -12,6 +12,7 @@ Code written by: Petru Soroaga, 2021-2023
 #include "../base/base.h"
 #include "../base/config.h"
 #include "../common/radio_stats.h"
+#include "../common/relay_video_blocks.h"
 #include "../radio/radiolink.h"
 #include "../base/ruby_ipc.h"
 #include "relay_rx.h"
@@ -24,6 +25,35 @@ Code written by: Petru Soroaga, 2021-2023
 // It's a pointer to: type_uplink_rx_info_stats s_UplinkInfoRxStats[MAX_RADIO_INTERFACES];
 type_uplink_rx_info_stats* s_pRelayRxInfoStats = NULL;
 
+t_relay_video_blocks* s_pRelayVideoBlocks = NULL;
+
+static int _relay_get_video_blocks_fec_packets(u32 uRelayFlags)
+{
+   int iFecPackets = (uRelayFlags & RELAY_FLAGS_MASK_VIDEO_BLOCKS_FECS) >> RELAY_FLAGS_SHIFT_VIDEO_BLOCKS_FECS;
+   if ( iFecPackets == 0xFF )
+      return RELAY_VIDEO_BLOCKS_SAME_FECS;
+   return iFecPackets;
+}
+
+static void _relay_send_video_blocks_packet(u8* pPacket, int iLength, void* pContext)
+{
+   relay_send_packet_to_controller(pPacket, iLength);
+}
+
+// Returns the video blocks relay if relayed video is rebuilt in blocks on this vehicle, NULL if it's forwarded as received
+static t_relay_video_blocks* _relay_get_video_blocks()
+{
+   if ( (NULL == g_pCurrentModel) || (g_pCurrentModel->relay_params.uCurrentRelayMode == RELAY_MODE_NONE) )
+      return NULL;
+   if ( ! (g_pCurrentModel->relay_params.uRelayFlags & RELAY_FLAGS_VIDEO) )
+      return NULL;
+   if ( ! (g_pCurrentModel->relay_params.uRelayFlags & RELAY_FLAGS_VIDEO_BLOCKS) )
+      return NULL;
+   if ( NULL == s_pRelayVideoBlocks )
+      s_pRelayVideoBlocks = relay_video_blocks_create(_relay_get_video_blocks_fec_packets(g_pCurrentModel->relay_params.uRelayFlags), _relay_send_video_blocks_packet, NULL);
+   return s_pRelayVideoBlocks;
+}
+
 void relay_set_rx_info_stats(type_uplink_rx_info_stats* pUplinkStats)
 {
    s_pRelayRxInfoStats = pUplinkStats;
@@ -32,6 +62,17 @@ void relay_set_rx_info_stats(type_uplink_rx_info_stats* pUplinkStats)
 
 void relay_process_received_single_radio_packet_from_controller_to_relayed_vehicle(int iRadioInterfaceIndex, u8* pBufferData, int iBufferLength)
 {
+   t_relay_video_blocks* pVideoBlocks = _relay_get_video_blocks();
+   if ( NULL != pVideoBlocks )
+   {
+      // Video retransmissions are answered from the relay blocks; only the missing packets are requested from the relayed vehicle
+      u8 uRequest[MAX_PACKET_TOTAL_SIZE];
+      int iRequestLength = relay_video_blocks_on_retransmission_request(pVideoBlocks, pBufferData, iBufferLength, uRequest);
+      if ( iRequestLength > 0 )
+         relay_send_single_packet_to_relayed_vehicle(uRequest, iRequestLength);
+      if ( iRequestLength >= 0 )
+         return;
+   }
    relay_send_single_packet_to_relayed_vehicle(pBufferData, iBufferLength);
 }
 
@@ -121,6 +162,32 @@ void relay_process_received_radio_packet_from_relayed_vehicle(int iRadioLink, in
         (!bPacketContainsRubyTelemetry) )
       return;
      
+   t_relay_video_blocks* pVideoBlocks = _relay_get_video_blocks();
+   if ( NULL != pVideoBlocks )
+   {
+      // Video data packets go to the video blocks relay, the other packets are forwarded as they are
+      u8 uOtherPackets[MAX_PACKET_TOTAL_SIZE];
+      int iOtherPacketsLength = 0;
+      pData = pBufferData;
+      nLength = iBufferLength;
+      while ( nLength >= (int)sizeof(t_packet_header) )
+      {
+         t_packet_header* pPH = (t_packet_header*)pData;
+         if ( (pPH->total_length < sizeof(t_packet_header)) || (pPH->total_length > nLength) )
+            break;
+         if ( ! relay_video_blocks_on_packet(pVideoBlocks, pData, pPH->total_length) )
+         {
+            memcpy(uOtherPackets + iOtherPacketsLength, pData, pPH->total_length);
+            iOtherPacketsLength += pPH->total_length;
+         }
+         pData += pPH->total_length;
+         nLength -= pPH->total_length;
+      }
+      if ( iOtherPacketsLength > 0 )
+         relay_send_packet_to_controller(uOtherPackets, iOtherPacketsLength);
+      return;
+   }
+
    // Forward the full composed packet to the controller
    
    relay_send_packet_to_controller(pBufferData, iBufferLength);
@@ -138,6 +205,11 @@ void relay_on_relay_params_changed()
    g_TimeLastNotificationRelayParamsChanged = 0;
 
    log_line("Processing notification that relay parameters where updated by user command...");
+   if ( NULL != s_pRelayVideoBlocks )
+   {
+      relay_video_blocks_log_stats(s_pRelayVideoBlocks);
+      relay_video_blocks_reset(s_pRelayVideoBlocks);
+   }
    close_radio_interfaces();
 
    if ( NULL != g_pProcessStats )
@@ -219,5 +291,6 @@ void relay_on_relay_mode_changed(u8 uNewMode)
 
 void relay_on_relay_flags_changed(u32 uNewFlags)
 {
-
+   if ( NULL != s_pRelayVideoBlocks )
+      relay_video_blocks_set_fec_packets(s_pRelayVideoBlocks, _relay_get_video_blocks_fec_packets(uNewFlags));
 }
\ No newline at end of file
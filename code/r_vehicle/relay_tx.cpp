@@ -13,7 +13,9 @@ Code written by: Petru Soroaga, 2021-2023
 #include "../base/config.h"
 #include "../common/radio_stats.h"
 #include "../radio/radiolink.h"
+#include "../radio/radio_packets_chain.h"
 #include "relay_tx.h"
+#include "radio_tx_routes.h"
 #include "shared_vars.h"
 #include "timers.h"
 
@@ -21,23 +23,23 @@ static u8 s_RadioRawPacketRelayed[MAX_PACKET_TOTAL_SIZE];
 
 void relay_send_packet_to_controller(u8* pBufferData, int iBufferLength)
 {
-   u8* pData = pBufferData;
-   int nLength = iBufferLength;
-   u32 uCountChainedPackets = 0;
    u32 uStreamId = 0;
    u32 uSourceVehicleId = 0;
-   while ( nLength > 0 )
+   t_packets_chain_iterator chainIterator;
+   t_packet_header* pPH = NULL;
+   packets_chain_iterator_init(&chainIterator, pBufferData, iBufferLength);
+   while ( NULL != (pPH = packets_chain_iterator_next(&chainIterator)) )
    {
-      t_packet_header* pPH = (t_packet_header*)pData;
-      
       uSourceVehicleId = pPH->vehicle_id_src;
       uStreamId = (pPH->stream_packet_idx)>>PACKET_FLAGS_MASK_SHIFT_STREAM_INDEX;
       if ( uStreamId < 0 || uStreamId >= MAX_RADIO_STREAMS )
          uStreamId = 0;
+   }
 
-      nLength -= pPH->total_length;
-      pData += pPH->total_length;
-      uCountChainedPackets++;
+   if ( chainIterator.iError != PACKETS_CHAIN_OK )
+   {
+      log_softerror_and_alarm("[RelayTX] Invalid chained packets from relayed vehicle (error %d after %d packets, %d bytes). Not sent to controller.", chainIterator.iError, chainIterator.iCountPackets, iBufferLength);
+      return;
    }
 
    if ( uSourceVehicleId != g_pCurrentModel->relay_params.uRelayVehicleId )
@@ -48,47 +50,17 @@ void relay_send_packet_to_controller(u8* pBufferData, int iBufferLength)
 
    bool bPacketSent = false;
 
-   for( int iRadioLinkId=0; iRadioLinkId<g_pCurrentModel->radioLinksParams.links_count; iRadioLinkId++ )
+   int iRoutesCount = radio_tx_routes_get_count();
+   for( int iRoute=0; iRoute<iRoutesCount; iRoute++ )
    {
-      if ( g_pCurrentModel->radioLinksParams.link_capabilities_flags[iRadioLinkId] & RADIO_HW_CAPABILITY_FLAG_DISABLED )
-         continue;
-
-      if ( g_pCurrentModel->radioLinksParams.link_capabilities_flags[iRadioLinkId] & RADIO_HW_CAPABILITY_FLAG_USED_FOR_RELAY )
-         continue;
-
-      if ( !(g_pCurrentModel->radioLinksParams.link_capabilities_flags[iRadioLinkId] & RADIO_HW_CAPABILITY_FLAG_CAN_TX) )
+      t_radio_tx_route* pRoute = radio_tx_routes_get(iRoute);
+      if ( pRoute->uFlags & RADIO_TX_ROUTE_FLAG_RELAY )
          continue;
 
-      int iRadioInterfaceIndex = -1;
-      for( int k=0; k<g_pCurrentModel->radioInterfacesParams.interfaces_count; k++ )
-         if ( g_pCurrentModel->radioInterfacesParams.interface_link_id[k] == iRadioLinkId )
-         {
-            iRadioInterfaceIndex = k;
-            break;
-         }
-      if ( iRadioInterfaceIndex < 0 )
-         continue;
-
-      radio_hw_info_t* pNICInfo = hardware_get_radio_info(iRadioInterfaceIndex);
-      if ( ! pNICInfo->openedForWrite )
-         continue;
-      if ( g_pCurrentModel->radioInterfacesParams.interface_capabilities_flags[iRadioInterfaceIndex] & RADIO_HW_CAPABILITY_FLAG_DISABLED )
-         continue;
-      if ( !(g_pCurrentModel->radioInterfacesParams.interface_capabilities_flags[iRadioInterfaceIndex] & RADIO_HW_CAPABILITY_FLAG_CAN_TX) )
-         continue;
-      
+      int iRadioLinkId = pRoute->iRadioLinkId;
+      int iRadioInterfaceIndex = pRoute->iRadioInterfaceIndex;
       int nRateTx = g_pCurrentModel->radioLinksParams.link_datarates[iRadioLinkId][0];
-      radio_set_out_datarate(nRateTx);
-
-      u32 radioFlags = g_pCurrentModel->radioInterfacesParams.interface_current_radio_flags[iRadioInterfaceIndex];
-      if ( ! (radioFlags & RADIO_FLAGS_APPLY_MCS_FLAGS_ON_VEHICLE) )
-      {
-         radioFlags &= ~(RADIO_FLAGS_STBC | RADIO_FLAGS_LDPC | RADIO_FLAGS_SHORT_GI | RADIO_FLAGS_HT40);
-         radioFlags |= RADIO_FLAGS_HT20;
-      }
-      radio_set_frames_flags(radioFlags);
-
-      int totalLength = radio_build_packet(s_RadioRawPacketRelayed, pBufferData, iBufferLength, RADIO_PORT_ROUTER_DOWNLINK, 0, 0, NULL);
+      int totalLength = radio_tx_routes_build_packet(pRoute, nRateTx, RADIO_PORT_ROUTER_DOWNLINK, s_RadioRawPacketRelayed, pBufferData, iBufferLength, 0, 0, NULL);
 
       if ( (totalLength >0) && radio_write_packet(iRadioInterfaceIndex, s_RadioRawPacketRelayed, totalLength) )
       {           
@@ -135,47 +107,17 @@ void relay_send_single_packet_to_relayed_vehicle(u8* pBufferData, int iBufferLen
 
    bool bPacketSent = false;
 
-   for( int iRadioLinkId=0; iRadioLinkId<g_pCurrentModel->radioLinksParams.links_count; iRadioLinkId++ )
+   int iRoutesCount = radio_tx_routes_get_count();
+   for( int iRoute=0; iRoute<iRoutesCount; iRoute++ )
    {
-      if ( g_pCurrentModel->radioLinksParams.link_capabilities_flags[iRadioLinkId] & RADIO_HW_CAPABILITY_FLAG_DISABLED )
-         continue;
-
-      if ( ! (g_pCurrentModel->radioLinksParams.link_capabilities_flags[iRadioLinkId] & RADIO_HW_CAPABILITY_FLAG_USED_FOR_RELAY) )
-         continue;
-
-      if ( !(g_pCurrentModel->radioLinksParams.link_capabilities_flags[iRadioLinkId] & RADIO_HW_CAPABILITY_FLAG_CAN_TX) )
-         continue;
-
-      int iRadioInterfaceIndex = -1;
-      for( int k=0; k<g_pCurrentModel->radioInterfacesParams.interfaces_count; k++ )
-         if ( g_pCurrentModel->radioInterfacesParams.interface_link_id[k] == iRadioLinkId )
-         {
-            iRadioInterfaceIndex = k;
-            break;
-         }
-      if ( iRadioInterfaceIndex < 0 )
+      t_radio_tx_route* pRoute = radio_tx_routes_get(iRoute);
+      if ( ! (pRoute->uFlags & RADIO_TX_ROUTE_FLAG_RELAY) )
          continue;
 
-      radio_hw_info_t* pNICInfo = hardware_get_radio_info(iRadioInterfaceIndex);
-      if ( ! pNICInfo->openedForWrite )
-         continue;
-      if ( g_pCurrentModel->radioInterfacesParams.interface_capabilities_flags[iRadioInterfaceIndex] & RADIO_HW_CAPABILITY_FLAG_DISABLED )
-         continue;
-      if ( !(g_pCurrentModel->radioInterfacesParams.interface_capabilities_flags[iRadioInterfaceIndex] & RADIO_HW_CAPABILITY_FLAG_CAN_TX) )
-         continue;
-      
+      int iRadioLinkId = pRoute->iRadioLinkId;
+      int iRadioInterfaceIndex = pRoute->iRadioInterfaceIndex;
       int nRateTx = g_pCurrentModel->radioLinksParams.link_datarates[iRadioLinkId][1];
-      radio_set_out_datarate(nRateTx);
-
-      u32 radioFlags = g_pCurrentModel->radioInterfacesParams.interface_current_radio_flags[iRadioInterfaceIndex];
-      if ( ! (radioFlags & RADIO_FLAGS_APPLY_MCS_FLAGS_ON_VEHICLE) )
-      {
-         radioFlags &= ~(RADIO_FLAGS_STBC | RADIO_FLAGS_LDPC | RADIO_FLAGS_SHORT_GI | RADIO_FLAGS_HT40);
-         radioFlags |= RADIO_FLAGS_HT20;
-      }
-      radio_set_frames_flags(radioFlags);
-
-      int totalLength = radio_build_packet(s_RadioRawPacketRelayed, pBufferData, iBufferLength, RADIO_PORT_ROUTER_UPLINK, 0, 0, NULL);
+      int totalLength = radio_tx_routes_build_packet(pRoute, nRateTx, RADIO_PORT_ROUTER_UPLINK, s_RadioRawPacketRelayed, pBufferData, iBufferLength, 0, 0, NULL);
 
       if ( (totalLength>0) && radio_write_packet(iRadioInterfaceIndex, s_RadioRawPacketRelayed, totalLength) )
       {           
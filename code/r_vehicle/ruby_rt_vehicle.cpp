@@ -36,6 +36,7 @@ Code written by: Petru Soroaga, 2021-2023
 #include "../base/encr.h"
 #include "../base/ruby_ipc.h"
 #include "../base/camera_utils.h"
+#include "../base/latency_trace.h"
 #include "../common/string_utils.h"
 #include "../common/radio_stats.h"
 
@@ -52,6 +53,7 @@ Code written by: Petru Soroaga, 2021-2023
 #include "../radio/radiopackets2.h"
 #include "../radio/radiolink.h"
 #include "../radio/radiopacketsqueue.h"
+#include "../radio/radio_packets_chain.h"
 #include "../radio/fec.h" 
 #include "radio_utils.h"
 #include "packets_utils.h"
@@ -62,6 +64,7 @@ Code written by: Petru Soroaga, 2021-2023
 #include "video_link_check_bitrate.h"
 #include "relay_rx.h"
 #include "relay_tx.h"
+#include "radio_tx_routes.h"
 
 
 #define MAX_RECV_UPLINK_HISTORY 12
@@ -73,15 +76,12 @@ static u32 s_uTimeLastCheckForRaspiDebugMessages = 0;
 u32 s_MinVideoBlocksGapMilisec = 1;
 
 
-u8 s_BufferCommandsReply[MAX_PACKET_TOTAL_SIZE];
 u8 s_PipeTmpBufferCommandsReply[MAX_PACKET_TOTAL_SIZE];
 int s_PipeTmpBufferCommandsReplyPos = 0;
 
-u8 s_BufferTelemetryDownlink[MAX_PACKET_TOTAL_SIZE];
 u8 s_PipeTmpBufferTelemetryDownlink[MAX_PACKET_TOTAL_SIZE];
 int s_PipeTmpBufferTelemetryDownlinkPos = 0;  
 
-u8 s_BufferRCDownlink[MAX_PACKET_TOTAL_SIZE];
 u8 s_PipeTmpBufferRCDownlink[MAX_PACKET_TOTAL_SIZE];
 int s_PipeTmpBufferRCDownlinkPos = 0;  
 
@@ -119,6 +119,7 @@ int try_read_video_input(bool bDiscard);
 void close_radio_interfaces()
 {
    log_line("Closing all radio interfaces (rx/tx).");
+   radio_tx_routes_invalidate();
 
    for( int i=0; i<hardware_get_radio_interfaces_count(); i++ )
    {
@@ -148,6 +149,8 @@ int open_radio_interfaces()
 {
    log_line("=========================================================");
    log_line("Opening RX/TX radio interfaces...");
+   // TX routes are computed again on the next sent packet, from the interfaces opened now
+   radio_tx_routes_invalidate();
    if ( g_pCurrentModel->relay_params.isRelayEnabledOnRadioLinkId > 0 )
       log_line("Relaying is enabled on radio link %d.", g_pCurrentModel->relay_params.isRelayEnabledOnRadioLinkId);
 
@@ -643,9 +646,9 @@ void _inject_video_link_dev_graphs()
 
 void process_and_send_packets()
 {
-   int maxLengthAllowedInRadioPacket = MAX_PACKET_PAYLOAD;
-   u8 composed_packet[MAX_PACKET_TOTAL_SIZE];
-   int composed_packet_length = 0;
+   // Compose the chained packets directly in the radio TX frame
+   t_packets_chain_builder chainBuilder;
+   packets_chain_builder_init(&chainBuilder, get_radio_tx_frame_packets_buffer(), MAX_PACKET_TOTAL_SIZE);
    bool bMustInjectVideoDevStats = false;
    bool bMustInjectVideoDevGraphs = false;
 
@@ -723,14 +726,14 @@ void process_and_send_packets()
          }
       }
 
-      if ( composed_packet_length + length > maxLengthAllowedInRadioPacket )
+      if ( (chainBuilder.iLength > 0) && (chainBuilder.iLength + length > MAX_PACKET_PAYLOAD) )
       {
-         send_packet_to_radio_interfaces(composed_packet, composed_packet_length);
-         composed_packet_length = 0;
+         send_packet_to_radio_interfaces(chainBuilder.pBuffer, packets_chain_builder_finalize(&chainBuilder));
+         packets_chain_builder_reset(&chainBuilder);
       }
  
-      memcpy(&composed_packet[composed_packet_length], pBuffer, length);
-      composed_packet_length += length;
+      if ( ! packets_chain_builder_append(&chainBuilder, pBuffer, length) )
+         log_softerror_and_alarm("Invalid packets to send (first packet type: %d, %d bytes, first packet length: %d bytes). Skipped them.", pPH->packet_type, length, pPH->total_length);
 
       if ( bMustInjectVideoDevStats )
          _inject_video_link_dev_stats();
@@ -738,10 +741,10 @@ void process_and_send_packets()
          _inject_video_link_dev_graphs();
    }
 
-   if ( composed_packet_length > 0 )
+   if ( chainBuilder.iLength > 0 )
    {
-      send_packet_to_radio_interfaces(composed_packet, composed_packet_length);
-      composed_packet_length = 0;
+      send_packet_to_radio_interfaces(chainBuilder.pBuffer, packets_chain_builder_finalize(&chainBuilder));
+      packets_chain_builder_reset(&chainBuilder);
    } 
 }
 
@@ -784,57 +787,37 @@ int try_read_video_input(bool bDiscard)
 }
 
 
-void try_read_pipes()
+// Reads the messages straight into packets pool buffers and queues them without copying.
+// If the pool is empty, the messages wait in the pipe.
+static void _try_read_pipe_to_queues(int iPipeFd, u8* pPipeBuffer, int* pPipeBufferPos, int iMaxPacketsToRead)
 {
-   int maxPacketsToRead = 10;
-
-   while ( (maxPacketsToRead > 0) && NULL != ruby_ipc_try_read_message(s_fIPCRouterFromCommands, 50, s_PipeTmpBufferCommandsReply, &s_PipeTmpBufferCommandsReplyPos, s_BufferCommandsReply) )
-   {
-      maxPacketsToRead--;
-      t_packet_header* pPH = (t_packet_header*)s_BufferCommandsReply;      
-      if ( (pPH->packet_flags & PACKET_FLAGS_MASK_MODULE) == PACKET_COMPONENT_LOCAL_CONTROL )
-         packets_queue_add_packet(&s_QueueControlPackets, s_BufferCommandsReply); 
-      else
-         packets_queue_add_packet(&s_QueueRadioPacketsOut, s_BufferCommandsReply); 
-   } 
-
-   maxPacketsToRead = 10;
-   while ( (maxPacketsToRead > 0) && NULL != ruby_ipc_try_read_message(s_fIPCRouterFromTelemetry, 50, s_PipeTmpBufferTelemetryDownlink, &s_PipeTmpBufferTelemetryDownlinkPos, s_BufferTelemetryDownlink) )
+   while ( iMaxPacketsToRead > 0 )
    {
-      maxPacketsToRead--;
-      t_packet_header* pPH = (t_packet_header*)s_BufferTelemetryDownlink;      
-      if ( (pPH->packet_flags & PACKET_FLAGS_MASK_MODULE) == PACKET_COMPONENT_LOCAL_CONTROL )
-         packets_queue_add_packet(&s_QueueControlPackets, s_BufferTelemetryDownlink); 
-      else
+      t_packet_buffer* pPacket = packets_pool_alloc();
+      if ( NULL == pPacket )
+         break;
+      if ( NULL == ruby_ipc_try_read_message(iPipeFd, 50, pPipeBuffer, pPipeBufferPos, pPacket->packet_buffer) )
       {
-         packets_queue_add_packet(&s_QueueRadioPacketsOut, s_BufferTelemetryDownlink); 
-         /*
-         if ( (pPH->packet_flags & PACKET_FLAGS_MASK_MODULE) == PACKET_COMPONENT_TELEMETRY )
-         {
-            if ( pPH->packet_type == PACKET_TYPE_TELEMETRY_ALL )
-            {
-               t_packet_header_fc_telemetry* pH = (t_packet_header_fc_telemetry*)(&s_BufferTelemetryDownlink[0] + sizeof(t_packet_header) + sizeof(t_packet_header_ruby_telemetry));
-               log_line("Received from telemetry pipe: %d pitch", pH->pitch/100-180);
-            }
-            //else
-            //   log_line("Received from telemetry pipe: other packet to download, type: %d, size: %d bytes", pPH->packet_type, pPH->total_length);
-         }
-         */
+         packets_pool_release(pPacket);
+         break;
       }
-   }
-
-   maxPacketsToRead = 10;
-   while ( (maxPacketsToRead > 0) && NULL != ruby_ipc_try_read_message(s_fIPCRouterFromRC, 50, s_PipeTmpBufferRCDownlink, &s_PipeTmpBufferRCDownlinkPos, s_BufferRCDownlink) )
-   {
-      maxPacketsToRead--;
-      t_packet_header* pPH = (t_packet_header*)s_BufferRCDownlink;      
+      iMaxPacketsToRead--;
+      t_packet_header* pPH = (t_packet_header*)pPacket->packet_buffer;
+      pPacket->packet_length = pPH->total_length;
       if ( (pPH->packet_flags & PACKET_FLAGS_MASK_MODULE) == PACKET_COMPONENT_LOCAL_CONTROL )
-         packets_queue_add_packet(&s_QueueControlPackets, s_BufferRCDownlink); 
+         packets_queue_add_buffer(&s_QueueControlPackets, pPacket, PACKETS_QUEUE_CLASS_CONTROL);
       else
-         packets_queue_add_packet(&s_QueueRadioPacketsOut, s_BufferRCDownlink); 
+         packets_queue_add_buffer(&s_QueueRadioPacketsOut, pPacket, packets_queue_get_packet_class(pPacket->packet_buffer));
    }
 }
 
+void try_read_pipes()
+{
+   _try_read_pipe_to_queues(s_fIPCRouterFromCommands, s_PipeTmpBufferCommandsReply, &s_PipeTmpBufferCommandsReplyPos, 10);
+   _try_read_pipe_to_queues(s_fIPCRouterFromTelemetry, s_PipeTmpBufferTelemetryDownlink, &s_PipeTmpBufferTelemetryDownlinkPos, 10);
+   _try_read_pipe_to_queues(s_fIPCRouterFromRC, s_PipeTmpBufferRCDownlink, &s_PipeTmpBufferRCDownlinkPos, 10);
+}
+
 
 // returns 1 if needs to stop/exit
 
@@ -1344,6 +1327,7 @@ void _read_ipc_pipes()
 
 void cleanUp()
 {
+   radio_tx_routes_log_stats();
    close_radio_interfaces();
 
    if ( -1 != s_fInputAudioStream )
@@ -1479,7 +1463,7 @@ int router_open_pipes()
    if ( g_pCurrentModel->audio_params.has_audio_device && g_pCurrentModel->audio_params.enabled )
    {
       log_line("Opening audio input stream: %s", FIFO_RUBY_AUDIO1);
-      s_fInputAudioStream = open(FIFO_RUBY_AUDIO1, O_RDONLY);
+      s_fInputAudioStream = open(FIFO_RUBY_AUDIO1, O_RDONLY | O_NONBLOCK);
       if ( s_fInputAudioStream < 0 )
          log_softerror_and_alarm("Failed to open audio input stream: %s", FIFO_RUBY_AUDIO1);
       else
@@ -1643,6 +1627,8 @@ int main (int argc, char *argv[])
    else
       log_line("Opened shared mem for router process watchdog for writing.");
 
+   LATENCY_TRACE_INIT(SHARED_MEM_LATENCY_TRACE_VEHICLE);
+
    g_pCurrentModel = new Model();
    if ( ! g_pCurrentModel->loadFromFile(FILE_CURRENT_VEHICLE_MODEL, true) )
    {
@@ -1815,6 +1801,7 @@ int main (int argc, char *argv[])
    u32 uLastTotalTxBytes = 0;
 
    u32 uTimeLastMemoryCheck = 0;
+   u32 uTimeLastQueuesStatsLog = 0;
    u32 uCountMemoryChecks = 0;
 
    _broadcast_router_ready();
@@ -1825,6 +1812,7 @@ int main (int argc, char *argv[])
    {
       g_TimeNow = get_current_timestamp_ms();
       u32 tTime0 = g_TimeNow;
+      LATENCY_TRACE_PERIODIC(g_TimeNow);
 
       if ( NULL != g_pProcessStats )
       {
@@ -1849,6 +1837,12 @@ int main (int argc, char *argv[])
          }
       }
 
+      if ( g_TimeNow > uTimeLastQueuesStatsLog + 30000 )
+      {
+         uTimeLastQueuesStatsLog = g_TimeNow;
+         packets_queue_log_stats(&s_QueueRadioPacketsOut, "radio out");
+      }
+
       uLastTotalTxPackets = g_SM_RadioStats.radio_links[0].totalTxPackets;
       uLastTotalTxBytes = g_SM_RadioStats.radio_links[0].totalTxBytes;
 
@@ -1865,12 +1859,18 @@ int main (int argc, char *argv[])
       u32 uEndRecvTimeMicro = uStartRecvTimeMicro + uLoopMicroInterval;
       while ( uStartRecvTimeMicro < uEndRecvTimeMicro )
       {
-         readResult = try_receive_radio_packets(uEndRecvTimeMicro-uStartRecvTimeMicro);
+         // Wake up in time for the next paced video packet
+         u32 uWaitMicro = uEndRecvTimeMicro-uStartRecvTimeMicro;
+         u32 uPacedWaitMicro = process_data_tx_video_get_paced_packets_wait_micros();
+         if ( (0 != uPacedWaitMicro) && (uPacedWaitMicro < uWaitMicro) )
+            uWaitMicro = uPacedWaitMicro;
+         readResult = try_receive_radio_packets(uWaitMicro);
          if ( readResult < 0 || g_bQuit )
             break; 
 
          if( readResult > 0 )
             process_received_radio_packets();
+         process_data_tx_video_send_paced_packets();
          u32 t = get_current_timestamp_micros();
          if ( t < uStartRecvTimeMicro )
             break;
@@ -1899,7 +1899,11 @@ int main (int argc, char *argv[])
       {
          iReadCameraCount++;
          if ( g_pCurrentModel->hasCamera() )
+         {
+            LATENCY_TRACE_BEGIN(uTraceReadVideo);
             iReadCameraBytes = try_read_video_input(false);
+            LATENCY_TRACE_END(LATENCY_TRACE_STAGE_VEHICLE_READ_VIDEO_INPUT, uTraceReadVideo);
+         }
          if ( -1 == iReadCameraBytes )
             log_softerror_and_alarm("Failed to read camera stream.");
          if ( 0 == iReadCameraBytes )
@@ -1972,6 +1976,7 @@ int main (int argc, char *argv[])
    shared_mem_video_info_stats_close(g_pSM_VideoInfoStats);
    shared_mem_video_info_stats_radio_out_close(g_pSM_VideoInfoStatsRadioOut);
    shared_mem_process_stats_close(SHARED_MEM_WATCHDOG_ROUTER_TX, g_pProcessStats);
+   LATENCY_TRACE_UNINIT();
    log_line("Stopped.Exit now.");
    log_line("---------------------\n");
    return 0;
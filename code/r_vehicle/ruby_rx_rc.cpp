@@ -188,9 +188,9 @@ int main(int argc, char *argv[])
 
    g_TimeStart = get_current_timestamp_ms();
 
+   // No sleep in the loop: it waits for the RC frames on the router pipe (up to 20 ms), so frames are output as they come in
    while (!g_bQuit) 
    {
-      hardware_sleep_ms(5);
       g_TimeNow = get_current_timestamp_ms();
       u32 tTime0 = g_TimeNow;
 
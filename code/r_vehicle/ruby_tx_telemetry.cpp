@@ -39,6 +39,7 @@ Code written by: Petru Soroaga, 2021-2023
 #include "../base/utils.h"
 #include "../base/ruby_ipc.h"
 #include "../common/string_utils.h"
+#include "../common/telemetry_transport.h"
 #include "../../mavlink/common/mavlink.h"
 #include "parse_fc_telemetry.h"
 #include "launchers_vehicle.h"
@@ -66,6 +67,7 @@ int s_iCurrentDataLinkSerialPortIndex = -1;
 u32 s_uCurrentDataLinkSerialPortSpeed = DEFAULT_FC_TELEMETRY_SERIAL_SPEED;
 
 u8 serialBufferIn[300];
+u8 s_uSerialBufferFromFC[2048];
 u8 serialBufferOut[300];
 
 u8  telemetryBufferFromFC[RAW_TELEMETRY_MAX_BUFFER];
@@ -125,6 +127,11 @@ bool s_bMAVLinkSetupSent = false;
 bool s_bSendRCInfoBack = false;
 bool s_bSendFullMAVLinkBackToController = false;
 
+// MAVLink aware reliable transport to the controller, used instead of the raw segments once the controller uses it too
+t_telemetry_transport s_TelemetryTransport;
+bool s_bTelemetryTransportEnabled = false;
+u32 s_uTimeLastTelemetryTransportPacket = 0;
+
 u32 s_CountMessagesFromFCPerSecond = 0;
 u32 s_CountMessagesFromFCPerSecondTemp = 0;
 u32 s_TimeLastMessagesFromFCPerSecondCalculation = 0;
@@ -824,6 +831,15 @@ void reload_model(u8 changeType)
    {
       open_datalink_serial_port();
    }
+
+   telemetry_transport_set_rate(&s_TelemetryTransport, s_uCurrentTelemetrySerialPortSpeed/10, g_TimeNow);
+   if ( s_bTelemetryTransportEnabled )
+   if ( g_pCurrentModel->telemetry_params.fc_telemetry_type != MODEL_TELEMETRY_TYPE_MAVLINK )
+   {
+      log_line("Telemetry type is not MAVLink anymore, switching back to raw telemetry segments.");
+      s_bTelemetryTransportEnabled = false;
+      telemetry_transport_reset(&s_TelemetryTransport, g_TimeNow);
+   }
    s_bSendFullMAVLinkBackToController = (g_pCurrentModel->telemetry_params.flags & TELEMETRY_FLAGS_SEND_FULL_PACKETS_TO_CONTROLLER)?true:false;
    if ( s_bSendFullMAVLinkBackToController )
       log_line("Flag to send back full mavlink/tml packet to controller is set.");
@@ -847,6 +863,46 @@ void onRebootRequest()
    hw_execute_bash_command("sudo reboot -f", NULL);
 }
 
+void _on_telemetry_transport_deliver(const u8* pFrame, int iFrameLength, void* pContext)
+{
+   if ( -1 == s_fSerialToFC )
+      return;
+   if ( iFrameLength != write(s_fSerialToFC, pFrame, iFrameLength) )
+      log_softerror_and_alarm("Failed to write to serial port for telemetry output to FC.");
+}
+
+void _send_telemetry_transport_packets()
+{
+   u8 buffer[MAX_PACKET_TOTAL_SIZE];
+   int iMaxPayload = TELEMETRY_TRANSPORT_MAX_PAYLOAD;
+   if ( iMaxPayload > MAX_PACKET_TOTAL_SIZE - (int)sizeof(t_packet_header) )
+      iMaxPayload = MAX_PACKET_TOTAL_SIZE - (int)sizeof(t_packet_header);
+
+   int iLength = 0;
+   while ( (iLength = telemetry_transport_get_packet(&s_TelemetryTransport, buffer + sizeof(t_packet_header), iMaxPayload, g_TimeNow)) > 0 )
+   {
+      t_packet_header PH;
+      PH.packet_flags = PACKET_COMPONENT_TELEMETRY;
+      PH.packet_type =  PACKET_TYPE_TELEMETRY_MAVLINK_DOWNLOAD;
+      PH.stream_packet_idx = (STREAM_ID_DATA) << PACKET_FLAGS_MASK_SHIFT_STREAM_INDEX;
+      PH.vehicle_id_src = g_pCurrentModel->vehicle_id;
+      PH.vehicle_id_dest = g_pCurrentModel->vehicle_id;
+      PH.total_headers_length = sizeof(t_packet_header)+sizeof(t_packet_header_telemetry_transport);
+      PH.total_length = sizeof(t_packet_header) + iLength;
+      PH.extra_flags = 0;
+      memcpy(buffer, (u8*)&PH, sizeof(t_packet_header));
+      packet_compute_crc(buffer, PH.total_length);
+
+      if ( s_bRouterReady && (! s_bRadioInterfacesReinitIsInProgress) )
+      {
+         int result = ruby_ipc_channel_send_message(s_fIPCToRouter, buffer, PH.total_length);
+         if ( result != PH.total_length )
+            log_softerror_and_alarm("Failed to send data to router. Sent result: %d", result );
+      }
+      if ( NULL != g_pProcessStats )
+         g_pProcessStats->lastIPCOutgoingTime = g_TimeNow;
+   }
+}
 
 bool try_read_messages_from_router()
 {
@@ -935,6 +991,23 @@ bool try_read_messages_from_router()
       return true;
    }
 
+   if ( pPH->packet_type == PACKET_TYPE_TELEMETRY_MAVLINK_UPLOAD )
+   {
+      if ( g_pCurrentModel->telemetry_params.fc_telemetry_type != MODEL_TELEMETRY_TYPE_MAVLINK )
+         return true;
+      if ( ! s_bTelemetryTransportEnabled )
+      {
+         log_line("Controller uses the MAVLink telemetry transport, switching to it from raw telemetry segments.");
+         s_bTelemetryTransportEnabled = true;
+         telemetryBufferFromFCCount = 0;
+      }
+      s_uTimeLastTelemetryTransportPacket = g_TimeNow;
+      int len = pPH->total_length - sizeof(t_packet_header);
+      if ( ! telemetry_transport_on_packet(&s_TelemetryTransport, (&s_BufferTelemetryUplink[0]) + sizeof(t_packet_header), len, g_TimeNow) )
+         log_softerror_and_alarm("Received invalid MAVLink telemetry transport packet (%d bytes).", len);
+      return true;
+   }
+
    if (pPH->packet_type == PACKET_TYPE_TELEMETRY_RAW_UPLOAD )
    {
       int len = pPH->total_length - sizeof(t_packet_header) - sizeof(t_packet_header_telemetry_raw);
@@ -1112,6 +1185,12 @@ void addSerialDataToFCTelemetryBuffer(u8* pData, int dataLength)
 
    if ( ! bMustSendFullTelemetryPackets )
       return;
+
+   if ( s_bTelemetryTransportEnabled )
+   {
+      telemetry_transport_add_serial_data(&s_TelemetryTransport, pData, dataLength, g_TimeNow);
+      return;
+   }
    /*
    log_line("adding %d bytes to sent to controller as telemetry.", dataLength);
 
@@ -1161,7 +1240,24 @@ void try_read_serial_telemetry()
    if ( ! FD_ISSET(s_fSerialToFC, &readset) )
       return;
 
-   int length = read(s_fSerialToFC, serialBufferIn, 270);
+   // Drain everything the serial port has buffered, so the parser works on whole blocks
+   int length = 0;
+   while ( length < (int)sizeof(s_uSerialBufferFromFC) )
+   {
+      int iRead = read(s_fSerialToFC, &s_uSerialBufferFromFC[length], sizeof(s_uSerialBufferFromFC) - length);
+      if ( iRead <= 0 )
+         break;
+      length += iRead;
+
+      to.tv_sec = 0;
+      to.tv_usec = 0;
+      FD_ZERO(&readset);
+      FD_SET(s_fSerialToFC, &readset);
+      if ( select(s_fSerialToFC+1, &readset, NULL, NULL, &to) <= 0 )
+         break;
+      if ( ! FD_ISSET(s_fSerialToFC, &readset) )
+         break;
+   }
    if ( length <= 0 )
       return;
 
@@ -1170,11 +1266,11 @@ void try_read_serial_telemetry()
    s_uRawTelemetryDownloadTotalReadFromSerial += length;
    iFCSerialReadBytes += length;
 
-   addSerialDataToFCTelemetryBuffer(serialBufferIn, length);
+   addSerialDataToFCTelemetryBuffer(s_uSerialBufferFromFC, length);
 
    //log_line("Received %d bytes from FC", length);
 
-   if ( parse_telemetry_from_fc(serialBufferIn, length, &sPHFCT, &sPHRTE, g_pCurrentModel->vehicle_type, g_pCurrentModel->telemetry_params.fc_telemetry_type) )
+   if ( parse_telemetry_from_fc(s_uSerialBufferFromFC, length, &sPHFCT, &sPHRTE, g_pCurrentModel->vehicle_type, g_pCurrentModel->telemetry_params.fc_telemetry_type) )
    {
       g_TimeLastMessageFromFC = g_TimeNow;
       s_CountMessagesFromFCPerSecondTemp++;
@@ -2099,6 +2195,9 @@ int main (int argc, char *argv[])
    telemetryBufferFromFCLastSendTime = g_TimeNow;
    log_line("Telemetry from FC chunk size: %d for serial speed: %u bps", telemetryBufferFromFCMaxSize, s_uCurrentTelemetrySerialPortSpeed);
 
+   telemetry_transport_init(&s_TelemetryTransport, _on_telemetry_transport_deliver, NULL, g_TimeNow);
+   telemetry_transport_set_rate(&s_TelemetryTransport, s_uCurrentTelemetrySerialPortSpeed/10, g_TimeNow);
+
    _init_telemetry_structures();
 
    _broadcast_vehicle_stats();
@@ -2222,6 +2321,16 @@ int main (int argc, char *argv[])
           (telemetryBufferFromFCCount > 0 && g_TimeNow >= telemetryBufferFromFCLastSendTime + RAW_TELEMETRY_SEND_TIMEOUT ) )
          send_raw_telemetry_packet_to_controller();
 
+      if ( s_bTelemetryTransportEnabled )
+      if ( g_TimeNow > s_uTimeLastTelemetryTransportPacket + TELEMETRY_TRANSPORT_LINK_TIMEOUT_MS )
+      {
+         log_line("No MAVLink telemetry transport packets from controller for %d ms, switching back to raw telemetry segments.", TELEMETRY_TRANSPORT_LINK_TIMEOUT_MS);
+         s_bTelemetryTransportEnabled = false;
+         telemetry_transport_reset(&s_TelemetryTransport, g_TimeNow);
+      }
+
+      if ( s_bTelemetryTransportEnabled )
+         _send_telemetry_transport_packets();
 
       if ( dataLinkSerialBufferCount >= AUXILIARY_DATA_LINK_MIN_SEND_LENGTH || 
           (dataLinkSerialBufferCount > 0 && g_TimeNow >= dataLinkSerialBufferLastSendTime + AUXILIARY_DATA_LINK_SEND_TIMEOUT ) )
@@ -34,6 +34,7 @@ shared_mem_radio_stats g_SM_RadioStats;
 type_uplink_rx_info_stats g_UplinkInfoRxStats[MAX_RADIO_INTERFACES];
 
 bool g_bReceivedPairingRequest = false;
+bool g_bControllerCanOpenSealedPackets = false; // from the pairing request flags, or set once the controller sent sealed packets
 bool g_bHasLinkToController = false;
 bool g_bHadEverLinkToController = false;
 
@@ -54,6 +54,7 @@ extern shared_mem_radio_stats g_SM_RadioStats;
 extern type_uplink_rx_info_stats g_UplinkInfoRxStats[MAX_RADIO_INTERFACES];
 
 extern bool g_bReceivedPairingRequest;
+extern bool g_bControllerCanOpenSealedPackets;
 extern bool g_bHasLinkToController;
 extern bool g_bHadEverLinkToController;
 
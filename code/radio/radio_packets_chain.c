@@ -0,0 +1,159 @@
+/*
+You can use this C/C++ code however you wish (for example, but not limited to:
+     as is, or by modifying it, or by adding new code, or by removing parts of the code;
+     in public or private projects, in new free or commercial products)
+     only if you get a priori written consent from Petru Soroaga (petrusoroaga@yahoo.com) for your specific use
+     and only if this copyright terms are preserved in the code.
+     This code is public for learning and academic purposes.
+Also, check the licences folder for additional licences terms.
+Code written by: Petru Soroaga, 2021-2023
+*/
+
+#include "radio_packets_chain.h"
+
+void packets_chain_builder_init(t_packets_chain_builder* pBuilder, u8* pBuffer, int iMaxLength)
+{
+   if ( NULL == pBuilder )
+      return;
+   pBuilder->pBuffer = pBuffer;
+   pBuilder->iMaxLength = (NULL == pBuffer)?0:iMaxLength;
+   if ( pBuilder->iMaxLength < 0 )
+      pBuilder->iMaxLength = 0;
+   packets_chain_builder_reset(pBuilder);
+}
+
+void packets_chain_builder_reset(t_packets_chain_builder* pBuilder)
+{
+   if ( NULL == pBuilder )
+      return;
+   pBuilder->iLength = 0;
+   pBuilder->iCountPackets = 0;
+   pBuilder->iCountPendingCRC = 0;
+}
+
+int packets_chain_builder_get_free_space(t_packets_chain_builder* pBuilder)
+{
+   if ( NULL == pBuilder )
+      return 0;
+   return pBuilder->iMaxLength - pBuilder->iLength;
+}
+
+t_packet_header* packets_chain_builder_add(t_packets_chain_builder* pBuilder, u8 uPacketFlags, u8 uPacketType, u32 uStreamPacketIndex, u32 uVehicleIdSrc, u32 uVehicleIdDest, int iHeadersLength, int iPayloadLength)
+{
+   if ( NULL == pBuilder )
+      return NULL;
+   if ( (iHeadersLength < (int)sizeof(t_packet_header)) || (iPayloadLength < 0) )
+      return NULL;
+   int iTotalLength = iHeadersLength + iPayloadLength;
+   if ( (iTotalLength > 0xFFFF) || (iTotalLength > pBuilder->iMaxLength - pBuilder->iLength) )
+      return NULL;
+   if ( pBuilder->iCountPendingCRC >= (int)PACKETS_CHAIN_MAX_PACKETS )
+      return NULL;
+
+   t_packet_header* pPH = (t_packet_header*)(pBuilder->pBuffer + pBuilder->iLength);
+   pPH->crc = 0;
+   pPH->packet_flags = uPacketFlags;
+   pPH->packet_type = uPacketType;
+   pPH->stream_packet_idx = uStreamPacketIndex;
+   pPH->total_headers_length = (u16)iHeadersLength;
+   pPH->total_length = (u16)iTotalLength;
+   pPH->extra_flags = 0;
+   pPH->vehicle_id_src = uVehicleIdSrc;
+   pPH->vehicle_id_dest = uVehicleIdDest;
+
+   pBuilder->uPendingCRCOffsets[pBuilder->iCountPendingCRC] = (u16)pBuilder->iLength;
+   pBuilder->iCountPendingCRC++;
+   pBuilder->iLength += iTotalLength;
+   pBuilder->iCountPackets++;
+   return pPH;
+}
+
+int packets_chain_builder_append(t_packets_chain_builder* pBuilder, const u8* pPackets, int iLength)
+{
+   if ( (NULL == pBuilder) || (NULL == pPackets) || (iLength <= 0) )
+      return 0;
+   if ( iLength > pBuilder->iMaxLength - pBuilder->iLength )
+      return 0;
+   int iCount = packets_chain_validate((u8*)pPackets, iLength);
+   if ( iCount <= 0 )
+      return 0;
+
+   memcpy(pBuilder->pBuffer + pBuilder->iLength, pPackets, iLength);
+   pBuilder->iLength += iLength;
+   pBuilder->iCountPackets += iCount;
+   return 1;
+}
+
+int packets_chain_builder_finalize(t_packets_chain_builder* pBuilder)
+{
+   if ( NULL == pBuilder )
+      return 0;
+   for( int i=0; i<pBuilder->iCountPendingCRC; i++ )
+   {
+      u8* pPacket = pBuilder->pBuffer + pBuilder->uPendingCRCOffsets[i];
+      t_packet_header* pPH = (t_packet_header*)pPacket;
+      if ( pPH->packet_flags & PACKET_FLAGS_BIT_HEADERS_ONLY_CRC )
+         packet_compute_crc(pPacket, pPH->total_headers_length);
+      else
+         packet_compute_crc(pPacket, pPH->total_length);
+   }
+   pBuilder->iCountPendingCRC = 0;
+   return pBuilder->iLength;
+}
+
+
+void packets_chain_iterator_init(t_packets_chain_iterator* pIterator, u8* pBuffer, int iLength)
+{
+   if ( NULL == pIterator )
+      return;
+   pIterator->pBuffer = pBuffer;
+   pIterator->iLength = (NULL == pBuffer)?0:iLength;
+   if ( pIterator->iLength < 0 )
+      pIterator->iLength = 0;
+   pIterator->iPos = 0;
+   pIterator->iCountPackets = 0;
+   pIterator->iError = PACKETS_CHAIN_OK;
+}
+
+t_packet_header* packets_chain_iterator_next(t_packets_chain_iterator* pIterator)
+{
+   if ( (NULL == pIterator) || (pIterator->iError != PACKETS_CHAIN_OK) )
+      return NULL;
+
+   int iLeft = pIterator->iLength - pIterator->iPos;
+   if ( iLeft <= 0 )
+      return NULL;
+   if ( iLeft < (int)sizeof(t_packet_header) )
+   {
+      pIterator->iError = PACKETS_CHAIN_ERROR_TRUNCATED;
+      return NULL;
+   }
+
+   t_packet_header* pPH = (t_packet_header*)(pIterator->pBuffer + pIterator->iPos);
+   if ( (pPH->total_length < sizeof(t_packet_header)) || ((int)pPH->total_length > iLeft) )
+   {
+      pIterator->iError = PACKETS_CHAIN_ERROR_LENGTH;
+      return NULL;
+   }
+   if ( (pPH->total_headers_length < sizeof(t_packet_header)) || (pPH->total_headers_length > pPH->total_length) )
+   {
+      pIterator->iError = PACKETS_CHAIN_ERROR_HEADERS_LENGTH;
+      return NULL;
+   }
+
+   pIterator->iPos += pPH->total_length;
+   pIterator->iCountPackets++;
+   return pPH;
+}
+
+int packets_chain_validate(u8* pBuffer, int iLength)
+{
+   t_packets_chain_iterator iterator;
+   packets_chain_iterator_init(&iterator, pBuffer, iLength);
+   while ( NULL != packets_chain_iterator_next(&iterator) )
+   {
+   }
+   if ( iterator.iError != PACKETS_CHAIN_OK )
+      return -1;
+   return iterator.iCountPackets;
+}
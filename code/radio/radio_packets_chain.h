@@ -0,0 +1,68 @@
+#pragma once
+#include "../base/base.h"
+#include "radiopackets2.h"
+
+// Chained radio packets (back to back t_packet_header + headers + payload) built and parsed in place.
+// The builder reserves each packet directly in the caller's frame buffer: the caller writes the
+// extra headers and the payload where they belong, no intermediate stack buffers. The CRC of the
+// packets added this way is computed once, when the chain is finalized.
+// The iterator validates each chained packet header against the buffer bounds before returning it.
+
+#define PACKETS_CHAIN_MAX_PACKETS (MAX_PACKET_TOTAL_SIZE/sizeof(t_packet_header))
+
+#define PACKETS_CHAIN_OK 0
+#define PACKETS_CHAIN_ERROR_TRUNCATED 1 // less bytes left than a packet header
+#define PACKETS_CHAIN_ERROR_LENGTH 2 // packet total length smaller than its header or past the buffer end
+#define PACKETS_CHAIN_ERROR_HEADERS_LENGTH 3 // total headers length smaller than the packet header or larger than the packet
+
+typedef struct
+{
+   u8* pBuffer;
+   int iMaxLength;
+   int iLength;
+   int iCountPackets;
+   int iCountPendingCRC;
+   u16 uPendingCRCOffsets[PACKETS_CHAIN_MAX_PACKETS]; // packets added with packets_chain_builder_add
+} t_packets_chain_builder;
+
+typedef struct
+{
+   u8* pBuffer;
+   int iLength;
+   int iPos;
+   int iCountPackets;
+   int iError;
+} t_packets_chain_iterator;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void packets_chain_builder_init(t_packets_chain_builder* pBuilder, u8* pBuffer, int iMaxLength);
+void packets_chain_builder_reset(t_packets_chain_builder* pBuilder);
+int packets_chain_builder_get_free_space(t_packets_chain_builder* pBuilder);
+
+// Reserves a packet of iHeadersLength + iPayloadLength bytes at the end of the chain and fills its
+// packet header. Other headers go after the packet header, the payload at iHeadersLength from the returned packet start.
+// Returns NULL if it does not fit.
+t_packet_header* packets_chain_builder_add(t_packets_chain_builder* pBuilder, u8 uPacketFlags, u8 uPacketType, u32 uStreamPacketIndex, u32 uVehicleIdSrc, u32 uVehicleIdDest, int iHeadersLength, int iPayloadLength);
+
+// Copies complete packets (one or more chained, CRC already computed) at the end of the chain.
+// Returns 0 if they do not fit or they are not a valid chain.
+int packets_chain_builder_append(t_packets_chain_builder* pBuilder, const u8* pPackets, int iLength);
+
+// Computes the CRC of the packets added since the last finalize. Returns the chain length.
+int packets_chain_builder_finalize(t_packets_chain_builder* pBuilder);
+
+
+void packets_chain_iterator_init(t_packets_chain_iterator* pIterator, u8* pBuffer, int iLength);
+// Returns the next packet, or NULL at the end of the chain or on the first invalid packet (iError set).
+// The returned packet total_length and total_headers_length are within the buffer bounds.
+t_packet_header* packets_chain_iterator_next(t_packets_chain_iterator* pIterator);
+
+// Returns the number of packets in the chain, or -1 if any packet is invalid
+int packets_chain_validate(u8* pBuffer, int iLength);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,443 @@
+/*
+You can use this C/C++ code however you wish (for example, but not limited to:
+     as is, or by modifying it, or by adding new code, or by removing parts of the code;
+     in public or private projects, in new free or commercial products)
+     only if you get a priori written consent from Petru Soroaga (petrusoroaga@yahoo.com) for your specific use
+     and only if this copyright terms are preserved in the code.
+     This code is public for learning and academic purposes.
+Also, check the licences folder for additional licences terms.
+Code written by: Petru Soroaga, 2021-2023
+*/
+
+#include "radio_sim.h"
+
+#define RADIO_SIM_RADIOTAP_LENGTH 8
+#define RADIO_SIM_RADIOTAP_DBM_ANTSIGNAL 5 // radiotap present bit
+#define RADIO_SIM_IEEE80211_HEADER_LENGTH 24
+
+static u8 s_uRadioSimIEEE80211Header[RADIO_SIM_IEEE80211_HEADER_LENGTH] =
+{
+   0x08, 0x01, 0x00, 0x00, // data frame, to DS; duration
+   0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, // receiver
+   0x13, 0x22, 0x33, 0x44, 0x55, 0x66, // transmitter
+   0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, // destination
+   0x00, 0x00 // sequence
+};
+
+static u32 _radio_sim_random(t_radio_sim_link* pLink)
+{
+   // xorshift32, so runs with the same seed are repeatable
+   u32 x = pLink->uRandomState;
+   x ^= x << 13;
+   x ^= x >> 17;
+   x ^= x << 5;
+   pLink->uRandomState = x;
+   return x;
+}
+
+static float _radio_sim_random_float(t_radio_sim_link* pLink)
+{
+   return (float)(_radio_sim_random(pLink) & 0xFFFFFF) / (float)0x1000000;
+}
+
+static int _radio_sim_is_packet_lost(t_radio_sim_link* pLink)
+{
+   if ( pLink->params.iLossModel == RADIO_SIM_LOSS_UNIFORM )
+      return (_radio_sim_random_float(pLink) < pLink->params.fLossRate)?1:0;
+
+   if ( pLink->params.iLossModel == RADIO_SIM_LOSS_GILBERT_ELLIOTT )
+   {
+      if ( pLink->iGEStateBad )
+      {
+         if ( _radio_sim_random_float(pLink) < pLink->params.fGEBadToGood )
+            pLink->iGEStateBad = 0;
+      }
+      else
+      {
+         if ( _radio_sim_random_float(pLink) < pLink->params.fGEGoodToBad )
+            pLink->iGEStateBad = 1;
+      }
+      float fLoss = pLink->iGEStateBad?pLink->params.fGELossBad:pLink->params.fGELossGood;
+      return (_radio_sim_random_float(pLink) < fLoss)?1:0;
+   }
+   return 0;
+}
+
+void radio_sim_link_params_reset(t_radio_sim_link_params* pParams)
+{
+   if ( NULL == pParams )
+      return;
+   memset(pParams, 0, sizeof(t_radio_sim_link_params));
+   pParams->iLossModel = RADIO_SIM_LOSS_NONE;
+   pParams->fGEGoodToBad = 0.01;
+   pParams->fGEBadToGood = 0.3;
+   pParams->fGELossGood = 0.0;
+   pParams->fGELossBad = 0.8;
+   pParams->uLatencyMicros = 1000;
+   pParams->uReorderDelayMicros = 2000;
+   pParams->iMaxQueuedPackets = RADIO_SIM_MAX_QUEUED_PACKETS;
+}
+
+t_radio_sim_link* radio_sim_link_create(t_radio_sim_link_params* pParams, u32 uRandomSeed)
+{
+   t_radio_sim_link* pLink = (t_radio_sim_link*)malloc(sizeof(t_radio_sim_link));
+   if ( NULL == pLink )
+   {
+      log_softerror_and_alarm("[RadioSim] Failed to allocate simulated link.");
+      return NULL;
+   }
+   memset(pLink, 0, sizeof(t_radio_sim_link));
+   if ( NULL != pParams )
+      memcpy(&pLink->params, pParams, sizeof(t_radio_sim_link_params));
+   else
+      radio_sim_link_params_reset(&pLink->params);
+   if ( pLink->params.iMaxQueuedPackets <= 0 || pLink->params.iMaxQueuedPackets > RADIO_SIM_MAX_QUEUED_PACKETS )
+      pLink->params.iMaxQueuedPackets = RADIO_SIM_MAX_QUEUED_PACKETS;
+
+   pLink->uRandomState = (0 == uRandomSeed)?0x12345678:uRandomSeed;
+
+   for( int i=0; i<RADIO_SIM_MAX_QUEUED_PACKETS; i++ )
+   {
+      pLink->packets[i].pData = (u8*)malloc(MAX_PACKET_TOTAL_SIZE);
+      if ( NULL == pLink->packets[i].pData )
+      {
+         log_softerror_and_alarm("[RadioSim] Failed to allocate simulated link buffers.");
+         radio_sim_link_destroy(pLink);
+         return NULL;
+      }
+   }
+   return pLink;
+}
+
+void radio_sim_link_destroy(t_radio_sim_link* pLink)
+{
+   if ( NULL == pLink )
+      return;
+   for( int i=0; i<RADIO_SIM_MAX_QUEUED_PACKETS; i++ )
+   {
+      if ( NULL != pLink->packets[i].pData )
+         free(pLink->packets[i].pData);
+   }
+   free(pLink);
+}
+
+void radio_sim_link_reset_stats(t_radio_sim_link* pLink)
+{
+   if ( NULL != pLink )
+      memset(&pLink->stats, 0, sizeof(t_radio_sim_link_stats));
+}
+
+int radio_sim_link_write(t_radio_sim_link* pLink, u8* pData, int iLength, u32 uTimeNowMicros)
+{
+   if ( NULL == pLink || NULL == pData || iLength <= 0 || iLength > MAX_PACKET_TOTAL_SIZE )
+      return 0;
+
+   pLink->stats.uPacketsIn++;
+   pLink->stats.uBytesIn += iLength;
+
+   if ( pLink->iQueuedPackets >= pLink->params.iMaxQueuedPackets )
+   {
+      pLink->stats.uPacketsDroppedQueueFull++;
+      return 0;
+   }
+
+   // Air time is used even if the packet is lost afterwards
+   u32 uTimeSent = uTimeNowMicros;
+   if ( 0 != pLink->params.uBandwidthBitsPerSec )
+   {
+      u32 uAirTime = (u32)(((double)iLength * 8.0 * 1000000.0) / (double)pLink->params.uBandwidthBitsPerSec);
+      if ( (int)(pLink->uTimeChannelFree - uTimeNowMicros) < 0 )
+         pLink->uTimeChannelFree = uTimeNowMicros;
+      pLink->uTimeChannelFree += uAirTime;
+      uTimeSent = pLink->uTimeChannelFree;
+   }
+
+   if ( _radio_sim_is_packet_lost(pLink) )
+   {
+      pLink->stats.uPacketsLost++;
+      return 1;
+   }
+
+   t_radio_sim_packet* pPacket = &(pLink->packets[pLink->iQueuedPackets]);
+   memcpy(pPacket->pData, pData, iLength);
+   pPacket->iLength = iLength;
+   pPacket->uSequence = pLink->uSequence++;
+   pPacket->uDeliveryTime = uTimeSent + pLink->params.uLatencyMicros;
+   if ( pLink->params.uJitterMicros > 0 )
+      pPacket->uDeliveryTime += _radio_sim_random(pLink) % (pLink->params.uJitterMicros+1);
+   if ( pLink->params.fReorderRate > 0.0 )
+   if ( _radio_sim_random_float(pLink) < pLink->params.fReorderRate )
+   {
+      pPacket->uDeliveryTime += pLink->params.uReorderDelayMicros;
+      pLink->stats.uPacketsReordered++;
+   }
+   pLink->iQueuedPackets++;
+   if ( (u32)pLink->iQueuedPackets > pLink->stats.uMaxQueuedPackets )
+      pLink->stats.uMaxQueuedPackets = pLink->iQueuedPackets;
+   return 1;
+}
+
+static int _radio_sim_get_next_packet_index(t_radio_sim_link* pLink)
+{
+   int iBest = -1;
+   for( int i=0; i<pLink->iQueuedPackets; i++ )
+   {
+      if ( iBest == -1 )
+      {
+         iBest = i;
+         continue;
+      }
+      int iDiff = (int)(pLink->packets[i].uDeliveryTime - pLink->packets[iBest].uDeliveryTime);
+      if ( iDiff < 0 || (iDiff == 0 && pLink->packets[i].uSequence < pLink->packets[iBest].uSequence) )
+         iBest = i;
+   }
+   return iBest;
+}
+
+int radio_sim_link_read(t_radio_sim_link* pLink, u8* pOutBuffer, int iMaxLength, u32 uTimeNowMicros)
+{
+   if ( NULL == pLink || NULL == pOutBuffer )
+      return 0;
+
+   int iIndex = _radio_sim_get_next_packet_index(pLink);
+   if ( iIndex < 0 )
+      return 0;
+   if ( (int)(uTimeNowMicros - pLink->packets[iIndex].uDeliveryTime) < 0 )
+      return 0;
+
+   int iLength = pLink->packets[iIndex].iLength;
+   if ( iLength > iMaxLength )
+      iLength = iMaxLength;
+   memcpy(pOutBuffer, pLink->packets[iIndex].pData, iLength);
+
+   // Move the last queued packet in the free slot (swap buffers, no copy)
+   pLink->iQueuedPackets--;
+   if ( iIndex != pLink->iQueuedPackets )
+   {
+      t_radio_sim_packet tmp = pLink->packets[iIndex];
+      pLink->packets[iIndex] = pLink->packets[pLink->iQueuedPackets];
+      pLink->packets[pLink->iQueuedPackets] = tmp;
+   }
+   pLink->stats.uPacketsDelivered++;
+   pLink->stats.uBytesDelivered += iLength;
+   return iLength;
+}
+
+u32 radio_sim_link_get_next_delivery_time(t_radio_sim_link* pLink)
+{
+   if ( NULL == pLink )
+      return MAX_U32;
+   int iIndex = _radio_sim_get_next_packet_index(pLink);
+   if ( iIndex < 0 )
+      return MAX_U32;
+   return pLink->packets[iIndex].uDeliveryTime;
+}
+
+int radio_sim_parse_loss_model(const char* szSpec, t_radio_sim_link_params* pParams)
+{
+   if ( NULL == szSpec || NULL == pParams )
+      return 0;
+   if ( 0 == strcmp(szSpec, "none") )
+   {
+      pParams->iLossModel = RADIO_SIM_LOSS_NONE;
+      return 1;
+   }
+   if ( 0 == strncmp(szSpec, "uniform:", 8) )
+   {
+      pParams->iLossModel = RADIO_SIM_LOSS_UNIFORM;
+      pParams->fLossRate = atof(szSpec+8);
+      return 1;
+   }
+   if ( 0 == strncmp(szSpec, "ge:", 3) )
+   {
+      if ( 4 != sscanf(szSpec+3, "%f,%f,%f,%f", &pParams->fGEGoodToBad, &pParams->fGEBadToGood, &pParams->fGELossGood, &pParams->fGELossBad) )
+         return 0;
+      pParams->iLossModel = RADIO_SIM_LOSS_GILBERT_ELLIOTT;
+      return 1;
+   }
+   return 0;
+}
+
+static void _radio_sim_put_u32(u8* pBuffer, u32 uValue)
+{
+   pBuffer[0] = uValue & 0xFF;
+   pBuffer[1] = (uValue >> 8) & 0xFF;
+   pBuffer[2] = (uValue >> 16) & 0xFF;
+   pBuffer[3] = (uValue >> 24) & 0xFF;
+}
+
+static u32 _radio_sim_get_u32(u8* pBuffer)
+{
+   return ((u32)pBuffer[0]) | (((u32)pBuffer[1])<<8) | (((u32)pBuffer[2])<<16) | (((u32)pBuffer[3])<<24);
+}
+
+FILE* radio_sim_pcap_open_write(const char* szFile)
+{
+   FILE* fd = fopen(szFile, "wb");
+   if ( NULL == fd )
+   {
+      log_softerror_and_alarm("[RadioSim] Failed to create pcap file %s", szFile);
+      return NULL;
+   }
+   u8 header[24];
+   _radio_sim_put_u32(header, 0xA1B2C3D4);
+   header[4] = 2; header[5] = 0; // version 2.4
+   header[6] = 4; header[7] = 0;
+   _radio_sim_put_u32(header+8, 0); // time zone
+   _radio_sim_put_u32(header+12, 0); // sigfigs
+   _radio_sim_put_u32(header+16, 65535); // snap length
+   _radio_sim_put_u32(header+20, RADIO_SIM_PCAP_LINKTYPE_RADIOTAP);
+   if ( 24 != fwrite(header, 1, 24, fd) )
+   {
+      fclose(fd);
+      return NULL;
+   }
+   return fd;
+}
+
+int radio_sim_pcap_write_packet(FILE* fd, u8* pData, int iLength, u32 uTimeMicros)
+{
+   return radio_sim_pcap_write_packet_ex(fd, pData, iLength, uTimeMicros, RADIO_SIM_PCAP_NO_RSSI);
+}
+
+int radio_sim_pcap_write_packet_ex(FILE* fd, u8* pData, int iLength, u32 uTimeMicros, int iRSSIDbm)
+{
+   if ( NULL == fd || NULL == pData || iLength <= 0 )
+      return 0;
+
+   // Minimal radiotap header: version 0, length 8, no fields present; or the antenna signal (dBm) field only
+   int iRadiotapLength = RADIO_SIM_RADIOTAP_LENGTH;
+   if ( RADIO_SIM_PCAP_NO_RSSI != iRSSIDbm )
+      iRadiotapLength++;
+
+   u8 header[16 + RADIO_SIM_RADIOTAP_LENGTH + 1 + RADIO_SIM_IEEE80211_HEADER_LENGTH];
+   int iHeaderLength = 16 + iRadiotapLength + RADIO_SIM_IEEE80211_HEADER_LENGTH;
+   u32 uCapturedLength = iRadiotapLength + RADIO_SIM_IEEE80211_HEADER_LENGTH + iLength;
+   _radio_sim_put_u32(header, uTimeMicros/1000000);
+   _radio_sim_put_u32(header+4, uTimeMicros%1000000);
+   _radio_sim_put_u32(header+8, uCapturedLength);
+   _radio_sim_put_u32(header+12, uCapturedLength);
+
+   u8* pRadiotap = header + 16;
+   memset(pRadiotap, 0, iRadiotapLength);
+   pRadiotap[2] = (u8)iRadiotapLength;
+   if ( RADIO_SIM_PCAP_NO_RSSI != iRSSIDbm )
+   {
+      _radio_sim_put_u32(pRadiotap+4, ((u32)1)<<RADIO_SIM_RADIOTAP_DBM_ANTSIGNAL);
+      if ( iRSSIDbm < -128 )
+         iRSSIDbm = -128;
+      if ( iRSSIDbm > 127 )
+         iRSSIDbm = 127;
+      pRadiotap[RADIO_SIM_RADIOTAP_LENGTH] = (u8)(signed char)iRSSIDbm;
+   }
+   memcpy(pRadiotap + iRadiotapLength, s_uRadioSimIEEE80211Header, RADIO_SIM_IEEE80211_HEADER_LENGTH);
+
+   if ( iHeaderLength != (int)fwrite(header, 1, iHeaderLength, fd) )
+      return 0;
+   if ( iLength != (int)fwrite(pData, 1, iLength, fd) )
+      return 0;
+   return 1;
+}
+
+// Finds the antenna signal (dBm) field: only the fields before it in the first present word are skipped
+static int _radio_sim_radiotap_get_dbm(u8* pRadiotap, int iLength)
+{
+   static const int s_iFieldSizes[RADIO_SIM_RADIOTAP_DBM_ANTSIGNAL] = { 8, 1, 1, 4, 2 }; // TSFT, flags, rate, channel, FHSS
+   static const int s_iFieldAligns[RADIO_SIM_RADIOTAP_DBM_ANTSIGNAL] = { 8, 1, 1, 2, 2 };
+
+   if ( iLength < 8 )
+      return RADIO_SIM_PCAP_NO_RSSI;
+   u32 uPresent = _radio_sim_get_u32(pRadiotap+4);
+   if ( ! (uPresent & (((u32)1)<<RADIO_SIM_RADIOTAP_DBM_ANTSIGNAL)) )
+      return RADIO_SIM_PCAP_NO_RSSI;
+
+   // Extended present words
+   int iOffset = 8;
+   u32 uWord = uPresent;
+   while ( uWord & (((u32)1)<<31) )
+   {
+      if ( iOffset + 4 > iLength )
+         return RADIO_SIM_PCAP_NO_RSSI;
+      uWord = _radio_sim_get_u32(pRadiotap+iOffset);
+      iOffset += 4;
+   }
+   for( int i=0; i<RADIO_SIM_RADIOTAP_DBM_ANTSIGNAL; i++ )
+   {
+      if ( ! (uPresent & (((u32)1)<<i)) )
+         continue;
+      iOffset = (iOffset + s_iFieldAligns[i] - 1) & (~(s_iFieldAligns[i]-1));
+      iOffset += s_iFieldSizes[i];
+   }
+   if ( iOffset >= iLength )
+      return RADIO_SIM_PCAP_NO_RSSI;
+   return (int)(signed char)pRadiotap[iOffset];
+}
+
+FILE* radio_sim_pcap_open_read(const char* szFile)
+{
+   FILE* fd = fopen(szFile, "rb");
+   if ( NULL == fd )
+   {
+      log_softerror_and_alarm("[RadioSim] Failed to open pcap file %s", szFile);
+      return NULL;
+   }
+   u8 header[24];
+   if ( 24 != fread(header, 1, 24, fd) || _radio_sim_get_u32(header) != 0xA1B2C3D4 )
+   {
+      log_softerror_and_alarm("[RadioSim] Invalid or unsupported (not little endian microseconds) pcap file %s", szFile);
+      fclose(fd);
+      return NULL;
+   }
+   if ( _radio_sim_get_u32(header+20) != RADIO_SIM_PCAP_LINKTYPE_RADIOTAP )
+   {
+      log_softerror_and_alarm("[RadioSim] Pcap file %s is not a radiotap capture (link type %u)", szFile, _radio_sim_get_u32(header+20));
+      fclose(fd);
+      return NULL;
+   }
+   return fd;
+}
+
+int radio_sim_pcap_read_packet(FILE* fd, u8* pOutBuffer, int iMaxLength, u32* pTimeMicros)
+{
+   return radio_sim_pcap_read_packet_ex(fd, pOutBuffer, iMaxLength, pTimeMicros, NULL);
+}
+
+int radio_sim_pcap_read_packet_ex(FILE* fd, u8* pOutBuffer, int iMaxLength, u32* pTimeMicros, int* piRSSIDbm)
+{
+   if ( NULL == fd || NULL == pOutBuffer )
+      return -1;
+
+   u8 header[16];
+   u8 buffer[MAX_PACKET_TOTAL_SIZE*2];
+   while ( 1 )
+   {
+      if ( 16 != fread(header, 1, 16, fd) )
+         return 0;
+      u32 uCapturedLength = _radio_sim_get_u32(header+8);
+      if ( uCapturedLength > sizeof(buffer) )
+      {
+         if ( 0 != fseek(fd, uCapturedLength, SEEK_CUR) )
+            return -1;
+         continue;
+      }
+      if ( uCapturedLength != fread(buffer, 1, uCapturedLength, fd) )
+         return 0;
+      if ( NULL != pTimeMicros )
+         *pTimeMicros = _radio_sim_get_u32(header)*1000000 + _radio_sim_get_u32(header+4);
+
+      if ( uCapturedLength < 4 )
+         continue;
+      int iRadiotapLength = ((int)buffer[2]) | (((int)buffer[3])<<8);
+      int iOffset = iRadiotapLength + RADIO_SIM_IEEE80211_HEADER_LENGTH;
+      int iLength = (int)uCapturedLength - iOffset;
+      if ( iLength < (int)sizeof(t_packet_header) )
+         continue;
+      if ( NULL != piRSSIDbm )
+         *piRSSIDbm = _radio_sim_radiotap_get_dbm(buffer, iRadiotapLength);
+      if ( iLength > iMaxLength )
+         iLength = iMaxLength;
+      memcpy(pOutBuffer, buffer + iOffset, iLength);
+      return iLength;
+   }
+   return 0;
+}
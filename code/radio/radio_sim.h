@@ -0,0 +1,101 @@
+#pragma once
+#include "../base/base.h"
+#include "radiopackets2.h"
+
+// Simulated radio link, used to run the vehicle TX and station RX packet paths
+// without monitor mode cards: packets written on one end are delivered on the other
+// end after loss, latency, jitter, reordering and bandwidth limits are applied.
+// All times are in microseconds of simulation time, supplied by the caller.
+
+#define RADIO_SIM_LOSS_NONE 0
+#define RADIO_SIM_LOSS_UNIFORM 1
+#define RADIO_SIM_LOSS_GILBERT_ELLIOTT 2
+
+#define RADIO_SIM_MAX_QUEUED_PACKETS 1024
+
+#define RADIO_SIM_PCAP_LINKTYPE_RADIOTAP 127
+#define RADIO_SIM_PCAP_NO_RSSI (-1000)
+
+typedef struct
+{
+   int iLossModel;
+   float fLossRate; // uniform loss probability (0..1)
+   float fGEGoodToBad; // Gilbert-Elliott: probability to go from good to bad state, per packet
+   float fGEBadToGood; // Gilbert-Elliott: probability to go from bad to good state, per packet
+   float fGELossGood; // loss probability while in good state
+   float fGELossBad; // loss probability while in bad state
+   u32 uLatencyMicros;
+   u32 uJitterMicros; // uniform extra delay, 0..jitter
+   float fReorderRate; // probability a packet is held back
+   u32 uReorderDelayMicros; // extra delay for held back packets
+   u32 uBandwidthBitsPerSec; // 0 for unlimited
+   int iMaxQueuedPackets; // packets over the bandwidth cap are dropped when the queue is full
+} t_radio_sim_link_params;
+
+typedef struct
+{
+   u32 uPacketsIn;
+   u32 uBytesIn;
+   u32 uPacketsLost;
+   u32 uPacketsDroppedQueueFull;
+   u32 uPacketsReordered;
+   u32 uPacketsDelivered;
+   u32 uBytesDelivered;
+   u32 uMaxQueuedPackets;
+} t_radio_sim_link_stats;
+
+typedef struct
+{
+   u8* pData;
+   int iLength;
+   u32 uDeliveryTime;
+   u32 uSequence;
+} t_radio_sim_packet;
+
+typedef struct
+{
+   t_radio_sim_link_params params;
+   t_radio_sim_link_stats stats;
+   u32 uRandomState;
+   int iGEStateBad;
+   u32 uTimeChannelFree; // when the bandwidth limited channel is free again
+   u32 uSequence;
+   t_radio_sim_packet packets[RADIO_SIM_MAX_QUEUED_PACKETS];
+   int iQueuedPackets;
+} t_radio_sim_link;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void radio_sim_link_params_reset(t_radio_sim_link_params* pParams);
+t_radio_sim_link* radio_sim_link_create(t_radio_sim_link_params* pParams, u32 uRandomSeed);
+void radio_sim_link_destroy(t_radio_sim_link* pLink);
+void radio_sim_link_reset_stats(t_radio_sim_link* pLink);
+
+// Returns 1 if the packet was accepted by the channel (it can still be lost), 0 if dropped on a full queue
+int radio_sim_link_write(t_radio_sim_link* pLink, u8* pData, int iLength, u32 uTimeNowMicros);
+
+// Returns the length of the next packet due for delivery at uTimeNowMicros (copied to pOutBuffer), 0 if none
+int radio_sim_link_read(t_radio_sim_link* pLink, u8* pOutBuffer, int iMaxLength, u32 uTimeNowMicros);
+
+// Returns the delivery time of the next queued packet, or MAX_U32 if the link is empty
+u32 radio_sim_link_get_next_delivery_time(t_radio_sim_link* pLink);
+
+// Parses a loss spec: "none", "uniform:rate" or "ge:p_good_to_bad,p_bad_to_good,loss_good,loss_bad"
+int radio_sim_parse_loss_model(const char* szSpec, t_radio_sim_link_params* pParams);
+
+// Pcap files (radiotap link type), so captures can be opened in wireshark or replayed into the RX path.
+// Written packets get a minimal radiotap header and 802.11 data header in front of the Ruby packet.
+FILE* radio_sim_pcap_open_write(const char* szFile);
+int radio_sim_pcap_write_packet(FILE* fd, u8* pData, int iLength, u32 uTimeMicros);
+FILE* radio_sim_pcap_open_read(const char* szFile);
+// Returns the Ruby packet length (radiotap and 802.11 headers stripped), 0 on end of file, -1 on error
+int radio_sim_pcap_read_packet(FILE* fd, u8* pOutBuffer, int iMaxLength, u32* pTimeMicros);
+// Same, with the RSSI (radiotap antenna signal, dBm); RADIO_SIM_PCAP_NO_RSSI if there is none
+int radio_sim_pcap_write_packet_ex(FILE* fd, u8* pData, int iLength, u32 uTimeMicros, int iRSSIDbm);
+int radio_sim_pcap_read_packet_ex(FILE* fd, u8* pOutBuffer, int iMaxLength, u32* pTimeMicros, int* piRSSIDbm);
+
+#ifdef __cplusplus
+}
+#endif
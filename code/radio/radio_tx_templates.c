@@ -0,0 +1,167 @@
+/*
+You can use this C/C++ code however you wish (for example, but not limited to:
+     as is, or by modifying it, or by adding new code, or by removing parts of the code;
+     in public or private projects, in new free or commercial products)
+     only if you get a priori written consent from Petru Soroaga (petrusoroaga@yahoo.com) for your specific use
+     and only if this copyright terms are preserved in the code.
+     This code is public for learning and academic purposes.
+Also, check the licences folder for additional licences terms.
+Code written by: Petru Soroaga, 2021-2023
+*/
+
+#include "../base/config.h"
+#include "radiolink.h"
+#include "radioflags.h"
+#include "radio_tx_templates.h"
+
+#define RADIO_TX_PROBE_LENGTH_1 100
+#define RADIO_TX_PROBE_LENGTH_2 300
+
+// Computes the CRC of each chained packet, on the whole packet or on the headers only
+static void _radio_tx_templates_compute_crcs(u8* pPacketData, int nLength)
+{
+   while ( nLength >= (int)sizeof(t_packet_header) )
+   {
+      t_packet_header* pPH = (t_packet_header*)pPacketData;
+      if ( (pPH->total_length < sizeof(t_packet_header)) || ((int)pPH->total_length > nLength) )
+         return;
+      if ( pPH->packet_flags & PACKET_FLAGS_BIT_HEADERS_ONLY_CRC )
+         packet_compute_crc(pPacketData, pPH->total_headers_length);
+      else
+         packet_compute_crc(pPacketData, pPH->total_length);
+      nLength -= pPH->total_length;
+      pPacketData += pPH->total_length;
+   }
+}
+
+// Two chained packets, one with a whole packet CRC and one with a headers only CRC, both with a wrong CRC
+static void _radio_tx_templates_fill_probe(u8* pBuffer, int nLength)
+{
+   for( int i=0; i<nLength; i++ )
+      pBuffer[i] = (u8)(i*7+3);
+
+   int iFirstLength = nLength/2;
+   t_packet_header* pPH = (t_packet_header*)pBuffer;
+   pPH->crc = 0xA5A5A5A5;
+   pPH->packet_flags = PACKET_COMPONENT_RUBY;
+   pPH->packet_type = PACKET_TYPE_RUBY_PING_CLOCK;
+   pPH->stream_packet_idx = (STREAM_ID_DATA) << PACKET_FLAGS_MASK_SHIFT_STREAM_INDEX;
+   pPH->total_headers_length = sizeof(t_packet_header);
+   pPH->total_length = iFirstLength;
+
+   pPH = (t_packet_header*)(pBuffer + iFirstLength);
+   pPH->crc = 0x5A5A5A5A;
+   pPH->packet_flags = PACKET_COMPONENT_RUBY | PACKET_FLAGS_BIT_HEADERS_ONLY_CRC;
+   pPH->packet_type = PACKET_TYPE_RUBY_PING_CLOCK;
+   pPH->stream_packet_idx = (STREAM_ID_DATA) << PACKET_FLAGS_MASK_SHIFT_STREAM_INDEX;
+   pPH->total_headers_length = sizeof(t_packet_header);
+   pPH->total_length = nLength - iFirstLength;
+}
+
+// Returns the payload mode that reproduces radio_build_packet for this probe, -1 if none does
+static int _radio_tx_templates_check_probe(int nLength, u8* pHeader, int* piHeaderLength)
+{
+   u8 uProbe[RADIO_TX_PROBE_LENGTH_2];
+   u8 uExpected[RADIO_TX_PROBE_LENGTH_2];
+   u8 uRaw[MAX_PACKET_TOTAL_SIZE];
+
+   _radio_tx_templates_fill_probe(uProbe, nLength);
+   memcpy(uExpected, uProbe, nLength);
+
+   int iTotal = radio_build_packet(uRaw, uProbe, nLength, RADIO_PORT_ROUTER_DOWNLINK, 0, 0, NULL);
+   int iHeaderLength = iTotal - nLength;
+   if ( (iHeaderLength <= 0) || (iHeaderLength > RADIO_TX_TEMPLATE_MAX_HEADER) )
+      return -1;
+   if ( (*piHeaderLength > 0) && ((*piHeaderLength != iHeaderLength) || (0 != memcmp(pHeader, uRaw, iHeaderLength))) )
+      return -1;
+   *piHeaderLength = iHeaderLength;
+   memcpy(pHeader, uRaw, iHeaderLength);
+
+   if ( 0 == memcmp(uRaw + iHeaderLength, uExpected, nLength) )
+      return RADIO_TX_PAYLOAD_MODE_COPY;
+   _radio_tx_templates_compute_crcs(uExpected, nLength);
+   if ( 0 == memcmp(uRaw + iHeaderLength, uExpected, nLength) )
+      return RADIO_TX_PAYLOAD_MODE_CRC;
+   return -1;
+}
+
+int radio_tx_templates_detect_payload_mode()
+{
+   radio_set_out_datarate(DEFAULT_RADIO_DATARATE);
+   radio_set_frames_flags(DEFAULT_RADIO_FRAMES_FLAGS);
+
+   // The headers must not depend on the payload length, and both probes must agree on the payload
+   u8 uHeader[RADIO_TX_TEMPLATE_MAX_HEADER];
+   int iHeaderLength = 0;
+   int iMode1 = _radio_tx_templates_check_probe(RADIO_TX_PROBE_LENGTH_1, uHeader, &iHeaderLength);
+   int iMode2 = _radio_tx_templates_check_probe(RADIO_TX_PROBE_LENGTH_2, uHeader, &iHeaderLength);
+
+   int iMode = RADIO_TX_PAYLOAD_MODE_BUILDER;
+   if ( (iMode1 > 0) && (iMode1 == iMode2) )
+      iMode = iMode1;
+   log_line("[RadioTXTemplates] Radio headers: %d bytes, payload mode: %s", iHeaderLength,
+      (iMode == RADIO_TX_PAYLOAD_MODE_COPY)?"copy":((iMode == RADIO_TX_PAYLOAD_MODE_CRC)?"copy and CRC":"not reproducible, templates disabled"));
+   return iMode;
+}
+
+int radio_tx_template_init(t_radio_tx_template* pTemplate, int iDataRate, u32 uRadioFlags, int iPort)
+{
+   if ( NULL == pTemplate )
+      return 0;
+   pTemplate->iDataRate = iDataRate;
+   pTemplate->uRadioFlags = uRadioFlags;
+   pTemplate->iPort = iPort;
+   pTemplate->iHeaderLength = 0;
+
+   radio_set_out_datarate(iDataRate);
+   radio_set_frames_flags(uRadioFlags);
+
+   // A single packet, headers only
+   u8 uProbe[sizeof(t_packet_header)];
+   u8 uRaw[MAX_PACKET_TOTAL_SIZE];
+   memset(uProbe, 0, sizeof(uProbe));
+   t_packet_header* pPH = (t_packet_header*)uProbe;
+   pPH->packet_flags = PACKET_COMPONENT_RUBY;
+   pPH->packet_type = PACKET_TYPE_RUBY_PING_CLOCK;
+   pPH->total_headers_length = sizeof(t_packet_header);
+   pPH->total_length = sizeof(t_packet_header);
+   int iTotal = radio_build_packet(uRaw, uProbe, sizeof(uProbe), iPort, 0, 0, NULL);
+   int iHeaderLength = iTotal - (int)sizeof(uProbe);
+   if ( (iHeaderLength <= 0) || (iHeaderLength > RADIO_TX_TEMPLATE_MAX_HEADER) )
+   {
+      log_softerror_and_alarm("[RadioTXTemplates] Can't capture the radio headers for datarate %d, radio flags %u, port %d (%d bytes).", iDataRate, uRadioFlags, iPort, iHeaderLength);
+      return 0;
+   }
+   memcpy(pTemplate->uHeader, uRaw, iHeaderLength);
+   pTemplate->iHeaderLength = iHeaderLength;
+   return 1;
+}
+
+int radio_tx_template_build_packet(const t_radio_tx_template* pTemplate, int iPayloadMode, u8* pRawPacket, u8* pPacketData, int nInputLength)
+{
+   if ( (NULL == pTemplate) || (pTemplate->iHeaderLength <= 0) || (iPayloadMode == RADIO_TX_PAYLOAD_MODE_BUILDER) )
+      return 0;
+   if ( (nInputLength <= 0) || (pTemplate->iHeaderLength + nInputLength > MAX_PACKET_TOTAL_SIZE) )
+      return 0;
+
+   memcpy(pRawPacket, pTemplate->uHeader, pTemplate->iHeaderLength);
+   memcpy(pRawPacket + pTemplate->iHeaderLength, pPacketData, nInputLength);
+   if ( iPayloadMode == RADIO_TX_PAYLOAD_MODE_CRC )
+      _radio_tx_templates_compute_crcs(pRawPacket + pTemplate->iHeaderLength, nInputLength);
+   return pTemplate->iHeaderLength + nInputLength;
+}
+
+int radio_tx_template_build_packet_in_place(const t_radio_tx_template* pTemplate, int iPayloadMode, u8* pPacketData, int nInputLength, u8** ppRawPacket)
+{
+   if ( (NULL == pTemplate) || (NULL == ppRawPacket) || (pTemplate->iHeaderLength <= 0) || (iPayloadMode == RADIO_TX_PAYLOAD_MODE_BUILDER) )
+      return 0;
+   if ( (nInputLength <= 0) || (pTemplate->iHeaderLength + nInputLength > MAX_PACKET_TOTAL_SIZE) )
+      return 0;
+
+   u8* pRawPacket = pPacketData - pTemplate->iHeaderLength;
+   memcpy(pRawPacket, pTemplate->uHeader, pTemplate->iHeaderLength);
+   if ( iPayloadMode == RADIO_TX_PAYLOAD_MODE_CRC )
+      _radio_tx_templates_compute_crcs(pPacketData, nInputLength);
+   *ppRawPacket = pRawPacket;
+   return pTemplate->iHeaderLength + nInputLength;
+}
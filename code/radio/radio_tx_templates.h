@@ -0,0 +1,48 @@
+#pragma once
+#include "../base/base.h"
+#include "radiopackets2.h"
+
+// Prebuilt radio TX headers (radiotap + 802.11 header) for a given datarate, radio flags and port.
+// A template is captured once from radio_build_packet; building a packet from it is then
+// a header copy plus the payload, instead of assembling the headers again for each packet.
+// How radio_build_packet treats the payload (copied as is, or with the packets CRC computed)
+// is detected once, see radio_tx_templates_detect_payload_mode. Encrypted packets and packets
+// with extra data still go through radio_build_packet.
+
+#define RADIO_TX_TEMPLATE_MAX_HEADER 96
+
+#define RADIO_TX_PAYLOAD_MODE_BUILDER 0 // templates can't reproduce radio_build_packet, always use it
+#define RADIO_TX_PAYLOAD_MODE_COPY 1 // payload is copied as is
+#define RADIO_TX_PAYLOAD_MODE_CRC 2 // payload is copied and the CRC of each chained packet is computed
+
+typedef struct
+{
+   int iDataRate;
+   u32 uRadioFlags;
+   int iPort;
+   int iHeaderLength;
+   u8  uHeader[RADIO_TX_TEMPLATE_MAX_HEADER];
+} t_radio_tx_template;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Builds probe packets with radio_build_packet and returns one of RADIO_TX_PAYLOAD_MODE_xxx.
+// Changes the radio out datarate and frames flags.
+int radio_tx_templates_detect_payload_mode();
+
+// Captures the headers for the datarate, radio flags and port. Returns 1 on success.
+// Changes the radio out datarate and frames flags (sets them to the template values).
+int radio_tx_template_init(t_radio_tx_template* pTemplate, int iDataRate, u32 uRadioFlags, int iPort);
+
+// Returns the total length of the raw packet, same output as radio_build_packet (not encrypted, no extra data)
+int radio_tx_template_build_packet(const t_radio_tx_template* pTemplate, int iPayloadMode, u8* pRawPacket, u8* pPacketData, int nInputLength);
+
+// Same, but the payload is not copied: the radio headers are written in the RADIO_TX_TEMPLATE_MAX_HEADER bytes
+// the caller keeps free before pPacketData. ppRawPacket is set to the start of the raw packet.
+int radio_tx_template_build_packet_in_place(const t_radio_tx_template* pTemplate, int iPayloadMode, u8* pPacketData, int nInputLength, u8** ppRawPacket);
+
+#ifdef __cplusplus
+}
+#endif
@@ -10,23 +10,18 @@ Code written by: Petru Soroaga, 2021-2023
 */
 
 #include "../base/base.h"
+#include "../base/crc32.h"
 #include "radiopackets2.h"
 #include "radiolink.h"
 
 void packet_compute_crc(u8* pBuffer, int length)
 {
-   u32 crc = base_compute_crc32(pBuffer + sizeof(u32), length-sizeof(u32)); 
-   u32* p = (u32*)pBuffer;
-   *p = crc;
+   crc32_store_at(pBuffer, length, 0);
 }
 
 int packet_check_crc(u8* pBuffer, int length)
 {
-   u32 crc = base_compute_crc32(pBuffer + sizeof(u32), length-sizeof(u32)); 
-   u32* p = (u32*)pBuffer;
-   if ( *p != crc )
-      return 0;
-   return 1;
+   return crc32_check_at(pBuffer, length, 0);
 }
 
 
@@ -129,9 +124,9 @@ int radio_buffer_embed_packet_to_short_packet(t_packet_header* pPH, u8* pOutPack
    pPHS->total_length = sizeof(t_packet_header_short) + pPH->total_length;
     
    if ( pPH->packet_flags & PACKET_FLAGS_BIT_HEADERS_ONLY_CRC )
-      pPH->crc = base_compute_crc32(((u8*)pPH) + sizeof(u32), pPH->total_headers_length-sizeof(u32));
+      pPH->crc = crc32_compute(((u8*)pPH) + sizeof(u32), pPH->total_headers_length-sizeof(u32));
    else
-      pPH->crc = base_compute_crc32(((u8*)pPH) + sizeof(u32), pPH->total_length-sizeof(u32));
+      pPH->crc = crc32_compute(((u8*)pPH) + sizeof(u32), pPH->total_length-sizeof(u32));
 
    memcpy(pOutPacket + sizeof(t_packet_header_short), (u8*)pPH, pPH->total_length);
 
@@ -158,7 +153,7 @@ int radio_buffer_is_valid_short_packet(u8* pBuffer, int iLength)
          pStart++;
          continue;
       }
-      u32 crc = base_compute_crc32(pStart+sizeof(u32), len-sizeof(u32));
+      u32 crc = crc32_compute(pStart+sizeof(u32), len-sizeof(u32));
       t_packet_header_short* pPHS = (t_packet_header_short*)pStart;
       if ( crc != pPHS->crc )
       {
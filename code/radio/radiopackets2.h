@@ -54,6 +54,15 @@ Code written by: Petru Soroaga, 2021-2023
 #define PACKET_FLAGS_BIT_HAS_ENCRYPTION   ((u8)(1<<6))
 #define PACKET_FLAGS_BIT_CAN_START_TX     ((u8)(1<<7))
 
+// Packet extra flags (extra_flags field in t_packet_header):
+// bit 0 - packet is sealed with authenticated encryption (see base/encr_aead.h)
+// bit 1 - sender can open sealed packets (set by controllers on the pairing requests)
+// bit 15 - extra flags are valid
+
+#define PACKET_EXTRA_FLAGS_BIT_AEAD ((u16)(1<<0))
+#define PACKET_EXTRA_FLAGS_BIT_CAN_OPEN_AEAD ((u16)(1<<1))
+#define PACKET_EXTRA_FLAGS_VALID    ((u16)(1<<15))
+
 #define PACKET_COMPONENT_LOCAL_CONTROL 0 // Used only internally, to exchange data between processes
 #define PACKET_COMPONENT_VIDEO 1
 #define PACKET_COMPONENT_TELEMETRY 2
@@ -167,6 +176,10 @@ typedef struct
 // payload is a packet_header_telemetry_raw structure and then is the actual telemetry data
 #define PACKET_TYPE_TELEMETRY_RAW_UPLOAD 42  // upload telemetry data packet from controller to vehicle
 // payload is a packet_header_telemetry_raw structure and then is the actual telemetry data
+#define PACKET_TYPE_TELEMETRY_MAVLINK_DOWNLOAD 43 // download MAVLink telemetry frames from vehicle to controller (common/telemetry_transport)
+// payload is a packet_header_telemetry_transport structure and then the frames
+#define PACKET_TYPE_TELEMETRY_MAVLINK_UPLOAD 44 // upload MAVLink telemetry frames from controller to vehicle (common/telemetry_transport)
+// payload is a packet_header_telemetry_transport structure and then the frames
 
 #define PACKET_TYPE_AUX_DATA_LINK_UPLOAD 45  // upload data link packet from controller to vehicle
 // payload is a data link segment index and data
@@ -480,6 +493,22 @@ typedef struct
 } __attribute__((packed)) t_packet_header_telemetry_raw;
 
 
+//----------------------------------------------
+// packet_header_telemetry_transport, present in PACKET_TYPE_TELEMETRY_MAVLINK_DOWNLOAD and PACKET_TYPE_TELEMETRY_MAVLINK_UPLOAD
+// Followed by uFramesCount frames: u8 flags, u16 reliable index (only for reliable frames), MAVLink frame
+//
+typedef struct
+{
+   u16 uSessionId; // of the sender, changes when the sender restarts
+   u16 uAckSessionId; // peer session the ack fields refer to
+   u16 uFirstUnackedIndex; // sender does not resend reliable frames before this one
+   u16 uAckIndex; // all peer reliable frames before this one were received
+   u32 uAckBitmap; // bit i set: peer reliable frame uAckIndex+1+i was received
+   u8  uFlags;
+   u8  uFramesCount;
+} __attribute__((packed)) t_packet_header_telemetry_transport;
+
+
 #define MAX_HISTORY_VEHICLE_TX_STATS_SLICES 40
 typedef struct
 {
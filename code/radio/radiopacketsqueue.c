@@ -1,7 +1,7 @@
 /*
 You can use this C/C++ code however you wish (for example, but not limited to:
      as is, or by modifying it, or by adding new code, or by removing parts of the code;
-     in public or private projects, in new free or commercial products) 
+     in public or private projects, in new free or commercial products)
      only if you get a priori written consent from Petru Soroaga (petrusoroaga@yahoo.com) for your specific use
      and only if this copyright terms are preserved in the code.
      This code is public for learning and academic purposes.
@@ -10,104 +10,405 @@ Code written by: Petru Soroaga, 2021-2023
 */
 
 #include "../base/base.h"
+#include <stdbool.h>
+#include "../base/commands.h"
 #include "radiopacketsqueue.h"
 #include "radiopackets2.h"
 #include "radiolink.h"
 
+static t_packet_buffer s_PacketsPool[MAX_PACKETS_IN_POOL];
+static int s_iPacketsPoolFree[MAX_PACKETS_IN_POOL];
+static int s_iPacketsPoolFreeCount = 0;
+static int s_bPacketsPoolInitialized = 0;
+
+static const char* s_szPacketsQueueClassNames[PACKETS_QUEUE_CLASSES] = { "urgent", "control", "telemetry", "bulk" };
+
+static void _packets_pool_init()
+{
+   for( int i=0; i<MAX_PACKETS_IN_POOL; i++ )
+   {
+      s_PacketsPool[i].uRefCount = 0;
+      s_iPacketsPoolFree[i] = MAX_PACKETS_IN_POOL-1-i;
+   }
+   s_iPacketsPoolFreeCount = MAX_PACKETS_IN_POOL;
+   s_bPacketsPoolInitialized = 1;
+}
+
+t_packet_buffer* packets_pool_alloc()
+{
+   if ( ! s_bPacketsPoolInitialized )
+      _packets_pool_init();
+   if ( 0 == s_iPacketsPoolFreeCount )
+      return NULL;
+
+   s_iPacketsPoolFreeCount--;
+   t_packet_buffer* pBuffer = &s_PacketsPool[s_iPacketsPoolFree[s_iPacketsPoolFreeCount]];
+   pBuffer->uRefCount = 1;
+   pBuffer->packet_length = 0;
+   pBuffer->has_radio_header = 0;
+   return pBuffer;
+}
+
+void packets_pool_add_ref(t_packet_buffer* pBuffer)
+{
+   if ( (NULL == pBuffer) || (0 == pBuffer->uRefCount) || (pBuffer->uRefCount == 0xFF) )
+      return;
+   pBuffer->uRefCount++;
+}
+
+void packets_pool_release(t_packet_buffer* pBuffer)
+{
+   if ( (NULL == pBuffer) || (0 == pBuffer->uRefCount) )
+      return;
+   pBuffer->uRefCount--;
+   if ( 0 != pBuffer->uRefCount )
+      return;
+   if ( s_iPacketsPoolFreeCount < MAX_PACKETS_IN_POOL )
+      s_iPacketsPoolFree[s_iPacketsPoolFreeCount++] = (int)(pBuffer - s_PacketsPool);
+}
+
+int packets_pool_get_free_count()
+{
+   if ( ! s_bPacketsPoolInitialized )
+      _packets_pool_init();
+   return s_iPacketsPoolFreeCount;
+}
+
+int packets_queue_get_packet_class(u8* pPacket)
+{
+   if ( NULL == pPacket )
+      return PACKETS_QUEUE_CLASS_BULK;
+
+   t_packet_header* pPH = (t_packet_header*)pPacket;
+   switch ( pPH->packet_flags & PACKET_FLAGS_MASK_MODULE )
+   {
+      case PACKET_COMPONENT_LOCAL_CONTROL:
+      case PACKET_COMPONENT_RC:
+         return PACKETS_QUEUE_CLASS_CONTROL;
+
+      case PACKET_COMPONENT_VIDEO:
+         if ( (pPH->packet_type == PACKET_TYPE_VIDEO_REQ_MULTIPLE_PACKETS) ||
+              (pPH->packet_type == PACKET_TYPE_VIDEO_REQ_MULTIPLE_PACKETS2) ||
+              (pPH->packet_type == PACKET_TYPE_VIDEO_SWITCH_TO_ADAPTIVE_VIDEO_LEVEL) ||
+              (pPH->packet_type == PACKET_TYPE_VIDEO_SWITCH_TO_ADAPTIVE_VIDEO_LEVEL_ACK) ||
+              (pPH->packet_type == PACKET_TYPE_VIDEO_SWITCH_VIDEO_KEYFRAME_TO_VALUE) ||
+              (pPH->packet_type == PACKET_TYPE_VIDEO_SWITCH_VIDEO_KEYFRAME_TO_VALUE_ACK) )
+            return PACKETS_QUEUE_CLASS_CONTROL;
+         return PACKETS_QUEUE_CLASS_BULK;
+
+      case PACKET_COMPONENT_COMMANDS:
+         if ( (pPH->packet_type == PACKET_TYPE_COMMAND) && (pPH->total_length >= sizeof(t_packet_header) + sizeof(t_packet_header_command)) )
+         {
+            t_packet_header_command* pPHC = (t_packet_header_command*)(pPacket + sizeof(t_packet_header));
+            u16 uCommandType = pPHC->command_type & COMMAND_TYPE_MASK;
+            if ( (uCommandType == COMMAND_ID_UPLOAD_FILE_SEGMENT) || (uCommandType == COMMAND_ID_UPLOAD_SW_TO_VEHICLE) || (uCommandType == COMMAND_ID_UPLOAD_SW_TO_VEHICLE63) )
+               return PACKETS_QUEUE_CLASS_BULK;
+         }
+         return PACKETS_QUEUE_CLASS_CONTROL;
+
+      case PACKET_COMPONENT_TELEMETRY:
+         if ( (pPH->packet_type == PACKET_TYPE_TELEMETRY_RAW_UPLOAD) || (pPH->packet_type == PACKET_TYPE_AUX_DATA_LINK_UPLOAD) )
+            return PACKETS_QUEUE_CLASS_BULK;
+         return PACKETS_QUEUE_CLASS_TELEMETRY;
+
+      case PACKET_COMPONENT_RUBY:
+         return PACKETS_QUEUE_CLASS_TELEMETRY;
+   }
+   return PACKETS_QUEUE_CLASS_BULK;
+}
+
+static void _packets_queue_update_time_first_packet(t_packet_queue* pQueue)
+{
+   pQueue->timeFirstPacket = MAX_U32;
+   for( int iClass=0; iClass<PACKETS_QUEUE_CLASSES; iClass++ )
+   {
+      t_packet_queue_class* pClass = &(pQueue->classes[iClass]);
+      if ( 0 == pClass->iCount )
+         continue;
+      // Injected packets go at the start of a class, so check both ends
+      u32 uTimeStart = pClass->entries[pClass->iStart].uTimeAddedMs;
+      u32 uTimeEnd = pClass->entries[(pClass->iStart + pClass->iCount - 1) % MAX_PACKETS_IN_QUEUE].uTimeAddedMs;
+      if ( uTimeStart < pQueue->timeFirstPacket )
+         pQueue->timeFirstPacket = uTimeStart;
+      if ( uTimeEnd < pQueue->timeFirstPacket )
+         pQueue->timeFirstPacket = uTimeEnd;
+   }
+}
+
+static t_packet_buffer* _packets_queue_class_pop(t_packet_queue_class* pClass)
+{
+   t_packet_queue_entry* pEntry = &(pClass->entries[pClass->iStart]);
+   t_packet_buffer* pBuffer = pEntry->pBuffer;
+   u32 uDelay = get_current_timestamp_micros() - pEntry->uTimeAddedMicros;
+   pClass->stats.uPacketsOut++;
+   pClass->stats.uDelayTotalMicros += uDelay;
+   if ( uDelay > pClass->stats.uDelayMaxMicros )
+      pClass->stats.uDelayMaxMicros = uDelay;
+
+   pEntry->pBuffer = NULL;
+   pClass->iStart = (pClass->iStart + 1) % MAX_PACKETS_IN_QUEUE;
+   pClass->iCount--;
+   return pBuffer;
+}
 
 void packets_queue_init(t_packet_queue* pQueue)
 {
    if ( NULL == pQueue )
       return;
-   pQueue->queue_start_pos = -1;
-   pQueue->queue_end_pos = -1;   
+   if ( pQueue->bInitialized )
+      packets_queue_clear(pQueue);
+   memset(pQueue, 0, sizeof(t_packet_queue));
+   pQueue->timeFirstPacket = MAX_U32;
+   packets_queue_set_class_params(pQueue, PACKETS_QUEUE_CLASS_URGENT, 16, 0, PACKETS_QUEUE_DROP_OLDEST);
+   packets_queue_set_class_params(pQueue, PACKETS_QUEUE_CLASS_CONTROL, MAX_PACKETS_IN_QUEUE, 0, PACKETS_QUEUE_DROP_NEWEST);
+   packets_queue_set_class_params(pQueue, PACKETS_QUEUE_CLASS_TELEMETRY, 48, 3, PACKETS_QUEUE_DROP_OLDEST);
+   packets_queue_set_class_params(pQueue, PACKETS_QUEUE_CLASS_BULK, MAX_PACKETS_IN_QUEUE, 1, PACKETS_QUEUE_DROP_NEWEST);
+   pQueue->bInitialized = 1;
 }
 
-int packets_queue_is_empty(t_packet_queue* pQueue)
+void packets_queue_clear(t_packet_queue* pQueue)
 {
    if ( NULL == pQueue )
-      return 1;
-   return (pQueue->queue_start_pos == pQueue->queue_end_pos);
+      return;
+   for( int iClass=0; iClass<PACKETS_QUEUE_CLASSES; iClass++ )
+   {
+      t_packet_queue_class* pClass = &(pQueue->classes[iClass]);
+      while ( pClass->iCount > 0 )
+      {
+         packets_pool_release(pClass->entries[pClass->iStart].pBuffer);
+         pClass->entries[pClass->iStart].pBuffer = NULL;
+         pClass->iStart = (pClass->iStart + 1) % MAX_PACKETS_IN_QUEUE;
+         pClass->iCount--;
+      }
+      pClass->iStart = 0;
+      pClass->iDeficit = 0;
+   }
+   if ( NULL != pQueue->pLastPopped )
+      packets_pool_release(pQueue->pLastPopped);
+   pQueue->pLastPopped = NULL;
+   pQueue->iCurrentWeightedClass = 0;
+   pQueue->bWeightedTurnStarted = 0;
+   pQueue->timeFirstPacket = MAX_U32;
 }
 
-int packets_queue_has_packets(t_packet_queue* pQueue)
+void packets_queue_set_class_params(t_packet_queue* pQueue, int iClass, int iMaxDepth, int iWeight, int iDropPolicy)
 {
-   if ( NULL == pQueue )
-      return 0;
-   if ( pQueue->queue_start_pos == pQueue->queue_end_pos )
-      return 0;
+   if ( (NULL == pQueue) || (iClass < 0) || (iClass >= PACKETS_QUEUE_CLASSES) )
+      return;
+   if ( iMaxDepth < 1 )
+      iMaxDepth = 1;
+   if ( iMaxDepth > MAX_PACKETS_IN_QUEUE )
+      iMaxDepth = MAX_PACKETS_IN_QUEUE;
+   if ( iWeight < 0 )
+      iWeight = 0;
+   pQueue->classes[iClass].iMaxDepth = iMaxDepth;
+   pQueue->classes[iClass].iWeight = iWeight;
+   pQueue->classes[iClass].iDropPolicy = iDropPolicy;
+   pQueue->classes[iClass].iDeficit = 0;
+}
 
-   if ( pQueue->queue_end_pos > pQueue->queue_start_pos )
-      return pQueue->queue_end_pos - pQueue->queue_start_pos;
+t_packet_queue_class_stats* packets_queue_get_class_stats(t_packet_queue* pQueue, int iClass)
+{
+   if ( (NULL == pQueue) || (iClass < 0) || (iClass >= PACKETS_QUEUE_CLASSES) )
+      return NULL;
+   return &(pQueue->classes[iClass].stats);
+}
+
+void packets_queue_log_stats(t_packet_queue* pQueue, const char* szName)
+{
+   if ( NULL == pQueue )
+      return;
+   for( int iClass=0; iClass<PACKETS_QUEUE_CLASSES; iClass++ )
+   {
+      t_packet_queue_class_stats* pStats = &(pQueue->classes[iClass].stats);
+      if ( (0 != pStats->uPacketsIn) || (0 != pStats->uPacketsOut) )
+      {
+         u32 uDelayAvg = 0;
+         if ( 0 != pStats->uPacketsOut )
+            uDelayAvg = (u32)(pStats->uDelayTotalMicros / pStats->uPacketsOut);
+         log_line("[Queue] %s, %s packets: in %u, out %u, dropped %u, queued now %d, delay avg/max: %u/%u us",
+            (NULL != szName)?szName:"", s_szPacketsQueueClassNames[iClass],
+            pStats->uPacketsIn, pStats->uPacketsOut, pStats->uPacketsDropped, pQueue->classes[iClass].iCount, uDelayAvg, pStats->uDelayMaxMicros);
+      }
+      memset(pStats, 0, sizeof(t_packet_queue_class_stats));
+   }
+   log_line("[Queue] Free packets buffers in pool: %d of %d", packets_pool_get_free_count(), MAX_PACKETS_IN_POOL);
+}
 
-   return pQueue->queue_end_pos + (MAX_PACKETS_IN_QUEUE - pQueue->queue_start_pos);
+int packets_queue_is_empty(t_packet_queue* pQueue)
+{
+   return (0 == packets_queue_has_packets(pQueue));
 }
 
-int packets_queue_inject_packet_first(t_packet_queue* pQueue, u8* pBuffer)
+int packets_queue_has_packets(t_packet_queue* pQueue)
 {
    if ( NULL == pQueue )
       return 0;
+   int iCount = 0;
+   for( int iClass=0; iClass<PACKETS_QUEUE_CLASSES; iClass++ )
+      iCount += pQueue->classes[iClass].iCount;
+   return iCount;
+}
 
-   t_packet_header* pPH = (t_packet_header*)pBuffer;
+static int _packets_queue_add_buffer(t_packet_queue* pQueue, t_packet_buffer* pBuffer, int iClass, int bFirst)
+{
+   if ( NULL == pBuffer )
+      return 0;
+   if ( (NULL == pQueue) || (iClass < 0) || (iClass >= PACKETS_QUEUE_CLASSES) )
+   {
+      packets_pool_release(pBuffer);
+      return 0;
+   }
+   if ( ! pQueue->bInitialized )
+      packets_queue_init(pQueue);
 
+   t_packet_queue_class* pClass = &(pQueue->classes[iClass]);
+   pClass->stats.uPacketsIn++;
 
-   if ( (-1 == pQueue->queue_start_pos) || (pQueue->queue_start_pos == pQueue->queue_end_pos) )
+   if ( pClass->iCount >= pClass->iMaxDepth )
    {
-      pQueue->queue_start_pos = 0;
-      pQueue->queue_end_pos = 1;
-      pQueue->timeFirstPacket = get_current_timestamp_ms();
-      pQueue->packets_queue[0].packet_length = pPH->total_length;
-      memcpy( &(pQueue->packets_queue[0].packet_buffer[0]), pBuffer, pQueue->packets_queue[0].packet_length);
-      return 1;
+      pClass->stats.uPacketsDropped++;
+      if ( pClass->iDropPolicy != PACKETS_QUEUE_DROP_OLDEST )
+      {
+         packets_pool_release(pBuffer);
+         return 0;
+      }
+      packets_pool_release(pClass->entries[pClass->iStart].pBuffer);
+      pClass->entries[pClass->iStart].pBuffer = NULL;
+      pClass->iStart = (pClass->iStart + 1) % MAX_PACKETS_IN_QUEUE;
+      pClass->iCount--;
    }
 
-   pQueue->queue_start_pos--;
-   if ( pQueue->queue_start_pos < 0 )
-      pQueue->queue_start_pos = MAX_PACKETS_IN_QUEUE-1;
+   int iPos = (pClass->iStart + pClass->iCount) % MAX_PACKETS_IN_QUEUE;
+   if ( bFirst )
+   {
+      pClass->iStart = (pClass->iStart + MAX_PACKETS_IN_QUEUE - 1) % MAX_PACKETS_IN_QUEUE;
+      iPos = pClass->iStart;
+   }
+   pClass->entries[iPos].pBuffer = pBuffer;
+   pClass->entries[iPos].uTimeAddedMs = get_current_timestamp_ms();
+   pClass->entries[iPos].uTimeAddedMicros = get_current_timestamp_micros();
+   pClass->iCount++;
 
-   pQueue->packets_queue[pQueue->queue_start_pos].packet_length = pPH->total_length;
-   memcpy( &(pQueue->packets_queue[pQueue->queue_start_pos].packet_buffer[0]), pBuffer, pQueue->packets_queue[pQueue->queue_start_pos].packet_length);
+   if ( pClass->entries[iPos].uTimeAddedMs < pQueue->timeFirstPacket )
+      pQueue->timeFirstPacket = pClass->entries[iPos].uTimeAddedMs;
    return 1;
 }
 
-int packets_queue_add_packet(t_packet_queue* pQueue, u8* pBuffer)
+int packets_queue_add_buffer(t_packet_queue* pQueue, t_packet_buffer* pBuffer, int iClass)
 {
-   return packets_queue_add_packet2(pQueue, pBuffer, -1, 0);
+   return _packets_queue_add_buffer(pQueue, pBuffer, iClass, 0);
 }
 
-int packets_queue_add_packet2(t_packet_queue* pQueue, u8* pBuffer, int length, int has_radio_header)
+t_packet_buffer* packets_queue_pop_buffer(t_packet_queue* pQueue)
 {
    if ( NULL == pQueue )
-      return 0;
-   if ( -1 == pQueue->queue_start_pos )
+      return NULL;
+
+   t_packet_buffer* pBuffer = NULL;
+
+   // Strict classes first, in class order
+
+   for( int iClass=0; iClass<PACKETS_QUEUE_CLASSES; iClass++ )
    {
-      pQueue->queue_start_pos = 0;
-      pQueue->queue_end_pos = 0;
+      t_packet_queue_class* pClass = &(pQueue->classes[iClass]);
+      if ( (0 == pClass->iWeight) && (pClass->iCount > 0) )
+      {
+         pBuffer = _packets_queue_class_pop(pClass);
+         _packets_queue_update_time_first_packet(pQueue);
+         return pBuffer;
+      }
    }
 
-   // Full queue
-   if ( ((pQueue->queue_end_pos+1) % MAX_PACKETS_IN_QUEUE) == pQueue->queue_start_pos )
-      return 0;
+   // Deficit round robin on the weighted classes. A quantum is at least one packet,
+   // so two rounds always find a packet if there is any.
 
-   // Empty queue
-   if ( pQueue->queue_start_pos == pQueue->queue_end_pos )
-      pQueue->timeFirstPacket = get_current_timestamp_ms();
+   for( int i=0; i<2*PACKETS_QUEUE_CLASSES; i++ )
+   {
+      t_packet_queue_class* pClass = &(pQueue->classes[pQueue->iCurrentWeightedClass]);
+      if ( (0 == pClass->iWeight) || (0 == pClass->iCount) )
+      {
+         pClass->iDeficit = 0;
+         pQueue->iCurrentWeightedClass = (pQueue->iCurrentWeightedClass + 1) % PACKETS_QUEUE_CLASSES;
+         pQueue->bWeightedTurnStarted = 0;
+         continue;
+      }
+      if ( ! pQueue->bWeightedTurnStarted )
+      {
+         pClass->iDeficit += pClass->iWeight * PACKETS_QUEUE_QUANTUM_BYTES;
+         pQueue->bWeightedTurnStarted = 1;
+      }
+      int iLength = pClass->entries[pClass->iStart].pBuffer->packet_length;
+      if ( pClass->iDeficit >= iLength )
+      {
+         pClass->iDeficit -= iLength;
+         pBuffer = _packets_queue_class_pop(pClass);
+         if ( 0 == pClass->iCount )
+         {
+            pClass->iDeficit = 0;
+            pQueue->iCurrentWeightedClass = (pQueue->iCurrentWeightedClass + 1) % PACKETS_QUEUE_CLASSES;
+            pQueue->bWeightedTurnStarted = 0;
+         }
+         _packets_queue_update_time_first_packet(pQueue);
+         return pBuffer;
+      }
+      pQueue->iCurrentWeightedClass = (pQueue->iCurrentWeightedClass + 1) % PACKETS_QUEUE_CLASSES;
+      pQueue->bWeightedTurnStarted = 0;
+   }
+   return NULL;
+}
 
-   pQueue->packets_queue[pQueue->queue_end_pos].has_radio_header = (u8)has_radio_header;
-   pQueue->packets_queue[pQueue->queue_end_pos].packet_length = (u16)length;
+static t_packet_buffer* _packets_queue_copy_packet(u8* pBuffer, int length, int has_radio_header)
+{
+   if ( NULL == pBuffer )
+      return NULL;
    if ( -1 == length )
    {
       t_packet_header* pPH = (t_packet_header*)pBuffer;
-      pQueue->packets_queue[pQueue->queue_end_pos].packet_length = pPH->total_length;
+      length = pPH->total_length;
    }
+   if ( (length <= 0) || (length > MAX_PACKET_TOTAL_SIZE) )
+      return NULL;
+
+   t_packet_buffer* pPacket = packets_pool_alloc();
+   if ( NULL == pPacket )
+      return NULL;
+   pPacket->packet_length = (u16)length;
+   pPacket->has_radio_header = (u8)has_radio_header;
+   memcpy(pPacket->packet_buffer, pBuffer, length);
+   return pPacket;
+}
 
-   memcpy( &(pQueue->packets_queue[pQueue->queue_end_pos].packet_buffer[0]), pBuffer, pQueue->packets_queue[pQueue->queue_end_pos].packet_length);
+int packets_queue_inject_packet_first(t_packet_queue* pQueue, u8* pBuffer)
+{
+   if ( NULL == pQueue )
+      return 0;
+   t_packet_buffer* pPacket = _packets_queue_copy_packet(pBuffer, -1, 0);
+   if ( NULL == pPacket )
+   {
+      pQueue->classes[PACKETS_QUEUE_CLASS_URGENT].stats.uPacketsDropped++;
+      return 0;
+   }
+   return _packets_queue_add_buffer(pQueue, pPacket, PACKETS_QUEUE_CLASS_URGENT, 1);
+}
 
-   pQueue->queue_end_pos++;
-   if ( pQueue->queue_end_pos >= MAX_PACKETS_IN_QUEUE )
-      pQueue->queue_end_pos = 0;
+int packets_queue_add_packet(t_packet_queue* pQueue, u8* pBuffer)
+{
+   return packets_queue_add_packet2(pQueue, pBuffer, -1, 0);
+}
 
-   return 1;
+int packets_queue_add_packet2(t_packet_queue* pQueue, u8* pBuffer, int length, int has_radio_header)
+{
+   if ( NULL == pQueue )
+      return 0;
+   int iClass = packets_queue_get_packet_class(pBuffer);
+   t_packet_buffer* pPacket = _packets_queue_copy_packet(pBuffer, length, has_radio_header);
+   if ( NULL == pPacket )
+   {
+      pQueue->classes[iClass].stats.uPacketsDropped++;
+      return 0;
+   }
+   return _packets_queue_add_buffer(pQueue, pPacket, iClass, 0);
 }
 
 u8* packets_queue_pop_packet(t_packet_queue* pQueue, int* pLength)
@@ -116,21 +417,16 @@ u8* packets_queue_pop_packet(t_packet_queue* pQueue, int* pLength)
       return NULL;
    if ( NULL != pLength )
       *pLength = 0;
-   if ( pQueue->queue_start_pos == pQueue->queue_end_pos )
+
+   if ( NULL != pQueue->pLastPopped )
+      packets_pool_release(pQueue->pLastPopped);
+   pQueue->pLastPopped = packets_queue_pop_buffer(pQueue);
+   if ( NULL == pQueue->pLastPopped )
       return NULL;
 
    if ( NULL != pLength )
-      *pLength = pQueue->packets_queue[pQueue->queue_start_pos].packet_length;
-   u8* pRet = &(pQueue->packets_queue[pQueue->queue_start_pos].packet_buffer[0]);
-
-   pQueue->queue_start_pos++;
-   if ( pQueue->queue_start_pos >= MAX_PACKETS_IN_QUEUE )
-      pQueue->queue_start_pos = 0;
-
-   if ( pQueue->queue_start_pos == pQueue->queue_end_pos )
-      pQueue->timeFirstPacket = MAX_U32;
-
-   return pRet;
+      *pLength = pQueue->pLastPopped->packet_length;
+   return &(pQueue->pLastPopped->packet_buffer[0]);
 }
 
 u8* packets_queue_peek_packet(t_packet_queue* pQueue, int index, int* pLength)
@@ -139,15 +435,25 @@ u8* packets_queue_peek_packet(t_packet_queue* pQueue, int index, int* pLength)
       return NULL;
    if ( NULL != pLength )
       *pLength = 0;
-   if ( pQueue->queue_start_pos == pQueue->queue_end_pos )
+   if ( index < 0 )
       return NULL;
 
-   int iPos = pQueue->queue_start_pos + index;
-   if ( iPos >= MAX_PACKETS_IN_QUEUE )
-      iPos -= MAX_PACKETS_IN_QUEUE;
-   if ( NULL != pLength )
-      *pLength = pQueue->packets_queue[iPos].packet_length;
-   u8* pRet = &(pQueue->packets_queue[iPos].packet_buffer[0]);
-
-   return pRet;
+   // Strict classes, then the weighted ones, same as packets_queue_has_packets counts them
+   for( int iPass=0; iPass<2; iPass++ )
+   for( int iClass=0; iClass<PACKETS_QUEUE_CLASSES; iClass++ )
+   {
+      t_packet_queue_class* pClass = &(pQueue->classes[iClass]);
+      if ( (0 == iPass) != (0 == pClass->iWeight) )
+         continue;
+      if ( index >= pClass->iCount )
+      {
+         index -= pClass->iCount;
+         continue;
+      }
+      t_packet_buffer* pBuffer = pClass->entries[(pClass->iStart + index) % MAX_PACKETS_IN_QUEUE].pBuffer;
+      if ( NULL != pLength )
+         *pLength = pBuffer->packet_length;
+      return &(pBuffer->packet_buffer[0]);
+   }
+   return NULL;
 }
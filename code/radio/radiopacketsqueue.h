@@ -1,39 +1,112 @@
 #pragma once
 #include "radiopackets2.h"
 
+// Radio packets queues.
+// Packets live in reference counted buffers from a pool shared by all the queues of the process, so a packet
+// can be built directly in a pool buffer and queued without copying it (packets_pool_alloc + packets_queue_add_buffer),
+// or be in more than one queue at a time.
+// Each queue has a few priority classes, each one a FIFO with its own max depth and drop policy.
+// Strict classes (weight 0) are always served first, in class order; the weighted classes share what is left
+// by their weights (deficit round robin on bytes). Not thread safe, like the rest of the router.
+
 #define MAX_PACKETS_IN_QUEUE 64
+#define MAX_PACKETS_IN_POOL 384 // radio queues and the video TX pacer
+
+#define PACKETS_QUEUE_CLASS_URGENT 0    // injected first: pings, local video link stats
+#define PACKETS_QUEUE_CLASS_CONTROL 1   // commands, RC, video retransmission requests and adaptive video/keyframe changes
+#define PACKETS_QUEUE_CLASS_TELEMETRY 2 // telemetry, Ruby messages
+#define PACKETS_QUEUE_CLASS_BULK 3      // uploads, audio, data links, everything else
+#define PACKETS_QUEUE_CLASSES 4
+
+#define PACKETS_QUEUE_DROP_NEWEST 0
+#define PACKETS_QUEUE_DROP_OLDEST 1
+
+// Bytes a weighted class can send for each unit of weight, in a round robin turn
+#define PACKETS_QUEUE_QUANTUM_BYTES MAX_PACKET_TOTAL_SIZE
 
 typedef struct
 {
-   u8  has_radio_header;
    u8  packet_buffer[MAX_PACKET_TOTAL_SIZE];
    u16 packet_length;
-} __attribute__((packed)) t_packet_queue_item;
+   u8  has_radio_header;
+   u8  uRefCount;
+} t_packet_buffer;
+
+typedef struct
+{
+   t_packet_buffer* pBuffer;
+   u32 uTimeAddedMs;
+   u32 uTimeAddedMicros;
+} t_packet_queue_entry;
+
+typedef struct
+{
+   u32 uPacketsIn;
+   u32 uPacketsOut;
+   u32 uPacketsDropped;
+   u32 uDelayMaxMicros;
+   unsigned long long uDelayTotalMicros; // for the packets out
+} t_packet_queue_class_stats;
+
+typedef struct
+{
+   t_packet_queue_entry entries[MAX_PACKETS_IN_QUEUE];
+   int iStart;
+   int iCount;
+   int iMaxDepth;
+   int iWeight; // 0 for strict priority
+   int iDropPolicy;
+   int iDeficit;
+   t_packet_queue_class_stats stats; // since the last packets_queue_log_stats
+} t_packet_queue_class;
 
 typedef struct
 {
-   t_packet_queue_item packets_queue[MAX_PACKETS_IN_QUEUE];
-   int queue_start_pos; // position of first element in queue
-   int queue_end_pos; // position of first free element in queue (after the last one)
-   u32 timeFirstPacket;
-} __attribute__((packed)) t_packet_queue;
+   t_packet_queue_class classes[PACKETS_QUEUE_CLASSES];
+   int iCurrentWeightedClass;
+   int bWeightedTurnStarted;
+   int bInitialized;
+   t_packet_buffer* pLastPopped; // kept until the next pop, for packets_queue_pop_packet
+   u32 timeFirstPacket; // when the oldest packet in the queue was added, MAX_U32 if empty
+} t_packet_queue;
 
 #ifdef __cplusplus
 extern "C" {
-#endif  
+#endif
+
+// Returns a buffer with one reference (owned by the caller), or NULL if the pool is empty
+t_packet_buffer* packets_pool_alloc();
+void packets_pool_add_ref(t_packet_buffer* pBuffer);
+void packets_pool_release(t_packet_buffer* pBuffer);
+int packets_pool_get_free_count();
+
+int packets_queue_get_packet_class(u8* pPacket);
 
 void packets_queue_init(t_packet_queue* pQueue);
+// Removes all the packets, keeps the classes params and stats
+void packets_queue_clear(t_packet_queue* pQueue);
+void packets_queue_set_class_params(t_packet_queue* pQueue, int iClass, int iMaxDepth, int iWeight, int iDropPolicy);
+t_packet_queue_class_stats* packets_queue_get_class_stats(t_packet_queue* pQueue, int iClass);
+// Logs the packets in/out/dropped and the queueing delay of each class, then resets the stats
+void packets_queue_log_stats(t_packet_queue* pQueue, const char* szName);
 
 int packets_queue_is_empty(t_packet_queue* pQueue);
 int packets_queue_has_packets(t_packet_queue* pQueue);
 
+// Zero copy: the queue takes over the caller's reference (also when the packet is dropped). Returns 0 if dropped
+int packets_queue_add_buffer(t_packet_queue* pQueue, t_packet_buffer* pBuffer, int iClass);
+// Returns the next packet to send; the caller owns the returned reference
+t_packet_buffer* packets_queue_pop_buffer(t_packet_queue* pQueue);
+
+// Copying helpers, the class is taken from the packet header
 int packets_queue_inject_packet_first(t_packet_queue* pQueue, u8* pBuffer);
 int packets_queue_add_packet(t_packet_queue* pQueue, u8* pBuffer);
 int packets_queue_add_packet2(t_packet_queue* pQueue, u8* pBuffer, int length, int has_radio_header);
+// The returned data is valid until the next pop from this queue
 u8* packets_queue_pop_packet(t_packet_queue* pQueue, int* pLength);
+// Index goes through the classes in priority order, then in FIFO order in each class
 u8* packets_queue_peek_packet(t_packet_queue* pQueue, int index, int* pLength);
 
 #ifdef __cplusplus
-}  
+}
 #endif
-
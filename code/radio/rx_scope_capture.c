@@ -0,0 +1,469 @@
+/*
+You can use this C/C++ code however you wish (for example, but not limited to:
+     as is, or by modifying it, or by adding new code, or by removing parts of the code;
+     in public or private projects, in new free or commercial products)
+     only if you get a priori written consent from Petru Soroaga (petrusoroaga@yahoo.com) for your specific use
+     and only if this copyright terms are preserved in the code.
+     This code is public for learning and academic purposes.
+Also, check the licences folder for additional licences terms.
+Code written by: Petru Soroaga, 2021-2023
+*/
+
+#include "rx_scope_capture.h"
+#include "radiolink.h"
+#include "radio_sim.h"
+#include "../base/hardware.h"
+#include "../base/hardware_radio.h"
+
+#include <pthread.h>
+#include <sys/select.h>
+
+static t_rx_scope_slice s_RXScopeCaptureSlices[RX_SCOPE_CAPTURE_SLICES];
+static t_rx_scope_capture_stats s_RXScopeCaptureStats; // published, for the readers
+static t_rx_scope_capture_stats s_RXScopeCaptureStatsLocal; // capture thread only
+static t_rx_scope_capture_params s_RXScopeCaptureParams;
+
+static int s_iRXScopeCaptureStarted = 0;
+static volatile int s_iRXScopeCaptureQuit = 0;
+static pthread_t s_RXScopeCaptureThread;
+static u32 s_uRXScopeCaptureTimeStartMicros = 0;
+static FILE* s_pRXScopeCapturePcapInput = NULL;
+
+static FILE* s_pRXScopeCaptureExport = NULL;
+static pthread_mutex_t s_RXScopeCaptureExportMutex = PTHREAD_MUTEX_INITIALIZER;
+
+void rx_scope_capture_params_reset(t_rx_scope_capture_params* pParams)
+{
+   if ( NULL == pParams )
+      return;
+   memset(pParams, 0, sizeof(t_rx_scope_capture_params));
+   pParams->uSliceMicros = RX_SCOPE_CAPTURE_DEFAULT_SLICE_MICROS;
+}
+
+static void _rx_scope_capture_publish_stats()
+{
+   u32 uCounter = s_RXScopeCaptureStats.uUpdateCounter;
+   __sync_lock_test_and_set(&(s_RXScopeCaptureStats.uUpdateCounter), uCounter | 0x01);
+   __sync_synchronize();
+   memcpy(((u8*)&s_RXScopeCaptureStats) + sizeof(u32), ((u8*)&s_RXScopeCaptureStatsLocal) + sizeof(u32), sizeof(t_rx_scope_capture_stats) - sizeof(u32));
+   __sync_synchronize();
+   __sync_lock_test_and_set(&(s_RXScopeCaptureStats.uUpdateCounter), (uCounter | 0x01) + 1);
+}
+
+// Returns 0 if a packet in the frame is not valid (bad CRC); the rest of the frame is not classified then
+
+static int _rx_scope_capture_classify(t_rx_scope_slice* pSlice, u8* pData, int iLength)
+{
+   if ( iLength < (int)sizeof(t_packet_header) )
+      return 0;
+   while ( iLength >= (int)sizeof(t_packet_header) )
+   {
+      t_packet_header* pPH = (t_packet_header*)pData;
+      int iPacketLength = pPH->total_length;
+      if ( (iPacketLength < (int)sizeof(t_packet_header)) || (iPacketLength > iLength) )
+         return 0;
+      int iCRCLength = (pPH->packet_flags & PACKET_FLAGS_BIT_HEADERS_ONLY_CRC)?pPH->total_headers_length:iPacketLength;
+      if ( (iCRCLength > iPacketLength) || (! packet_check_crc(pData, iCRCLength)) )
+         return 0;
+
+      u8 uComponent = pPH->packet_flags & PACKET_FLAGS_MASK_MODULE;
+      if ( uComponent == PACKET_COMPONENT_TELEMETRY )
+         pSlice->uTelemetry++;
+      else if ( (uComponent == PACKET_COMPONENT_COMMANDS) || (uComponent == PACKET_COMPONENT_RUBY) )
+         pSlice->uCommands++;
+      else if ( uComponent == PACKET_COMPONENT_VIDEO )
+      {
+         if ( pPH->packet_flags & PACKET_FLAGS_BIT_RETRANSMITED )
+            pSlice->uVideoRetransmissions++;
+         else
+            pSlice->uVideo++;
+      }
+      else
+         pSlice->uOther++;
+
+      pData += iPacketLength;
+      iLength -= iPacketLength;
+   }
+   return 1;
+}
+
+static void _rx_scope_capture_add_frame(u32 uTimeMicros, u8* pData, int iLength, int iInterface, int iRSSIDbm)
+{
+   u32 uSliceNumber = uTimeMicros / s_RXScopeCaptureStatsLocal.uSliceMicros;
+   t_rx_scope_slice* pSlice = &(s_RXScopeCaptureSlices[uSliceNumber & (RX_SCOPE_CAPTURE_SLICES-1)]);
+   int bCRCOk = 1;
+   u32 uCounter = pSlice->uUpdateCounter;
+   __sync_lock_test_and_set(&(pSlice->uUpdateCounter), uCounter | 0x01);
+   __sync_synchronize();
+
+   if ( (pSlice->uSliceNumber != uSliceNumber) || (0 == pSlice->uPackets) )
+   {
+      memset(((u8*)pSlice) + sizeof(u32), 0, sizeof(t_rx_scope_slice) - sizeof(u32));
+      pSlice->uSliceNumber = uSliceNumber;
+      pSlice->iRSSIMin = RX_SCOPE_CAPTURE_NO_RSSI;
+      pSlice->iRSSIMax = RX_SCOPE_CAPTURE_NO_RSSI;
+   }
+   pSlice->uPackets++;
+   pSlice->uBytes += iLength;
+   if ( ! _rx_scope_capture_classify(pSlice, pData, iLength) )
+   {
+      bCRCOk = 0;
+      pSlice->uBadCRC++;
+   }
+
+   if ( RX_SCOPE_CAPTURE_NO_RSSI != iRSSIDbm )
+   {
+      if ( (0 == pSlice->uRSSICount) || (iRSSIDbm < pSlice->iRSSIMin) )
+         pSlice->iRSSIMin = iRSSIDbm;
+      if ( (0 == pSlice->uRSSICount) || (iRSSIDbm > pSlice->iRSSIMax) )
+         pSlice->iRSSIMax = iRSSIDbm;
+      pSlice->iRSSISum += iRSSIDbm;
+      pSlice->uRSSICount++;
+   }
+
+   __sync_synchronize();
+   __sync_lock_test_and_set(&(pSlice->uUpdateCounter), (uCounter | 0x01) + 1);
+
+   s_RXScopeCaptureStatsLocal.uLastSliceNumber = uSliceNumber;
+   s_RXScopeCaptureStatsLocal.uTimeLastPacketMicros = uTimeMicros;
+   s_RXScopeCaptureStatsLocal.uPackets++;
+   s_RXScopeCaptureStatsLocal.uBytes += iLength;
+   if ( ! bCRCOk )
+      s_RXScopeCaptureStatsLocal.uBadCRC++;
+   if ( (iInterface >= 0) && (iInterface < MAX_RADIO_INTERFACES) )
+      s_RXScopeCaptureStatsLocal.uInterfacePackets[iInterface]++;
+
+   pthread_mutex_lock(&s_RXScopeCaptureExportMutex);
+   if ( NULL != s_pRXScopeCaptureExport )
+   {
+      int iRSSIExport = (RX_SCOPE_CAPTURE_NO_RSSI == iRSSIDbm)?RADIO_SIM_PCAP_NO_RSSI:iRSSIDbm;
+      if ( radio_sim_pcap_write_packet_ex(s_pRXScopeCaptureExport, pData, iLength, uTimeMicros, iRSSIExport) )
+         s_RXScopeCaptureStatsLocal.uPacketsExported++;
+      else
+         s_RXScopeCaptureStatsLocal.uExportErrors++;
+   }
+   pthread_mutex_unlock(&s_RXScopeCaptureExportMutex);
+}
+
+static void _rx_scope_capture_end_wakeup(u32 uPacketsRead)
+{
+   s_RXScopeCaptureStatsLocal.uWakeups++;
+   if ( uPacketsRead > s_RXScopeCaptureStatsLocal.uMaxPacketsPerWakeup )
+      s_RXScopeCaptureStatsLocal.uMaxPacketsPerWakeup = uPacketsRead;
+   _rx_scope_capture_publish_stats();
+}
+
+static int _rx_scope_capture_has_data(int iFd)
+{
+   fd_set readset;
+   struct timeval to;
+   to.tv_sec = 0;
+   to.tv_usec = 0;
+   FD_ZERO(&readset);
+   FD_SET(iFd, &readset);
+   if ( select(iFd+1, &readset, NULL, NULL, &to) <= 0 )
+      return 0;
+   return FD_ISSET(iFd, &readset)?1:0;
+}
+
+static void _rx_scope_capture_loop_interfaces()
+{
+   int bFailed[MAX_RADIO_INTERFACES];
+   memset(bFailed, 0, sizeof(bFailed));
+
+   while ( ! s_iRXScopeCaptureQuit )
+   {
+      fd_set readset;
+      FD_ZERO(&readset);
+      int iMaxFd = -1;
+      for( int i=0; i<s_RXScopeCaptureParams.iInterfacesCount; i++ )
+      {
+         radio_hw_info_t* pRadioInfo = hardware_get_radio_info(s_RXScopeCaptureParams.iInterfaces[i]);
+         if ( bFailed[i] || (NULL == pRadioInfo) || (! pRadioInfo->openedForRead) || (pRadioInfo->monitor_interface_read.selectable_fd < 0) )
+            continue;
+         FD_SET(pRadioInfo->monitor_interface_read.selectable_fd, &readset);
+         if ( pRadioInfo->monitor_interface_read.selectable_fd > iMaxFd )
+            iMaxFd = pRadioInfo->monitor_interface_read.selectable_fd;
+      }
+      if ( -1 == iMaxFd )
+      {
+         if ( ! s_RXScopeCaptureStatsLocal.bInputDone )
+         {
+            log_softerror_and_alarm("[RxScopeCapture] No radio interface to read from.");
+            s_RXScopeCaptureStatsLocal.bInputDone = 1;
+            _rx_scope_capture_publish_stats();
+         }
+         hardware_sleep_ms(20);
+         continue;
+      }
+
+      struct timeval to;
+      to.tv_sec = 0;
+      to.tv_usec = RX_SCOPE_CAPTURE_WAIT_MICROS;
+      int iResult = select(iMaxFd+1, &readset, NULL, NULL, &to);
+      if ( iResult <= 0 )
+         continue;
+
+      // Drain everything pending on each interface
+      u32 uPacketsRead = 0;
+      for( int i=0; i<s_RXScopeCaptureParams.iInterfacesCount; i++ )
+      {
+         int iInterface = s_RXScopeCaptureParams.iInterfaces[i];
+         radio_hw_info_t* pRadioInfo = hardware_get_radio_info(iInterface);
+         if ( bFailed[i] || (NULL == pRadioInfo) || (! pRadioInfo->openedForRead) || (pRadioInfo->monitor_interface_read.selectable_fd < 0) )
+            continue;
+         int iFd = pRadioInfo->monitor_interface_read.selectable_fd;
+         if ( ! FD_ISSET(iFd, &readset) )
+            continue;
+
+         for( int k=0; k<RX_SCOPE_CAPTURE_MAX_READS_PER_WAKEUP; k++ )
+         {
+            int iLength = 0;
+            u8* pData = radio_process_wlan_data_in(iInterface, &iLength);
+            if ( (NULL == pData) && (radio_get_last_read_error_code() == RADIO_READ_ERROR_INTERFACE_BROKEN) )
+            {
+               log_softerror_and_alarm("[RxScopeCapture] Radio interface %d is broken, stopped reading it.", iInterface+1);
+               bFailed[i] = 1;
+               break;
+            }
+            if ( (NULL != pData) && (iLength > 0) )
+            {
+               int iRSSI = pRadioInfo->monitor_interface_read.radioInfo.nDbm;
+               if ( (iRSSI >= 0) || (iRSSI < -127) )
+                  iRSSI = RX_SCOPE_CAPTURE_NO_RSSI;
+               _rx_scope_capture_add_frame(get_current_timestamp_micros() - s_uRXScopeCaptureTimeStartMicros, pData, iLength, iInterface, iRSSI);
+               uPacketsRead++;
+            }
+            if ( ! _rx_scope_capture_has_data(iFd) )
+               break;
+         }
+      }
+      _rx_scope_capture_end_wakeup(uPacketsRead);
+   }
+}
+
+static void _rx_scope_capture_loop_pcap()
+{
+   u8 buffer[MAX_PACKET_TOTAL_SIZE];
+   u32 uTimeFirstPacket = 0;
+   int bFirstPacket = 1;
+
+   while ( ! s_iRXScopeCaptureQuit )
+   {
+      u32 uPacketsRead = 0;
+      while ( (! s_iRXScopeCaptureQuit) && (uPacketsRead < RX_SCOPE_CAPTURE_MAX_READS_PER_WAKEUP) )
+      {
+         u32 uPcapTime = 0;
+         int iRSSI = RADIO_SIM_PCAP_NO_RSSI;
+         int iLength = radio_sim_pcap_read_packet_ex(s_pRXScopeCapturePcapInput, buffer, sizeof(buffer), &uPcapTime, &iRSSI);
+         if ( iLength <= 0 )
+         {
+            if ( iLength < 0 )
+               log_softerror_and_alarm("[RxScopeCapture] Failed to read from pcap file %s", s_RXScopeCaptureParams.szPcapInput);
+            _rx_scope_capture_end_wakeup(uPacketsRead);
+            s_RXScopeCaptureStatsLocal.bInputDone = 1;
+            _rx_scope_capture_publish_stats();
+            log_line("[RxScopeCapture] Done reading pcap file %s: %u frames.", s_RXScopeCaptureParams.szPcapInput, s_RXScopeCaptureStatsLocal.uPackets);
+            return;
+         }
+         if ( bFirstPacket )
+         {
+            bFirstPacket = 0;
+            uTimeFirstPacket = uPcapTime;
+         }
+         u32 uTime = uPcapTime - uTimeFirstPacket;
+
+         if ( s_RXScopeCaptureParams.bPcapInputRealTime )
+         {
+            u32 uElapsed = get_current_timestamp_micros() - s_uRXScopeCaptureTimeStartMicros;
+            if ( uElapsed < uTime )
+            {
+               // Wake up for the frame, the batch so far is done
+               if ( uPacketsRead > 0 )
+                  _rx_scope_capture_end_wakeup(uPacketsRead);
+               uPacketsRead = 0;
+               while ( (! s_iRXScopeCaptureQuit) && (uElapsed < uTime) )
+               {
+                  u32 uWait = uTime - uElapsed;
+                  if ( uWait > RX_SCOPE_CAPTURE_WAIT_MICROS )
+                     uWait = RX_SCOPE_CAPTURE_WAIT_MICROS;
+                  hardware_sleep_micros(uWait);
+                  uElapsed = get_current_timestamp_micros() - s_uRXScopeCaptureTimeStartMicros;
+               }
+            }
+         }
+         if ( RADIO_SIM_PCAP_NO_RSSI == iRSSI )
+            iRSSI = RX_SCOPE_CAPTURE_NO_RSSI;
+         _rx_scope_capture_add_frame(uTime, buffer, iLength, 0, iRSSI);
+         uPacketsRead++;
+      }
+      _rx_scope_capture_end_wakeup(uPacketsRead);
+   }
+}
+
+static void* _rx_scope_capture_thread(void* pParam)
+{
+   if ( NULL != s_pRXScopeCapturePcapInput )
+      _rx_scope_capture_loop_pcap();
+   else
+      _rx_scope_capture_loop_interfaces();
+   return NULL;
+}
+
+int rx_scope_capture_start(t_rx_scope_capture_params* pParams)
+{
+   if ( s_iRXScopeCaptureStarted )
+      return 1;
+   if ( NULL == pParams )
+      return 0;
+
+   memcpy(&s_RXScopeCaptureParams, pParams, sizeof(t_rx_scope_capture_params));
+   if ( 0 == s_RXScopeCaptureParams.uSliceMicros )
+      s_RXScopeCaptureParams.uSliceMicros = RX_SCOPE_CAPTURE_DEFAULT_SLICE_MICROS;
+   if ( s_RXScopeCaptureParams.iInterfacesCount > MAX_RADIO_INTERFACES )
+      s_RXScopeCaptureParams.iInterfacesCount = MAX_RADIO_INTERFACES;
+   if ( s_RXScopeCaptureParams.iInterfacesCount < 0 )
+      s_RXScopeCaptureParams.iInterfacesCount = 0;
+
+   memset(s_RXScopeCaptureSlices, 0, sizeof(s_RXScopeCaptureSlices));
+   memset(&s_RXScopeCaptureStats, 0, sizeof(t_rx_scope_capture_stats));
+   memset(&s_RXScopeCaptureStatsLocal, 0, sizeof(t_rx_scope_capture_stats));
+   s_RXScopeCaptureStatsLocal.uSliceMicros = s_RXScopeCaptureParams.uSliceMicros;
+   _rx_scope_capture_publish_stats();
+
+   s_pRXScopeCapturePcapInput = NULL;
+   if ( 0 != s_RXScopeCaptureParams.szPcapInput[0] )
+   {
+      s_pRXScopeCapturePcapInput = radio_sim_pcap_open_read(s_RXScopeCaptureParams.szPcapInput);
+      if ( NULL == s_pRXScopeCapturePcapInput )
+         return 0;
+   }
+   if ( 0 != s_RXScopeCaptureParams.szPcapExport[0] )
+      rx_scope_capture_set_pcap_export(s_RXScopeCaptureParams.szPcapExport);
+
+   s_uRXScopeCaptureTimeStartMicros = get_current_timestamp_micros();
+   s_iRXScopeCaptureQuit = 0;
+   if ( 0 != pthread_create(&s_RXScopeCaptureThread, NULL, &_rx_scope_capture_thread, NULL) )
+   {
+      log_softerror_and_alarm("[RxScopeCapture] Failed to create the capture thread.");
+      if ( NULL != s_pRXScopeCapturePcapInput )
+         fclose(s_pRXScopeCapturePcapInput);
+      s_pRXScopeCapturePcapInput = NULL;
+      rx_scope_capture_set_pcap_export(NULL);
+      return 0;
+   }
+   s_iRXScopeCaptureStarted = 1;
+   if ( NULL != s_pRXScopeCapturePcapInput )
+      log_line("[RxScopeCapture] Started capture from pcap file %s (%s), %u us slices.", s_RXScopeCaptureParams.szPcapInput, s_RXScopeCaptureParams.bPcapInputRealTime?"real time":"fast", s_RXScopeCaptureParams.uSliceMicros);
+   else
+      log_line("[RxScopeCapture] Started capture on %d radio interfaces, %u us slices.", s_RXScopeCaptureParams.iInterfacesCount, s_RXScopeCaptureParams.uSliceMicros);
+   return 1;
+}
+
+void rx_scope_capture_stop()
+{
+   if ( ! s_iRXScopeCaptureStarted )
+      return;
+   s_iRXScopeCaptureQuit = 1;
+   pthread_join(s_RXScopeCaptureThread, NULL);
+   s_iRXScopeCaptureStarted = 0;
+
+   if ( NULL != s_pRXScopeCapturePcapInput )
+      fclose(s_pRXScopeCapturePcapInput);
+   s_pRXScopeCapturePcapInput = NULL;
+   rx_scope_capture_set_pcap_export(NULL);
+   log_line("[RxScopeCapture] Stopped. Captured %u frames, %u bytes, %u with bad CRC; %u wake ups, max %u frames per wake up; %u frames exported.",
+      s_RXScopeCaptureStatsLocal.uPackets, s_RXScopeCaptureStatsLocal.uBytes, s_RXScopeCaptureStatsLocal.uBadCRC,
+      s_RXScopeCaptureStatsLocal.uWakeups, s_RXScopeCaptureStatsLocal.uMaxPacketsPerWakeup, s_RXScopeCaptureStatsLocal.uPacketsExported);
+}
+
+int rx_scope_capture_is_started()
+{
+   return s_iRXScopeCaptureStarted;
+}
+
+int rx_scope_capture_set_pcap_export(const char* szFile)
+{
+   int iResult = 1;
+   pthread_mutex_lock(&s_RXScopeCaptureExportMutex);
+   if ( NULL != s_pRXScopeCaptureExport )
+   {
+      fclose(s_pRXScopeCaptureExport);
+      s_pRXScopeCaptureExport = NULL;
+      log_line("[RxScopeCapture] Stopped the pcap export.");
+   }
+   if ( (NULL != szFile) && (0 != szFile[0]) )
+   {
+      s_pRXScopeCaptureExport = radio_sim_pcap_open_write(szFile);
+      if ( NULL == s_pRXScopeCaptureExport )
+         iResult = 0;
+      else
+         log_line("[RxScopeCapture] Exporting the captured frames to %s", szFile);
+   }
+   pthread_mutex_unlock(&s_RXScopeCaptureExportMutex);
+   return iResult;
+}
+
+int rx_scope_capture_get_stats(t_rx_scope_capture_stats* pOutStats)
+{
+   if ( NULL == pOutStats )
+      return 0;
+   for( int i=0; i<10; i++ )
+   {
+      u32 uCounter = s_RXScopeCaptureStats.uUpdateCounter;
+      __sync_synchronize();
+      if ( uCounter & 0x01 )
+         continue;
+      memcpy(pOutStats, &s_RXScopeCaptureStats, sizeof(t_rx_scope_capture_stats));
+      __sync_synchronize();
+      if ( uCounter == s_RXScopeCaptureStats.uUpdateCounter )
+         return 1;
+   }
+   return 0;
+}
+
+int rx_scope_capture_get_timeline(t_rx_scope_slice* pOutSlices, int iCount, u32 uLastSliceNumber)
+{
+   if ( (NULL == pOutSlices) || (iCount <= 0) )
+      return 0;
+   if ( iCount > RX_SCOPE_CAPTURE_SLICES )
+      iCount = RX_SCOPE_CAPTURE_SLICES;
+
+   if ( MAX_U32 == uLastSliceNumber )
+   {
+      t_rx_scope_capture_stats stats;
+      if ( ! rx_scope_capture_get_stats(&stats) )
+         return 0;
+      uLastSliceNumber = stats.uLastSliceNumber;
+   }
+
+   for( int i=0; i<iCount; i++ )
+   {
+      u32 uSliceNumber = uLastSliceNumber - (u32)(iCount-1-i);
+      t_rx_scope_slice* pSlice = &(s_RXScopeCaptureSlices[uSliceNumber & (RX_SCOPE_CAPTURE_SLICES-1)]);
+      t_rx_scope_slice* pOut = &(pOutSlices[i]);
+      int bOk = 0;
+      for( int k=0; k<10; k++ )
+      {
+         u32 uCounter = pSlice->uUpdateCounter;
+         __sync_synchronize();
+         if ( uCounter & 0x01 )
+            continue;
+         memcpy(pOut, pSlice, sizeof(t_rx_scope_slice));
+         __sync_synchronize();
+         if ( uCounter == pSlice->uUpdateCounter )
+         {
+            bOk = 1;
+            break;
+         }
+      }
+      if ( (! bOk) || (pOut->uSliceNumber != uSliceNumber) || (uSliceNumber > uLastSliceNumber) || (0 == pOut->uPackets) )
+      {
+         memset(pOut, 0, sizeof(t_rx_scope_slice));
+         pOut->uSliceNumber = uSliceNumber;
+         pOut->iRSSIMin = RX_SCOPE_CAPTURE_NO_RSSI;
+         pOut->iRSSIMax = RX_SCOPE_CAPTURE_NO_RSSI;
+      }
+   }
+   return iCount;
+}
@@ -0,0 +1,86 @@
+#pragma once
+#include "../base/base.h"
+#include "../base/config.h"
+#include "radiopackets2.h"
+
+// RX scope capture engine: a thread that reads all the pending radio frames on each wake up, from all the
+// given monitor interfaces (or from a pcap file instead), timestamps them (microseconds) and adds them to
+// a timeline ring of per slice counters. The ring has a single writer (the capture thread); readers (the UI)
+// only take snapshots, each slice is guarded by an update counter (odd while the slice is being updated).
+// The captured frames can also be written to a pcap file (radiotap, with the RSSI) for offline analysis.
+
+#define RX_SCOPE_CAPTURE_SLICES 4096 // power of 2
+#define RX_SCOPE_CAPTURE_DEFAULT_SLICE_MICROS 1000
+#define RX_SCOPE_CAPTURE_MAX_READS_PER_WAKEUP 256 // per interface
+#define RX_SCOPE_CAPTURE_WAIT_MICROS 20000
+#define RX_SCOPE_CAPTURE_NO_RSSI (-1000)
+
+typedef struct
+{
+   u32 uUpdateCounter; // odd while the capture thread updates the slice
+   u32 uSliceNumber; // time since the capture start / slice duration
+   u32 uPackets; // radio frames
+   u32 uBytes;
+   u32 uBadCRC; // frames with a bad packet (CRC, length); the packets after it are not classified
+   // Ruby packets in the frames (a frame can have several chained packets)
+   u32 uVideo;
+   u32 uVideoRetransmissions;
+   u32 uTelemetry;
+   u32 uCommands; // commands and Ruby packets
+   u32 uOther;
+   int iRSSIMin;
+   int iRSSIMax;
+   int iRSSISum;
+   u32 uRSSICount;
+} t_rx_scope_slice;
+
+typedef struct
+{
+   u32 uUpdateCounter; // odd while the capture thread updates the stats
+   u32 uSliceMicros;
+   u32 uLastSliceNumber; // the slice of the last captured frame
+   u32 uTimeLastPacketMicros; // since the capture start
+   u32 uPackets;
+   u32 uBytes;
+   u32 uBadCRC;
+   u32 uWakeups;
+   u32 uMaxPacketsPerWakeup;
+   u32 uPacketsExported;
+   u32 uExportErrors;
+   u32 uInterfacePackets[MAX_RADIO_INTERFACES];
+   int bInputDone; // pcap input read to the end, or all the interfaces failed
+} t_rx_scope_capture_stats;
+
+typedef struct
+{
+   u32 uSliceMicros;
+   int iInterfacesCount;
+   int iInterfaces[MAX_RADIO_INTERFACES]; // radio interfaces already opened for read
+   char szPcapInput[256]; // not empty: read this pcap file instead of the radio interfaces
+   int bPcapInputRealTime; // replay the pcap file at its own pace, else as fast as possible
+   char szPcapExport[256]; // not empty: write the captured frames to this pcap file
+} t_rx_scope_capture_params;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void rx_scope_capture_params_reset(t_rx_scope_capture_params* pParams);
+
+int rx_scope_capture_start(t_rx_scope_capture_params* pParams);
+void rx_scope_capture_stop();
+int rx_scope_capture_is_started();
+
+// Starts or stops (NULL or empty) writing the captured frames to a pcap file, while capturing
+int rx_scope_capture_set_pcap_export(const char* szFile);
+
+// Copies a consistent snapshot of the capture stats
+int rx_scope_capture_get_stats(t_rx_scope_capture_stats* pOutStats);
+// Copies the last iCount slices, oldest first, ending at the slice of the last captured frame
+// (or at uLastSliceNumber if it's not MAX_U32). Slices with no frames are returned zeroed (with their number).
+// Returns the number of slices copied.
+int rx_scope_capture_get_timeline(t_rx_scope_slice* pOutSlices, int iCount, u32 uLastSliceNumber);
+
+#ifdef __cplusplus
+}
+#endif
@@ -222,6 +222,34 @@ void fbg_dispmanxOnFlip(struct _fbg *fbg, void (*opt_flip)(struct _fbg *fbg)) {
     dispmanx_context->opt_flip = opt_flip;
 }
 
+int fbg_dispmanxSnapshot(struct _fbg *fbg, unsigned char *buffer) {
+#ifdef FBG_MMAL
+    return -1;
+#else
+    struct _fbg_dispmanx_context *dispmanx_context = fbg->user_context;
+
+    uint32_t vc_image_ptr;
+    DISPMANX_RESOURCE_HANDLE_T resource = vc_dispmanx_resource_create(VC_IMAGE_RGBA32, fbg->width, fbg->height, &vc_image_ptr);
+    if (!resource) {
+        fprintf(stderr, "fbg_dispmanxSnapshot: vc_dispmanx_resource_create failed\n");
+        return -1;
+    }
+
+    int result = vc_dispmanx_snapshot(dispmanx_context->display, resource, DISPMANX_NO_ROTATE);
+    if (result == 0) {
+        VC_RECT_T rect;
+        vc_dispmanx_rect_set(&rect, 0, 0, fbg->width, fbg->height);
+        result = vc_dispmanx_resource_read_data(resource, &rect, buffer, fbg->width * 4);
+    }
+    if (result != 0) {
+        fprintf(stderr, "fbg_dispmanxSnapshot: display snapshot failed\n");
+    }
+
+    vc_dispmanx_resource_delete(resource);
+    return result;
+#endif
+}
+
 void fbg_dispmanxDraw(struct _fbg *fbg) {
     struct _fbg_dispmanx_context *dispmanx_context = fbg->user_context;
 
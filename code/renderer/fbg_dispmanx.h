@@ -100,6 +100,14 @@ extern "C" {
     */
     extern void fbg_dispmanxOnFlip(struct _fbg *fbg, void (*opt_flip)(struct _fbg *fbg));
 
+    //! copy the display content, as composed from all its layers (video included), to a RGBA buffer
+    /*!
+      \param fbg FBG data structure pointer
+      \param buffer fbg->width * fbg->height * 4 bytes
+      \return 0 on success
+    */
+    extern int fbg_dispmanxSnapshot(struct _fbg *fbg, unsigned char *buffer);
+
 #endif
 
 #ifdef __cplusplus
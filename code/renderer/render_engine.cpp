@@ -37,6 +37,19 @@ RenderEngine* render_init_engine()
    return s_pRenderEngine;
 }
 
+// Renders to memory only, no display needed
+
+RenderEngine* render_init_offscreen_engine(int iWidth, int iHeight)
+{
+   log_line("Renderer Engine Init (offscreen, %d x %d)...", iWidth, iHeight);
+   if ( NULL == s_pRenderEngine )
+   {
+      s_bRenderEngineIsRaw = true;
+      s_pRenderEngine = new RenderEngineRaw(iWidth, iHeight);
+   }
+   return s_pRenderEngine;
+}
+
 bool render_engine_is_raw()
 {
    return s_bRenderEngineIsRaw;  
@@ -238,6 +251,11 @@ void RenderEngine::rotate180()
 {
 }
 
+u8* RenderEngine::captureFrame(int* piWidth, int* piHeight)
+{
+   return NULL;
+}
+
 void RenderEngine::drawImage(float xPos, float yPos, float fWidth, float fHeight, u32 imageId)
 {
 }
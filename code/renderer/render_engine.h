@@ -14,7 +14,7 @@ class RenderEngine
      float getPixelWidth();
      float getPixelHeight();
 
-     float setGlobalAlfa(float alfa);
+     virtual float setGlobalAlfa(float alfa);
      float getGlobalAlfa();
 
      virtual void highlightFirstWordOfLine(bool bHighlight);
@@ -46,6 +46,8 @@ class RenderEngine
      virtual void endFrame();
 
      virtual void rotate180();
+     // Returns a copy (malloc-ed, RGBA) of what is shown on the screen, or NULL if not supported
+     virtual u8* captureFrame(int* piWidth, int* piHeight);
 
      virtual void drawImage(float xPos, float yPos, float fWidth, float fHeight, u32 imageId);
      virtual void drawIcon(float xPos, float yPos, float fWidth, float fHeight, u32 iconId);
@@ -102,6 +104,7 @@ class RenderEngine
 
 
 RenderEngine* render_init_engine();
+RenderEngine* render_init_offscreen_engine(int iWidth, int iHeight);
 RenderEngine* renderer_engine();
 bool render_engine_is_raw();
 
@@ -0,0 +1,656 @@
+/*
+You can use this C/C++ code however you wish (for example, but not limited to:
+     as is, or by modifying it, or by adding new code, or by removing parts of the code;
+     in public or private projects, in new free or commercial products)
+     only if you get a priori written consent from Petru Soroaga (petrusoroaga@yahoo.com) for your specific use
+     and only if this copyright terms are preserved in the code.
+     This code is public for learning and academic purposes.
+Also, check the licences folder for additional licences terms.
+Code written by: Petru Soroaga, 2021-2023
+*/
+
+#include "render_engine_display_list.h"
+#include "../base/base.h"
+
+#define DL_OP_GLOBAL_ALFA 1
+#define DL_OP_HIGHLIGHT_FIRST_WORD 2
+#define DL_OP_BACKGROUND_BOXES 3
+#define DL_OP_COLORS 4
+#define DL_OP_FILL 5
+#define DL_OP_STROKE_COLOR 6
+#define DL_OP_STROKE 7
+#define DL_OP_STROKE_SIZE 8
+#define DL_OP_FONT_COLOR 9
+#define DL_OP_FONT_SCALING 10
+#define DL_OP_BOX_FILL_COLOR 11
+#define DL_OP_BOX_STRIKE_COLOR 12
+#define DL_OP_BOX_STRIKE_CLEAR 13
+#define DL_OP_BOX_PADDING 14
+#define DL_OP_IMAGE 15
+#define DL_OP_ICON 16
+#define DL_OP_TEXT 17
+#define DL_OP_TEXT_HEIGHT 18
+#define DL_OP_TEXT_NO_OUTLINE 19
+#define DL_OP_TEXT_LEFT 20
+#define DL_OP_TEXT_LEFT_HEIGHT 21
+#define DL_OP_TEXT_SCALED 22
+#define DL_OP_TEXT_LEFT_SCALED 23
+#define DL_OP_MESSAGE_LINES 24
+#define DL_OP_LINE 25
+#define DL_OP_RECT 26
+#define DL_OP_ROUND_RECT 27
+#define DL_OP_TRIANGLE 28
+#define DL_OP_POLY_LINE 29
+#define DL_OP_FILL_POLYGON 30
+#define DL_OP_FILL_CIRCLE 31
+#define DL_OP_CIRCLE 32
+#define DL_OP_ARC 33
+
+#define DL_MIN_CAPACITY 64
+
+RenderEngineDisplayList::RenderEngineDisplayList()
+{
+   m_pEngine = NULL;
+   m_bRecording = false;
+   m_fStrokeSize = 0.0;
+
+   m_pOps = NULL;
+   m_iCountOps = 0;
+   m_iCapacityOps = 0;
+   m_pText = NULL;
+   m_iTextBytes = 0;
+   m_iCapacityText = 0;
+   m_pPoints = NULL;
+   m_iCountPoints = 0;
+   m_iCapacityPoints = 0;
+   memset(&m_Stats, 0, sizeof(m_Stats));
+}
+
+RenderEngineDisplayList::~RenderEngineDisplayList()
+{
+   if ( NULL != m_pOps )
+      free(m_pOps);
+   if ( NULL != m_pText )
+      free(m_pText);
+   if ( NULL != m_pPoints )
+      free(m_pPoints);
+   m_pOps = NULL;
+   m_pText = NULL;
+   m_pPoints = NULL;
+}
+
+void RenderEngineDisplayList::startRecording(RenderEngine* pEngine)
+{
+   clear();
+   m_pEngine = pEngine;
+   m_bRecording = (NULL != pEngine);
+   if ( NULL == pEngine )
+      return;
+
+   // Same screen and state as the engine it records for
+   m_iRenderWidth = pEngine->getScreenWidth();
+   m_iRenderHeight = pEngine->getScreenHeight();
+   m_fPixelWidth = pEngine->getPixelWidth();
+   m_fPixelHeight = pEngine->getPixelHeight();
+   m_fGlobalAlfa = pEngine->getGlobalAlfa();
+   m_fStrokeSize = pEngine->getStrokeSize();
+   m_bDrawBackgroundBoundingBoxes = pEngine->drawBackgroundBoundingBoxes(false);
+   pEngine->drawBackgroundBoundingBoxes(m_bDrawBackgroundBoundingBoxes);
+   m_Stats.uRecordings++;
+}
+
+void RenderEngineDisplayList::endRecording()
+{
+   m_bRecording = false;
+   m_Stats.uOps = m_iCountOps;
+   m_Stats.uTextBytes = m_iTextBytes;
+   m_Stats.uPoints = m_iCountPoints;
+}
+
+void RenderEngineDisplayList::clear()
+{
+   m_iCountOps = 0;
+   m_iTextBytes = 0;
+   m_iCountPoints = 0;
+}
+
+bool RenderEngineDisplayList::isEmpty()
+{
+   return (0 == m_iCountOps);
+}
+
+t_display_list_stats* RenderEngineDisplayList::getStats()
+{
+   return &m_Stats;
+}
+
+void RenderEngineDisplayList::replay(RenderEngine* pEngine, float dx, float dy)
+{
+   if ( NULL == pEngine )
+      return;
+   m_Stats.uReplays++;
+
+   double color[4];
+   float xPoints[256];
+   float yPoints[256];
+
+   for( int i=0; i<m_iCountOps; i++ )
+   {
+      t_display_list_op* pOp = &(m_pOps[i]);
+      float* f = pOp->fParams;
+      const char* szText = (NULL != m_pText)?(m_pText + pOp->uDataOffset):"";
+
+      if ( (pOp->uType == DL_OP_COLORS) || (pOp->uType == DL_OP_STROKE_COLOR) || (pOp->uType == DL_OP_FONT_COLOR) ||
+           (pOp->uType == DL_OP_BOX_FILL_COLOR) || (pOp->uType == DL_OP_BOX_STRIKE_COLOR) )
+      {
+         for( int k=0; k<4; k++ )
+            color[k] = f[k];
+      }
+
+      switch ( pOp->uType )
+      {
+         case DL_OP_GLOBAL_ALFA: pEngine->setGlobalAlfa(f[0]); break;
+         case DL_OP_HIGHLIGHT_FIRST_WORD: pEngine->highlightFirstWordOfLine(pOp->uFlag?true:false); break;
+         case DL_OP_BACKGROUND_BOXES: pEngine->drawBackgroundBoundingBoxes(pOp->uFlag?true:false); break;
+         case DL_OP_COLORS: pEngine->setColors(color, f[4]); break;
+         case DL_OP_FILL: pEngine->setFill(f[0], f[1], f[2], f[3]); break;
+         case DL_OP_STROKE_COLOR: pEngine->setStroke(color, f[4]); break;
+         case DL_OP_STROKE: pEngine->setStroke(f[0], f[1], f[2], f[3]); break;
+         case DL_OP_STROKE_SIZE: pEngine->setStrokeSize(f[0]); break;
+         case DL_OP_FONT_COLOR: pEngine->setFontColor(pOp->uId, color); break;
+         case DL_OP_FONT_SCALING: pEngine->enableFontScaling(pOp->uFlag?true:false); break;
+         case DL_OP_BOX_FILL_COLOR: pEngine->setFontBackgroundBoundingBoxFillColor(color); break;
+         case DL_OP_BOX_STRIKE_COLOR: pEngine->setFontBackgroundBoundingBoxStrikeColor(color); break;
+         case DL_OP_BOX_STRIKE_CLEAR: pEngine->clearFontBackgroundBoundingBoxStrikeColor(); break;
+         case DL_OP_BOX_PADDING: pEngine->setBackgroundBoundingBoxPadding(f[0]); break;
+         case DL_OP_IMAGE: pEngine->drawImage(f[0]+dx, f[1]+dy, f[2], f[3], pOp->uId); break;
+         case DL_OP_ICON: pEngine->drawIcon(f[0]+dx, f[1]+dy, f[2], f[3], pOp->uId); break;
+         case DL_OP_TEXT: pEngine->drawText(f[0]+dx, f[1]+dy, pOp->uId, szText); break;
+         case DL_OP_TEXT_HEIGHT: pEngine->drawText(f[0]+dx, f[1]+dy, f[2], pOp->uId, szText); break;
+         case DL_OP_TEXT_NO_OUTLINE: pEngine->drawTextNoOutline(f[0]+dx, f[1]+dy, f[2], pOp->uId, szText); break;
+         case DL_OP_TEXT_LEFT: pEngine->drawTextLeft(f[0]+dx, f[1]+dy, pOp->uId, szText); break;
+         case DL_OP_TEXT_LEFT_HEIGHT: pEngine->drawTextLeft(f[0]+dx, f[1]+dy, f[2], pOp->uId, szText); break;
+         case DL_OP_TEXT_SCALED: pEngine->drawTextScaled(f[0]+dx, f[1]+dy, f[2], pOp->uId, f[3], szText); break;
+         case DL_OP_TEXT_LEFT_SCALED: pEngine->drawTextLeftScaled(f[0]+dx, f[1]+dy, f[2], pOp->uId, f[3], szText); break;
+         case DL_OP_MESSAGE_LINES: pEngine->drawMessageLines(f[0]+dx, f[1]+dy, szText, f[2], f[3], f[4], pOp->uId); break;
+         case DL_OP_LINE: pEngine->drawLine(f[0]+dx, f[1]+dy, f[2]+dx, f[3]+dy); break;
+         case DL_OP_RECT: pEngine->drawRect(f[0]+dx, f[1]+dy, f[2], f[3]); break;
+         case DL_OP_ROUND_RECT: pEngine->drawRoundRect(f[0]+dx, f[1]+dy, f[2], f[3], f[4]); break;
+         case DL_OP_TRIANGLE: pEngine->drawTriangle(f[0]+dx, f[1]+dy, f[2]+dx, f[3]+dy, f[4]+dx, f[5]+dy); break;
+         case DL_OP_FILL_CIRCLE: pEngine->fillCircle(f[0]+dx, f[1]+dy, f[2]); break;
+         case DL_OP_CIRCLE: pEngine->drawCircle(f[0]+dx, f[1]+dy, f[2]); break;
+         case DL_OP_ARC: pEngine->drawArc(f[0]+dx, f[1]+dy, f[2], f[3], f[4]); break;
+
+         case DL_OP_POLY_LINE:
+         case DL_OP_FILL_POLYGON:
+         {
+            int iCount = pOp->uCount;
+            if ( iCount > 256 )
+               iCount = 256;
+            float* pPoints = m_pPoints + pOp->uDataOffset;
+            for( int k=0; k<iCount; k++ )
+            {
+               xPoints[k] = pPoints[2*k] + dx;
+               yPoints[k] = pPoints[2*k+1] + dy;
+            }
+            if ( pOp->uType == DL_OP_POLY_LINE )
+               pEngine->drawPolyLine(xPoints, yPoints, iCount);
+            else
+               pEngine->fillPolygon(xPoints, yPoints, iCount);
+            break;
+         }
+      }
+   }
+}
+
+bool RenderEngineDisplayList::_grow(void** ppBuffer, int* piCapacity, int iItemSize, int iNeeded)
+{
+   if ( iNeeded <= *piCapacity )
+      return true;
+   int iCapacity = *piCapacity * 2;
+   if ( iCapacity < DL_MIN_CAPACITY )
+      iCapacity = DL_MIN_CAPACITY;
+   while ( iCapacity < iNeeded )
+      iCapacity *= 2;
+   void* pBuffer = realloc(*ppBuffer, iCapacity * iItemSize);
+   if ( NULL == pBuffer )
+   {
+      log_softerror_and_alarm("RenderDisplayList: Failed to allocate %d bytes.", iCapacity * iItemSize);
+      return false;
+   }
+   m_Stats.uMemory += (iCapacity - *piCapacity) * iItemSize;
+   m_Stats.uAllocations++;
+   *ppBuffer = pBuffer;
+   *piCapacity = iCapacity;
+   return true;
+}
+
+t_display_list_op* RenderEngineDisplayList::_addOp(u8 uType)
+{
+   if ( ! m_bRecording )
+      return NULL;
+   if ( ! _grow((void**)&m_pOps, &m_iCapacityOps, sizeof(t_display_list_op), m_iCountOps+1) )
+      return NULL;
+   t_display_list_op* pOp = &(m_pOps[m_iCountOps]);
+   m_iCountOps++;
+   memset(pOp, 0, sizeof(t_display_list_op));
+   pOp->uType = uType;
+   return pOp;
+}
+
+t_display_list_op* RenderEngineDisplayList::_addColorOp(u8 uType, double* color)
+{
+   if ( NULL == color )
+      return NULL;
+   t_display_list_op* pOp = _addOp(uType);
+   if ( NULL != pOp )
+   {
+      for( int i=0; i<4; i++ )
+         pOp->fParams[i] = color[i];
+   }
+   return pOp;
+}
+
+void RenderEngineDisplayList::_addTextOp(u8 uType, float xPos, float yPos, float fTextHeight, u32 fontId, float fScale, const char* szText)
+{
+   if ( (NULL == szText) || (! m_bRecording) )
+      return;
+   int iLength = strlen(szText) + 1;
+   if ( ! _grow((void**)&m_pText, &m_iCapacityText, 1, m_iTextBytes + iLength) )
+      return;
+   t_display_list_op* pOp = _addOp(uType);
+   if ( NULL == pOp )
+      return;
+   memcpy(m_pText + m_iTextBytes, szText, iLength);
+   pOp->uDataOffset = m_iTextBytes;
+   m_iTextBytes += iLength;
+   pOp->uId = fontId;
+   pOp->fParams[0] = xPos;
+   pOp->fParams[1] = yPos;
+   pOp->fParams[2] = fTextHeight;
+   pOp->fParams[3] = fScale;
+}
+
+void RenderEngineDisplayList::_addPointsOp(u8 uType, float* x, float* y, int count)
+{
+   if ( (NULL == x) || (NULL == y) || (count <= 0) || (! m_bRecording) )
+      return;
+   if ( count > 256 )
+      count = 256;
+   if ( ! _grow((void**)&m_pPoints, &m_iCapacityPoints, sizeof(float), m_iCountPoints + 2*count) )
+      return;
+   t_display_list_op* pOp = _addOp(uType);
+   if ( NULL == pOp )
+      return;
+   pOp->uDataOffset = m_iCountPoints;
+   pOp->uCount = count;
+   for( int i=0; i<count; i++ )
+   {
+      m_pPoints[m_iCountPoints++] = x[i];
+      m_pPoints[m_iCountPoints++] = y[i];
+   }
+}
+
+float RenderEngineDisplayList::setGlobalAlfa(float alfa)
+{
+   float f = m_fGlobalAlfa;
+   m_fGlobalAlfa = alfa;
+   t_display_list_op* pOp = _addOp(DL_OP_GLOBAL_ALFA);
+   if ( NULL != pOp )
+      pOp->fParams[0] = alfa;
+   return f;
+}
+
+void RenderEngineDisplayList::highlightFirstWordOfLine(bool bHighlight)
+{
+   m_bHighlightFirstWord = bHighlight;
+   t_display_list_op* pOp = _addOp(DL_OP_HIGHLIGHT_FIRST_WORD);
+   if ( NULL != pOp )
+      pOp->uFlag = bHighlight?1:0;
+}
+
+bool RenderEngineDisplayList::drawBackgroundBoundingBoxes(bool bEnable)
+{
+   bool b = m_bDrawBackgroundBoundingBoxes;
+   m_bDrawBackgroundBoundingBoxes = bEnable;
+   t_display_list_op* pOp = _addOp(DL_OP_BACKGROUND_BOXES);
+   if ( NULL != pOp )
+      pOp->uFlag = bEnable?1:0;
+   return b;
+}
+
+void RenderEngineDisplayList::setColors(double* color)
+{
+   setColors(color, 1.0);
+}
+
+void RenderEngineDisplayList::setColors(double* color, float fAlfaScale)
+{
+   t_display_list_op* pOp = _addColorOp(DL_OP_COLORS, color);
+   if ( NULL != pOp )
+      pOp->fParams[4] = fAlfaScale;
+}
+
+void RenderEngineDisplayList::setFill(float r, float g, float b, float a)
+{
+   t_display_list_op* pOp = _addOp(DL_OP_FILL);
+   if ( NULL == pOp )
+      return;
+   pOp->fParams[0] = r;
+   pOp->fParams[1] = g;
+   pOp->fParams[2] = b;
+   pOp->fParams[3] = a;
+}
+
+void RenderEngineDisplayList::setStroke(double* color)
+{
+   setStroke(color, 1.0);
+}
+
+void RenderEngineDisplayList::setStroke(double* color, float fStrokeSize)
+{
+   m_fStrokeSize = fStrokeSize;
+   t_display_list_op* pOp = _addColorOp(DL_OP_STROKE_COLOR, color);
+   if ( NULL != pOp )
+      pOp->fParams[4] = fStrokeSize;
+}
+
+void RenderEngineDisplayList::setStroke(float r, float g, float b, float a)
+{
+   t_display_list_op* pOp = _addOp(DL_OP_STROKE);
+   if ( NULL == pOp )
+      return;
+   pOp->fParams[0] = r;
+   pOp->fParams[1] = g;
+   pOp->fParams[2] = b;
+   pOp->fParams[3] = a;
+}
+
+float RenderEngineDisplayList::getStrokeSize()
+{
+   return m_fStrokeSize;
+}
+
+void RenderEngineDisplayList::setStrokeSize(float fStrokeSize)
+{
+   m_fStrokeSize = fStrokeSize;
+   t_display_list_op* pOp = _addOp(DL_OP_STROKE_SIZE);
+   if ( NULL != pOp )
+      pOp->fParams[0] = fStrokeSize;
+}
+
+void RenderEngineDisplayList::setFontColor(u32 fontId, double* color)
+{
+   t_display_list_op* pOp = _addColorOp(DL_OP_FONT_COLOR, color);
+   if ( NULL != pOp )
+      pOp->uId = fontId;
+}
+
+void RenderEngineDisplayList::enableFontScaling(bool bEnable)
+{
+   m_bEnableFontScaling = bEnable;
+   t_display_list_op* pOp = _addOp(DL_OP_FONT_SCALING);
+   if ( NULL != pOp )
+      pOp->uFlag = bEnable?1:0;
+}
+
+void RenderEngineDisplayList::setFontBackgroundBoundingBoxFillColor(double* color)
+{
+   _addColorOp(DL_OP_BOX_FILL_COLOR, color);
+}
+
+void RenderEngineDisplayList::setFontBackgroundBoundingBoxStrikeColor(double* color)
+{
+   _addColorOp(DL_OP_BOX_STRIKE_COLOR, color);
+}
+
+void RenderEngineDisplayList::clearFontBackgroundBoundingBoxStrikeColor()
+{
+   _addOp(DL_OP_BOX_STRIKE_CLEAR);
+}
+
+void RenderEngineDisplayList::setBackgroundBoundingBoxPadding(float fPadding)
+{
+   m_fBoundingBoxPadding = fPadding;
+   t_display_list_op* pOp = _addOp(DL_OP_BOX_PADDING);
+   if ( NULL != pOp )
+      pOp->fParams[0] = fPadding;
+}
+
+// Resources belong to the real engine
+
+u32 RenderEngineDisplayList::loadFont(const char* szFontFile)
+{
+   return (NULL != m_pEngine)?m_pEngine->loadFont(szFontFile):0;
+}
+
+void RenderEngineDisplayList::freeFont(u32 idFont)
+{
+   if ( NULL != m_pEngine )
+      m_pEngine->freeFont(idFont);
+}
+
+u32 RenderEngineDisplayList::loadImage(const char* szFile)
+{
+   return (NULL != m_pEngine)?m_pEngine->loadImage(szFile):0;
+}
+
+void RenderEngineDisplayList::freeImage(u32 idImage)
+{
+   if ( NULL != m_pEngine )
+      m_pEngine->freeImage(idImage);
+}
+
+u32 RenderEngineDisplayList::loadIcon(const char* szFile)
+{
+   return (NULL != m_pEngine)?m_pEngine->loadIcon(szFile):0;
+}
+
+void RenderEngineDisplayList::freeIcon(u32 idIcon)
+{
+   if ( NULL != m_pEngine )
+      m_pEngine->freeIcon(idIcon);
+}
+
+void RenderEngineDisplayList::drawImage(float xPos, float yPos, float fWidth, float fHeight, u32 imageId)
+{
+   t_display_list_op* pOp = _addOp(DL_OP_IMAGE);
+   if ( NULL == pOp )
+      return;
+   pOp->uId = imageId;
+   pOp->fParams[0] = xPos;
+   pOp->fParams[1] = yPos;
+   pOp->fParams[2] = fWidth;
+   pOp->fParams[3] = fHeight;
+}
+
+void RenderEngineDisplayList::drawIcon(float xPos, float yPos, float fWidth, float fHeight, u32 iconId)
+{
+   t_display_list_op* pOp = _addOp(DL_OP_ICON);
+   if ( NULL == pOp )
+      return;
+   pOp->uId = iconId;
+   pOp->fParams[0] = xPos;
+   pOp->fParams[1] = yPos;
+   pOp->fParams[2] = fWidth;
+   pOp->fParams[3] = fHeight;
+}
+
+// Measurements are done by the real engine
+
+float RenderEngineDisplayList::getFontHeight(u32 fontId)
+{
+   return (NULL != m_pEngine)?m_pEngine->getFontHeight(fontId):0.0;
+}
+
+float RenderEngineDisplayList::textHeight(u32 fontId)
+{
+   return (NULL != m_pEngine)?m_pEngine->textHeight(fontId):0.0;
+}
+
+float RenderEngineDisplayList::textHeight(float fTextHeight, u32 fontId)
+{
+   return (NULL != m_pEngine)?m_pEngine->textHeight(fTextHeight, fontId):fTextHeight;
+}
+
+float RenderEngineDisplayList::textWidth(u32 fontId, const char* szText)
+{
+   return (NULL != m_pEngine)?m_pEngine->textWidth(fontId, szText):0.0;
+}
+
+float RenderEngineDisplayList::textWidth(float fTextHeight, u32 fontId, const char* szText)
+{
+   return (NULL != m_pEngine)?m_pEngine->textWidth(fTextHeight, fontId, szText):0.0;
+}
+
+float RenderEngineDisplayList::textHeightScaled(float fTextHeight, u32 fontId, float fScale)
+{
+   return (NULL != m_pEngine)?m_pEngine->textHeightScaled(fTextHeight, fontId, fScale):fTextHeight*fScale;
+}
+
+float RenderEngineDisplayList::textWidthScaled(float fTextHeight, u32 fontId, float fScale, const char* szText)
+{
+   return (NULL != m_pEngine)?m_pEngine->textWidthScaled(fTextHeight, fontId, fScale, szText):0.0;
+}
+
+float RenderEngineDisplayList::getMessageHeight(const char* text, float line_spacing_percent, float max_width, u32 fontId)
+{
+   return (NULL != m_pEngine)?m_pEngine->getMessageHeight(text, line_spacing_percent, max_width, fontId):0.0;
+}
+
+float RenderEngineDisplayList::getMessageHeight(const char* text, float fTextHeight, float line_spacing_percent, float max_width, u32 fontId)
+{
+   return (NULL != m_pEngine)?m_pEngine->getMessageHeight(text, fTextHeight, line_spacing_percent, max_width, fontId):0.0;
+}
+
+void RenderEngineDisplayList::drawText(float xPos, float yPos, u32 fontId, const char* szText)
+{
+   _addTextOp(DL_OP_TEXT, xPos, yPos, 0.0, fontId, 1.0, szText);
+}
+
+void RenderEngineDisplayList::drawText(float xPos, float yPos, float fTextHeight, u32 fontId, const char* szText)
+{
+   _addTextOp(DL_OP_TEXT_HEIGHT, xPos, yPos, fTextHeight, fontId, 1.0, szText);
+}
+
+void RenderEngineDisplayList::drawTextNoOutline(float xPos, float yPos, float fTextHeight, u32 fontId, const char* szText)
+{
+   _addTextOp(DL_OP_TEXT_NO_OUTLINE, xPos, yPos, fTextHeight, fontId, 1.0, szText);
+}
+
+void RenderEngineDisplayList::drawTextLeft(float xPos, float yPos, u32 fontId, const char* szText)
+{
+   _addTextOp(DL_OP_TEXT_LEFT, xPos, yPos, 0.0, fontId, 1.0, szText);
+}
+
+void RenderEngineDisplayList::drawTextLeft(float xPos, float yPos, float fTextHeight, u32 fontId, const char* szText)
+{
+   _addTextOp(DL_OP_TEXT_LEFT_HEIGHT, xPos, yPos, fTextHeight, fontId, 1.0, szText);
+}
+
+void RenderEngineDisplayList::drawTextScaled(float xPos, float yPos, float fTextHeight, u32 fontId, float fScale, const char* szText)
+{
+   _addTextOp(DL_OP_TEXT_SCALED, xPos, yPos, fTextHeight, fontId, fScale, szText);
+}
+
+void RenderEngineDisplayList::drawTextLeftScaled(float xPos, float yPos, float fTextHeight, u32 fontId, float fScale, const char* szText)
+{
+   _addTextOp(DL_OP_TEXT_LEFT_SCALED, xPos, yPos, fTextHeight, fontId, fScale, szText);
+}
+
+float RenderEngineDisplayList::drawMessageLines(float xPos, float yPos, const char* text, float fTextHeight, float line_spacing_percent, float max_width, u32 fontId)
+{
+   _addTextOp(DL_OP_MESSAGE_LINES, xPos, yPos, fTextHeight, fontId, line_spacing_percent, text);
+   if ( (m_iCountOps > 0) && (m_pOps[m_iCountOps-1].uType == DL_OP_MESSAGE_LINES) )
+      m_pOps[m_iCountOps-1].fParams[4] = max_width;
+   return getMessageHeight(text, fTextHeight, line_spacing_percent, max_width, fontId);
+}
+
+void RenderEngineDisplayList::drawLine(float x1, float y1, float x2, float y2)
+{
+   t_display_list_op* pOp = _addOp(DL_OP_LINE);
+   if ( NULL == pOp )
+      return;
+   pOp->fParams[0] = x1;
+   pOp->fParams[1] = y1;
+   pOp->fParams[2] = x2;
+   pOp->fParams[3] = y2;
+}
+
+void RenderEngineDisplayList::drawRect(float xPos, float yPos, float fWidth, float fHeight)
+{
+   t_display_list_op* pOp = _addOp(DL_OP_RECT);
+   if ( NULL == pOp )
+      return;
+   pOp->fParams[0] = xPos;
+   pOp->fParams[1] = yPos;
+   pOp->fParams[2] = fWidth;
+   pOp->fParams[3] = fHeight;
+}
+
+void RenderEngineDisplayList::drawRoundRect(float xPos, float yPos, float fWidth, float fHeight, float fCornerRadius)
+{
+   t_display_list_op* pOp = _addOp(DL_OP_ROUND_RECT);
+   if ( NULL == pOp )
+      return;
+   pOp->fParams[0] = xPos;
+   pOp->fParams[1] = yPos;
+   pOp->fParams[2] = fWidth;
+   pOp->fParams[3] = fHeight;
+   pOp->fParams[4] = fCornerRadius;
+}
+
+void RenderEngineDisplayList::drawTriangle(float x1, float y1, float x2, float y2, float x3, float y3)
+{
+   t_display_list_op* pOp = _addOp(DL_OP_TRIANGLE);
+   if ( NULL == pOp )
+      return;
+   pOp->fParams[0] = x1;
+   pOp->fParams[1] = y1;
+   pOp->fParams[2] = x2;
+   pOp->fParams[3] = y2;
+   pOp->fParams[4] = x3;
+   pOp->fParams[5] = y3;
+}
+
+void RenderEngineDisplayList::drawPolyLine(float* x, float* y, int count)
+{
+   _addPointsOp(DL_OP_POLY_LINE, x, y, count);
+}
+
+void RenderEngineDisplayList::fillPolygon(float* x, float* y, int count)
+{
+   _addPointsOp(DL_OP_FILL_POLYGON, x, y, count);
+}
+
+void RenderEngineDisplayList::fillCircle(float x, float y, float r)
+{
+   t_display_list_op* pOp = _addOp(DL_OP_FILL_CIRCLE);
+   if ( NULL == pOp )
+      return;
+   pOp->fParams[0] = x;
+   pOp->fParams[1] = y;
+   pOp->fParams[2] = r;
+}
+
+void RenderEngineDisplayList::drawCircle(float x, float y, float r)
+{
+   t_display_list_op* pOp = _addOp(DL_OP_CIRCLE);
+   if ( NULL == pOp )
+      return;
+   pOp->fParams[0] = x;
+   pOp->fParams[1] = y;
+   pOp->fParams[2] = r;
+}
+
+void RenderEngineDisplayList::drawArc(float x, float y, float r, float a1, float a2)
+{
+   t_display_list_op* pOp = _addOp(DL_OP_ARC);
+   if ( NULL == pOp )
+      return;
+   pOp->fParams[0] = x;
+   pOp->fParams[1] = y;
+   pOp->fParams[2] = r;
+   pOp->fParams[3] = a1;
+   pOp->fParams[4] = a2;
+}
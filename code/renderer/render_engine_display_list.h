@@ -0,0 +1,128 @@
+#pragma once
+
+#include "render_engine.h"
+
+// Display list: a render engine that records the drawing calls made on it (lines, rects, text runs, colors,
+// alpha...) instead of drawing them, to be replayed later, at an offset, on the real render engine.
+// Text and fonts are measured by the real engine while recording, so code that lays out its content
+// from the text sizes records the same calls it would make on the real engine.
+// The buffers are kept (and only grown) between recordings: re-recording a similar content doesn't allocate.
+
+#define DISPLAY_LIST_OP_PARAMS 8
+
+typedef struct
+{
+   u8 uType;
+   u8 uFlag;
+   u16 uCount; // points, for poly lines
+   u32 uId; // font, icon or image id
+   u32 uDataOffset; // text (in the text buffer) or points (in the points buffer)
+   float fParams[DISPLAY_LIST_OP_PARAMS];
+} t_display_list_op;
+
+typedef struct
+{
+   u32 uOps;
+   u32 uTextBytes;
+   u32 uPoints;
+   u32 uMemory; // bytes allocated by the buffers
+   u32 uAllocations; // buffers (re)allocations, since created
+   u32 uRecordings;
+   u32 uReplays;
+} t_display_list_stats;
+
+class RenderEngineDisplayList: public RenderEngine
+{
+   public:
+     RenderEngineDisplayList();
+     virtual ~RenderEngineDisplayList();
+
+     // Records on this list (cleared first) what is drawn on it, measuring with pEngine
+     void startRecording(RenderEngine* pEngine);
+     void endRecording();
+     void clear();
+     bool isEmpty();
+     void replay(RenderEngine* pEngine, float dx, float dy);
+     t_display_list_stats* getStats();
+
+     virtual float setGlobalAlfa(float alfa);
+     virtual void highlightFirstWordOfLine(bool bHighlight);
+     virtual bool drawBackgroundBoundingBoxes(bool bEnable);
+
+     virtual void setColors(double* color);
+     virtual void setColors(double* color, float fAlfaScale);
+     virtual void setFill(float r, float g, float b, float a);
+     virtual void setStroke(double* color);
+     virtual void setStroke(double* color, float fStrokeSize);
+     virtual void setStroke(float r, float g, float b, float a);
+     virtual float getStrokeSize();
+     virtual void setStrokeSize(float fStrokeSize);
+     virtual void setFontColor(u32 fontId, double* color);
+     virtual void enableFontScaling(bool bEnable);
+     virtual void setFontBackgroundBoundingBoxFillColor(double* color);
+     virtual void setFontBackgroundBoundingBoxStrikeColor(double* color);
+     virtual void clearFontBackgroundBoundingBoxStrikeColor();
+     virtual void setBackgroundBoundingBoxPadding(float fPadding);
+
+     virtual u32 loadFont(const char* szFontFile);
+     virtual void freeFont(u32 idFont);
+     virtual u32 loadImage(const char* szFile);
+     virtual void freeImage(u32 idImage);
+     virtual u32 loadIcon(const char* szFile);
+     virtual void freeIcon(u32 idIcon);
+
+     virtual void drawImage(float xPos, float yPos, float fWidth, float fHeight, u32 imageId);
+     virtual void drawIcon(float xPos, float yPos, float fWidth, float fHeight, u32 iconId);
+
+     virtual float getFontHeight(u32 fontId);
+     virtual float textHeight(u32 fontId);
+     virtual float textHeight(float fTextHeight, u32 fontId);
+     virtual float textWidth(u32 fontId, const char* szText);
+     virtual float textWidth(float fTextHeight, u32 fontId, const char* szText);
+     virtual float textHeightScaled(float fTextHeight, u32 fontId, float fScale);
+     virtual float textWidthScaled(float fTextHeight, u32 fontId, float fScale, const char* szText);
+     virtual void drawText(float xPos, float yPos, u32 fontId, const char* szText);
+     virtual void drawText(float xPos, float yPos, float fTextHeight, u32 fontId, const char* szText);
+     virtual void drawTextNoOutline(float xPos, float yPos, float fTextHeight, u32 fontId, const char* szText);
+     virtual void drawTextLeft(float xPos, float yPos, u32 fontId, const char* szText);
+     virtual void drawTextLeft(float xPos, float yPos, float fTextHeight, u32 fontId, const char* szText);
+     virtual void drawTextScaled(float xPos, float yPos, float fTextHeight, u32 fontId, float fScale, const char* szText);
+     virtual void drawTextLeftScaled(float xPos, float yPos, float fTextHeight, u32 fontId, float fScale, const char* szText);
+     virtual float getMessageHeight(const char* text, float line_spacing_percent, float max_width, u32 fontId);
+     virtual float getMessageHeight(const char* text, float fTextHeight, float line_spacing_percent, float max_width, u32 fontId);
+     virtual float drawMessageLines(float xPos, float yPos, const char* text, float fTextHeight, float line_spacing_percent, float max_width, u32 fontId);
+
+     virtual void drawLine(float x1, float y1, float x2, float y2);
+     virtual void drawRect(float xPos, float yPos, float fWidth, float fHeight);
+     virtual void drawRoundRect(float xPos, float yPos, float fWidth, float fHeight, float fCornerRadius);
+     virtual void drawTriangle(float x1, float y1, float x2, float y2, float x3, float y3);
+     virtual void drawPolyLine(float* x, float* y, int count);
+     virtual void fillPolygon(float* x, float* y, int count);
+
+     virtual void fillCircle(float x, float y, float r);
+     virtual void drawCircle(float x, float y, float r);
+     virtual void drawArc(float x, float y, float r, float a1, float a2);
+
+   protected:
+      t_display_list_op* _addOp(u8 uType);
+      t_display_list_op* _addColorOp(u8 uType, double* color);
+      void _addTextOp(u8 uType, float xPos, float yPos, float fTextHeight, u32 fontId, float fScale, const char* szText);
+      void _addPointsOp(u8 uType, float* x, float* y, int count);
+      bool _grow(void** ppBuffer, int* piCapacity, int iItemSize, int iNeeded);
+
+      RenderEngine* m_pEngine; // measures while recording
+      bool m_bRecording;
+      float m_fStrokeSize;
+
+      t_display_list_op* m_pOps;
+      int m_iCountOps;
+      int m_iCapacityOps;
+      char* m_pText;
+      int m_iTextBytes;
+      int m_iCapacityText;
+      float* m_pPoints;
+      int m_iCountPoints;
+      int m_iCapacityPoints;
+
+      t_display_list_stats m_Stats;
+};
@@ -10,6 +10,7 @@ Code written by: Petru Soroaga, 2021-2023
 */
 
 #include "render_engine_raw.h"
+#include "render_engine_raw_text_cache.h"
 #include "fbg_dispmanx.h"
 #include <math.h>
 
@@ -19,7 +20,24 @@ RenderEngineRaw::RenderEngineRaw()
    log_line("RendererRAW: Init started.");
 
    m_pFBG = fbg_dispmanxSetup(0, VC_IMAGE_RGBA32);
+   _init();
 
+   log_line("RendererRAW: Render init done.");
+}
+
+RenderEngineRaw::RenderEngineRaw(int iOffscreenWidth, int iOffscreenHeight)
+:RenderEngine()
+{
+   log_line("RendererRAW: Init offscreen started.");
+
+   m_pFBG = fbg_customSetup(iOffscreenWidth, iOffscreenHeight, 4, 1, 0, NULL, NULL, NULL, NULL, NULL);
+   _init();
+
+   log_line("RendererRAW: Render offscreen init done.");
+}
+
+void RenderEngineRaw::_init()
+{
    m_iRenderWidth = m_pFBG->width;
    m_iRenderHeight = m_pFBG->height;
    log_line("Initialized graphics to resolution: %d x %d", m_iRenderWidth, m_iRenderHeight);
@@ -37,14 +55,19 @@ RenderEngineRaw::RenderEngineRaw()
    m_ColorStroke[0] = m_ColorStroke[1] = m_ColorStroke[2] = m_ColorStroke[3] = 0;
    m_ColorTextBoundingBoxBgFill[0] = m_ColorTextBoundingBoxBgFill[1] = m_ColorTextBoundingBoxBgFill[2] = m_ColorTextBoundingBoxBgFill[3] = 0;
    m_fStrokeSize = 0.0;
+   m_bDisableTextOutline = false;
 
-   log_line("RendererRAW: Render init done.");
+   m_pTextCache = new RenderEngineRawTextCache();
+   m_bUseTextCache = true;
 }
 
 
 RenderEngineRaw::~RenderEngineRaw()
 {
    log_line("Free graphics engine resources.");
+   if ( NULL != m_pTextCache )
+      delete m_pTextCache;
+   m_pTextCache = NULL;
    if ( NULL != m_pFBG )
    {
       log_line("Free graphics engine instance.");
@@ -52,6 +75,20 @@ RenderEngineRaw::~RenderEngineRaw()
    }
 }
 
+void RenderEngineRaw::setTextCacheEnabled(bool bEnable)
+{
+   m_bUseTextCache = bEnable;
+}
+
+RenderEngineRawTextCache* RenderEngineRaw::getTextCache()
+{
+   return m_pTextCache;
+}
+
+unsigned char* RenderEngineRaw::getBackBuffer()
+{
+   return m_pFBG->back_buffer;
+}
 
 void RenderEngineRaw::setColors(double* color)
 {
@@ -286,6 +323,8 @@ void RenderEngineRaw::freeFont(u32 idFont)
    if ( -1 == indexFont )
       return;
 
+   if ( NULL != m_pTextCache )
+      m_pTextCache->removeFont(idFont);
    fbg_freeImage(m_pFonts[indexFont]->pImage);
    free(m_pFonts[indexFont]);
 
@@ -512,6 +551,47 @@ void RenderEngineRaw::rotate180()
    }
 }
 
+// On the display, the screen is composed by the hardware from all the layers (video, OSD/UI), so it's
+// read back from the display. Offscreen, it's the last frame rendered (the back buffer, until the next startFrame).
+u8* RenderEngineRaw::captureFrame(int* piWidth, int* piHeight)
+{
+   int iSize = m_pFBG->width * m_pFBG->height * 4;
+   u8* pBuffer = (u8*) malloc(iSize);
+   if ( NULL == pBuffer )
+      return NULL;
+
+   if ( NULL != m_pFBG->user_context )
+   {
+      if ( 0 != fbg_dispmanxSnapshot(m_pFBG, pBuffer) )
+      {
+         log_softerror_and_alarm("RendererRAW: Failed to capture the display.");
+         free(pBuffer);
+         return NULL;
+      }
+   }
+   else if ( m_pFBG->components == 4 && m_pFBG->line_length == m_pFBG->width * 4 )
+      memcpy(pBuffer, m_pFBG->back_buffer, iSize);
+   else
+   {
+      for( int y=0; y<m_pFBG->height; y++ )
+      for( int x=0; x<m_pFBG->width; x++ )
+      {
+         unsigned char* pSrc = m_pFBG->back_buffer + y * m_pFBG->line_length + x * m_pFBG->components;
+         u8* pDest = pBuffer + (y * m_pFBG->width + x) * 4;
+         pDest[0] = pSrc[0];
+         pDest[1] = pSrc[1];
+         pDest[2] = pSrc[2];
+         pDest[3] = (m_pFBG->components == 4)?pSrc[3]:255;
+      }
+   }
+
+   if ( NULL != piWidth )
+      *piWidth = m_pFBG->width;
+   if ( NULL != piHeight )
+      *piHeight = m_pFBG->height;
+   return pBuffer;
+}
+
 void RenderEngineRaw::drawImage(float xPos, float yPos, float fWidth, float fHeight, u32 imageId)
 {
    if ( imageId < 1 )
@@ -635,6 +715,17 @@ float RenderEngineRaw::textWidthScaled(float fTextHeight, u32 fontId, float fSca
       return 0.0;
 
    float fWidth = 0.0;
+
+   int iAdvance = 0;
+   int iCharsCount = 0;
+   if ( m_bUseTextCache && (NULL != m_pTextCache) )
+   if ( m_pTextCache->getTextAdvance(fontId, pFont, szText, &iAdvance, &iCharsCount) )
+   {
+      fWidth = iAdvance * m_fPixelWidth * fScale;
+      fWidth += iCharsCount * pFont->dxLetters * pFont->lineHeight*m_fPixelWidth;
+      return fWidth;
+   }
+
    char* p = (char*)szText;
 
    while ( (*p) != 0 )
@@ -696,7 +787,7 @@ void RenderEngineRaw::drawTextScaled(float xPos, float yPos, float fTextHeight,
    if ( fabs(fScale-1.0) > m_fPixelWidth )
        _drawSimpleTextScaled(pFont, szText, x, y, fScale);
    else
-       _drawSimpleText(pFont, szText, x, y);
+       _drawSimpleText(fontId, pFont, szText, x, y);
 }
 
 void RenderEngineRaw::drawTextLeft(float xPos, float yPos, u32 fontId, const char* szText)
@@ -735,10 +826,15 @@ void RenderEngineRaw::drawTextLeftScaled(float xPos, float yPos, float fTextHeig
    if ( y + fScale*pFont->lineHeight >= m_iRenderHeight )
       return;
 
-   char* p = (char*)szText;
    int wText = 0;
+   bool bScaled = (fabs(fScale-1.0) > m_fPixelWidth);
+   bool bCachedWidth = false;
+   int iCharsCount = 0;
+   if ( (!bScaled) && m_bUseTextCache && (NULL != m_pTextCache) && (0.0 == pFont->dxLetters) )
+      bCachedWidth = m_pTextCache->getTextAdvance(fontId, pFont, szText, &wText, &iCharsCount);
 
-   while ( (*p) != 0 )
+   char* p = (char*)szText;
+   while ( (!bCachedWidth) && ((*p) != 0) )
    {
       if ( (*p) >= pFont->charIdFirst && (*p) <= pFont->charIdLast )
       {
@@ -748,10 +844,10 @@ void RenderEngineRaw::drawTextLeftScaled(float xPos, float yPos, float fTextHeig
       p++;
    }
 
-   if ( fabs(fScale-1.0) > m_fPixelWidth )
+   if ( bScaled )
       _drawSimpleTextScaled(pFont, szText, x-wText, y, fScale);
    else
-      _drawSimpleText(pFont, szText, x-wText, y);
+      _drawSimpleText(fontId, pFont, szText, x-wText, y);
 }
 
 float RenderEngineRaw::getMessageHeight(const char* text, float line_spacing_percent, float max_width, u32 fontId)
@@ -921,7 +1017,7 @@ float RenderEngineRaw::drawMessageLines(float xPos, float yPos, const char* text
          if ( m_bEnableFontScaling )
             _drawSimpleTextScaled(pFont, szText, x, y, 0.7);
          else
-            _drawSimpleText(pFont, pTmpWord, x, y);
+            _drawSimpleText(fontId, pFont, pTmpWord, x, y);
          x += wWord;
 
          if ( NULL != szPrevWord && '\n' == szPrevWord[strlen(szPrevWord)-1])
@@ -937,7 +1033,7 @@ float RenderEngineRaw::drawMessageLines(float xPos, float yPos, const char* text
          if ( m_bEnableFontScaling )
             _drawSimpleTextScaled(pFont, szText, x, y, 0.7);
          else
-            _drawSimpleText(pFont, pTmpWord, x, y);
+            _drawSimpleText(fontId, pFont, pTmpWord, x, y);
          line_width += wWord;
          x += wWord;
          szPrevWord = szWord;
@@ -955,7 +1051,43 @@ float RenderEngineRaw::drawMessageLines(float xPos, float yPos, const char* text
    return height;
 }
 
-void RenderEngineRaw::_drawSimpleText(RenderEngineRawFont* pFont, const char* szText, int x, int y)
+void RenderEngineRaw::_drawTextBackgroundBox(RenderEngineRawFont* pFont, int xBoundingStart, int yBoundingStart, int xBoundingEnd, int yBoundingEnd)
+{
+   if ( (xBoundingStart >= xBoundingEnd) || (yBoundingStart >= yBoundingEnd) )
+      return;
+
+   xBoundingStart -= 0.7*pFont->chars[' '-pFont->charIdFirst].xAdvance;
+   xBoundingEnd += 0.7*pFont->chars[' '-pFont->charIdFirst].xAdvance;
+   yBoundingStart += 3;
+   yBoundingEnd -= 2;
+   yBoundingStart += pFont->lineHeight*0.03;
+   yBoundingEnd -= pFont->lineHeight*0.01;
+
+   u8 tmp_ColorFill[4];
+   u8 tmp_ColorStroke[4];
+   float tmp_fStrokeSize = m_fStrokeSize;
+
+   memcpy(tmp_ColorFill, m_ColorFill, 4*sizeof(u8));
+   memcpy(tmp_ColorStroke, m_ColorStroke, 4*sizeof(u8));
+   memcpy(m_ColorFill, m_ColorTextBoundingBoxBgFill, 4*sizeof(u8));
+   m_ColorStroke[0] = 0; m_ColorStroke[1] = 0; m_ColorStroke[2] = 0; m_ColorStroke[3] = 0;
+   m_fStrokeSize = 0.0;
+   if ( m_bDrawStrikeOnTextBackgroundBoundingBoxes )
+   {
+      m_ColorStroke[0] = m_ColorTextBackgroundBoundingBoxStrike[0];
+      m_ColorStroke[1] = m_ColorTextBackgroundBoundingBoxStrike[1];
+      m_ColorStroke[2] = m_ColorTextBackgroundBoundingBoxStrike[2];
+      m_ColorStroke[3] = m_ColorTextBackgroundBoundingBoxStrike[3]*255;
+      m_fStrokeSize = 1.0;
+   }
+   drawRoundRect(xBoundingStart/(float)m_iRenderWidth - m_fBoundingBoxPadding/getAspectRatio(), yBoundingStart/(float)m_iRenderHeight - m_fBoundingBoxPadding, (xBoundingEnd - xBoundingStart)/(float)m_iRenderWidth + 2.0*m_fBoundingBoxPadding/getAspectRatio(), (yBoundingEnd - yBoundingStart)/(float)m_iRenderHeight + 2.0*m_fBoundingBoxPadding, 5.0 );
+
+   memcpy(m_ColorFill, tmp_ColorFill, 4*sizeof(u8));
+   memcpy(m_ColorStroke, tmp_ColorStroke, 4*sizeof(u8));
+   m_fStrokeSize = tmp_fStrokeSize;
+}
+
+void RenderEngineRaw::_drawSimpleText(u32 fontId, RenderEngineRawFont* pFont, const char* szText, int x, int y)
 {
    if ( NULL == pFont || NULL == szText || 0 == szText[0] )
       return;
@@ -965,6 +1097,30 @@ void RenderEngineRaw::_drawSimpleText(RenderEngineRawFont* pFont, const char* sz
    if ( y + pFont->lineHeight >= m_iRenderHeight )
       return;
 
+   // Cached path: the whole text is one premultiplied span, or glyphs from the color atlas for long texts.
+   // Keyed on the color the glyphs are drawn with (mix_color), callers can change it from the fill color (highlights).
+
+   t_raw_text_glyph_atlas* pAtlas = NULL;
+   if ( m_bUseTextCache && (NULL != m_pTextCache) )
+   {
+      u8 uColor[4];
+      uColor[0] = m_pFBG->mix_color.r;
+      uColor[1] = m_pFBG->mix_color.g;
+      uColor[2] = m_pFBG->mix_color.b;
+      uColor[3] = m_pFBG->mix_color.a;
+      t_raw_text_span* pSpan = m_pTextCache->getTextSpan(fontId, pFont, uColor, m_bDisableTextOutline, pFont->dxLetters * pFont->lineHeight*m_fPixelWidth, szText);
+      if ( NULL != pSpan )
+      {
+         if ( m_bDrawBackgroundBoundingBoxes )
+            _drawTextBackgroundBox(pFont, _FBG_MAX(x,0), y, _FBG_MIN(x + pSpan->iWidth, m_iRenderWidth), y + pSpan->iHeight);
+         RenderEngineRawTextCache::drawSpan(m_pFBG, pSpan, x, y);
+         return;
+      }
+      pAtlas = m_pTextCache->getGlyphAtlas(fontId, pFont, uColor, m_bDisableTextOutline);
+      if ( (NULL != pAtlas) && (NULL == pAtlas->pPixels) )
+         pAtlas = NULL;
+   }
+
    int xBoundingStart = 5000;
    int yBoundingStart = 5000;
    int xBoundingEnd = 0;
@@ -1012,38 +1168,7 @@ void RenderEngineRaw::_drawSimpleText(RenderEngineRawFont* pFont, const char* sz
          pText++;
       }
       x = xOrg;
-      if ( (xBoundingStart < xBoundingEnd) && (yBoundingStart < yBoundingEnd) )
-      {
-         xBoundingStart -= 0.7*pFont->chars[' '-pFont->charIdFirst].xAdvance;
-         xBoundingEnd += 0.7*pFont->chars[' '-pFont->charIdFirst].xAdvance;
-         yBoundingStart += 3;
-         yBoundingEnd -= 2;
-         yBoundingStart += pFont->lineHeight*0.03;
-         yBoundingEnd -= pFont->lineHeight*0.01;
-
-         u8 tmp_ColorFill[4];
-         u8 tmp_ColorStroke[4];
-         float tmp_fStrokeSize = m_fStrokeSize;
-
-         memcpy(tmp_ColorFill, m_ColorFill, 4*sizeof(u8));
-         memcpy(tmp_ColorStroke, m_ColorStroke, 4*sizeof(u8));
-         memcpy(m_ColorFill, m_ColorTextBoundingBoxBgFill, 4*sizeof(u8));
-         m_ColorStroke[0] = 0; m_ColorStroke[1] = 0; m_ColorStroke[2] = 0; m_ColorStroke[3] = 0;
-         m_fStrokeSize = 0.0;
-         if ( m_bDrawStrikeOnTextBackgroundBoundingBoxes )
-         {
-            m_ColorStroke[0] = m_ColorTextBackgroundBoundingBoxStrike[0];
-            m_ColorStroke[1] = m_ColorTextBackgroundBoundingBoxStrike[1];
-            m_ColorStroke[2] = m_ColorTextBackgroundBoundingBoxStrike[2];
-            m_ColorStroke[3] = m_ColorTextBackgroundBoundingBoxStrike[3]*255;
-            m_fStrokeSize = 1.0;
-         }
-         drawRoundRect(xBoundingStart/(float)m_iRenderWidth - m_fBoundingBoxPadding/getAspectRatio(), yBoundingStart/(float)m_iRenderHeight - m_fBoundingBoxPadding, (xBoundingEnd - xBoundingStart)/(float)m_iRenderWidth + 2.0*m_fBoundingBoxPadding/getAspectRatio(), (yBoundingEnd - yBoundingStart)/(float)m_iRenderHeight + 2.0*m_fBoundingBoxPadding, 5.0 );
-
-         memcpy(m_ColorFill, tmp_ColorFill, 4*sizeof(u8));
-         memcpy(m_ColorStroke, tmp_ColorStroke, 4*sizeof(u8));
-         m_fStrokeSize = tmp_fStrokeSize;
-      }
+      _drawTextBackgroundBox(pFont, xBoundingStart, yBoundingStart, xBoundingEnd, yBoundingEnd);
    }
 
    while ( *szText )
@@ -1068,9 +1193,11 @@ void RenderEngineRaw::_drawSimpleText(RenderEngineRawFont* pFont, const char* sz
       int yImg = pFont->chars[(*szText)-pFont->charIdFirst].imgYOffset;
       int wImg = pFont->chars[(*szText)-pFont->charIdFirst].width;
       int hImg = pFont->chars[(*szText)-pFont->charIdFirst].height;
-      unsigned char *img_pointer = (unsigned char *)(pFont->pImage->data + (yImg * pFont->pImage->width * m_pFBG->components + xImg * m_pFBG->components));
 
-      fbg_imageClipAColor(m_pFBG, pFont->pImage, x, y, xImg, yImg, wImg, hImg);
+      if ( NULL != pAtlas )
+         RenderEngineRawTextCache::drawGlyph(m_pFBG, pAtlas, (*szText)-pFont->charIdFirst, x, y);
+      else
+         fbg_imageClipAColor(m_pFBG, pFont->pImage, x, y, xImg, yImg, wImg, hImg);
 
       if ( x < xBoundingStart )
          xBoundingStart = x;
@@ -38,13 +38,19 @@ typedef struct
 
 } RenderEngineRawFont;
 
+class RenderEngineRawTextCache;
 
 class RenderEngineRaw: public RenderEngine
 {
    public:
      RenderEngineRaw();
+     RenderEngineRaw(int iOffscreenWidth, int iOffscreenHeight); // renders to a memory buffer only
      virtual ~RenderEngineRaw();
 
+     void setTextCacheEnabled(bool bEnable);
+     RenderEngineRawTextCache* getTextCache();
+     unsigned char* getBackBuffer();
+
      virtual void setColors(double* color);
      virtual void setColors(double* color, float fAlfaScale);
      virtual void setFill(float r, float g, float b, float a);
@@ -66,6 +72,7 @@ class RenderEngineRaw: public RenderEngine
      virtual void startFrame();
      virtual void endFrame();
      virtual void rotate180();
+     virtual u8* captureFrame(int* piWidth, int* piHeight);
 
      virtual void drawImage(float xPos, float yPos, float fWidth, float fHeight, u32 imageId);
      virtual void drawIcon(float xPos, float yPos, float fWidth, float fHeight, u32 iconId);
@@ -103,7 +110,9 @@ class RenderEngineRaw: public RenderEngine
       RenderEngineRawFont* _getFontFromId(u32 fontId);
       void _buildMipImage(struct _fbg_img* pSrc, struct _fbg_img* pDest);
 
-      void _drawSimpleText(RenderEngineRawFont* pFont, const char* szText, int x, int y);
+      void _init();
+      void _drawTextBackgroundBox(RenderEngineRawFont* pFont, int xStart, int yStart, int xEnd, int yEnd);
+      void _drawSimpleText(u32 fontId, RenderEngineRawFont* pFont, const char* szText, int x, int y);
       void _drawSimpleTextScaled(RenderEngineRawFont* pFont, const char* szText, int x, int y, float fScale);
 
       struct _fbg* m_pFBG;
@@ -130,4 +139,7 @@ class RenderEngineRaw: public RenderEngine
       float m_fStrokeSize;
 
       bool m_bDisableTextOutline;
+
+      RenderEngineRawTextCache* m_pTextCache;
+      bool m_bUseTextCache;
 };
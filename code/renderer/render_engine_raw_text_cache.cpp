@@ -0,0 +1,551 @@
+/*
+You can use this C/C++ code however you wish (for example, but not limited to:
+     as is, or by modifying it, or by adding new code, or by removing parts of the code;
+     in public or private projects, in new free or commercial products)
+     only if you get a priori written consent from Petru Soroaga (petrusoroaga@yahoo.com) for your specific use
+     and only if this copyright terms are preserved in the code.
+     This code is public for learning and academic purposes.
+Also, check the licences folder for additional licences terms.
+Code written by: Petru Soroaga, 2021-2023
+*/
+
+#include "render_engine_raw_text_cache.h"
+#include "../base/base.h"
+
+RenderEngineRawTextCache::RenderEngineRawTextCache()
+{
+   m_uUseCounter = 0;
+   m_iCountAtlases = 0;
+   m_iCountAdvances = 0;
+   memset(m_Atlases, 0, sizeof(m_Atlases));
+   memset(&m_Stats, 0, sizeof(m_Stats));
+
+   m_pSpans = (t_raw_text_span*) malloc(RAW_TEXT_CACHE_MAX_SPANS * sizeof(t_raw_text_span));
+   m_pAdvances = (t_raw_text_advance*) malloc(RAW_TEXT_CACHE_MAX_ADVANCES * sizeof(t_raw_text_advance));
+   if ( NULL == m_pSpans || NULL == m_pAdvances )
+      log_softerror_and_alarm("RendererRAW: Failed to allocate text cache.");
+   if ( NULL != m_pSpans )
+      memset(m_pSpans, 0, RAW_TEXT_CACHE_MAX_SPANS * sizeof(t_raw_text_span));
+   if ( NULL != m_pAdvances )
+      memset(m_pAdvances, 0, RAW_TEXT_CACHE_MAX_ADVANCES * sizeof(t_raw_text_advance));
+
+   for( int i=0; i<RAW_TEXT_CACHE_HASH_SIZE; i++ )
+   {
+      m_iSpansHash[i] = -1;
+      m_iAdvancesHash[i] = -1;
+   }
+}
+
+RenderEngineRawTextCache::~RenderEngineRawTextCache()
+{
+   clear();
+   if ( NULL != m_pSpans )
+      free(m_pSpans);
+   if ( NULL != m_pAdvances )
+      free(m_pAdvances);
+   m_pSpans = NULL;
+   m_pAdvances = NULL;
+}
+
+void RenderEngineRawTextCache::clear()
+{
+   for( int i=0; i<m_iCountAtlases; i++ )
+   {
+      if ( NULL != m_Atlases[i].pPixels )
+         free(m_Atlases[i].pPixels);
+      m_Atlases[i].pPixels = NULL;
+   }
+   m_iCountAtlases = 0;
+
+   if ( NULL != m_pSpans )
+   for( int i=0; i<RAW_TEXT_CACHE_MAX_SPANS; i++ )
+   {
+      if ( NULL != m_pSpans[i].pPixels )
+         free(m_pSpans[i].pPixels);
+      m_pSpans[i].pPixels = NULL;
+   }
+   m_iCountAdvances = 0;
+   m_Stats.uSpansMemory = 0;
+
+   for( int i=0; i<RAW_TEXT_CACHE_HASH_SIZE; i++ )
+   {
+      m_iSpansHash[i] = -1;
+      m_iAdvancesHash[i] = -1;
+   }
+}
+
+void RenderEngineRawTextCache::removeFont(u32 uFontId)
+{
+   for( int i=0; i<m_iCountAtlases; i++ )
+   {
+      if ( m_Atlases[i].uFontId != uFontId )
+         continue;
+      if ( NULL != m_Atlases[i].pPixels )
+         free(m_Atlases[i].pPixels);
+      m_Atlases[i] = m_Atlases[m_iCountAtlases-1];
+      m_Atlases[m_iCountAtlases-1].pPixels = NULL;
+      m_iCountAtlases--;
+      i--;
+   }
+
+   if ( NULL != m_pSpans )
+   for( int i=0; i<RAW_TEXT_CACHE_MAX_SPANS; i++ )
+   {
+      if ( (NULL != m_pSpans[i].pPixels) && (m_pSpans[i].uFontId == uFontId) )
+         _freeSpan(i);
+   }
+
+   if ( NULL != m_pAdvances )
+   for( int i=0; i<m_iCountAdvances; i++ )
+   {
+      if ( m_pAdvances[i].uFontId != uFontId )
+         continue;
+      _unlinkAdvance(i);
+      i--;
+   }
+}
+
+t_raw_text_cache_stats* RenderEngineRawTextCache::getStats()
+{
+   return &m_Stats;
+}
+
+u32 RenderEngineRawTextCache::_hashText(u32 uSeed, const char* szText)
+{
+   // FNV-1a
+   u32 uHash = 2166136261u ^ uSeed;
+   while ( 0 != *szText )
+   {
+      uHash ^= (u8)(*szText);
+      uHash *= 16777619u;
+      szText++;
+   }
+   return uHash;
+}
+
+bool RenderEngineRawTextCache::getTextAdvance(u32 uFontId, RenderEngineRawFont* pFont, const char* szText, int* piAdvance, int* piCharsCount)
+{
+   if ( NULL == pFont || NULL == szText || NULL == m_pAdvances )
+      return false;
+   if ( strlen(szText) > RAW_TEXT_CACHE_MAX_TEXT_LENGTH )
+      return false;
+
+   m_uUseCounter++;
+   u32 uHash = _hashText(uFontId, szText);
+   int iBucket = uHash % RAW_TEXT_CACHE_HASH_SIZE;
+   for( int i=m_iAdvancesHash[iBucket]; i != -1; i = m_pAdvances[i].iNextInHash )
+   {
+      if ( m_pAdvances[i].uHash != uHash || m_pAdvances[i].uFontId != uFontId )
+         continue;
+      if ( 0 != strcmp(m_pAdvances[i].szText, szText) )
+         continue;
+      m_pAdvances[i].uLastUsed = m_uUseCounter;
+      m_Stats.uAdvanceHits++;
+      if ( NULL != piAdvance )
+         *piAdvance = m_pAdvances[i].iAdvance;
+      if ( NULL != piCharsCount )
+         *piCharsCount = m_pAdvances[i].iCharsCount;
+      return true;
+   }
+
+   m_Stats.uAdvanceMisses++;
+
+   // Not found, evict the least recently used one if full
+
+   if ( m_iCountAdvances >= RAW_TEXT_CACHE_MAX_ADVANCES )
+   {
+      int iOldest = 0;
+      for( int i=1; i<m_iCountAdvances; i++ )
+         if ( m_pAdvances[i].uLastUsed < m_pAdvances[iOldest].uLastUsed )
+            iOldest = i;
+      _unlinkAdvance(iOldest);
+   }
+
+   t_raw_text_advance* pAdvance = &(m_pAdvances[m_iCountAdvances]);
+   pAdvance->uHash = uHash;
+   pAdvance->uFontId = uFontId;
+   strcpy(pAdvance->szText, szText);
+   pAdvance->iAdvance = 0;
+   pAdvance->iCharsCount = 0;
+   pAdvance->uLastUsed = m_uUseCounter;
+
+   const char* p = szText;
+   while ( (*p) != 0 )
+   {
+      if ( (*p) >= pFont->charIdFirst && (*p) <= pFont->charIdLast )
+      {
+         pAdvance->iAdvance += pFont->chars[(*p)-pFont->charIdFirst].xAdvance;
+         pAdvance->iCharsCount++;
+      }
+      p++;
+   }
+
+   pAdvance->iNextInHash = m_iAdvancesHash[iBucket];
+   m_iAdvancesHash[iBucket] = m_iCountAdvances;
+   m_iCountAdvances++;
+
+   if ( NULL != piAdvance )
+      *piAdvance = pAdvance->iAdvance;
+   if ( NULL != piCharsCount )
+      *piCharsCount = pAdvance->iCharsCount;
+   return true;
+}
+
+// Removes the entry from its hash chain and moves the last entry in its place
+
+void RenderEngineRawTextCache::_unlinkAdvance(int iIndex)
+{
+   int iBucket = m_pAdvances[iIndex].uHash % RAW_TEXT_CACHE_HASH_SIZE;
+   int* pLink = &(m_iAdvancesHash[iBucket]);
+   while ( *pLink != -1 && *pLink != iIndex )
+      pLink = &(m_pAdvances[*pLink].iNextInHash);
+   if ( *pLink == iIndex )
+      *pLink = m_pAdvances[iIndex].iNextInHash;
+
+   int iLast = m_iCountAdvances-1;
+   if ( iIndex != iLast )
+   {
+      iBucket = m_pAdvances[iLast].uHash % RAW_TEXT_CACHE_HASH_SIZE;
+      pLink = &(m_iAdvancesHash[iBucket]);
+      while ( *pLink != -1 && *pLink != iLast )
+         pLink = &(m_pAdvances[*pLink].iNextInHash);
+      if ( *pLink == iLast )
+         *pLink = iIndex;
+      m_pAdvances[iIndex] = m_pAdvances[iLast];
+   }
+   m_iCountAdvances--;
+}
+
+t_raw_text_glyph_atlas* RenderEngineRawTextCache::getGlyphAtlas(u32 uFontId, RenderEngineRawFont* pFont, u8* pColor, bool bNoOutline)
+{
+   if ( NULL == pFont || NULL == pFont->pImage )
+      return NULL;
+
+   m_uUseCounter++;
+   u32 uColor = (((u32)pColor[0]) << 24) | (((u32)pColor[1]) << 16) | (((u32)pColor[2]) << 8) | (u32)pColor[3];
+   for( int i=0; i<m_iCountAtlases; i++ )
+   {
+      if ( m_Atlases[i].uFontId == uFontId && m_Atlases[i].uColor == uColor && m_Atlases[i].bNoOutline == bNoOutline )
+      {
+         m_Atlases[i].uLastUsed = m_uUseCounter;
+         m_Stats.uAtlasHits++;
+         return &(m_Atlases[i]);
+      }
+   }
+
+   m_Stats.uAtlasMisses++;
+
+   int iIndex = m_iCountAtlases;
+   if ( m_iCountAtlases >= RAW_TEXT_CACHE_MAX_ATLASES )
+   {
+      iIndex = 0;
+      for( int i=1; i<m_iCountAtlases; i++ )
+         if ( m_Atlases[i].uLastUsed < m_Atlases[iIndex].uLastUsed )
+            iIndex = i;
+      if ( NULL != m_Atlases[iIndex].pPixels )
+         free(m_Atlases[iIndex].pPixels);
+      m_Atlases[iIndex].pPixels = NULL;
+   }
+   else
+      m_iCountAtlases++;
+
+   t_raw_text_glyph_atlas* pAtlas = &(m_Atlases[iIndex]);
+   pAtlas->uFontId = uFontId;
+   pAtlas->uColor = uColor;
+   pAtlas->bNoOutline = bNoOutline;
+   pAtlas->pFont = pFont;
+   pAtlas->uLastUsed = m_uUseCounter;
+   _buildAtlas(pAtlas);
+   return pAtlas;
+}
+
+// Same color modulation as fbg_imageClipAColor, stored premultiplied
+
+void RenderEngineRawTextCache::_buildAtlas(t_raw_text_glyph_atlas* pAtlas)
+{
+   RenderEngineRawFont* pFont = pAtlas->pFont;
+   u32 uColorR = (pAtlas->uColor >> 24) & 0xFF;
+   u32 uColorG = (pAtlas->uColor >> 16) & 0xFF;
+   u32 uColorB = (pAtlas->uColor >> 8) & 0xFF;
+   u32 uColorA = pAtlas->uColor & 0xFF;
+
+   int iTotalSize = 0;
+   for( int i=0; i<pFont->charCount && i<MAX_FONT_CHARS; i++ )
+      if ( pFont->chars[i].width > 0 && pFont->chars[i].height > 0 )
+         iTotalSize += pFont->chars[i].width * pFont->chars[i].height * 4;
+
+   pAtlas->pPixels = NULL;
+   if ( iTotalSize > 0 )
+      pAtlas->pPixels = (u8*) malloc(iTotalSize);
+
+   int iOffset = 0;
+   for( int i=0; i<MAX_FONT_CHARS; i++ )
+   {
+      pAtlas->iGlyphOffset[i] = -1;
+      if ( NULL == pAtlas->pPixels || i >= pFont->charCount )
+         continue;
+      RenderEngineRawFontChar* pChar = &(pFont->chars[i]);
+      if ( pChar->width <= 0 || pChar->height <= 0 )
+         continue;
+      if ( pChar->imgXOffset < 0 || pChar->imgYOffset < 0 )
+         continue;
+      if ( pChar->imgXOffset + pChar->width > (int)pFont->pImage->width || pChar->imgYOffset + pChar->height > (int)pFont->pImage->height )
+         continue;
+
+      pAtlas->iGlyphOffset[i] = iOffset;
+      u8* pDest = pAtlas->pPixels + iOffset;
+      for( int y=0; y<pChar->height; y++ )
+      {
+         u8* pSrc = pFont->pImage->data + ((pChar->imgYOffset + y) * pFont->pImage->width + pChar->imgXOffset) * 4;
+         for( int x=0; x<pChar->width; x++ )
+         {
+            u32 uAlpha = (pSrc[3] * uColorA) >> 8;
+            if ( pAtlas->bNoOutline && ((u32)pSrc[0] + (u32)pSrc[1] + (u32)pSrc[2] < 120) )
+               uAlpha = 0;
+            pDest[0] = (uAlpha * ((pSrc[0] * uColorR) >> 8)) >> 8;
+            pDest[1] = (uAlpha * ((pSrc[1] * uColorG) >> 8)) >> 8;
+            pDest[2] = (uAlpha * ((pSrc[2] * uColorB) >> 8)) >> 8;
+            pDest[3] = uAlpha;
+            pDest += 4;
+            pSrc += 4;
+         }
+      }
+      iOffset += pChar->width * pChar->height * 4;
+   }
+}
+
+t_raw_text_span* RenderEngineRawTextCache::getTextSpan(u32 uFontId, RenderEngineRawFont* pFont, u8* pColor, bool bNoOutline, float fDxLetters, const char* szText)
+{
+   if ( NULL == pFont || NULL == szText || 0 == szText[0] || NULL == m_pSpans )
+      return NULL;
+   if ( strlen(szText) > RAW_TEXT_CACHE_MAX_TEXT_LENGTH )
+      return NULL;
+
+   m_uUseCounter++;
+   u32 uColor = (((u32)pColor[0]) << 24) | (((u32)pColor[1]) << 16) | (((u32)pColor[2]) << 8) | (u32)pColor[3];
+   u32 uHash = _hashText(uFontId ^ (uColor * 2654435761u) ^ (bNoOutline?0x5A5A5A5A:0), szText);
+   int iBucket = uHash % RAW_TEXT_CACHE_HASH_SIZE;
+   for( int i=m_iSpansHash[iBucket]; i != -1; i = m_pSpans[i].iNextInHash )
+   {
+      t_raw_text_span* pSpan = &(m_pSpans[i]);
+      if ( pSpan->uHash != uHash || pSpan->uFontId != uFontId || pSpan->uColor != uColor || pSpan->bNoOutline != bNoOutline )
+         continue;
+      if ( 0 != strcmp(pSpan->szText, szText) )
+         continue;
+      pSpan->uLastUsed = m_uUseCounter;
+      m_Stats.uSpanHits++;
+      return pSpan;
+   }
+
+   m_Stats.uSpanMisses++;
+
+   t_raw_text_glyph_atlas* pAtlas = getGlyphAtlas(uFontId, pFont, pColor, bNoOutline);
+   if ( NULL == pAtlas || NULL == pAtlas->pPixels )
+      return NULL;
+
+   t_raw_text_span span;
+   span.uHash = uHash;
+   span.uFontId = uFontId;
+   span.uColor = uColor;
+   span.bNoOutline = bNoOutline;
+   strcpy(span.szText, szText);
+   span.pPixels = NULL;
+   if ( ! _buildSpan(&span, pAtlas, fDxLetters) )
+      return NULL;
+
+   // Find a free slot, evict least recently used spans while over the count or memory limit
+
+   int iSlot = -1;
+   for( int i=0; i<RAW_TEXT_CACHE_MAX_SPANS; i++ )
+      if ( NULL == m_pSpans[i].pPixels )
+      {
+         iSlot = i;
+         break;
+      }
+
+   while ( (-1 == iSlot) || (m_Stats.uSpansMemory + span.iWidth*span.iHeight*4 > RAW_TEXT_CACHE_MAX_SPANS_MEMORY) )
+   {
+      int iOldest = -1;
+      for( int i=0; i<RAW_TEXT_CACHE_MAX_SPANS; i++ )
+      {
+         if ( NULL == m_pSpans[i].pPixels )
+            continue;
+         if ( (-1 == iOldest) || (m_pSpans[i].uLastUsed < m_pSpans[iOldest].uLastUsed) )
+            iOldest = i;
+      }
+      if ( -1 == iOldest )
+         break;
+      _freeSpan(iOldest);
+      iSlot = iOldest;
+   }
+
+   if ( -1 == iSlot )
+   {
+      free(span.pPixels);
+      return NULL;
+   }
+
+   span.uLastUsed = m_uUseCounter;
+   span.iNextInHash = m_iSpansHash[iBucket];
+   m_pSpans[iSlot] = span;
+   m_iSpansHash[iBucket] = iSlot;
+   m_Stats.uSpansMemory += span.iWidth*span.iHeight*4;
+   return &(m_pSpans[iSlot]);
+}
+
+void RenderEngineRawTextCache::_freeSpan(int iIndex)
+{
+   t_raw_text_span* pSpan = &(m_pSpans[iIndex]);
+   if ( NULL == pSpan->pPixels )
+      return;
+
+   int iBucket = pSpan->uHash % RAW_TEXT_CACHE_HASH_SIZE;
+   int* pLink = &(m_iSpansHash[iBucket]);
+   while ( *pLink != -1 && *pLink != iIndex )
+      pLink = &(m_pSpans[*pLink].iNextInHash);
+   if ( *pLink == iIndex )
+      *pLink = pSpan->iNextInHash;
+
+   m_Stats.uSpansMemory -= pSpan->iWidth*pSpan->iHeight*4;
+   free(pSpan->pPixels);
+   pSpan->pPixels = NULL;
+}
+
+// Lays out the text the same way _drawSimpleText does and composes the glyphs (premultiplied "over")
+
+bool RenderEngineRawTextCache::_buildSpan(t_raw_text_span* pSpan, t_raw_text_glyph_atlas* pAtlas, float fDxLetters)
+{
+   RenderEngineRawFont* pFont = pAtlas->pFont;
+   int x = 0;
+   pSpan->iWidth = 0;
+   pSpan->iHeight = 0;
+   pSpan->iGlyphsCount = 0;
+
+   const char* p = pSpan->szText;
+   while ( (*p) != 0 )
+   {
+      if ( (*p) < pFont->charIdFirst || (*p) > pFont->charIdLast )
+      {
+         p++;
+         continue;
+      }
+      RenderEngineRawFontChar* pChar = &(pFont->chars[(*p)-pFont->charIdFirst]);
+      pSpan->uGlyphX[pSpan->iGlyphsCount] = x;
+      pSpan->iGlyphsCount++;
+      if ( x + pChar->width > pSpan->iWidth )
+         pSpan->iWidth = x + pChar->width;
+      if ( pChar->height > pSpan->iHeight )
+         pSpan->iHeight = pChar->height;
+      x += pChar->xAdvance;
+      x += fDxLetters;
+      p++;
+   }
+   pSpan->iAdvance = x;
+
+   if ( pSpan->iWidth <= 0 || pSpan->iHeight <= 0 )
+      return false;
+
+   pSpan->pPixels = (u8*) malloc(pSpan->iWidth * pSpan->iHeight * 4);
+   if ( NULL == pSpan->pPixels )
+      return false;
+   memset(pSpan->pPixels, 0, pSpan->iWidth * pSpan->iHeight * 4);
+
+   int iGlyph = 0;
+   p = pSpan->szText;
+   while ( (*p) != 0 )
+   {
+      if ( (*p) < pFont->charIdFirst || (*p) > pFont->charIdLast )
+      {
+         p++;
+         continue;
+      }
+      int iCharIndex = (*p)-pFont->charIdFirst;
+      RenderEngineRawFontChar* pChar = &(pFont->chars[iCharIndex]);
+      int xGlyph = pSpan->uGlyphX[iGlyph];
+      iGlyph++;
+      p++;
+      if ( pAtlas->iGlyphOffset[iCharIndex] < 0 )
+         continue;
+
+      u8* pSrc = pAtlas->pPixels + pAtlas->iGlyphOffset[iCharIndex];
+      for( int y=0; y<pChar->height; y++ )
+      {
+         u8* pDest = pSpan->pPixels + (y * pSpan->iWidth + xGlyph) * 4;
+         for( int i=0; i<pChar->width; i++ )
+         {
+            u32 uInvAlpha = 255 - pSrc[3];
+            if ( 0 != pSrc[3] )
+            {
+               pDest[0] = pSrc[0] + ((uInvAlpha * pDest[0]) >> 8);
+               pDest[1] = pSrc[1] + ((uInvAlpha * pDest[1]) >> 8);
+               pDest[2] = pSrc[2] + ((uInvAlpha * pDest[2]) >> 8);
+               pDest[3] = pSrc[3] + ((uInvAlpha * pDest[3]) >> 8);
+            }
+            pDest += 4;
+            pSrc += 4;
+         }
+      }
+   }
+   return true;
+}
+
+static inline void _raw_text_blend_row(u8* pDest, const u8* pSrc, int iCount)
+{
+   for( int i=0; i<iCount; i++ )
+   {
+      u32 uAlpha = pSrc[3];
+      if ( 0 != uAlpha )
+      {
+         u32 uInvAlpha = 255 - uAlpha;
+         pDest[0] = pSrc[0] + ((uInvAlpha * pDest[0]) >> 8);
+         pDest[1] = pSrc[1] + ((uInvAlpha * pDest[1]) >> 8);
+         pDest[2] = pSrc[2] + ((uInvAlpha * pDest[2]) >> 8);
+         if ( pDest[3] != 255 )
+            pDest[3] = pDest[3] + (((255 - pDest[3]) * uAlpha) >> 8);
+      }
+      pDest += 4;
+      pSrc += 4;
+   }
+}
+
+static void _raw_text_blit(struct _fbg* pFBG, const u8* pPixels, int iWidth, int iHeight, int x, int y)
+{
+   int xStart = 0;
+   int yStart = 0;
+   int xEnd = iWidth;
+   int yEnd = iHeight;
+   if ( x < 0 )
+      xStart = -x;
+   if ( y < 0 )
+      yStart = -y;
+   if ( x + xEnd > pFBG->width )
+      xEnd = pFBG->width - x;
+   if ( y + yEnd > pFBG->height )
+      yEnd = pFBG->height - y;
+   if ( xStart >= xEnd || yStart >= yEnd )
+      return;
+
+   for( int iRow=yStart; iRow<yEnd; iRow++ )
+   {
+      u8* pDest = pFBG->back_buffer + (y + iRow) * pFBG->line_length + (x + xStart) * 4;
+      const u8* pSrc = pPixels + (iRow * iWidth + xStart) * 4;
+      _raw_text_blend_row(pDest, pSrc, xEnd - xStart);
+   }
+}
+
+void RenderEngineRawTextCache::drawGlyph(struct _fbg* pFBG, t_raw_text_glyph_atlas* pAtlas, int iCharIndex, int x, int y)
+{
+   if ( NULL == pFBG || NULL == pAtlas || NULL == pAtlas->pPixels )
+      return;
+   if ( iCharIndex < 0 || iCharIndex >= MAX_FONT_CHARS || pAtlas->iGlyphOffset[iCharIndex] < 0 )
+      return;
+   RenderEngineRawFontChar* pChar = &(pAtlas->pFont->chars[iCharIndex]);
+   _raw_text_blit(pFBG, pAtlas->pPixels + pAtlas->iGlyphOffset[iCharIndex], pChar->width, pChar->height, x, y);
+}
+
+void RenderEngineRawTextCache::drawSpan(struct _fbg* pFBG, t_raw_text_span* pSpan, int x, int y)
+{
+   if ( NULL == pFBG || NULL == pSpan || NULL == pSpan->pPixels )
+      return;
+   _raw_text_blit(pFBG, pSpan->pPixels, pSpan->iWidth, pSpan->iHeight, x, y);
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include "render_engine_raw.h"
+
+// Text caches for the raw renderer.
+// Glyph atlases: the font glyphs pre-multiplied with a text color (and the outline removed, if needed),
+// stored as premultiplied alpha so drawing a glyph is a single multiply-add per channel.
+// Text spans: whole strings laid out and composed from an atlas into one premultiplied image,
+// drawn with a single blit. Both are kept in LRU caches keyed by font, color and string.
+// Text advances (the width queries) are cached by font and string only.
+
+#define RAW_TEXT_CACHE_MAX_ATLASES 24
+#define RAW_TEXT_CACHE_MAX_SPANS 384
+#define RAW_TEXT_CACHE_MAX_SPANS_MEMORY (6*1024*1024)
+#define RAW_TEXT_CACHE_MAX_ADVANCES 512
+#define RAW_TEXT_CACHE_MAX_TEXT_LENGTH 95
+#define RAW_TEXT_CACHE_HASH_SIZE 1024
+
+typedef struct
+{
+   u32 uFontId;
+   u32 uColor; // RGBA, 8 bits each
+   bool bNoOutline;
+   RenderEngineRawFont* pFont;
+   u8* pPixels; // premultiplied R,G,B and alpha, each glyph stored compact (width x height)
+   int iGlyphOffset[MAX_FONT_CHARS]; // offset in pPixels of each glyph, -1 for empty glyphs
+   u32 uLastUsed;
+} t_raw_text_glyph_atlas;
+
+typedef struct
+{
+   u32 uHash;
+   u32 uFontId;
+   u32 uColor;
+   bool bNoOutline;
+   char szText[RAW_TEXT_CACHE_MAX_TEXT_LENGTH+1];
+   int iWidth; // pixels, of the composed image
+   int iHeight;
+   int iAdvance; // pixels, the x distance to the next text
+   int iGlyphsCount;
+   u16 uGlyphX[RAW_TEXT_CACHE_MAX_TEXT_LENGTH]; // glyph positions in the span
+   u8* pPixels; // premultiplied R,G,B and alpha, iWidth x iHeight
+   u32 uLastUsed;
+   int iNextInHash;
+} t_raw_text_span;
+
+typedef struct
+{
+   u32 uHash;
+   u32 uFontId;
+   char szText[RAW_TEXT_CACHE_MAX_TEXT_LENGTH+1];
+   int iAdvance; // sum of char advances, in pixels
+   int iCharsCount; // count of chars present in the font
+   u32 uLastUsed;
+   int iNextInHash;
+} t_raw_text_advance;
+
+typedef struct
+{
+   u32 uAtlasHits;
+   u32 uAtlasMisses;
+   u32 uSpanHits;
+   u32 uSpanMisses;
+   u32 uAdvanceHits;
+   u32 uAdvanceMisses;
+   u32 uSpansMemory;
+} t_raw_text_cache_stats;
+
+class RenderEngineRawTextCache
+{
+   public:
+      RenderEngineRawTextCache();
+      ~RenderEngineRawTextCache();
+
+      void clear();
+      void removeFont(u32 uFontId);
+
+      // Returns false if the text is too long to be cached; the caller computes it directly
+      bool getTextAdvance(u32 uFontId, RenderEngineRawFont* pFont, const char* szText, int* piAdvance, int* piCharsCount);
+
+      t_raw_text_glyph_atlas* getGlyphAtlas(u32 uFontId, RenderEngineRawFont* pFont, u8* pColor, bool bNoOutline);
+      // Returns NULL if the text is too long to be cached or has nothing to draw
+      t_raw_text_span* getTextSpan(u32 uFontId, RenderEngineRawFont* pFont, u8* pColor, bool bNoOutline, float fDxLetters, const char* szText);
+
+      t_raw_text_cache_stats* getStats();
+
+      static void drawGlyph(struct _fbg* pFBG, t_raw_text_glyph_atlas* pAtlas, int iCharIndex, int x, int y);
+      static void drawSpan(struct _fbg* pFBG, t_raw_text_span* pSpan, int x, int y);
+
+   protected:
+      u32 _hashText(u32 uSeed, const char* szText);
+      void _buildAtlas(t_raw_text_glyph_atlas* pAtlas);
+      bool _buildSpan(t_raw_text_span* pSpan, t_raw_text_glyph_atlas* pAtlas, float fDxLetters);
+      void _freeSpan(int iIndex);
+      void _unlinkAdvance(int iIndex);
+
+      u32 m_uUseCounter;
+
+      t_raw_text_glyph_atlas m_Atlases[RAW_TEXT_CACHE_MAX_ATLASES];
+      int m_iCountAtlases;
+
+      t_raw_text_span* m_pSpans; // slots with no pixels are free
+      int m_iSpansHash[RAW_TEXT_CACHE_HASH_SIZE];
+
+      t_raw_text_advance* m_pAdvances;
+      int m_iAdvancesHash[RAW_TEXT_CACHE_HASH_SIZE];
+      int m_iCountAdvances;
+
+      t_raw_text_cache_stats m_Stats;
+};
@@ -0,0 +1,205 @@
+/*
+You can use this C/C++ code however you wish (for example, but not limited to:
+     as is, or by modifying it, or by adding new code, or by removing parts of the code;
+     in public or private projects, in new free or commercial products) 
+     only if you get a priori written consent from Petru Soroaga (petrusoroaga@yahoo.com) for your specific use
+     and only if this copyright terms are preserved in the code.
+     This code is public for learning and academic purposes.
+Also, check the licences folder for additional licences terms.
+Code written by: Petru Soroaga, 2021-2023
+*/
+
+#include "render_screenshot.h"
+// Only the C API: lodepng.c is built as C
+#define LODEPNG_NO_COMPILE_CPP
+#include "lodepng.h"
+
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+typedef struct
+{
+   u8* pRGBA;
+   int iWidth;
+   int iHeight;
+   char szFile[256];
+} t_render_screenshot_request;
+
+static t_render_screenshot_request s_ScreenshotQueue[RENDER_SCREENSHOT_QUEUE_SIZE];
+static int s_iScreenshotQueueStart = 0;
+static int s_iScreenshotQueueCount = 0;
+static bool s_bScreenshotWriterBusy = false;
+static bool s_bScreenshotWriterStarted = false;
+static bool s_bScreenshotWriterQuit = false;
+
+static pthread_t s_ScreenshotWriterThread;
+static pthread_mutex_t s_ScreenshotMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t s_ScreenshotCondRequest = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t s_ScreenshotCondIdle = PTHREAD_COND_INITIALIZER;
+
+static t_render_screenshot_stats s_ScreenshotStats;
+
+static bool _render_screenshot_write(t_render_screenshot_request* pRequest)
+{
+   u8* pPNG = NULL;
+   size_t uPNGSize = 0;
+   unsigned uError = lodepng_encode32(&pPNG, &uPNGSize, pRequest->pRGBA, pRequest->iWidth, pRequest->iHeight);
+   if ( 0 != uError )
+   {
+      log_softerror_and_alarm("[Screenshot] Failed to encode PNG (%s)", lodepng_error_text(uError));
+      if ( NULL != pPNG )
+         free(pPNG);
+      return false;
+   }
+
+   char szTmpFile[300];
+   snprintf(szTmpFile, sizeof(szTmpFile), "%s.tmp", pRequest->szFile);
+   FILE* fd = fopen(szTmpFile, "wb");
+   bool bOk = (NULL != fd);
+   if ( bOk )
+   {
+      bOk = (uPNGSize == fwrite(pPNG, 1, uPNGSize, fd));
+      if ( 0 != fclose(fd) )
+         bOk = false;
+   }
+   free(pPNG);
+
+   if ( bOk && 0 != rename(szTmpFile, pRequest->szFile) )
+      bOk = false;
+   if ( ! bOk )
+   {
+      log_softerror_and_alarm("[Screenshot] Failed to write file %s", pRequest->szFile);
+      unlink(szTmpFile);
+   }
+   return bOk;
+}
+
+static void* _render_screenshot_thread(void* pParam)
+{
+   // Below the UI/render thread: the encoding uses the idle CPU time only
+   setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), RENDER_SCREENSHOT_THREAD_NICE);
+
+   pthread_mutex_lock(&s_ScreenshotMutex);
+   while ( true )
+   {
+      while ( 0 == s_iScreenshotQueueCount && ! s_bScreenshotWriterQuit )
+         pthread_cond_wait(&s_ScreenshotCondRequest, &s_ScreenshotMutex);
+      if ( 0 == s_iScreenshotQueueCount )
+         break;
+
+      t_render_screenshot_request request = s_ScreenshotQueue[s_iScreenshotQueueStart];
+      s_iScreenshotQueueStart = (s_iScreenshotQueueStart+1) % RENDER_SCREENSHOT_QUEUE_SIZE;
+      s_iScreenshotQueueCount--;
+      s_bScreenshotWriterBusy = true;
+      pthread_mutex_unlock(&s_ScreenshotMutex);
+
+      u32 uTimeStart = get_current_timestamp_ms();
+      bool bOk = _render_screenshot_write(&request);
+      free(request.pRGBA);
+      u32 uTime = get_current_timestamp_ms() - uTimeStart;
+      if ( bOk )
+         log_line("[Screenshot] Saved %s (%d x %d) in %u ms", request.szFile, request.iWidth, request.iHeight, uTime);
+
+      pthread_mutex_lock(&s_ScreenshotMutex);
+      s_bScreenshotWriterBusy = false;
+      s_ScreenshotStats.uLastEncodeTimeMs = uTime;
+      if ( bOk )
+         s_ScreenshotStats.uSaved++;
+      else
+         s_ScreenshotStats.uFailed++;
+      if ( 0 == s_iScreenshotQueueCount )
+         pthread_cond_broadcast(&s_ScreenshotCondIdle);
+   }
+   pthread_cond_broadcast(&s_ScreenshotCondIdle);
+   pthread_mutex_unlock(&s_ScreenshotMutex);
+   return NULL;
+}
+
+bool render_screenshot_writer_start()
+{
+   if ( s_bScreenshotWriterStarted )
+      return true;
+   s_iScreenshotQueueStart = 0;
+   s_iScreenshotQueueCount = 0;
+   s_bScreenshotWriterBusy = false;
+   s_bScreenshotWriterQuit = false;
+   if ( 0 != pthread_create(&s_ScreenshotWriterThread, NULL, &_render_screenshot_thread, NULL) )
+   {
+      log_softerror_and_alarm("[Screenshot] Failed to create the writer thread.");
+      return false;
+   }
+   s_bScreenshotWriterStarted = true;
+   log_line("[Screenshot] Started the writer thread.");
+   return true;
+}
+
+void render_screenshot_writer_stop()
+{
+   if ( ! s_bScreenshotWriterStarted )
+      return;
+   pthread_mutex_lock(&s_ScreenshotMutex);
+   s_bScreenshotWriterQuit = true;
+   pthread_cond_signal(&s_ScreenshotCondRequest);
+   pthread_mutex_unlock(&s_ScreenshotMutex);
+   pthread_join(s_ScreenshotWriterThread, NULL);
+   s_bScreenshotWriterStarted = false;
+   log_line("[Screenshot] Stopped the writer thread (saved: %u, failed: %u, rejected: %u).",
+      s_ScreenshotStats.uSaved, s_ScreenshotStats.uFailed, s_ScreenshotStats.uRejected);
+}
+
+bool render_screenshot_writer_add(u8* pRGBA, int iWidth, int iHeight, const char* szFile)
+{
+   if ( NULL == pRGBA )
+      return false;
+   if ( (! s_bScreenshotWriterStarted) && (! render_screenshot_writer_start()) )
+   {
+      free(pRGBA);
+      return false;
+   }
+
+   pthread_mutex_lock(&s_ScreenshotMutex);
+   if ( s_iScreenshotQueueCount >= RENDER_SCREENSHOT_QUEUE_SIZE )
+   {
+      s_ScreenshotStats.uRejected++;
+      pthread_mutex_unlock(&s_ScreenshotMutex);
+      free(pRGBA);
+      log_softerror_and_alarm("[Screenshot] Writer queue is full, screenshot %s skipped.", szFile);
+      return false;
+   }
+   t_render_screenshot_request* pRequest = &s_ScreenshotQueue[(s_iScreenshotQueueStart + s_iScreenshotQueueCount) % RENDER_SCREENSHOT_QUEUE_SIZE];
+   pRequest->pRGBA = pRGBA;
+   pRequest->iWidth = iWidth;
+   pRequest->iHeight = iHeight;
+   strncpy(pRequest->szFile, szFile, sizeof(pRequest->szFile)-1);
+   pRequest->szFile[sizeof(pRequest->szFile)-1] = 0;
+   s_iScreenshotQueueCount++;
+   s_ScreenshotStats.uQueued++;
+   pthread_cond_signal(&s_ScreenshotCondRequest);
+   pthread_mutex_unlock(&s_ScreenshotMutex);
+   return true;
+}
+
+int render_screenshot_writer_get_pending()
+{
+   pthread_mutex_lock(&s_ScreenshotMutex);
+   int iPending = s_iScreenshotQueueCount + (s_bScreenshotWriterBusy?1:0);
+   pthread_mutex_unlock(&s_ScreenshotMutex);
+   return iPending;
+}
+
+void render_screenshot_writer_wait_idle()
+{
+   if ( ! s_bScreenshotWriterStarted )
+      return;
+   pthread_mutex_lock(&s_ScreenshotMutex);
+   while ( s_iScreenshotQueueCount > 0 || s_bScreenshotWriterBusy )
+      pthread_cond_wait(&s_ScreenshotCondIdle, &s_ScreenshotMutex);
+   pthread_mutex_unlock(&s_ScreenshotMutex);
+}
+
+t_render_screenshot_stats* render_screenshot_writer_get_stats()
+{
+   return &s_ScreenshotStats;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "../base/base.h"
+
+// Background PNG writer for the screenshots.
+// The render loop only copies the screen (RenderEngine::captureFrame) and queues it; the PNG encoding and
+// the file write run on a low priority thread. The queue is bounded: when it is full, new screenshots
+// are rejected instead of blocking the caller. Files are written to a temporary name and renamed when
+// complete, so a partial PNG never shows up in the media folder.
+
+#define RENDER_SCREENSHOT_QUEUE_SIZE 2
+#define RENDER_SCREENSHOT_THREAD_NICE 10
+
+typedef struct
+{
+   u32 uQueued;
+   u32 uRejected; // queue full
+   u32 uSaved;
+   u32 uFailed;
+   u32 uLastEncodeTimeMs;
+} t_render_screenshot_stats;
+
+bool render_screenshot_writer_start();
+// Waits for the queued screenshots to be written
+void render_screenshot_writer_stop();
+
+// Takes ownership of pRGBA (malloc-ed, iWidth x iHeight x 4 bytes), also when it fails (queue full)
+bool render_screenshot_writer_add(u8* pRGBA, int iWidth, int iHeight, const char* szFile);
+int render_screenshot_writer_get_pending();
+void render_screenshot_writer_wait_idle();
+t_render_screenshot_stats* render_screenshot_writer_get_stats();